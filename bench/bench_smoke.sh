@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+# Smoke test of cpc_bench and lib_bench: echo runs of several sizes in a row,
+# each size reopening the endpoints, with frame counts that aren't a multiple of
+# the 8 sequence numbers, with and without aggregation.
+#
+# Usage: bench_smoke.sh <build directory>
+
+set -e
+
+BUILD_DIR=$1
+INSTANCE=bench_smoke_$$
+WORK_DIR=$(mktemp -d)
+SOCKET=/dev/shm/cpcd/$INSTANCE/ctrl.cpcd.sock
+DAEMON_PID=
+
+cleanup()
+{
+  if [ -n "$DAEMON_PID" ]; then
+    kill "$DAEMON_PID" 2>/dev/null || true
+    wait "$DAEMON_PID" 2>/dev/null || true
+  fi
+  rm -rf "$WORK_DIR" "/dev/shm/cpcd/$INSTANCE"
+}
+trap cleanup EXIT
+
+cat > "$WORK_DIR/cpcd.conf" << EOF
+instance_name: $INSTANCE
+bus_type: EMUL
+emul_mode: ECHO
+disable_encryption: true
+tx_window_size: 4
+EOF
+
+"$BUILD_DIR/cpc_bench" -c "$WORK_DIR/cpcd.conf" > "$WORK_DIR/cpc_bench.log" 2>&1 &
+DAEMON_PID=$!
+
+i=0
+while [ ! -S "$SOCKET" ]; do
+  i=$((i + 1))
+  if [ $i -gt 50 ] || ! kill -0 "$DAEMON_PID" 2>/dev/null; then
+    cat "$WORK_DIR/cpc_bench.log"
+    exit 1
+  fi
+  sleep 0.1
+done
+
+"$BUILD_DIR/lib_bench" -i "$INSTANCE" -m echo -s 16,200,64 -n 20 -w 4
+"$BUILD_DIR/lib_bench" -i "$INSTANCE" -m echo -s 16,200,64 -n 21 -w 4 -c 2 -e 2 -a 300
@@ -0,0 +1,518 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - core hot path micro-benchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the primitives on the path of every frame in isolation: the CRC,
+ * building and parsing HDLC headers, the lists the queues are made of, the
+ * encryption when it is built in, the frame traces, and a core_write() with
+ * its flush to the emul driver, acknowledged by the emulated secondary of the
+ * EMUL bus in SINK mode.
+ *
+ * The daemon is linked in without its main(), the bench runs the event loop
+ * of the core itself. Allocations are counted by wrapping the allocator at
+ * link time, cycles by the CPU cycles counter of the calling thread, when
+ * perf events are available. The emul driver thread is left out of both.
+ *
+ * Output, one line per run:
+ * <primitive> <bytes, or depth of the list> <ns per operation> <cycles per operation> <cycles per byte> <allocations per operation>
+ * with "-" for the cycles when there's no counter, and for the cycles per byte
+ * of the lists.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/sl_slist.h"
+#include "misc/sl_queue.h"
+#include "misc/utils.h"
+#include "driver/driver_emul.h"
+#include "server_core/core/core.h"
+#include "server_core/core/crc.h"
+#include "server_core/core/hdlc.h"
+#include "server_core/epoll/epoll.h"
+
+#if defined(ENABLE_ENCRYPTION)
+#include "security/security.h"
+#include "security/private/keys/keys.h"
+#endif
+
+#define BENCH_ENDPOINT      90u
+#define BENCH_TX_WINDOW     1u
+#define BENCH_MAX_SIZE      4087u
+#define BENCH_MAX_DEPTH     256u
+#define MAX_EPOLL_EVENTS    4
+
+#define CRC_OPERATIONS      200000u
+#define HDLC_OPERATIONS     1000000u
+#define LIST_OPERATIONS     1000000u
+#define SECURITY_OPERATIONS 50000u
+#define TRACE_BATCHES       200u
+/* Half the buffer of the async loggers, for the traces not to be lost */
+#define TRACE_BATCH_BYTES   (7u * 4096u / 2u)
+#define CORE_OPERATIONS     20000u
+
+/* The symbols of main.c the daemon sources refer to */
+pthread_t main_thread = 0;
+pthread_t driver_thread = 0;
+pthread_t server_core_thread = 0;
+pthread_t security_thread = 0;
+char **argv_g = 0;
+int argc_g = 0;
+
+__attribute__((noreturn)) void software_graceful_exit(void);
+void main_wait_crash_or_graceful_exit(void);
+
+__attribute__((noreturn)) void signal_crash(void)
+{
+  exit(EXIT_FAILURE);
+}
+
+__attribute__((noreturn)) void software_graceful_exit(void)
+{
+  exit(EXIT_SUCCESS);
+}
+
+void main_wait_crash_or_graceful_exit(void)
+{
+  BUG("The benchmark never runs a mode");
+}
+
+/*
+ * Linked with --wrap for every allocation to go through these. Only those of
+ * the thread running the bench are counted.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+static uint64_t allocations;
+
+static void bench_count_allocation(void)
+{
+  if (pthread_equal(pthread_self(), main_thread)) {
+    allocations++;
+  }
+}
+
+void *__wrap_malloc(size_t size)
+{
+  bench_count_allocation();
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+  bench_count_allocation();
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  bench_count_allocation();
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+  __real_free(ptr);
+}
+
+typedef struct {
+  uint64_t ns;
+  uint64_t cycles;
+  uint64_t allocations;
+} bench_sample_t;
+
+typedef struct {
+  sl_slist_node_t node;
+  uint32_t value;
+} bench_item_t;
+
+static const uint16_t sizes[] = { 16, 64, 256, 1024, BENCH_MAX_SIZE };
+static uint8_t payload[BENCH_MAX_SIZE];
+#if defined(ENABLE_ENCRYPTION)
+static uint8_t output[BENCH_MAX_SIZE];
+#endif
+static bench_item_t items[BENCH_MAX_DEPTH + 1];
+static int fd_cycles = -1;
+static volatile uint32_t sink;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* The cycles of the calling thread only, the emul driver thread is not counted */
+static void cycles_init(void)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.exclude_hv = 1;
+
+  fd_cycles = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (fd_cycles < 0) {
+    fprintf(stderr, "No cycles counter (%s), reporting time only\n", strerror(errno));
+  }
+}
+
+static uint64_t cycles_read(void)
+{
+  uint64_t cycles = 0;
+
+  if (fd_cycles >= 0 && read(fd_cycles, &cycles, sizeof(cycles)) != sizeof(cycles)) {
+    cycles = 0;
+  }
+
+  return cycles;
+}
+
+static void bench_begin(bench_sample_t *sample)
+{
+  sample->allocations = allocations;
+  sample->cycles = cycles_read();
+  sample->ns = now_ns();
+}
+
+static void bench_end(bench_sample_t *sample)
+{
+  sample->ns = now_ns() - sample->ns;
+  sample->cycles = cycles_read() - sample->cycles;
+  sample->allocations = allocations - sample->allocations;
+}
+
+static void bench_report(const char *primitive, size_t size, bool per_byte, uint32_t operations, const bench_sample_t *sample)
+{
+  double cycles = (double)sample->cycles / operations;
+
+  printf("%s %zu %.1f ", primitive, size, (double)sample->ns / operations);
+
+  if (fd_cycles < 0) {
+    printf("- - ");
+  } else if (!per_byte) {
+    printf("%.1f - ", cycles);
+  } else {
+    printf("%.1f %.2f ", cycles, cycles / (double)size);
+  }
+
+  printf("%.3f\n", (double)sample->allocations / operations);
+}
+
+static void bench_crc(void)
+{
+  bench_sample_t sample;
+  size_t s;
+  uint32_t i;
+
+  for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+    bench_begin(&sample);
+    for (i = 0; i < CRC_OPERATIONS; i++) {
+      sink += sli_cpc_get_crc_sw(payload, sizes[s]);
+    }
+    bench_end(&sample);
+
+    bench_report("sli_cpc_get_crc_sw", sizes[s], true, CRC_OPERATIONS, &sample);
+  }
+}
+
+static void bench_hdlc(void)
+{
+  uint8_t header[SLI_CPC_HDLC_HEADER_RAW_SIZE];
+  bench_sample_t sample;
+  uint32_t i;
+
+  bench_begin(&sample);
+  for (i = 0; i < HDLC_OPERATIONS; i++) {
+    uint8_t control = hdlc_create_control_data((uint8_t)(i & 7u), (uint8_t)((i >> 3) & 7u), false);
+
+    hdlc_create_header(header, BENCH_ENDPOINT, (uint16_t)(64u + SLI_CPC_HDLC_FCS_SIZE), control, true);
+    sink += header[SLI_CPC_HDLC_HEADER_RAW_SIZE - 1];
+  }
+  bench_end(&sample);
+
+  bench_report("hdlc_create_header", SLI_CPC_HDLC_HEADER_RAW_SIZE, true, HDLC_OPERATIONS, &sample);
+
+  /* What the core reads of every received header */
+  bench_begin(&sample);
+  for (i = 0; i < HDLC_OPERATIONS; i++) {
+    uint8_t control;
+
+    header[SLI_CPC_HDLC_HEADER_RAW_SIZE - 1] = (uint8_t)i;
+
+    control = hdlc_get_control(header);
+    sink += (uint32_t)(hdlc_get_flag(header) + hdlc_get_address(header) + hdlc_get_length(header) + hdlc_get_hcs(header)
+                       + hdlc_get_frame_type(control) + hdlc_get_seq(control) + hdlc_get_ack(control)
+                       + hdlc_is_poll_final(control));
+  }
+  bench_end(&sample);
+
+  bench_report("hdlc_get", SLI_CPC_HDLC_HEADER_RAW_SIZE, true, HDLC_OPERATIONS, &sample);
+}
+
+static void bench_lists(void)
+{
+  bench_sample_t sample;
+  size_t depth;
+  uint32_t i;
+
+  /* bench/queue_bench sweeps deeper, these are the depths the core runs at */
+  for (depth = 1; depth <= BENCH_MAX_DEPTH; depth *= 16) {
+    sl_slist_node_t *head;
+    sl_queue_t queue;
+
+    sl_slist_init(&head);
+    for (i = 0; i <= depth; i++) {
+      sl_slist_push(&head, &items[i].node);
+    }
+
+    bench_begin(&sample);
+    for (i = 0; i < LIST_OPERATIONS; i++) {
+      sl_slist_node_t *node = sl_slist_pop(&head);
+      sl_slist_push(&head, node);
+    }
+    bench_end(&sample);
+
+    bench_report("sl_slist_push_pop", depth, false, LIST_OPERATIONS, &sample);
+
+    sl_queue_init(&queue);
+    for (i = 0; i <= depth; i++) {
+      sl_queue_push_back(&queue, &items[i].node);
+    }
+
+    bench_begin(&sample);
+    for (i = 0; i < LIST_OPERATIONS; i++) {
+      sl_slist_node_t *node = sl_queue_pop(&queue);
+      sl_queue_push_back(&queue, node);
+    }
+    bench_end(&sample);
+
+    bench_report("sl_queue_push_back_pop", depth, false, LIST_OPERATIONS, &sample);
+  }
+}
+
+#if defined(ENABLE_ENCRYPTION)
+/*
+ * A session key is derived from fixed randoms, as it would be from those of
+ * the session init. The frames are decrypted with the nonce of the secondary,
+ * so the tag check of those encrypted by the primary fails: the GCM pass over
+ * the payload happens nonetheless, the cost is the same.
+ */
+static void bench_security(void)
+{
+  uint8_t random1[SESSION_INIT_RANDOM_LENGTH_BYTES] = { 1 };
+  uint8_t random2[SESSION_INIT_RANDOM_LENGTH_BYTES] = { 2 };
+  uint8_t header[SLI_CPC_HDLC_HEADER_RAW_SIZE];
+  uint8_t tag[TAG_LENGTH_BYTES];
+  sl_cpc_endpoint_t ep;
+  bench_sample_t sample;
+  size_t s;
+  uint32_t i;
+
+  security_keys_init();
+  security_compute_session_key_and_id(random1, random2);
+  security_session_initialized = true;
+
+  memset(&ep, 0, sizeof(ep));
+  ep.id = BENCH_ENDPOINT;
+
+  for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+    hdlc_create_header(header, BENCH_ENDPOINT, (uint16_t)(sizes[s] + TAG_LENGTH_BYTES + SLI_CPC_HDLC_FCS_SIZE),
+                       hdlc_create_control_data(0, 0, false), true);
+
+    bench_begin(&sample);
+    for (i = 0; i < SECURITY_OPERATIONS; i++) {
+      sl_cpc_security_frame_t sec_frame = { .frame_counter = ep.frame_counter_tx };
+      sl_status_t status = security_encrypt(&ep, &sec_frame, header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
+                                            payload, sizes[s], output, tag, sizeof(tag));
+      FATAL_ON(status != SL_STATUS_OK);
+    }
+    bench_end(&sample);
+
+    bench_report("security_encrypt", sizes[s], true, SECURITY_OPERATIONS, &sample);
+
+    bench_begin(&sample);
+    for (i = 0; i < SECURITY_OPERATIONS; i++) {
+      sink += (uint32_t)security_decrypt(&ep, header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
+                                         output, sizes[s], payload, tag, sizeof(tag));
+    }
+    bench_end(&sample);
+
+    bench_report("security_decrypt", sizes[s], true, SECURITY_OPERATIONS, &sample);
+  }
+}
+#endif
+
+/* With frame traces disabled, then to a trace file in a temporary folder */
+static void bench_trace_frame(void)
+{
+  char traces_folder[] = "/tmp/core_bench.XXXXXX";
+  bench_sample_t sample;
+  size_t s;
+  uint32_t i;
+
+  bench_begin(&sample);
+  for (i = 0; i < HDLC_OPERATIONS; i++) {
+    trace_frame("Core : Sent frame", payload, 64);
+  }
+  bench_end(&sample);
+
+  bench_report("trace_frame_disabled", 64, true, HDLC_OPERATIONS, &sample);
+
+  FATAL_SYSCALL_ON(mkdtemp(traces_folder) == NULL);
+  config.traces_folder = traces_folder;
+  config.file_tracing = true;
+  config.enable_frame_trace = true;
+  init_file_logging();
+
+  for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+    /* A trace is about three characters per byte */
+    uint32_t batch = TRACE_BATCH_BYTES / (3u * sizes[s] + 64u) + 1u;
+    bench_sample_t total = { 0 };
+    uint32_t b;
+
+    for (b = 0; b < TRACE_BATCHES; b++) {
+      bench_begin(&sample);
+      for (i = 0; i < batch; i++) {
+        trace_frame("Core : Sent frame", payload, sizes[s]);
+      }
+      bench_end(&sample);
+
+      total.ns += sample.ns;
+      total.cycles += sample.cycles;
+      total.allocations += sample.allocations;
+
+      /* Let the file logger drain, off the clock */
+      usleep(5000);
+    }
+
+    bench_report("trace_frame", sizes[s], true, TRACE_BATCHES * batch, &total);
+  }
+
+  config.file_tracing = false;
+  config.enable_frame_trace = false;
+  printf("# traces in %s\n", traces_folder);
+}
+
+/* One turn of the event loop of server_core */
+static void bench_core_dispatch(void)
+{
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  size_t event_count;
+  size_t i;
+
+  event_count = epoll_wait_for_event(events, MAX_EPOLL_EVENTS);
+
+  for (i = 0; i < event_count; i++) {
+    epoll_private_data_t *private_data = (epoll_private_data_t *)events[i].data.ptr;
+
+    private_data->ready_events = events[i].events;
+    private_data->callback(private_data);
+  }
+}
+
+static void bench_core_write(void)
+{
+  int fd_socket_driver_core;
+  int fd_socket_driver_core_notify;
+  bench_sample_t sample;
+  size_t s;
+  uint32_t i;
+
+  config.bus = EMUL;
+  config.emul_mode = EMUL_MODE_SINK;
+  config.emul_bitrate = 0;
+  config.emul_latency_us = 0;
+  config.emul_loss_per_mille = 0;
+
+  driver_thread = driver_emul_init(&fd_socket_driver_core, &fd_socket_driver_core_notify);
+
+  core_init(fd_socket_driver_core, fd_socket_driver_core_notify);
+  core_init_buffer_pools();
+  core_open_endpoint(BENCH_ENDPOINT, 0, BENCH_TX_WINDOW, false);
+
+  /* The frames the secondary accepts, see server_core_get_secondary_rx_capability() */
+  for (s = 0; s < ARRAY_SIZE(sizes) && sizes[s] <= 1024u; s++) {
+    bench_begin(&sample);
+    for (i = 0; i < CORE_OPERATIONS; i++) {
+      while (core_get_endpoint_tx_credit(BENCH_ENDPOINT) == 0) {
+        bench_core_dispatch();
+      }
+
+      core_write(BENCH_ENDPOINT, payload, sizes[s], 0);
+      core_process_transmit_queue();
+    }
+
+    /* Until the last frame is acknowledged */
+    while (core_get_endpoint_tx_credit(BENCH_ENDPOINT) != BENCH_TX_WINDOW) {
+      bench_core_dispatch();
+    }
+    bench_end(&sample);
+
+    bench_report("core_write", sizes[s], true, CORE_OPERATIONS, &sample);
+  }
+}
+
+int main(void)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(payload); i++) {
+    payload[i] = (uint8_t)i;
+  }
+
+  main_thread = pthread_self();
+
+  logging_init();
+  epoll_init();
+  cycles_init();
+
+  bench_crc();
+  bench_hdlc();
+  bench_lists();
+#if defined(ENABLE_ENCRYPTION)
+  bench_security();
+#endif
+  bench_trace_frame();
+  bench_core_write();
+
+  return 0;
+}
@@ -0,0 +1,565 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Library benchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the daemon end to end through libcpc. Each client is a process,
+ * libcpc registering one per pid, and each of its endpoints runs in a thread
+ * of its own, on an endpoint of its own: client c, endpoint e gets the id
+ * base + c * endpoints + e.
+ * The modes:
+ * - echo:  frames of the given sizes go out with up to in_flight of them
+ *          waiting for their echo, the round trip of each is measured from its
+ *          write to the read of its echo. The secondary must echo the frames,
+ *          like cpc_bench with emul_mode: ECHO does
+ * - sink:  the frames only go out, the run ends once the daemon has none left
+ *          to send, its transmit credit back to the full window
+ * - churn: the endpoints are opened and closed over and over, the latency is
+ *          the one of an open and close pair
+ *
+ * When the pid of the daemon is given, its CPU time is read from /proc, the
+ * thread of the emulated secondary of cpc_bench left out. With an aggregation
+ * deadline, the endpoints aggregate their writes, which an echo run with a
+ * single frame in flight holds for the whole deadline.
+ *
+ * Usage: lib_bench [-i instance] [-m echo|sink|churn] [-s size[,size...]]
+ *                  [-n frames] [-w in_flight] [-c clients] [-e endpoints]
+ *                  [-b base id] [-p daemon pid] [-a deadline us] [-l label]
+ * Output, a header then one line per size:
+ * <label> <mode> <size> <clients> <endpoints> <operations> <per second> <kB per second> <p50 us> <p99 us> <p999 us> <daemon CPU us per operation>
+ * An operation is a frame, or an open and close pair. The label, "-" by
+ * default, stands for the daemon version or the bus configuration, for runs to
+ * be diffed against each other.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "sl_cpc.h"
+
+#define MAX_SIZES           16u
+#define MAX_FRAME_SIZE      4087u
+#define READ_TIMEOUT_S      5
+
+typedef enum {
+  BENCH_ECHO,
+  BENCH_SINK,
+  BENCH_CHURN
+} bench_mode_t;
+
+typedef struct {
+  pthread_t thread;
+  cpc_handle_t handle;
+  uint8_t endpoint_id;
+  uint64_t *latencies;   // One per operation
+} bench_worker_t;
+
+static const char *instance = "cpcd_0";
+static const char *label = "-";
+static bench_mode_t mode = BENCH_ECHO;
+static size_t sizes[MAX_SIZES] = { 64 };
+static size_t size_count = 1;
+static uint32_t operations = 10000;
+static uint32_t in_flight = 1;
+static uint32_t clients = 1;
+static uint32_t endpoints = 1;
+static uint8_t base_id = SL_CPC_ENDPOINT_USER_ID_0;
+static long daemon_pid;
+static uint32_t aggregation_deadline_us;
+static pid_t parent_pid;
+
+static size_t frame_size;
+
+/* Shared with the client processes */
+static struct {
+  pthread_barrier_t barrier;  // Every endpoint is open, then every worker done
+  uint64_t latencies[];       // One per operation, operations per worker
+} *shared;
+
+static const char *mode_names[] = { "echo", "sink", "churn" };
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_us(uint64_t us)
+{
+  struct timespec ts = { .tv_sec = (time_t)(us / 1000000u), .tv_nsec = (long)(us % 1000000u) * 1000 };
+
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+static void fail(const char *what, long ret)
+{
+  fprintf(stderr, "%s: %ld (%s)\n", what, ret, strerror((int)(ret < 0 ? -ret : ret)));
+
+  // The others would wait for this client at the barrier forever
+  if (getpid() != parent_pid) {
+    kill(parent_pid, SIGTERM);
+  }
+  exit(EXIT_FAILURE);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* CPU time of the daemon threads in ns, the emulated secondary left out */
+static uint64_t daemon_cpu_ns(void)
+{
+  char path[64];
+  char comm[32];
+  unsigned long long cpu_ns;
+  uint64_t total = 0;
+  struct dirent *entry;
+  FILE *file;
+  DIR *dir;
+
+  if (daemon_pid <= 0) {
+    return 0;
+  }
+
+  snprintf(path, sizeof(path), "/proc/%ld/task", daemon_pid);
+  dir = opendir(path);
+  if (dir == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%ld/task/%.16s/comm", daemon_pid, entry->d_name);
+    file = fopen(path, "r");
+    if (file == NULL) {
+      continue;
+    }
+    if (fgets(comm, sizeof(comm), file) == NULL) {
+      comm[0] = '\0';
+    }
+    fclose(file);
+    if (strncmp(comm, "emul_drv_thread", strlen("emul_drv_thread")) == 0) {
+      continue;
+    }
+
+    // The first field is the time spent on the CPU, in ns
+    snprintf(path, sizeof(path), "/proc/%ld/task/%.16s/schedstat", daemon_pid, entry->d_name);
+    file = fopen(path, "r");
+    if (file == NULL) {
+      continue;
+    }
+    if (fscanf(file, "%llu", &cpu_ns) == 1) {
+      total += cpu_ns;
+    }
+    fclose(file);
+  }
+
+  closedir(dir);
+
+  return total;
+}
+
+static void open_endpoint(bench_worker_t *worker, cpc_endpoint_t *endpoint)
+{
+  cpc_timeval_t timeout = { .seconds = READ_TIMEOUT_S, .microseconds = 0 };
+  int ret;
+
+  ret = cpc_open_endpoint(worker->handle, endpoint, worker->endpoint_id, 1);
+  if (ret < 0) {
+    fail("cpc_open_endpoint", ret);
+  }
+
+  ret = cpc_set_endpoint_read_timeout(*endpoint, timeout);
+  if (ret < 0) {
+    fail("cpc_set_endpoint_read_timeout", ret);
+  }
+
+  if (aggregation_deadline_us != 0) {
+    ret = cpc_set_endpoint_option(*endpoint, CPC_OPTION_AGGREGATION, &aggregation_deadline_us, sizeof(aggregation_deadline_us));
+    if (ret < 0) {
+      fail("cpc_set_endpoint_option", ret);
+    }
+  }
+}
+
+static void write_frame(cpc_endpoint_t endpoint, const uint8_t *frame)
+{
+  ssize_t ret = cpc_write_endpoint(endpoint, frame, frame_size, 0);
+
+  if (ret != (ssize_t)frame_size) {
+    fail("cpc_write_endpoint", (long)ret);
+  }
+}
+
+static void bench_echo(bench_worker_t *worker, cpc_endpoint_t endpoint)
+{
+  uint8_t tx_buffer[MAX_FRAME_SIZE];
+  uint8_t rx_buffer[SL_CPC_READ_MINIMUM_SIZE];
+  uint64_t *write_ns = calloc(operations, sizeof(uint64_t));
+  uint32_t sent = 0;
+  uint32_t received = 0;
+  uint32_t index;
+  ssize_t ret;
+
+  if (write_ns == NULL) {
+    fail("calloc", ENOMEM);
+  }
+
+  memset(tx_buffer, 0x5a, frame_size);
+
+  while (received < operations) {
+    while (sent < operations && sent - received < in_flight) {
+      memcpy(tx_buffer, &sent, sizeof(sent));
+      write_ns[sent] = now_ns();
+      write_frame(endpoint, tx_buffer);
+      sent++;
+    }
+
+    ret = cpc_read_endpoint(endpoint, rx_buffer, sizeof(rx_buffer), 0);
+    if (ret != (ssize_t)frame_size) {
+      fail("cpc_read_endpoint, is the secondary echoing?", (long)ret);
+    }
+
+    memcpy(&index, rx_buffer, sizeof(index));
+    if (index >= sent) {
+      fprintf(stderr, "Unexpected echo on endpoint %u\n", worker->endpoint_id);
+      exit(EXIT_FAILURE);
+    }
+    worker->latencies[received++] = now_ns() - write_ns[index];
+  }
+
+  free(write_ns);
+}
+
+static uint32_t get_tx_credit(cpc_endpoint_t endpoint)
+{
+  uint32_t tx_credit;
+  size_t length = sizeof(tx_credit);
+  int ret = cpc_get_endpoint_option(endpoint, CPC_OPTION_TX_CREDIT, &tx_credit, &length);
+
+  if (ret < 0) {
+    fail("cpc_get_endpoint_option(CPC_OPTION_TX_CREDIT)", ret);
+  }
+
+  return tx_credit;
+}
+
+static void bench_sink(cpc_endpoint_t endpoint)
+{
+  uint8_t tx_buffer[MAX_FRAME_SIZE];
+  uint32_t full_window = get_tx_credit(endpoint);
+  uint32_t i;
+
+  memset(tx_buffer, 0x5a, frame_size);
+
+  for (i = 0; i < operations; i++) {
+    memcpy(tx_buffer, &i, sizeof(i));
+    write_frame(endpoint, tx_buffer);
+  }
+
+  while (get_tx_credit(endpoint) != full_window) {
+    sleep_us(100);
+  }
+}
+
+static void bench_churn(bench_worker_t *worker)
+{
+  cpc_endpoint_t endpoint;
+  uint64_t start;
+  uint32_t i;
+  int ret;
+
+  for (i = 0; i < operations; i++) {
+    start = now_ns();
+
+    ret = cpc_open_endpoint(worker->handle, &endpoint, worker->endpoint_id, 1);
+    if (ret < 0) {
+      fail("cpc_open_endpoint", ret);
+    }
+
+    ret = cpc_close_endpoint(&endpoint);
+    if (ret < 0) {
+      fail("cpc_close_endpoint", ret);
+    }
+
+    worker->latencies[i] = now_ns() - start;
+  }
+}
+
+static void *worker_thread(void *arg)
+{
+  bench_worker_t *worker = arg;
+  cpc_endpoint_t endpoint;
+
+  if (mode != BENCH_CHURN) {
+    open_endpoint(worker, &endpoint);
+  }
+
+  (void)pthread_barrier_wait(&shared->barrier);
+
+  if (mode == BENCH_ECHO) {
+    bench_echo(worker, endpoint);
+  } else if (mode == BENCH_SINK) {
+    bench_sink(endpoint);
+  } else {
+    bench_churn(worker);
+  }
+
+  (void)pthread_barrier_wait(&shared->barrier);
+
+  if (mode != BENCH_CHURN) {
+    cpc_close_endpoint(&endpoint);
+  }
+
+  return NULL;
+}
+
+static void run_client(uint32_t client)
+{
+  bench_worker_t workers[256];
+  cpc_handle_t handle;
+  uint32_t i;
+  int ret;
+
+  ret = cpc_init(&handle, instance, false, NULL);
+  if (ret < 0) {
+    fail("cpc_init, is the daemon running?", ret);
+  }
+
+  for (i = 0; i < endpoints; i++) {
+    uint32_t worker = client * endpoints + i;
+
+    workers[i].handle = handle;
+    workers[i].endpoint_id = (uint8_t)(base_id + worker);
+    workers[i].latencies = &shared->latencies[(uint64_t)worker * operations];
+
+    ret = pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+    if (ret != 0) {
+      fail("pthread_create", ret);
+    }
+  }
+
+  for (i = 0; i < endpoints; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+}
+
+static void run(void)
+{
+  uint64_t total = (uint64_t)clients * endpoints * operations;
+  uint64_t *latencies = shared->latencies;
+  pthread_barrierattr_t attr;
+  uint64_t start;
+  uint64_t elapsed;
+  uint64_t cpu;
+  uint32_t i;
+  double ops;
+  int status;
+  int ret;
+
+  pthread_barrierattr_init(&attr);
+  pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  ret = pthread_barrier_init(&shared->barrier, &attr, clients * endpoints + 1);
+  if (ret != 0) {
+    fail("pthread_barrier_init", ret);
+  }
+  pthread_barrierattr_destroy(&attr);
+
+  fflush(stdout);
+  for (i = 0; i < clients; i++) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+      fail("fork", errno);
+    } else if (pid == 0) {
+      (void)prctl(PR_SET_PDEATHSIG, SIGTERM);
+      run_client(i);
+      _exit(EXIT_SUCCESS);
+    }
+  }
+
+  // Every endpoint is open
+  (void)pthread_barrier_wait(&shared->barrier);
+  cpu = daemon_cpu_ns();
+  start = now_ns();
+
+  // Every worker is done
+  (void)pthread_barrier_wait(&shared->barrier);
+  elapsed = now_ns() - start;
+  cpu = daemon_cpu_ns() - cpu;
+
+  for (i = 0; i < clients; i++) {
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+      fprintf(stderr, "A client failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pthread_barrier_destroy(&shared->barrier);
+
+  qsort(latencies, total, sizeof(uint64_t), compare_u64);
+
+  ops = (double)total * 1e9 / (double)elapsed;
+  printf("%s %s %zu %u %u %llu %.0f %.1f %.1f %.1f %.1f %.2f\n",
+         label,
+         mode_names[mode],
+         mode == BENCH_CHURN ? (size_t)0 : frame_size,
+         clients,
+         endpoints,
+         (unsigned long long)total,
+         ops,
+         mode == BENCH_CHURN ? 0.0 : ops * (double)frame_size / 1000.0,
+         (double)latencies[total / 2] / 1000.0,
+         (double)latencies[total * 99u / 100u] / 1000.0,
+         (double)latencies[total * 999u / 1000u] / 1000.0,
+         daemon_pid > 0 ? (double)cpu / 1000.0 / (double)total : 0.0);
+  fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-i instance] [-m echo|sink|churn] [-s size[,size...]] [-n frames] [-w in_flight]\n"
+          "          [-c clients] [-e endpoints] [-b base id] [-p daemon pid] [-a deadline us] [-l label]\n",
+          name);
+  exit(EXIT_FAILURE);
+}
+
+static void parse_sizes(const char *name, char *list)
+{
+  char *token;
+  char *save;
+
+  size_count = 0;
+  for (token = strtok_r(list, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save)) {
+    if (size_count == MAX_SIZES) {
+      usage(name);
+    }
+    sizes[size_count] = strtoul(token, NULL, 0);
+    if (sizes[size_count] < sizeof(uint32_t) || sizes[size_count] > MAX_FRAME_SIZE) {
+      fprintf(stderr, "Sizes go from %zu to %u\n", sizeof(uint32_t), MAX_FRAME_SIZE);
+      exit(EXIT_FAILURE);
+    }
+    size_count++;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  size_t shared_size;
+  uint32_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:m:s:n:w:c:e:b:p:a:l:")) != -1) {
+    switch (opt) {
+      case 'i':
+        instance = optarg;
+        break;
+      case 'm':
+        if (strcmp(optarg, "echo") == 0) {
+          mode = BENCH_ECHO;
+        } else if (strcmp(optarg, "sink") == 0) {
+          mode = BENCH_SINK;
+        } else if (strcmp(optarg, "churn") == 0) {
+          mode = BENCH_CHURN;
+        } else {
+          usage(argv[0]);
+        }
+        break;
+      case 's':
+        parse_sizes(argv[0], optarg);
+        break;
+      case 'n':
+        operations = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'w':
+        in_flight = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'c':
+        clients = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'e':
+        endpoints = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'b':
+        base_id = (uint8_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'p':
+        daemon_pid = strtol(optarg, NULL, 0);
+        break;
+      case 'a':
+        aggregation_deadline_us = (uint32_t)strtoul(optarg, NULL, 0);
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (operations == 0 || in_flight == 0 || clients == 0 || endpoints == 0 || size_count == 0
+      || (uint32_t)base_id + clients * endpoints > 256) {
+    usage(argv[0]);
+  }
+
+  parent_pid = getpid();
+  shared_size = sizeof(*shared) + (size_t)clients * endpoints * operations * sizeof(uint64_t);
+  shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    fail("mmap", errno);
+  }
+
+  printf("# label mode size clients endpoints operations per_second kB_per_second p50_us p99_us p999_us daemon_cpu_us_per_operation\n");
+
+  if (mode == BENCH_CHURN) {
+    run();
+  } else {
+    for (i = 0; i < size_count; i++) {
+      frame_size = sizes[i];
+      run();
+    }
+  }
+
+  munmap(shared, shared_size);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - queue micro-benchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the cost of an enqueue at the tail followed by a dequeue at the head
+ * on a queue kept at a fixed depth, for sl_slist and sl_queue. The sl_queue cost
+ * must stay flat as the depth grows.
+ *
+ * Output, one line per run: <implementation> <depth> <ns per enqueue+dequeue>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "misc/sl_slist.h"
+#include "misc/sl_queue.h"
+
+#define MAX_DEPTH   16384u
+#define OPERATIONS  200000u
+
+typedef struct {
+  sl_slist_node_t node;
+  uint32_t value;
+} bench_item_t;
+
+static bench_item_t items[MAX_DEPTH + 1];
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static double bench_slist(size_t depth, uint32_t operations)
+{
+  sl_slist_node_t *head;
+  uint64_t start;
+  uint32_t i;
+
+  sl_slist_init(&head);
+  for (i = 0; i <= depth; i++) {
+    sl_slist_push_back(&head, &items[i].node);
+  }
+
+  start = now_ns();
+  for (i = 0; i < operations; i++) {
+    sl_slist_node_t *node = sl_slist_pop(&head);
+    sl_slist_push_back(&head, node);
+  }
+
+  return (double)(now_ns() - start) / operations;
+}
+
+static double bench_queue(size_t depth, uint32_t operations)
+{
+  sl_queue_t queue;
+  uint64_t start;
+  uint32_t i;
+
+  sl_queue_init(&queue);
+  for (i = 0; i <= depth; i++) {
+    sl_queue_push_back(&queue, &items[i].node);
+  }
+
+  start = now_ns();
+  for (i = 0; i < operations; i++) {
+    sl_slist_node_t *node = sl_queue_pop(&queue);
+    sl_queue_push_back(&queue, node);
+  }
+
+  return (double)(now_ns() - start) / operations;
+}
+
+int main(void)
+{
+  size_t depth;
+
+  for (depth = 1; depth <= MAX_DEPTH; depth *= 4) {
+    // Keep the sl_slist runs short at depth, every push walks the whole list
+    uint32_t slist_operations = (uint32_t)(OPERATIONS / depth) + 1000u;
+
+    printf("sl_slist %zu %.1f\n", depth, bench_slist(depth, slist_operations));
+    printf("sl_queue %zu %.1f\n", depth, bench_queue(depth, OPERATIONS));
+  }
+
+  return 0;
+}
@@ -0,0 +1,848 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - capture replay benchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Replays the traffic of a capture, from frame_capture_file or from a flight
+ * recorder dump, through the core, for a regression of a change on real
+ * traffic to show in numbers that do not move from one run to the other.
+ *
+ * The I-frames of the user endpoints are replayed, each of them once: those
+ * the primary sent are written with core_write() by the bench, those the
+ * secondary sent are sent by the emulated secondary of the EMUL bus, in SINK
+ * mode, with the sequence numbers of the session being replayed and no more
+ * of them unacknowledged than the tx window. The system endpoint, the
+ * supervisory and unnumbered frames and the re-transmits are left to the
+ * session itself. The payload bytes a capture did not keep, those of a flight
+ * recorder, are zeroes. The payloads of the frames to the secondary are cut
+ * to the frames it accepts.
+ *
+ * At the recorded speed, the frames go at their offset in the capture, within
+ * the millisecond of the timers of the event loop. At the maximum speed, they
+ * go as soon as the tx window lets them.
+ *
+ * As in core_bench, the daemon is linked in without its main() and the bench
+ * runs the event loop of the core itself. The allocations and the system
+ * calls of the core thread are counted by wrapping them at link time, those of
+ * the emul driver thread are left out. The latency of a frame to the
+ * secondary is from core_write() to the emulated secondary getting it in
+ * sequence, the one of a frame from the secondary from the emulated secondary
+ * sending it to the core delivering it to the server.
+ *
+ * Output:
+ * # <capture>: <frames> frames to the secondary, <frames> from it, over <ms> ms
+ * replay <speed> <wall ms> <core CPU ms> <allocations> <system calls>
+ * latency_to_secondary <frames> <min us> <p50 us> <p90 us> <p99 us> <max us>
+ * latency_from_secondary <frames> <min us> <p50 us> <p90 us> <p99 us> <max us>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/lz4_block.h"
+#include "misc/utils.h"
+#include "driver/driver_emul.h"
+#include "server_core/core/core.h"
+#include "server_core/core/crc.h"
+#include "server_core/core/hdlc.h"
+#include "server_core/epoll/epoll.h"
+#include "server_core/epoll/timer.h"
+
+#define MAX_EPOLL_EVENTS         8
+#define REPLAY_WATCHDOG_US       1000000u
+
+#define PCAPNG_BLOCK_TYPE_SHB    0x0A0D0D0Au
+#define PCAPNG_BLOCK_TYPE_IDB    0x00000001u
+#define PCAPNG_BLOCK_TYPE_EPB    0x00000006u
+#define PCAPNG_BYTE_ORDER_MAGIC  0x1A2B3C4Du
+#define PCAPNG_LINKTYPE_USER0    147u
+#define PCAPNG_OPT_ENDOFOPT      0u
+#define PCAPNG_OPT_IF_TSRESOL    9u
+#define PCAPNG_OPT_EPB_FLAGS     2u
+#define PCAPNG_EPB_FLAGS_INBOUND 0x1u
+#define PCAPNG_EPB_FLAGS_OUTBOUND 0x2u
+#define PCAPNG_PAD_TO_4_BYTES(x) (((x) + 3u) & ~(size_t)3u)
+
+/* The symbols of main.c the daemon sources refer to */
+pthread_t main_thread = 0;
+pthread_t driver_thread = 0;
+pthread_t server_core_thread = 0;
+pthread_t security_thread = 0;
+char **argv_g = 0;
+int argc_g = 0;
+
+__attribute__((noreturn)) void software_graceful_exit(void);
+void main_wait_crash_or_graceful_exit(void);
+
+__attribute__((noreturn)) void signal_crash(void)
+{
+  exit(EXIT_FAILURE);
+}
+
+__attribute__((noreturn)) void software_graceful_exit(void)
+{
+  exit(EXIT_SUCCESS);
+}
+
+void main_wait_crash_or_graceful_exit(void)
+{
+  BUG("The benchmark never runs a mode");
+}
+
+/*
+ * Linked with --wrap for every allocation and for the system calls of the
+ * event loop, the driver and the server sockets to go through these. Only
+ * those of the thread running the core are counted.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t nmemb, size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+void __wrap_free(void *ptr);
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __real_recv(int sockfd, void *buf, size_t len, int flags);
+ssize_t __real_send(int sockfd, const void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+int __real_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+int __real_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+int __real_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+int __real_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+long __real_syscall(long number, ...);
+ssize_t __wrap_read(int fd, void *buf, size_t count);
+ssize_t __wrap_write(int fd, const void *buf, size_t count);
+ssize_t __wrap_recv(int sockfd, void *buf, size_t len, int flags);
+ssize_t __wrap_send(int sockfd, const void *buf, size_t len, int flags);
+ssize_t __wrap_sendmsg(int sockfd, const struct msghdr *msg, int flags);
+int __wrap_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+int __wrap_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+long __wrap_syscall(long number, ...);
+
+/* There is no server, the bench is the client of every endpoint */
+bool __wrap_server_listener_list_empty(uint8_t endpoint_number);
+sl_status_t __wrap_server_push_data_to_endpoint(uint8_t endpoint_number, const uint8_t* data, size_t data_len);
+
+static uint64_t allocations;
+static uint64_t syscalls;
+
+static void bench_count_allocation(void)
+{
+  if (pthread_equal(pthread_self(), main_thread)) {
+    allocations++;
+  }
+}
+
+static void bench_count_syscall(void)
+{
+  if (pthread_equal(pthread_self(), main_thread)) {
+    syscalls++;
+  }
+}
+
+void *__wrap_malloc(size_t size)
+{
+  bench_count_allocation();
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+  bench_count_allocation();
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  bench_count_allocation();
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+  __real_free(ptr);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+  bench_count_syscall();
+  return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+  bench_count_syscall();
+  return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_recv(int sockfd, void *buf, size_t len, int flags)
+{
+  bench_count_syscall();
+  return __real_recv(sockfd, buf, len, flags);
+}
+
+ssize_t __wrap_send(int sockfd, const void *buf, size_t len, int flags)
+{
+  bench_count_syscall();
+  return __real_send(sockfd, buf, len, flags);
+}
+
+ssize_t __wrap_sendmsg(int sockfd, const struct msghdr *msg, int flags)
+{
+  bench_count_syscall();
+  return __real_sendmsg(sockfd, msg, flags);
+}
+
+int __wrap_recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+{
+  bench_count_syscall();
+  return __real_recvmmsg(sockfd, msgvec, vlen, flags, timeout);
+}
+
+int __wrap_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags)
+{
+  bench_count_syscall();
+  return __real_sendmmsg(sockfd, msgvec, vlen, flags);
+}
+
+int __wrap_epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+  bench_count_syscall();
+  return __real_epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int __wrap_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+  bench_count_syscall();
+  return __real_epoll_ctl(epfd, op, fd, event);
+}
+
+/* io_uring_enter() and epoll_pwait2(), which the C library may not wrap */
+long __wrap_syscall(long number, ...)
+{
+  va_list args;
+  long arguments[6];
+  size_t i;
+
+  va_start(args, number);
+  for (i = 0; i < ARRAY_SIZE(arguments); i++) {
+    arguments[i] = va_arg(args, long);
+  }
+  va_end(args);
+
+  bench_count_syscall();
+  return __real_syscall(number, arguments[0], arguments[1], arguments[2], arguments[3], arguments[4], arguments[5]);
+}
+
+/* The I-frames of the capture, in its order */
+static driver_emul_replay_frame_t *frames;
+/* For those from the secondary, the messages the core delivers out of each */
+static uint16_t *frame_messages;
+static size_t frame_count;
+static size_t frame_capacity;
+static size_t frames_to_secondary;
+static size_t frames_truncated;
+static bool endpoints[SL_CPC_ENDPOINT_MAX_COUNT];
+
+static bool max_speed;
+static uint8_t tx_window = 1;
+static uint64_t start_ns;
+static epoll_timer_t write_timer;
+static epoll_timer_t watchdog_timer;
+
+/* Progress of the replay */
+static size_t next_write;                                    // Next frame to the secondary to write
+static size_t next_sent;                                     // First frame to the secondary not got by the secondary yet
+static size_t rx_cursors[SL_CPC_ENDPOINT_MAX_COUNT];         // Frame from the secondary being delivered per endpoint
+static uint16_t rx_cursor_messages[SL_CPC_ENDPOINT_MAX_COUNT]; // Messages of it delivered so far
+static size_t frames_delivered;
+static size_t watchdog_progress;
+static bool stalled;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t get_u32(const uint8_t *buffer)
+{
+  uint32_t value;
+
+  memcpy(&value, buffer, sizeof(value));
+
+  return value;
+}
+
+/* Messages the core delivers out of the payload of a frame from the secondary */
+static uint16_t replay_count_messages(const driver_emul_replay_frame_t *frame)
+{
+  static uint8_t decompressed[SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE];
+  const uint8_t *payload = frame->payload;
+  size_t payload_length = (size_t)frame->payload_length - SLI_CPC_HDLC_FCS_SIZE;
+  size_t offset = 0;
+  uint16_t messages = 0;
+
+  /* P/F is set on every fragment of a message but the last one */
+  if (frame->poll_final) {
+    return 0;
+  }
+
+  if ((frame->length_flags & SLI_CPC_HDLC_LENGTH_AGGREGATED) == 0) {
+    return 1;
+  }
+
+  if ((frame->length_flags & SLI_CPC_HDLC_LENGTH_COMPRESSED) != 0) {
+    ssize_t decompressed_length = lz4_block_decompress(payload, payload_length, decompressed, sizeof(decompressed));
+
+    if (decompressed_length < 0) {
+      return 1;
+    }
+
+    payload = decompressed;
+    payload_length = (size_t)decompressed_length;
+  }
+
+  while (payload_length - offset >= SL_CPC_AGGREGATE_PREFIX_SIZE) {
+    size_t message_length = (size_t)payload[offset] | ((size_t)payload[offset + 1] << 8);
+
+    offset += SL_CPC_AGGREGATE_PREFIX_SIZE;
+    if (message_length > payload_length - offset) {
+      break;
+    }
+
+    offset += message_length;
+    messages++;
+  }
+
+  return messages;
+}
+
+/***************************************************************************//**
+ * Add an I-frame of the capture, unless it is a re-transmit. The frame is
+ * given as captured, captured_length of its frame_length bytes.
+ ******************************************************************************/
+static void replay_add_frame(bool outbound, uint64_t timestamp_ns, const uint8_t *frame, size_t captured_length, size_t frame_length)
+{
+  static bool seen[2][SL_CPC_ENDPOINT_MAX_COUNT];
+  static uint8_t next_seq[2][SL_CPC_ENDPOINT_MAX_COUNT];
+  static uint64_t first_timestamp_ns;
+  driver_emul_replay_frame_t *replay_frame;
+  uint8_t address;
+  uint8_t control;
+  uint8_t seq;
+  uint16_t payload_length;
+  uint16_t fcs;
+
+  if (captured_length < SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+    return;
+  }
+
+  address = hdlc_get_address(frame);
+  control = hdlc_get_control(frame);
+  payload_length = hdlc_get_length(frame);
+
+  if (hdlc_get_frame_type(control) != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION
+      || address == SL_CPC_ENDPOINT_SYSTEM
+      || address == SL_CPC_ENDPOINT_SECURITY
+      || payload_length <= SLI_CPC_HDLC_FCS_SIZE) {
+    return;
+  }
+
+  seq = hdlc_get_seq(control);
+  if (seen[outbound][address] && seq != next_seq[outbound][address]) {
+    return;
+  }
+  seen[outbound][address] = true;
+  next_seq[outbound][address] = (uint8_t)((seq + 1) % 8);
+
+  if (frame_count == frame_capacity) {
+    frame_capacity = frame_capacity == 0 ? 1024 : frame_capacity * 2;
+    frames = realloc(frames, frame_capacity * sizeof(driver_emul_replay_frame_t));
+    frame_messages = realloc(frame_messages, frame_capacity * sizeof(uint16_t));
+    FATAL_ON(frames == NULL || frame_messages == NULL);
+  }
+
+  if (frame_count == 0) {
+    first_timestamp_ns = timestamp_ns;
+  }
+
+  replay_frame = &frames[frame_count];
+  memset(replay_frame, 0, sizeof(*replay_frame));
+  replay_frame->offset_ns = timestamp_ns - first_timestamp_ns;
+  replay_frame->address = address;
+  replay_frame->poll_final = hdlc_is_poll_final(control);
+  replay_frame->outbound = outbound;
+  replay_frame->payload_length = payload_length;
+  replay_frame->payload = zalloc(payload_length);
+  FATAL_ON(replay_frame->payload == NULL);
+
+  if (captured_length > SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+    size_t captured_payload_length = captured_length - SLI_CPC_HDLC_HEADER_RAW_SIZE;
+
+    memcpy(replay_frame->payload, &frame[SLI_CPC_HDLC_HEADER_RAW_SIZE],
+           captured_payload_length < payload_length ? captured_payload_length : payload_length);
+  }
+
+  /* The zeroes of a snapped payload are neither an aggregate nor an LZ4 block */
+  if (captured_length >= frame_length) {
+    replay_frame->length_flags = hdlc_get_length_flags(frame);
+  }
+
+  /* The FCS of the bytes that are replayed, whether they are those captured or not */
+  fcs = sli_cpc_get_crc_sw(replay_frame->payload, (uint16_t)(payload_length - SLI_CPC_HDLC_FCS_SIZE));
+  replay_frame->payload[payload_length - 2] = (uint8_t)fcs;
+  replay_frame->payload[payload_length - 1] = (uint8_t)(fcs >> 8);
+
+  frame_messages[frame_count] = outbound ? 0 : replay_count_messages(replay_frame);
+  if (outbound) {
+    frames_to_secondary++;
+  }
+  endpoints[address] = true;
+  frame_count++;
+}
+
+/***************************************************************************//**
+ * Load the I-frames of a pcapng capture of the frames exchanged with the
+ * secondary, as written by the frame capture and the flight recorder.
+ ******************************************************************************/
+static void replay_load(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  uint64_t ticks_per_second = 1000000u;
+  uint8_t *capture;
+  size_t capture_length = 0;
+  size_t capture_capacity = 1u << 20;
+  size_t offset = 0;
+  size_t read_length;
+
+  FATAL_ON(file == NULL);
+
+  capture = malloc(capture_capacity);
+  FATAL_ON(capture == NULL);
+  while ((read_length = fread(&capture[capture_length], 1, capture_capacity - capture_length, file)) != 0) {
+    capture_length += read_length;
+    if (capture_length == capture_capacity) {
+      capture_capacity *= 2;
+      capture = realloc(capture, capture_capacity);
+      FATAL_ON(capture == NULL);
+    }
+  }
+  fclose(file);
+
+  if (capture_length < 12 || get_u32(capture) != PCAPNG_BLOCK_TYPE_SHB || get_u32(&capture[8]) != PCAPNG_BYTE_ORDER_MAGIC) {
+    FATAL("%s is not a pcapng capture in the byte order of the host", path);
+  }
+
+  while (capture_length - offset >= 12) {
+    const uint8_t *block = &capture[offset];
+    uint32_t block_type = get_u32(block);
+    uint32_t block_length = get_u32(&block[4]);
+
+    if (block_length < 12 || block_length % 4 != 0 || block_length > capture_length - offset) {
+      FATAL("Malformed block at offset %zu of %s", offset, path);
+    }
+
+    if (block_type == PCAPNG_BLOCK_TYPE_IDB) {
+      size_t option = 16;
+
+      if ((get_u32(&block[8]) & 0xFFFFu) != PCAPNG_LINKTYPE_USER0) {
+        FATAL("%s is not a capture of CPC frames", path);
+      }
+
+      while (option + 4 <= block_length - 4) {
+        uint16_t code = (uint16_t)(block[option] | block[option + 1] << 8);
+        uint16_t length = (uint16_t)(block[option + 2] | block[option + 3] << 8);
+
+        if (code == PCAPNG_OPT_ENDOFOPT) {
+          break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && length == 1) {
+          uint8_t tsresol = block[option + 4];
+
+          FATAL_ON((tsresol & 0x80u) != 0 || tsresol > 9);
+          for (ticks_per_second = 1; tsresol > 0; tsresol--) {
+            ticks_per_second *= 10;
+          }
+        }
+        option += 4 + PCAPNG_PAD_TO_4_BYTES(length);
+      }
+    } else if (block_type == PCAPNG_BLOCK_TYPE_EPB && block_length >= 32) {
+      uint64_t timestamp = (uint64_t)get_u32(&block[12]) << 32 | get_u32(&block[16]);
+      uint32_t captured_length = get_u32(&block[20]);
+      uint32_t original_length = get_u32(&block[24]);
+      size_t option = 28 + PCAPNG_PAD_TO_4_BYTES((size_t)captured_length);
+      uint32_t flags = 0;
+
+      if ((size_t)captured_length > block_length - 32) {
+        FATAL("Malformed packet at offset %zu of %s", offset, path);
+      }
+
+      while (option + 4 <= block_length - 4) {
+        uint16_t code = (uint16_t)(block[option] | block[option + 1] << 8);
+        uint16_t length = (uint16_t)(block[option + 2] | block[option + 3] << 8);
+
+        if (code == PCAPNG_OPT_ENDOFOPT) {
+          break;
+        }
+        if (code == PCAPNG_OPT_EPB_FLAGS && length == 4) {
+          flags = get_u32(&block[option + 4]);
+        }
+        option += 4 + PCAPNG_PAD_TO_4_BYTES(length);
+      }
+
+      /* The direction is what makes a frame replayable */
+      if ((flags & 0x3u) == PCAPNG_EPB_FLAGS_INBOUND || (flags & 0x3u) == PCAPNG_EPB_FLAGS_OUTBOUND) {
+        replay_add_frame((flags & 0x3u) == PCAPNG_EPB_FLAGS_OUTBOUND,
+                         timestamp / ticks_per_second * 1000000000u + timestamp % ticks_per_second * 1000000000u / ticks_per_second,
+                         &block[28], captured_length, original_length);
+      }
+    }
+
+    offset += block_length;
+  }
+
+  free(capture);
+
+  if (frame_count == 0) {
+    FATAL("No I-frame of a user endpoint to replay in %s", path);
+  }
+}
+
+/***************************************************************************//**
+ * Write the frames to the secondary that are due, in the order of the capture
+ ******************************************************************************/
+static void replay_write_due_frames(void)
+{
+  uint64_t now = now_ns();
+
+  for (; next_write < frame_count; next_write++) {
+    driver_emul_replay_frame_t *replay_frame = &frames[next_write];
+    size_t message_length = (size_t)replay_frame->payload_length - SLI_CPC_HDLC_FCS_SIZE;
+
+    if (!replay_frame->outbound) {
+      continue;
+    }
+
+    if (max_speed) {
+      if (core_get_endpoint_tx_credit(replay_frame->address) == 0) {
+        return;
+      }
+    } else if (start_ns + replay_frame->offset_ns > now) {
+      uint64_t due_ns = start_ns + replay_frame->offset_ns;
+      struct timespec expiry = {
+        .tv_sec = (time_t)(due_ns / 1000000000u),
+        .tv_nsec = (long)(due_ns % 1000000000u)
+      };
+
+      epoll_timer_start_at(&write_timer, &expiry);
+      return;
+    }
+
+    if (message_length > core_get_write_buffer_size()) {
+      message_length = core_get_write_buffer_size();
+      frames_truncated++;
+    }
+
+    replay_frame->sent_ns = now_ns();
+    core_write(replay_frame->address, replay_frame->payload, message_length, 0);
+
+    /* For the credit to be that of the window, not of the frame just written */
+    if (max_speed) {
+      core_process_transmit_queue();
+    }
+  }
+}
+
+static void replay_on_write_timer(epoll_timer_t *timer)
+{
+  (void)timer;
+
+  replay_write_due_frames();
+}
+
+/* Ends a replay that stopped moving, frames went missing */
+static void replay_on_watchdog(epoll_timer_t *timer)
+{
+  size_t progress = next_write + next_sent + frames_delivered;
+
+  if (progress == watchdog_progress && now_ns() > start_ns + frames[frame_count - 1].offset_ns) {
+    stalled = true;
+    return;
+  }
+
+  watchdog_progress = progress;
+  epoll_timer_start(timer, REPLAY_WATCHDOG_US);
+}
+
+bool __wrap_server_listener_list_empty(uint8_t endpoint_number)
+{
+  (void)endpoint_number;
+
+  return false;
+}
+
+sl_status_t __wrap_server_push_data_to_endpoint(uint8_t endpoint_number, const uint8_t* data, size_t data_len)
+{
+  size_t i;
+
+  (void)data;
+  (void)data_len;
+
+  for (i = rx_cursors[endpoint_number]; i < frame_count; i++) {
+    if (!frames[i].outbound && frames[i].address == endpoint_number && frame_messages[i] != 0) {
+      break;
+    }
+  }
+  rx_cursors[endpoint_number] = i;
+
+  if (i == frame_count) {
+    WARN("ep#%d delivered more than the capture holds", endpoint_number);
+    return SL_STATUS_OK;
+  }
+
+  if (++rx_cursor_messages[endpoint_number] == frame_messages[i]) {
+    frames[i].received_ns = now_ns();
+    rx_cursor_messages[endpoint_number] = 0;
+    rx_cursors[endpoint_number] = i + 1;
+    frames_delivered++;
+  }
+
+  return SL_STATUS_OK;
+}
+
+static bool replay_is_complete(void)
+{
+  while (next_sent < frame_count
+         && (!frames[next_sent].outbound || __atomic_load_n(&frames[next_sent].received_ns, __ATOMIC_ACQUIRE) != 0)) {
+    next_sent++;
+  }
+
+  return next_sent == frame_count && frames_delivered == frame_count - frames_to_secondary;
+}
+
+/* One turn of the event loop of server_core */
+static void replay_dispatch(void)
+{
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  size_t event_count;
+  size_t i;
+
+  core_process_transmit_queue();
+
+  event_count = epoll_wait_for_event(events, MAX_EPOLL_EVENTS);
+
+  for (i = 0; i < event_count; i++) {
+    epoll_private_data_t *private_data = (epoll_private_data_t *)events[i].data.ptr;
+
+    private_data->ready_events = events[i].events;
+    private_data->callback(private_data);
+  }
+
+  replay_write_due_frames();
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void replay_report_latency(const char *name, bool outbound)
+{
+  uint64_t *latencies = malloc(frame_count * sizeof(uint64_t));
+  size_t count = 0;
+  size_t i;
+
+  FATAL_ON(latencies == NULL);
+
+  for (i = 0; i < frame_count; i++) {
+    uint64_t sent_ns = __atomic_load_n(&frames[i].sent_ns, __ATOMIC_ACQUIRE);
+    uint64_t received_ns = __atomic_load_n(&frames[i].received_ns, __ATOMIC_ACQUIRE);
+
+    if (frames[i].outbound == outbound && sent_ns != 0 && received_ns >= sent_ns) {
+      latencies[count++] = received_ns - sent_ns;
+    }
+  }
+
+  printf("%s %zu ", name, count);
+  if (count == 0) {
+    printf("- - - - -\n");
+  } else {
+    qsort(latencies, count, sizeof(uint64_t), compare_u64);
+    printf("%.1f %.1f %.1f %.1f %.1f\n",
+           (double)latencies[0] / 1000.0,
+           (double)latencies[count * 50 / 100] / 1000.0,
+           (double)latencies[count * 90 / 100] / 1000.0,
+           (double)latencies[count * 99 / 100] / 1000.0,
+           (double)latencies[count - 1] / 1000.0);
+  }
+
+  free(latencies);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-m] [-w <tx window>] <capture.pcapng>\n"
+          "  -m  replay at the maximum speed rather than at the recorded one\n"
+          "  -w  tx window of the endpoints, both ways, 1 to 7, defaults to 1\n", name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int fd_socket_driver_core;
+  int fd_socket_driver_core_notify;
+  uint64_t wall_ns;
+  uint64_t cpu_ns;
+  uint64_t allocations_start;
+  uint64_t syscalls_start;
+  size_t i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "mw:h")) != -1) {
+    switch (opt) {
+      case 'm':
+        max_speed = true;
+        break;
+      case 'w':
+        tx_window = (uint8_t)strtoul(optarg, NULL, 10);
+        if (tx_window < 1 || tx_window > 7) {
+          usage(argv[0]);
+        }
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+  }
+
+  main_thread = pthread_self();
+
+  logging_init();
+  epoll_init();
+
+  replay_load(argv[optind]);
+  printf("# %s: %zu frames to the secondary, %zu from it, over %.1f ms\n", argv[optind],
+         frames_to_secondary, frame_count - frames_to_secondary,
+         (double)frames[frame_count - 1].offset_ns / 1000000.0);
+
+  config.bus = EMUL;
+  config.emul_mode = EMUL_MODE_SINK;
+  config.emul_bitrate = 0;
+  config.emul_latency_us = 0;
+  config.emul_loss_per_mille = 0;
+
+  /* Every frame is due at once */
+  if (max_speed) {
+    for (i = 0; i < frame_count; i++) {
+      frames[i].offset_ns = 0;
+    }
+  }
+
+  start_ns = now_ns();
+  driver_emul_set_replay(frames, frame_count, start_ns, tx_window);
+  driver_thread = driver_emul_init(&fd_socket_driver_core, &fd_socket_driver_core_notify);
+
+  core_init(fd_socket_driver_core, fd_socket_driver_core_notify);
+  core_init_buffer_pools();
+  for (i = 0; i < SL_CPC_ENDPOINT_MAX_COUNT; i++) {
+    if (endpoints[i]) {
+      core_open_endpoint((uint8_t)i, 0, tx_window, false);
+    }
+  }
+
+  epoll_timer_init(&write_timer, replay_on_write_timer);
+  epoll_timer_init(&watchdog_timer, replay_on_watchdog);
+  epoll_timer_start(&watchdog_timer, REPLAY_WATCHDOG_US);
+
+  allocations_start = allocations;
+  syscalls_start = syscalls;
+  cpu_ns = thread_cpu_ns();
+
+  replay_write_due_frames();
+  while (!replay_is_complete() && !stalled) {
+    replay_dispatch();
+  }
+
+  cpu_ns = thread_cpu_ns() - cpu_ns;
+  wall_ns = now_ns() - start_ns;
+
+  if (stalled) {
+    size_t lost = 0;
+
+    for (i = 0; i < frame_count; i++) {
+      if (frames[i].outbound && __atomic_load_n(&frames[i].received_ns, __ATOMIC_ACQUIRE) == 0) {
+        lost++;
+      }
+    }
+
+    printf("# stalled, %zu frames to the secondary and %zu from it did not make it\n",
+           lost, frame_count - frames_to_secondary - frames_delivered);
+  }
+  if (frames_truncated != 0) {
+    printf("# %zu frames to the secondary cut to %zu bytes\n", frames_truncated, core_get_write_buffer_size());
+  }
+
+  printf("replay %s %.1f %.1f %" PRIu64 " %" PRIu64 "\n",
+         max_speed ? "maximum" : "recorded",
+         (double)wall_ns / 1000000.0,
+         (double)cpu_ns / 1000000.0,
+         allocations - allocations_start,
+         syscalls - syscalls_start);
+
+  replay_report_latency("latency_to_secondary", true);
+  replay_report_latency("latency_from_secondary", false);
+
+  return 0;
+}
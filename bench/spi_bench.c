@@ -0,0 +1,173 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - SPI handshake benchmark
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Measures the frames per second the host side of the SPI driver can push for
+ * a given frame size, with the timings of the driver:
+ * - fixed: sleep 1 ms after asserting chip select and 1 ms after each
+ *   transfer, as the driver did
+ * - gap:   wait spi_cs_setup_us after asserting chip select, and space the
+ *   transfers by spi_inter_transfer_gap_us, only when they are back to back
+ *
+ * Transfers go to a spidev device when one is given, its native chip select
+ * standing in for the GPIO of the driver. Without a device, the transfer time
+ * is computed from the bitrate, to compare the timings without hardware.
+ *
+ * Usage: spi_bench [device] [bitrate] [frame_size] [cs_setup_us] [gap_us]
+ * Output, one line per run: <timing> <frame size> <frames per second> <kB per second>
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#define FRAMES          2000u
+#define MAX_FRAME_SIZE  4096u
+
+static int fd_spi = -1;
+static unsigned int bitrate = 1000000;
+static uint8_t tx_buffer[MAX_FRAME_SIZE];
+static uint8_t rx_buffer[MAX_FRAME_SIZE];
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_us(uint64_t us)
+{
+  struct timespec ts = { .tv_sec = (time_t)(us / 1000000u), .tv_nsec = (long)(us % 1000000u) * 1000 };
+
+  while (nanosleep(&ts, &ts) != 0) {
+  }
+}
+
+static void transfer(size_t frame_size)
+{
+  struct spi_ioc_transfer spi_transfer;
+
+  if (fd_spi < 0) {
+    /* Busy wait the bit time, a sleep would be too coarse for small frames */
+    uint64_t end = now_ns() + (uint64_t)frame_size * 8u * 1000000000u / bitrate;
+
+    while (now_ns() < end) {
+    }
+    return;
+  }
+
+  memset(&spi_transfer, 0, sizeof(spi_transfer));
+  spi_transfer.tx_buf = (unsigned long)tx_buffer;
+  spi_transfer.rx_buf = (unsigned long)rx_buffer;
+  spi_transfer.len = (uint32_t)frame_size;
+  spi_transfer.speed_hz = bitrate;
+
+  if (ioctl(fd_spi, SPI_IOC_MESSAGE(1), &spi_transfer) < 0) {
+    perror("SPI_IOC_MESSAGE");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static double bench_fixed(size_t frame_size)
+{
+  uint64_t start = now_ns();
+  uint32_t i;
+
+  for (i = 0; i < FRAMES; i++) {
+    sleep_us(1000);
+    transfer(frame_size);
+    sleep_us(1000);
+  }
+
+  return (double)FRAMES * 1e9 / (double)(now_ns() - start);
+}
+
+static double bench_gap(size_t frame_size, uint64_t cs_setup_us, uint64_t gap_us)
+{
+  uint64_t start = now_ns();
+  uint64_t last_deassert = 0;
+  uint32_t i;
+
+  for (i = 0; i < FRAMES; i++) {
+    uint64_t elapsed_us = (now_ns() - last_deassert) / 1000u;
+
+    if (last_deassert != 0 && elapsed_us < gap_us) {
+      sleep_us(gap_us - elapsed_us);
+    }
+    if (cs_setup_us != 0) {
+      sleep_us(cs_setup_us);
+    }
+    transfer(frame_size);
+    last_deassert = now_ns();
+  }
+
+  return (double)FRAMES * 1e9 / (double)(now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+  size_t frame_size = 64;
+  uint64_t cs_setup_us = 20;
+  uint64_t gap_us = 20;
+  double fps;
+
+  if (argc > 1 && strcmp(argv[1], "-") != 0) {
+    fd_spi = open(argv[1], O_RDWR | O_CLOEXEC);
+    if (fd_spi < 0) {
+      perror(argv[1]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (argc > 2) {
+    bitrate = (unsigned int)strtoul(argv[2], NULL, 0);
+  }
+  if (argc > 3) {
+    frame_size = strtoul(argv[3], NULL, 0);
+  }
+  if (argc > 4) {
+    cs_setup_us = strtoull(argv[4], NULL, 0);
+  }
+  if (argc > 5) {
+    gap_us = strtoull(argv[5], NULL, 0);
+  }
+
+  if (bitrate == 0 || frame_size == 0 || frame_size > MAX_FRAME_SIZE) {
+    fprintf(stderr, "Usage: %s [device|-] [bitrate] [frame_size <= %u] [cs_setup_us] [gap_us]\n", argv[0], MAX_FRAME_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  fps = bench_fixed(frame_size);
+  printf("fixed %zu %.0f %.1f\n", frame_size, fps, fps * (double)frame_size / 1000.0);
+
+  fps = bench_gap(frame_size, cs_setup_us, gap_us);
+  printf("gap   %zu %.0f %.1f\n", frame_size, fps, fps * (double)frame_size / 1000.0);
+
+  if (fd_spi >= 0) {
+    close(fd_spi);
+  }
+
+  return EXIT_SUCCESS;
+}
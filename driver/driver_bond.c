@@ -0,0 +1,543 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Bonded links driver
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "misc/busy_poll.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "driver/driver_bond.h"
+#include "driver/driver_kill.h"
+#include "server_core/core/hdlc.h"
+
+#define BOND_BUFFER_SIZE 4096 + SLI_CPC_HDLC_HEADER_RAW_SIZE
+
+/* Frames handed to the links and not yet reported to the core, a power of 2 */
+#define BOND_PENDING_FRAMES_MAX 1024
+
+typedef struct {
+  size_t link;
+  size_t length;
+  bool completed;
+  struct timespec timestamp;
+} bond_pending_frame_t;
+
+typedef struct {
+  driver_bond_link_t params;
+
+  /* Owned by the transmitter thread */
+  uint32_t next_frame_id;  // Of the next completion the driver of the link reports
+  uint64_t cursor;         // Pending frame to look for the next completion of the link from
+  uint64_t pending_bytes;  // Handed to the link and not completed
+  uint64_t tx_frames;
+  uint64_t tx_bytes;
+
+  /* Owned by the receiver thread */
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+} bond_link_t;
+
+static struct {
+  bool enabled;
+  int fd_core;
+  int fd_core_notify;
+  int fd_stop_drv;
+  pthread_t rx_drv_thread;
+  pthread_t tx_drv_thread;
+  pthread_t cleanup_thread;
+  size_t link_count;
+  bond_link_t links[DRIVER_BOND_LINK_MAX_COUNT];
+
+  /* Owned by the receiver thread */
+  uint8_t rx_buffer[BOND_BUFFER_SIZE];
+
+  /* Owned by the transmitter thread */
+  uint8_t tx_buffer[BOND_BUFFER_SIZE];
+  int fd_tx_epoll;
+  bool core_paused;                   // While every pending frame slot is taken
+  bond_pending_frame_t pending[BOND_PENDING_FRAMES_MAX];
+  uint64_t pending_head;              // Oldest frame not reported to the core
+  uint64_t pending_tail;              // Next frame handed to a link
+  uint32_t tx_frame_id;               // Of the next frame whose completion is pushed to the core
+} bond;
+
+static void* receive_driver_thread_func(void* param);
+
+static void* transmit_driver_thread_func(void* param);
+
+static void* driver_bond_cleanup(void *param);
+
+pthread_t driver_bond_init(int *fd_to_core, int *fd_notify_core, const driver_bond_link_t *links, size_t link_count)
+{
+  int fd_sockets[2];
+  int fd_sockets_notify[2];
+  size_t i;
+  ssize_t ret;
+
+  BUG_ON(link_count == 0 || link_count > DRIVER_BOND_LINK_MAX_COUNT);
+
+  bond.link_count = link_count;
+  for (i = 0; i < link_count; i++) {
+    BUG_ON(links[i].bytes_per_second == 0);
+    memset(&bond.links[i], 0, sizeof(bond.links[i]));
+    bond.links[i].params = links[i];
+  }
+
+  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  bond.fd_core  = fd_sockets[0];
+  *fd_to_core = fd_sockets[1];
+
+  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  bond.fd_core_notify  = fd_sockets_notify[0];
+  *fd_notify_core = fd_sockets_notify[1];
+
+  /* Killed along with the drivers of the links */
+  bond.fd_stop_drv = driver_kill_init();
+
+  ret = thread_create(&bond.tx_drv_thread, config.driver_sched, transmit_driver_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = thread_create(&bond.rx_drv_thread, config.driver_sched, receive_driver_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = thread_create(&bond.cleanup_thread, config.driver_sched, driver_bond_cleanup, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(bond.tx_drv_thread, "bond_tx_drv");
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(bond.rx_drv_thread, "bond_rx_drv");
+  FATAL_ON(ret != 0);
+
+  bond.enabled = true;
+
+  for (i = 0; i < link_count; i++) {
+    PRINT_INFO("Bonded link %s : %u bytes/s", links[i].name, links[i].bytes_per_second);
+  }
+
+  return bond.cleanup_thread;
+}
+
+bool driver_bond_is_enabled(void)
+{
+  return bond.enabled;
+}
+
+void driver_bond_add_metrics(metrics_t *metrics)
+{
+  size_t i;
+
+  for (i = 0; i < bond.link_count; i++) {
+    const bond_link_t *link = &bond.links[i];
+
+    metrics_add_counter(metrics, "bond_tx_frames", "link", link->params.name, link->tx_frames);
+    metrics_add_counter(metrics, "bond_tx_bytes", "link", link->params.name, link->tx_bytes);
+    metrics_add_counter(metrics, "bond_rx_frames", "link", link->params.name, link->rx_frames);
+    metrics_add_counter(metrics, "bond_rx_bytes", "link", link->params.name, link->rx_bytes);
+    metrics_add_gauge(metrics, "bond_pending_bytes", "link", link->params.name, link->pending_bytes);
+  }
+}
+
+static void* driver_bond_cleanup(void *param)
+{
+  size_t i;
+
+  (void) param;
+
+  // wait for threads to exit, the drivers of the links got the same kill event
+  pthread_join(bond.tx_drv_thread, NULL);
+  pthread_join(bond.rx_drv_thread, NULL);
+  for (i = 0; i < bond.link_count; i++) {
+    pthread_join(bond.links[i].params.thread, NULL);
+  }
+
+  TRACE_DRIVER("Bond driver threads cancelled");
+
+  for (i = 0; i < bond.link_count; i++) {
+    close(bond.links[i].params.fd_to_core);
+    close(bond.links[i].params.fd_notify_core);
+  }
+  close(bond.fd_core);
+  close(bond.fd_core_notify);
+  close(bond.fd_stop_drv);
+
+  pthread_exit(NULL);
+  return NULL;
+}
+
+/* The link a frame from the core goes out on */
+static size_t driver_bond_pick_link(const uint8_t *frame, size_t length)
+{
+  uint64_t best_drain_ns = UINT64_MAX;
+  size_t best = 0;
+  size_t i;
+
+  if (length < SLI_CPC_HDLC_HEADER_RAW_SIZE
+      || hdlc_get_frame_type(hdlc_get_control(frame)) != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION
+      || hdlc_get_address(frame) == SL_CPC_ENDPOINT_SYSTEM) {
+    return 0;
+  }
+
+  /* The link that would be done first with what it has and this frame */
+  for (i = 0; i < bond.link_count; i++) {
+    const bond_link_t *link = &bond.links[i];
+    uint64_t drain_ns = (link->pending_bytes + length) * 1000000000u / link->params.bytes_per_second;
+
+    if (drain_ns < best_drain_ns) {
+      best_drain_ns = drain_ns;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+static void driver_bond_set_core_paused(bool paused)
+{
+  struct epoll_event event = {};
+  int ret;
+
+  if (bond.core_paused == paused) {
+    return;
+  }
+
+  event.events = paused ? 0 : EPOLLIN;
+  event.data.fd = bond.fd_core;
+  ret = epoll_ctl(bond.fd_tx_epoll, EPOLL_CTL_MOD, bond.fd_core, &event);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  bond.core_paused = paused;
+}
+
+static void driver_bond_process_core(void)
+{
+  /* One batch at a time, the completions of the links are read in between */
+  for (int i = 0; i < SLI_CPC_DRIVER_TX_BATCH_SIZE; i++) {
+    bond_pending_frame_t *pending;
+    bond_link_t *link;
+    size_t link_index;
+    ssize_t length;
+    ssize_t ret;
+
+    /* The core waits for completions before it hands over more */
+    if (bond.pending_tail - bond.pending_head == BOND_PENDING_FRAMES_MAX) {
+      driver_bond_set_core_paused(true);
+      return;
+    }
+
+    length = recv(bond.fd_core, bond.tx_buffer, sizeof(bond.tx_buffer), MSG_DONTWAIT);
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    FATAL_SYSCALL_ON(length < 0);
+
+    /* The core closed the socket, the driver is being killed */
+    if (length == 0) {
+      return;
+    }
+
+    link_index = driver_bond_pick_link(bond.tx_buffer, (size_t)length);
+    link = &bond.links[link_index];
+
+    ret = send(link->params.fd_to_core, bond.tx_buffer, (size_t)length, MSG_NOSIGNAL);
+
+    /* The driver of the link was killed before the bond */
+    if (ret < 0 && errno == EPIPE) {
+      return;
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+    FATAL_ON(ret != length);
+
+    pending = &bond.pending[bond.pending_tail % BOND_PENDING_FRAMES_MAX];
+    pending->link = link_index;
+    pending->length = (size_t)length;
+    pending->completed = false;
+    bond.pending_tail++;
+
+    link->pending_bytes += (uint64_t)length;
+    link->tx_frames++;
+    link->tx_bytes += (uint64_t)length;
+  }
+}
+
+/* Report the frames completed on every link, in the order the core handed them over */
+static void driver_bond_notify_core(void)
+{
+  sl_cpc_tx_complete_t tx_completes[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  size_t count = 0;
+  ssize_t ret;
+
+  while (bond.pending_head != bond.pending_tail) {
+    const bond_pending_frame_t *pending = &bond.pending[bond.pending_head % BOND_PENDING_FRAMES_MAX];
+
+    if (!pending->completed) {
+      break;
+    }
+
+    tx_completes[count].frame_id = bond.tx_frame_id++;
+    tx_completes[count].timestamp = pending->timestamp;
+    count++;
+    bond.pending_head++;
+
+    if (count == SLI_CPC_DRIVER_TX_BATCH_SIZE) {
+      ret = send(bond.fd_core_notify, tx_completes, count * sizeof(tx_completes[0]), 0);
+      FATAL_SYSCALL_ON(ret < 0);
+      count = 0;
+    }
+  }
+
+  if (count != 0) {
+    ret = send(bond.fd_core_notify, tx_completes, count * sizeof(tx_completes[0]), 0);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
+  driver_bond_set_core_paused(false);
+}
+
+static void driver_bond_process_link_notify(size_t link_index)
+{
+  sl_cpc_tx_complete_t tx_completes[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  bond_link_t *link = &bond.links[link_index];
+  ssize_t length;
+  size_t count;
+  size_t i;
+
+  length = recv(link->params.fd_notify_core, tx_completes, sizeof(tx_completes), MSG_DONTWAIT);
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  FATAL_SYSCALL_ON(length < 0);
+
+  count = (size_t)length / sizeof(tx_completes[0]);
+
+  for (i = 0; i < count; i++) {
+    bond_pending_frame_t *pending;
+
+    BUG_ON(tx_completes[i].frame_id != link->next_frame_id);
+    link->next_frame_id++;
+
+    /* The oldest frame of the link not completed, the ones before the head all are */
+    if (link->cursor < bond.pending_head) {
+      link->cursor = bond.pending_head;
+    }
+    while (link->cursor != bond.pending_tail) {
+      pending = &bond.pending[link->cursor % BOND_PENDING_FRAMES_MAX];
+      if (pending->link == link_index && !pending->completed) {
+        break;
+      }
+      link->cursor++;
+    }
+    BUG_ON(link->cursor == bond.pending_tail);
+
+    pending = &bond.pending[link->cursor % BOND_PENDING_FRAMES_MAX];
+    pending->completed = true;
+    pending->timestamp = tx_completes[i].timestamp;
+    link->pending_bytes -= pending->length;
+    link->cursor++;
+  }
+
+  driver_bond_notify_core();
+}
+
+static void driver_bond_process_link(size_t link_index)
+{
+  bond_link_t *link = &bond.links[link_index];
+
+  /* One batch at a time, not to hold the other links back */
+  for (int i = 0; i < SLI_CPC_DRIVER_TX_BATCH_SIZE; i++) {
+    ssize_t length;
+    ssize_t ret;
+
+    length = recv(link->params.fd_to_core, bond.rx_buffer, sizeof(bond.rx_buffer), MSG_DONTWAIT);
+    if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    FATAL_SYSCALL_ON(length < 0);
+
+    /* The driver of the link is being killed */
+    if (length == 0) {
+      return;
+    }
+
+    ret = send(bond.fd_core, bond.rx_buffer, (size_t)length, 0);
+    FATAL_SYSCALL_ON(ret < 0);
+    FATAL_ON(ret != length);
+
+    link->rx_frames++;
+    link->rx_bytes += (uint64_t)length;
+  }
+}
+
+static void* receive_driver_thread_func(void* param)
+{
+  struct epoll_event events[DRIVER_BOND_LINK_MAX_COUNT + 1] = {};
+  bool exit_thread = false;
+  int fd_epoll;
+  size_t i;
+  int ret;
+
+  (void) param;
+
+  TRACE_DRIVER("Receiver thread start");
+
+  /* Create the epoll set */
+  fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+  FATAL_SYSCALL_ON(fd_epoll < 0);
+
+  /* Setup poll event for the frames received on each link */
+  for (i = 0; i < bond.link_count; i++) {
+    events[0].events = EPOLLIN;
+    events[0].data.u64 = i;
+    ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, bond.links[i].params.fd_to_core, &events[0]);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
+  /* Setup poll event for stop event */
+  events[0].events = EPOLLIN;
+  events[0].data.u64 = UINT64_MAX;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, bond.fd_stop_drv, &events[0]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  while (!exit_thread) {
+    int event_count;
+
+    /* Wait for action */
+    {
+      do {
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, fd_epoll, events, DRIVER_BOND_LINK_MAX_COUNT + 1, -1);
+        if (event_count == -1 && errno == EINTR) {
+          continue;
+        }
+        FATAL_SYSCALL_ON(event_count == -1);
+        break;
+      } while (1);
+
+      /* Timeouts should not occur */
+      FATAL_ON(event_count == 0);
+    }
+
+    /* Process each ready file descriptor */
+    {
+      size_t event_i;
+      for (event_i = 0; event_i != (size_t)event_count; event_i++) {
+        if (events[event_i].data.u64 == UINT64_MAX) {
+          exit_thread = true;
+        } else {
+          driver_bond_process_link((size_t)events[event_i].data.u64);
+        }
+      }
+    }
+  }
+
+  close(fd_epoll);
+
+  return 0;
+}
+
+static void* transmit_driver_thread_func(void* param)
+{
+  struct epoll_event events[DRIVER_BOND_LINK_MAX_COUNT + 2] = {};
+  bool exit_thread = false;
+  size_t i;
+  int ret;
+
+  (void) param;
+
+  TRACE_DRIVER("Transmitter thread start");
+
+  /* Create the epoll set */
+  bond.fd_tx_epoll = epoll_create1(EPOLL_CLOEXEC);
+  FATAL_SYSCALL_ON(bond.fd_tx_epoll < 0);
+
+  /* Setup poll event for reading core socket */
+  events[0].events = EPOLLIN;
+  events[0].data.fd = bond.fd_core;
+  ret = epoll_ctl(bond.fd_tx_epoll, EPOLL_CTL_ADD, bond.fd_core, &events[0]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  /* Setup poll event for the completions of each link */
+  for (i = 0; i < bond.link_count; i++) {
+    events[0].events = EPOLLIN;
+    events[0].data.fd = bond.links[i].params.fd_notify_core;
+    ret = epoll_ctl(bond.fd_tx_epoll, EPOLL_CTL_ADD, bond.links[i].params.fd_notify_core, &events[0]);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
+  /* Setup poll event for stop event */
+  events[0].events = EPOLLIN;
+  events[0].data.fd = bond.fd_stop_drv;
+  ret = epoll_ctl(bond.fd_tx_epoll, EPOLL_CTL_ADD, bond.fd_stop_drv, &events[0]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  while (!exit_thread) {
+    int event_count;
+
+    /* Wait for action */
+    {
+      do {
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, bond.fd_tx_epoll, events, DRIVER_BOND_LINK_MAX_COUNT + 2, -1);
+        if (event_count == -1 && errno == EINTR) {
+          continue;
+        }
+        FATAL_SYSCALL_ON(event_count == -1);
+        break;
+      } while (1);
+
+      /* Timeouts should not occur */
+      FATAL_ON(event_count == 0);
+    }
+
+    /* Process each ready file descriptor */
+    {
+      size_t event_i;
+      for (event_i = 0; event_i != (size_t)event_count; event_i++) {
+        int current_event_fd = events[event_i].data.fd;
+
+        if (current_event_fd == bond.fd_core) {
+          driver_bond_process_core();
+        } else if (current_event_fd == bond.fd_stop_drv) {
+          exit_thread = true;
+        } else {
+          for (i = 0; i < bond.link_count; i++) {
+            if (current_event_fd == bond.links[i].params.fd_notify_core) {
+              driver_bond_process_link_notify(i);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  close(bond.fd_tx_epoll);
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Bonded links driver
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef DRIVER_BOND_H
+#define DRIVER_BOND_H
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "misc/metrics.h"
+
+/*
+ * Bonds the drivers of several links to the same secondary, a UART next to the
+ * UART or SPI bus, into a single driver for the core.
+ *
+ * The I-frames of the user endpoints are striped over the links, each one to the
+ * link that would have it out first, from the bytes given to that link and not
+ * sent yet at the rate of the link. The other frames, those of the system
+ * endpoint, the supervisory and the unnumbered ones, stay on the first link, the
+ * one the reset sequence applies to. The frames received on any link are pushed
+ * to the core as they come: the seq/ack of the endpoints puts them back in order,
+ * or has them sent again, as for frames lost on a single link.
+ *
+ * Each link reports the completion of its frames in its own order, the core
+ * expects them in the order it handed the frames over: a completion is held
+ * until the frames handed before it, on the other links, completed too.
+ */
+
+#define DRIVER_BOND_LINK_MAX_COUNT 2
+
+typedef struct {
+  int fd_to_core;                 // The sockets the driver of the link returned to its init
+  int fd_notify_core;
+  pthread_t thread;               // Of the driver of the link, joined once it is killed
+  unsigned int bytes_per_second;  // What the link sends, to estimate when a frame is out
+  const char *name;               // Label of the metrics of the link
+} driver_bond_link_t;
+
+/*
+ * Initialize the bond over the drivers of the links, already initialized.
+ * Crashes the app if the init fails.
+ * Returns the thread to join once the drivers of the links are killed.
+ */
+pthread_t driver_bond_init(int *fd_to_core, int *fd_notify_core, const driver_bond_link_t *links, size_t link_count);
+
+/* Whether the bus is bonded with a second link */
+bool driver_bond_is_enabled(void);
+
+void driver_bond_add_metrics(metrics_t *metrics);
+
+#endif //DRIVER_BOND_H
@@ -19,6 +19,7 @@
 #include <pthread.h>
 
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -27,26 +28,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "server_core/core/crc.h"
 #include "misc/logging.h"
 #include "misc/utils.h"
 #include "driver/driver_emul.h"
+#include "driver/driver_kill.h"
 #include "server_core/core/hdlc.h"
 #include "server_core/core/core.h"
 #include "misc/sl_slist.h"
 #include "misc/sl_status.h"
+#include "misc/config.h"
+#if defined(UNIT_TESTING)
 #include "test/unity/cpc_unity_common.h"
+#endif
 #include "server_core/system_endpoint/system.h"
+#include "server_core/handoff/handoff.h"
 #include "security/security.h"
 
-static int fd_socket_drv;
-static int fd_notification_socket_drv;
-static pthread_t drv_thread;
-static sl_slist_node_t *sli_rx_pending_list_head;
-static cpc_endpoint_state_t ep_states[SL_CPC_ENDPOINT_MAX_COUNT];
-static uint32_t ep_frame_counters_tx[SL_CPC_ENDPOINT_MAX_COUNT];
-static uint32_t ep_frame_counters_rx[SL_CPC_ENDPOINT_MAX_COUNT];
+/* The secondary side of the encryption is only built for the unit tests */
+#if defined(ENABLE_ENCRYPTION) && defined(UNIT_TESTING)
+#define EMUL_ENCRYPTION
+#endif
+
+/* Outside of the unit tests, the emulation plays the secondary of cpc_bench */
+#if !defined(UNIT_TESTING)
+#define EMUL_BENCH
+#endif
 
 typedef struct {
   sl_slist_node_t node;
@@ -54,29 +63,391 @@ typedef struct {
   uint16_t payload_len;
 } sli_buf_entry_rx;
 
+#if defined(EMUL_BENCH)
+/*
+ * For cpc_bench, the frames from the primary occupy an emulated bus for their
+ * length at config.emul_bitrate before being reported as sent, and
+ * config.emul_loss_per_mille of them get lost on the way. The I-frames that
+ * make it are acknowledged, and echoed back with ECHO, once
+ * config.emul_latency_us elapsed. The frames back to the primary occupy a bus
+ * of their own, like on a full duplex UART, and are never lost.
+ */
+typedef struct {
+  sl_slist_node_t node;
+  uint64_t due_ns;
+  size_t frame_length;
+  uint8_t frame[];
+} driver_emul_bench_frame_t;
+#endif
+
+static struct {
+  int fd_socket_drv;
+  int fd_notification_socket_drv;
+  pthread_t drv_thread;
+  sl_slist_node_t *sli_rx_pending_list_head;
+  cpc_endpoint_state_t ep_states[SL_CPC_ENDPOINT_MAX_COUNT];
+  uint32_t ep_frame_counters_tx[SL_CPC_ENDPOINT_MAX_COUNT];
+  uint32_t ep_frame_counters_rx[SL_CPC_ENDPOINT_MAX_COUNT];
+  uint32_t tx_frame_id; // Of the next frame whose completion is pushed to the core
+#if defined(EMUL_BENCH)
+  // Frames to the primary, in due order as they all get the same latency
+  sl_slist_node_t *bench_frames;
+  uint64_t bench_tx_bus_free_ns;
+  uint64_t bench_rx_bus_free_ns;
+  // Fixed, for every run to lose the same frames
+  unsigned int bench_loss_seed;
+  uint8_t bench_seq[SL_CPC_ENDPOINT_MAX_COUNT];
+  uint8_t bench_ack[SL_CPC_ENDPOINT_MAX_COUNT];
+  int fd_kill;
+#endif
+#if defined(CPC_BENCH)
+  // The capture replayed by bench/replay_bench.c, if any
+  driver_emul_replay_frame_t *replay_frames;
+  size_t replay_frame_count;
+  size_t replay_next;                               // Next frame to the primary to send
+  size_t replay_cursors[SL_CPC_ENDPOINT_MAX_COUNT]; // Next frame from the primary per endpoint
+  uint64_t replay_start_ns;
+  uint8_t replay_tx_window;
+  uint8_t replay_peer_ack[SL_CPC_ENDPOINT_MAX_COUNT];
+#endif
+} emul = {
+#if defined(EMUL_BENCH)
+  .bench_loss_seed = 1,
+#endif
+};
+
 static void* driver_thread_func(void* param);
 
+#if defined(EMUL_BENCH)
+static uint64_t driver_emul_bench_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t driver_emul_bench_bus_time_ns(size_t frame_length)
+{
+  if (config.emul_bitrate == 0) {
+    return 0;
+  }
+
+  // A start and a stop bit per byte, like a UART
+  return (uint64_t)frame_length * 10u * 1000000000u / config.emul_bitrate;
+}
+
+/***************************************************************************//**
+ * Hold the frame from the primary for the time it spends on the bus, queued
+ * behind the previous ones, and return when it was sent.
+ ******************************************************************************/
+static void driver_emul_bench_occupy_bus(size_t frame_length, struct timespec *tx_complete_timestamp)
+{
+  uint64_t now_ns = driver_emul_bench_now_ns();
+  uint64_t start_ns = emul.bench_tx_bus_free_ns > now_ns ? emul.bench_tx_bus_free_ns : now_ns;
+
+  emul.bench_tx_bus_free_ns = start_ns + driver_emul_bench_bus_time_ns(frame_length);
+
+  tx_complete_timestamp->tv_sec = (time_t)(emul.bench_tx_bus_free_ns / 1000000000u);
+  tx_complete_timestamp->tv_nsec = (long)(emul.bench_tx_bus_free_ns % 1000000000u);
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, tx_complete_timestamp, NULL) != 0) {
+  }
+}
+
+static bool driver_emul_bench_lose_frame(void)
+{
+  if (config.emul_loss_per_mille == 0) {
+    return false;
+  }
+
+  return (unsigned int)rand_r(&emul.bench_loss_seed) % 1000u < config.emul_loss_per_mille;
+}
+
+/***************************************************************************//**
+ * Queue a frame to the primary, sent once the latency elapsed and the bus is
+ * free. The payload, if any, comes with its FCS.
+ ******************************************************************************/
+static uint64_t driver_emul_bench_queue_frame(uint8_t address, uint8_t control, const void *payload, uint16_t payload_length, uint16_t length_flags)
+{
+  driver_emul_bench_frame_t *bench_frame;
+  size_t frame_length = SLI_CPC_HDLC_HEADER_RAW_SIZE + payload_length;
+  uint64_t due_ns = driver_emul_bench_now_ns() + (uint64_t)config.emul_latency_us * 1000u;
+
+  if (emul.bench_rx_bus_free_ns > due_ns) {
+    due_ns = emul.bench_rx_bus_free_ns;
+  }
+  due_ns += driver_emul_bench_bus_time_ns(frame_length);
+  emul.bench_rx_bus_free_ns = due_ns;
+
+  bench_frame = zalloc(sizeof(driver_emul_bench_frame_t) + frame_length);
+  FATAL_ON(bench_frame == NULL);
+
+  bench_frame->due_ns = due_ns;
+  bench_frame->frame_length = frame_length;
+  hdlc_create_header(bench_frame->frame,
+                     address,
+                     (uint16_t)(payload_length | length_flags),
+                     control,
+                     true);
+  if (payload_length > 0) {
+    memcpy(&bench_frame->frame[SLI_CPC_HDLC_HEADER_RAW_SIZE], payload, payload_length);
+  }
+
+  sl_slist_push_back(&emul.bench_frames, &bench_frame->node);
+
+  return due_ns;
+}
+
+static void driver_emul_bench_queue_ack(uint8_t address)
+{
+  (void)driver_emul_bench_queue_frame(address,
+                                hdlc_create_control_supervisory(emul.bench_ack[address], SLI_CPC_HDLC_ACK_SUPERVISORY_FUNCTION),
+                                NULL,
+                                0,
+                                0);
+}
+
+static uint64_t driver_emul_bench_queue_i_frame(uint8_t address, const void *payload, uint16_t payload_length, bool poll_final, uint16_t length_flags)
+{
+  uint64_t due_ns = driver_emul_bench_queue_frame(address,
+                                                  hdlc_create_control_data(emul.bench_seq[address], emul.bench_ack[address], poll_final),
+                                                  payload,
+                                                  payload_length,
+                                                  length_flags);
+
+  emul.bench_seq[address] = (uint8_t)((emul.bench_seq[address] + 1) % 8);
+
+  return due_ns;
+}
+
+#if defined(CPC_BENCH)
+/***************************************************************************//**
+ * Queue the frames of the replayed capture to the primary that are due, in
+ * the order of the capture, and return when the next one is, 0 if there is
+ * none left or if it waits for an acknowledge to be in the window.
+ ******************************************************************************/
+static uint64_t driver_emul_bench_replay_due_frames(uint64_t now_ns)
+{
+  while (emul.replay_next < emul.replay_frame_count) {
+    driver_emul_replay_frame_t *replay_frame = &emul.replay_frames[emul.replay_next];
+    uint64_t due_ns = emul.replay_start_ns + replay_frame->offset_ns;
+
+    if (!replay_frame->outbound) {
+      uint8_t address = replay_frame->address;
+      uint8_t unacknowledged = (uint8_t)((emul.bench_seq[address] - emul.replay_peer_ack[address]) & 7u);
+
+      if (due_ns > now_ns) {
+        return due_ns;
+      }
+
+      if (unacknowledged >= emul.replay_tx_window) {
+        return 0;
+      }
+
+      due_ns = driver_emul_bench_queue_i_frame(address,
+                                               replay_frame->payload,
+                                               replay_frame->payload_length,
+                                               replay_frame->poll_final,
+                                               replay_frame->length_flags);
+      __atomic_store_n(&replay_frame->sent_ns, due_ns, __ATOMIC_RELEASE);
+    }
+
+    emul.replay_next++;
+  }
+
+  return 0;
+}
+
+/***************************************************************************//**
+ * Time stamp the next frame of the replayed capture from the primary on the
+ * endpoint, now that the I-frame got in sequence.
+ ******************************************************************************/
+static void driver_emul_bench_replay_received(uint8_t address)
+{
+  size_t i;
+
+  for (i = emul.replay_cursors[address]; i < emul.replay_frame_count; i++) {
+    driver_emul_replay_frame_t *replay_frame = &emul.replay_frames[i];
+
+    if (replay_frame->outbound && replay_frame->address == address) {
+      __atomic_store_n(&replay_frame->received_ns, driver_emul_bench_now_ns(), __ATOMIC_RELEASE);
+      i++;
+      break;
+    }
+  }
+
+  emul.replay_cursors[address] = i;
+}
+#endif
+
+/***************************************************************************//**
+ * Send the frames that are due, and return how long to wait for the next one,
+ * NULL if there is none.
+ ******************************************************************************/
+static struct timeval *driver_emul_bench_send_due_frames(struct timeval *timeout)
+{
+  sl_slist_node_t *node;
+  uint64_t now_ns = driver_emul_bench_now_ns();
+  uint64_t next_ns = 0;
+  uint64_t wait_us;
+
+#if defined(CPC_BENCH)
+  next_ns = driver_emul_bench_replay_due_frames(now_ns);
+#endif
+
+  while ((node = emul.bench_frames) != NULL) {
+    driver_emul_bench_frame_t *bench_frame = SL_SLIST_ENTRY(node, driver_emul_bench_frame_t, node);
+
+    if (bench_frame->due_ns > now_ns) {
+      if (next_ns == 0 || bench_frame->due_ns < next_ns) {
+        next_ns = bench_frame->due_ns;
+      }
+      break;
+    }
+
+    (void)sl_slist_pop(&emul.bench_frames);
+    (void)send(emul.fd_socket_drv, bench_frame->frame, bench_frame->frame_length, 0);
+    free(bench_frame);
+  }
+
+  if (next_ns == 0) {
+    return NULL;
+  }
+
+  wait_us = (next_ns - now_ns + 999u) / 1000u;
+  timeout->tv_sec = (time_t)(wait_us / 1000000u);
+  timeout->tv_usec = (suseconds_t)(wait_us % 1000000u);
+
+  return timeout;
+}
+
+/***************************************************************************//**
+ * Keep the frames from the primary in sequence, like the secondary does:
+ * I-frames out of sequence, a re-transmitted one among them, only get the
+ * current acknowledge again. Returns false for frames to go no further.
+ ******************************************************************************/
+static bool driver_emul_bench_accept_frame(uint8_t address, uint8_t type, uint8_t seq)
+{
+  if (type == SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED) {
+    return address == SL_CPC_ENDPOINT_SYSTEM;
+  }
+
+  // Acknowledges of the frames sent to the primary, nothing to re-transmit
+  if (type != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
+    return false;
+  }
+
+  if (seq != emul.bench_ack[address]) {
+    TRACE_DRIVER("Out of sequence frame on ep#%d: seq=%d, expected %d", address, seq, emul.bench_ack[address]);
+    driver_emul_bench_queue_ack(address);
+    return false;
+  }
+
+  emul.bench_ack[address] = (uint8_t)((emul.bench_ack[address] + 1) % 8);
+
+#if defined(CPC_BENCH)
+  driver_emul_bench_replay_received(address);
+#endif
+
+  return true;
+}
+
+/***************************************************************************//**
+ * Close the endpoint like the secondary does when the primary closes it: its
+ * sequence numbers restart for the next open, and the frames it had yet to
+ * send back are dropped. The replay goes on from where it is in the capture.
+ ******************************************************************************/
+static void driver_emul_bench_close_endpoint(uint8_t address)
+{
+  sl_slist_node_t **node = &emul.bench_frames;
+
+  TRACE_DRIVER("Closing ep#%d", address);
+
+  emul.bench_seq[address] = 0;
+  emul.bench_ack[address] = 0;
+#if defined(CPC_BENCH)
+  emul.replay_peer_ack[address] = 0;
+#endif
+
+  while (*node != NULL) {
+    driver_emul_bench_frame_t *bench_frame = SL_SLIST_ENTRY(*node, driver_emul_bench_frame_t, node);
+
+    if (hdlc_get_address(bench_frame->frame) == address) {
+      *node = bench_frame->node.node;
+      free(bench_frame);
+    } else {
+      node = &bench_frame->node.node;
+    }
+  }
+}
+
+static void driver_emul_bench_process_frame(const frame_t *frame, size_t frame_length)
+{
+  uint8_t address = hdlc_get_address(frame->header);
+
+  if (config.emul_mode == EMUL_MODE_ECHO && frame_length > SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+    // Same payload, same FCS, the acknowledge goes along, and so do P/F for the
+    // fragments and the flags of the length field
+    driver_emul_bench_queue_i_frame(address,
+                                    frame->payload,
+                                    (uint16_t)(frame_length - SLI_CPC_HDLC_HEADER_RAW_SIZE),
+                                    hdlc_is_poll_final(hdlc_get_control(frame->header)),
+                                    hdlc_get_length_flags(frame->header));
+  } else {
+    driver_emul_bench_queue_ack(address);
+  }
+}
+#endif
+
 pthread_t driver_emul_init(int* fd_core, int *fd_notify_core)
 {
   int fd_sockets[2];
   int fd_notify_sockets[2];
   uint32_t i;
 
-  sl_slist_init(&sli_rx_pending_list_head);
+  sl_slist_init(&emul.sli_rx_pending_list_head);
 
   if (0 != socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets)) {
     FATAL("Create driver socket pair : %m");
   }
 
-  fd_socket_drv  = fd_sockets[0];
+  emul.fd_socket_drv  = fd_sockets[0];
+
+#if defined(EMUL_BENCH)
+  // The daemon joins the driver thread when exiting
+  emul.fd_kill = driver_kill_init();
+#endif
+
+#if defined(CPC_BENCH)
+  // Frames the previous emulated secondary had yet to send back are lost, not its sequence numbers
+  if (handoff_is_resuming()) {
+    memcpy(emul.bench_seq, handoff_get_released()->emul_seq, sizeof(emul.bench_seq));
+    memcpy(emul.bench_ack, handoff_get_released()->emul_ack, sizeof(emul.bench_ack));
+  }
+#endif
 
   /* create driver thread */
-  if (pthread_create(&drv_thread, NULL, driver_thread_func, NULL)) {
+  if (thread_create(&emul.drv_thread, config.driver_sched, driver_thread_func, NULL)) {
     FATAL("Error creating driver thread");
   }
 
+#if defined(EMUL_BENCH)
+  // cpc_bench leaves the emulated secondary out of the CPU time of the daemon
+  if (pthread_setname_np(emul.drv_thread, "emul_drv_thread")) {
+    FATAL("Error naming driver thread");
+  }
+
+  PRINT_INFO("Emulated secondary: mode %s, bitrate %u, latency %u us, loss %u per mille",
+             config.emul_mode == EMUL_MODE_ECHO ? "ECHO" : "SINK",
+             config.emul_bitrate,
+             config.emul_latency_us,
+             config.emul_loss_per_mille);
+#endif
+
   for (i = 0; i < SL_CPC_ENDPOINT_MAX_COUNT; i++) {
-    ep_states[i] = SL_CPC_STATE_OPEN;
+    emul.ep_states[i] = SL_CPC_STATE_OPEN;
   }
 
   *fd_core = fd_sockets[1];
@@ -85,36 +456,61 @@ pthread_t driver_emul_init(int* fd_core, int *fd_notify_core)
     FATAL("Create driver notification socket pair : %m");
   }
 
-  fd_notification_socket_drv  = fd_notify_sockets[0];
+  emul.fd_notification_socket_drv  = fd_notify_sockets[0];
   *fd_notify_core = fd_notify_sockets[1];
 
-  return drv_thread;
+  return emul.drv_thread;
+}
+
+uint32_t driver_emul_get_capabilities(void)
+{
+  return CPC_CAPABILITIES_FRAGMENTATION_MASK | CPC_CAPABILITIES_AGGREGATION_MASK | CPC_CAPABILITIES_COMPRESSION_MASK;
+}
+
+#if defined(CPC_BENCH)
+void driver_emul_get_bench_sequences(uint8_t *seq, uint8_t *ack)
+{
+  memcpy(seq, emul.bench_seq, sizeof(emul.bench_seq));
+  memcpy(ack, emul.bench_ack, sizeof(emul.bench_ack));
 }
 
+void driver_emul_set_replay(driver_emul_replay_frame_t *frames, size_t frame_count, uint64_t start_ns, uint8_t tx_window)
+{
+  BUG_ON(tx_window == 0 || tx_window > 7);
+
+  emul.replay_frames = frames;
+  emul.replay_frame_count = frame_count;
+  emul.replay_next = 0;
+  memset(emul.replay_cursors, 0, sizeof(emul.replay_cursors));
+  emul.replay_start_ns = start_ns;
+  emul.replay_tx_window = tx_window;
+}
+#endif
+
 // -----------------------------------------------------------------------------
 // Validation interface
 
 void sli_cpc_drv_emul_set_ep_state(uint8_t id, cpc_endpoint_state_t state)
 {
   FATAL_ON(id == 0);
-  ep_states[id] = state;
+  emul.ep_states[id] = state;
 }
 
 void sli_cpc_drv_emul_set_frame_counter(uint8_t id, uint32_t frame_counter, bool tx)
 {
   if (tx) {
-    ep_frame_counters_tx[id] = frame_counter;
+    emul.ep_frame_counters_tx[id] = frame_counter;
   } else {
-    ep_frame_counters_rx[id] = frame_counter;
+    emul.ep_frame_counters_rx[id] = frame_counter;
   }
 }
 
 uint32_t sli_cpc_drv_emul_get_frame_counter(uint8_t id, bool tx)
 {
   if (tx) {
-    return ep_frame_counters_tx[id];
+    return emul.ep_frame_counters_tx[id];
   } else {
-    return ep_frame_counters_rx[id];
+    return emul.ep_frame_counters_rx[id];
   }
 }
 
@@ -122,7 +518,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
 {
   uint8_t *buffer;
   uint16_t tag_len = 0;
-#if defined(ENABLE_ENCRYPTION)
+#if defined(EMUL_ENCRYPTION)
   sl_cpc_security_state_t security_state = security_get_state();
   uint8_t control = hdlc_get_control(header_buf);
   uint8_t address = hdlc_get_address(header_buf);
@@ -145,7 +541,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
   }
 
   if (tag_len) {
-#if defined(ENABLE_ENCRYPTION)
+#if defined(EMUL_ENCRYPTION)
     sl_cpc_endpoint_t endpoint;
     sl_status_t status;
     uint16_t fcs;
@@ -153,7 +549,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
     // recreate header with adjusted tag length
     hdlc_create_header(buffer,
                        address,
-                       hdlc_get_length(header_buf) + tag_len,
+                       (uint16_t)((hdlc_get_length(header_buf) + tag_len) | hdlc_get_length_flags(header_buf)),
                        hdlc_get_control(header_buf),
                        true);
 
@@ -161,7 +557,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
     payload_buf_len -= 2;
 
     endpoint.id = hdlc_get_address(header_buf);
-    endpoint.frame_counter_tx = ep_frame_counters_tx[endpoint.id];
+    endpoint.frame_counter_tx = emul.ep_frame_counters_tx[endpoint.id];
 
     status = __security_encrypt_secondary(&endpoint,
                                           buffer, SLI_CPC_HDLC_HEADER_RAW_SIZE,
@@ -174,7 +570,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
       return;
     }
 
-    ep_frame_counters_tx[endpoint.id] = endpoint.frame_counter_tx;
+    emul.ep_frame_counters_tx[endpoint.id] = endpoint.frame_counter_tx;
 
     // recompute FCS with encrypted payload + tag
     fcs = sli_cpc_get_crc_sw(&buffer[SLI_CPC_HDLC_HEADER_RAW_SIZE],
@@ -190,7 +586,7 @@ void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uin
     memcpy(&buffer[SLI_CPC_HDLC_HEADER_RAW_SIZE], payload_buf, payload_buf_len);
   }
 
-  (void)send(fd_socket_drv, buffer, payload_buf_len + tag_len + SLI_CPC_HDLC_HEADER_RAW_SIZE, 0);
+  (void)send(emul.fd_socket_drv, buffer, payload_buf_len + tag_len + SLI_CPC_HDLC_HEADER_RAW_SIZE, 0);
 
   free(buffer);
 }
@@ -219,7 +615,7 @@ static void sli_cpc_drv_emul_create_get_endpoint_property(sl_cpc_system_cmd_t *t
 
     reply_prop_cmd_buff->property_id = EP_ID_TO_PROPERTY_STATE(ep_id);
 
-    *reply_ep_state = ep_states[PROPERTY_ID_TO_EP_ID(prop_id)];
+    *reply_ep_state = emul.ep_states[PROPERTY_ID_TO_EP_ID(prop_id)];
 
     tx_command->length = sizeof(sl_cpc_property_id_t) + sizeof(cpc_endpoint_state_t);
   } else if (prop_id >= EP_ID_TO_PROPERTY_ENCRYPTION(0x00)
@@ -239,7 +635,11 @@ static void sli_cpc_drv_emul_create_get_endpoint_property(sl_cpc_system_cmd_t *t
     reply_ep_encryption = (bool*) reply_prop_cmd_buff->payload;
 
     reply_prop_cmd_buff->property_id = EP_ID_TO_PROPERTY_ENCRYPTION(ep_id);
+#if defined(EMUL_BENCH)
+    *reply_ep_encryption = false; // cpc_bench runs without encryption
+#else
     *reply_ep_encryption = true; // default to always encrypted
+#endif
 
     tx_command->length = sizeof(sl_cpc_property_id_t) + sizeof(bool);
   }
@@ -281,9 +681,12 @@ static void* driver_thread_func(void* param)
   uint8_t ack;
   uint8_t address;
   uint8_t  type;
-#if defined(ENABLE_ENCRYPTION)
+#if defined(EMUL_BENCH)
+  struct timeval timeout;
+  struct timeval *select_timeout = NULL;
+#endif
+#if defined(EMUL_ENCRYPTION)
   sl_cpc_security_state_t security_state;
-  uint8_t plaintext_buffer[2048];
   sl_cpc_endpoint_t endpoint;
   uint16_t length;
   uint16_t tag_len = (uint16_t)security_encrypt_get_extra_buffer_size();
@@ -291,43 +694,80 @@ static void* driver_thread_func(void* param)
 
   pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
 
+#if defined(EMUL_BENCH)
+  // A replayed capture may start with frames to the primary
+  select_timeout = driver_emul_bench_send_due_frames(&timeout);
+#endif
+
   while (1) {
     FD_ZERO(&rfds);
-    FD_SET(fd_socket_drv, &rfds);
-    max_fd = fd_socket_drv;
+    FD_SET(emul.fd_socket_drv, &rfds);
+    max_fd = emul.fd_socket_drv;
+#if defined(EMUL_BENCH)
+    FD_SET(emul.fd_kill, &rfds);
+    if (emul.fd_kill > max_fd) {
+      max_fd = emul.fd_kill;
+    }
+#endif
     /* select() requires the number of the highest file descriptor + 1 in the fd_set passed  */
     max_fd++;
+#if defined(EMUL_BENCH)
+    // wake up for the next frame to the primary
+    retval = select(max_fd, &rfds, NULL, NULL, select_timeout);
+#else
     //no timeout
     retval = select(max_fd, &rfds, NULL, NULL, NULL);
+#endif
     if (retval == -1) {
       perror("select()");
       continue;
     }
-    if (FD_ISSET(fd_socket_drv, &rfds)) {
+#if defined(EMUL_BENCH)
+    if (FD_ISSET(emul.fd_kill, &rfds)) {
+      TRACE_DRIVER("Emulation driver exiting");
+      break;
+    }
+    select_timeout = driver_emul_bench_send_due_frames(&timeout);
+#endif
+    if (FD_ISSET(emul.fd_socket_drv, &rfds)) {
       memset(temp_buffer, 0, 2048);
-      ret =  recv(fd_socket_drv, temp_buffer, 2048, 0);
+      ret =  recv(emul.fd_socket_drv, temp_buffer, 2048, 0);
       FATAL_ON(ret < 2);
       TRACE_DRIVER_RXD_FRAME((const void*)temp_buffer, (size_t)ret);
 
       // Notify core of TX completion
-      struct timespec tx_complete_timestamp;
-      clock_gettime(CLOCK_MONOTONIC, &tx_complete_timestamp);
-      ssize_t write_retval = write(fd_notification_socket_drv, &tx_complete_timestamp, sizeof(tx_complete_timestamp));
-      FATAL_SYSCALL_ON(write_retval != sizeof(tx_complete_timestamp));
+      sl_cpc_tx_complete_t tx_complete;
 
+      tx_complete.frame_id = emul.tx_frame_id++;
+#if defined(EMUL_BENCH)
+      driver_emul_bench_occupy_bus((size_t)ret, &tx_complete.timestamp);
+#else
+      clock_gettime(CLOCK_MONOTONIC, &tx_complete.timestamp);
+#endif
+      ssize_t write_retval = write(emul.fd_notification_socket_drv, &tx_complete, sizeof(tx_complete));
+      FATAL_SYSCALL_ON(write_retval != sizeof(tx_complete));
+
+#if defined(EMUL_BENCH)
+      if (driver_emul_bench_lose_frame()) {
+        TRACE_DRIVER("Losing frame on the emulated bus");
+        select_timeout = driver_emul_bench_send_due_frames(&timeout);
+        continue;
+      }
+#else
       usleep(1000); // Add a delay to emulate the time it takes for the secondary to process the packet
+#endif
 
       frame = (frame_t *)temp_buffer;
       control = hdlc_get_control(frame->header);
       address = hdlc_get_address(frame->header);
-#if defined(ENABLE_ENCRYPTION)
+#if defined(EMUL_ENCRYPTION)
       length  = hdlc_get_length(frame->header);
 #endif
       type = hdlc_get_frame_type(control);
       seq = hdlc_get_seq(control);
       ack = hdlc_get_ack(control);
 
-#if defined(ENABLE_ENCRYPTION)
+#if defined(EMUL_ENCRYPTION)
       security_state = security_get_state();
       if (security_state == SECURITY_STATE_INITIALIZED
           && type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION
@@ -340,16 +780,16 @@ static void* driver_thread_func(void* param)
         length = (uint16_t)(length - tag_len - 2);
 
         endpoint.id = address;
-        endpoint.frame_counter_rx = ep_frame_counters_rx[endpoint.id];
+        endpoint.frame_counter_rx = emul.ep_frame_counters_rx[endpoint.id];
 
         /* decrypt like the secondary would do when receiving such frame */
         status = security_decrypt_secondary(&endpoint,
                                             frame->header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
                                             frame->payload, length,
-                                            plaintext_buffer,
+                                            frame->payload,
                                             &(frame->payload[length]), tag_len);
 
-        ep_frame_counters_rx[endpoint.id] = endpoint.frame_counter_rx;
+        emul.ep_frame_counters_rx[endpoint.id] = endpoint.frame_counter_rx;
 
         if (status != SL_STATUS_OK) {
           TRACE_DRIVER("Failed to decrypt frame: 0x%x\n", status);
@@ -357,9 +797,20 @@ static void* driver_thread_func(void* param)
         } else {
           TRACE_DRIVER("Successfully decrypted frame\n");
         }
+      }
+#endif
 
-        /* copy plaintext buffer at the payload pointer */
-        memcpy(frame->payload, plaintext_buffer, length);
+#if defined(CPC_BENCH)
+      // Opens the window of the replayed capture
+      if (type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION || type == SLI_CPC_HDLC_FRAME_TYPE_SUPERVISORY) {
+        emul.replay_peer_ack[address] = ack;
+      }
+#endif
+
+#if defined(EMUL_BENCH)
+      if (!driver_emul_bench_accept_frame(address, type, seq)) {
+        select_timeout = driver_emul_bench_send_due_frames(&timeout);
+        continue;
       }
 #endif
 
@@ -405,7 +856,11 @@ static void* driver_thread_func(void* param)
 
               if (!is_unnumbered) {
                 TRACE_DRIVER("Sending ack %d on system endpoint", ack);
+#if defined(EMUL_BENCH)
+                driver_emul_bench_queue_ack(0);
+#else
                 cpc_unity_test_push_ack_in_driver(0, ack);
+#endif
               }
 
               // Allocate for the tx command with two bytes for the CRC
@@ -424,7 +879,14 @@ static void* driver_thread_func(void* param)
                 sli_cpc_drv_emul_create_set_endpoint_status_reply((sl_cpc_system_cmd_t *)buffer,
                                                                   PROPERTY_ID_TO_EP_ID(rx_property_cmd->property_id),
                                                                   rx_command->command_seq,
-                                                                  ep_states[PROPERTY_ID_TO_EP_ID(rx_property_cmd->property_id)]);
+                                                                  emul.ep_states[PROPERTY_ID_TO_EP_ID(rx_property_cmd->property_id)]);
+#if defined(EMUL_BENCH)
+                if (rx_property_cmd->property_id >= EP_ID_TO_PROPERTY_STATE(1)
+                    && rx_property_cmd->property_id <= EP_ID_TO_PROPERTY_STATE(255)
+                    && *(cpc_endpoint_state_t *)rx_property_cmd->payload != SL_CPC_STATE_OPEN) {
+                  driver_emul_bench_close_endpoint(PROPERTY_ID_TO_EP_ID(rx_property_cmd->property_id));
+                }
+#endif
               } else {
                 BUG("Invalid command id");
               }
@@ -434,26 +896,47 @@ static void* driver_thread_func(void* param)
               buffer[buf_len - 2] = (uint8_t)fcs;
               buffer[buf_len - 1] = (uint8_t)(fcs >> 8);
 
+#if defined(EMUL_BENCH)
+              driver_emul_bench_queue_i_frame(0, buffer, (uint16_t)buf_len, true, 0);
+#else
               ack = (uint8_t)(ack + 1);
               cpc_unity_test_push_pkt_in_driver(0, buffer, (uint16_t)buf_len, &seq, ack++, false, true);
+#endif
 
               free(buffer);
             } else if (rx_property_cmd->property_id == PROP_ENDPOINT_STATES) {
               TRACE_DRIVER("Sending ack %d on system endpoint", ack);
+#if defined(EMUL_BENCH)
+              driver_emul_bench_queue_ack(0);
+#else
               cpc_unity_test_push_ack_in_driver(0, ack);
+#endif
             }
             break;
           default:
+#if defined(EMUL_BENCH)
+            // Not emulated, but acknowledged to spare the re-transmits
+            if (type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
+              driver_emul_bench_queue_ack(0);
+            }
+#endif
             break;
         }
       } else {
+#if defined(EMUL_BENCH)
+        driver_emul_bench_process_frame(frame, (size_t)ret);
+#else
         if (ret == SLI_CPC_HDLC_HEADER_RAW_SIZE) {
           sli_cpc_drv_emul_pkt_txed_notif(frame->header, frame->payload, 0, 0);
         } else {
           uint16_t fcs = hdlc_get_fcs(frame->payload, (uint16_t)(((size_t)ret - SLI_CPC_HDLC_HEADER_RAW_SIZE) - 2));
           sli_cpc_drv_emul_pkt_txed_notif(frame->header, frame->payload, (uint16_t)(((size_t)ret - SLI_CPC_HDLC_HEADER_RAW_SIZE) - 2), fcs);
         }
+#endif
       }
+#if defined(EMUL_BENCH)
+      select_timeout = driver_emul_bench_send_due_frames(&timeout);
+#endif
     }
   }
   return 0;
@@ -15,8 +15,8 @@
  *
  ******************************************************************************/
 
-#ifndef DRV_UART_H
-#define DRV_UART_H
+#ifndef DRIVER_EMUL_H
+#define DRIVER_EMUL_H
 
 #define _GNU_SOURCE
 #include <pthread.h>
@@ -26,11 +26,44 @@
 #include "server_core/core/core.h"
 
 /*
- * Initialize the uart driver. Crashes the app if the init fails.
+ * Initialize the emulation driver, a secondary for the unit tests, or for
+ * cpc_bench the one of the EMUL bus. Crashes the app if the init fails.
  * Returns the file descriptor of the paired socket to the driver
  * to use in a select() call.
  */
 pthread_t driver_emul_init(int* fd_core_driver, int *fd_notify_core);
+
+/* The capabilities of the emulated secondary, CPC_CAPABILITIES_*_MASK. It echoes
+ * the frames as they are, flags included, but doesn't play the reset sequence to
+ * advertise them */
+uint32_t driver_emul_get_capabilities(void);
+
+#if defined(CPC_BENCH)
+/* The sequence numbers of the emulated secondary, once its thread is joined. Arrays of SL_CPC_ENDPOINT_MAX_COUNT */
+void driver_emul_get_bench_sequences(uint8_t *seq, uint8_t *ack);
+
+/* An I-frame of a recorded capture, see bench/replay_bench.c */
+typedef struct {
+  uint64_t offset_ns;   // From the start of the capture
+  uint64_t sent_ns;     // CLOCK_MONOTONIC, 0 until its side sent it
+  uint64_t received_ns; // CLOCK_MONOTONIC, 0 until the other side got it
+  uint8_t *payload;     // FCS included
+  uint16_t payload_length;
+  uint16_t length_flags;
+  uint8_t address;
+  bool poll_final;
+  bool outbound;        // From the primary
+} driver_emul_replay_frame_t;
+
+/*
+ * Have the emulated secondary send the frames of a capture coming from the
+ * secondary at start_ns plus their offset, no more than tx_window of them
+ * unacknowledged per endpoint, and time stamp those from the primary as it
+ * receives them. Called before driver_emul_init(), the frames stay owned by
+ * the caller.
+ */
+void driver_emul_set_replay(driver_emul_replay_frame_t *frames, size_t frame_count, uint64_t start_ns, uint8_t tx_window);
+#endif
 sl_status_t sli_cpc_drv_read_data(frame_t *handle, uint16_t *payload_rx_len);
 void sli_cpc_drv_emul_submit_pkt_for_rx(void *header_buf, void *payload_buf, uint16_t payload_buf_len);
 void sli_cpc_drv_emul_set_ep_state(uint8_t id, cpc_endpoint_state_t state);
@@ -28,11 +28,14 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
 #include <linux/spi/spidev.h>
 
 #include "server_core/core/crc.h"
 #include "driver/driver_spi.h"
 #include "driver/driver_ezsp.h"
+#include "misc/config.h"
 #include "misc/logging.h"
 #include "misc/sleep.h"
 #include "misc/xmodem.h"
@@ -61,10 +64,17 @@ static struct spi_ioc_transfer spi_transfer;
 static uint8_t rx_spi_buffer[SPI_BUFFER_SIZE];
 static uint8_t tx_spi_buffer[SPI_BUFFER_SIZE];
 
+/* Sleep on the edges of the IRQ line rather than polling it, and build the next
+ * frame while the bootloader checks the current one */
+static bool pipelined;
+
 static int read_until_end_of_frame(void);
 static bool wait_irq_line(void);
 static int send_query(void);
 static bool send_end_of_file(void);
+static size_t build_frame(XmodemFrame_t *frame, uint8_t seq, const uint8_t *data, size_t remaining);
+static void ezsp_write_bootloader_frame(const uint8_t *message, uint8_t length);
+static bool ezsp_complete_bootloader_frame(uint8_t seq_no);
 static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t length);
 static void cs_assert(void);
 static void cs_deassert(void);
@@ -90,7 +100,8 @@ sl_status_t send_firmware(const char   * image_file,
                           const char *irq_gpio_chip,
                           unsigned int irq_gpio_pin,
                           const char *wake_gpio_chip,
-                          unsigned int wake_gpio_pin)
+                          unsigned int wake_gpio_pin,
+                          bool pipelined_upload)
 {
   struct stat stat;
   int ret = 0;
@@ -103,7 +114,11 @@ sl_status_t send_firmware(const char   * image_file,
   bool proceed_to_next_frame = false;
   char status;
   int retries = 0;
-  XmodemFrame_t frame;
+  XmodemFrame_t frames[2];
+  unsigned int current = 0;
+  bool frame_ready = false;
+  uint8_t seq = 1; //Sequence number starts at one initially, wraps around to 0 afterward
+  struct timespec transfer_start = { 0 };
   uint8_t* image_file_data;
   size_t image_file_len;
   enum {
@@ -114,6 +129,8 @@ sl_status_t send_firmware(const char   * image_file,
     CLEAN_UP
   } state = GET_INFO;
 
+  pipelined = pipelined_upload;
+
   // open connection to secondary
   driver_ezsp_spi_open(device,
                        mode,
@@ -140,9 +157,6 @@ sl_status_t send_firmware(const char   * image_file,
   image_file_data = mmaped_image_file_data;
   image_file_len = mmaped_image_file_len;
 
-  frame.header = XMODEM_CMD_SOH;
-  frame.seq = 1;   //Sequence number starts at one initially, wraps around to 0 afterward
-
   TRACE_EZSP_SPI("===== State: GET_INFO =====");
   TRACE_EZSP_SPI("Sending query to bootloader.");
 
@@ -165,33 +179,46 @@ sl_status_t send_firmware(const char   * image_file,
           retries = 0;
           state = SEND_FRAMES;
           TRACE_EZSP_SPI("===== State: SEND_FRAMES =====");
-          TRACE_EZSP_SPI("Starting image file transmission.");
+          TRACE_EZSP_SPI("Starting image file transmission%s.", pipelined ? " in pipelined mode" : "");
+          clock_gettime(CLOCK_MONOTONIC, &transfer_start);
         } else {
           TRACE_EZSP_SPI("Failed to receive QUERYFOUND, received 0x%X. Retrying.", ret);
         }
         break;
       case SEND_FRAMES:
-        z = min(image_file_len, sizeof(frame.data));
-
-        memcpy(frame.data, image_file_data, z);
-        // 0x1A padding
-        memset(frame.data + z, 0x1A, sizeof(frame.data) - z);
+        if (!frame_ready) {
+          build_frame(&frames[current], seq, image_file_data, image_file_len);
+        }
+        z = min(image_file_len, sizeof(frames[current].data));
 
-        frame.crc = __builtin_bswap16(sli_cpc_get_crc_sw(frame.data, sizeof(frame.data)));
+        if (pipelined) {
+          ezsp_write_bootloader_frame((const uint8_t *)&frames[current], sizeof(frames[current]));
 
-        frame.seq_neg = (uint8_t)(0xff - frame.seq);
+          if (image_file_len > z) {
+            build_frame(&frames[current ^ 1], (uint8_t)(seq + 1), image_file_data + z, image_file_len - z);
+          }
 
-        proceed_to_next_frame = ezsp_send_bootloader_raw_bytes((const uint8_t *)&frame, sizeof(frame));
+          proceed_to_next_frame = ezsp_complete_bootloader_frame(seq);
+        } else {
+          proceed_to_next_frame = ezsp_send_bootloader_raw_bytes((const uint8_t *)&frames[current], sizeof(frames[current]));
+        }
 
         if (proceed_to_next_frame) {
-          TRACE_EZSP_SPI("Sent frame number %d successfully.", frame.seq);
-          frame.seq++;
+          TRACE_EZSP_SPI("Sent frame number %d successfully.", seq);
+          seq++;
           image_file_len -= z;
           image_file_data += z;
           status = '.';
           retries = 0;
+
+          /* Else the frame is rebuilt in the same buffer */
+          frame_ready = pipelined;
+          if (pipelined) {
+            current ^= 1;
+          }
         } else {
-          TRACE_EZSP_SPI("Failed to send frame number %d, retrying.", frame.seq);
+          frame_ready = true;
+          TRACE_EZSP_SPI("Failed to send frame number %d, retrying.", seq);
           status = 'N';
           retransmit_count++;
           retries++;
@@ -219,14 +246,28 @@ sl_status_t send_firmware(const char   * image_file,
       case CONFIRM_EOT:
         ret = send_query();
         // bootloader should respond with an ACK and the last frame number + 1
-        if ((ret == XMODEM_CMD_ACK) && (rx_spi_buffer[3] == frame.seq)) {
+        if ((ret == XMODEM_CMD_ACK) && (rx_spi_buffer[3] == seq)) {
+          struct timespec now;
+          uint64_t elapsed_ms;
+
+          clock_gettime(CLOCK_MONOTONIC, &now);
+          elapsed_ms = (uint64_t)(now.tv_sec - transfer_start.tv_sec) * 1000u
+                       + (uint64_t)(now.tv_nsec / 1000000) - (uint64_t)(transfer_start.tv_nsec / 1000000);
+          if (elapsed_ms == 0) {
+            elapsed_ms = 1;
+          }
+
+          PRINT_INFO("Sent %zu bytes in %llu ms, %llu kB/s",
+                     mmaped_image_file_len,
+                     (unsigned long long)elapsed_ms,
+                     (unsigned long long)(mmaped_image_file_len / elapsed_ms));
           TRACE_EZSP_SPI("Received EOT confirmation, cleaning up...");
           retries = 0;
           state = CLEAN_UP;
           TRACE_EZSP_SPI("===== State: CLEAN_UP =====");
         } else {
           TRACE_EZSP_SPI("Failed to receive EOT confirmation for final frame number %d."
-                         "Received 0x%X for frame number %d instead. Retrying.", frame.seq, ret, rx_spi_buffer[3]);
+                         "Received 0x%X for frame number %d instead. Retrying.", seq, ret, rx_spi_buffer[3]);
           retries++;
           // the confirmation can take ~3 seconds
           sleep_s(1);
@@ -250,7 +291,9 @@ sl_status_t send_firmware(const char   * image_file,
         }
         break;
     }
-    sleep_ms(1);
+    if (!pipelined) {
+      sleep_ms(1);
+    }
   }
 }
 
@@ -347,10 +390,55 @@ static int read_until_end_of_frame(void)
   return cpt;
 }
 
+/* The line is set up to report its falling edges */
+static bool wait_irq_edge(uint64_t timeout_us)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (gpio_read(&spi_dev.irq_gpio) != 0) {
+    struct pollfd irq_poll = { .fd = gpio_get_fd(&spi_dev.irq_gpio), .events = GPIO_EPOLL_EVENT };
+    struct timespec now;
+    struct timespec timeout;
+    uint64_t elapsed_us;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_us = (uint64_t)(now.tv_sec - start.tv_sec) * 1000000u
+                 + (uint64_t)(now.tv_nsec / 1000) - (uint64_t)(start.tv_nsec / 1000);
+
+    if (elapsed_us >= timeout_us) {
+      /* The edge may have come right before the timeout */
+      return gpio_read(&spi_dev.irq_gpio) == 0;
+    }
+
+    timeout.tv_sec = (time_t)((timeout_us - elapsed_us) / 1000000u);
+    timeout.tv_nsec = (long)((timeout_us - elapsed_us) % 1000000u) * 1000;
+
+    ret = ppoll(&irq_poll, 1, &timeout, NULL);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+
+    if (ret > 0) {
+      gpio_clear_irq(&spi_dev.irq_gpio);
+    }
+  }
+
+  return true;
+}
+
 static bool wait_irq_line(void)
 {
   int timeout = BOOTLOADER_TIMEOUT;
 
+  if (pipelined) {
+    /* Same budget as polling it every 10ms */
+    return wait_irq_edge(BOOTLOADER_TIMEOUT * 10000u);
+  }
+
   while ((gpio_read(&spi_dev.irq_gpio) != 0)
          && timeout-- > 0) {
     sleep_ms(10);
@@ -445,11 +533,28 @@ static bool send_end_of_file(void)
   return false;
 }
 
-static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t length)
+/* Returns the bytes of the image in the frame, the rest is padded */
+static size_t build_frame(XmodemFrame_t *frame, uint8_t seq, const uint8_t *data, size_t remaining)
+{
+  size_t z = min(remaining, sizeof(frame->data));
+
+  frame->header = XMODEM_CMD_SOH;
+  frame->seq = seq;
+  frame->seq_neg = (uint8_t)(0xff - seq);
+
+  memcpy(frame->data, data, z);
+  // 0x1A padding
+  memset(frame->data + z, 0x1A, sizeof(frame->data) - z);
+
+  frame->crc = __builtin_bswap16(sli_cpc_get_crc_sw(frame->data, sizeof(frame->data)));
+
+  return z;
+}
+
+/* Leaves the chip select asserted, ezsp_complete_bootloader_frame() must follow */
+static void ezsp_write_bootloader_frame(const uint8_t *message, uint8_t length)
 {
   int ret = 0;
-  int timeout = 5;
-  uint8_t seq_no = ((XmodemFrame_t *)message)->seq;
 
   memset(tx_spi_buffer, 0xFF, SPI_BUFFER_SIZE);
   memset(rx_spi_buffer, 0, SPI_BUFFER_SIZE);
@@ -466,6 +571,12 @@ static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t lengt
 
   ret = ioctl(spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &spi_transfer);
   FATAL_ON(ret != (int)(length) + 3);
+}
+
+static bool ezsp_complete_bootloader_frame(uint8_t seq_no)
+{
+  int ret = 0;
+  int timeout = 5;
 
   if (!wait_irq_line()) {
     cs_deassert();
@@ -492,7 +603,9 @@ static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t lengt
   // a subsequent send_query should return an XMODEM ACK with
   // the seq number
   while ((send_query() != XMODEM_CMD_ACK) && (timeout-- > 0)) {
-    sleep_ms(1);
+    if (!pipelined) {
+      sleep_ms(1);
+    }
   }
   if (timeout <= 0) {
     TRACE_EZSP_SPI("Failed to get a XMODEM_ACK after writing frame numer %d", seq_no);
@@ -507,6 +620,13 @@ static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t lengt
   return true;
 }
 
+static bool ezsp_send_bootloader_raw_bytes(const uint8_t *message, uint8_t length)
+{
+  ezsp_write_bootloader_frame(message, length);
+
+  return ezsp_complete_bootloader_frame(((const XmodemFrame_t *)message)->seq);
+}
+
 static void cs_assert(void)
 {
   int ret = 0;
@@ -522,5 +642,9 @@ static void cs_deassert(void)
   ret = gpio_write(&spi_dev.cs_gpio, 1);
   FATAL_SYSCALL_ON(ret < 0);
 
-  sleep_ms(1);
+  if (pipelined) {
+    sleep_us(config.spi_inter_transfer_gap_us);
+  } else {
+    sleep_ms(1);
+  }
 }
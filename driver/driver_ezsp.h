@@ -35,6 +35,7 @@ sl_status_t send_firmware(const char   *image_file,
                           const char *irq_gpio_chip,
                           unsigned int irq_gpio_pin,
                           const char *wake_gpio_chip,
-                          unsigned int wake_gpio_pin);
+                          unsigned int wake_gpio_pin,
+                          bool pipelined);
 
 #endif//DRIVER_EZSP_H
@@ -28,6 +28,15 @@ static int kill_eventfd = -1;
 
 int driver_kill_init(void)
 {
+  /* The drivers bonded into the link are all killed by the same event */
+  if (kill_eventfd != -1) {
+    int fd = fcntl(kill_eventfd, F_DUPFD_CLOEXEC, 0);
+
+    FATAL_SYSCALL_ON(fd < 0);
+
+    return fd;
+  }
+
   kill_eventfd = eventfd(0, //Start with 0 value
                          EFD_CLOEXEC);
 
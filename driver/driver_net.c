@@ -0,0 +1,587 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Network driver
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+
+#include <pthread.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "misc/busy_poll.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/utils.h"
+#include "driver/driver_net.h"
+#include "driver/driver_kill.h"
+#include "driver/driver_ring.h"
+#include "server_core/handoff/handoff.h"
+#include "server_core/core/hdlc.h"
+#include "server_core/core/crc.h"
+
+#define NET_BUFFER_SIZE 4096 + SLI_CPC_HDLC_HEADER_RAW_SIZE
+
+/* Frames sent in a same UDP datagram stay under the payload an Ethernet frame carries */
+#define NET_UDP_DATAGRAM_MAX 1472u
+
+/*
+ * Bytes received and not yet delimited lie between 'tail' and 'head'. On TCP
+ * they carry over from one read to the next, since frames span segments. A UDP
+ * datagram only holds whole frames, what is left of it once delimited is dropped.
+ */
+typedef struct {
+  uint8_t data[NET_BUFFER_SIZE];
+  size_t tail;
+  size_t head;
+} rx_buffer_t;
+
+static struct {
+  int fd_net;
+  int fd_core;
+  int fd_core_notify;
+  int fd_stop_drv;
+  net_protocol_t net_protocol;
+  pthread_t rx_drv_thread;
+  pthread_t tx_drv_thread;
+  pthread_t cleanup_thread;
+
+  /* Owned by the receiver thread */
+  rx_buffer_t rx_buffer;
+
+  /* Owned by the transmitter thread */
+  uint8_t tx_buffers[SLI_CPC_DRIVER_TX_BATCH_SIZE][NET_BUFFER_SIZE];
+  uint32_t tx_frame_id; // Of the next frame whose completion is pushed to the core
+} net;
+
+static void* receive_driver_thread_func(void* param);
+
+static void* transmit_driver_thread_func(void* param);
+
+static void driver_net_process_net(void);
+
+static void driver_net_process_core(void);
+
+static void* driver_net_cleanup(void *param);
+
+static int driver_net_connect(const char *address, unsigned int port, net_protocol_t protocol)
+{
+  struct addrinfo hints;
+  struct addrinfo *results;
+  struct addrinfo *result;
+  char service[8];
+  int fd = -1;
+  int ret;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = (protocol == NET_PROTOCOL_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV;
+
+  snprintf(service, sizeof(service), "%u", port);
+
+  ret = getaddrinfo(address, service, &hints, &results);
+  if (ret != 0) {
+    FATAL("Could not resolve %s : %s", address, gai_strerror(ret));
+  }
+
+  /* A UDP socket is connected too, it only receives from the secondary then */
+  for (result = results; result != NULL; result = result->ai_next) {
+    fd = socket(result->ai_family, result->ai_socktype | SOCK_CLOEXEC, result->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+
+    if (connect(fd, result->ai_addr, result->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(results);
+
+  if (fd < 0) {
+    FATAL("Could not connect to %s:%u (%m)", address, port);
+  }
+
+  if (protocol == NET_PROTOCOL_TCP) {
+    const int enable = 1;
+
+    /* The frames of a batch are written at once, waiting for more would only add latency */
+    ret = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
+  return fd;
+}
+
+pthread_t driver_net_init(int *fd_to_core, int *fd_notify_core, const char *address, unsigned int port, net_protocol_t protocol)
+{
+  int fd_sockets[2];
+  int fd_sockets_notify[2];
+  ssize_t ret;
+
+  net.net_protocol = protocol;
+
+  if (handoff_is_resuming()) {
+    /* Connected by the daemon that handed the link over */
+    net.fd_net = handoff_get_bus_fd();
+  } else {
+    TRACE_DRIVER("Connecting to %s:%u over %s", address, port, protocol == NET_PROTOCOL_TCP ? "TCP" : "UDP");
+
+    net.fd_net = driver_net_connect(address, port, protocol);
+  }
+
+  if (config.driver_rings) {
+    driver_ring_init(fd_to_core, fd_notify_core);
+
+    net.fd_core = driver_ring_get_driver_doorbell();
+    net.fd_core_notify = -1;
+  } else {
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
+    FATAL_SYSCALL_ON(ret < 0);
+
+    net.fd_core  = fd_sockets[0];
+    *fd_to_core = fd_sockets[1];
+
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
+    FATAL_SYSCALL_ON(ret < 0);
+
+    net.fd_core_notify  = fd_sockets_notify[0];
+    *fd_notify_core = fd_sockets_notify[1];
+  }
+
+  /*
+   * Create stop driver event, this file descriptor will be used by
+   * receive and transmit thread to exit gracefully
+   */
+  net.fd_stop_drv = driver_kill_init();
+
+  /* create transmitter driver thread */
+  ret = thread_create(&net.tx_drv_thread, config.driver_sched, transmit_driver_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  /* create receiver driver thread */
+  ret = thread_create(&net.rx_drv_thread, config.driver_sched, receive_driver_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  /* create cleanup thread */
+  ret = thread_create(&net.cleanup_thread, config.driver_sched, driver_net_cleanup, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(net.tx_drv_thread, "tx_drv_thread");
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(net.rx_drv_thread, "rx_drv_thread");
+  FATAL_ON(ret != 0);
+
+  PRINT_INFO("Connected to the secondary at %s:%u over %s", address, port, protocol == NET_PROTOCOL_TCP ? "TCP" : "UDP");
+
+  TRACE_DRIVER("Init done");
+
+  return net.cleanup_thread;
+}
+
+int driver_net_get_fd(void)
+{
+  return net.fd_net;
+}
+
+static void* driver_net_cleanup(void *param)
+{
+  (void) param;
+
+  // wait for threads to exit
+  pthread_join(net.tx_drv_thread, NULL);
+  pthread_join(net.rx_drv_thread, NULL);
+
+  TRACE_DRIVER("Network driver threads cancelled");
+
+  close(net.fd_net);
+  /* The core may still ring the doorbells of the rings, they stay open */
+  if (!driver_ring_is_enabled()) {
+    close(net.fd_core);
+    close(net.fd_core_notify);
+  }
+  close(net.fd_stop_drv);
+
+  pthread_exit(NULL);
+  return NULL;
+}
+
+static void* receive_driver_thread_func(void* param)
+{
+  struct epoll_event events[2] = {};
+  bool exit_thread = false;
+  int fd_epoll;
+  int ret;
+
+  (void) param;
+
+  TRACE_DRIVER("Receiver thread start");
+
+  /* Create the epoll set */
+  fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+  FATAL_SYSCALL_ON(fd_epoll < 0);
+
+  /* Setup poll event for reading the network socket */
+  events[0].events = EPOLLIN;
+  events[0].data.fd = net.fd_net;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, net.fd_net, &events[0]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  /* Setup poll event for stop event */
+  events[1].events = EPOLLIN;
+  events[1].data.fd = net.fd_stop_drv;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, net.fd_stop_drv, &events[1]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  while (!exit_thread) {
+    int event_count;
+
+    /* Wait for action */
+    {
+      do {
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, fd_epoll, events, 2, -1);
+        if (event_count == -1 && errno == EINTR) {
+          continue;
+        }
+        FATAL_SYSCALL_ON(event_count == -1);
+        break;
+      } while (1);
+
+      /* Timeouts should not occur */
+      FATAL_ON(event_count == 0);
+    }
+
+    /* Process each ready file descriptor */
+    {
+      size_t event_i;
+      for (event_i = 0; event_i != (size_t)event_count; event_i++) {
+        int current_event_fd = events[event_i].data.fd;
+
+        if (current_event_fd == net.fd_net) {
+          driver_net_process_net();
+        } else if (current_event_fd == net.fd_stop_drv) {
+          exit_thread = true;
+        }
+      }
+    }
+  }
+
+  close(fd_epoll);
+
+  return 0;
+}
+
+static void* transmit_driver_thread_func(void* param)
+{
+  struct epoll_event events[2] = {};
+  bool exit_thread = false;
+  int fd_epoll;
+  int ret;
+
+  (void) param;
+
+  TRACE_DRIVER("Transmitter thread start");
+
+  /* Create the epoll set */
+  fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+  FATAL_SYSCALL_ON(fd_epoll < 0);
+
+  /* Setup poll event for reading core socket */
+  events[0].events = EPOLLIN;
+  events[0].data.fd = net.fd_core;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, net.fd_core, &events[0]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  /* Setup poll event for stop event */
+  events[1].events = EPOLLIN;
+  events[1].data.fd = net.fd_stop_drv;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, net.fd_stop_drv, &events[1]);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  while (!exit_thread) {
+    int event_count;
+
+    /* Wait for action */
+    {
+      do {
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, fd_epoll, events, 2, -1);
+        if (event_count == -1 && errno == EINTR) {
+          continue;
+        }
+        FATAL_SYSCALL_ON(event_count == -1);
+        break;
+      } while (1);
+
+      /* Timeouts should not occur */
+      FATAL_ON(event_count == 0);
+    }
+
+    /* Process each ready file descriptor */
+    {
+      size_t event_i;
+      for (event_i = 0; event_i != (size_t)event_count; event_i++) {
+        int current_event_fd = events[event_i].data.fd;
+
+        if (current_event_fd == net.fd_core) {
+          driver_net_process_core();
+        } else if (current_event_fd == net.fd_stop_drv) {
+          exit_thread = true;
+        }
+      }
+    }
+  }
+
+  close(fd_epoll);
+
+  return 0;
+}
+
+static bool validate_header(const uint8_t *header_start)
+{
+  uint16_t hcs;
+
+  if (header_start[SLI_CPC_HDLC_FLAG_POS] != SLI_CPC_HDLC_FLAG_VAL) {
+    return false;
+  }
+
+  hcs = hdlc_get_hcs(header_start);
+
+  if (!sli_cpc_validate_crc_sw(header_start, SLI_CPC_HDLC_HEADER_SIZE, hcs)) {
+    TRACE_DRIVER_INVALID_HEADER_CHECKSUM();
+    return false;
+  }
+
+  return true;
+}
+
+/* Push every whole frame of the buffer to the core, skipping the bytes that can't start a header */
+static void delimit_and_push_frames_to_core(rx_buffer_t *buffer)
+{
+  while (buffer->head - buffer->tail >= SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+    const uint8_t *frame = &buffer->data[buffer->tail];
+    size_t frame_size = 0;
+
+    if (validate_header(frame)) {
+      frame_size = (size_t)hdlc_get_length(frame) + SLI_CPC_HDLC_HEADER_RAW_SIZE;
+    }
+
+    if (frame_size == 0 || frame_size > sizeof(buffer->data)) {
+      /* Only the positions holding the flag can start a header */
+      const uint8_t *flag = memchr(frame + 1, SLI_CPC_HDLC_FLAG_VAL, buffer->head - buffer->tail - 1);
+
+      buffer->tail = (flag != NULL) ? (size_t)(flag - buffer->data) : buffer->head;
+      TRACE_DRIVER("re-sync : dropped bytes until the next flag");
+      continue;
+    }
+
+    /* Check if we have enough data for a full frame */
+    if (frame_size > buffer->head - buffer->tail) {
+      return;
+    }
+
+    TRACE_DRIVER_FRAME("Frame delimiter : push delimited frame to core : ", frame, frame_size);
+
+    if (driver_ring_is_enabled()) {
+      driver_ring_push_frame_to_core(frame, frame_size);
+    } else {
+      ssize_t write_retval = write(net.fd_core, frame, frame_size);
+      FATAL_SYSCALL_ON(write_retval < 0);
+
+      /* Error if write is not complete */
+      FATAL_ON((size_t)write_retval != frame_size);
+    }
+
+    buffer->tail += frame_size;
+  }
+}
+
+static void driver_net_process_net(void)
+{
+  ssize_t read_retval;
+
+  if (net.net_protocol == NET_PROTOCOL_UDP) {
+    net.rx_buffer.tail = 0;
+    net.rx_buffer.head = 0;
+  } else if (net.rx_buffer.tail == net.rx_buffer.head) {
+    net.rx_buffer.tail = 0;
+    net.rx_buffer.head = 0;
+  } else if (net.rx_buffer.tail >= sizeof(net.rx_buffer.data) / 2 || net.rx_buffer.head == sizeof(net.rx_buffer.data)) {
+    /* Bring the pending bytes back to the start of the buffer, only once they are past its
+     * middle or once there is no room left after them */
+    memmove(net.rx_buffer.data, &net.rx_buffer.data[net.rx_buffer.tail], net.rx_buffer.head - net.rx_buffer.tail);
+    net.rx_buffer.head -= net.rx_buffer.tail;
+    net.rx_buffer.tail = 0;
+  }
+
+  read_retval = recv(net.fd_net, &net.rx_buffer.data[net.rx_buffer.head], sizeof(net.rx_buffer.data) - net.rx_buffer.head, 0);
+  if (read_retval < 0 && errno == EINTR) {
+    return;
+  }
+  FATAL_SYSCALL_ON(read_retval < 0);
+
+  if (read_retval == 0 && net.net_protocol == NET_PROTOCOL_TCP) {
+    FATAL("The secondary closed the connection");
+  }
+
+  net.rx_buffer.head += (size_t)read_retval;
+
+  delimit_and_push_frames_to_core(&net.rx_buffer);
+
+  if (net.net_protocol == NET_PROTOCOL_UDP && net.rx_buffer.tail != net.rx_buffer.head) {
+    TRACE_DRIVER("Dropped %u bytes at the end of a datagram", (unsigned int)(net.rx_buffer.head - net.rx_buffer.tail));
+  }
+}
+
+/* Stream sockets may take part of an iovec array, write the rest */
+static void driver_net_writev_all(struct iovec *iovecs, int iovec_count)
+{
+  while (iovec_count > 0) {
+    ssize_t write_retval = writev(net.fd_net, iovecs, iovec_count);
+
+    if (write_retval < 0 && errno == EINTR) {
+      continue;
+    }
+    FATAL_SYSCALL_ON(write_retval < 0);
+
+    size_t written = (size_t)write_retval;
+
+    while (iovec_count > 0 && written >= iovecs->iov_len) {
+      written -= iovecs->iov_len;
+      iovecs++;
+      iovec_count--;
+    }
+
+    if (iovec_count > 0) {
+      iovecs->iov_base = (uint8_t *)iovecs->iov_base + written;
+      iovecs->iov_len -= written;
+    }
+  }
+}
+
+/* Send consecutive frames in a same datagram, as long as it stays under NET_UDP_DATAGRAM_MAX */
+static void driver_net_send_datagrams(struct iovec *iovecs, int frame_count)
+{
+  struct mmsghdr datagrams[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  unsigned int datagram_count = 0;
+  unsigned int sent = 0;
+  size_t datagram_length = 0;
+  int i;
+
+  memset(datagrams, 0, sizeof(datagrams));
+
+  for (i = 0; i < frame_count; i++) {
+    struct msghdr *datagram = &datagrams[datagram_count].msg_hdr;
+
+    if (datagram->msg_iovlen != 0 && datagram_length + iovecs[i].iov_len > NET_UDP_DATAGRAM_MAX) {
+      datagram_count++;
+      datagram = &datagrams[datagram_count].msg_hdr;
+      datagram_length = 0;
+    }
+
+    if (datagram->msg_iovlen == 0) {
+      datagram->msg_iov = &iovecs[i];
+    }
+    datagram->msg_iovlen++;
+    datagram_length += iovecs[i].iov_len;
+  }
+  datagram_count++;
+
+  while (sent < datagram_count) {
+    int ret = sendmmsg(net.fd_net, &datagrams[sent], datagram_count - sent, 0);
+
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+
+    sent += (unsigned int)ret;
+  }
+}
+
+static void driver_net_process_core(void)
+{
+  struct mmsghdr msgs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct iovec iovecs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  sl_cpc_tx_complete_t tx_completes[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct timespec now;
+  int frame_count;
+  int i;
+
+  /* Read every frame the core queued, it hands them over in batches */
+  {
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < SLI_CPC_DRIVER_TX_BATCH_SIZE; i++) {
+      iovecs[i].iov_base = net.tx_buffers[i];
+      iovecs[i].iov_len = sizeof(net.tx_buffers[i]);
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (driver_ring_is_enabled()) {
+      frame_count = driver_ring_pop_frames_from_core(msgs, SLI_CPC_DRIVER_TX_BATCH_SIZE);
+    } else {
+      frame_count = recvmmsg(net.fd_core, msgs, SLI_CPC_DRIVER_TX_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    }
+
+    FATAL_SYSCALL_ON(frame_count < 0);
+
+    /* The core closed the socket, the driver is being killed */
+    if (frame_count == 0) {
+      return;
+    }
+  }
+
+  for (i = 0; i < frame_count; i++) {
+    iovecs[i].iov_len = msgs[i].msg_len;
+  }
+
+  /* The whole batch in one system call, and on TCP in as few segments as its size allows */
+  if (net.net_protocol == NET_PROTOCOL_TCP) {
+    driver_net_writev_all(iovecs, frame_count);
+  } else {
+    driver_net_send_datagrams(iovecs, frame_count);
+  }
+
+  /* There is no line to drain, the frames are out once the network stack took them */
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  for (i = 0; i < frame_count; i++) {
+    tx_completes[i].frame_id = net.tx_frame_id++;
+    tx_completes[i].timestamp = now;
+  }
+
+  /* Push write notification to core, one completion per frame */
+  if (driver_ring_is_enabled()) {
+    driver_ring_notify_tx_complete(tx_completes, (size_t)frame_count);
+  } else {
+    ssize_t write_retval = write(net.fd_core_notify, tx_completes, (size_t)frame_count * sizeof(sl_cpc_tx_complete_t));
+    FATAL_SYSCALL_ON(write_retval != (ssize_t)((size_t)frame_count * sizeof(sl_cpc_tx_complete_t)));
+  }
+}
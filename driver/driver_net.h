@@ -0,0 +1,40 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Network driver
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef DRIVER_NET_H
+#define DRIVER_NET_H
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "misc/config.h"
+
+/*
+ * Initialize the network driver, connected to a secondary reachable at
+ * address:port. HDLC frames travel as they would on a UART: back to back on a
+ * TCP stream, or one or more whole frames per UDP datagram.
+ * Crashes the app if the init fails.
+ * Returns the file descriptor of the paired socket to the driver
+ * to use in a select() call.
+ */
+pthread_t driver_net_init(int *fd_to_core, int *fd_notify_core, const char *address, unsigned int port, net_protocol_t protocol);
+
+/* The socket connected to the secondary, handed over on a hot restart */
+int driver_net_get_fd(void);
+
+#endif //DRIVER_NET_H
@@ -0,0 +1,203 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Driver rings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "driver/driver_ring.h"
+#include "misc/logging.h"
+#include "misc/shm_ring.h"
+
+/* Room for a few driver batches of the largest frames */
+#define DRIVER_RING_FRAMES_SIZE       (256u * 1024u)
+#define DRIVER_RING_COMPLETIONS_SIZE  (64u * 1024u)
+
+typedef struct {
+  shm_ring_t ring;
+  int fd_doorbell;  // Rung by the producer when the ring was empty
+  int fd_room;      // Rung by the consumer when the producer waits for room
+} driver_ring_t;
+
+static struct {
+  driver_ring_t to_core;
+  driver_ring_t to_driver;
+  driver_ring_t completions;
+  bool enabled;
+} rings;
+
+static void driver_ring_ring(int fd)
+{
+  const uint64_t event_value = 1;
+  ssize_t ret;
+
+  ret = write(fd, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret != sizeof(event_value));
+}
+
+static void driver_ring_clear(int fd)
+{
+  uint64_t event_value;
+  ssize_t ret;
+
+  ret = read(fd, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret < 0 && errno != EAGAIN);
+}
+
+static void driver_ring_alloc(driver_ring_t *ring, uint32_t size)
+{
+  size_t footprint = shm_ring_footprint(size);
+  void *base = aligned_alloc(64, (footprint + 63u) & ~(size_t)63u);
+  FATAL_ON(base == NULL);
+
+  shm_ring_attach(&ring->ring, base, size, true);
+
+  ring->fd_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(ring->fd_doorbell < 0);
+
+  ring->fd_room = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(ring->fd_room < 0);
+}
+
+bool driver_ring_is_enabled(void)
+{
+  return rings.enabled;
+}
+
+void driver_ring_init(int *fd_to_core, int *fd_notify_core)
+{
+  BUG_ON(rings.enabled);
+
+  driver_ring_alloc(&rings.to_core, DRIVER_RING_FRAMES_SIZE);
+  driver_ring_alloc(&rings.to_driver, DRIVER_RING_FRAMES_SIZE);
+  driver_ring_alloc(&rings.completions, DRIVER_RING_COMPLETIONS_SIZE);
+
+  *fd_to_core = rings.to_core.fd_doorbell;
+  *fd_notify_core = rings.completions.fd_doorbell;
+
+  rings.enabled = true;
+
+  PRINT_INFO("Driver and core exchange frames through in-process rings");
+}
+
+int driver_ring_get_driver_doorbell(void)
+{
+  BUG_ON(!rings.enabled);
+
+  return rings.to_driver.fd_doorbell;
+}
+
+/* Blocks until the message fits, the consumer rings fd_room once it made some */
+static void driver_ring_push(driver_ring_t *ring, const void *message, size_t length)
+{
+  bool was_empty;
+
+  BUG_ON(length == 0 || length > ring->ring.size / 2);
+
+  while (!shm_ring_push(&ring->ring, message, (uint32_t)length, &was_empty)) {
+    struct pollfd pollfd = { .fd = ring->fd_room, .events = POLLIN };
+
+    /* Either the consumer sees the flag, or the second attempt sees the room it made */
+    shm_ring_set_producer_waiting(&ring->ring);
+    if (shm_ring_push(&ring->ring, message, (uint32_t)length, &was_empty)) {
+      break;
+    }
+
+    if (poll(&pollfd, 1, -1) < 0) {
+      FATAL_SYSCALL_ON(errno != EINTR);
+    }
+    driver_ring_clear(ring->fd_room);
+  }
+
+  if (was_empty) {
+    driver_ring_ring(ring->fd_doorbell);
+  }
+}
+
+/*
+ * The doorbell is cleared before popping, and rung again if messages are left
+ * behind, so that the level-triggered epoll entry stays ready while the ring
+ * is not empty.
+ */
+static int driver_ring_pop_frames(driver_ring_t *ring, struct mmsghdr *msgs, unsigned int count)
+{
+  unsigned int i;
+
+  driver_ring_clear(ring->fd_doorbell);
+
+  for (i = 0; i < count; i++) {
+    ssize_t length = shm_ring_pop(&ring->ring, msgs[i].msg_hdr.msg_iov[0].iov_base, msgs[i].msg_hdr.msg_iov[0].iov_len);
+
+    if (length == 0) {
+      break;
+    }
+
+    /* The ring never leaves the process, a corrupted one is a bug */
+    BUG_ON(length < 0);
+
+    msgs[i].msg_len = (unsigned int)length;
+    msgs[i].msg_hdr.msg_flags = 0;
+  }
+
+  if (shm_ring_take_producer_waiting(&ring->ring)) {
+    driver_ring_ring(ring->fd_room);
+  }
+
+  if (!shm_ring_is_empty(&ring->ring)) {
+    driver_ring_ring(ring->fd_doorbell);
+  }
+
+  return (int)i;
+}
+
+void driver_ring_push_frame_to_core(const void *frame, size_t frame_length)
+{
+  driver_ring_push(&rings.to_core, frame, frame_length);
+}
+
+int driver_ring_pop_frames_from_core(struct mmsghdr *msgs, unsigned int count)
+{
+  return driver_ring_pop_frames(&rings.to_driver, msgs, count);
+}
+
+void driver_ring_notify_tx_complete(const sl_cpc_tx_complete_t *tx_completes, size_t count)
+{
+  driver_ring_push(&rings.completions, tx_completes, count * sizeof(sl_cpc_tx_complete_t));
+}
+
+void driver_ring_push_frames_to_driver(const struct iovec *iovecs, unsigned int count)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; i++) {
+    driver_ring_push(&rings.to_driver, iovecs[i].iov_base, iovecs[i].iov_len);
+  }
+}
+
+int driver_ring_pop_frames_from_driver(struct mmsghdr *msgs, unsigned int count)
+{
+  return driver_ring_pop_frames(&rings.to_core, msgs, count);
+}
+
+int driver_ring_pop_tx_complete(struct mmsghdr *msgs, unsigned int count)
+{
+  return driver_ring_pop_frames(&rings.completions, msgs, count);
+}
@@ -0,0 +1,74 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Driver rings
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef DRIVER_RING_H
+#define DRIVER_RING_H
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "server_core/core/hdlc.h"
+
+/*
+ * With config.driver_rings, frames and transmit completions go between the
+ * driver threads and the core thread through in-process single producer,
+ * single consumer rings instead of the socketpairs. Each ring comes with a
+ * doorbell eventfd, rung only when the ring goes from empty to non-empty, that
+ * takes the place of the socket in the epoll sets: the core registers the
+ * doorbells returned by driver_ring_init() like it would the sockets.
+ *
+ * There is one producer and one consumer per ring:
+ * - to the core: the driver thread delimiting the received frames
+ * - to the driver: the core thread, the driver thread transmitting
+ * - completions: the driver thread transmitting, the core thread
+ *
+ * A producer blocks while its ring is full, as it would on a full socket.
+ * Drivers that don't call driver_ring_init(), the emulation driver of the
+ * unit tests among them, keep talking to the core through sockets.
+ */
+
+/* Whether a driver set up the rings */
+bool driver_ring_is_enabled(void);
+
+/* Called by the driver init in place of the socketpairs, returns the doorbells the core waits on */
+void driver_ring_init(int *fd_to_core, int *fd_notify_core);
+
+/* The doorbell the transmitting driver thread waits on for frames from the core */
+int driver_ring_get_driver_doorbell(void);
+
+/* Driver side */
+void driver_ring_push_frame_to_core(const void *frame, size_t frame_length);
+
+/* Like recvmmsg(), one frame per message, returns 0 if there is none */
+int driver_ring_pop_frames_from_core(struct mmsghdr *msgs, unsigned int count);
+
+void driver_ring_notify_tx_complete(const sl_cpc_tx_complete_t *tx_completes, size_t count);
+
+/* Core side */
+void driver_ring_push_frames_to_driver(const struct iovec *iovecs, unsigned int count);
+
+/* Like recvmmsg(), one frame per message, returns 0 if there is none */
+int driver_ring_pop_frames_from_driver(struct mmsghdr *msgs, unsigned int count);
+
+/* Like recvmmsg() on the notification socket, one notification per message, returns 0 if there is none */
+int driver_ring_pop_tx_complete(struct mmsghdr *msgs, unsigned int count);
+
+#endif //DRIVER_RING_H
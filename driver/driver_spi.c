@@ -29,28 +29,44 @@
 #include <sys/ioctl.h>
 #include <linux/spi/spidev.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
 
 #include "server_core/core/crc.h"
 #include "server_core/core/hdlc.h"
+#include "misc/busy_poll.h"
+#include "misc/config.h"
 #include "misc/logging.h"
 #include "misc/sleep.h"
 #include "driver/driver_spi.h"
 #include "driver/driver_kill.h"
+#include "driver/driver_ring.h"
 
 #define MAX_EPOLL_EVENTS 5
-#define IRQ_LINE_TIMEOUT  10
+#define IRQ_LINE_TIMEOUT_US  1000
 
-static int fd_core;
-static int fd_core_notify;
-static int fd_epoll;
-static pthread_t drv_thread;
+#define SPI_FRAME_BUFFER_SIZE (4096 + SLI_CPC_HDLC_HEADER_RAW_SIZE)
 
-static cpc_spi_dev_t spi_dev;
+static struct {
+  int fd_core;
+  int fd_core_notify;
+  int fd_epoll;
+  pthread_t drv_thread;
 
-static struct spi_ioc_transfer spi_tranfer;
+  cpc_spi_dev_t spi_dev;
 
-static uint8_t rx_spi_buffer[4096];
-static uint8_t tx_spi_buffer[4096];
+  /* Speed and word size of every transfer, the segments are copied from it */
+  struct spi_ioc_transfer spi_tranfer;
+
+  /* When chip select was last released, to space transfers by config.spi_inter_transfer_gap_us */
+  struct timespec last_cs_deassert;
+
+  /* The transfers clock in and out of these buffers directly, spidev sends zeroes when there is no tx_buf */
+  uint8_t rx_frame[SPI_FRAME_BUFFER_SIZE];
+  uint8_t tx_frame[SPI_FRAME_BUFFER_SIZE];
+
+  uint32_t tx_frame_id; // Of the next frame whose completion is pushed to the core
+} spi;
 
 typedef void (*driver_epoll_callback_t)(void);
 
@@ -78,14 +94,17 @@ static void driver_spi_open(const char *device,
 
 static void driver_spi_cleanup(void)
 {
-  close(spi_dev.spi_dev_descriptor);
-  close(fd_core);
-  close(fd_core_notify);
-  close(fd_epoll);
+  close(spi.spi_dev.spi_dev_descriptor);
+  /* The core may still ring the doorbells of the rings, they stay open */
+  if (!driver_ring_is_enabled()) {
+    close(spi.fd_core);
+    close(spi.fd_core_notify);
+  }
+  close(spi.fd_epoll);
 
-  gpio_deinit(&spi_dev.cs_gpio);
-  gpio_deinit(&spi_dev.irq_gpio);
-  gpio_deinit(&spi_dev.wake_gpio);
+  gpio_deinit(&spi.spi_dev.cs_gpio);
+  gpio_deinit(&spi.spi_dev.irq_gpio);
+  gpio_deinit(&spi.spi_dev.wake_gpio);
 
   TRACE_DRIVER("SPI driver thread cancelled");
 
@@ -120,17 +139,24 @@ pthread_t driver_spi_init(int *fd_to_core,
                   wake_gpio_chip,
                   wake_gpio_pin);
 
-  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
-  FATAL_SYSCALL_ON(ret < 0);
+  if (config.driver_rings) {
+    driver_ring_init(fd_to_core, fd_notify_core);
+
+    spi.fd_core = driver_ring_get_driver_doorbell();
+    spi.fd_core_notify = -1;
+  } else {
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
+    FATAL_SYSCALL_ON(ret < 0);
 
-  fd_core  = fd_sockets[0];
-  *fd_to_core = fd_sockets[1];
+    spi.fd_core  = fd_sockets[0];
+    *fd_to_core = fd_sockets[1];
 
-  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
-  FATAL_SYSCALL_ON(ret < 0);
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
+    FATAL_SYSCALL_ON(ret < 0);
 
-  fd_core_notify  = fd_sockets_notify[0];
-  *fd_notify_core = fd_sockets_notify[1];
+    spi.fd_core_notify  = fd_sockets_notify[0];
+    *fd_notify_core = fd_sockets_notify[1];
+  }
 
   /* Setup epoll */
   {
@@ -138,15 +164,15 @@ pthread_t driver_spi_init(int *fd_to_core,
 
     /* Create the epoll set */
     {
-      fd_epoll = epoll_create1(EPOLL_CLOEXEC);
-      FATAL_SYSCALL_ON(fd_epoll < 0);
+      spi.fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+      FATAL_SYSCALL_ON(spi.fd_epoll < 0);
     }
 
     /* Setup the socket to the core */
     {
       event.events = EPOLLIN; /* Level-triggered read() availability */
       event.data.ptr = driver_spi_process_core;
-      ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_core, &event);
+      ret = epoll_ctl(spi.fd_epoll, EPOLL_CTL_ADD, spi.fd_core, &event);
       FATAL_SYSCALL_ON(ret < 0);
     }
 
@@ -154,7 +180,7 @@ pthread_t driver_spi_init(int *fd_to_core,
     {
       event.events = GPIO_EPOLL_EVENT; /* Level-triggered read() availability */
       event.data.ptr = driver_spi_clear_and_process_irq;
-      ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, gpio_get_fd(&spi_dev.irq_gpio), &event);
+      ret = epoll_ctl(spi.fd_epoll, EPOLL_CTL_ADD, gpio_get_fd(&spi.spi_dev.irq_gpio), &event);
       FATAL_SYSCALL_ON(ret < 0);
     }
 
@@ -163,23 +189,23 @@ pthread_t driver_spi_init(int *fd_to_core,
       int eventfd_kill = driver_kill_init();
       event.events = EPOLLIN; /* Level-triggered read() availability */
       event.data.ptr = driver_spi_cleanup;
-      ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, eventfd_kill, &event);
+      ret = epoll_ctl(spi.fd_epoll, EPOLL_CTL_ADD, eventfd_kill, &event);
       FATAL_SYSCALL_ON(ret < 0);
     }
   }
 
   /* create driver thread */
-  ret = pthread_create(&drv_thread, NULL, driver_thread_func, NULL);
+  ret = thread_create(&spi.drv_thread, config.driver_sched, driver_thread_func, NULL);
   FATAL_ON(ret != 0);
 
-  ret = pthread_setname_np(drv_thread, "drv_thread");
+  ret = pthread_setname_np(spi.drv_thread, "drv_thread");
   FATAL_ON(ret != 0);
 
   TRACE_DRIVER("Opening spi file %s", device);
 
   TRACE_DRIVER("Init done");
 
-  return drv_thread;
+  return spi.drv_thread;
 }
 
 static void* driver_thread_func(void* param)
@@ -202,7 +228,7 @@ static void* driver_thread_func(void* param)
     /* Wait for action */
     {
       do {
-        event_count = epoll_wait(fd_epoll, events, MAX_EPOLL_EVENTS, -1);
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, spi.fd_epoll, events, MAX_EPOLL_EVENTS, -1);
         if (event_count == -1 && errno == EINTR) {
           continue;
         }
@@ -224,9 +250,9 @@ static void* driver_thread_func(void* param)
     }
   } //while(1)
 
-  gpio_deinit(&spi_dev.cs_gpio);
-  gpio_deinit(&spi_dev.irq_gpio);
-  gpio_deinit(&spi_dev.wake_gpio);
+  gpio_deinit(&spi.spi_dev.cs_gpio);
+  gpio_deinit(&spi.spi_dev.irq_gpio);
+  gpio_deinit(&spi.spi_dev.wake_gpio);
 
   return 0;
 }
@@ -258,24 +284,92 @@ static int get_data_size(uint8_t *header)
   }
 }
 
+static uint64_t elapsed_us_since(const struct timespec *since)
+{
+  struct timespec now;
+  int64_t elapsed_ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  elapsed_ns = ((int64_t)now.tv_sec - (int64_t)since->tv_sec) * 1000000000
+               + ((int64_t)now.tv_nsec - (int64_t)since->tv_nsec);
+
+  return elapsed_ns > 0 ? (uint64_t)elapsed_ns / 1000u : 0u;
+}
+
+/*
+ * Assert chip select, no sooner than config.spi_inter_transfer_gap_us after it was
+ * last released, and give the secondary config.spi_cs_setup_us to get ready.
+ * The gap is only waited for when transfers come back to back.
+ */
 static void cs_assert(void)
 {
+  uint64_t elapsed_us = elapsed_us_since(&spi.last_cs_deassert);
   int ret = 0;
 
-  ret = gpio_write(&spi_dev.cs_gpio, 0);
+  if (elapsed_us < config.spi_inter_transfer_gap_us) {
+    sleep_us((uint32_t)(config.spi_inter_transfer_gap_us - elapsed_us));
+  }
+
+  ret = gpio_write(&spi.spi_dev.cs_gpio, 0);
 
   FATAL_SYSCALL_ON(ret < 0);
+
+  if (config.spi_cs_setup_us != 0) {
+    sleep_us(config.spi_cs_setup_us);
+  }
 }
 
 static void cs_deassert(void)
 {
   int ret = 0;
 
-  ret = gpio_write(&spi_dev.cs_gpio, 1);
+  ret = gpio_write(&spi.spi_dev.cs_gpio, 1);
 
   FATAL_SYSCALL_ON(ret < 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &spi.last_cs_deassert);
 }
 
+/*
+ * Wait for the IRQ line to read 'level', sleeping on its edges rather than
+ * polling its value. The line reports both edges for that purpose.
+ *
+ * @return false on timeout
+ */
+static bool wait_irq_level(int level, uint64_t timeout_us)
+{
+  struct timespec start;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  while (gpio_read(&spi.spi_dev.irq_gpio) != level) {
+    uint64_t elapsed_us = elapsed_us_since(&start);
+    struct pollfd irq_poll = { .fd = gpio_get_fd(&spi.spi_dev.irq_gpio), .events = GPIO_EPOLL_EVENT };
+    struct timespec timeout;
+    int ret;
+
+    if (elapsed_us >= timeout_us) {
+      /* The edge may have come right before the timeout */
+      return gpio_read(&spi.spi_dev.irq_gpio) == level;
+    }
+
+    timeout.tv_sec = (time_t)((timeout_us - elapsed_us) / 1000000u);
+    timeout.tv_nsec = (long)((timeout_us - elapsed_us) % 1000000u) * 1000;
+
+    ret = ppoll(&irq_poll, 1, &timeout, NULL);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+
+    if (ret > 0) {
+      gpio_clear_irq(&spi.spi_dev.irq_gpio);
+    }
+  }
+
+  return true;
+}
 static void driver_spi_open(const char *device,
                             unsigned int mode,
                             unsigned int bit_per_word,
@@ -292,7 +386,7 @@ static void driver_spi_open(const char *device,
 
   mode |= SPI_NO_CS;
 
-  memset(&spi_tranfer, 0, sizeof(struct spi_ioc_transfer));
+  memset(&spi.spi_tranfer, 0, sizeof(struct spi_ioc_transfer));
 
   // SPIDEV0: MOSI (GPIO10); MISO (GPIO9); SCLK (GPIO11); RX_IRQ (GPIO23); CS (GPIO24)
   fd = open(device, O_RDWR | O_CLOEXEC);
@@ -304,150 +398,237 @@ static void driver_spi_open(const char *device,
   ret = ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bit_per_word);
   FATAL_SYSCALL_ON(ret < 0);
 
-  spi_tranfer.bits_per_word = (uint8_t)bit_per_word;
+  spi.spi_tranfer.bits_per_word = (uint8_t)bit_per_word;
 
   ret = ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed);
   FATAL_SYSCALL_ON(ret < 0);
 
-  spi_tranfer.speed_hz = speed;
-
-  spi_tranfer.rx_buf = (unsigned long)rx_spi_buffer;
-  spi_tranfer.tx_buf = (unsigned long)tx_spi_buffer;
+  spi.spi_tranfer.speed_hz = speed;
 
-  spi_dev.spi_dev_descriptor = fd;
+  spi.spi_dev.spi_dev_descriptor = fd;
 
   // Setup CS gpio
-  FATAL_ON(gpio_init(&spi_dev.cs_gpio, cs_gpio_chip, cs_gpio_pin, OUT, NO_EDGE) < 0);
-  FATAL_ON(gpio_write(&spi_dev.cs_gpio, 1u) < 0);
+  FATAL_ON(gpio_init(&spi.spi_dev.cs_gpio, cs_gpio_chip, cs_gpio_pin, OUT, NO_EDGE) < 0);
+  FATAL_ON(gpio_write(&spi.spi_dev.cs_gpio, 1u) < 0);
 
   // Setup IRQ gpio
-  FATAL_ON(gpio_init(&spi_dev.irq_gpio, irq_gpio_chip, irq_gpio_pin, IN, FALLING) < 0);
+  FATAL_ON(gpio_init(&spi.spi_dev.irq_gpio, irq_gpio_chip, irq_gpio_pin, IN, BOTH) < 0);
 
   // Setup WAKE gpio
-  FATAL_ON(gpio_init(&spi_dev.wake_gpio, wake_gpio_chip, wake_gpio_pin, OUT, NO_EDGE) < 0);
-  FATAL_ON(gpio_write(&spi_dev.wake_gpio, 1u) < 0);
+  FATAL_ON(gpio_init(&spi.spi_dev.wake_gpio, wake_gpio_chip, wake_gpio_pin, OUT, NO_EDGE) < 0);
+  FATAL_ON(gpio_write(&spi.spi_dev.wake_gpio, 1u) < 0);
+}
+
+static struct spi_ioc_transfer spi_segment(void *rx_buf, const void *tx_buf, size_t len)
+{
+  struct spi_ioc_transfer segment = spi.spi_tranfer;
+
+  /* Chip select is a GPIO held for the whole message, cs_change stays 0 */
+  segment.rx_buf = (unsigned long)rx_buf;
+  segment.tx_buf = (unsigned long)tx_buf;
+  segment.len = (uint32_t)len;
+
+  return segment;
+}
+
+static void driver_spi_notify_tx_complete(void)
+{
+  sl_cpc_tx_complete_t tx_complete;
+
+  tx_complete.frame_id = spi.tx_frame_id++;
+  clock_gettime(CLOCK_MONOTONIC, &tx_complete.timestamp);
+
+  /* Push write notification to core */
+  if (driver_ring_is_enabled()) {
+    driver_ring_notify_tx_complete(&tx_complete, 1);
+    return;
+  }
+
+  ssize_t write_retval = write(spi.fd_core_notify, &tx_complete, sizeof(tx_complete));
+  FATAL_SYSCALL_ON(write_retval != sizeof(tx_complete));
+}
+
+/*
+ * Take the next frame the core queued into tx_frame
+ *
+ * @return The size of the frame, 0 if there is none
+ */
+static size_t driver_spi_pull_frame_from_core(int flags)
+{
+  ssize_t read_retval;
+
+  if (driver_ring_is_enabled()) {
+    struct iovec iovec = { .iov_base = spi.tx_frame, .iov_len = sizeof(spi.tx_frame) };
+    struct mmsghdr msg = { .msg_hdr = { .msg_iov = &iovec, .msg_iovlen = 1 } };
+
+    if (driver_ring_pop_frames_from_core(&msg, 1) == 0) {
+      return 0;
+    }
+
+    return msg.msg_len;
+  }
+
+  read_retval = recv(spi.fd_core, spi.tx_frame, sizeof(spi.tx_frame), flags);
+  if (read_retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
+  FATAL_SYSCALL_ON(read_retval < 0);
+
+  return (size_t)read_retval;
+}
+
+/*
+ * With config.spi_full_duplex, take the next frame the core queued, to clock it
+ * out while the secondary sends its own.
+ *
+ * @return The size of the frame in tx_frame, 0 if there is none
+ */
+static size_t driver_spi_take_piggybacked_frame(void)
+{
+  if (!config.spi_full_duplex) {
+    return 0;
+  }
+
+  return driver_spi_pull_frame_from_core(MSG_DONTWAIT);
 }
 
 static void driver_spi_process_irq(void)
 {
+  struct spi_ioc_transfer segments[2];
+  unsigned int segment_count = 0;
+  size_t segments_length = 0;
+  size_t tx_frame_size;
+  size_t clocked;
   int ret = 0;
   int payload_size = 0;
-  size_t write_size = 0;
-  uint8_t rx_buffer[4096];
   ssize_t write_retval;
-  int timeout = IRQ_LINE_TIMEOUT;
   int error_timeout = 4096;
 
-  if (gpio_read(&spi_dev.irq_gpio) == 0) {
+  if (gpio_read(&spi.spi_dev.irq_gpio) == 0) {
     cs_assert();
-    sleep_ms(1);
 
-    if (gpio_read(&spi_dev.irq_gpio) != 0u) {
+    if (gpio_read(&spi.spi_dev.irq_gpio) != 0u) {
       cs_deassert();
       return;
     }
 
-    spi_tranfer.len = SLI_CPC_HDLC_HEADER_RAW_SIZE;
+    tx_frame_size = driver_spi_take_piggybacked_frame();
 
-    ret = ioctl(spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &spi_tranfer);
+    segments[0] = spi_segment(spi.rx_frame, tx_frame_size ? spi.tx_frame : NULL, SLI_CPC_HDLC_HEADER_RAW_SIZE);
+
+    ret = ioctl(spi.spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &segments[0]);
     FATAL_ON(ret != SLI_CPC_HDLC_HEADER_RAW_SIZE);
 
-    memcpy(rx_buffer, (uint8_t*)(long)spi_tranfer.rx_buf, SLI_CPC_HDLC_HEADER_RAW_SIZE);
+    payload_size = get_data_size(spi.rx_frame);
+    if (payload_size > (int)(sizeof(spi.rx_frame) - SLI_CPC_HDLC_HEADER_RAW_SIZE)) {
+      payload_size = -1;
+    }
 
-    payload_size = get_data_size((uint8_t *)(long)spi_tranfer.rx_buf);
     if (payload_size == -1) {
-      spi_tranfer.len = 1u;
+      segments[0] = spi_segment(NULL, NULL, 1u);
 
-      while ((gpio_read(&spi_dev.irq_gpio) == 0u)
+      while ((gpio_read(&spi.spi_dev.irq_gpio) == 0u)
              && (error_timeout > 0)) {
-        ret = ioctl(spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &spi_tranfer);
+        ret = ioctl(spi.spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &segments[0]);
         FATAL_ON(ret != 1);
         error_timeout--;
       }
 
       cs_deassert();
 
-      sleep_ms(1);
+      /* The secondary was not listening, the frame is lost like one corrupted on the bus */
+      if (tx_frame_size != 0) {
+        driver_spi_notify_tx_complete();
+      }
 
-      TRACE_FRAME("Driver : Invalid header contain: ", rx_buffer, (size_t)SLI_CPC_HDLC_HEADER_RAW_SIZE);
+      TRACE_DRIVER_FRAME("Invalid header contain: ", spi.rx_frame, (size_t)SLI_CPC_HDLC_HEADER_RAW_SIZE);
       TRACE_DRIVER("Invalid header");
 
       return;
     }
 
+    /* The payload and what is left of the piggybacked frame are chained in a single message */
+    clocked = SLI_CPC_HDLC_HEADER_RAW_SIZE + (size_t)payload_size;
+
+    if (tx_frame_size != 0 && tx_frame_size < clocked) {
+      memset(&spi.tx_frame[tx_frame_size], 0, clocked - tx_frame_size);
+    }
+
     if (payload_size > 0) {
-      spi_tranfer.len = (uint32_t)payload_size;
-      ret = ioctl(spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &spi_tranfer);
-      FATAL_ON(ret != payload_size);
-      memcpy(&rx_buffer[SLI_CPC_HDLC_HEADER_RAW_SIZE], (uint8_t*)(long)spi_tranfer.rx_buf, (uint32_t)payload_size);
-      write_size = (uint32_t)payload_size + SLI_CPC_HDLC_HEADER_RAW_SIZE;
-    } else if (payload_size == 0) {
-      write_size = SLI_CPC_HDLC_HEADER_RAW_SIZE;
+      segments[segment_count++] = spi_segment(&spi.rx_frame[SLI_CPC_HDLC_HEADER_RAW_SIZE],
+                                              tx_frame_size ? &spi.tx_frame[SLI_CPC_HDLC_HEADER_RAW_SIZE] : NULL,
+                                              (size_t)payload_size);
+      segments_length += (size_t)payload_size;
     }
 
-    // Wait for NCP to response
-    while ((gpio_read(&spi_dev.irq_gpio) != 1)
-           && timeout > 0) {
-      sleep_us(100);
-      timeout--;
+    if (tx_frame_size > clocked) {
+      segments[segment_count++] = spi_segment(NULL, &spi.tx_frame[clocked], tx_frame_size - clocked);
+      segments_length += tx_frame_size - clocked;
+    }
+
+    if (segment_count != 0) {
+      ret = ioctl(spi.spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(segment_count), segments);
+      FATAL_ON(ret != (int)segments_length);
     }
 
-    if (timeout == 0) {
+    // Wait for NCP to response
+    if (!wait_irq_level(1, IRQ_LINE_TIMEOUT_US)) {
       FATAL("Secondary IRQ line is busy !!!!");
     }
 
     cs_deassert();
 
-    write_retval = write(fd_core, rx_buffer, write_size);
-    FATAL_SYSCALL_ON(write_retval < 0);
+    if (tx_frame_size != 0) {
+      driver_spi_notify_tx_complete();
+      TRACE_DRIVER_FRAME("flushed frame to SPI along the received one : ", spi.tx_frame, tx_frame_size);
+    }
 
-    sleep_ms(1);
+    if (driver_ring_is_enabled()) {
+      driver_ring_push_frame_to_core(spi.rx_frame, clocked);
+      write_retval = (ssize_t)clocked;
+    } else {
+      write_retval = write(spi.fd_core, spi.rx_frame, clocked);
+      FATAL_SYSCALL_ON(write_retval < 0);
+    }
 
-    TRACE_FRAME("Driver : flushed frame to core : ", rx_buffer, (size_t)write_retval);
+    TRACE_DRIVER_FRAME("flushed frame to core : ", spi.rx_frame, (size_t)write_retval);
   }
 }
 
 static void driver_spi_clear_and_process_irq(void)
 {
-  gpio_clear_irq(&spi_dev.irq_gpio);
+  gpio_clear_irq(&spi.spi_dev.irq_gpio);
 
   driver_spi_process_irq();
 }
 
 static void driver_spi_process_core(void)
 {
-  uint8_t buffer[4096];
-  ssize_t read_retval;
+  struct spi_ioc_transfer segment;
+  size_t frame_size;
   int ret;
 
   cs_assert();
 
-  sleep_ms(1);
-
-  if (gpio_read(&spi_dev.irq_gpio) == 0) {
+  if (gpio_read(&spi.spi_dev.irq_gpio) == 0) {
     return;
   }
 
-  read_retval = read(fd_core, buffer, sizeof(buffer));
-  FATAL_SYSCALL_ON(read_retval < 0);
-
-  memcpy((uint8_t*)(long)spi_tranfer.tx_buf, buffer, (uint32_t)read_retval);
+  frame_size = driver_spi_pull_frame_from_core(0);
+  if (frame_size == 0) {
+    /* The rings may ring once more than there are frames */
+    cs_deassert();
+    return;
+  }
 
-  spi_tranfer.len = (uint32_t)read_retval;
+  segment = spi_segment(NULL, spi.tx_frame, frame_size);
 
-  ret = ioctl(spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &spi_tranfer);
+  ret = ioctl(spi.spi_dev.spi_dev_descriptor, SPI_IOC_MESSAGE(1), &segment);
   FATAL_SYSCALL_ON(ret < 0);
 
   cs_deassert();
 
-  struct timespec tx_complete_timestamp;
-  clock_gettime(CLOCK_MONOTONIC, &tx_complete_timestamp);
-
-  /* Push write notification to core */
-  ssize_t write_retval = write(fd_core_notify, &tx_complete_timestamp, sizeof(tx_complete_timestamp));
-  FATAL_SYSCALL_ON(write_retval != sizeof(tx_complete_timestamp));
-
-  sleep_ms(1);
+  driver_spi_notify_tx_complete();
 
-  TRACE_FRAME("Driver : flushed frame to SPI : ", buffer, (size_t)read_retval);
+  TRACE_DRIVER_FRAME("flushed frame to SPI : ", spi.tx_frame, frame_size);
 }
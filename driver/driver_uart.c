@@ -29,9 +29,17 @@
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <signal.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdint.h>
 #include <linux/serial.h>
 
+#include "misc/busy_poll.h"
 #include "misc/config.h"
 #include "misc/logging.h"
 #include "misc/sleep.h"
@@ -41,18 +49,27 @@
 #include "server_core/core/hdlc.h"
 #include "server_core/core/crc.h"
 #include "driver/driver_kill.h"
+#include "driver/driver_ring.h"
+#include "server_core/handoff/handoff.h"
 
 #define UART_BUFFER_SIZE 4096 + SLI_CPC_HDLC_HEADER_RAW_SIZE
 #define MAX_EPOLL_EVENTS 1
 
-static int fd_uart;
-static int fd_core;
-static int fd_core_notify;
-static int fd_stop_drv;
-static unsigned int device_baudrate = 0;
-static pthread_t rx_drv_thread;
-static pthread_t tx_drv_thread;
-static pthread_t cleanup_thread;
+/*
+ * With config.uart_tx_drain_polling, the completion of a frame is reported once the
+ * UART actually sent it rather than when the baud rate says it should have. The
+ * transmitter thread keeps the frames written and not yet out, and polls how much
+ * the UART drained with a timer armed from the baud rate, backing off while the
+ * output is held, by the flow control for instance.
+ */
+#define TX_DRAIN_PENDING_FRAMES_MAX      (4 * SLI_CPC_DRIVER_TX_BATCH_SIZE)
+#define TX_DRAIN_POLL_MIN_NS             50000L
+#define TX_DRAIN_POLL_MAX_NS             10000000L
+
+typedef struct {
+  uint64_t end_offset;        // Bytes written to the UART up to the end of the frame
+  struct timespec estimated;  // When the baud rate says the frame is out
+} tx_pending_frame_t;
 
 static void* receive_driver_thread_func(void* param);
 
@@ -62,14 +79,76 @@ static void driver_uart_process_uart(void);
 
 static void driver_uart_process_core(void);
 
+static void driver_uart_poll_tx_drain(void);
+
+static void driver_uart_notify_tx_complete(const struct timespec *tx_complete_timestamps, size_t count);
+
 typedef struct notify_private_data{
   int timer_file_descriptor;
 }notify_private_data_t;
 
+/*
+ * Bytes received from the UART and not yet delimited lie between 'tail' and 'head'.
+ * Delimiting a frame only advances 'tail'; the remaining bytes are moved back to the
+ * start of the buffer only when more room is needed at its end, at most once per read.
+ */
+typedef struct {
+  uint8_t data[UART_BUFFER_SIZE];
+  size_t tail;
+  size_t head;
+} rx_buffer_t;
+
+/* The links of the driver: the bus and the UART bonded with it, see driver/driver_bond.h */
+#define UART_LINK_COUNT 2
+
+static struct {
+  int fd_uart;
+  int fd_core;
+  int fd_core_notify;
+  int fd_stop_drv;
+  unsigned int device_baudrate;
+  pthread_t rx_drv_thread;
+  pthread_t tx_drv_thread;
+  pthread_t cleanup_thread;
+
+  /* Owned by the receiver thread */
+  rx_buffer_t rx_buffer;
+  enum {EXPECTING_HEADER, EXPECTING_PAYLOAD} rx_state;
+
+  /* Owned by the transmitter thread */
+  uint8_t tx_buffers[SLI_CPC_DRIVER_TX_BATCH_SIZE][UART_BUFFER_SIZE];
+  uint32_t tx_frame_id; // Of the next frame whose completion is pushed to the core
+
+  struct {
+    tx_pending_frame_t frames[TX_DRAIN_PENDING_FRAMES_MAX];
+    size_t first;
+    size_t count;
+    uint64_t bytes_written;
+    uint64_t bytes_drained;
+    long poll_interval_ns;
+    bool lsr_supported;
+    int timer_fd;
+  } tx_drain;
+
+  /* Actual drain times against the estimate, updated by the transmitter thread */
+  struct {
+    uint64_t frames;
+    uint64_t late_frames;
+    uint64_t total_late_ns;
+    uint64_t max_late_ns;
+    uint64_t total_early_ns;
+  } tx_drain_stats;
+} uart_links[UART_LINK_COUNT];
+
+/* The link of the calling thread, passed to the threads of the driver on their creation */
+static __thread unsigned int uart_link;
+
+#define uart (uart_links[uart_link])
+
 /*
  * @return The number of bytes appended to the buffer
  */
-static size_t read_and_append_uart_received_data(uint8_t *buffer, size_t buffer_head, size_t buffer_size);
+static size_t read_and_append_uart_received_data(rx_buffer_t *buffer);
 
 /*
  * Call this function in loop over the buffer to delimit and push the frames to the core
@@ -77,93 +156,204 @@ static size_t read_and_append_uart_received_data(uint8_t *buffer, size_t buffer_
  * @return Whether or not this call has delimited a pushed a frame, in other words,
  *         shall this function be called again in a loop
  */
-static bool delimit_and_push_frames_to_core(uint8_t *buffer, size_t *buffer_head);
+static bool delimit_and_push_frames_to_core(rx_buffer_t *buffer);
 
 /*
- * Insures the start of the buffer is aligned with the start of a valid checksum
+ * Insures the tail of the buffer is aligned with the start of a valid checksum
  * and re-synch in case the buffer starts with garbage.
  */
-static bool header_re_synch(uint8_t *buffer, size_t *buffer_head);
+static bool header_re_synch(rx_buffer_t *buffer);
 
 static void* driver_uart_cleanup(void *param);
 
-pthread_t driver_uart_init(int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow)
+/* What the low latency profile could get from the tty, reported once the driver is up */
+static struct {
+  bool async_low_latency;
+  int usb_latency_timer_ms; // -1 when the device is not an USB serial converter
+  int rx_thread_priority;   // 0 when the receiver thread is not realtime
+} uart_latency = { .usb_latency_timer_ms = -1 };
+
+static void driver_uart_set_rx_thread_priority(void)
+{
+  struct sched_param param = { .sched_priority = (int)config.uart_rx_realtime_priority };
+  int ret;
+
+  if (config.uart_rx_realtime_priority == 0) {
+    return;
+  }
+
+  ret = pthread_setschedparam(uart.rx_drv_thread, SCHED_FIFO, &param);
+  if (ret != 0) {
+    WARN("Could not run the UART receiver thread with realtime priority %u (%s)", config.uart_rx_realtime_priority, strerror(ret));
+    return;
+  }
+
+  uart_latency.rx_thread_priority = param.sched_priority;
+}
+
+static pthread_t driver_uart_init_link(unsigned int link, int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow)
 {
   int fd_sockets[2];
   int fd_sockets_notify[2];
+  void *thread_param = (void *)(uintptr_t)link;
   ssize_t ret;
 
-  fd_uart = driver_uart_open(device, baudrate, hardflow);
+  uart_link = link;
 
-  /* Flush the uart IO fifo */
+  /* Zeroed when allocated but for these */
+  uart.tx_drain.lsr_supported = true;
+  uart.tx_drain.timer_fd = -1;
 
-  tcflush(fd_uart, TCIOFLUSH);
+  /* A bonded UART is never handed over nor on the rings, see config_validate_configuration() */
+  if (link == 0 && handoff_is_resuming()) {
+    /* Set up by the daemon that handed the link over, what the secondary sent since is kept */
+    uart.fd_uart = handoff_get_bus_fd();
+    uart.device_baudrate = handoff_get_secondary()->bus_speed;
+  } else {
+    uart.fd_uart = driver_uart_open(device, baudrate, hardflow);
 
-  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
-  FATAL_SYSCALL_ON(ret < 0);
+    /* Flush the uart IO fifo */
 
-  fd_core  = fd_sockets[0];
-  *fd_to_core = fd_sockets[1];
+    tcflush(uart.fd_uart, TCIOFLUSH);
+  }
 
-  ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
-  FATAL_SYSCALL_ON(ret < 0);
+  if (link == 0 && config.driver_rings) {
+    driver_ring_init(fd_to_core, fd_notify_core);
+
+    uart.fd_core = driver_ring_get_driver_doorbell();
+    uart.fd_core_notify = -1;
+  } else {
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets);
+    FATAL_SYSCALL_ON(ret < 0);
 
-  fd_core_notify  = fd_sockets_notify[0];
-  *fd_notify_core = fd_sockets_notify[1];
+    uart.fd_core  = fd_sockets[0];
+    *fd_to_core = fd_sockets[1];
+
+    ret = socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fd_sockets_notify);
+    FATAL_SYSCALL_ON(ret < 0);
+
+    uart.fd_core_notify  = fd_sockets_notify[0];
+    *fd_notify_core = fd_sockets_notify[1];
+  }
 
   /*
    * Create stop driver event, this file descriptor will be used by
    * receive and transmit thread to exit gracefully
    */
-  fd_stop_drv = driver_kill_init();
+  uart.fd_stop_drv = driver_kill_init();
 
   /* create transmitter driver thread */
-  ret = pthread_create(&tx_drv_thread, NULL, transmit_driver_thread_func, NULL);
+  ret = thread_create(&uart.tx_drv_thread, config.driver_sched, transmit_driver_thread_func, thread_param);
   FATAL_ON(ret != 0);
 
   /* create receiver driver thread */
-  ret = pthread_create(&rx_drv_thread, NULL, receive_driver_thread_func, NULL);
+  ret = thread_create(&uart.rx_drv_thread, config.driver_sched, receive_driver_thread_func, thread_param);
   FATAL_ON(ret != 0);
 
+  driver_uart_set_rx_thread_priority();
+
   /* create cleanup thread */
-  ret = pthread_create(&cleanup_thread, NULL, driver_uart_cleanup, NULL);
+  ret = thread_create(&uart.cleanup_thread, config.driver_sched, driver_uart_cleanup, thread_param);
   FATAL_ON(ret != 0);
 
-  ret = pthread_setname_np(tx_drv_thread, "tx_drv_thread");
+  ret = pthread_setname_np(uart.tx_drv_thread, link == 0 ? "tx_drv_thread" : "bond_tx_thread");
   FATAL_ON(ret != 0);
 
-  ret = pthread_setname_np(rx_drv_thread, "rx_drv_thread");
+  ret = pthread_setname_np(uart.rx_drv_thread, link == 0 ? "rx_drv_thread" : "bond_rx_thread");
   FATAL_ON(ret != 0);
 
   TRACE_DRIVER("Opening uart file %s", device);
 
+  if (config.uart_low_latency) {
+    char latency_timer[16] = "n/a";
+
+    if (uart_latency.usb_latency_timer_ms >= 0) {
+      snprintf(latency_timer, sizeof(latency_timer), "%d ms", uart_latency.usb_latency_timer_ms);
+    }
+
+    PRINT_INFO("UART low latency profile : ASYNC_LOW_LATENCY %s, USB latency timer %s, VMIN %u, VTIME %u, receiver thread %s",
+               uart_latency.async_low_latency ? "set" : "not supported",
+               latency_timer, 1, 0,
+               uart_latency.rx_thread_priority ? "SCHED_FIFO" : "not realtime");
+  } else if (uart_latency.rx_thread_priority) {
+    PRINT_INFO("UART receiver thread running SCHED_FIFO with priority %d", uart_latency.rx_thread_priority);
+  }
+
   TRACE_DRIVER("Init done");
 
-  return cleanup_thread;
+  /* The caller goes on with the first link */
+  uart_link = 0;
+
+  return uart_links[link].cleanup_thread;
+}
+
+pthread_t driver_uart_init(int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow)
+{
+  return driver_uart_init_link(0, fd_to_core, fd_notify_core, device, baudrate, hardflow);
+}
+
+pthread_t driver_uart_init_bonded(int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow)
+{
+  return driver_uart_init_link(1, fd_to_core, fd_notify_core, device, baudrate, hardflow);
 }
 
 void driver_uart_print_overruns(void)
 {
   struct serial_icounter_struct counters;
-  int retval = ioctl(fd_uart, TIOCGICOUNT, &counters);
+  int retval = ioctl(uart.fd_uart, TIOCGICOUNT, &counters);
   FATAL_SYSCALL_ON(retval < 0);
   TRACE_DRIVER("Overruns %d,%d", counters.overrun, counters.buf_overrun);
+
+  if (config.uart_tx_drain_polling && uart.tx_drain_stats.frames != 0) {
+    uint64_t early_frames = uart.tx_drain_stats.frames - uart.tx_drain_stats.late_frames;
+
+    TRACE_DRIVER("TX drain : %llu frames, %llu later than estimated (avg %llu us, max %llu us), the others avg %llu us early",
+                 (unsigned long long)uart.tx_drain_stats.frames,
+                 (unsigned long long)uart.tx_drain_stats.late_frames,
+                 (unsigned long long)(uart.tx_drain_stats.late_frames ? uart.tx_drain_stats.total_late_ns / uart.tx_drain_stats.late_frames / 1000 : 0),
+                 (unsigned long long)(uart.tx_drain_stats.max_late_ns / 1000),
+                 (unsigned long long)(early_frames ? uart.tx_drain_stats.total_early_ns / early_frames / 1000 : 0));
+  }
+}
+
+void driver_uart_add_metrics(metrics_t *metrics)
+{
+  struct serial_icounter_struct counters;
+
+  /* Not every tty keeps these counters */
+  if (ioctl(uart.fd_uart, TIOCGICOUNT, &counters) == 0) {
+    metrics_add_counter(metrics, "uart_overruns", NULL, NULL, (uint64_t)counters.overrun);
+    metrics_add_counter(metrics, "uart_buffer_overruns", NULL, NULL, (uint64_t)counters.buf_overrun);
+  }
+
+  if (config.uart_tx_drain_polling) {
+    metrics_add_counter(metrics, "uart_tx_drain_frames", NULL, NULL, uart.tx_drain_stats.frames);
+    metrics_add_counter(metrics, "uart_tx_drain_late_frames", NULL, NULL, uart.tx_drain_stats.late_frames);
+    metrics_add_counter(metrics, "uart_tx_drain_late_ns", NULL, NULL, uart.tx_drain_stats.total_late_ns);
+    metrics_add_gauge(metrics, "uart_tx_drain_max_late_ns", NULL, NULL, uart.tx_drain_stats.max_late_ns);
+  }
 }
 
 static void* driver_uart_cleanup(void *param)
 {
-  (void) param;
+  uart_link = (unsigned int)(uintptr_t)param;
 
   // wait for threads to exit
-  pthread_join(tx_drv_thread, NULL);
-  pthread_join(rx_drv_thread, NULL);
+  pthread_join(uart.tx_drv_thread, NULL);
+  pthread_join(uart.rx_drv_thread, NULL);
 
   TRACE_DRIVER("Uart driver threads cancelled");
 
-  close(fd_uart);
-  close(fd_core);
-  close(fd_core_notify);
-  close(fd_stop_drv);
+  close(uart.fd_uart);
+  /* The core may still ring the doorbells of the rings, they stay open */
+  if (!driver_ring_is_enabled()) {
+    close(uart.fd_core);
+    close(uart.fd_core_notify);
+  }
+  close(uart.fd_stop_drv);
+  if (uart.tx_drain.timer_fd != -1) {
+    close(uart.tx_drain.timer_fd);
+  }
 
   pthread_exit(NULL);
   return NULL;
@@ -176,7 +366,7 @@ static void* receive_driver_thread_func(void* param)
   int fd_epoll;
   int ret;
 
-  (void) param;
+  uart_link = (unsigned int)(uintptr_t)param;
 
   TRACE_DRIVER("Receiver thread start");
 
@@ -186,14 +376,14 @@ static void* receive_driver_thread_func(void* param)
 
   /* Setup poll event for reading uart device */
   events[0].events = EPOLLIN;
-  events[0].data.fd = fd_uart;
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_uart, &events[0]);
+  events[0].data.fd = uart.fd_uart;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, uart.fd_uart, &events[0]);
   FATAL_SYSCALL_ON(ret < 0);
 
   /* Setup poll event for stop event */
   events[1].events = EPOLLIN;
-  events[1].data.fd = fd_stop_drv;
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_stop_drv, &events[1]);
+  events[1].data.fd = uart.fd_stop_drv;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, uart.fd_stop_drv, &events[1]);
   FATAL_SYSCALL_ON(ret < 0);
 
   while (!exit_thread) {
@@ -202,7 +392,7 @@ static void* receive_driver_thread_func(void* param)
     /* Wait for action */
     {
       do {
-        event_count = epoll_wait(fd_epoll, events, 2, -1);
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, fd_epoll, events, 2, -1);
         if (event_count == -1 && errno == EINTR) {
           continue;
         }
@@ -220,9 +410,9 @@ static void* receive_driver_thread_func(void* param)
       for (event_i = 0; event_i != (size_t)event_count; event_i++) {
         int current_event_fd = events[event_i].data.fd;
 
-        if (current_event_fd == fd_uart) {
+        if (current_event_fd == uart.fd_uart) {
           driver_uart_process_uart();
-        } else if (current_event_fd == fd_stop_drv) {
+        } else if (current_event_fd == uart.fd_stop_drv) {
           exit_thread = true;
         }
       }
@@ -236,12 +426,12 @@ static void* receive_driver_thread_func(void* param)
 
 static void* transmit_driver_thread_func(void* param)
 {
-  struct epoll_event events[2] = {};
+  struct epoll_event events[3] = {};
   bool exit_thread = false;
   int fd_epoll;
   int ret;
 
-  (void) param;
+  uart_link = (unsigned int)(uintptr_t)param;
 
   TRACE_DRIVER("Transmitter thread start");
 
@@ -251,23 +441,34 @@ static void* transmit_driver_thread_func(void* param)
 
   /* Setup poll event for reading core socket */
   events[0].events = EPOLLIN;
-  events[0].data.fd = fd_core;
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_core, &events[0]);
+  events[0].data.fd = uart.fd_core;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, uart.fd_core, &events[0]);
   FATAL_SYSCALL_ON(ret < 0);
 
   /* Setup poll event for stop event */
   events[1].events = EPOLLIN;
-  events[1].data.fd = fd_stop_drv;
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_stop_drv, &events[1]);
+  events[1].data.fd = uart.fd_stop_drv;
+  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, uart.fd_stop_drv, &events[1]);
   FATAL_SYSCALL_ON(ret < 0);
 
+  /* Setup poll event for the drain polling timer */
+  if (config.uart_tx_drain_polling) {
+    uart.tx_drain.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    FATAL_SYSCALL_ON(uart.tx_drain.timer_fd < 0);
+
+    events[2].events = EPOLLIN;
+    events[2].data.fd = uart.tx_drain.timer_fd;
+    ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, uart.tx_drain.timer_fd, &events[2]);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
   while (!exit_thread) {
     int event_count;
 
     /* Wait for action */
     {
       do {
-        event_count = epoll_wait(fd_epoll, events, 2, -1);
+        event_count = busy_poll_epoll_wait(BUSY_POLL_THREAD_DRIVER, fd_epoll, events, 3, -1);
         if (event_count == -1 && errno == EINTR) {
           continue;
         }
@@ -285,9 +486,15 @@ static void* transmit_driver_thread_func(void* param)
       for (event_i = 0; event_i != (size_t)event_count; event_i++) {
         int current_event_fd = events[event_i].data.fd;
 
-        if (current_event_fd == fd_core) {
+        if (current_event_fd == uart.fd_core) {
           driver_uart_process_core();
-        } else if (current_event_fd == fd_stop_drv) {
+        } else if (current_event_fd == uart.tx_drain.timer_fd) {
+          uint64_t expirations;
+          ssize_t read_retval = read(uart.tx_drain.timer_fd, &expirations, sizeof(expirations));
+          FATAL_SYSCALL_ON(read_retval < 0 && errno != EAGAIN);
+
+          driver_uart_poll_tx_drain();
+        } else if (current_event_fd == uart.fd_stop_drv) {
           exit_thread = true;
         }
       }
@@ -299,23 +506,143 @@ static void* transmit_driver_thread_func(void* param)
   return 0;
 }
 
+/*
+ * USB serial converters hold received bytes until their latency timer expires, 16 ms
+ * by default for FTDI chips, unless the driver honors ASYNC_LOW_LATENCY.
+ */
+static int driver_uart_set_usb_latency_timer(const char *device)
+{
+  char real_device[PATH_MAX];
+  char path[PATH_MAX];
+  int latency_timer_ms = -1;
+  FILE *file;
+  int ret;
+
+  if (realpath(device, real_device) == NULL) {
+    return -1;
+  }
+
+  ret = snprintf(path, sizeof(path), "/sys/bus/usb-serial/devices/%s/latency_timer", basename(real_device));
+  if (ret < 0 || (size_t)ret >= sizeof(path)) {
+    return -1;
+  }
+
+  file = fopen(path, "r+");
+  if (file == NULL) {
+    /* Not an USB serial converter, or the driver has no latency timer */
+    return -1;
+  }
+
+  if (fputs("1", file) < 0 || fflush(file) != 0) {
+    WARN("Could not lower the latency timer of %s (%m)", device);
+  }
+
+  rewind(file);
+  if (fscanf(file, "%d", &latency_timer_ms) != 1) {
+    latency_timer_ms = -1;
+  }
+
+  fclose(file);
+
+  return latency_timer_ms;
+}
+
+/* Ask the tty to push received bytes to the line discipline right away, where the driver supports it */
+static void driver_uart_set_low_latency(int fd, const char *device)
+{
+  struct serial_struct serial;
+
+  if (ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+    serial.flags |= (int)ASYNC_LOW_LATENCY;
+
+    if (ioctl(fd, TIOCSSERIAL, &serial) == 0 && ioctl(fd, TIOCGSERIAL, &serial) == 0) {
+      uart_latency.async_low_latency = (serial.flags & (int)ASYNC_LOW_LATENCY) != 0;
+    }
+  }
+
+  if (!uart_latency.async_low_latency) {
+    WARN("%s does not support ASYNC_LOW_LATENCY", device);
+  }
+
+  uart_latency.usb_latency_timer_ms = driver_uart_set_usb_latency_timer(device);
+}
+
+/* In increasing order */
+static const struct {
+  unsigned int val;
+  int symbolic;
+} baudrate_conversion[] = {
+  { 9600, B9600 },
+  { 19200, B19200 },
+  { 38400, B38400 },
+  { 57600, B57600 },
+  { 115200, B115200 },
+  { 230400, B230400 },
+  { 460800, B460800 },
+  { 921600, B921600 },
+};
+
+static int driver_uart_get_symbolic_baudrate(unsigned int baudrate)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(baudrate_conversion); i++) {
+    if (baudrate_conversion[i].val == baudrate) {
+      return baudrate_conversion[i].symbolic;
+    }
+  }
+
+  return -1;
+}
+
+unsigned int driver_uart_get_highest_baudrate(unsigned int limit)
+{
+  unsigned int baudrate = 0;
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(baudrate_conversion); i++) {
+    if (baudrate_conversion[i].val <= limit) {
+      baudrate = baudrate_conversion[i].val;
+    }
+  }
+
+  return baudrate;
+}
+
+void driver_uart_set_baudrate(unsigned int baudrate)
+{
+  int sym_baudrate = driver_uart_get_symbolic_baudrate(baudrate);
+  struct termios tty;
+
+  BUG_ON(sym_baudrate < 0);
+
+  /* What was written at the current rate must go out at that rate */
+  FATAL_SYSCALL_ON(tcdrain(uart.fd_uart) < 0);
+
+  FATAL_SYSCALL_ON(tcgetattr(uart.fd_uart, &tty) < 0);
+  cfsetispeed(&tty, (speed_t)sym_baudrate);
+  cfsetospeed(&tty, (speed_t)sym_baudrate);
+  FATAL_SYSCALL_ON(tcsetattr(uart.fd_uart, TCSANOW, &tty) < 0);
+
+  uart.device_baudrate = baudrate;
+
+  TRACE_DRIVER("UART switched to %u bauds", baudrate);
+}
+
+unsigned int driver_uart_get_baudrate(void)
+{
+  return uart.device_baudrate;
+}
+
+int driver_uart_get_fd(void)
+{
+  return uart.fd_uart;
+}
+
 int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow)
 {
-  static const struct {
-    unsigned int val;
-    int symbolic;
-  } conversion[] = {
-    { 9600, B9600 },
-    { 19200, B19200 },
-    { 38400, B38400 },
-    { 57600, B57600 },
-    { 115200, B115200 },
-    { 230400, B230400 },
-    { 460800, B460800 },
-    { 921600, B921600 },
-  };
   struct termios tty;
-  int sym_baudrate = -1;
+  int sym_baudrate;
   int fd;
 
   fd = open(device, O_RDWR | O_CLOEXEC);
@@ -323,12 +650,7 @@ int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow)
 
   FATAL_SYSCALL_ON(tcgetattr(fd, &tty) < 0);
 
-  size_t i;
-  for (i = 0; i < ARRAY_SIZE(conversion); i++) {
-    if (conversion[i].val == baudrate) {
-      sym_baudrate = conversion[i].symbolic;
-    }
-  }
+  sym_baudrate = driver_uart_get_symbolic_baudrate(baudrate);
 
   if (sym_baudrate < 0) {
     FATAL("invalid baudrate: %d", baudrate);
@@ -337,7 +659,10 @@ int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow)
   cfsetispeed(&tty, (speed_t)sym_baudrate);
   cfsetospeed(&tty, (speed_t)sym_baudrate);
   cfmakeraw(&tty);
-  /* Nonblocking read. */
+  /* Nonblocking read. This is also the lowest latency setting: a bigger VMIN would only
+   * report the tty readable once that many bytes arrived, and a VTIME would add an
+   * inter-byte timer. Frames are delimited from whatever arrived, so nothing is gained
+   * by waiting for a whole frame in the tty. */
   tty.c_cc[VTIME] = 0;
   tty.c_cc[VMIN] = 1;
   tty.c_iflag &= (unsigned) ~(IXON);
@@ -353,6 +678,10 @@ int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow)
 
   FATAL_SYSCALL_ON(tcsetattr(fd, TCSANOW, &tty) < 0);
 
+  if (config.uart_low_latency) {
+    driver_uart_set_low_latency(fd, device);
+  }
+
   /* Flush the content of the UART in case there was stale data */
   {
     /* There was once a bug in the kernel requiring a delay before flushing the uart.
@@ -378,7 +707,7 @@ int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow)
     }
   }
 
-  device_baudrate = baudrate;
+  uart.device_baudrate = baudrate;
 
   return fd;
 }
@@ -388,12 +717,12 @@ void driver_uart_assert_rts(bool assert)
   int ret;
   int flag = TIOCM_RTS;
 
-  FATAL_ON(fd_uart < 0);
+  FATAL_ON(uart.fd_uart < 0);
 
   if (assert) {
-    ret = ioctl(fd_uart, TIOCMBIS, &flag);
+    ret = ioctl(uart.fd_uart, TIOCMBIS, &flag);
   } else {
-    ret = ioctl(fd_uart, TIOCMBIC, &flag);
+    ret = ioctl(uart.fd_uart, TIOCMBIC, &flag);
   }
 
   FATAL_SYSCALL_ON(ret < 0);
@@ -401,20 +730,16 @@ void driver_uart_assert_rts(bool assert)
 
 static void driver_uart_process_uart(void)
 {
-  static uint8_t buffer[UART_BUFFER_SIZE];
-  static size_t buffer_head = 0;
-  static enum {EXPECTING_HEADER, EXPECTING_PAYLOAD} state = EXPECTING_HEADER;
-
   /* Put the read data at the tip of the buffer head and increment it. */
-  buffer_head += read_and_append_uart_received_data(buffer, buffer_head, sizeof(buffer));
+  uart.rx_buffer.head += read_and_append_uart_received_data(&uart.rx_buffer);
 
   while (1) {
-    switch (state) {
+    switch (uart.rx_state) {
       case EXPECTING_HEADER:
         /* Synchronize the start of 'buffer' with the start of a valid header with valid checksum. */
-        if (header_re_synch(buffer, &buffer_head)) {
+        if (header_re_synch(&uart.rx_buffer)) {
           /* We are synchronized on a valid header, start delimiting the data that follows into a frame. */
-          state = EXPECTING_PAYLOAD;
+          uart.rx_state = EXPECTING_PAYLOAD;
         } else {
           /* We went through all the data contained in 'buffer' and haven't synchronized on a header.
            * Go back to waiting for more data. */
@@ -423,9 +748,9 @@ static void driver_uart_process_uart(void)
         break;
 
       case EXPECTING_PAYLOAD:
-        if (delimit_and_push_frames_to_core(buffer, &buffer_head)) {
+        if (delimit_and_push_frames_to_core(&uart.rx_buffer)) {
           /* A frame has been delimited and pushed to the core, go back to synchronizing on the next header */
-          state = EXPECTING_HEADER;
+          uart.rx_state = EXPECTING_HEADER;
         } else {
           /* Not yet enough data, go back to waiting. */
           return;
@@ -434,29 +759,37 @@ static void driver_uart_process_uart(void)
 
       default:
 
-        BUG("Illegal switch, Case : %d", state);
+        BUG("Illegal switch, Case : %d", uart.rx_state);
         break;
     }
   }
 }
 
 /* Append UART new data to the frame delimiter processing buffer */
-static size_t read_and_append_uart_received_data(uint8_t *buffer, size_t buffer_head, size_t buffer_size)
+static size_t read_and_append_uart_received_data(rx_buffer_t *buffer)
 {
-  uint8_t temp_buffer[UART_BUFFER_SIZE];
-
-  BUG_ON(buffer_head >= buffer_size);
+  const size_t pending_bytes = buffer->head - buffer->tail;
+
+  BUG_ON(buffer->head >= sizeof(buffer->data));
+
+  /* Bring the pending bytes back to the start of the buffer, only once they are past its
+   * middle or once there is no room left after them */
+  if (pending_bytes == 0) {
+    buffer->tail = 0;
+    buffer->head = 0;
+  } else if (buffer->tail >= sizeof(buffer->data) / 2 || buffer->head == sizeof(buffer->data) - 1) {
+    memmove(buffer->data, &buffer->data[buffer->tail], pending_bytes);
+    buffer->tail = 0;
+    buffer->head = pending_bytes;
+  }
 
   /* Make sure we don't read more data than the supplied buffer can handle */
-  const size_t available_space = buffer_size - buffer_head - 1;
+  const size_t available_space = sizeof(buffer->data) - buffer->head - 1;
 
-  /* Read the uart data into the temp buffer */
-  ssize_t read_retval = read(fd_uart, temp_buffer, available_space);
+  /* Read the uart data straight after the pending bytes */
+  ssize_t read_retval = read(uart.fd_uart, &buffer->data[buffer->head], available_space);
   FATAL_ON(read_retval < 0);
 
-  /* copy the data in the main buffer */
-  memcpy(&buffer[buffer_head], temp_buffer, (size_t)read_retval);
-
   return (size_t)read_retval;
 }
 
@@ -478,97 +811,93 @@ static bool validate_header(uint8_t *header_start)
   return true;
 }
 
-static bool header_re_synch(uint8_t *buffer, size_t *buffer_head)
+static bool header_re_synch(rx_buffer_t *buffer)
 {
-  if (*buffer_head < SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+  const size_t pending_bytes = buffer->head - buffer->tail;
+
+  if (pending_bytes < SLI_CPC_HDLC_HEADER_RAW_SIZE) {
     /* There's not enough data for a header, nothing to re-synch */
     return false;
   }
 
   /* If we think of a header like a sliding window of width SLI_CPC_HDLC_HEADER_RAW_SIZE,
    * then we can slide it 'num_header_combination' times over the data. */
-  const size_t num_header_combination = *buffer_head - SLI_CPC_HDLC_HEADER_RAW_SIZE + 1;
+  const size_t num_header_combination = pending_bytes - SLI_CPC_HDLC_HEADER_RAW_SIZE + 1;
+  const uint8_t *start = &buffer->data[buffer->tail];
+  const uint8_t *candidate = start;
+  const uint8_t *end = start + num_header_combination;
 
   TRACE_DRIVER("re-sync : Will test %i header combination", num_header_combination);
 
-  size_t i;
+  /* Only the positions holding the flag can start a header, skip to them before checking the checksum */
+  while ((candidate = memchr(candidate, SLI_CPC_HDLC_FLAG_VAL, (size_t)(end - candidate))) != NULL) {
+    if (validate_header((uint8_t *)candidate)) {
+      const size_t i = (size_t)(candidate - start);
 
-  for (i = 0; i != num_header_combination; i++) {
-    if (validate_header(&buffer[i])) {
       if (i == 0) {
-        /* The start of the buffer is aligned with a good header, don't do anything */
+        /* The tail of the buffer is aligned with a good header, don't do anything */
         TRACE_DRIVER("re-sync : The start of the buffer is aligned with a good header");
       } else {
-        /* We had 'i' number of bad bytes until we struck a good header, move back the data
-         * to the beginning of the buffer */
-        memmove(&buffer[0], &buffer[i], *buffer_head - i);
-
-        /* We crushed 'i' bytes at the start of the buffer */
-        *buffer_head -= i;
+        /* We had 'i' number of bad bytes until we struck a good header, drop them */
+        buffer->tail += i;
         TRACE_DRIVER("re-sync : had '%u' number of bad bytes until we struck a good header", i);
       }
       return true;
     } else {
       /* The header is not valid, continue until it is */
+      candidate++;
     }
   }
 
-  /* If we land here, no header at all was found. Keep the last 'SLI_CPC_HDLC_HEADER_RAW_SIZE - 1' bytes and
-   * bring them back at the start of the buffer so that the next appended byte could complete that potential header */
-  {
-    memmove(&buffer[0], &buffer[num_header_combination], SLI_CPC_HDLC_HEADER_RAW_SIZE - 1);
-
-    *buffer_head = SLI_CPC_HDLC_HEADER_RAW_SIZE - 1;
-  }
+  /* If we land here, no header at all was found. Keep the last 'SLI_CPC_HDLC_HEADER_RAW_SIZE - 1' bytes
+   * so that the next appended byte could complete that potential header */
+  buffer->tail += num_header_combination;
 
   return false;
 }
 
 /*
- * In this function, it is assumed that the start of the buffer 'buffer' is aligned with the
- * start of a header because each time this function delimits a frame, it moves back the
- * remaining data back to the start of the buffer. Except when things go wrong, the start
- * if the remaining data will be the start of a next header.
+ * In this function, it is assumed that the tail of the buffer is aligned with the
+ * start of a header because each time this function delimits a frame, it advances the
+ * tail past it. Except when things go wrong, the tail will be the start of a next header.
  */
-static bool delimit_and_push_frames_to_core(uint8_t *buffer, size_t *buffer_head)
+static bool delimit_and_push_frames_to_core(rx_buffer_t *buffer)
 {
   uint16_t payload_len; /* The length of the payload, as retrieved from the header (including the checksum) */
   size_t frame_size; /* The whole size of the frame */
+  const uint8_t *frame = &buffer->data[buffer->tail];
 
   /* if not enough bytes even for a header */
-  if (*buffer_head < SLI_CPC_HDLC_HEADER_RAW_SIZE) {
+  if (buffer->head - buffer->tail < SLI_CPC_HDLC_HEADER_RAW_SIZE) {
     return false;
   }
 
-  payload_len = hdlc_get_length(buffer);
+  payload_len = hdlc_get_length(frame);
 
   frame_size = payload_len + SLI_CPC_HDLC_HEADER_RAW_SIZE;
 
   /* Check if we have enough data for a full frame*/
-  if (frame_size > *buffer_head) {
+  if (frame_size > buffer->head - buffer->tail) {
     return false;
   }
 
   /* Push to core */
   {
-    TRACE_FRAME("Driver : Frame delimiter : push delimited frame to core : ", buffer, frame_size);
+    TRACE_DRIVER_FRAME("Frame delimiter : push delimited frame to core : ", frame, frame_size);
 
-    ssize_t write_retval = write(fd_core, buffer, frame_size);
-    FATAL_SYSCALL_ON(write_retval < 0);
+    if (driver_ring_is_enabled()) {
+      driver_ring_push_frame_to_core(frame, frame_size);
+    } else {
+      ssize_t write_retval = write(uart.fd_core, frame, frame_size);
+      FATAL_SYSCALL_ON(write_retval < 0);
 
-    /* Error if write is not complete */
-    FATAL_ON((size_t)write_retval != frame_size);
+      /* Error if write is not complete */
+      FATAL_ON((size_t)write_retval != frame_size);
+    }
   }
 
-  /* Move the remaining data back to the start of the buffer. */
-  {
-    const size_t remaining_bytes = *buffer_head - frame_size;
-
-    memmove(buffer, &buffer[frame_size], remaining_bytes);
-
-    /* Adjust the buffer_head now that we have modified the buffer's content */
-    *buffer_head = remaining_bytes;
-  }
+  /* The remaining data starts right after this frame */
+  buffer->tail += frame_size;
 
   /* A complete frame has been delimited. A second round of parsing can be done. */
   return true;
@@ -576,9 +905,9 @@ static bool delimit_and_push_frames_to_core(uint8_t *buffer, size_t *buffer_head
 
 static long driver_get_time_to_drain_ns(uint32_t bytes_left)
 {
-  BUG_ON(device_baudrate == 0);
+  BUG_ON(uart.device_baudrate == 0);
   uint64_t nanoseconds;
-  uint64_t bytes_per_sec = device_baudrate / 8;
+  uint64_t bytes_per_sec = uart.device_baudrate / 8;
 
   nanoseconds = bytes_left * (uint64_t)1000000000 / bytes_per_sec;
 
@@ -587,40 +916,239 @@ static long driver_get_time_to_drain_ns(uint32_t bytes_left)
 
 static void driver_uart_process_core(void)
 {
+  struct mmsghdr msgs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct iovec iovecs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct timespec tx_complete_timestamps[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct timespec now;
+  size_t total_length = 0;
+  size_t bytes_after;
+  int frame_count;
   int ret;
   int length;
-  uint8_t buffer[UART_BUFFER_SIZE];
-  ssize_t read_retval;
+  int i;
 
+  /* Make room to track the completion of a whole batch, waiting for older frames to drain */
+  while (config.uart_tx_drain_polling && uart.tx_drain.count + SLI_CPC_DRIVER_TX_BATCH_SIZE > TX_DRAIN_PENDING_FRAMES_MAX) {
+    sleep_us((uint32_t)(uart.tx_drain.poll_interval_ns / 1000));
+    driver_uart_poll_tx_drain();
+  }
+
+  /* Read every frame the core queued, it hands them over in batches */
   {
-    read_retval = read(fd_core, buffer, sizeof(buffer));
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < SLI_CPC_DRIVER_TX_BATCH_SIZE; i++) {
+      iovecs[i].iov_base = uart.tx_buffers[i];
+      iovecs[i].iov_len = sizeof(uart.tx_buffers[i]);
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 
-    FATAL_SYSCALL_ON(read_retval < 0);
+    if (driver_ring_is_enabled()) {
+      frame_count = driver_ring_pop_frames_from_core(msgs, SLI_CPC_DRIVER_TX_BATCH_SIZE);
+    } else {
+      frame_count = recvmmsg(uart.fd_core, msgs, SLI_CPC_DRIVER_TX_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    }
+
+    FATAL_SYSCALL_ON(frame_count < 0);
+
+    /* The core closed the socket, the driver is being killed */
+    if (frame_count == 0) {
+      return;
+    }
   }
 
+  /* Write the whole batch to the UART at once, so that its FIFO never runs dry between frames */
   {
-    ssize_t write_retval = write(fd_uart, buffer, (size_t)read_retval);
+    for (i = 0; i < frame_count; i++) {
+      iovecs[i].iov_len = msgs[i].msg_len;
+      total_length += msgs[i].msg_len;
+    }
+
+    ssize_t write_retval = writev(uart.fd_uart, iovecs, frame_count);
 
     FATAL_SYSCALL_ON(write_retval < 0);
 
     /* Error if write is not complete */
-    FATAL_ON((size_t)write_retval != (size_t)read_retval);
+    FATAL_ON((size_t)write_retval != total_length);
   }
 
-  ret = ioctl(fd_uart, TIOCOUTQ, &length);
+  ret = ioctl(uart.fd_uart, TIOCOUTQ, &length);
   TRACE_DRIVER("%d bytes left in the UART char driver", length);
   FATAL_SYSCALL_ON(ret < 0);
 
-  struct timespec tx_complete_timestamp;
-  clock_gettime(CLOCK_MONOTONIC, &tx_complete_timestamp);
+  clock_gettime(CLOCK_MONOTONIC, &now);
 
-  if (tx_complete_timestamp.tv_nsec + driver_get_time_to_drain_ns((uint32_t)length) > 1000000000) {
-    tx_complete_timestamp.tv_sec += (tx_complete_timestamp.tv_nsec + driver_get_time_to_drain_ns((uint32_t)length)) / 1000000000;
+  /* A frame is out once the bytes queued before its end drained */
+  bytes_after = 0;
+  for (i = frame_count - 1; i >= 0; i--) {
+    long drain_ns = 0;
+
+    if ((size_t)length > bytes_after) {
+      drain_ns = driver_get_time_to_drain_ns((uint32_t)((size_t)length - bytes_after));
+    }
+
+    tx_complete_timestamps[i].tv_sec = now.tv_sec + (now.tv_nsec + drain_ns) / 1000000000;
+    tx_complete_timestamps[i].tv_nsec = (now.tv_nsec + drain_ns) % 1000000000;
+
+    bytes_after += msgs[i].msg_len;
+  }
+
+  /* The completions are pushed once the frames actually drained */
+  if (config.uart_tx_drain_polling) {
+    for (i = 0; i < frame_count; i++) {
+      tx_pending_frame_t *pending = &uart.tx_drain.frames[(uart.tx_drain.first + uart.tx_drain.count) % TX_DRAIN_PENDING_FRAMES_MAX];
+
+      uart.tx_drain.bytes_written += msgs[i].msg_len;
+      pending->end_offset = uart.tx_drain.bytes_written;
+      pending->estimated = tx_complete_timestamps[i];
+      uart.tx_drain.count++;
+    }
+
+    /* First poll when the baud rate says the oldest frame is out */
+    uart.tx_drain.poll_interval_ns = 0;
+    driver_uart_poll_tx_drain();
+    return;
   }
-  tx_complete_timestamp.tv_nsec += driver_get_time_to_drain_ns((uint32_t)length);
-  tx_complete_timestamp.tv_nsec %= 1000000000;
 
-  /* Push write notification to core */
-  ssize_t write_retval = write(fd_core_notify, &tx_complete_timestamp, sizeof(tx_complete_timestamp));
-  FATAL_SYSCALL_ON(write_retval != sizeof(tx_complete_timestamp));
+  /* Push write notification to core, one completion time per frame */
+  driver_uart_notify_tx_complete(tx_complete_timestamps, (size_t)frame_count);
+}
+
+static bool driver_uart_transmitter_is_empty(void)
+{
+  unsigned int lsr;
+
+  if (!uart.tx_drain.lsr_supported) {
+    return true;
+  }
+
+  /* The output queue is empty, the last bytes may still be in the FIFO of the UART */
+  if (ioctl(uart.fd_uart, TIOCSERGETLSR, &lsr) < 0) {
+    TRACE_DRIVER("TIOCSERGETLSR not supported (%m), drain times won't account for the UART FIFO");
+    uart.tx_drain.lsr_supported = false;
+    return true;
+  }
+
+  return (lsr & TIOCSER_TEMT) != 0;
+}
+
+static void driver_uart_record_tx_drain(const struct timespec *estimated, const struct timespec *actual)
+{
+  int64_t delta_ns = ((int64_t)actual->tv_sec - (int64_t)estimated->tv_sec) * 1000000000
+                     + ((int64_t)actual->tv_nsec - (int64_t)estimated->tv_nsec);
+
+  uart.tx_drain_stats.frames++;
+
+  if (delta_ns > 0) {
+    uart.tx_drain_stats.late_frames++;
+    uart.tx_drain_stats.total_late_ns += (uint64_t)delta_ns;
+    if ((uint64_t)delta_ns > uart.tx_drain_stats.max_late_ns) {
+      uart.tx_drain_stats.max_late_ns = (uint64_t)delta_ns;
+    }
+  } else {
+    uart.tx_drain_stats.total_early_ns += (uint64_t)-delta_ns;
+  }
+}
+
+static void driver_uart_notify_tx_complete(const struct timespec *tx_complete_timestamps, size_t count)
+{
+  sl_cpc_tx_complete_t tx_completes[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  size_t i;
+
+  BUG_ON(count > SLI_CPC_DRIVER_TX_BATCH_SIZE);
+
+  for (i = 0; i < count; i++) {
+    tx_completes[i].frame_id = uart.tx_frame_id++;
+    tx_completes[i].timestamp = tx_complete_timestamps[i];
+  }
+
+  if (driver_ring_is_enabled()) {
+    driver_ring_notify_tx_complete(tx_completes, count);
+    return;
+  }
+
+  ssize_t write_retval = write(uart.fd_core_notify, tx_completes, count * sizeof(sl_cpc_tx_complete_t));
+  FATAL_SYSCALL_ON(write_retval != (ssize_t)(count * sizeof(sl_cpc_tx_complete_t)));
+}
+
+/* Report the frames the UART sent and arm the timer for the next poll */
+static void driver_uart_poll_tx_drain(void)
+{
+  struct timespec tx_complete_timestamps[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+  struct itimerspec next_poll = { 0 };
+  struct timespec now;
+  uint64_t bytes_drained;
+  size_t completed = 0;
+  long poll_ns;
+  int length;
+  int ret;
+
+  if (uart.tx_drain.count == 0) {
+    return;
+  }
+
+  ret = ioctl(uart.fd_uart, TIOCOUTQ, &length);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  bytes_drained = uart.tx_drain.bytes_written - (uint64_t)length;
+
+  while (uart.tx_drain.count > 0) {
+    tx_pending_frame_t *pending = &uart.tx_drain.frames[uart.tx_drain.first];
+
+    if (pending->end_offset > bytes_drained) {
+      break;
+    }
+
+    if (pending->end_offset == uart.tx_drain.bytes_written && !driver_uart_transmitter_is_empty()) {
+      break;
+    }
+
+    driver_uart_record_tx_drain(&pending->estimated, &now);
+    tx_complete_timestamps[completed++] = now;
+
+    uart.tx_drain.first = (uart.tx_drain.first + 1) % TX_DRAIN_PENDING_FRAMES_MAX;
+    uart.tx_drain.count--;
+
+    /* Push write notification to core, one completion time per frame */
+    if (completed == SLI_CPC_DRIVER_TX_BATCH_SIZE) {
+      driver_uart_notify_tx_complete(tx_complete_timestamps, completed);
+      completed = 0;
+    }
+  }
+
+  if (completed != 0) {
+    driver_uart_notify_tx_complete(tx_complete_timestamps, completed);
+  }
+
+  if (uart.tx_drain.count == 0) {
+    uart.tx_drain.poll_interval_ns = 0;
+    return;
+  }
+
+  /* Poll when the next frame should be out, or back off if nothing drained since the last poll */
+  if (bytes_drained == uart.tx_drain.bytes_drained && uart.tx_drain.poll_interval_ns != 0) {
+    poll_ns = uart.tx_drain.poll_interval_ns * 2;
+  } else if (uart.tx_drain.frames[uart.tx_drain.first].end_offset > bytes_drained) {
+    poll_ns = driver_get_time_to_drain_ns((uint32_t)(uart.tx_drain.frames[uart.tx_drain.first].end_offset - bytes_drained));
+  } else {
+    /* Only the FIFO of the UART is left */
+    poll_ns = TX_DRAIN_POLL_MIN_NS;
+  }
+
+  if (poll_ns < TX_DRAIN_POLL_MIN_NS) {
+    poll_ns = TX_DRAIN_POLL_MIN_NS;
+  } else if (poll_ns > TX_DRAIN_POLL_MAX_NS) {
+    poll_ns = TX_DRAIN_POLL_MAX_NS;
+  }
+
+  uart.tx_drain.bytes_drained = bytes_drained;
+  uart.tx_drain.poll_interval_ns = poll_ns;
+
+  next_poll.it_value.tv_sec = poll_ns / 1000000000;
+  next_poll.it_value.tv_nsec = poll_ns % 1000000000;
+
+  ret = timerfd_settime(uart.tx_drain.timer_fd, 0, &next_poll, NULL);
+  FATAL_SYSCALL_ON(ret < 0);
 }
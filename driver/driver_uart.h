@@ -22,6 +22,8 @@
 #include <pthread.h>
 #include <stdbool.h>
 
+#include "misc/metrics.h"
+
 /*
  * Initialize the uart driver. Crashes the app if the init fails.
  * Returns the file descriptor of the paired socket to the driver
@@ -29,9 +31,27 @@
  */
 pthread_t driver_uart_init(int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow);
 
+/* Same for the UART bonded with the bus, see driver/driver_bond.h.
+ * The other functions act on the first UART. */
+pthread_t driver_uart_init_bonded(int *fd_to_core, int *fd_notify_core, const char *device, unsigned int baudrate, bool hardflow);
+
 int driver_uart_open(const char *device, unsigned int baudrate, bool hardflow);
 void driver_uart_assert_rts(bool assert);
 
+/* The highest baud rate the driver supports up to 'limit', 0 if there is none */
+unsigned int driver_uart_get_highest_baudrate(unsigned int limit);
+
+/* Switch the UART to another supported baud rate once what was written is out */
+void driver_uart_set_baudrate(unsigned int baudrate);
+
+/* The baud rate in use, once the reset sequence negotiated it */
+unsigned int driver_uart_get_baudrate(void);
+
+/* The UART device, handed over on a hot restart */
+int driver_uart_get_fd(void);
+
 void driver_uart_print_overruns(void);
 
+void driver_uart_add_metrics(metrics_t *metrics);
+
 #endif //DRIVER_UART_H
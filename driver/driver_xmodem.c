@@ -34,6 +34,54 @@
 
 #define MAX_RETRANSMIT_ATTEMPTS (5)
 
+/* Blocks sent ahead of the acknowledgements in streaming mode */
+#define XMODEM_STREAMING_WINDOW (8)
+
+typedef union {
+  XmodemFrame_t crc;
+  Xmodem1kFrame_t large;
+} xmodem_frame_t;
+
+/* The tail of the image goes in 128 bytes blocks, to pad it less */
+static size_t xmodem_block_size(xmodem_mode_t mode, size_t remaining)
+{
+  if (mode == XMODEM_MODE_CRC || remaining <= XMODEM_DATA_SIZE) {
+    return XMODEM_DATA_SIZE;
+  }
+
+  return XMODEM_1K_DATA_SIZE;
+}
+
+/* Returns the length of the frame to send */
+static size_t xmodem_build_frame(xmodem_frame_t *frame, xmodem_mode_t mode, uint8_t seq,
+                                 const uint8_t *data, size_t remaining)
+{
+  size_t block_size = xmodem_block_size(mode, remaining);
+  size_t z = min(remaining, block_size);
+  uint8_t *payload;
+  uint16_t crc;
+
+  if (block_size == XMODEM_1K_DATA_SIZE) {
+    frame->large.header = XMODEM_CMD_STX;
+    frame->large.seq = seq;
+    frame->large.seq_neg = (uint8_t)(0xff - seq);
+    payload = frame->large.data;
+  } else {
+    frame->crc.header = XMODEM_CMD_SOH;
+    frame->crc.seq = seq;
+    frame->crc.seq_neg = (uint8_t)(0xff - seq);
+    payload = frame->crc.data;
+  }
+
+  memcpy(payload, data, z);
+  memset(payload + z, 0xff, block_size - z); //Pad last frame with 0xFF
+
+  crc = __builtin_bswap16(sli_cpc_get_crc_sw(payload, (uint16_t)block_size));
+  memcpy(payload + block_size, &crc, sizeof(crc));
+
+  return 3 + block_size + sizeof(crc);
+}
+
 // data from the bootloader comes in chunks
 static bool wait_for_bootloader_string(int fd, char *string)
 {
@@ -69,8 +117,9 @@ static bool wait_for_bootloader_string(int fd, char *string)
   return true;
 }
 
-sl_status_t xmodem_send(const char* image_file, const char *dev_name, unsigned  int bitrate, bool hardflow)
+sl_status_t xmodem_send(const char* image_file, const char *dev_name, unsigned  int bitrate, bool hardflow, xmodem_mode_t mode)
 {
+  xmodem_frame_t frame;
   int uart_fd;
   int image_file_fd;
   uint8_t* mmapped_image_file_data;
@@ -124,63 +173,78 @@ sl_status_t xmodem_send(const char* image_file, const char *dev_name, unsigned
       FATAL_SYSCALL_ON(ret != sizeof(answer));
     } while (answer != XMODEM_CMD_C);
 
-    TRACE_XMODEM("Received \"C\" ping. Transfer begins : ");
+    TRACE_XMODEM("Received \"C\" ping. Transfer begins in %s mode : ",
+                 mode == XMODEM_MODE_STREAMING ? "streaming" : mode == XMODEM_MODE_1K ? "XMODEM-1K" : "XMODEM-CRC");
   }
 
   /* Actual file transfer */
   {
-    XmodemFrame_t frame;
     uint8_t* image_file_data = mmapped_image_file_data;
     size_t image_file_len = mmapped_image_file_len;
-
-    frame.header = XMODEM_CMD_SOH;
-    frame.seq = 1; //Sequence number starts at one initially, wraps around to 0 afterward
-
-    while (image_file_len) {
-      size_t z = 0;
-      bool proceed_to_next_frame = false;
+    unsigned int total_retransmits = 0;
+    size_t window = (mode == XMODEM_MODE_STREAMING) ? XMODEM_STREAMING_WINDOW : 1;
+    size_t queued = 0;      // Blocks sent and not answered yet
+    size_t queued_len = 0;  // Bytes of the image in these blocks
+    bool rejected = false;  // A queued block was rejected, the ones after it are ignored
+    uint8_t seq = 1; //Sequence number starts at one initially, wraps around to 0 afterward
+
+    while (image_file_len || queued) {
       char status;
 
-      z = min(image_file_len, sizeof(frame.data));
-
-      memcpy(frame.data, image_file_data, z);
-      memset(frame.data + z, 0xff, sizeof(frame.data) - z); //Pad last frame with 0xFF
+      /* Keep the window full */
+      while (!rejected && queued < window && queued_len < image_file_len) {
+        size_t frame_len = xmodem_build_frame(&frame, mode, (uint8_t)(seq + queued),
+                                              image_file_data + queued_len,
+                                              image_file_len - queued_len);
 
-      frame.crc = __builtin_bswap16(sli_cpc_get_crc_sw(frame.data, sizeof(frame.data)));
+        ret = write(uart_fd, &frame, frame_len);
+        FATAL_SYSCALL_ON(ret != (ssize_t)frame_len);
 
-      frame.seq_neg = (uint8_t)(0xff - frame.seq);
-
-      ret = write(uart_fd, &frame, sizeof(frame));
-      FATAL_SYSCALL_ON(ret != sizeof(frame));
+        queued_len += min(image_file_len - queued_len, xmodem_block_size(mode, image_file_len - queued_len));
+        queued++;
+      }
 
+      /* Every block is answered, in order */
       ret = read(uart_fd, &answer, sizeof(answer));
       FATAL_SYSCALL_ON(ret != sizeof(answer));
+      queued--;
 
       switch (answer) {
         case XMODEM_CMD_NAK:
-          TRACE_XMODEM("Received XMODEM_CMD_NAK for frame number %d, retrying.", frame.seq);
+          if (!rejected) {
+            TRACE_XMODEM("Received XMODEM_CMD_NAK for frame number %d, retrying.", seq);
+            retransmit_count++;
+            total_retransmits++;
+            rejected = true;
+          }
           status = 'N';
-          retransmit_count++;
           break;
 
         case XMODEM_CMD_ACK:
-          TRACE_XMODEM("Sent frame number %d successfully.", frame.seq);
+          if (!rejected) {
+            size_t z = min(image_file_len, xmodem_block_size(mode, image_file_len));
+
+            TRACE_XMODEM("Sent frame number %d successfully.", seq);
+            seq++;
+            image_file_len -= z;
+            image_file_data += z;
+            queued_len -= z;
+            retransmit_count = 0;
+          }
           status = '.';
-          proceed_to_next_frame = true;
-          retransmit_count = 0;
           break;
 
         default:
-          FATAL("Error in file upload, received 0x%X when sending frame number %d.", answer, frame.seq);
+          FATAL("Error in file upload, received 0x%X when sending frame number %d.", answer, seq);
           break;
       }
 
       trace_no_timestamp("%c", status);
 
-      if (proceed_to_next_frame) {
-        frame.seq++;
-        image_file_len -= z;
-        image_file_data += z;
+      /* Once the blocks sent after the rejected one are answered, go back to it */
+      if (rejected && queued == 0) {
+        rejected = false;
+        queued_len = 0;
       }
 
       if (retransmit_count > MAX_RETRANSMIT_ATTEMPTS) {
@@ -189,7 +253,7 @@ sl_status_t xmodem_send(const char* image_file, const char *dev_name, unsigned
       }
     }
     TRACE_XMODEM("Finished sending image file. Sent a total of %d Bytes.", (size_t)(image_file_data - mmapped_image_file_data));
-    TRACE_XMODEM("Transfer of file \"%s\" completed with %u retransmits.", image_file, retransmit_count);
+    TRACE_XMODEM("Transfer of file \"%s\" completed with %u retransmits.", image_file, total_retransmits);
   }
 
   trace_no_timestamp("\n");
@@ -19,11 +19,14 @@
 #define DRIVER_XMODEM_H
 
 #include <stdbool.h>
+#include "misc/config.h"
 #include "misc/sl_status.h"
 
-sl_status_t xmodem_send(const char   *image_file,
-                        const char   *dev_name,
-                        unsigned int bitrate,
-                        bool         hardflow);
+/* mode is XMODEM_MODE_CRC, XMODEM_MODE_1K or XMODEM_MODE_STREAMING */
+sl_status_t xmodem_send(const char    *image_file,
+                        const char    *dev_name,
+                        unsigned int  bitrate,
+                        bool          hardflow,
+                        xmodem_mode_t mode);
 
 #endif //DRIVER_XMODEM_H
@@ -0,0 +1,295 @@
+//! Endpoints for tokio, built on the pollable file descriptor of libcpc.
+//!
+//! The endpoint is put in non-blocking mode and its file descriptor is
+//! registered with the reactor, so reads and writes are done on the task
+//! calling them, without a blocking thread. Frames are received straight in
+//! the buffer of the returned `Bytes`, and written from the caller's buffers.
+
+use crate::{cpc_endpoint, sl_cpc};
+use bytes::{Bytes, BytesMut};
+use std::io;
+use std::os::unix::io::{AsRawFd, RawFd};
+use std::pin::Pin;
+use std::task::{Context, Poll};
+use tokio::io::unix::AsyncFd;
+use tokio::io::Interest;
+
+/// Frames read with a single call by `read_frames()`, at most
+const READ_BATCH_SIZE: usize = 16;
+
+struct EndpointFd(RawFd);
+
+impl AsRawFd for EndpointFd {
+    fn as_raw_fd(&self) -> RawFd {
+        self.0
+    }
+}
+
+fn errno_to_io(err: isize) -> io::Error {
+    io::Error::from_raw_os_error(-err as i32)
+}
+
+fn would_block(err: isize) -> bool {
+    errno_to_io(err).kind() == io::ErrorKind::WouldBlock
+}
+
+pub struct AsyncEndpoint {
+    endpoint: cpc_endpoint,
+    fd: AsyncFd<EndpointFd>,
+    // With the shared memory transport, the file descriptor only signals reads
+    socket_transport: bool,
+    rx: BytesMut,
+}
+
+unsafe impl Send for AsyncEndpoint {}
+
+impl AsyncEndpoint {
+    /// Take over an opened endpoint. Must be called from a tokio runtime, and
+    /// after enabling the shared memory transport if it is used.
+    pub fn new(endpoint: cpc_endpoint) -> io::Result<AsyncEndpoint> {
+        crate::set_endpoint_blocking(&endpoint, false).map_err(|err| errno_to_io(err as isize))?;
+
+        let fd = unsafe { sl_cpc::cpc_get_endpoint_fd(endpoint.endpoint) };
+        if fd < 0 {
+            return Err(errno_to_io(fd as isize));
+        }
+
+        let socket_transport = fd == endpoint.fd;
+        let interest = if socket_transport {
+            Interest::READABLE | Interest::WRITABLE
+        } else {
+            Interest::READABLE
+        };
+
+        Ok(AsyncEndpoint {
+            endpoint,
+            fd: AsyncFd::with_interest(EndpointFd(fd), interest)?,
+            socket_transport,
+            rx: BytesMut::new(),
+        })
+    }
+
+    /// Give the endpoint back, still in non-blocking mode
+    pub fn into_inner(self) -> cpc_endpoint {
+        self.endpoint
+    }
+
+    pub fn endpoint(&self) -> &cpc_endpoint {
+        &self.endpoint
+    }
+
+    fn reserve_rx(&mut self, frames: usize) {
+        self.rx.reserve(frames * sl_cpc::SL_CPC_READ_MINIMUM_SIZE as usize);
+    }
+
+    fn try_read_frame(&mut self) -> Result<Bytes, isize> {
+        self.reserve_rx(1);
+
+        let bytes_read = unsafe {
+            sl_cpc::cpc_read_endpoint(
+                self.endpoint.endpoint,
+                self.rx.spare_capacity_mut().as_mut_ptr() as *mut std::ffi::c_void,
+                sl_cpc::SL_CPC_READ_MINIMUM_SIZE.try_into().unwrap(),
+                sl_cpc::cpc_endpoint_read_flags_t_enum::CPC_ENDPOINT_READ_FLAG_NON_BLOCKING
+                    as sl_cpc::cpc_endpoint_read_flags_t,
+            )
+        };
+
+        if bytes_read < 0 {
+            return Err(bytes_read);
+        }
+
+        unsafe { self.rx.set_len(bytes_read as usize) };
+        Ok(self.rx.split().freeze())
+    }
+
+    fn try_read_frames(&mut self, count: usize) -> Result<Vec<Bytes>, isize> {
+        let frame_size = sl_cpc::SL_CPC_READ_MINIMUM_SIZE as usize;
+
+        self.reserve_rx(count);
+
+        let base = self.rx.spare_capacity_mut().as_mut_ptr() as *mut u8;
+        let mut msgs: Vec<sl_cpc::cpc_endpoint_msg_t> = (0..count)
+            .map(|i| sl_cpc::cpc_endpoint_msg_t {
+                buffer: unsafe { base.add(i * frame_size) } as *mut std::ffi::c_void,
+                length: frame_size.try_into().unwrap(),
+                status: 0,
+            })
+            .collect();
+
+        let read = unsafe {
+            sl_cpc::cpc_read_endpoint_batch(
+                self.endpoint.endpoint,
+                msgs.as_mut_ptr(),
+                msgs.len().try_into().unwrap(),
+                sl_cpc::cpc_endpoint_read_flags_t_enum::CPC_ENDPOINT_READ_FLAG_NON_BLOCKING
+                    as sl_cpc::cpc_endpoint_read_flags_t,
+            )
+        };
+
+        if read < 0 {
+            return Err(read as isize);
+        }
+
+        // The frames share the allocation, each keeps its slot of the buffer
+        unsafe { self.rx.set_len(read as usize * frame_size) };
+        Ok(msgs[..read as usize]
+            .iter()
+            .map(|msg| {
+                let mut frame = self.rx.split_to(frame_size);
+                frame.truncate(msg.status as usize);
+                frame.freeze()
+            })
+            .collect())
+    }
+
+    fn poll_read_with<T>(
+        &mut self,
+        cx: &mut Context<'_>,
+        mut read: impl FnMut(&mut Self) -> Result<T, isize>,
+    ) -> Poll<io::Result<T>> {
+        loop {
+            // Try first, the file descriptor is edge triggered
+            match read(self) {
+                Ok(value) => return Poll::Ready(Ok(value)),
+                Err(err) if would_block(err) => {}
+                Err(err) => return Poll::Ready(Err(errno_to_io(err))),
+            }
+
+            let mut guard = match self.fd.poll_read_ready(cx) {
+                Poll::Ready(Ok(guard)) => guard,
+                Poll::Ready(Err(err)) => return Poll::Ready(Err(err)),
+                Poll::Pending => return Poll::Pending,
+            };
+            guard.clear_ready();
+        }
+    }
+
+    pub fn poll_read_frame(&mut self, cx: &mut Context<'_>) -> Poll<io::Result<Bytes>> {
+        self.poll_read_with(cx, |ep| ep.try_read_frame())
+    }
+
+    /// Wait for a frame of the secondary
+    pub async fn read_frame(&mut self) -> io::Result<Bytes> {
+        std::future::poll_fn(|cx| self.poll_read_frame(cx)).await
+    }
+
+    /// Wait for at least one frame, and take the ones already received, up to
+    /// 16 per call
+    pub async fn read_frames(&mut self) -> io::Result<Vec<Bytes>> {
+        std::future::poll_fn(|cx| self.poll_read_with(cx, |ep| ep.try_read_frames(READ_BATCH_SIZE)))
+            .await
+    }
+
+    fn poll_write_with<T>(
+        &self,
+        cx: &mut Context<'_>,
+        mut write: impl FnMut() -> Result<T, isize>,
+    ) -> Poll<io::Result<T>> {
+        loop {
+            match write() {
+                Ok(value) => return Poll::Ready(Ok(value)),
+                Err(err) if would_block(err) => {}
+                Err(err) => return Poll::Ready(Err(errno_to_io(err))),
+            }
+
+            if !self.socket_transport {
+                // Nothing signals room in the shared memory ring, the daemon
+                // empties it quickly: try again on the next poll
+                cx.waker().wake_by_ref();
+                return Poll::Pending;
+            }
+
+            let mut guard = match self.fd.poll_write_ready(cx) {
+                Poll::Ready(Ok(guard)) => guard,
+                Poll::Ready(Err(err)) => return Poll::Ready(Err(err)),
+                Poll::Pending => return Poll::Pending,
+            };
+            guard.clear_ready();
+        }
+    }
+
+    pub fn poll_write_frame(&self, cx: &mut Context<'_>, data: &[u8]) -> Poll<io::Result<usize>> {
+        self.poll_write_with(cx, || {
+            let bytes_written = unsafe {
+                sl_cpc::cpc_write_endpoint(
+                    self.endpoint.endpoint,
+                    data.as_ptr() as *const std::ffi::c_void,
+                    data.len().try_into().unwrap(),
+                    sl_cpc::cpc_endpoint_write_flags_t_enum::CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING
+                        as sl_cpc::cpc_endpoint_write_flags_t,
+                )
+            };
+
+            if bytes_written < 0 {
+                Err(bytes_written)
+            } else {
+                Ok(bytes_written as usize)
+            }
+        })
+    }
+
+    /// Write a frame to the secondary, waiting for room in the socket
+    pub async fn write_frame(&self, data: &[u8]) -> io::Result<usize> {
+        std::future::poll_fn(|cx| self.poll_write_frame(cx, data)).await
+    }
+
+    /// Write frames in order, as many as fit without waiting, and at least
+    /// one. Returns the number of frames written.
+    pub async fn write_frames(&self, frames: &[Bytes]) -> io::Result<usize> {
+        if frames.is_empty() {
+            return Ok(0);
+        }
+
+        let mut msgs: Vec<sl_cpc::cpc_endpoint_msg_t> = frames
+            .iter()
+            .map(|frame| sl_cpc::cpc_endpoint_msg_t {
+                buffer: frame.as_ptr() as *mut std::ffi::c_void,
+                length: frame.len().try_into().unwrap(),
+                status: 0,
+            })
+            .collect();
+
+        std::future::poll_fn(|cx| {
+            self.poll_write_with(cx, || {
+                let written = unsafe {
+                    sl_cpc::cpc_write_endpoint_batch(
+                        self.endpoint.endpoint,
+                        msgs.as_mut_ptr(),
+                        msgs.len().try_into().unwrap(),
+                        sl_cpc::cpc_endpoint_write_flags_t_enum::CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING
+                            as sl_cpc::cpc_endpoint_write_flags_t,
+                    )
+                };
+
+                if written < 0 {
+                    Err(written as isize)
+                } else {
+                    Ok(written as usize)
+                }
+            })
+        })
+        .await
+    }
+}
+
+/// The frames of the secondary, the stream ends when the daemon closes the
+/// endpoint
+impl futures_core::Stream for AsyncEndpoint {
+    type Item = io::Result<Bytes>;
+
+    fn poll_next(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Option<Self::Item>> {
+        match self.get_mut().poll_read_frame(cx) {
+            Poll::Ready(Err(err))
+                if matches!(
+                    err.kind(),
+                    io::ErrorKind::ConnectionReset | io::ErrorKind::BrokenPipe
+                ) =>
+            {
+                Poll::Ready(None)
+            }
+            Poll::Ready(result) => Poll::Ready(Some(result)),
+            Poll::Pending => Poll::Pending,
+        }
+    }
+}
@@ -5,6 +5,9 @@
 
 pub mod sl_cpc;
 
+#[cfg(feature = "tokio")]
+pub mod async_endpoint;
+
 #[derive(Debug, Copy, Clone)]
 pub struct cpc_handle {
     pub cpc: sl_cpc::cpc_handle_t,
@@ -147,6 +150,71 @@ pub fn read_endpoint(
     }
 }
 
+pub fn write_endpoint_batch(
+    endpoint: &cpc_endpoint,
+    data: &[Vec<u8>],
+    flags: sl_cpc::cpc_endpoint_write_flags_t,
+) -> Result<Vec<isize>, std::os::raw::c_int> {
+    let mut msgs: Vec<sl_cpc::cpc_endpoint_msg_t> = data
+        .iter()
+        .map(|message| sl_cpc::cpc_endpoint_msg_t {
+            buffer: message.as_ptr() as *mut std::ffi::c_void,
+            length: message.len().try_into().unwrap(),
+            status: 0,
+        })
+        .collect();
+
+    let written = unsafe {
+        sl_cpc::cpc_write_endpoint_batch(
+            endpoint.endpoint,
+            msgs.as_mut_ptr(),
+            msgs.len().try_into().unwrap(),
+            flags,
+        )
+    };
+
+    if written < 0 {
+        Err(written)
+    } else {
+        Ok(msgs[..written as usize].iter().map(|msg| msg.status as isize).collect())
+    }
+}
+
+pub fn read_endpoint_batch(
+    endpoint: &cpc_endpoint,
+    count: usize,
+    flags: sl_cpc::cpc_endpoint_read_flags_t,
+) -> Result<Vec<Vec<u8>>, std::os::raw::c_int> {
+    let mut buffers: Vec<Vec<u8>> = (0..count).map(|_| cpc_buffer()).collect();
+    let mut msgs: Vec<sl_cpc::cpc_endpoint_msg_t> = buffers
+        .iter_mut()
+        .map(|buffer| sl_cpc::cpc_endpoint_msg_t {
+            buffer: buffer.as_mut_ptr() as *mut std::ffi::c_void,
+            length: buffer.len().try_into().unwrap(),
+            status: 0,
+        })
+        .collect();
+
+    let read = unsafe {
+        sl_cpc::cpc_read_endpoint_batch(
+            endpoint.endpoint,
+            msgs.as_mut_ptr(),
+            msgs.len().try_into().unwrap(),
+            flags,
+        )
+    };
+
+    if read < 0 {
+        Err(read)
+    } else {
+        buffers.truncate(read as usize);
+        for (buffer, msg) in buffers.iter_mut().zip(msgs.iter()) {
+            buffer.truncate(msg.status as usize);
+        }
+        Ok(buffers)
+    }
+}
+
 pub fn get_endpoint_state(
     cpc: &cpc_handle,
     id: u8,
@@ -15,6 +15,8 @@
  *
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -26,10 +28,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
@@ -39,6 +45,8 @@
 #include "version.h"
 #include "misc/utils.h"
 #include "misc/sleep.h"
+#include "misc/shm_ring.h"
+#include "misc/shm_broadcast.h"
 #include "server_core/cpcd_exchange.h"
 #include "server_core/cpcd_event.h"
 
@@ -57,14 +65,41 @@ typedef struct {
   bool enable_tracing;
   char* instance_name;
   bool initialized;
+  const cpcd_exchange_state_table_t *state_table; // NULL if the queries must be used
+  uint32_t state_table_reset_count;
 } sli_cpc_handle_t;
 
+typedef struct {
+  void *base;
+  size_t length;
+  void *broadcast_base;
+  size_t broadcast_length;
+  shm_ring_t tx_ring;
+  shm_broadcast_t rx_ring;           // Shared by the clients of the endpoint, read-only
+  shm_broadcast_cursor_t *rx_cursor; // Of this client in rx_ring
+  bool rx_ring_lendable;             // The daemon doesn't overwrite messages this client has yet to read
+  pthread_mutex_t tx_ring_lock;
+  pthread_mutex_t rx_ring_lock;
+  int fds[SHM_TRANSPORT_FD_COUNT];
+  bool sock_fd_drained;
+  int poll_fd;        // epoll of the rx doorbell and the socket, created by cpc_get_endpoint_fd()
+  size_t view_length; // Length of the message lent by cpc_read_endpoint_zc(), still in rx_ring
+} sli_cpc_shm_transport_t;
+
 typedef struct {
   uint8_t id;
   int server_sock_fd;
   int sock_fd;
   pthread_mutex_t sock_fd_lock;
   sli_cpc_handle_t *lib_handle;
+  sli_cpc_shm_transport_t *shm;
+  size_t max_write_size; // The one of the handle, unless fragmentation is enabled
+  bool fragmentation;
+  uint32_t aggregation_deadline_us; // As applied by the daemon, 0 if disabled
+  bool compression;
+  uint8_t *zc_buffer;   // Holds the reads of cpc_read_endpoint_zc() that can't be lent from a ring
+  const void *zc_view;  // What cpc_read_endpoint_zc() lent, until cpc_release_buffer()
+  bool zc_lent;
 } sli_cpc_endpoint_t;
 
 typedef struct {
@@ -74,6 +109,13 @@ typedef struct {
   sli_cpc_handle_t *lib_handle;
 } sli_cpc_endpoint_event_handle_t;
 
+typedef struct {
+  uint8_t id;
+  int sock_fd;                // Control connection the open query was sent on
+  struct sockaddr_un ep_addr;
+  sli_cpc_handle_t *lib_handle;
+} sli_cpc_endpoint_open_t;
+
 static void lib_trace(sli_cpc_handle_t* lib_handle, FILE *__restrict __stream, const char* string, ...)
 {
   char time_string[25];
@@ -166,6 +208,18 @@ static void lib_trace(sli_cpc_handle_t* lib_handle, FILE *__restrict __stream, c
 
 #define CTRL_SOCKET_TIMEOUT_SEC 2
 
+// Messages handed to the kernel per recvmmsg() or sendmmsg() by the batch APIs
+#define ENDPOINT_BATCH_CHUNK 16
+
+// Items cpc_wait() polls without allocating
+#define WAIT_ITEMS_ON_STACK 16
+
+// Room left in the reply of the init query for the secondary app version, a longer one is queried on its own
+#define INIT_APP_VERSION_ROOM 64
+
+/* First delay between the attempts to reconnect to a restarting CPCd, doubled after each one */
+#define CPC_RESTART_FIRST_RETRY_DELAY_MS 10
+
 #define DEFAULT_ENDPOINT_SOCKET_SIZE SL_CPC_READ_MINIMUM_SIZE
 
 static cpc_reset_callback_t saved_reset_callback;
@@ -291,23 +345,9 @@ static int get_max_write(sli_cpc_handle_t *lib_handle)
   RETURN_CPC_RET;
 }
 
-static int check_version(sli_cpc_handle_t *lib_handle)
+static int check_version(sli_cpc_handle_t *lib_handle, const char *version)
 {
   INIT_CPC_RET(int);
-  int tmp_ret = 0;
-  char version[PROJECT_MAX_VERSION_SIZE];
-
-  strncpy(version, PROJECT_VER, PROJECT_MAX_VERSION_SIZE);
-
-  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
-                               EXCHANGE_VERSION_QUERY, 0,
-                               (void*)version, PROJECT_MAX_VERSION_SIZE);
-
-  if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange version query");
-    SET_CPC_RET(tmp_ret);
-    RETURN_CPC_RET;
-  }
 
   if (strncmp(version, PROJECT_VER, PROJECT_MAX_VERSION_SIZE) != 0) {
     TRACE_LIB_ERROR(lib_handle, -ELIBBAD, "libcpc version does not match with the daemon");
@@ -343,20 +383,10 @@ static int check_normal_operation_mode(sli_cpc_handle_t *lib_handle)
   RETURN_CPC_RET;
 }
 
-static int get_secondary_app_version(sli_cpc_handle_t *lib_handle)
+static int get_secondary_app_version_string(sli_cpc_handle_t *lib_handle, uint16_t app_string_size)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  uint16_t app_string_size = 0;
-
-  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
-                               EXCHANGE_SECONDARY_APP_VERSION_SIZE_QUERY, 0,
-                               (void*)&app_string_size, sizeof(app_string_size));
-  if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange secondary app version size query");
-    SET_CPC_RET(tmp_ret);
-    RETURN_CPC_RET;
-  }
 
   lib_handle->secondary_app_version = zalloc((size_t)app_string_size + 1);
   if (lib_handle->secondary_app_version == NULL) {
@@ -371,6 +401,7 @@ static int get_secondary_app_version(sli_cpc_handle_t *lib_handle)
 
   if (tmp_ret) {
     free(lib_handle->secondary_app_version);
+    lib_handle->secondary_app_version = NULL;
     TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange secondary app version string query");
     SET_CPC_RET(tmp_ret);
     RETURN_CPC_RET;
@@ -382,6 +413,25 @@ static int get_secondary_app_version(sli_cpc_handle_t *lib_handle)
   RETURN_CPC_RET;
 }
 
+static int get_secondary_app_version(sli_cpc_handle_t *lib_handle)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  uint16_t app_string_size = 0;
+
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_SECONDARY_APP_VERSION_SIZE_QUERY, 0,
+                               (void*)&app_string_size, sizeof(app_string_size));
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange secondary app version size query");
+    SET_CPC_RET(tmp_ret);
+    RETURN_CPC_RET;
+  }
+
+  SET_CPC_RET(get_secondary_app_version_string(lib_handle, app_string_size));
+  RETURN_CPC_RET;
+}
+
 static int set_pid(sli_cpc_handle_t *lib_handle)
 {
   INIT_CPC_RET(int);
@@ -423,675 +473,2092 @@ static int set_pid(sli_cpc_handle_t *lib_handle)
   RETURN_CPC_RET;
 }
 
-static int get_endpoint_encryption(sli_cpc_endpoint_t *ep, bool *encryption)
+/***************************************************************************//**
+ * Do the queries of the initialization in one round trip. A version query is
+ * sent right after the init query: older daemons ignore the latter and answer
+ * the former, the handshake is then completed with one query at a time.
+ ******************************************************************************/
+static int init_handshake(sli_cpc_handle_t *lib_handle)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  sli_cpc_handle_t *lib_handle = ep->lib_handle;
+  int fd = lib_handle->ctrl_sock_fd;
+  cpcd_exchange_buffer_t *query = NULL;
+  cpcd_exchange_init_t init = { 0 };
+  ssize_t bytes_written = 0;
+  ssize_t bytes_read = 0;
+  const size_t init_query_len = sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_init_t) + INIT_APP_VERSION_ROOM;
+  const size_t version_query_len = sizeof(cpcd_exchange_buffer_t) + PROJECT_MAX_VERSION_SIZE;
 
-  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
-    SET_CPC_RET(-tmp_ret);
+  query = zalloc(init_query_len);
+  if (query == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", init_query_len);
+    SET_CPC_RET(-ENOMEM);
     RETURN_CPC_RET;
   }
 
-  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
-                               EXCHANGE_ENDPOINT_ENCRYPTION_QUERY, ep->id,
-                               (void*)encryption, sizeof(bool));
+  strncpy(init.version, PROJECT_VER, PROJECT_MAX_VERSION_SIZE);
+  init.pid = getpid();
+
+  query->type = EXCHANGE_INIT_QUERY;
+  memcpy(query->payload, &init, sizeof(init));
+
+  bytes_written = send(fd, query, init_query_len, 0);
+  if (bytes_written < (ssize_t)init_query_len) {
+    TRACE_LIB_ERRNO(lib_handle, "send(%d) failed", fd);
+    SET_CPC_RET(-errno);
+    goto free_query;
+  }
+
+  memset(query, 0, version_query_len);
+  query->type = EXCHANGE_VERSION_QUERY;
+  strncpy((char *)query->payload, PROJECT_VER, PROJECT_MAX_VERSION_SIZE);
+
+  bytes_written = send(fd, query, version_query_len, 0);
+  if (bytes_written < (ssize_t)version_query_len) {
+    TRACE_LIB_ERRNO(lib_handle, "send(%d) failed", fd);
+    SET_CPC_RET(-errno);
+    goto free_query;
+  }
+
+  bytes_read = recv(fd, query, init_query_len, 0);
+  if (bytes_read == 0) {
+    TRACE_LIB_ERROR(lib_handle, -ECONNRESET, "recv(%d) failed", fd);
+    SET_CPC_RET(-ECONNRESET);
+    goto free_query;
+  } else if (bytes_read < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "recv(%d) failed", fd);
+    SET_CPC_RET(-errno);
+    goto free_query;
+  }
+
+  if ((size_t)bytes_read == version_query_len && query->type == EXCHANGE_VERSION_QUERY) {
+    TRACE_LIB(lib_handle, "daemon does not support the init query, initializing one query at a time");
+
+    tmp_ret = check_version(lib_handle, (const char *)query->payload);
+    if (tmp_ret == 0) {
+      tmp_ret = set_pid(lib_handle);
+    }
+    if (tmp_ret == 0) {
+      tmp_ret = check_normal_operation_mode(lib_handle);
+    }
+    if (tmp_ret == 0) {
+      tmp_ret = get_max_write(lib_handle);
+    }
+    if (tmp_ret == 0) {
+      tmp_ret = get_secondary_app_version(lib_handle);
+    }
+    SET_CPC_RET(tmp_ret);
+    goto free_query;
+  }
+
+  if ((size_t)bytes_read != init_query_len || query->type != EXCHANGE_INIT_QUERY) {
+    TRACE_LIB_ERROR(lib_handle, -EBADE, "recv(%d) failed, ret = %d", fd, bytes_read);
+    SET_CPC_RET(-EBADE);
+    goto free_query;
+  }
 
+  /* The payload is not aligned */
+  memcpy(&init, query->payload, sizeof(init));
+
+  /* On a mismatch, the daemon closed the connection without answering the version query */
+  tmp_ret = check_version(lib_handle, init.version);
   if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint encryption query");
     SET_CPC_RET(tmp_ret);
+    goto free_query;
   }
 
-  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
-    SET_CPC_RET(-tmp_ret);
-    RETURN_CPC_RET;
+  tmp_ret = cpc_query_receive(lib_handle, fd, NULL, PROJECT_MAX_VERSION_SIZE);
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange version query");
+    SET_CPC_RET(tmp_ret);
+    goto free_query;
   }
 
-  RETURN_CPC_RET;
-}
+  if (!init.can_connect) {
+    TRACE_LIB_ERROR(lib_handle, -ELIBMAX, "cannot set pid %d, another process with same pid is already registered", init.pid);
+    SET_CPC_RET(-ELIBMAX);
+    goto free_query;
+  }
+  TRACE_LIB(lib_handle, "pid %d registered with daemon", init.pid);
 
-static void SIGUSR1_handler(int signum)
-{
-  (void) signum;
+  if (!init.normal_operation_mode) {
+    TRACE_LIB_ERROR(lib_handle, -EPERM, "daemon is not running in normal operation mode");
+    SET_CPC_RET(-EPERM);
+    goto free_query;
+  }
 
-  if (saved_reset_callback != NULL) {
-    saved_reset_callback();
+  lib_handle->max_write_size = (size_t)init.max_write_size;
+
+  if (init.app_version_length > INIT_APP_VERSION_ROOM) {
+    SET_CPC_RET(get_secondary_app_version_string(lib_handle, init.app_version_length));
+    goto free_query;
+  }
+
+  lib_handle->secondary_app_version = zalloc((size_t)init.app_version_length + 1);
+  if (lib_handle->secondary_app_version == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", (size_t)init.app_version_length + 1);
+    SET_CPC_RET(-ENOMEM);
+    goto free_query;
   }
+
+  memcpy(lib_handle->secondary_app_version, query->payload + sizeof(init), init.app_version_length);
+  TRACE_LIB(lib_handle, "secondary application is v%s", lib_handle->secondary_app_version);
+
+  free_query:
+  free(query);
+
+  RETURN_CPC_RET;
 }
 
 /***************************************************************************//**
- * Initialize the CPC library.
- * Upon success, users will get a handle that must be passed to subsequent calls.
+ * Map the table the daemon publishes the endpoint states in. Without it, the
+ * states are queried, this is not an error.
  ******************************************************************************/
-int cpc_init(cpc_handle_t *handle, const char *instance_name, bool enable_tracing, cpc_reset_callback_t reset_callback)
+static void open_state_table(sli_cpc_handle_t *lib_handle)
 {
-  INIT_CPC_RET(int);
-  int tmp_ret = 0;
-  sli_cpc_handle_t *lib_handle = NULL;
-  struct sockaddr_un server_addr = { 0 };
+  cpcd_exchange_buffer_t *query = NULL;
+  cpcd_exchange_state_table_query_t table_query = { 0 };
+  const size_t query_len = sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_state_table_query_t);
+  int fd = -1;
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t bytes_read = 0;
+  void *table;
 
-  if (handle == NULL) {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
+  query = zalloc(query_len);
+  if (query == NULL) {
+    return;
   }
 
-  lib_handle = zalloc(sizeof(sli_cpc_handle_t));
-  if (lib_handle == NULL) {
-    SET_CPC_RET(-ENOMEM);
-    RETURN_CPC_RET;
-  }
+  query->type = EXCHANGE_STATE_TABLE_QUERY;
+  memcpy(query->payload, &table_query, sizeof(table_query));
 
-  /* Save the parameters internally for possible further re-init */
-  lib_handle->enable_tracing = enable_tracing;
-  saved_reset_callback = reset_callback;
+  iov.iov_base = query;
+  iov.iov_len = query_len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
 
-  if (instance_name == NULL) {
-    /* If the instance name is NULL, use the default name */
-    lib_handle->instance_name = strdup(DEFAULT_INSTANCE_NAME);
-    if (lib_handle->instance_name == NULL) {
-      SET_CPC_RET(-errno);
-      goto free_lib_handle;
-    }
-  } else {
-    /* Instead, use the one supplied by the user */
-    lib_handle->instance_name = strdup(instance_name);
-    if (lib_handle->instance_name == NULL) {
-      SET_CPC_RET(-errno);
-      goto free_lib_handle;
-    }
+  if (send(lib_handle->ctrl_sock_fd, query, query_len, 0) != (ssize_t)query_len) {
+    TRACE_LIB_ERRNO(lib_handle, "send(%d) failed", lib_handle->ctrl_sock_fd);
+    goto free_query;
   }
 
-  /* Create the control socket path */
-  {
-    int nchars;
-    const size_t size = sizeof(server_addr.sun_path) - 1;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sun_family = AF_UNIX;
-
-    nchars = snprintf(server_addr.sun_path, size, "%s/cpcd/%s/ctrl.cpcd.sock", CPC_SOCKET_DIR, lib_handle->instance_name);
+  bytes_read = recvmsg(lib_handle->ctrl_sock_fd, &msg, 0);
+  if (bytes_read <= 0) {
+    TRACE_LIB_ERRNO(lib_handle, "recvmsg(%d) failed", lib_handle->ctrl_sock_fd);
+    goto free_query;
+  }
 
-    /* Make sure the path fitted entirely in the struct's static buffer */
-    if (nchars < 0 || (size_t) nchars >= size) {
-      TRACE_LIB_ERROR(lib_handle, -ERANGE, "socket path '%s/cpcd/%s/ctrl.cpcd.sock' does not fit in buffer", CPC_SOCKET_DIR, lib_handle->instance_name);
-      SET_CPC_RET(-ERANGE);
-      goto free_instance_name;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
     }
   }
 
-  // Check if control socket exists
-  if (access(server_addr.sun_path, F_OK) != 0) {
-    TRACE_LIB_ERRNO(lib_handle,
-                    "access() : %s doesn't exist. The daemon is not started or "
-                    "the reset sequence is not done or the secondary is not responsive.",
-                    server_addr.sun_path);
-    SET_CPC_RET(-errno);
-    goto free_instance_name;
-  }
+  memcpy(&table_query, query->payload, sizeof(table_query));
 
-  lib_handle->ctrl_sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-  if (lib_handle->ctrl_sock_fd < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "socket() failed");
-    SET_CPC_RET(-errno);
-    goto free_instance_name;
+  if (bytes_read != (ssize_t)query_len || fd < 0 || table_query.size != sizeof(cpcd_exchange_state_table_t)) {
+    TRACE_LIB(lib_handle, "no state table, endpoint states will be queried");
+    goto close_fd;
   }
 
-  if (connect(lib_handle->ctrl_sock_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
-    TRACE_LIB_ERRNO(lib_handle,
-                    "connect() : could not connect to %s. Either the process does not have "
-                    "the correct permissions or the secondary is not responsive.",
-                    server_addr.sun_path);
-    SET_CPC_RET(-errno);
-    goto close_ctrl_sock_fd;
+  table = mmap(NULL, sizeof(cpcd_exchange_state_table_t), PROT_READ, MAP_SHARED, fd, 0);
+  if (table == MAP_FAILED) {
+    TRACE_LIB_ERRNO(lib_handle, "mmap(%d) failed", fd);
+    goto close_fd;
   }
 
-  // Set ctrl socket timeout
-  struct timeval timeout;
-  timeout.tv_sec = CTRL_SOCKET_TIMEOUT_SEC;
-  timeout.tv_usec = 0;
+  lib_handle->state_table = (const cpcd_exchange_state_table_t *)table;
+  lib_handle->state_table_reset_count = __atomic_load_n(&lib_handle->state_table->reset_count, __ATOMIC_SEQ_CST);
+  TRACE_LIB(lib_handle, "mapped the state table");
 
-  if (setsockopt(lib_handle->ctrl_sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval)) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "setsockopt(%d) failed", lib_handle->ctrl_sock_fd);
-    SET_CPC_RET(-errno);
-    goto close_ctrl_sock_fd;
+  close_fd:
+  if (fd >= 0 && close(fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", fd);
   }
 
-  tmp_ret = check_version(lib_handle);
-  if (tmp_ret < 0) {
-    SET_CPC_RET(tmp_ret);
-    goto close_ctrl_sock_fd;
-  }
+  free_query:
+  free(query);
+}
 
-  tmp_ret = set_pid(lib_handle);
-  if (tmp_ret < 0) {
-    SET_CPC_RET(tmp_ret);
-    goto close_ctrl_sock_fd;
-  }
+/***************************************************************************//**
+ * Read the state and encryption of an endpoint from the state table, without
+ * the control socket. Returns false if the query must be used instead: there
+ * is no table, the secondary reset or the daemon is gone, the table is stale
+ * then and the query reports the error.
+ ******************************************************************************/
+static bool read_state_table(sli_cpc_handle_t *lib_handle, uint8_t id, cpc_endpoint_state_t *state, bool *encryption)
+{
+  const cpcd_exchange_state_table_t *table = lib_handle->state_table;
+  struct pollfd pfd = { .fd = lib_handle->ctrl_sock_fd, .events = 0 };
+  uint32_t sequence;
+  uint32_t reset_count;
+  uint8_t ep_state;
+  uint8_t ep_encrypted;
 
-  tmp_ret = check_normal_operation_mode(lib_handle);
-  if (tmp_ret < 0) {
-    SET_CPC_RET(tmp_ret);
-    goto close_ctrl_sock_fd;
+  if (table == NULL) {
+    return false;
   }
 
-  // Check if reset callback is define
-  if (reset_callback != NULL) {
-    signal(SIGUSR1, SIGUSR1_handler);
+  do {
+    sequence = __atomic_load_n(&table->sequence, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    reset_count = table->reset_count;
+    ep_state = table->endpoint_state[id];
+    ep_encrypted = table->endpoint_encrypted[id];
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  } while ((sequence & 1) != 0 || sequence != __atomic_load_n(&table->sequence, __ATOMIC_SEQ_CST));
+
+  if (reset_count != lib_handle->state_table_reset_count) {
+    return false;
   }
 
-  // Check if control socket exists
-  if (access(server_addr.sun_path, F_OK) != 0) {
-    TRACE_LIB_ERRNO(lib_handle,
-                    "access() : %s doesn't exist. The daemon is not started or the reset "
-                    "sequence is not done or the secondary is not responsive.",
-                    server_addr.sun_path);
-    SET_CPC_RET(-errno);
-    goto close_ctrl_sock_fd;
+  // Only reports a hangup, doesn't take anything from the socket
+  if (poll(&pfd, 1, 0) != 0) {
+    return false;
   }
 
-  tmp_ret = get_max_write(lib_handle);
-  if (tmp_ret < 0) {
-    SET_CPC_RET(tmp_ret);
-    goto close_ctrl_sock_fd;
+  if (state != NULL) {
+    *state = (cpc_endpoint_state_t)ep_state;
   }
 
-  tmp_ret = get_secondary_app_version(lib_handle);
-  if (tmp_ret < 0) {
-    SET_CPC_RET(tmp_ret);
-    goto close_ctrl_sock_fd;
+  if (encryption != NULL) {
+    *encryption = (ep_encrypted != 0);
   }
 
-  tmp_ret = pthread_mutex_init(&lib_handle->ctrl_sock_fd_lock, NULL);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_init(%p) failed", &lib_handle->ctrl_sock_fd_lock);
-    SET_CPC_RET(-tmp_ret);
-    goto free_secondary_app_version;
-  }
-
-  lib_handle->initialized = true;
-  handle->ptr = (void *)lib_handle;
-  TRACE_LIB(lib_handle, "cpc lib initialized");
+  return true;
+}
 
-  RETURN_CPC_RET;
+static int get_endpoint_encryption(sli_cpc_endpoint_t *ep, bool *encryption)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
 
-  free_secondary_app_version:
-  free(lib_handle->secondary_app_version);
+  if (read_state_table(lib_handle, ep->id, NULL, encryption)) {
+    RETURN_CPC_RET;
+  }
 
-  close_ctrl_sock_fd:
-  if (close(lib_handle->ctrl_sock_fd) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", lib_handle->ctrl_sock_fd);
-    SET_CPC_RET(-errno);
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
   }
 
-  free_instance_name:
-  free(lib_handle->instance_name);
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_ENDPOINT_ENCRYPTION_QUERY, ep->id,
+                               (void*)encryption, sizeof(bool));
 
-  free_lib_handle:
-  free(lib_handle);
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint encryption query");
+    SET_CPC_RET(tmp_ret);
+  }
+
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
+  }
 
   RETURN_CPC_RET;
 }
 
-/***************************************************************************//**
- * De-init the library handle and any allocated resources
- ******************************************************************************/
-int cpc_deinit(cpc_handle_t *handle)
+static int get_endpoint_tx_credit(sli_cpc_endpoint_t *ep, uint32_t *tx_credit)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  sli_cpc_handle_t *lib_handle = NULL;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
 
-  if (handle->ptr == NULL) {
-    SET_CPC_RET(-EINVAL);
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  lib_handle = (sli_cpc_handle_t *)handle->ptr;
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_ENDPOINT_TX_CREDIT_QUERY, ep->id,
+                               (void*)tx_credit, sizeof(uint32_t));
 
-  if (close(lib_handle->ctrl_sock_fd) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", lib_handle->ctrl_sock_fd);
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint tx credit query");
+    SET_CPC_RET(tmp_ret);
   }
 
-  tmp_ret = pthread_mutex_destroy(&lib_handle->ctrl_sock_fd_lock);
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
   if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_destroy(%p) failed, free up resources anyway", &lib_handle->ctrl_sock_fd_lock);
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
   }
 
-  TRACE_LIB(lib_handle, "cpc lib deinitialized");
-
-  free(lib_handle->instance_name);
-  free(lib_handle->secondary_app_version);
-  free(lib_handle);
-
-  handle->ptr = NULL;
-
   RETURN_CPC_RET;
 }
 
-/***************************************************************************//**
- * Restart the CPC library.
- * The user is notified via the 'reset_callback' when the secondary has restarted.
- * The user logic then has to call this function in order to [try] to re-connect
- * the application to the daemon.
- ******************************************************************************/
-int cpc_restart(cpc_handle_t *handle)
+static int set_endpoint_tx_priority(sli_cpc_endpoint_t *ep, cpc_tx_priority_t *priority)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  sli_cpc_handle_t *lib_handle = NULL;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
 
-  if (handle->ptr == NULL) {
-    SET_CPC_RET(-EINVAL);
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  lib_handle = (sli_cpc_handle_t *)handle->ptr;
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_SET_ENDPOINT_TX_PRIORITY_QUERY, ep->id,
+                               (void*)priority, sizeof(cpc_tx_priority_t));
 
-  sli_cpc_handle_t *lib_handle_copy = zalloc(sizeof(sli_cpc_handle_t));
-  if (lib_handle_copy == NULL) {
-    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_handle_t));
-    SET_CPC_RET(-ENOMEM);
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint tx priority query");
+    SET_CPC_RET(tmp_ret);
+  }
+
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  memcpy(lib_handle_copy, lib_handle, sizeof(sli_cpc_handle_t));
-  lib_handle_copy->instance_name = strdup(lib_handle->instance_name);
-  if (lib_handle_copy->instance_name == NULL) {
-    free(lib_handle_copy);
-    TRACE_LIB_ERRNO(lib_handle, "failed to copy the instance name");
-    SET_CPC_RET(-errno);
+  RETURN_CPC_RET;
+}
+
+static int set_endpoint_fragmentation(sli_cpc_endpoint_t *ep, bool enable)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
+  cpcd_exchange_fragmentation_t fragmentation = { .enable = enable };
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  // De-init the original handle
-  if (lib_handle_copy->initialized) {
-    tmp_ret = cpc_deinit(handle);
-    if (tmp_ret != 0) {
-      // Restore the handle copy on failure
-      free(lib_handle_copy->instance_name);
-      lib_handle_copy->instance_name = lib_handle->instance_name;
-      handle->ptr = (void *)lib_handle_copy;
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_SET_ENDPOINT_FRAGMENTATION_QUERY, ep->id,
+                               (void*)&fragmentation, sizeof(fragmentation));
 
-      TRACE_LIB_ERROR(lib_handle, tmp_ret, "cpc_deinit(%p) failed", handle);
-      SET_CPC_RET(tmp_ret);
-      RETURN_CPC_RET;
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint fragmentation query");
+    SET_CPC_RET(tmp_ret);
+  } else {
+    ep->fragmentation = (fragmentation.enable != 0);
+    ep->max_write_size = (size_t)fragmentation.max_write_size;
+    if (enable && !ep->fragmentation) {
+      TRACE_LIB_ERROR(lib_handle, -ENOTSUP, "fragmentation is not supported by the secondary or the daemon");
+      SET_CPC_RET(-ENOTSUP);
     }
   }
 
-  // De-init was successful, invalidate copy
-  lib_handle_copy->initialized = false;
-
-  // Attemps a connection
-  tmp_ret = cpc_init(handle, lib_handle_copy->instance_name, lib_handle_copy->enable_tracing, saved_reset_callback);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle_copy, tmp_ret, "Failed cpc_init, attempting again in %d milliseconds", CPCD_REBOOT_TIME_MS);
-    sleep_ms(CPCD_REBOOT_TIME_MS);  // Wait for the minimum time it takes for CPCd to reboot
+  // The socket must take the largest write in one datagram, the kernel doubles the size set
+  if (ep->fragmentation) {
+    int sock_size = 0;
+    socklen_t socklen = sizeof(sock_size);
 
-    tmp_ret = cpc_init(handle, lib_handle_copy->instance_name, lib_handle_copy->enable_tracing, saved_reset_callback);
-    if (tmp_ret != 0) {
-      // Restore the handle copy on failure
-      handle->ptr = (void *)lib_handle_copy;
-      TRACE_LIB_ERROR(lib_handle_copy, tmp_ret, "cpc_init(%p) failed", handle);
-      SET_CPC_RET(tmp_ret);
-      RETURN_CPC_RET;
+    if (getsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, &sock_size, &socklen) == 0
+        && (size_t)sock_size < 2 * ep->max_write_size) {
+      sock_size = (int)ep->max_write_size;
+      if (setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, &sock_size, sizeof(sock_size)) != 0) {
+        TRACE_LIB_ERRNO(lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+        SET_CPC_RET(-errno);
+      }
     }
   }
 
-  // On success we can free the lib_handle_copy
-  free(lib_handle_copy->instance_name);
-  free(lib_handle_copy);
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
+  }
 
   RETURN_CPC_RET;
 }
 
-/***************************************************************************//**
- * Connect to the socket corresponding to the provided endpoint ID.
- * The function will also allocate the memory for the endpoint structure and assign
- * it to the provided pointer.
- * This endpoint structure must then be used for further calls to the libcpc.
- ******************************************************************************/
-int cpc_open_endpoint(cpc_handle_t handle, cpc_endpoint_t *endpoint, uint8_t id, uint8_t tx_window_size)
+static int set_endpoint_aggregation(sli_cpc_endpoint_t *ep, uint32_t deadline_us)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  int tmp_ret2 = 0;
-  bool can_open = false;
-  sli_cpc_handle_t *lib_handle = NULL;
-  sli_cpc_endpoint_t *ep = NULL;
-  struct sockaddr_un ep_addr = { 0 };
-
-  if (id == SL_CPC_ENDPOINT_SYSTEM || endpoint == NULL || handle.ptr == NULL) {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
-  }
-
-  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
+  cpcd_exchange_aggregation_t aggregation = { .deadline_us = deadline_us };
 
-  if (tx_window_size != 1) {
-    TRACE_LIB_ERROR(lib_handle, -EINVAL, "Only a tx window of 1 is supported at the moment");
-    SET_CPC_RET(-EINVAL);
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  TRACE_LIB(lib_handle, "opening EP #%d", id);
-
-  ep_addr.sun_family = AF_UNIX;
-
-  /* Create the endpoint socket path */
-  {
-    int nchars;
-    const size_t size = sizeof(ep_addr.sun_path) - 1;
-
-    nchars = snprintf(ep_addr.sun_path, size, "%s/cpcd/%s/ep%d.cpcd.sock", CPC_SOCKET_DIR, lib_handle->instance_name, id);
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_SET_ENDPOINT_AGGREGATION_QUERY, ep->id,
+                               (void*)&aggregation, sizeof(aggregation));
 
-    /* Make sure the path fitted entirely in the struct sockaddr_un's static buffer */
-    if (nchars < 0 || (size_t) nchars >= size) {
-      TRACE_LIB_ERROR(lib_handle, -ERANGE, "socket path '%s/cpcd/%s/ep%d.cpcd.sock' does not fit in buffer", CPC_SOCKET_DIR, lib_handle->instance_name, id);
-      SET_CPC_RET(-ERANGE);
-      RETURN_CPC_RET;
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint aggregation query");
+    SET_CPC_RET(tmp_ret);
+  } else {
+    ep->aggregation_deadline_us = aggregation.deadline_us;
+    if (deadline_us != 0 && ep->aggregation_deadline_us == 0) {
+      TRACE_LIB_ERROR(lib_handle, -ENOTSUP, "aggregation is not supported by the secondary or the daemon");
+      SET_CPC_RET(-ENOTSUP);
     }
   }
 
-  ep = zalloc(sizeof(sli_cpc_endpoint_t));
-  if (ep == NULL) {
-    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_endpoint_t));
-    SET_CPC_RET(-ERANGE);
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
     RETURN_CPC_RET;
   }
 
-  ep->id = id;
-  ep->lib_handle = lib_handle;
+  RETURN_CPC_RET;
+}
+
+static int set_endpoint_compression(sli_cpc_endpoint_t *ep, bool enable)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
+  cpcd_exchange_compression_t compression = { .enable = enable };
 
   tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
   if (tmp_ret != 0) {
     TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
     SET_CPC_RET(-tmp_ret);
-    goto free_endpoint;
+    RETURN_CPC_RET;
   }
 
   tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
-                               EXCHANGE_OPEN_ENDPOINT_QUERY, id,
-                               (void*)&can_open, sizeof(can_open));
+                               EXCHANGE_SET_ENDPOINT_COMPRESSION_QUERY, ep->id,
+                               (void*)&compression, sizeof(compression));
 
   if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange open endpoint query");
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange endpoint compression query");
     SET_CPC_RET(tmp_ret);
+  } else {
+    ep->compression = (compression.enable != 0);
+    if (enable && !ep->compression) {
+      TRACE_LIB_ERROR(lib_handle, -ENOTSUP, "compression is not supported by the secondary or the daemon");
+      SET_CPC_RET(-ENOTSUP);
+    }
   }
 
-  tmp_ret2 = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
-  if (tmp_ret2 != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret2, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
-    SET_CPC_RET(-tmp_ret2);
-    goto free_endpoint;
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
   }
 
-  if (tmp_ret) {
-    goto free_endpoint;
-  }
+  RETURN_CPC_RET;
+}
 
-  if (can_open == false) {
-    if (id == SL_CPC_ENDPOINT_SECURITY) {
-      TRACE_LIB_ERROR(lib_handle, -EPERM, "cannot open security endpoint as a client");
-      SET_CPC_RET(-EPERM);
-    } else {
-      TRACE_LIB_ERROR(lib_handle, -EAGAIN, "endpoint on secondary is not opened");
-      SET_CPC_RET(-EAGAIN);
-    }
-    goto free_endpoint;
+/* Messages of the shared memory rings are no larger than the ones of the handle */
+static size_t get_endpoint_max_write_size(const sli_cpc_endpoint_t *ep)
+{
+  if (ep->shm != NULL) {
+    return ep->lib_handle->max_write_size;
   }
 
-  ep->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-  if (ep->sock_fd < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "socket()");
-    SET_CPC_RET(-errno);
-    goto free_endpoint;
-  }
+  return ep->max_write_size;
+}
 
-  tmp_ret = connect(ep->sock_fd, (struct sockaddr *)&ep_addr, sizeof(ep_addr));
-  if (tmp_ret < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "connect(%d) failed", ep->sock_fd);
-    SET_CPC_RET(-errno);
-    goto close_sock_fd;
-  }
+static void close_shm_transport(sli_cpc_endpoint_t *ep)
+{
+  sli_cpc_shm_transport_t *shm = ep->shm;
 
-  tmp_ret = cpc_query_receive(lib_handle, ep->sock_fd, (void*)&ep->server_sock_fd, sizeof(ep->server_sock_fd));
-  if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to receive server ack");
-    SET_CPC_RET(tmp_ret);
-    goto close_sock_fd;
+  if (shm == NULL) {
+    return;
   }
 
-  int ep_socket_size = DEFAULT_ENDPOINT_SOCKET_SIZE;
-  tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, &ep_socket_size, sizeof(int));
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERRNO(lib_handle, "setsockopt(%d) failed", ep->sock_fd);
-    SET_CPC_RET(-errno);
-    goto close_sock_fd;
+  if (munmap(shm->base, shm->length) < 0) {
+    TRACE_LIB_ERRNO(ep->lib_handle, "munmap(%p) failed", shm->base);
   }
 
-  tmp_ret = pthread_mutex_init(&ep->sock_fd_lock, NULL);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_init(%p) failed", &ep->sock_fd_lock);
-    SET_CPC_RET(-tmp_ret);
-    goto close_sock_fd;
+  if (munmap(shm->broadcast_base, shm->broadcast_length) < 0) {
+    TRACE_LIB_ERRNO(ep->lib_handle, "munmap(%p) failed", shm->broadcast_base);
   }
 
-  TRACE_LIB(lib_handle, "opened EP #%d", ep->id);
-  endpoint->ptr = (void *)ep;
-
-  SET_CPC_RET(ep->sock_fd);
-  RETURN_CPC_RET;
+  for (int i = SHM_TRANSPORT_FD_DAEMON_DOORBELL; i < SHM_TRANSPORT_FD_COUNT; i++) {
+    if (close(shm->fds[i]) < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "close(%d) failed", shm->fds[i]);
+    }
+  }
 
-  close_sock_fd:
-  if (close(ep->sock_fd) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
-    SET_CPC_RET(-errno);
+  if (shm->poll_fd != -1 && close(shm->poll_fd) < 0) {
+    TRACE_LIB_ERRNO(ep->lib_handle, "close(%d) failed", shm->poll_fd);
   }
 
-  free_endpoint:
-  free(ep);
+  pthread_mutex_destroy(&shm->tx_ring_lock);
+  pthread_mutex_destroy(&shm->rx_ring_lock);
 
-  RETURN_CPC_RET;
+  free(shm);
+  ep->shm = NULL;
 }
 
-/***************************************************************************//**
- * Close the socket connection to the endpoint.
- * This function will also free the memory used to allocate the endpoint structure.
- ******************************************************************************/
-int cpc_close_endpoint(cpc_endpoint_t *endpoint)
+static int open_shm_transport(sli_cpc_endpoint_t *ep)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
-  sli_cpc_handle_t *lib_handle = NULL;
-  sli_cpc_endpoint_t *ep = NULL;
+  sli_cpc_handle_t *lib_handle = ep->lib_handle;
+  sli_cpc_shm_transport_t *shm = NULL;
+  cpcd_exchange_buffer_t *query = NULL;
+  cpcd_exchange_shm_transport_t transport;
+  const size_t query_len = sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_shm_transport_t);
+  int fds[SHM_TRANSPORT_FD_COUNT];
+  size_t fd_count = 0;
+  size_t footprint;
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(fds))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t bytes_read = 0;
 
-  if (endpoint == NULL) {
-    SET_CPC_RET(-EINVAL);
+  query = zalloc(query_len);
+  if (query == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", query_len);
+    SET_CPC_RET(-ENOMEM);
     RETURN_CPC_RET;
   }
 
-  ep = (sli_cpc_endpoint_t *)endpoint->ptr;
-  if (ep == NULL) {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
-  }
+  transport.data_socket = ep->server_sock_fd;
+  transport.ring_size = SHM_RING_DEFAULT_SIZE;
+  transport.overwrites = 0;
 
-  lib_handle = ep->lib_handle;
+  query->type = EXCHANGE_OPEN_SHM_TRANSPORT_QUERY;
+  query->endpoint_number = ep->id;
+  memcpy(query->payload, &transport, sizeof(transport));
+
+  iov.iov_base = query;
+  iov.iov_len = query_len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
 
   tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
   if (tmp_ret != 0) {
     TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
-    goto destroy_mutex;
+    SET_CPC_RET(-tmp_ret);
+    goto free_query;
   }
 
-  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
-                               EXCHANGE_CLOSE_ENDPOINT_QUERY, ep->id,
-                               (void*)&ep->server_sock_fd, sizeof(ep->server_sock_fd));
+  if (send(lib_handle->ctrl_sock_fd, query, query_len, 0) != (ssize_t)query_len) {
+    TRACE_LIB_ERRNO(lib_handle, "send(%d) failed", lib_handle->ctrl_sock_fd);
+    SET_CPC_RET(-errno);
+  } else {
+    /* The reply carries the shared memory and the doorbells as ancillary data */
+    bytes_read = recvmsg(lib_handle->ctrl_sock_fd, &msg, 0);
+    if (bytes_read != (ssize_t)query_len) {
+      if (bytes_read == 0) {
+        TRACE_LIB_ERROR(lib_handle, -ECONNRESET, "recvmsg(%d) failed", lib_handle->ctrl_sock_fd);
+        SET_CPC_RET(-ECONNRESET);
+      } else if (bytes_read == -1) {
+        TRACE_LIB_ERRNO(lib_handle, "recvmsg(%d) failed", lib_handle->ctrl_sock_fd);
+        SET_CPC_RET(-errno);
+      } else {
+        TRACE_LIB_ERROR(lib_handle, -EBADE, "recvmsg(%d) failed, ret = %d", lib_handle->ctrl_sock_fd, bytes_read);
+        SET_CPC_RET(-EBADE);
+      }
+    }
+  }
 
-  if (tmp_ret) {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange close endpoint query");
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
   }
 
-  TRACE_LIB(lib_handle, "closing EP #%d", ep->id);
+  if (bytes_read > 0) {
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && fd_count == 0) {
+        fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (fd_count > SHM_TRANSPORT_FD_COUNT) {
+          fd_count = SHM_TRANSPORT_FD_COUNT;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), fd_count * sizeof(int));
+      }
+    }
+  }
 
-  if (close(ep->sock_fd) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
-    goto unlock_mutex;
+  if (__cpc_ret != 0) {
+    goto close_fds;
   }
-  ep->sock_fd = -1;
 
-  tmp_ret = cpc_query_receive(lib_handle, lib_handle->ctrl_sock_fd, NULL, sizeof(int));
-  if (tmp_ret == 0) {
-    TRACE_LIB(lib_handle, "closed EP #%d", ep->id);
-  } else {
-    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to receive close notification EP #%d, free up resources anyway", ep->id);
+  memcpy(&transport, query->payload, sizeof(transport));
+
+  if (transport.ring_size == 0) {
+    TRACE_LIB_ERROR(lib_handle, -EBUSY, "daemon refused the shared memory transport on EP #%d", ep->id);
+    SET_CPC_RET(-EBUSY);
+    goto close_fds;
   }
 
-  unlock_mutex:
-  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed, free up resources anyway", &lib_handle->ctrl_sock_fd_lock);
+  if (fd_count != SHM_TRANSPORT_FD_COUNT || (transport.ring_size & (transport.ring_size - 1)) != 0) {
+    TRACE_LIB_ERROR(lib_handle, -EBADE, "invalid shared memory transport reply");
+    SET_CPC_RET(-EBADE);
+    goto close_fds;
   }
 
-  destroy_mutex:
-  tmp_ret = pthread_mutex_destroy(&ep->sock_fd_lock);
-  if (tmp_ret != 0) {
-    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_destroy(%p) failed, free up resources anyway", &ep->sock_fd_lock);
+  shm = zalloc(sizeof(sli_cpc_shm_transport_t));
+  if (shm == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_shm_transport_t));
+    SET_CPC_RET(-ENOMEM);
+    goto close_fds;
   }
 
-  // Try to close the file descriptor if an error occured previously and prevented it
-  if (ep->sock_fd != -1 && close(ep->sock_fd) < 0) {
-    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
+  footprint = shm_ring_footprint(transport.ring_size);
+  shm->length = footprint + sizeof(shm_broadcast_cursor_t);
+  shm->base = mmap(NULL, shm->length, PROT_READ | PROT_WRITE, MAP_SHARED, fds[SHM_TRANSPORT_FD_MEMFD], 0);
+  if (shm->base == MAP_FAILED) {
+    TRACE_LIB_ERRNO(lib_handle, "mmap(%d) failed", fds[SHM_TRANSPORT_FD_MEMFD]);
+    SET_CPC_RET(-errno);
+    goto free_shm;
   }
 
-  free(ep);
-  endpoint->ptr = NULL;
+  // The other clients of the endpoint read the same messages, only the daemon writes them
+  shm->broadcast_length = shm_broadcast_footprint(transport.ring_size);
+  shm->broadcast_base = mmap(NULL, shm->broadcast_length, PROT_READ, MAP_SHARED, fds[SHM_TRANSPORT_FD_BROADCAST_MEMFD], 0);
+  if (shm->broadcast_base == MAP_FAILED) {
+    TRACE_LIB_ERRNO(lib_handle, "mmap(%d) failed", fds[SHM_TRANSPORT_FD_BROADCAST_MEMFD]);
+    SET_CPC_RET(-errno);
+    munmap(shm->base, shm->length);
+    goto free_shm;
+  }
+
+  // The daemon reads the ring of this client, and writes the broadcast ring
+  shm_ring_attach(&shm->tx_ring, shm->base, transport.ring_size, false);
+  shm_broadcast_attach(&shm->rx_ring, shm->broadcast_base, transport.ring_size, false);
+  shm->rx_cursor = (shm_broadcast_cursor_t *)((uint8_t *)shm->base + footprint);
+  shm->rx_ring_lendable = (transport.overwrites == 0);
+
+  pthread_mutex_init(&shm->tx_ring_lock, NULL);
+  pthread_mutex_init(&shm->rx_ring_lock, NULL);
+  shm->poll_fd = -1;
+
+  // The mappings hold the memory, keep the doorbells only
+  close(fds[SHM_TRANSPORT_FD_MEMFD]);
+  close(fds[SHM_TRANSPORT_FD_BROADCAST_MEMFD]);
+  for (int i = SHM_TRANSPORT_FD_DAEMON_DOORBELL; i < SHM_TRANSPORT_FD_COUNT; i++) {
+    shm->fds[i] = fds[i];
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+
+  ep->shm = shm;
+  TRACE_LIB(lib_handle, "opened shared memory transport on EP #%d", ep->id);
+
+  free(query);
+
+  RETURN_CPC_RET;
+
+  free_shm:
+  free(shm);
+
+  close_fds:
+  for (size_t i = 0; i < fd_count; i++) {
+    close(fds[i]);
+  }
+
+  free_query:
+  free(query);
 
   RETURN_CPC_RET;
 }
 
 /***************************************************************************//**
- * Attempt to read up to count bytes from a previously-opened endpoint socket.
- * Once data is received, it will be copied to the user-provided buffer.
- * The lifecycle of this buffer is handled by the user.
- *
- * By default the cpc_read function will block indefinitely.
- * A timeout can be configured with cpc_set_endpoint_option.
+ * Poll a doorbell of the shared memory transport and the endpoint socket, and
+ * clear the doorbell if it rang.
+ * Returns 1 if the socket has an event, 0 if the doorbell rang, -EAGAIN if
+ * neither happened before timeout_ms.
  ******************************************************************************/
-ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_endpoint_read_flags_t flags)
+static int shm_poll(sli_cpc_endpoint_t *ep, int fd_doorbell, short sock_events, int timeout_ms)
 {
-  INIT_CPC_RET(ssize_t);
-  int sock_flags = 0;
-  ssize_t bytes_read = 0;
-  sli_cpc_endpoint_t *ep = NULL;
-
-  if (buffer == NULL || count < SL_CPC_READ_MINIMUM_SIZE || endpoint.ptr == NULL) {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
+  struct pollfd fds[2];
+  uint64_t count;
+  int ret;
+
+  fds[0].fd = fd_doorbell;
+  fds[0].events = POLLIN;
+  fds[1].fd = ep->sock_fd;
+  fds[1].events = sock_events;
+
+  ret = poll(fds, 2, timeout_ms);
+  if (ret < 0) {
+    return -errno;
+  } else if (ret == 0) {
+    return -EAGAIN;
+  }
+
+  if (fds[0].revents & POLLIN) {
+    // Doorbells are non-blocking, another thread may have consumed it meanwhile
+    if (read(fd_doorbell, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+      return -errno;
+    }
   }
 
-  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+  return fds[1].revents != 0 ? 1 : 0;
+}
 
-  TRACE_LIB(ep->lib_handle, "reading from EP #%d", ep->id);
+/***************************************************************************//**
+ * Wait for a doorbell of the shared memory transport, or for an event on the
+ * endpoint socket. The socket timeout given by optname is honoured, deadline_us
+ * must be 0 on the first call of a transaction.
+ * Returns 1 if the socket has an event, 0 if the doorbell rang.
+ ******************************************************************************/
+static int shm_wait(sli_cpc_endpoint_t *ep, int fd_doorbell, short sock_events, int optname, int64_t *deadline_us)
+{
+  struct timespec now;
+  int64_t now_us;
+  int timeout_ms = -1;
 
-  if (flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING) {
-    sock_flags |= MSG_DONTWAIT;
-  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  now_us = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
 
-  bytes_read = recv(ep->sock_fd, buffer, count, sock_flags);
-  if (bytes_read == 0) {
-    TRACE_LIB_ERROR(ep->lib_handle, -ECONNRESET, "recv(%d) failed", ep->sock_fd);
-    SET_CPC_RET(-ECONNRESET);
-  } else if (bytes_read < 0) {
-    if (errno != EAGAIN) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "recv(%d) failed", ep->sock_fd);
+  if (*deadline_us == 0) {
+    struct timeval timeout;
+    socklen_t socklen = sizeof(timeout);
+
+    if (getsockopt(ep->sock_fd, SOL_SOCKET, optname, &timeout, &socklen) < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
+      return -errno;
+    }
+
+    if (timeout.tv_sec == 0 && timeout.tv_usec == 0) {
+      *deadline_us = -1;
+    } else {
+      *deadline_us = now_us + (int64_t)timeout.tv_sec * 1000000 + timeout.tv_usec;
     }
-    SET_CPC_RET(-errno);
-  } else {
-    SET_CPC_RET(bytes_read);
   }
 
-  if (bytes_read > 0) {
-    TRACE_LIB(ep->lib_handle, "read from EP #%d", ep->id);
+  if (*deadline_us > 0) {
+    if (now_us >= *deadline_us) {
+      return -EAGAIN;
+    }
+    timeout_ms = (int)((*deadline_us - now_us + 999) / 1000);
   }
 
-  RETURN_CPC_RET;
+  return shm_poll(ep, fd_doorbell, sock_events, timeout_ms);
 }
 
-/***************************************************************************//**
- * Write data to an open endpoint.
- ******************************************************************************/
-ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_endpoint_write_flags_t flags)
+static bool shm_is_non_blocking(sli_cpc_endpoint_t *ep)
 {
-  INIT_CPC_RET(ssize_t);
-  int sock_flags = 0;
-  ssize_t bytes_written = 0;
-  sli_cpc_endpoint_t *ep = NULL;
+  int flags = fcntl(ep->sock_fd, F_GETFL);
 
-  if (endpoint.ptr == NULL || data == NULL || data_length == 0) {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
-  }
+  return flags >= 0 && (flags & O_NONBLOCK);
+}
 
-  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+/* If view is not NULL and the next message can be lent in place, it points to it and buffer is left unused */
+static ssize_t shm_read_endpoint(sli_cpc_endpoint_t *ep, void *buffer, size_t count, const void **view, bool non_blocking)
+{
+  sli_cpc_shm_transport_t *shm = ep->shm;
+  int64_t deadline_us = 0;
+  bool rechecked = false;
+  ssize_t bytes_read;
+  int ret;
+
+  while (1) {
+    pthread_mutex_lock(&shm->rx_ring_lock);
+
+    if (shm->view_length != 0) {
+      /* The next message of the ring is lent, and stays there until released */
+      bytes_read = -EBUSY;
+    } else if (!shm->sock_fd_drained) {
+      /* Frames pushed before the switch are still in the socket, and a close shows up there */
+      bytes_read = recv(ep->sock_fd, buffer, count, MSG_DONTWAIT);
+      if (bytes_read == 0) {
+        bytes_read = -ECONNRESET;
+      } else if (bytes_read < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          shm->sock_fd_drained = true;
+          bytes_read = 0;
+        } else {
+          bytes_read = -errno;
+        }
+      }
+    } else {
+      bytes_read = 0;
+    }
 
-  if (data_length > ep->lib_handle->max_write_size) {
-    TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "payload too large (%d > %d)", data_length, ep->lib_handle->max_write_size);
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
-  }
+    if (bytes_read == 0 && view != NULL && shm->rx_ring_lendable) {
+      bytes_read = shm_broadcast_peek(&shm->rx_ring, shm->rx_cursor, view);
+      if (bytes_read > 0 && *view != NULL) {
+        shm->view_length = (size_t)bytes_read;
+      } else if (bytes_read > 0) {
+        /* Wraps around the end of the ring, it is copied instead */
+        bytes_read = 0;
+      }
+    }
 
-  TRACE_LIB(ep->lib_handle, "writing to EP #%d", ep->id);
+    if (bytes_read == 0) {
+      bytes_read = shm_broadcast_pop(&shm->rx_ring, shm->rx_cursor, buffer, count);
+    }
 
-  if (flags & CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING) {
-    sock_flags |= MSG_DONTWAIT;
-  }
+    pthread_mutex_unlock(&shm->rx_ring_lock);
 
-  bytes_written = send(ep->sock_fd, data, data_length, sock_flags);
-  if (bytes_written == -1) {
-    TRACE_LIB_ERRNO(ep->lib_handle, "send(%d) failed", ep->sock_fd);
-    SET_CPC_RET(-errno);
-    RETURN_CPC_RET;
-  } else {
-    SET_CPC_RET(bytes_written);
+    if (bytes_read != 0) {
+      return bytes_read;
+    }
+
+    if (non_blocking) {
+      /* Quiet the doorbell before giving up, so that the fd of cpc_get_endpoint_fd() and cpc_wait()
+       * only wake up again for new messages. One pushed before it was cleared is found by the recheck. */
+      if (rechecked) {
+        return -EAGAIN;
+      }
+
+      ret = shm_poll(ep, shm->fds[SHM_TRANSPORT_FD_RX_DOORBELL], POLLIN, 0);
+      if (ret == -EAGAIN) {
+        return -EAGAIN;
+      } else if (ret < 0) {
+        return ret;
+      } else if (ret == 1) {
+        shm->sock_fd_drained = false;
+      }
+
+      rechecked = true;
+      continue;
+    }
+
+    ret = shm_wait(ep, shm->fds[SHM_TRANSPORT_FD_RX_DOORBELL], POLLIN, SO_RCVTIMEO, &deadline_us);
+    if (ret < 0) {
+      return ret;
+    } else if (ret == 1) {
+      shm->sock_fd_drained = false;
+    }
   }
+}
 
-  TRACE_LIB(ep->lib_handle, "wrote to EP #%d", ep->id);
+static ssize_t shm_write_endpoint(sli_cpc_endpoint_t *ep, const void *data, size_t data_length, bool non_blocking)
+{
+  sli_cpc_shm_transport_t *shm = ep->shm;
+  int64_t deadline_us = 0;
+  bool waiting = false;
+  bool was_empty = false;
+  bool pushed;
+  int ret;
+
+  while (1) {
+    pthread_mutex_lock(&shm->tx_ring_lock);
+    pushed = shm_ring_push(&shm->tx_ring, data, (uint32_t)data_length, &was_empty);
+    pthread_mutex_unlock(&shm->tx_ring_lock);
+
+    if (pushed) {
+      /* The daemon only needs a doorbell if it may have drained the ring */
+      if (was_empty) {
+        const uint64_t one = 1;
+        if (write(shm->fds[SHM_TRANSPORT_FD_DAEMON_DOORBELL], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+          return -errno;
+        }
+      }
+      return (ssize_t)data_length;
+    }
 
-  /*
-   * The socket type between the library and the daemon are of type
-   * SOCK_SEQPACKET. Unlike stream sockets, it is technically impossible
-   * for DGRAM or SEQPACKET to do partial writes. The man page is ambiguous
-   * about the return value in the our case, but research showed that it should
-   * never happens. If it did happen,it would cause problems in
-   * dealing with partially sent messages.
-   */
-  assert((size_t)bytes_written == data_length);
+    if (non_blocking) {
+      return -EAGAIN;
+    }
 
-  RETURN_CPC_RET;
+    /* Ask for a doorbell and try again, in case space was freed in between */
+    if (!waiting) {
+      shm_ring_set_producer_waiting(&shm->tx_ring);
+      waiting = true;
+      continue;
+    }
+
+    ret = shm_wait(ep, shm->fds[SHM_TRANSPORT_FD_TX_DOORBELL], 0, SO_SNDTIMEO, &deadline_us);
+    if (ret < 0) {
+      return ret;
+    } else if (ret == 1) {
+      return -EPIPE;
+    }
+    waiting = false;
+  }
+}
+
+static void SIGUSR1_handler(int signum)
+{
+  (void) signum;
+
+  if (saved_reset_callback != NULL) {
+    saved_reset_callback();
+  }
 }
 
 /***************************************************************************//**
- * Get the state of an endpoint by ID.
+ * Initialize the CPC library.
+ * Upon success, users will get a handle that must be passed to subsequent calls.
  ******************************************************************************/
-int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t *state)
+int cpc_init(cpc_handle_t *handle, const char *instance_name, bool enable_tracing, cpc_reset_callback_t reset_callback)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
   sli_cpc_handle_t *lib_handle = NULL;
+  struct sockaddr_un server_addr = { 0 };
 
-  if (state == NULL || handle.ptr == NULL || id == SL_CPC_ENDPOINT_SYSTEM) {
+  if (handle == NULL) {
     SET_CPC_RET(-EINVAL);
     RETURN_CPC_RET;
   }
 
-  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+  lib_handle = zalloc(sizeof(sli_cpc_handle_t));
+  if (lib_handle == NULL) {
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
 
-  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  /* Save the parameters internally for possible further re-init */
+  lib_handle->enable_tracing = enable_tracing;
+  saved_reset_callback = reset_callback;
+
+  if (instance_name == NULL) {
+    /* If the instance name is NULL, use the default name */
+    lib_handle->instance_name = strdup(DEFAULT_INSTANCE_NAME);
+    if (lib_handle->instance_name == NULL) {
+      SET_CPC_RET(-errno);
+      goto free_lib_handle;
+    }
+  } else {
+    /* Instead, use the one supplied by the user */
+    lib_handle->instance_name = strdup(instance_name);
+    if (lib_handle->instance_name == NULL) {
+      SET_CPC_RET(-errno);
+      goto free_lib_handle;
+    }
+  }
+
+  /* Create the control socket path */
+  {
+    int nchars;
+    const size_t size = sizeof(server_addr.sun_path) - 1;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+
+    nchars = snprintf(server_addr.sun_path, size, "%s/cpcd/%s/ctrl.cpcd.sock", CPC_SOCKET_DIR, lib_handle->instance_name);
+
+    /* Make sure the path fitted entirely in the struct's static buffer */
+    if (nchars < 0 || (size_t) nchars >= size) {
+      TRACE_LIB_ERROR(lib_handle, -ERANGE, "socket path '%s/cpcd/%s/ctrl.cpcd.sock' does not fit in buffer", CPC_SOCKET_DIR, lib_handle->instance_name);
+      SET_CPC_RET(-ERANGE);
+      goto free_instance_name;
+    }
+  }
+
+  // Check if control socket exists
+  if (access(server_addr.sun_path, F_OK) != 0) {
+    TRACE_LIB_ERRNO(lib_handle,
+                    "access() : %s doesn't exist. The daemon is not started or "
+                    "the reset sequence is not done or the secondary is not responsive.",
+                    server_addr.sun_path);
+    SET_CPC_RET(-errno);
+    goto free_instance_name;
+  }
+
+  lib_handle->ctrl_sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (lib_handle->ctrl_sock_fd < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "socket() failed");
+    SET_CPC_RET(-errno);
+    goto free_instance_name;
+  }
+
+  if (connect(lib_handle->ctrl_sock_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) {
+    TRACE_LIB_ERRNO(lib_handle,
+                    "connect() : could not connect to %s. Either the process does not have "
+                    "the correct permissions or the secondary is not responsive.",
+                    server_addr.sun_path);
+    SET_CPC_RET(-errno);
+    goto close_ctrl_sock_fd;
+  }
+
+  // Set ctrl socket timeout
+  struct timeval timeout;
+  timeout.tv_sec = CTRL_SOCKET_TIMEOUT_SEC;
+  timeout.tv_usec = 0;
+
+  if (setsockopt(lib_handle->ctrl_sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval)) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "setsockopt(%d) failed", lib_handle->ctrl_sock_fd);
+    SET_CPC_RET(-errno);
+    goto close_ctrl_sock_fd;
+  }
+
+  tmp_ret = init_handshake(lib_handle);
+  if (tmp_ret < 0) {
+    SET_CPC_RET(tmp_ret);
+    goto free_secondary_app_version;
+  }
+
+  // Check if reset callback is define
+  if (reset_callback != NULL) {
+    signal(SIGUSR1, SIGUSR1_handler);
+  }
+
+  // Check if control socket exists
+  if (access(server_addr.sun_path, F_OK) != 0) {
+    TRACE_LIB_ERRNO(lib_handle,
+                    "access() : %s doesn't exist. The daemon is not started or the reset "
+                    "sequence is not done or the secondary is not responsive.",
+                    server_addr.sun_path);
+    SET_CPC_RET(-errno);
+    goto free_secondary_app_version;
+  }
+
+  tmp_ret = pthread_mutex_init(&lib_handle->ctrl_sock_fd_lock, NULL);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_init(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    goto free_secondary_app_version;
+  }
+
+  open_state_table(lib_handle);
+
+  lib_handle->initialized = true;
+  handle->ptr = (void *)lib_handle;
+  TRACE_LIB(lib_handle, "cpc lib initialized");
+
+  RETURN_CPC_RET;
+
+  free_secondary_app_version:
+  free(lib_handle->secondary_app_version);
+
+  close_ctrl_sock_fd:
+  if (close(lib_handle->ctrl_sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", lib_handle->ctrl_sock_fd);
+    SET_CPC_RET(-errno);
+  }
+
+  free_instance_name:
+  free(lib_handle->instance_name);
+
+  free_lib_handle:
+  free(lib_handle);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * De-init the library handle and any allocated resources
+ ******************************************************************************/
+int cpc_deinit(cpc_handle_t *handle)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+
+  if (handle->ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle->ptr;
+
+  if (close(lib_handle->ctrl_sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", lib_handle->ctrl_sock_fd);
+  }
+
+  if (lib_handle->state_table != NULL
+      && munmap((void *)lib_handle->state_table, sizeof(cpcd_exchange_state_table_t)) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "munmap(%p) failed", lib_handle->state_table);
+  }
+
+  tmp_ret = pthread_mutex_destroy(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_destroy(%p) failed, free up resources anyway", &lib_handle->ctrl_sock_fd_lock);
+  }
+
+  TRACE_LIB(lib_handle, "cpc lib deinitialized");
+
+  free(lib_handle->instance_name);
+  free(lib_handle->secondary_app_version);
+  free(lib_handle);
+
+  handle->ptr = NULL;
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Restart the CPC library.
+ * The user is notified via the 'reset_callback' when the secondary has restarted.
+ * The user logic then has to call this function in order to [try] to re-connect
+ * the application to the daemon.
+ ******************************************************************************/
+int cpc_restart(cpc_handle_t *handle)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+
+  if (handle->ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle->ptr;
+
+  sli_cpc_handle_t *lib_handle_copy = zalloc(sizeof(sli_cpc_handle_t));
+  if (lib_handle_copy == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_handle_t));
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
+
+  memcpy(lib_handle_copy, lib_handle, sizeof(sli_cpc_handle_t));
+  lib_handle_copy->instance_name = strdup(lib_handle->instance_name);
+  if (lib_handle_copy->instance_name == NULL) {
+    free(lib_handle_copy);
+    TRACE_LIB_ERRNO(lib_handle, "failed to copy the instance name");
+    SET_CPC_RET(-errno);
+    RETURN_CPC_RET;
+  }
+
+  // De-init the original handle
+  if (lib_handle_copy->initialized) {
+    tmp_ret = cpc_deinit(handle);
+    if (tmp_ret != 0) {
+      // Restore the handle copy on failure
+      free(lib_handle_copy->instance_name);
+      lib_handle_copy->instance_name = lib_handle->instance_name;
+      handle->ptr = (void *)lib_handle_copy;
+
+      TRACE_LIB_ERROR(lib_handle, tmp_ret, "cpc_deinit(%p) failed", handle);
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  }
+
+  // De-init was successful, invalidate copy
+  lib_handle_copy->initialized = false;
+  lib_handle_copy->state_table = NULL;
+
+  // Attemps a connection
+  tmp_ret = cpc_init(handle, lib_handle_copy->instance_name, lib_handle_copy->enable_tracing, saved_reset_callback);
+  if (tmp_ret != 0) {
+    uint32_t waited_ms = 0;
+    uint32_t delay_ms = CPC_RESTART_FIRST_RETRY_DELAY_MS;
+
+    TRACE_LIB_ERROR(lib_handle_copy, tmp_ret, "Failed cpc_init, attempting again for up to %d milliseconds", CPCD_REBOOT_TIME_MS);
+
+    // CPCd is usually back well before the time it can take to reboot, which is only an upper bound
+    while (tmp_ret != 0 && waited_ms < (uint32_t)CPCD_REBOOT_TIME_MS) {
+      if (delay_ms > (uint32_t)CPCD_REBOOT_TIME_MS - waited_ms) {
+        delay_ms = (uint32_t)CPCD_REBOOT_TIME_MS - waited_ms;
+      }
+
+      sleep_ms(delay_ms);
+      waited_ms += delay_ms;
+      delay_ms *= 2;
+
+      tmp_ret = cpc_init(handle, lib_handle_copy->instance_name, lib_handle_copy->enable_tracing, saved_reset_callback);
+    }
+
+    if (tmp_ret != 0) {
+      // Restore the handle copy on failure
+      handle->ptr = (void *)lib_handle_copy;
+      TRACE_LIB_ERROR(lib_handle_copy, tmp_ret, "cpc_init(%p) failed", handle);
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  }
+
+  // On success we can free the lib_handle_copy
+  free(lib_handle_copy->instance_name);
+  free(lib_handle_copy);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Connect to the socket corresponding to the provided endpoint ID.
+ * The function will also allocate the memory for the endpoint structure and assign
+ * it to the provided pointer.
+ * This endpoint structure must then be used for further calls to the libcpc.
+ ******************************************************************************/
+/* Check the arguments of an open and build the path of the endpoint socket */
+static int prepare_open_endpoint(sli_cpc_handle_t *lib_handle, uint8_t id, uint8_t tx_window_size, struct sockaddr_un *ep_addr)
+{
+  INIT_CPC_RET(int);
+
+  if (tx_window_size < 1 || tx_window_size > SL_CPC_TX_WINDOW_SIZE_MAX) {
+    TRACE_LIB_ERROR(lib_handle, -EINVAL, "The tx window must be between 1 and %d", SL_CPC_TX_WINDOW_SIZE_MAX);
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  TRACE_LIB(lib_handle, "opening EP #%d", id);
+
+  memset(ep_addr, 0, sizeof(*ep_addr));
+  ep_addr->sun_family = AF_UNIX;
+
+  /* Create the endpoint socket path */
+  {
+    int nchars;
+    const size_t size = sizeof(ep_addr->sun_path) - 1;
+
+    nchars = snprintf(ep_addr->sun_path, size, "%s/cpcd/%s/ep%d.cpcd.sock", CPC_SOCKET_DIR, lib_handle->instance_name, id);
+
+    /* Make sure the path fitted entirely in the struct sockaddr_un's static buffer */
+    if (nchars < 0 || (size_t) nchars >= size) {
+      TRACE_LIB_ERROR(lib_handle, -ERANGE, "socket path '%s/cpcd/%s/ep%d.cpcd.sock' does not fit in buffer", CPC_SOCKET_DIR, lib_handle->instance_name, id);
+      SET_CPC_RET(-ERANGE);
+      RETURN_CPC_RET;
+    }
+  }
+
+  RETURN_CPC_RET;
+}
+
+/* Once the daemon answered the open query, connect to the endpoint socket.
+ * Returns the file descriptor of the endpoint, or frees it on error. */
+static int connect_endpoint(sli_cpc_handle_t *lib_handle, uint8_t id, bool can_open, const struct sockaddr_un *ep_addr, cpc_endpoint_t *endpoint)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (can_open == false) {
+    if (id == SL_CPC_ENDPOINT_SECURITY) {
+      TRACE_LIB_ERROR(lib_handle, -EPERM, "cannot open security endpoint as a client");
+      SET_CPC_RET(-EPERM);
+    } else {
+      TRACE_LIB_ERROR(lib_handle, -EAGAIN, "endpoint on secondary is not opened");
+      SET_CPC_RET(-EAGAIN);
+    }
+    RETURN_CPC_RET;
+  }
+
+  ep = zalloc(sizeof(sli_cpc_endpoint_t));
+  if (ep == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_endpoint_t));
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
+
+  ep->id = id;
+  ep->lib_handle = lib_handle;
+  ep->max_write_size = lib_handle->max_write_size;
+
+  ep->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (ep->sock_fd < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "socket()");
+    SET_CPC_RET(-errno);
+    goto free_endpoint;
+  }
+
+  tmp_ret = connect(ep->sock_fd, (const struct sockaddr *)ep_addr, sizeof(*ep_addr));
+  if (tmp_ret < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "connect(%d) failed", ep->sock_fd);
+    SET_CPC_RET(-errno);
+    goto close_sock_fd;
+  }
+
+  tmp_ret = cpc_query_receive(lib_handle, ep->sock_fd, (void*)&ep->server_sock_fd, sizeof(ep->server_sock_fd));
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to receive server ack");
+    SET_CPC_RET(tmp_ret);
+    goto close_sock_fd;
+  }
+
+  int ep_socket_size = DEFAULT_ENDPOINT_SOCKET_SIZE;
+  tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, &ep_socket_size, sizeof(int));
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERRNO(lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+    SET_CPC_RET(-errno);
+    goto close_sock_fd;
+  }
+
+  tmp_ret = pthread_mutex_init(&ep->sock_fd_lock, NULL);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_init(%p) failed", &ep->sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    goto close_sock_fd;
+  }
+
+  TRACE_LIB(lib_handle, "opened EP #%d", ep->id);
+  endpoint->ptr = (void *)ep;
+
+  SET_CPC_RET(ep->sock_fd);
+  RETURN_CPC_RET;
+
+  close_sock_fd:
+  if (close(ep->sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
+    SET_CPC_RET(-errno);
+  }
+
+  free_endpoint:
+  free(ep);
+
+  RETURN_CPC_RET;
+}
+
+int cpc_open_endpoint(cpc_handle_t handle, cpc_endpoint_t *endpoint, uint8_t id, uint8_t tx_window_size)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  int tmp_ret2 = 0;
+  bool can_open = false;
+  sli_cpc_handle_t *lib_handle = NULL;
+  struct sockaddr_un ep_addr;
+
+  if (id == SL_CPC_ENDPOINT_SYSTEM || endpoint == NULL || handle.ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+
+  tmp_ret = prepare_open_endpoint(lib_handle, id, tx_window_size, &ep_addr);
+  if (tmp_ret) {
+    SET_CPC_RET(tmp_ret);
+    RETURN_CPC_RET;
+  }
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
+  }
+
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_OPEN_ENDPOINT_QUERY, id,
+                               (void*)&can_open, sizeof(can_open));
+
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange open endpoint query");
+    SET_CPC_RET(tmp_ret);
+  }
+
+  tmp_ret2 = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret2 != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret2, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret2);
+    RETURN_CPC_RET;
+  }
+
+  if (tmp_ret) {
+    RETURN_CPC_RET;
+  }
+
+  SET_CPC_RET(connect_endpoint(lib_handle, id, can_open, &ep_addr, endpoint));
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Start opening an endpoint, on a control connection of its own so that the
+ * reply of the daemon doesn't hold the one of the library handle. That
+ * connection doesn't register a pid, the daemon signals resets to the one of
+ * cpc_init().
+ ******************************************************************************/
+int cpc_open_endpoint_async(cpc_handle_t handle, cpc_endpoint_open_handle_t *open_handle, uint8_t id, uint8_t tx_window_size)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  bool can_open = false;
+  sli_cpc_handle_t *lib_handle = NULL;
+  sli_cpc_endpoint_open_t *open = NULL;
+  struct sockaddr_un ctrl_addr = { 0 };
+  cpcd_exchange_buffer_t *query = NULL;
+  const size_t query_len = sizeof(cpcd_exchange_buffer_t) + sizeof(can_open);
+  uint8_t buf[query_len];
+
+  if (id == SL_CPC_ENDPOINT_SYSTEM || open_handle == NULL || handle.ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+
+  open = zalloc(sizeof(sli_cpc_endpoint_open_t));
+  if (open == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", sizeof(sli_cpc_endpoint_open_t));
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
+
+  open->id = id;
+  open->lib_handle = lib_handle;
+
+  tmp_ret = prepare_open_endpoint(lib_handle, id, tx_window_size, &open->ep_addr);
+  if (tmp_ret) {
+    SET_CPC_RET(tmp_ret);
+    goto free_open;
+  }
+
+  ctrl_addr.sun_family = AF_UNIX;
+  snprintf(ctrl_addr.sun_path, sizeof(ctrl_addr.sun_path) - 1, "%s/cpcd/%s/ctrl.cpcd.sock", CPC_SOCKET_DIR, lib_handle->instance_name);
+
+  open->sock_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (open->sock_fd < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "socket() failed");
+    SET_CPC_RET(-errno);
+    goto free_open;
+  }
+
+  if (connect(open->sock_fd, (struct sockaddr *)&ctrl_addr, sizeof(ctrl_addr)) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "connect(%d) failed", open->sock_fd);
+    SET_CPC_RET(-errno);
+    goto close_sock_fd;
+  }
+
+  memset(buf, 0, sizeof(buf));
+  query = (cpcd_exchange_buffer_t *)buf;
+  query->type = EXCHANGE_OPEN_ENDPOINT_QUERY;
+  query->endpoint_number = id;
+
+  if (send(open->sock_fd, query, query_len, 0) != (ssize_t)query_len) {
+    TRACE_LIB_ERRNO(lib_handle, "send(%d) failed", open->sock_fd);
+    SET_CPC_RET(-errno);
+    goto close_sock_fd;
+  }
+
+  open_handle->ptr = (void *)open;
+
+  SET_CPC_RET(open->sock_fd);
+  RETURN_CPC_RET;
+
+  close_sock_fd:
+  if (close(open->sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", open->sock_fd);
+  }
+
+  free_open:
+  free(open);
+
+  RETURN_CPC_RET;
+}
+
+static void free_endpoint_open(cpc_endpoint_open_handle_t *open_handle)
+{
+  sli_cpc_endpoint_open_t *open = (sli_cpc_endpoint_open_t *)open_handle->ptr;
+
+  if (close(open->sock_fd) < 0) {
+    TRACE_LIB_ERRNO(open->lib_handle, "close(%d) failed", open->sock_fd);
+  }
+
+  free(open);
+  open_handle->ptr = NULL;
+}
+
+/***************************************************************************//**
+ * Complete an open started by cpc_open_endpoint_async(), once its file
+ * descriptor is readable. Returns -EINPROGRESS until then.
+ ******************************************************************************/
+int cpc_complete_open_endpoint(cpc_endpoint_open_handle_t *open_handle, cpc_endpoint_t *endpoint)
+{
+  INIT_CPC_RET(int);
+  sli_cpc_endpoint_open_t *open = NULL;
+  bool can_open = false;
+  cpcd_exchange_buffer_t *reply = NULL;
+  const size_t reply_len = sizeof(cpcd_exchange_buffer_t) + sizeof(can_open);
+  uint8_t buf[reply_len];
+  ssize_t bytes_read;
+
+  if (open_handle == NULL || open_handle->ptr == NULL || endpoint == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  open = (sli_cpc_endpoint_open_t *)open_handle->ptr;
+  reply = (cpcd_exchange_buffer_t *)buf;
+
+  bytes_read = recv(open->sock_fd, reply, reply_len, MSG_DONTWAIT);
+  if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    SET_CPC_RET(-EINPROGRESS);
+    RETURN_CPC_RET;
+  }
+
+  if (bytes_read != (ssize_t)reply_len) {
+    if (bytes_read == 0) {
+      TRACE_LIB_ERROR(open->lib_handle, -ECONNRESET, "recv(%d) failed", open->sock_fd);
+      SET_CPC_RET(-ECONNRESET);
+    } else if (bytes_read < 0) {
+      TRACE_LIB_ERRNO(open->lib_handle, "recv(%d) failed", open->sock_fd);
+      SET_CPC_RET(-errno);
+    } else {
+      TRACE_LIB_ERROR(open->lib_handle, -EBADE, "recv(%d) failed, ret = %d", open->sock_fd, bytes_read);
+      SET_CPC_RET(-EBADE);
+    }
+    free_endpoint_open(open_handle);
+    RETURN_CPC_RET;
+  }
+
+  memcpy(&can_open, reply->payload, sizeof(can_open));
+
+  SET_CPC_RET(connect_endpoint(open->lib_handle, open->id, can_open, &open->ep_addr, endpoint));
+  free_endpoint_open(open_handle);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Give up on an open started by cpc_open_endpoint_async(). The daemon forgets
+ * it when its control connection closes.
+ ******************************************************************************/
+int cpc_cancel_open_endpoint(cpc_endpoint_open_handle_t *open_handle)
+{
+  if (open_handle == NULL || open_handle->ptr == NULL) {
+    return -EINVAL;
+  }
+
+  free_endpoint_open(open_handle);
+
+  return 0;
+}
+
+/***************************************************************************//**
+ * Close the socket connection to the endpoint.
+ * This function will also free the memory used to allocate the endpoint structure.
+ ******************************************************************************/
+int cpc_close_endpoint(cpc_endpoint_t *endpoint)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (endpoint == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint->ptr;
+  if (ep == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = ep->lib_handle;
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    goto destroy_mutex;
+  }
+
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_CLOSE_ENDPOINT_QUERY, ep->id,
+                               (void*)&ep->server_sock_fd, sizeof(ep->server_sock_fd));
+
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange close endpoint query");
+  }
+
+  TRACE_LIB(lib_handle, "closing EP #%d", ep->id);
+
+  if (close(ep->sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
+    goto unlock_mutex;
+  }
+  ep->sock_fd = -1;
+
+  tmp_ret = cpc_query_receive(lib_handle, lib_handle->ctrl_sock_fd, NULL, sizeof(int));
+  if (tmp_ret == 0) {
+    TRACE_LIB(lib_handle, "closed EP #%d", ep->id);
+  } else {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to receive close notification EP #%d, free up resources anyway", ep->id);
+  }
+
+  unlock_mutex:
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed, free up resources anyway", &lib_handle->ctrl_sock_fd_lock);
+  }
+
+  destroy_mutex:
+  close_shm_transport(ep);
+
+  tmp_ret = pthread_mutex_destroy(&ep->sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_destroy(%p) failed, free up resources anyway", &ep->sock_fd_lock);
+  }
+
+  // Try to close the file descriptor if an error occured previously and prevented it
+  if (ep->sock_fd != -1 && close(ep->sock_fd) < 0) {
+    TRACE_LIB_ERRNO(lib_handle, "close(%d) failed", ep->sock_fd);
+  }
+
+  free(ep->zc_buffer);
+  free(ep);
+  endpoint->ptr = NULL;
+
+  RETURN_CPC_RET;
+}
+
+/* view is passed to shm_read_endpoint(), NULL when no message must be lent */
+static ssize_t read_endpoint(sli_cpc_endpoint_t *ep, void *buffer, size_t count, const void **view, cpc_endpoint_read_flags_t flags)
+{
+  INIT_CPC_RET(ssize_t);
+  int sock_flags = 0;
+  ssize_t bytes_read = 0;
+
+  TRACE_LIB(ep->lib_handle, "reading from EP #%d", ep->id);
+
+  if (ep->shm != NULL) {
+    bytes_read = shm_read_endpoint(ep, buffer, count, view, (flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING) || shm_is_non_blocking(ep));
+    if (bytes_read < 0 && bytes_read != -EAGAIN) {
+      TRACE_LIB_ERROR(ep->lib_handle, (int)bytes_read, "shared memory read on EP #%d failed", ep->id);
+    } else if (bytes_read > 0) {
+      TRACE_LIB(ep->lib_handle, "read from EP #%d", ep->id);
+    }
+    SET_CPC_RET(bytes_read);
+    RETURN_CPC_RET;
+  }
+
+  if (flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING) {
+    sock_flags |= MSG_DONTWAIT;
+  }
+
+  bytes_read = recv(ep->sock_fd, buffer, count, sock_flags);
+  if (bytes_read == 0) {
+    TRACE_LIB_ERROR(ep->lib_handle, -ECONNRESET, "recv(%d) failed", ep->sock_fd);
+    SET_CPC_RET(-ECONNRESET);
+  } else if (bytes_read < 0) {
+    if (errno != EAGAIN) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "recv(%d) failed", ep->sock_fd);
+    }
+    SET_CPC_RET(-errno);
+  } else {
+    SET_CPC_RET(bytes_read);
+  }
+
+  if (bytes_read > 0) {
+    TRACE_LIB(ep->lib_handle, "read from EP #%d", ep->id);
+  }
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Attempt to read up to count bytes from a previously-opened endpoint socket.
+ * Once data is received, it will be copied to the user-provided buffer.
+ * The lifecycle of this buffer is handled by the user.
+ *
+ * By default the cpc_read function will block indefinitely.
+ * A timeout can be configured with cpc_set_endpoint_option.
+ ******************************************************************************/
+ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_endpoint_read_flags_t flags)
+{
+  if (buffer == NULL || count < SL_CPC_READ_MINIMUM_SIZE || endpoint.ptr == NULL) {
+    return -EINVAL;
+  }
+
+  return read_endpoint((sli_cpc_endpoint_t *)endpoint.ptr, buffer, count, NULL, flags);
+}
+
+/***************************************************************************//**
+ * Read a message without a buffer of the caller. It is lent in place from the
+ * shared memory ring when it can be, copied to a buffer of the endpoint
+ * otherwise, and stays valid until cpc_release_buffer().
+ ******************************************************************************/
+ssize_t cpc_read_endpoint_zc(cpc_endpoint_t endpoint, const void **buffer, cpc_endpoint_read_flags_t flags)
+{
+  INIT_CPC_RET(ssize_t);
+  const void *view = NULL;
+  ssize_t bytes_read;
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (buffer == NULL || endpoint.ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  if (__atomic_exchange_n(&ep->zc_lent, true, __ATOMIC_ACQUIRE)) {
+    TRACE_LIB_ERROR(ep->lib_handle, -EBUSY, "EP #%d has a buffer that wasn't released", ep->id);
+    SET_CPC_RET(-EBUSY);
+    RETURN_CPC_RET;
+  }
+
+  if (ep->zc_buffer == NULL) {
+    ep->zc_buffer = malloc(SL_CPC_READ_MINIMUM_SIZE);
+    if (ep->zc_buffer == NULL) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "alloc(%d) failed", SL_CPC_READ_MINIMUM_SIZE);
+      __atomic_store_n(&ep->zc_lent, false, __ATOMIC_RELEASE);
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+  }
+
+  bytes_read = read_endpoint(ep, ep->zc_buffer, SL_CPC_READ_MINIMUM_SIZE, &view, flags);
+  if (bytes_read <= 0) {
+    __atomic_store_n(&ep->zc_lent, false, __ATOMIC_RELEASE);
+    SET_CPC_RET(bytes_read);
+    RETURN_CPC_RET;
+  }
+
+  ep->zc_view = (view != NULL) ? view : ep->zc_buffer;
+  *buffer = ep->zc_view;
+
+  SET_CPC_RET(bytes_read);
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Give back the buffer of cpc_read_endpoint_zc(), a message lent from the
+ * shared memory ring is only then removed from it.
+ ******************************************************************************/
+int cpc_release_buffer(cpc_endpoint_t endpoint, const void *buffer)
+{
+  INIT_CPC_RET(int);
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (buffer == NULL || endpoint.ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  if (!__atomic_load_n(&ep->zc_lent, __ATOMIC_ACQUIRE) || buffer != ep->zc_view) {
+    TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "%p is not lent by EP #%d", buffer, ep->id);
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  if (ep->shm != NULL && buffer != ep->zc_buffer) {
+    pthread_mutex_lock(&ep->shm->rx_ring_lock);
+    shm_broadcast_release(ep->shm->rx_cursor, ep->shm->view_length);
+    ep->shm->view_length = 0;
+    pthread_mutex_unlock(&ep->shm->rx_ring_lock);
+  }
+
+  ep->zc_view = NULL;
+  __atomic_store_n(&ep->zc_lent, false, __ATOMIC_RELEASE);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Write data to an open endpoint.
+ ******************************************************************************/
+ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_endpoint_write_flags_t flags)
+{
+  INIT_CPC_RET(ssize_t);
+  int sock_flags = 0;
+  ssize_t bytes_written = 0;
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (endpoint.ptr == NULL || data == NULL || data_length == 0) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  if (data_length > get_endpoint_max_write_size(ep)) {
+    TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "payload too large (%d > %d)", data_length, get_endpoint_max_write_size(ep));
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  TRACE_LIB(ep->lib_handle, "writing to EP #%d", ep->id);
+
+  if (ep->shm != NULL) {
+    bytes_written = shm_write_endpoint(ep, data, data_length, (flags & CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING) || shm_is_non_blocking(ep));
+    if (bytes_written < 0) {
+      TRACE_LIB_ERROR(ep->lib_handle, (int)bytes_written, "shared memory write on EP #%d failed", ep->id);
+    } else {
+      TRACE_LIB(ep->lib_handle, "wrote to EP #%d", ep->id);
+    }
+    SET_CPC_RET(bytes_written);
+    RETURN_CPC_RET;
+  }
+
+  if (flags & CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING) {
+    sock_flags |= MSG_DONTWAIT;
+  }
+
+  bytes_written = send(ep->sock_fd, data, data_length, sock_flags);
+  if (bytes_written == -1) {
+    TRACE_LIB_ERRNO(ep->lib_handle, "send(%d) failed", ep->sock_fd);
+    SET_CPC_RET(-errno);
+    RETURN_CPC_RET;
+  } else {
+    SET_CPC_RET(bytes_written);
+  }
+
+  TRACE_LIB(ep->lib_handle, "wrote to EP #%d", ep->id);
+
+  /*
+   * The socket type between the library and the daemon are of type
+   * SOCK_SEQPACKET. Unlike stream sockets, it is technically impossible
+   * for DGRAM or SEQPACKET to do partial writes. The man page is ambiguous
+   * about the return value in the our case, but research showed that it should
+   * never happens. If it did happen,it would cause problems in
+   * dealing with partially sent messages.
+   */
+  assert((size_t)bytes_written == data_length);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Read several messages from an endpoint, waiting only for the first one
+ ******************************************************************************/
+int cpc_read_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_read_flags_t flags)
+{
+  INIT_CPC_RET(int);
+  struct mmsghdr mmsgs[ENDPOINT_BATCH_CHUNK];
+  struct iovec iovecs[ENDPOINT_BATCH_CHUNK];
+  sli_cpc_endpoint_t *ep = NULL;
+  int sock_flags = MSG_WAITFORONE;
+  size_t done = 0;
+
+  if (endpoint.ptr == NULL || msgs == NULL || count == 0 || count > INT_MAX) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (msgs[i].buffer == NULL || msgs[i].length < SL_CPC_READ_MINIMUM_SIZE) {
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+    msgs[i].status = 0;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  TRACE_LIB(ep->lib_handle, "reading up to %zu messages from EP #%d", count, ep->id);
+
+  if (ep->shm != NULL) {
+    bool non_blocking = (flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING) || shm_is_non_blocking(ep);
+
+    while (done < count) {
+      ssize_t bytes_read = shm_read_endpoint(ep, msgs[done].buffer, msgs[done].length, NULL, non_blocking);
+
+      if (bytes_read < 0) {
+        if (done == 0) {
+          if (bytes_read != -EAGAIN) {
+            TRACE_LIB_ERROR(ep->lib_handle, (int)bytes_read, "shared memory read on EP #%d failed", ep->id);
+          }
+          msgs[0].status = bytes_read;
+          SET_CPC_RET((int)bytes_read);
+        }
+        break;
+      }
+
+      msgs[done].status = bytes_read;
+      done++;
+
+      /* Only the first message is waited for */
+      non_blocking = true;
+    }
+  } else {
+    if (flags & CPC_ENDPOINT_READ_FLAG_NON_BLOCKING) {
+      sock_flags |= MSG_DONTWAIT;
+    }
+
+    while (done < count) {
+      size_t chunk = count - done;
+      int received;
+
+      if (chunk > ENDPOINT_BATCH_CHUNK) {
+        chunk = ENDPOINT_BATCH_CHUNK;
+      }
+
+      memset(mmsgs, 0, sizeof(mmsgs));
+      for (size_t i = 0; i < chunk; i++) {
+        iovecs[i].iov_base = msgs[done + i].buffer;
+        iovecs[i].iov_len = msgs[done + i].length;
+        mmsgs[i].msg_hdr.msg_iov = &iovecs[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      received = recvmmsg(ep->sock_fd, mmsgs, (unsigned int)chunk, sock_flags, NULL);
+      if (received < 0) {
+        if (done == 0) {
+          if (errno != EAGAIN) {
+            TRACE_LIB_ERRNO(ep->lib_handle, "recvmmsg(%d) failed", ep->sock_fd);
+          }
+          msgs[0].status = -errno;
+          SET_CPC_RET(-errno);
+        }
+        break;
+      }
+
+      for (int i = 0; i < received; i++) {
+        /* The daemon closed the socket, the messages before are still returned */
+        if (mmsgs[i].msg_len == 0) {
+          if (done == 0) {
+            TRACE_LIB_ERROR(ep->lib_handle, -ECONNRESET, "recvmmsg(%d) failed", ep->sock_fd);
+            msgs[0].status = -ECONNRESET;
+            SET_CPC_RET(-ECONNRESET);
+          }
+          count = done;
+          break;
+        }
+
+        msgs[done].status = (ssize_t)mmsgs[i].msg_len;
+        done++;
+      }
+
+      if ((size_t)received < chunk) {
+        break;
+      }
+
+      /* Only the first message is waited for, the next chunks take what is there */
+      sock_flags = MSG_DONTWAIT;
+    }
+  }
+
+  if (done > 0) {
+    TRACE_LIB(ep->lib_handle, "read %zu messages from EP #%d", done, ep->id);
+    SET_CPC_RET((int)done);
+  }
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Write several messages to an endpoint, in order, until one can't be written
+ ******************************************************************************/
+int cpc_write_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_write_flags_t flags)
+{
+  INIT_CPC_RET(int);
+  struct mmsghdr mmsgs[ENDPOINT_BATCH_CHUNK];
+  struct iovec iovecs[ENDPOINT_BATCH_CHUNK];
+  sli_cpc_endpoint_t *ep = NULL;
+  int sock_flags = 0;
+  size_t done = 0;
+
+  if (endpoint.ptr == NULL || msgs == NULL || count == 0 || count > INT_MAX) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  /* Nothing is written if any message is invalid */
+  for (size_t i = 0; i < count; i++) {
+    if (msgs[i].buffer == NULL || msgs[i].length == 0) {
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    if (msgs[i].length > get_endpoint_max_write_size(ep)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "payload too large (%d > %d)", msgs[i].length, get_endpoint_max_write_size(ep));
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    msgs[i].status = 0;
+  }
+
+  TRACE_LIB(ep->lib_handle, "writing %zu messages to EP #%d", count, ep->id);
+
+  if (ep->shm != NULL) {
+    bool non_blocking = (flags & CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING) || shm_is_non_blocking(ep);
+
+    while (done < count) {
+      ssize_t bytes_written = shm_write_endpoint(ep, msgs[done].buffer, msgs[done].length, non_blocking);
+
+      msgs[done].status = bytes_written;
+      if (bytes_written < 0) {
+        if (done == 0) {
+          TRACE_LIB_ERROR(ep->lib_handle, (int)bytes_written, "shared memory write on EP #%d failed", ep->id);
+          SET_CPC_RET((int)bytes_written);
+        }
+        break;
+      }
+
+      done++;
+    }
+  } else {
+    if (flags & CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING) {
+      sock_flags |= MSG_DONTWAIT;
+    }
+
+    while (done < count) {
+      size_t chunk = count - done;
+      int sent;
+
+      if (chunk > ENDPOINT_BATCH_CHUNK) {
+        chunk = ENDPOINT_BATCH_CHUNK;
+      }
+
+      memset(mmsgs, 0, sizeof(mmsgs));
+      for (size_t i = 0; i < chunk; i++) {
+        iovecs[i].iov_base = msgs[done + i].buffer;
+        iovecs[i].iov_len = msgs[done + i].length;
+        mmsgs[i].msg_hdr.msg_iov = &iovecs[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      sent = sendmmsg(ep->sock_fd, mmsgs, (unsigned int)chunk, sock_flags);
+      if (sent < 0) {
+        msgs[done].status = -errno;
+        if (done == 0) {
+          if (errno != EAGAIN) {
+            TRACE_LIB_ERRNO(ep->lib_handle, "sendmmsg(%d) failed", ep->sock_fd);
+          }
+          SET_CPC_RET(-errno);
+        }
+        break;
+      }
+
+      for (int i = 0; i < sent; i++) {
+        /* SOCK_SEQPACKET, like cpc_write_endpoint() a message is never partially written */
+        assert(mmsgs[i].msg_len == msgs[done].length);
+        msgs[done].status = (ssize_t)mmsgs[i].msg_len;
+        done++;
+      }
+
+      /* The error of the message that stopped the kernel is returned by the next call */
+      if ((size_t)sent < chunk) {
+        break;
+      }
+    }
+  }
+
+  if (done > 0) {
+    TRACE_LIB(ep->lib_handle, "wrote %zu messages to EP #%d", done, ep->id);
+    SET_CPC_RET((int)done);
+  }
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Get the state of an endpoint by ID.
+ ******************************************************************************/
+int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t *state)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+
+  if (state == NULL || handle.ptr == NULL || id == SL_CPC_ENDPOINT_SYSTEM) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+
+  if (read_state_table(lib_handle, id, state, NULL)) {
+    RETURN_CPC_RET;
+  }
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
   if (tmp_ret != 0) {
     TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
     SET_CPC_RET(-tmp_ret);
@@ -1117,13 +2584,219 @@ int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t
 /***************************************************************************//**
  * Configure an endpoint with a specified option.
  ******************************************************************************/
-int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen)
+int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_endpoint_t *ep = NULL;
+
+  if (option == CPC_OPTION_NONE || endpoint.ptr == NULL || optval == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+
+  if (option == CPC_OPTION_RX_TIMEOUT) {
+    cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
+    struct timeval sockopt;
+
+    if (optlen != sizeof(cpc_timeval_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    sockopt.tv_sec  = useropt->seconds;
+    sockopt.tv_usec = useropt->microseconds;
+
+    tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &sockopt, (socklen_t)sizeof(sockopt));
+    if (tmp_ret < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+      SET_CPC_RET(-errno);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_TX_TIMEOUT) {
+    cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
+    struct timeval sockopt;
+
+    if (optlen != sizeof(cpc_timeval_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    sockopt.tv_sec  = useropt->seconds;
+    sockopt.tv_usec = useropt->microseconds;
+
+    tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &sockopt, (socklen_t)sizeof(sockopt));
+    if (tmp_ret < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+      SET_CPC_RET(-errno);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_BLOCKING) {
+    if (optlen != sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type bool");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = pthread_mutex_lock(&ep->sock_fd_lock);
+    if (tmp_ret != 0) {
+      TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &ep->sock_fd_lock);
+      SET_CPC_RET(-tmp_ret);
+      RETURN_CPC_RET;
+    }
+
+    int flags = fcntl(ep->sock_fd, F_GETFL);
+    if (flags < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "fnctl(%d) failed", ep->sock_fd);
+      SET_CPC_RET(-errno);
+
+      tmp_ret = pthread_mutex_unlock(&ep->sock_fd_lock);
+      if (tmp_ret != 0) {
+        TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &ep->sock_fd_lock);
+        SET_CPC_RET(-tmp_ret);
+      }
+
+      RETURN_CPC_RET;
+    }
+
+    if (*(bool*)optval == true) {
+      flags &= ~O_NONBLOCK;
+    } else {
+      flags |= O_NONBLOCK;
+    }
+
+    tmp_ret = fcntl(ep->sock_fd, F_SETFL, flags);
+    if (tmp_ret < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "fnctl(%d) failed", ep->sock_fd);
+      SET_CPC_RET(-errno);
+    }
+
+    tmp_ret = pthread_mutex_unlock(&ep->sock_fd_lock);
+    if (tmp_ret != 0) {
+      TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &ep->sock_fd_lock);
+      SET_CPC_RET(-tmp_ret);
+    }
+
+    RETURN_CPC_RET;
+  } else if (option == CPC_OPTION_SOCKET_SIZE) {
+    if (optlen != sizeof(int)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type int");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    if (setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, optval, (socklen_t)optlen) != 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+      SET_CPC_RET(-errno);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_TX_PRIORITY) {
+    cpc_tx_priority_t priority;
+
+    if (optlen != sizeof(cpc_tx_priority_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_tx_priority_t");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    priority = *(const cpc_tx_priority_t *)optval;
+
+    if (priority.level >= CPC_TX_PRIORITY_LEVEL_COUNT || priority.weight == 0) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "invalid tx priority level %u or weight %u", priority.level, priority.weight);
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = set_endpoint_tx_priority(ep, &priority);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to set endpoint tx priority");
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_SHM_TRANSPORT) {
+    if (optlen != sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type bool");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    if (*(const bool *)optval == false) {
+      if (ep->shm != NULL) {
+        TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "shared memory transport cannot be disabled once enabled");
+        SET_CPC_RET(-EINVAL);
+      }
+      RETURN_CPC_RET;
+    }
+
+    if (ep->shm == NULL) {
+      tmp_ret = open_shm_transport(ep);
+      if (tmp_ret) {
+        TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to open shared memory transport");
+        SET_CPC_RET(tmp_ret);
+        RETURN_CPC_RET;
+      }
+    }
+  } else if (option == CPC_OPTION_FRAGMENTATION) {
+    if (optlen != sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type bool");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = set_endpoint_fragmentation(ep, *(const bool *)optval);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to set endpoint fragmentation");
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_AGGREGATION) {
+    if (optlen != sizeof(uint32_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type uint32_t");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = set_endpoint_aggregation(ep, *(const uint32_t *)optval);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to set endpoint aggregation");
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  } else if (option == CPC_OPTION_COMPRESSION) {
+    if (optlen != sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type bool");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = set_endpoint_compression(ep, *(const bool *)optval);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to set endpoint compression");
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+  } else {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Get the option configured for a specified endpoint.
+ ******************************************************************************/
+int cpc_get_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, void *optval, size_t *optlen)
 {
   INIT_CPC_RET(int);
   int tmp_ret = 0;
   sli_cpc_endpoint_t *ep = NULL;
 
-  if (option == CPC_OPTION_NONE || endpoint.ptr == NULL || optval == NULL) {
+  if (option == CPC_OPTION_NONE || endpoint.ptr == NULL || optval == NULL || optlen == NULL) {
     SET_CPC_RET(-EINVAL);
     RETURN_CPC_RET;
   }
@@ -1133,100 +2806,166 @@ int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const
   if (option == CPC_OPTION_RX_TIMEOUT) {
     cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
     struct timeval sockopt;
+    socklen_t socklen = sizeof(sockopt);
 
-    if (optlen != sizeof(cpc_timeval_t)) {
+    if (*optlen != sizeof(cpc_timeval_t)) {
       TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
       SET_CPC_RET(-EINVAL);
       RETURN_CPC_RET;
     }
 
-    sockopt.tv_sec  = useropt->seconds;
-    sockopt.tv_usec = useropt->microseconds;
-
-    tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &sockopt, (socklen_t)sizeof(sockopt));
+    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &sockopt, &socklen);
     if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
       SET_CPC_RET(-errno);
       RETURN_CPC_RET;
     }
+
+    // these values are "usually" of type long, so make sure they
+    // fit in integers (really, they should).
+    if (sockopt.tv_sec > INT_MAX || sockopt.tv_usec > INT_MAX) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "getsockopt returned value out of bound");
+      SET_CPC_RET(-EINVAL);
+      RETURN_CPC_RET;
+    }
+
+    useropt->seconds      = (int)sockopt.tv_sec;
+    useropt->microseconds = (int)sockopt.tv_usec;
   } else if (option == CPC_OPTION_TX_TIMEOUT) {
     cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
     struct timeval sockopt;
+    socklen_t socklen = sizeof(sockopt);
 
-    if (optlen != sizeof(cpc_timeval_t)) {
+    if (*optlen != sizeof(cpc_timeval_t)) {
       TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
       SET_CPC_RET(-EINVAL);
       RETURN_CPC_RET;
     }
 
-    sockopt.tv_sec  = useropt->seconds;
-    sockopt.tv_usec = useropt->microseconds;
-
-    tmp_ret = setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &sockopt, (socklen_t)sizeof(sockopt));
+    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &sockopt, &socklen);
     if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
+      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
       SET_CPC_RET(-errno);
       RETURN_CPC_RET;
     }
-  } else if (option == CPC_OPTION_BLOCKING) {
-    if (optlen != sizeof(bool)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type bool");
+
+    if (sockopt.tv_sec > INT_MAX || sockopt.tv_usec > INT_MAX) {
+      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "getsockopt returned value out of bound");
       SET_CPC_RET(-EINVAL);
       RETURN_CPC_RET;
     }
 
-    tmp_ret = pthread_mutex_lock(&ep->sock_fd_lock);
-    if (tmp_ret != 0) {
-      TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &ep->sock_fd_lock);
-      SET_CPC_RET(-tmp_ret);
+    useropt->seconds      = (int)sockopt.tv_sec;
+    useropt->microseconds = (int)sockopt.tv_usec;
+  } else if (option == CPC_OPTION_BLOCKING) {
+    if (*optlen < sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
       RETURN_CPC_RET;
     }
 
+    *optlen = sizeof(bool);
+
     int flags = fcntl(ep->sock_fd, F_GETFL);
     if (flags < 0) {
       TRACE_LIB_ERRNO(ep->lib_handle, "fnctl(%d) failed", ep->sock_fd);
       SET_CPC_RET(-errno);
-
-      tmp_ret = pthread_mutex_unlock(&ep->sock_fd_lock);
-      if (tmp_ret != 0) {
-        TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &ep->sock_fd_lock);
-        SET_CPC_RET(-tmp_ret);
-      }
-
       RETURN_CPC_RET;
     }
 
-    if (*(bool*)optval == true) {
-      flags &= ~O_NONBLOCK;
+    if (flags & O_NONBLOCK) {
+      *(bool *)optval = false;
     } else {
-      flags |= O_NONBLOCK;
+      *(bool *)optval = true;
     }
+  } else if (option == CPC_OPTION_SOCKET_SIZE) {
+    socklen_t socklen = (socklen_t)*optlen;
 
-    tmp_ret = fcntl(ep->sock_fd, F_SETFL, flags);
+    if (*optlen < sizeof(int)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, optval, &socklen);
     if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "fnctl(%d) failed", ep->sock_fd);
+      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
       SET_CPC_RET(-errno);
+      RETURN_CPC_RET;
     }
 
-    tmp_ret = pthread_mutex_unlock(&ep->sock_fd_lock);
-    if (tmp_ret != 0) {
-      TRACE_LIB_ERROR(ep->lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &ep->sock_fd_lock);
-      SET_CPC_RET(-tmp_ret);
+    *optlen = (size_t)socklen;
+  } else if (option == CPC_OPTION_MAX_WRITE_SIZE) {
+    size_t max_write_size = get_endpoint_max_write_size(ep);
+
+    *optlen = sizeof(size_t);
+    memcpy(optval, &max_write_size, sizeof(max_write_size));
+  } else if (option == CPC_OPTION_ENCRYPTED) {
+    if (*optlen < sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
     }
 
-    RETURN_CPC_RET;
-  } else if (option == CPC_OPTION_SOCKET_SIZE) {
-    if (optlen != sizeof(int)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type int");
-      SET_CPC_RET(-EINVAL);
+    tmp_ret = get_endpoint_encryption(ep, (bool*)optval);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to query endpoint encryption state");
+      SET_CPC_RET(tmp_ret);
       RETURN_CPC_RET;
     }
 
-    if (setsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, optval, (socklen_t)optlen) != 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "setsockopt(%d) failed", ep->sock_fd);
-      SET_CPC_RET(-errno);
+    *optlen = sizeof(bool);
+  } else if (option == CPC_OPTION_SHM_TRANSPORT) {
+    if (*optlen < sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+
+    *(bool *)optval = (ep->shm != NULL);
+    *optlen = sizeof(bool);
+  } else if (option == CPC_OPTION_TX_CREDIT) {
+    if (*optlen < sizeof(uint32_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+
+    tmp_ret = get_endpoint_tx_credit(ep, (uint32_t*)optval);
+    if (tmp_ret) {
+      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to query endpoint tx credit");
+      SET_CPC_RET(tmp_ret);
+      RETURN_CPC_RET;
+    }
+
+    *optlen = sizeof(uint32_t);
+  } else if (option == CPC_OPTION_FRAGMENTATION) {
+    if (*optlen < sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+
+    *(bool *)optval = ep->fragmentation;
+    *optlen = sizeof(bool);
+  } else if (option == CPC_OPTION_AGGREGATION) {
+    if (*optlen < sizeof(uint32_t)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+
+    *(uint32_t *)optval = ep->aggregation_deadline_us;
+    *optlen = sizeof(uint32_t);
+  } else if (option == CPC_OPTION_COMPRESSION) {
+    if (*optlen < sizeof(bool)) {
+      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
+      SET_CPC_RET(-ENOMEM);
       RETURN_CPC_RET;
     }
+
+    *(bool *)optval = ep->compression;
+    *optlen = sizeof(bool);
   } else {
     SET_CPC_RET(-EINVAL);
     RETURN_CPC_RET;
@@ -1236,175 +2975,300 @@ int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const
 }
 
 /***************************************************************************//**
- * Get the option configured for a specified endpoint.
+ * Get the library version
  ******************************************************************************/
-int cpc_get_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, void *optval, size_t *optlen)
+const char* cpc_get_library_version(void)
 {
-  INIT_CPC_RET(int);
+  return PROJECT_VER;
+}
+
+/***************************************************************************//**
+ * Get the secondary application version
+ ******************************************************************************/
+const char* cpc_get_secondary_app_version(cpc_handle_t handle)
+{
+  sli_cpc_handle_t *lib_handle = NULL;
+  char *secondary_app_version = NULL;
+  size_t secondary_app_version_len = 0;
+
+  if (handle.ptr == NULL) {
+    return secondary_app_version;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+
+  if (lib_handle->secondary_app_version == NULL) {
+    return secondary_app_version;
+  }
+
+  secondary_app_version_len = strlen(lib_handle->secondary_app_version);
+  secondary_app_version = zalloc(secondary_app_version_len);
+  if (secondary_app_version == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", secondary_app_version_len);
+  } else {
+    memcpy(secondary_app_version, lib_handle->secondary_app_version, secondary_app_version_len);
+  }
+
+  return secondary_app_version;
+}
+
+/***************************************************************************//**
+ * Get a snapshot of the metrics of the daemon
+ ******************************************************************************/
+ssize_t cpc_get_metrics(cpc_handle_t handle, cpc_metrics_format_t format, char *buffer, size_t size)
+{
+  INIT_CPC_RET(ssize_t);
   int tmp_ret = 0;
-  sli_cpc_endpoint_t *ep = NULL;
+  sli_cpc_handle_t *lib_handle = NULL;
+  cpcd_exchange_metrics_t *metrics = NULL;
+  const size_t metrics_len = sizeof(cpcd_exchange_metrics_t) + size;
 
-  if (option == CPC_OPTION_NONE || endpoint.ptr == NULL || optval == NULL || optlen == NULL) {
+  if (handle.ptr == NULL || (buffer == NULL && size != 0)) {
     SET_CPC_RET(-EINVAL);
     RETURN_CPC_RET;
   }
 
-  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+  if (format != CPC_METRICS_FORMAT_JSON && format != CPC_METRICS_FORMAT_PROMETHEUS) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
 
-  if (option == CPC_OPTION_RX_TIMEOUT) {
-    cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
-    struct timeval sockopt;
-    socklen_t socklen = sizeof(sockopt);
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
 
-    if (*optlen != sizeof(cpc_timeval_t)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
-      SET_CPC_RET(-EINVAL);
-      RETURN_CPC_RET;
-    }
+  metrics = zalloc(metrics_len);
+  if (metrics == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", metrics_len);
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
 
-    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &sockopt, &socklen);
-    if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
-      SET_CPC_RET(-errno);
-      RETURN_CPC_RET;
+  metrics->format = (uint32_t)format;
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    goto free_metrics;
+  }
+
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_METRICS_QUERY, 0,
+                               (void*)metrics, metrics_len);
+
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange metrics query");
+    SET_CPC_RET(tmp_ret);
+  }
+
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+  }
+
+  if (__cpc_ret == 0) {
+    if (size != 0) {
+      memcpy(buffer, metrics->text, size);
+      buffer[size - 1] = '\0';
     }
+    SET_CPC_RET((ssize_t)metrics->length);
+  }
+
+  free_metrics:
+  free(metrics);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Write the flight recorder of the daemon to its traces folder
+ ******************************************************************************/
+int cpc_dump_flight_recorder(cpc_handle_t handle, char *path, size_t size)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+  cpcd_exchange_flight_recorder_t *flight_recorder = NULL;
+  const size_t flight_recorder_len = sizeof(cpcd_exchange_flight_recorder_t) + size;
+
+  if (handle.ptr == NULL || (path == NULL && size != 0)) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
+
+  flight_recorder = zalloc(flight_recorder_len);
+  if (flight_recorder == NULL) {
+    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", flight_recorder_len);
+    SET_CPC_RET(-ENOMEM);
+    RETURN_CPC_RET;
+  }
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    goto free_flight_recorder;
+  }
+
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_FLIGHT_RECORDER_QUERY, 0,
+                               (void*)flight_recorder, flight_recorder_len);
 
-    // these values are "usually" of type long, so make sure they
-    // fit in integers (really, they should).
-    if (sockopt.tv_sec > INT_MAX || sockopt.tv_usec > INT_MAX) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "getsockopt returned value out of bound");
-      SET_CPC_RET(-EINVAL);
-      RETURN_CPC_RET;
-    }
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange flight recorder query");
+    SET_CPC_RET(tmp_ret);
+  }
 
-    useropt->seconds      = (int)sockopt.tv_sec;
-    useropt->microseconds = (int)sockopt.tv_usec;
-  } else if (option == CPC_OPTION_TX_TIMEOUT) {
-    cpc_timeval_t *useropt = (cpc_timeval_t*)optval;
-    struct timeval sockopt;
-    socklen_t socklen = sizeof(sockopt);
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+  }
 
-    if (*optlen != sizeof(cpc_timeval_t)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "optval must be of type cpc_timeval_t");
-      SET_CPC_RET(-EINVAL);
-      RETURN_CPC_RET;
+  if (__cpc_ret == 0) {
+    if (size != 0) {
+      memcpy(path, flight_recorder->path, size);
+      path[size - 1] = '\0';
     }
+    SET_CPC_RET(flight_recorder->status);
+  }
 
-    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &sockopt, &socklen);
-    if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
-      SET_CPC_RET(-errno);
-      RETURN_CPC_RET;
-    }
+  free_flight_recorder:
+  free(flight_recorder);
 
-    if (sockopt.tv_sec > INT_MAX || sockopt.tv_usec > INT_MAX) {
-      TRACE_LIB_ERROR(ep->lib_handle, -EINVAL, "getsockopt returned value out of bound");
-      SET_CPC_RET(-EINVAL);
-      RETURN_CPC_RET;
-    }
+  RETURN_CPC_RET;
+}
 
-    useropt->seconds      = (int)sockopt.tv_sec;
-    useropt->microseconds = (int)sockopt.tv_usec;
-  } else if (option == CPC_OPTION_BLOCKING) {
-    if (*optlen < sizeof(bool)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
-      SET_CPC_RET(-ENOMEM);
-      RETURN_CPC_RET;
-    }
+static int cpc_trace_mask_exchange(cpc_handle_t handle, cpc_trace_level_t level, bool set, uint32_t *mask)
+{
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
+  sli_cpc_handle_t *lib_handle = NULL;
+  cpcd_exchange_trace_mask_t trace_mask = { 0 };
 
-    *optlen = sizeof(bool);
+  if (handle.ptr == NULL || mask == NULL || level >= CPC_TRACE_LEVEL_COUNT) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
 
-    int flags = fcntl(ep->sock_fd, F_GETFL);
-    if (flags < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "fnctl(%d) failed", ep->sock_fd);
-      SET_CPC_RET(-errno);
-      RETURN_CPC_RET;
-    }
+  lib_handle = (sli_cpc_handle_t *)handle.ptr;
 
-    if (flags & O_NONBLOCK) {
-      *(bool *)optval = false;
-    } else {
-      *(bool *)optval = true;
-    }
-  } else if (option == CPC_OPTION_SOCKET_SIZE) {
-    socklen_t socklen = (socklen_t)*optlen;
+  trace_mask.level = (uint8_t)level;
+  trace_mask.set = set;
+  trace_mask.mask = *mask;
 
-    if (*optlen < sizeof(int)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
-      SET_CPC_RET(-ENOMEM);
-      RETURN_CPC_RET;
-    }
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
+  }
 
-    tmp_ret = getsockopt(ep->sock_fd, SOL_SOCKET, SO_SNDBUF, optval, &socklen);
-    if (tmp_ret < 0) {
-      TRACE_LIB_ERRNO(ep->lib_handle, "getsockopt(%d) failed", ep->sock_fd);
-      SET_CPC_RET(-errno);
-      RETURN_CPC_RET;
-    }
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_TRACE_MASK_QUERY, 0,
+                               (void*)&trace_mask, sizeof(trace_mask));
 
-    *optlen = (size_t)socklen;
-  } else if (option == CPC_OPTION_MAX_WRITE_SIZE) {
-    *optlen = sizeof(size_t);
-    memcpy(optval, &ep->lib_handle->max_write_size, sizeof(ep->lib_handle->max_write_size));
-  } else if (option == CPC_OPTION_ENCRYPTED) {
-    if (*optlen < sizeof(bool)) {
-      TRACE_LIB_ERROR(ep->lib_handle, -ENOMEM, "insufficient space to store option value");
-      SET_CPC_RET(-ENOMEM);
-      RETURN_CPC_RET;
-    }
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange trace mask query");
+    SET_CPC_RET(tmp_ret);
+  }
 
-    tmp_ret = get_endpoint_encryption(ep, (bool*)optval);
-    if (tmp_ret) {
-      TRACE_LIB_ERROR(ep->lib_handle, tmp_ret, "failed to query endpoint encryption state");
-      SET_CPC_RET(tmp_ret);
-      RETURN_CPC_RET;
-    }
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+  }
 
-    *optlen = sizeof(bool);
-  } else {
-    SET_CPC_RET(-EINVAL);
-    RETURN_CPC_RET;
+  if (__cpc_ret == 0) {
+    *mask = trace_mask.mask;
   }
 
   RETURN_CPC_RET;
 }
 
 /***************************************************************************//**
- * Get the library version
+ * Get the trace mask of the daemon for a level
  ******************************************************************************/
-const char* cpc_get_library_version(void)
+int cpc_get_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t *mask)
 {
-  return PROJECT_VER;
+  return cpc_trace_mask_exchange(handle, level, false, mask);
 }
 
 /***************************************************************************//**
- * Get the secondary application version
+ * Set the trace mask of the daemon for a level
  ******************************************************************************/
-const char* cpc_get_secondary_app_version(cpc_handle_t handle)
+int cpc_set_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t mask)
+{
+  return cpc_trace_mask_exchange(handle, level, true, &mask);
+}
+
+static int cpc_protocol_parameter_exchange(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, bool set, uint32_t *value)
 {
+  INIT_CPC_RET(int);
+  int tmp_ret = 0;
   sli_cpc_handle_t *lib_handle = NULL;
-  char *secondary_app_version = NULL;
-  size_t secondary_app_version_len = 0;
+  cpcd_exchange_protocol_parameter_t protocol_parameter = { 0 };
 
-  if (handle.ptr == NULL) {
-    return secondary_app_version;
+  if (handle.ptr == NULL || value == NULL || parameter >= CPC_PROTOCOL_PARAMETER_COUNT) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
   }
 
   lib_handle = (sli_cpc_handle_t *)handle.ptr;
 
-  if (lib_handle->secondary_app_version == NULL) {
-    return secondary_app_version;
+  protocol_parameter.parameter = (uint8_t)parameter;
+  protocol_parameter.set = set;
+  protocol_parameter.value = *value;
+
+  tmp_ret = pthread_mutex_lock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_lock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+    RETURN_CPC_RET;
   }
 
-  secondary_app_version_len = strlen(lib_handle->secondary_app_version);
-  secondary_app_version = zalloc(secondary_app_version_len);
-  if (secondary_app_version == NULL) {
-    TRACE_LIB_ERROR(lib_handle, -ENOMEM, "alloc(%d) failed", secondary_app_version_len);
-  } else {
-    memcpy(secondary_app_version, lib_handle->secondary_app_version, secondary_app_version_len);
+  tmp_ret = cpc_query_exchange(lib_handle, lib_handle->ctrl_sock_fd,
+                               EXCHANGE_PROTOCOL_PARAMETER_QUERY, endpoint_id,
+                               (void*)&protocol_parameter, sizeof(protocol_parameter));
+
+  if (tmp_ret) {
+    TRACE_LIB_ERROR(lib_handle, tmp_ret, "failed to exchange protocol parameter query");
+    SET_CPC_RET(tmp_ret);
   }
 
-  return secondary_app_version;
+  tmp_ret = pthread_mutex_unlock(&lib_handle->ctrl_sock_fd_lock);
+  if (tmp_ret != 0) {
+    TRACE_LIB_ERROR(lib_handle, -tmp_ret, "pthread_mutex_unlock(%p) failed", &lib_handle->ctrl_sock_fd_lock);
+    SET_CPC_RET(-tmp_ret);
+  }
+
+  if (__cpc_ret == 0) {
+    if (protocol_parameter.status == 0) {
+      *value = protocol_parameter.value;
+    } else {
+      SET_CPC_RET(protocol_parameter.status);
+    }
+  }
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Get a protocol parameter of the daemon, or of one of its endpoints
+ ******************************************************************************/
+int cpc_get_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t *value)
+{
+  return cpc_protocol_parameter_exchange(handle, endpoint_id, parameter, false, value);
+}
+
+/***************************************************************************//**
+ * Set a protocol parameter of the daemon, or of one of its endpoints
+ ******************************************************************************/
+int cpc_set_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t value)
+{
+  return cpc_protocol_parameter_exchange(handle, endpoint_id, parameter, true, &value);
 }
 
 /***************************************************************************//**
@@ -1768,6 +3632,202 @@ int cpc_deinit_endpoint_event(cpc_endpoint_event_handle_t *event_handle)
   RETURN_CPC_RET;
 }
 
+/***************************************************************************//**
+ * Get the file descriptor an application polls for the endpoint to be readable.
+ * With the shared memory transport, it is an epoll of the rx doorbell and of
+ * the socket, created on first use.
+ ******************************************************************************/
+int cpc_get_endpoint_fd(cpc_endpoint_t endpoint)
+{
+  INIT_CPC_RET(int);
+  sli_cpc_endpoint_t *ep = NULL;
+  sli_cpc_shm_transport_t *shm = NULL;
+  struct epoll_event event = { 0 };
+  int poll_fd;
+
+  if (endpoint.ptr == NULL) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  ep = (sli_cpc_endpoint_t *)endpoint.ptr;
+  shm = ep->shm;
+
+  if (shm == NULL) {
+    SET_CPC_RET(ep->sock_fd);
+    RETURN_CPC_RET;
+  }
+
+  pthread_mutex_lock(&shm->rx_ring_lock);
+
+  if (shm->poll_fd == -1) {
+    poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poll_fd < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "epoll_create1() failed");
+      SET_CPC_RET(-errno);
+      goto unlock;
+    }
+
+    event.events = EPOLLIN;
+    if (epoll_ctl(poll_fd, EPOLL_CTL_ADD, shm->fds[SHM_TRANSPORT_FD_RX_DOORBELL], &event) < 0
+        || epoll_ctl(poll_fd, EPOLL_CTL_ADD, ep->sock_fd, &event) < 0) {
+      TRACE_LIB_ERRNO(ep->lib_handle, "epoll_ctl(%d) failed", poll_fd);
+      SET_CPC_RET(-errno);
+      close(poll_fd);
+      goto unlock;
+    }
+
+    shm->poll_fd = poll_fd;
+  }
+
+  SET_CPC_RET(shm->poll_fd);
+
+  unlock:
+  pthread_mutex_unlock(&shm->rx_ring_lock);
+
+  RETURN_CPC_RET;
+}
+
+/***************************************************************************//**
+ * Get the file descriptor an application polls for an endpoint event.
+ ******************************************************************************/
+int cpc_get_endpoint_event_fd(cpc_endpoint_event_handle_t event_handle)
+{
+  sli_cpc_endpoint_event_handle_t *evt = NULL;
+
+  if (event_handle.ptr == NULL) {
+    return -EINVAL;
+  }
+
+  evt = (sli_cpc_endpoint_event_handle_t *)event_handle.ptr;
+
+  return evt->sock_fd;
+}
+
+/* True if a read of the endpoint returns without waiting for its doorbell */
+static bool shm_has_pending_read(sli_cpc_endpoint_t *ep)
+{
+  bool pending;
+
+  pthread_mutex_lock(&ep->shm->rx_ring_lock);
+  pending = !ep->shm->sock_fd_drained || ep->shm->view_length != 0 || !shm_broadcast_is_empty(&ep->shm->rx_ring, ep->shm->rx_cursor);
+  pthread_mutex_unlock(&ep->shm->rx_ring_lock);
+
+  return pending;
+}
+
+/***************************************************************************//**
+ * Wait for events on several endpoints and endpoint event handles, with one
+ * poll(). Each item takes two entries: its socket, and its rx doorbell when
+ * the endpoint uses the shared memory transport.
+ ******************************************************************************/
+int cpc_wait(cpc_wait_item_t *items, size_t count, int timeout_ms)
+{
+  INIT_CPC_RET(int);
+  struct pollfd fds_on_stack[2 * WAIT_ITEMS_ON_STACK];
+  struct pollfd *fds = fds_on_stack;
+  int ready = 0;
+  int ret;
+
+  if (items == NULL || count == 0 || count > INT_MAX / 2) {
+    SET_CPC_RET(-EINVAL);
+    RETURN_CPC_RET;
+  }
+
+  if (count > WAIT_ITEMS_ON_STACK) {
+    fds = malloc(2 * count * sizeof(struct pollfd));
+    if (fds == NULL) {
+      SET_CPC_RET(-ENOMEM);
+      RETURN_CPC_RET;
+    }
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    struct pollfd *sock = &fds[2 * i];
+    struct pollfd *doorbell = &fds[2 * i + 1];
+
+    items[i].revents = CPC_WAIT_EVENT_NONE;
+    sock->events = 0;
+    doorbell->fd = -1;
+    doorbell->events = 0;
+
+    if (items[i].endpoint.ptr != NULL) {
+      sli_cpc_endpoint_t *ep = (sli_cpc_endpoint_t *)items[i].endpoint.ptr;
+
+      sock->fd = ep->sock_fd;
+
+      if (ep->shm == NULL) {
+        if (items[i].events & CPC_WAIT_EVENT_READABLE) {
+          sock->events |= POLLIN;
+        }
+        if (items[i].events & CPC_WAIT_EVENT_WRITABLE) {
+          sock->events |= POLLOUT;
+        }
+      } else {
+        /* The socket only carries the close and the frames sent before the switch */
+        if (items[i].events & CPC_WAIT_EVENT_READABLE) {
+          sock->events |= POLLIN;
+          doorbell->fd = ep->shm->fds[SHM_TRANSPORT_FD_RX_DOORBELL];
+          doorbell->events = POLLIN;
+          if (shm_has_pending_read(ep)) {
+            items[i].revents |= CPC_WAIT_EVENT_READABLE;
+          }
+        }
+        if (items[i].events & CPC_WAIT_EVENT_WRITABLE) {
+          items[i].revents |= CPC_WAIT_EVENT_WRITABLE;
+        }
+      }
+    } else if (items[i].event_handle.ptr != NULL) {
+      sli_cpc_endpoint_event_handle_t *evt = (sli_cpc_endpoint_event_handle_t *)items[i].event_handle.ptr;
+
+      sock->fd = evt->sock_fd;
+      if (items[i].events & CPC_WAIT_EVENT_READABLE) {
+        sock->events |= POLLIN;
+      }
+    } else {
+      SET_CPC_RET(-EINVAL);
+      goto free_fds;
+    }
+
+    if (items[i].revents != CPC_WAIT_EVENT_NONE) {
+      timeout_ms = 0;
+    }
+  }
+
+  ret = poll(fds, (nfds_t)(2 * count), timeout_ms);
+  if (ret < 0) {
+    SET_CPC_RET(-errno);
+    goto free_fds;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    short revents = (short)(fds[2 * i].revents | fds[2 * i + 1].revents);
+
+    if (revents & POLLIN) {
+      items[i].revents |= CPC_WAIT_EVENT_READABLE;
+    }
+    if (revents & POLLOUT) {
+      items[i].revents |= CPC_WAIT_EVENT_WRITABLE;
+    }
+    if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+      items[i].revents |= CPC_WAIT_EVENT_HANGUP;
+    }
+
+    if (items[i].revents != CPC_WAIT_EVENT_NONE) {
+      ready++;
+    }
+  }
+
+  SET_CPC_RET(ready);
+
+  free_fds:
+  if (fds != fds_on_stack) {
+    free(fds);
+  }
+
+  RETURN_CPC_RET;
+}
+
 /***************************************************************************//**
  * Get the option configured for a specified endpoint event handle
  ******************************************************************************/
@@ -163,6 +163,12 @@ extern "C"
 
 #define SL_CPC_READ_MINIMUM_SIZE 4087
 
+#define SL_CPC_TX_WINDOW_SIZE_MAX 7 ///< Largest transmit window of an endpoint, the sequence numbers are 3 bits wide
+
+#define CPC_TX_PRIORITY_LEVEL_COUNT    4 ///< Number of transmit priority levels, 0 is the highest
+#define CPC_TX_PRIORITY_LEVEL_DEFAULT  2 ///< Transmit priority level of user endpoints when opened
+#define CPC_TX_PRIORITY_WEIGHT_DEFAULT 1 ///< Round robin weight of user endpoints when opened
+
 /// @brief Enumeration representing the possible endpoint state.
 SL_ENUM(cpc_endpoint_state_t){
   SL_CPC_STATE_OPEN = 0,                      ///< State open
@@ -191,6 +197,14 @@ SL_ENUM(cpc_endpoint_event_flags_t){
   CPC_ENDPOINT_EVENT_FLAG_NON_BLOCKING = (1 << 0)   ///< Set this transaction as non-blocking
 };
 
+/// @brief Enumeration representing the events of cpc_wait().
+SL_ENUM(cpc_wait_events_t){
+  CPC_WAIT_EVENT_NONE = 0,                          ///< No event
+  CPC_WAIT_EVENT_READABLE = (1 << 0),               ///< A read can be done without blocking
+  CPC_WAIT_EVENT_WRITABLE = (1 << 1),               ///< A write can be done without blocking
+  CPC_WAIT_EVENT_HANGUP = (1 << 2)                  ///< The daemon closed the connection, always reported
+};
+
 /// @brief Enumeration representing the possible configurable options for an endpoint.
 SL_ENUM(cpc_option_t){
   CPC_OPTION_NONE = 0,        ///< Option none
@@ -199,7 +213,13 @@ SL_ENUM(cpc_option_t){
   CPC_OPTION_TX_TIMEOUT,      ///< Option write timeout
   CPC_OPTION_SOCKET_SIZE,     ///< Option socket size
   CPC_OPTION_MAX_WRITE_SIZE,  ///< Option maximum socket write size
-  CPC_OPTION_ENCRYPTED        ///< Option encryption state
+  CPC_OPTION_ENCRYPTED,       ///< Option encryption state
+  CPC_OPTION_TX_PRIORITY,     ///< Option transmit priority
+  CPC_OPTION_SHM_TRANSPORT,   ///< Option shared memory transport
+  CPC_OPTION_TX_CREDIT,       ///< Option transmit credit
+  CPC_OPTION_FRAGMENTATION,   ///< Option fragmentation of large writes
+  CPC_OPTION_AGGREGATION,     ///< Option aggregation of small writes
+  CPC_OPTION_COMPRESSION      ///< Option compression of the payloads
 };
 
 /// @brief Enumeration representing the possible configurable options for an endpoint event handler.
@@ -226,7 +246,8 @@ SL_ENUM(sl_cpc_service_endpoint_id_t){
   SL_CPC_ENDPOINT_15_4 = 12,                   ///< 802.15.4 endpoint
   SL_CPC_ENDPOINT_CLI = 13,                    ///< Ascii based CLI for stacks / applications
   SL_CPC_ENDPOINT_BLUETOOTH_RCP = 14,          ///< Bluetooth RCP endpoint
-  SL_CPC_ENDPOINT_ACP = 15                     ///< ACP endpoint
+  SL_CPC_ENDPOINT_ACP = 15,                    ///< ACP endpoint
+  SL_CPC_ENDPOINT_FIRMWARE_UPDATE = 16         ///< Firmware image upload, while the application runs
 };
 
 /// @brief Enumeration representing user endpoint.
@@ -252,6 +273,50 @@ SL_ENUM(cpc_event_type_t){
   SL_CPC_EVENT_ENDPOINT_ERROR_DESTINATION_UNREACHABLE = 4,
   SL_CPC_EVENT_ENDPOINT_ERROR_SECURITY_INCIDENT = 5,
   SL_CPC_EVENT_ENDPOINT_ERROR_FAULT = 6,
+  SL_CPC_EVENT_ENDPOINT_TX_CREDIT = 7,
+};
+
+/// @brief Enumeration representing the formats of the metrics snapshot of CPCd.
+SL_ENUM(cpc_metrics_format_t){
+  CPC_METRICS_FORMAT_JSON = 0,      ///< JSON object, with the version of the snapshot
+  CPC_METRICS_FORMAT_PROMETHEUS = 1 ///< Prometheus text exposition format
+};
+
+/// @brief Enumeration representing the subsystems of CPCd traces, bit i of a trace mask
+///        enables the subsystem of value i.
+SL_ENUM(cpc_trace_subsystem_t){
+  CPC_TRACE_SUBSYSTEM_MISC = 0,         ///< Traces of no particular subsystem, the stats for instance
+  CPC_TRACE_SUBSYSTEM_CORE = 1,
+  CPC_TRACE_SUBSYSTEM_DRIVER = 2,
+  CPC_TRACE_SUBSYSTEM_SERVER = 3,
+  CPC_TRACE_SUBSYSTEM_SECURITY = 4,
+  CPC_TRACE_SUBSYSTEM_SYSTEM = 5,
+  CPC_TRACE_SUBSYSTEM_RESET = 6,
+  CPC_TRACE_SUBSYSTEM_GPIO = 7,
+  CPC_TRACE_SUBSYSTEM_XMODEM = 8,
+  CPC_TRACE_SUBSYSTEM_EZSP_SPI = 9,
+  CPC_TRACE_SUBSYSTEM_UART_VALIDATION = 10,
+  CPC_TRACE_SUBSYSTEM_LIB = 11,
+  CPC_TRACE_SUBSYSTEM_FIRMWARE_UPLOAD = 12,
+  CPC_TRACE_SUBSYSTEM_COUNT
+};
+
+/// @brief Enumeration representing the levels of CPCd traces, each has its own trace mask.
+SL_ENUM(cpc_trace_level_t){
+  CPC_TRACE_LEVEL_DEBUG = 0,            ///< Regular traces
+  CPC_TRACE_LEVEL_FRAME = 1,            ///< Hex dumps of the frames, also subject to enable_frame_trace
+  CPC_TRACE_LEVEL_COUNT
+};
+
+/// @brief Enumeration representing the protocol parameters of CPCd that can be tuned at runtime.
+SL_ENUM(cpc_protocol_parameter_t){
+  CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS = 0, ///< Lower bound of the re-transmit timeout, daemon-wide or per endpoint
+  CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS = 1, ///< Upper bound of the re-transmit timeout, daemon-wide or per endpoint
+  CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_MAX_COUNT = 2,      ///< Re-transmissions of a frame before its endpoint is in error, daemon-wide or per endpoint
+  CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE = 3,             ///< Largest tx window of the endpoints opened from now on, daemon-wide
+  CPC_PROTOCOL_PARAMETER_KEEP_ALIVE_INTERVAL_MS = 4,     ///< Idle time of the link before a no-op keep alive, daemon-wide
+  CPC_PROTOCOL_PARAMETER_STATS_INTERVAL_S = 5,           ///< Period of the statistics, daemon-wide
+  CPC_PROTOCOL_PARAMETER_COUNT
 };
 
 /// @brief Struct representing a CPC library handle.
@@ -269,12 +334,38 @@ typedef struct {
   void *ptr; ///< void pointer.
 } cpc_endpoint_event_handle_t;
 
+/// @brief Struct representing an open of an endpoint in progress.
+typedef struct {
+  void *ptr; ///< void pointer.
+} cpc_endpoint_open_handle_t;
+
 /// @brief Struct for configuring time options of endpoints
 typedef struct {
   int seconds;      ///< Number of seconds
   int microseconds; ///< Number of microseconds
 } cpc_timeval_t;
 
+/// @brief Struct for configuring the transmit priority of endpoints
+typedef struct {
+  uint8_t level;  ///< Strict priority level, from 0 (highest) to CPC_TX_PRIORITY_LEVEL_COUNT - 1
+  uint8_t weight; ///< Share of the frames sent in round robin between endpoints of the same level, at least 1
+} cpc_tx_priority_t;
+
+/// @brief Struct representing one message of a batch read or write on an endpoint.
+typedef struct {
+  void *buffer;   ///< The data to write, or where to read a message
+  size_t length;  ///< The length of the data to write, or the size of buffer
+  ssize_t status; ///< Set by the call: the bytes written or read, a negative value of errno, or 0 if not processed
+} cpc_endpoint_msg_t;
+
+/// @brief Struct representing an endpoint, or an endpoint event handle, waited for by cpc_wait().
+typedef struct {
+  cpc_endpoint_t endpoint;                  ///< The endpoint, or { NULL } to wait for event_handle
+  cpc_endpoint_event_handle_t event_handle; ///< The endpoint event handle, used if endpoint is { NULL }
+  cpc_wait_events_t events;                 ///< The events to wait for
+  cpc_wait_events_t revents;                ///< Set by cpc_wait() to the events that occurred
+} cpc_wait_item_t;
+
 /// @brief Struct representing a CPC asynchronous event flag.
 typedef uint8_t cpc_events_flags_t;
 
@@ -333,13 +424,58 @@ int cpc_restart(cpc_handle_t *handle);
  * @param[in]  handle           CPC library handle
  * @param[out] endpoint         CPC endpoint handle to open
  * @param[in]  id               CPC endpoint id to open
- * @param[in]  tx_window_size   CPC transmit window (only a window of 1 is supported at the moment)
+ * @param[in]  tx_window_size   CPC transmit window, from 1 to SL_CPC_TX_WINDOW_SIZE_MAX. The endpoint
+ *                              uses the window of the daemon, its tx_window_size or
+ *                              CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE, within what the secondary supports
  *
  * @return On error, a negative value of errno is returned.
  *         On success, the file descriptor of the socket is returned.
  ******************************************************************************/
 int cpc_open_endpoint(cpc_handle_t handle, cpc_endpoint_t *endpoint, uint8_t id, uint8_t tx_window_size);
 
+/***************************************************************************//**
+ * @brief Start opening an endpoint without waiting for the secondary.
+ *        The returned file descriptor becomes readable once the daemon has the
+ *        answer of the secondary, cpc_complete_open_endpoint() must then be called.
+ *        Several opens can be in progress at once, on the same endpoint or not.
+ *
+ * @param[in]  handle           CPC library handle
+ * @param[out] open_handle      Handle of the open in progress
+ * @param[in]  id               CPC endpoint id to open
+ * @param[in]  tx_window_size   CPC transmit window, from 1 to SL_CPC_TX_WINDOW_SIZE_MAX. The endpoint
+ *                              uses the window of the daemon, its tx_window_size or
+ *                              CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE, within what the secondary supports
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the file descriptor to poll for POLLIN is returned.
+ ******************************************************************************/
+int cpc_open_endpoint_async(cpc_handle_t handle, cpc_endpoint_open_handle_t *open_handle, uint8_t id, uint8_t tx_window_size);
+
+/***************************************************************************//**
+ * @brief Complete an open started with cpc_open_endpoint_async().
+ *        Unless -EINPROGRESS is returned, the open handle is freed, whether the
+ *        endpoint could be opened or not.
+ *
+ * @param[in]  open_handle      Handle of the open in progress
+ * @param[out] endpoint         CPC endpoint handle, as with cpc_open_endpoint()
+ *
+ * @return -EINPROGRESS if the daemon didn't answer yet.
+ *         On error, a negative value of errno is returned.
+ *         On success, the file descriptor of the socket is returned.
+ ******************************************************************************/
+int cpc_complete_open_endpoint(cpc_endpoint_open_handle_t *open_handle, cpc_endpoint_t *endpoint);
+
+/***************************************************************************//**
+ * @brief Give up on an open started with cpc_open_endpoint_async() and free
+ *        the open handle.
+ *
+ * @param[in]  open_handle      Handle of the open in progress
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ ******************************************************************************/
+int cpc_cancel_open_endpoint(cpc_endpoint_open_handle_t *open_handle);
+
 /***************************************************************************//**
  * @brief Close the socket connection to the endpoint.
  *        This function will also free the memory used to allocate the endpoint structure.
@@ -376,6 +512,40 @@ int cpc_close_endpoint(cpc_endpoint_t *endpoint);
  ******************************************************************************/
 ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_endpoint_read_flags_t flags);
 
+/***************************************************************************//**
+ * @brief Read a message from an endpoint without providing a buffer.
+ *        The message is lent read-only, in place in the shared memory ring
+ *        when it can be, otherwise from a buffer of the endpoint.
+ *
+ * @param[in] endpoint         CPC endpoint handle to read from
+ * @param[out] buffer          Points to the message, valid until cpc_release_buffer()
+ * @param[in] flags            Optional read flags
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the function returns the length of the message.
+ *
+ * @note Only one message at a time is lent per endpoint, -EBUSY is returned
+ *       until it is released. A message lent from the ring blocks the ones
+ *       behind it, and the daemon drops what doesn't fit: release it quickly.
+ *       Messages are copied rather than lent when the daemon overflow policy
+ *       may overwrite the ones a client has yet to read.
+ *       Flags are enumerated in #cpc_read_endpoint_flags_t
+ *       - CPC_ENDPOINT_READ_FLAG_NONE
+ *       - CPC_ENDPOINT_READ_FLAG_NON_BLOCKING
+ ******************************************************************************/
+ssize_t cpc_read_endpoint_zc(cpc_endpoint_t endpoint, const void **buffer, cpc_endpoint_read_flags_t flags);
+
+/***************************************************************************//**
+ * @brief Give back a message lent by cpc_read_endpoint_zc().
+ *
+ * @param[in] endpoint         CPC endpoint handle the message was read from
+ * @param[in] buffer           The message returned by cpc_read_endpoint_zc()
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ ******************************************************************************/
+int cpc_release_buffer(cpc_endpoint_t endpoint, const void *buffer);
+
 /***************************************************************************//**
  * @brief Write data to an open endpoint.
  *
@@ -395,6 +565,50 @@ ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, c
  ******************************************************************************/
 ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_endpoint_write_flags_t flags);
 
+/***************************************************************************//**
+ * @brief Read several messages from an endpoint in one system call.
+ *
+ * @param[in]     endpoint     CPC endpoint handle to read from
+ * @param[in,out] msgs         The buffers to read into, each of at least
+ *                             SL_CPC_READ_MINIMUM_SIZE bytes. The status of each
+ *                             message is set to the number of bytes read.
+ * @param[in]     count        Number of messages in msgs
+ * @param[in]     flags        Optional read flags
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the number of messages read is returned, from 1 to count.
+ *
+ * @note Only the first message is waited for, like cpc_read_endpoint(). The
+ *       call returns with the messages already received after it.
+ *       Flags are enumerated in #cpc_read_endpoint_flags_t
+ *       - CPC_ENDPOINT_READ_FLAG_NONE
+ *       - CPC_ENDPOINT_READ_FLAG_NON_BLOCKING
+ ******************************************************************************/
+int cpc_read_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_read_flags_t flags);
+
+/***************************************************************************//**
+ * @brief Write several messages to an endpoint in one system call.
+ *
+ * @param[in]     endpoint     CPC endpoint handle to write to
+ * @param[in,out] msgs         The messages to write, none larger than the max write
+ *                             size. The status of each message is set to the number
+ *                             of bytes written, or to a negative value of errno for the
+ *                             first one that could not be written.
+ * @param[in]     count        Number of messages in msgs
+ * @param[in]     flags        Optional write flags
+ *
+ * @return On error, a negative value of errno is returned and nothing was written.
+ *         On success, the number of messages written is returned, from 1 to count.
+ *
+ * @note The messages are written in order, as separate messages, and the call stops
+ *       at the first one that can't be written. With CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING,
+ *       that is the first that doesn't fit in the socket.
+ *       Flags are enumerated in #cpc_write_endpoint_flags_t
+ *       - CPC_ENDPOINT_WRITE_FLAG_NONE
+ *       - CPC_ENDPOINT_WRITE_FLAG_NON_BLOCKING
+ ******************************************************************************/
+int cpc_write_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_write_flags_t flags);
+
 /***************************************************************************//**
  * @brief Get the state of an endpoint by ID.
  *
@@ -412,6 +626,10 @@ ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t dat
  *       - SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE
  *       - SL_CPC_STATE_ERROR_SECURITY_INCIDENT
  *       - SL_CPC_STATE_ERROR_FAULT
+ *
+ * @note The state is read from a table the daemon shares with the library,
+ *       without a round trip to the daemon. The daemon is only queried when
+ *       the table is not available, or no longer up to date.
  ******************************************************************************/
 int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t *state);
 
@@ -438,6 +656,37 @@ int cpc_get_endpoint_state(cpc_handle_t handle, uint8_t id, cpc_endpoint_state_t
  *       - CPC_OPTION_SOCKET_SIZE:  Set the buffer size for the socket used to write on an endpoint.
  *                                  Optval is an integer. The kernel doubles this value (to allow space for
  *                                  bookkeeping overhead).
+ *       - CPC_OPTION_TX_PRIORITY:  Set the priority of the endpoint frames on the bus, optval must be a
+ *                                  cpc_tx_priority_t. Frames of a level are only sent when no higher
+ *                                  level frames are waiting. Applies to the endpoint, for every client.
+ *       - CPC_OPTION_SHM_TRANSPORT: Exchange the endpoint data through rings in memory shared with
+ *                                  the daemon instead of the socket, optval must be true. Saves a copy
+ *                                  and a system call per transfer on each side. The clients of an endpoint
+ *                                  on this transport read its frames from a single ring. Once enabled, polling
+ *                                  the file descriptor returned by cpc_open_endpoint no longer signals data.
+ *       - CPC_OPTION_FRAGMENTATION: Accept writes larger than the secondary RX capability, optval is a
+ *                                  boolean. The daemon sends them in several frames, pipelined in the
+ *                                  transmit window, and reassembles the ones the secondary fragments the
+ *                                  same way, which a read must be large enough for. Applies to the endpoint,
+ *                                  for every client. Fails with -ENOTSUP if the secondary doesn't support
+ *                                  it. CPC_OPTION_MAX_WRITE_SIZE returns the new limit, except with the
+ *                                  shared memory transport.
+ *       - CPC_OPTION_AGGREGATION:  Send the small writes in fewer frames, optval is a uint32_t deadline in
+ *                                  microseconds, 0 to disable. The daemon holds a write for up to the
+ *                                  deadline, and sends it in a single frame with the ones written in the
+ *                                  meantime, as many as fit. The secondary splits them again, and so does
+ *                                  the daemon with the ones it aggregates: reads still return one message
+ *                                  at a time. The deadline is capped to 100 ms, and applied to the
+ *                                  microsecond from Linux 5.11, rounded up to the millisecond on older
+ *                                  kernels. Applies to the endpoint, for every client. Fails with -ENOTSUP
+ *                                  if the secondary doesn't support it.
+ *       - CPC_OPTION_COMPRESSION:  Compress the payloads sent to the secondary, optval is a boolean. Each
+ *                                  frame is compressed on its own as an LZ4 block, before encryption, and
+ *                                  only sent so if that makes it shorter. Worth it on a slow bus with
+ *                                  compressible data, such as logs or JSON. The secondary decompresses, and
+ *                                  the daemon decompresses what the secondary compresses whether it is
+ *                                  enabled or not. Applies to the endpoint, for every client. Fails with
+ *                                  -ENOTSUP if the secondary doesn't support it.
  ******************************************************************************/
 int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen);
 
@@ -467,6 +716,14 @@ int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const
  *       - CPC_OPTION_MAX_WRITE_SIZE: Get the maximum size of the payload that will can be written
  *                                    on an endpoint. Optval is an integer.
  *       - CPC_OPTION_ENCRYPTED:      True if the communication is encrypted. Optval is a boolean.
+ *       - CPC_OPTION_SHM_TRANSPORT:  True if the shared memory transport is enabled. Optval is a boolean.
+ *       - CPC_OPTION_TX_CREDIT:      Number of frames the daemon can send to the secondary right away, before
+ *                                    writes start to wait for acknowledgements. Optval is a uint32_t. When it
+ *                                    goes up from 0, a SL_CPC_EVENT_ENDPOINT_TX_CREDIT event is sent.
+ *       - CPC_OPTION_FRAGMENTATION:  True if fragmentation was enabled by this client. Optval is a boolean.
+ *       - CPC_OPTION_AGGREGATION:    Aggregation deadline applied when this client set it, 0 if disabled.
+ *                                    Optval is a uint32_t.
+ *       - CPC_OPTION_COMPRESSION:    True if compression was enabled by this client. Optval is a boolean.
  ******************************************************************************/
 int cpc_get_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, void *optval, size_t *optlen);
 
@@ -489,6 +746,109 @@ const char* cpc_get_library_version(void);
  ******************************************************************************/
 const char* cpc_get_secondary_app_version(cpc_handle_t handle);
 
+/***************************************************************************//**
+ * @brief Get a snapshot of the counters of the daemon: the core and each
+ *        endpoint (throughput, re-transmissions, queue depths, round trip time
+ *        histogram), the client backlogs, the driver, the event loop and the
+ *        secondary.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[in]  format          CPC_METRICS_FORMAT_JSON or CPC_METRICS_FORMAT_PROMETHEUS
+ * @param[out] buffer          The snapshot, NUL terminated
+ * @param[in]  size            Size of buffer
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the length of the whole snapshot is returned, without the NUL.
+ *         If it is not smaller than size, the snapshot was truncated.
+ *
+ * @note The counters of the secondary are the ones fetched last, every
+ *       stats_interval seconds. The event loop is only measured when
+ *       event_loop_stats_sampling is set.
+ ******************************************************************************/
+ssize_t cpc_get_metrics(cpc_handle_t handle, cpc_metrics_format_t format, char *buffer, size_t size);
+
+/***************************************************************************//**
+ * @brief Write the flight recorder of the daemon, its last frames and core
+ *        events, to a pcapng file in its traces folder.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[out] path            The name of the file, NUL terminated, can be NULL
+ * @param[in]  size            Size of path
+ *
+ * @return On error, a negative value of errno is returned, -EOPNOTSUPP if the
+ *         flight recorder is disabled.
+ *         On success, 0 is returned.
+ *
+ * @note The daemon also writes it on a fatal error and on SIGUSR2.
+ ******************************************************************************/
+int cpc_dump_flight_recorder(cpc_handle_t handle, char *path, size_t size);
+
+/***************************************************************************//**
+ * @brief Get the subsystems whose traces the daemon emits at a level.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[in]  level           CPC_TRACE_LEVEL_DEBUG or CPC_TRACE_LEVEL_FRAME
+ * @param[out] mask            Bit i is set if subsystem i (cpc_trace_subsystem_t) is traced
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ *
+ * @note The mask is 0 when the daemon has nowhere to trace to, see
+ *       stdout_trace, trace_to_file, enable_lttng_tracing and enable_frame_trace.
+ ******************************************************************************/
+int cpc_get_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t *mask);
+
+/***************************************************************************//**
+ * @brief Change at runtime the subsystems whose traces the daemon emits at a
+ *        level, without restarting it. Disabled traces cost the daemon a branch.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[in]  level           CPC_TRACE_LEVEL_DEBUG or CPC_TRACE_LEVEL_FRAME
+ * @param[in]  mask            Bit i enables subsystem i (cpc_trace_subsystem_t)
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ *
+ * @note The warnings and the informational messages are not masked.
+ ******************************************************************************/
+int cpc_set_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t mask);
+
+/***************************************************************************//**
+ * @brief Get a protocol parameter of the daemon.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[in]  endpoint_id     The endpoint, or 0 for the daemon-wide value
+ * @param[in]  parameter       The parameter, see cpc_protocol_parameter_t
+ * @param[out] value           The value in effect
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ *
+ * @note -ENOTCONN is returned for an endpoint that is not open, -EINVAL for
+ *       a daemon-wide parameter asked on an endpoint.
+ ******************************************************************************/
+int cpc_get_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t *value);
+
+/***************************************************************************//**
+ * @brief Change at runtime a protocol parameter of the daemon, without
+ *        restarting it nor its clients.
+ *
+ * @param[in]  handle          CPC library handle
+ * @param[in]  endpoint_id     An open endpoint, or 0 for the daemon-wide value
+ * @param[in]  parameter       The parameter, see cpc_protocol_parameter_t
+ * @param[in]  value           The new value
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, 0 is returned.
+ *
+ * @note A daemon-wide re-transmit parameter also resets the re-transmit
+ *       parameters of each open endpoint to the daemon-wide ones. The values
+ *       tuned on an endpoint hold until it is closed. -EINVAL is returned for
+ *       a value out of range, -ENOTSUP for the keep alive or the statistics
+ *       when they are disabled in the config file.
+ ******************************************************************************/
+int cpc_set_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t value);
+
 /***************************************************************************//**
  * @brief Set the timeout for the endpoint read operations
  *
@@ -645,6 +1005,55 @@ int cpc_deinit_endpoint_event(cpc_endpoint_event_handle_t *event_handle);
  ******************************************************************************/
 int cpc_read_endpoint_event(cpc_endpoint_event_handle_t event_handle, cpc_event_type_t *event_type, cpc_endpoint_event_flags_t flags);
 
+/***************************************************************************//**
+ * @brief Get a file descriptor to poll for the endpoint to be readable, to
+ *        integrate it in an event loop.
+ *
+ * @param[in] endpoint         CPC endpoint handle
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the file descriptor is returned. It belongs to the
+ *         endpoint and must not be read from nor closed.
+ *
+ * @note With the shared memory transport, the file descriptor is not the one
+ *       returned by cpc_open_endpoint(): get it after enabling the transport.
+ *       It is edge triggered, read until -EAGAIN before polling it again.
+ ******************************************************************************/
+int cpc_get_endpoint_fd(cpc_endpoint_t endpoint);
+
+/***************************************************************************//**
+ * @brief Get a file descriptor to poll for an event of the endpoint event
+ *        handle, to integrate it in an event loop.
+ *
+ * @param[in] event_handle     CPC endpoint event handle
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the file descriptor is returned. It belongs to the
+ *         event handle and must not be read from nor closed.
+ ******************************************************************************/
+int cpc_get_endpoint_event_fd(cpc_endpoint_event_handle_t event_handle);
+
+/***************************************************************************//**
+ * @brief Wait for events on several endpoints and endpoint event handles.
+ *
+ * @param[in,out] items        The endpoints and event handles, with the events
+ *                             to wait for. revents is set for each of them.
+ * @param[in]     count        Number of items
+ * @param[in]     timeout_ms   Maximum time to wait, -1 to wait indefinitely and
+ *                             0 to return immediately
+ *
+ * @return On error, a negative value of errno is returned.
+ *         On success, the number of items with revents set is returned, 0 if the
+ *         timeout expired.
+ *
+ * @note Events are enumerated in #cpc_wait_events_t
+ *       - CPC_WAIT_EVENT_READABLE
+ *       - CPC_WAIT_EVENT_WRITABLE: endpoints using the shared memory transport
+ *         are always writable, a write waits for room in the ring
+ *       - CPC_WAIT_EVENT_HANGUP
+ ******************************************************************************/
+int cpc_wait(cpc_wait_item_t *items, size_t count, int timeout_ms);
+
 /***************************************************************************//**
  * @brief Get the option configured for a specified endpoint event.
  *
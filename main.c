@@ -35,12 +35,15 @@
 
 #include "version.h"
 #include "misc/config.h"
+#include "misc/flight_recorder.h"
 #include "misc/logging.h"
+#include "misc/memlock.h"
 #include "misc/sleep.h"
 #include "modes/normal.h"
 #include "modes/binding.h"
 #include "modes/firmware_update.h"
 #include "modes/uart_validation.h"
+#include "modes/link_qualification.h"
 #include "driver/driver_kill.h"
 #include "security/security.h"
 #include "server_core/server_core.h"
@@ -129,6 +132,7 @@ int main(int argc, char *argv[])
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGTERM);
     sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGUSR2); // Dumps the flight recorder
 
     /* Block signals so that they aren't handled
        according to their default dispositions. */
@@ -156,18 +160,21 @@ int main(int argc, char *argv[])
       main_wait_crash_or_graceful_exit_epoll = epoll_create1(EPOLL_CLOEXEC);
       FATAL_SYSCALL_ON(main_wait_crash_or_graceful_exit_epoll < 0);
 
+      event.data.fd = main_crash_eventfd;
       ret = epoll_ctl(main_wait_crash_or_graceful_exit_epoll,
                       EPOLL_CTL_ADD,
                       main_crash_eventfd,
                       &event);
       FATAL_SYSCALL_ON(ret < 0);
 
+      event.data.fd = main_graceful_exit_eventfd;
       ret = epoll_ctl(main_wait_crash_or_graceful_exit_epoll,
                       EPOLL_CTL_ADD,
                       main_graceful_exit_eventfd,
                       &event);
       FATAL_SYSCALL_ON(ret < 0);
 
+      event.data.fd = main_graceful_exit_signalfd;
       ret = epoll_ctl(main_wait_crash_or_graceful_exit_epoll,
                       EPOLL_CTL_ADD,
                       main_graceful_exit_signalfd,
@@ -176,8 +183,6 @@ int main(int argc, char *argv[])
     }
   }
 
-  epoll_init();
-
   logging_init();
 
   PRINT_INFO("[CPCd v%s] [Library API v%d] [RCP Protocol v%d]", PROJECT_VER, LIBRARY_API_VERSION, PROTOCOL_VERSION);
@@ -190,6 +195,10 @@ int main(int argc, char *argv[])
 
   config_init(argc, argv);
 
+  memlock_init();
+
+  epoll_init();
+
 #if !defined(ENABLE_ENCRYPTION)
   PRINT_INFO("\033[31;1mENCRYPTION IS DISABLED \033[0m");
 #else
@@ -241,6 +250,11 @@ int main(int argc, char *argv[])
       run_uart_validation();
       break;
 
+    case MODE_LINK_QUALIFICATION:
+      PRINT_INFO("Starting daemon in link qualification mode");
+      run_link_qualification();
+      break;
+
     default:
       BUG();
       break;
@@ -277,14 +291,29 @@ void main_wait_crash_or_graceful_exit(void)
   int event_count;
   struct epoll_event events;
 
-  do {
-    event_count = epoll_wait(main_wait_crash_or_graceful_exit_epoll,
-                             &events,
-                             1, //only one event
-                             -1); //no timeout
-  } while (errno == EINTR && event_count < 0); // Ignore SIGSTOP
+  while (1) {
+    struct signalfd_siginfo siginfo;
 
-  FATAL_SYSCALL_ON(event_count <= 0);
+    do {
+      event_count = epoll_wait(main_wait_crash_or_graceful_exit_epoll,
+                               &events,
+                               1, //only one event
+                               -1); //no timeout
+    } while (errno == EINTR && event_count < 0); // Ignore SIGSTOP
+
+    FATAL_SYSCALL_ON(event_count <= 0);
+
+    if (events.data.fd != main_graceful_exit_signalfd) {
+      break;
+    }
+
+    FATAL_SYSCALL_ON(read(main_graceful_exit_signalfd, &siginfo, sizeof(siginfo)) != sizeof(siginfo));
+    if (siginfo.ssi_signo != SIGUSR2) {
+      break;
+    }
+
+    flight_recorder_report("SIGUSR2");
+  }
 
   exit_daemon();
 }
@@ -295,6 +324,8 @@ __attribute__((noreturn)) void signal_crash(void)
 
   exit_status = EXIT_FAILURE;
 
+  flight_recorder_report("crash");
+
   sleep_s(1); // Wait for logs to be flushed to the output
 
   if (pthread_self() == main_thread) {
@@ -0,0 +1,198 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Busy polling
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+#include "misc/busy_poll.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+
+typedef struct {
+  uint64_t spun_waits;  // Returned while spinning, an event or a timeout
+  uint64_t slept_waits; // Blocked once the spinning found nothing
+  uint64_t spin_ns;
+  uint64_t sleep_ns;
+} busy_poll_stats_t;
+
+/* Updated by every thread of a class, the driver ones are several */
+static busy_poll_stats_t busy_poll_stats[BUSY_POLL_THREAD_COUNT];
+
+static const char *busy_poll_thread_names[BUSY_POLL_THREAD_COUNT] = {
+  [BUSY_POLL_THREAD_CORE] = "core",
+  [BUSY_POLL_THREAD_DRIVER] = "driver",
+};
+
+static uint64_t busy_poll_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* epoll_pwait2() is used through its system call, the C library may predate it */
+static int busy_poll_sleep(int fd_epoll, struct epoll_event *events, int max_events, int64_t timeout_ns)
+{
+#if defined(__NR_epoll_pwait2)
+  static bool epoll_pwait2_missing = false;
+
+  if (timeout_ns >= 0 && !__atomic_load_n(&epoll_pwait2_missing, __ATOMIC_RELAXED)) {
+    struct __kernel_timespec timeout = {
+      .tv_sec = timeout_ns / 1000000000,
+      .tv_nsec = timeout_ns % 1000000000,
+    };
+    int ret = (int)syscall(__NR_epoll_pwait2, fd_epoll, events, max_events, &timeout, NULL, 0);
+
+    if (ret >= 0 || errno != ENOSYS) {
+      return ret;
+    }
+
+    WARN("epoll_pwait2() is not supported, timers are rounded up to the millisecond");
+    __atomic_store_n(&epoll_pwait2_missing, true, __ATOMIC_RELAXED);
+  }
+#endif
+
+  if (timeout_ns < 0) {
+    return epoll_wait(fd_epoll, events, max_events, -1);
+  }
+
+  // Round up, waking up early would only spin the loop
+  return epoll_wait(fd_epoll, events, max_events, (int)((timeout_ns + 999999) / 1000000));
+}
+
+int busy_poll_epoll_wait(busy_poll_thread_t thread, int fd_epoll, struct epoll_event *events, int max_events, int timeout_ms)
+{
+  struct timespec timeout;
+
+  if (timeout_ms < 0) {
+    return busy_poll_epoll_pwait2(thread, fd_epoll, events, max_events, NULL);
+  }
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+
+  return busy_poll_epoll_pwait2(thread, fd_epoll, events, max_events, &timeout);
+}
+
+int busy_poll_epoll_pwait2(busy_poll_thread_t thread, int fd_epoll, struct epoll_event *events, int max_events, const struct timespec *timeout)
+{
+  busy_poll_stats_t *stats = &busy_poll_stats[thread];
+  int64_t timeout_ns = -1;
+  uint64_t start_ns;
+  uint64_t now_ns;
+  uint64_t spin_end_ns;
+  int event_count;
+
+  if (timeout != NULL) {
+    timeout_ns = (int64_t)timeout->tv_sec * 1000000000 + timeout->tv_nsec;
+  }
+
+  if (timeout_ns == 0) {
+    return epoll_wait(fd_epoll, events, max_events, 0);
+  }
+
+  if (config.busy_poll_us == 0) {
+    return busy_poll_sleep(fd_epoll, events, max_events, timeout_ns);
+  }
+
+  start_ns = busy_poll_now_ns();
+  spin_end_ns = start_ns + (uint64_t)config.busy_poll_us * 1000u;
+  if (timeout_ns > 0 && start_ns + (uint64_t)timeout_ns < spin_end_ns) {
+    spin_end_ns = start_ns + (uint64_t)timeout_ns;
+  }
+
+  do {
+    event_count = epoll_wait(fd_epoll, events, max_events, 0);
+    now_ns = busy_poll_now_ns();
+  } while (event_count == 0 && now_ns < spin_end_ns);
+
+  __atomic_fetch_add(&stats->spin_ns, now_ns - start_ns, __ATOMIC_RELAXED);
+
+  /* An event, an error, or the timeout came first */
+  if (event_count != 0 || (timeout_ns > 0 && now_ns >= start_ns + (uint64_t)timeout_ns)) {
+    __atomic_fetch_add(&stats->spun_waits, 1, __ATOMIC_RELAXED);
+    return event_count;
+  }
+
+  /* Idle for the whole spin, sleep for what is left of the timeout */
+  if (timeout_ns > 0) {
+    timeout_ns -= (int64_t)(now_ns - start_ns);
+  }
+
+  event_count = busy_poll_sleep(fd_epoll, events, max_events, timeout_ns);
+
+  __atomic_fetch_add(&stats->slept_waits, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->sleep_ns, busy_poll_now_ns() - now_ns, __ATOMIC_RELAXED);
+
+  return event_count;
+}
+
+void busy_poll_print_stats(void)
+{
+  size_t thread;
+
+  if (config.busy_poll_us == 0) {
+    return;
+  }
+
+  for (thread = 0; thread < BUSY_POLL_THREAD_COUNT; thread++) {
+    const busy_poll_stats_t *stats = &busy_poll_stats[thread];
+    uint64_t spin_ns = __atomic_load_n(&stats->spin_ns, __ATOMIC_RELAXED);
+    uint64_t sleep_ns = __atomic_load_n(&stats->sleep_ns, __ATOMIC_RELAXED);
+    uint64_t total_ns = spin_ns + sleep_ns;
+
+    if (total_ns == 0) {
+      continue;
+    }
+
+    TRACE("Busy polling of the %s threads : %llu waits spun, %llu slept, %llu ms spinning against %llu ms sleeping (%llu%% spinning)",
+          busy_poll_thread_names[thread],
+          (unsigned long long)__atomic_load_n(&stats->spun_waits, __ATOMIC_RELAXED),
+          (unsigned long long)__atomic_load_n(&stats->slept_waits, __ATOMIC_RELAXED),
+          (unsigned long long)(spin_ns / 1000000u),
+          (unsigned long long)(sleep_ns / 1000000u),
+          (unsigned long long)(spin_ns * 100u / total_ns));
+  }
+}
+
+void busy_poll_add_metrics(metrics_t *metrics)
+{
+  size_t thread;
+
+  if (config.busy_poll_us == 0) {
+    return;
+  }
+
+  for (thread = 0; thread < BUSY_POLL_THREAD_COUNT; thread++) {
+    const busy_poll_stats_t *stats = &busy_poll_stats[thread];
+    const char *name = busy_poll_thread_names[thread];
+
+    metrics_add_counter(metrics, "busy_poll_spun_waits", "thread", name, __atomic_load_n(&stats->spun_waits, __ATOMIC_RELAXED));
+    metrics_add_counter(metrics, "busy_poll_slept_waits", "thread", name, __atomic_load_n(&stats->slept_waits, __ATOMIC_RELAXED));
+    metrics_add_counter(metrics, "busy_poll_spin_ns", "thread", name, __atomic_load_n(&stats->spin_ns, __ATOMIC_RELAXED));
+    metrics_add_counter(metrics, "busy_poll_sleep_ns", "thread", name, __atomic_load_n(&stats->sleep_ns, __ATOMIC_RELAXED));
+  }
+}
@@ -0,0 +1,55 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Busy polling
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <sys/epoll.h>
+#include <time.h>
+
+#include "misc/metrics.h"
+
+/*
+ * With config.busy_poll_us, the server core and driver threads poll their
+ * epoll set without blocking rather than sleep in epoll_wait(), so that a
+ * frame is picked up without the wakeup of the thread. A thread that found
+ * nothing for busy_poll_us goes back to sleeping until the next event, an idle
+ * daemon does not keep its cores busy.
+ *
+ * Each class of thread counts the waits that returned while spinning and those
+ * that slept, and the time spent either way: the share of spinning is the CPU
+ * the mode costs.
+ */
+
+typedef enum {
+  BUSY_POLL_THREAD_CORE,
+  BUSY_POLL_THREAD_DRIVER,
+  BUSY_POLL_THREAD_COUNT
+} busy_poll_thread_t;
+
+/* epoll_wait(), spinning first when busy polling is enabled */
+int busy_poll_epoll_wait(busy_poll_thread_t thread, int fd_epoll, struct epoll_event *events, int max_events, int timeout_ms);
+
+/* Same with a timeout to the nanosecond, NULL to wait forever. Rounded up to
+ * the millisecond on kernels older than 5.11, which lack epoll_pwait2() */
+int busy_poll_epoll_pwait2(busy_poll_thread_t thread, int fd_epoll, struct epoll_event *events, int max_events, const struct timespec *timeout);
+
+void busy_poll_print_stats(void);
+
+void busy_poll_add_metrics(metrics_t *metrics);
+
+#endif //BUSY_POLL_H
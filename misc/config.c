@@ -34,12 +34,14 @@
 #include <errno.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <sched.h>
 
 #include "sleep.h"
 #include "config.h"
 #include "logging.h"
 #include "version.h"
 #include "utils.h"
+#include "flight_recorder.h"
 
 /*******************************************************************************
  **********************  DATA TYPES   ******************************************
@@ -64,10 +66,16 @@ config_t config = {
 
   .use_encryption = false,
 
+  .crypto_worker = false,
+
+  .crypto_backend = CRYPTO_BACKEND_MBEDTLS,
+
   .binding_key_file = "~/.cpcd/binding.key",
 
   .binding_key_override = false,
 
+  .session_ticket_file = NULL,
+
   .binding_method = NULL,
 
   .stdout_tracing = false,
@@ -75,14 +83,37 @@ config_t config = {
   .lttng_tracing = false,
   .enable_frame_trace = false,
   .traces_folder = "/dev/shm/cpcd-traces", /* must be mounted on a tmpfs */
+  .frame_capture_file = NULL,
+  .flight_recorder_size = 1024,
+  .trace_mask = TRACE_MASK_ALL,
+  .frame_trace_mask = TRACE_MASK_ALL,
 
   .bus = UNCHOSEN,
 
   // UART config
   .uart_baudrate = 115200,
+  .uart_max_baudrate = 0,
   .uart_hardflow = false,
+  .uart_tx_drain_polling = false,
+  .uart_low_latency = false,
+  .uart_rx_realtime_priority = 0,
   .uart_file = NULL,
 
+  // Bonded UART config
+  .bond_uart_file = NULL,
+  .bond_uart_baudrate = 0,
+
+  // Network config
+  .net_address = NULL,
+  .net_port = 4901,
+  .net_protocol = NET_PROTOCOL_TCP,
+
+  // Emulated secondary config
+  .emul_mode = EMUL_MODE_ECHO,
+  .emul_bitrate = 0,
+  .emul_latency_us = 1000,
+  .emul_loss_per_mille = 0,
+
   // SPI config
   .spi_file = NULL,
   .spi_bitrate = 1000000,
@@ -92,6 +123,9 @@ config_t config = {
   .spi_cs_pin = 24,
   .spi_irq_chip = "gpiochip0",
   .spi_irq_pin = 23,
+  .spi_cs_setup_us = 1000,
+  .spi_inter_transfer_gap_us = 1000,
+  .spi_full_duplex = false,
 
   // Firmware update
   .fu_reset_chip = "gpiochip0",
@@ -102,9 +136,16 @@ config_t config = {
   .fu_connect_to_bootloader = false,
   .fu_enter_bootloader = false,
   .fu_file = NULL,
+  .fu_xmodem_mode = XMODEM_MODE_AUTO,
+  .fu_uart_baudrate = 0,
+  .fu_spi_pipelined = false,
+  .fu_over_cpc = false,
 
   .restart_cpcd = false,
 
+  .hot_restart = false,
+  .hot_restart_take_over = false,
+
   .board_controller_ip_addr = NULL,
 
   .application_version_validation = NULL,
@@ -117,11 +158,43 @@ config_t config = {
 
   .uart_validation_test_option = NULL,
 
+  .link_qualification_duration = 0,
+  .link_qualification_endpoint = SL_CPC_ENDPOINT_USER_ID_0,
+
   .stats_interval = 0,
 
+  .tx_window_size = 1,
+
+  .selective_reject = false,
+  .delayed_ack_timeout_us = 0,
+  .delayed_ack_frame_count = 2,
+
+  .fragmentation = true,
+  .aggregation = true,
+  .compression = true,
+
+  .client_backlog_max_frames = 64,
+  .client_backlog_max_bytes = 262144,
+  .client_backlog_overflow_policy = BACKLOG_OVERFLOW_DISCONNECT,
+  .client_socket_autotune = false,
+  .client_socket_max_bytes = 4194304,
+  .client_socket_total_max_bytes = 33554432,
+  .server_io_thread = false,
+  .driver_rings = false,
+  .deterministic_memory = false,
+  .driver_sched = { .cpu = -1, .policy = SCHED_OTHER },
+  .core_sched = { .cpu = -1, .policy = SCHED_OTHER },
+  .security_sched = { .cpu = -1, .policy = SCHED_OTHER },
+  .event_loop_stats_sampling = 16,
+  .frame_latency_stats = false,
+  .busy_poll_us = 0,
+
   .rlimit_nofile = 2000, /* New number of concurrent opened file descriptor */
 };
 
+/* The file descriptor holding the lock on the device, -1 if none */
+static int device_lock_fd = -1;
+
 /*******************************************************************************
  **************************  LOCAL PROTOTYPES   ********************************
  ******************************************************************************/
@@ -160,6 +233,10 @@ static const char* config_bus_to_str(bus_t value)
       return "UART";
     case SPI:
       return "SPI";
+    case NET:
+      return "NET";
+    case EMUL:
+      return "EMUL";
     case UNCHOSEN:
       return "UNCHOSEN";
     default:
@@ -167,6 +244,60 @@ static const char* config_bus_to_str(bus_t value)
   }
 }
 
+static const char* config_net_protocol_to_str(net_protocol_t value)
+{
+  switch (value) {
+    case NET_PROTOCOL_TCP:
+      return "TCP";
+    case NET_PROTOCOL_UDP:
+      return "UDP";
+    default:
+      FATAL("net_protocol_t value not supported (%d)", value);
+  }
+}
+
+static const char* config_emul_mode_to_str(emul_mode_t value)
+{
+  switch (value) {
+    case EMUL_MODE_ECHO:
+      return "ECHO";
+    case EMUL_MODE_SINK:
+      return "SINK";
+    default:
+      FATAL("emul_mode_t value not supported (%d)", value);
+  }
+}
+
+static const char* config_crypto_backend_to_str(crypto_backend_t value)
+{
+  switch (value) {
+    case CRYPTO_BACKEND_MBEDTLS:
+      return "mbedtls";
+    case CRYPTO_BACKEND_KERNEL:
+      return "kernel";
+    case CRYPTO_BACKEND_OPENSSL:
+      return "openssl";
+    default:
+      FATAL("crypto_backend_t value not supported (%d)", value);
+  }
+}
+
+static const char* config_xmodem_mode_to_str(xmodem_mode_t value)
+{
+  switch (value) {
+    case XMODEM_MODE_AUTO:
+      return "auto";
+    case XMODEM_MODE_CRC:
+      return "crc";
+    case XMODEM_MODE_1K:
+      return "1k";
+    case XMODEM_MODE_STREAMING:
+      return "streaming";
+    default:
+      FATAL("xmodem_mode_t value not supported (%d)", value);
+  }
+}
+
 static const char* config_spi_mode_to_str(unsigned int value)
 {
   switch (value) {
@@ -200,11 +331,41 @@ static const char* config_operation_mode_to_str(operation_mode_t value)
       return "MODE_FIRMWARE_UPDATE";
     case MODE_UART_VALIDATION:
       return "MODE_UART_VALIDATION";
+    case MODE_LINK_QUALIFICATION:
+      return "MODE_LINK_QUALIFICATION";
     default:
       FATAL("operation_mode_t value not supported (%d)", value);
   }
 }
 
+static const char* config_backlog_overflow_policy_to_str(backlog_overflow_policy_t value)
+{
+  switch (value) {
+    case BACKLOG_OVERFLOW_DISCONNECT:
+      return "disconnect";
+    case BACKLOG_OVERFLOW_DROP_OLDEST:
+      return "drop-oldest";
+    case BACKLOG_OVERFLOW_DROP_NEWEST:
+      return "drop-newest";
+    default:
+      FATAL("backlog_overflow_policy_t value not supported (%d)", value);
+  }
+}
+
+static const char* config_sched_policy_to_str(int value)
+{
+  switch (value) {
+    case SCHED_OTHER:
+      return "SCHED_OTHER";
+    case SCHED_FIFO:
+      return "SCHED_FIFO";
+    case SCHED_RR:
+      return "SCHED_RR";
+    default:
+      FATAL("sched policy value not supported (%d)", value);
+  }
+}
+
 #define CONFIG_PREFIX_LEN(variable) (strlen(#variable) + 1)
 
 #define CONFIG_PRINT_STR(value)                                           \
@@ -225,24 +386,66 @@ static const char* config_operation_mode_to_str(operation_mode_t value)
     run_time_total_size += (uint32_t)sizeof(value);                                      \
   } while (0)
 
+#define CONFIG_PRINT_BACKLOG_OVERFLOW_POLICY_TO_STR(value)                                        \
+  do {                                                                                            \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_backlog_overflow_policy_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                               \
+  } while (0)
+
 #define CONFIG_PRINT_BUS_TO_STR(value)                                        \
   do {                                                                        \
     PRINT_INFO("%s = %s", &(#value)[print_offset], config_bus_to_str(value)); \
     run_time_total_size += (uint32_t)sizeof(value);                           \
   } while (0)
 
+#define CONFIG_PRINT_NET_PROTOCOL_TO_STR(value)                                        \
+  do {                                                                                 \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_net_protocol_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                    \
+  } while (0)
+
+#define CONFIG_PRINT_EMUL_MODE_TO_STR(value)                                        \
+  do {                                                                              \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_emul_mode_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                 \
+  } while (0)
+
+#define CONFIG_PRINT_CRYPTO_BACKEND_TO_STR(value)                                        \
+  do {                                                                                   \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_crypto_backend_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                      \
+  } while (0)
+
+#define CONFIG_PRINT_XMODEM_MODE_TO_STR(value)                                        \
+  do {                                                                                \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_xmodem_mode_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                   \
+  } while (0)
+
 #define CONFIG_PRINT_SPI_MODE_TO_STR(value)                                        \
   do {                                                                             \
     PRINT_INFO("%s = %s", &(#value)[print_offset], config_spi_mode_to_str(value)); \
     run_time_total_size += (uint32_t)sizeof(value);                                \
   } while (0)
 
+#define CONFIG_PRINT_SCHED_POLICY_TO_STR(value)                                        \
+  do {                                                                                 \
+    PRINT_INFO("%s = %s", &(#value)[print_offset], config_sched_policy_to_str(value)); \
+    run_time_total_size += (uint32_t)sizeof(value);                                    \
+  } while (0)
+
 #define CONFIG_PRINT_DEC(value)                            \
   do {                                                     \
     PRINT_INFO("%s = %d", &(#value)[print_offset], value); \
     run_time_total_size += (uint32_t)sizeof(value);        \
   } while (0)
 
+#define CONFIG_PRINT_HEX(value)                              \
+  do {                                                       \
+    PRINT_INFO("%s = 0x%x", &(#value)[print_offset], value); \
+    run_time_total_size += (uint32_t)sizeof(value);          \
+  } while (0)
+
 static void config_print(void)
 {
   PRINT_INFO("Reading configuration");
@@ -262,9 +465,15 @@ static void config_print(void)
 
   CONFIG_PRINT_BOOL_TO_STR(config.use_encryption);
 
+  CONFIG_PRINT_BOOL_TO_STR(config.crypto_worker);
+
+  CONFIG_PRINT_CRYPTO_BACKEND_TO_STR(config.crypto_backend);
+
   CONFIG_PRINT_STR(config.binding_key_file);
   CONFIG_PRINT_BOOL_TO_STR(config.binding_key_override);
 
+  CONFIG_PRINT_STR(config.session_ticket_file);
+
   CONFIG_PRINT_STR(config.binding_method);
 
   CONFIG_PRINT_BOOL_TO_STR(config.stdout_tracing);
@@ -272,13 +481,33 @@ static void config_print(void)
   CONFIG_PRINT_BOOL_TO_STR(config.lttng_tracing);
   CONFIG_PRINT_BOOL_TO_STR(config.enable_frame_trace);
   CONFIG_PRINT_STR(config.traces_folder);
+  CONFIG_PRINT_STR(config.frame_capture_file);
+  CONFIG_PRINT_DEC(config.flight_recorder_size);
+  CONFIG_PRINT_HEX(config.trace_mask);
+  CONFIG_PRINT_HEX(config.frame_trace_mask);
 
   CONFIG_PRINT_BUS_TO_STR(config.bus);
 
   CONFIG_PRINT_DEC(config.uart_baudrate);
+  CONFIG_PRINT_DEC(config.uart_max_baudrate);
   CONFIG_PRINT_BOOL_TO_STR(config.uart_hardflow);
+  CONFIG_PRINT_BOOL_TO_STR(config.uart_tx_drain_polling);
+  CONFIG_PRINT_BOOL_TO_STR(config.uart_low_latency);
+  CONFIG_PRINT_DEC(config.uart_rx_realtime_priority);
   CONFIG_PRINT_STR(config.uart_file);
 
+  CONFIG_PRINT_STR(config.bond_uart_file);
+  CONFIG_PRINT_DEC(config.bond_uart_baudrate);
+
+  CONFIG_PRINT_STR(config.net_address);
+  CONFIG_PRINT_DEC(config.net_port);
+  CONFIG_PRINT_NET_PROTOCOL_TO_STR(config.net_protocol);
+
+  CONFIG_PRINT_EMUL_MODE_TO_STR(config.emul_mode);
+  CONFIG_PRINT_DEC(config.emul_bitrate);
+  CONFIG_PRINT_DEC(config.emul_latency_us);
+  CONFIG_PRINT_DEC(config.emul_loss_per_mille);
+
   CONFIG_PRINT_STR(config.spi_file);
   CONFIG_PRINT_DEC(config.spi_bitrate);
   CONFIG_PRINT_SPI_MODE_TO_STR(config.spi_mode);
@@ -287,6 +516,9 @@ static void config_print(void)
   CONFIG_PRINT_DEC(config.spi_cs_pin);
   CONFIG_PRINT_STR(config.spi_irq_chip);
   CONFIG_PRINT_DEC(config.spi_irq_pin);
+  CONFIG_PRINT_DEC(config.spi_cs_setup_us);
+  CONFIG_PRINT_DEC(config.spi_inter_transfer_gap_us);
+  CONFIG_PRINT_BOOL_TO_STR(config.spi_full_duplex);
 
   CONFIG_PRINT_STR(config.fu_reset_chip);
   CONFIG_PRINT_DEC(config.fu_spi_reset_pin);
@@ -296,7 +528,13 @@ static void config_print(void)
   CONFIG_PRINT_BOOL_TO_STR(config.fu_connect_to_bootloader);
   CONFIG_PRINT_BOOL_TO_STR(config.fu_enter_bootloader);
   CONFIG_PRINT_STR(config.fu_file);
+  CONFIG_PRINT_XMODEM_MODE_TO_STR(config.fu_xmodem_mode);
+  CONFIG_PRINT_DEC(config.fu_uart_baudrate);
+  CONFIG_PRINT_BOOL_TO_STR(config.fu_spi_pipelined);
+  CONFIG_PRINT_BOOL_TO_STR(config.fu_over_cpc);
   CONFIG_PRINT_BOOL_TO_STR(config.restart_cpcd);
+  CONFIG_PRINT_BOOL_TO_STR(config.hot_restart);
+  CONFIG_PRINT_BOOL_TO_STR(config.hot_restart_take_over);
 
   CONFIG_PRINT_STR(config.board_controller_ip_addr);
 
@@ -310,8 +548,54 @@ static void config_print(void)
 
   CONFIG_PRINT_STR(config.uart_validation_test_option);
 
+  CONFIG_PRINT_DEC(config.link_qualification_duration);
+  CONFIG_PRINT_DEC(config.link_qualification_endpoint);
+
   CONFIG_PRINT_DEC(config.stats_interval);
 
+  CONFIG_PRINT_DEC(config.tx_window_size);
+
+  CONFIG_PRINT_BOOL_TO_STR(config.selective_reject);
+
+  CONFIG_PRINT_DEC(config.delayed_ack_timeout_us);
+
+  CONFIG_PRINT_DEC(config.delayed_ack_frame_count);
+
+  CONFIG_PRINT_BOOL_TO_STR(config.fragmentation);
+  CONFIG_PRINT_BOOL_TO_STR(config.aggregation);
+  CONFIG_PRINT_BOOL_TO_STR(config.compression);
+
+  CONFIG_PRINT_DEC(config.client_backlog_max_frames);
+
+  CONFIG_PRINT_DEC(config.client_backlog_max_bytes);
+
+  CONFIG_PRINT_BACKLOG_OVERFLOW_POLICY_TO_STR(config.client_backlog_overflow_policy);
+
+  CONFIG_PRINT_BOOL_TO_STR(config.client_socket_autotune);
+  CONFIG_PRINT_DEC(config.client_socket_max_bytes);
+  CONFIG_PRINT_DEC(config.client_socket_total_max_bytes);
+
+  CONFIG_PRINT_BOOL_TO_STR(config.server_io_thread);
+  CONFIG_PRINT_BOOL_TO_STR(config.driver_rings);
+  CONFIG_PRINT_BOOL_TO_STR(config.deterministic_memory);
+
+  CONFIG_PRINT_DEC(config.driver_sched.cpu);
+  CONFIG_PRINT_SCHED_POLICY_TO_STR(config.driver_sched.policy);
+  CONFIG_PRINT_DEC(config.driver_sched.priority);
+  CONFIG_PRINT_DEC(config.driver_sched.nice);
+  CONFIG_PRINT_DEC(config.core_sched.cpu);
+  CONFIG_PRINT_SCHED_POLICY_TO_STR(config.core_sched.policy);
+  CONFIG_PRINT_DEC(config.core_sched.priority);
+  CONFIG_PRINT_DEC(config.core_sched.nice);
+  CONFIG_PRINT_DEC(config.security_sched.cpu);
+  CONFIG_PRINT_SCHED_POLICY_TO_STR(config.security_sched.policy);
+  CONFIG_PRINT_DEC(config.security_sched.priority);
+  CONFIG_PRINT_DEC(config.security_sched.nice);
+
+  CONFIG_PRINT_DEC(config.event_loop_stats_sampling);
+  CONFIG_PRINT_BOOL_TO_STR(config.frame_latency_stats);
+  CONFIG_PRINT_DEC(config.busy_poll_us);
+
   CONFIG_PRINT_DEC(config.rlimit_nofile);
 
   if (run_time_total_size != compile_time_total_size) {
@@ -411,6 +695,8 @@ static void print_cli_args(int argc, char *argv[])
 #define ARGV_OPT_CONNECT_TO_BOOTLOADER  "connect-to-bootloader"
 #define ARGV_OPT_UART_VALIDATION        "uart-validation"
 #define ARGV_OPT_BOARD_CONTROLLER       "board-controller"
+#define ARGV_OPT_LINK_QUALIFICATION     "link-qualification"
+#define ARGV_OPT_HOT_RESTART            "hot-restart"
 
 const struct option argv_opt_list[] =
 {
@@ -429,6 +715,8 @@ const struct option argv_opt_list[] =
   { ARGV_OPT_CONNECT_TO_BOOTLOADER, no_argument, 0, 'l' },
   { ARGV_OPT_UART_VALIDATION, required_argument, 0, 't' },
   { ARGV_OPT_BOARD_CONTROLLER, required_argument, 0, 'w' },
+  { ARGV_OPT_LINK_QUALIFICATION, required_argument, 0, 'q' },
+  { ARGV_OPT_HOT_RESTART, no_argument, 0, 'H' },
   { 0, 0, 0, 0  }
 };
 
@@ -441,7 +729,7 @@ static void config_parse_cli_arg(int argc, char *argv[])
   print_cli_args(argc, argv);
 
   while (1) {
-    opt = getopt_long(argc, argv, "c:hupvrs:f:k:a:b:t:w:el", argv_opt_list, NULL);
+    opt = getopt_long(argc, argv, "c:hupvrs:f:k:a:b:t:w:q:elH", argv_opt_list, NULL);
 
     if (opt == -1) {
       break;
@@ -522,12 +810,31 @@ static void config_parse_cli_arg(int argc, char *argv[])
       case 'w':
         config.board_controller_ip_addr = optarg;
         break;
+      case 'q':
+      {
+        char *endptr;
+        unsigned long duration = strtoul(optarg, &endptr, 10);
+
+        if (*endptr != '\0' || duration == 0 || duration > UINT32_MAX) {
+          FATAL("Invalid link qualification duration: %s, see --help", optarg);
+        }
+        config.link_qualification_duration = (unsigned int)duration;
+        if (config.operation_mode == MODE_NORMAL) {
+          config.operation_mode = MODE_LINK_QUALIFICATION;
+        } else {
+          FATAL("Multiple non normal mode flag detected.");
+        }
+        break;
+      }
       case 'l':
         config.fu_connect_to_bootloader = true;
         break;
       case 'e':
         config.fu_enter_bootloader = true;
         break;
+      case 'H':
+        config.hot_restart_take_over = true;
+        break;
       case '?':
       default:
         config_print_help(stderr, 1);
@@ -586,6 +893,11 @@ static void config_restart_cpcd_without_args(argv_exclude_t *argv_exclude_list,
   config_restart_cpcd(argv);
 }
 
+int config_get_device_lock_fd(void)
+{
+  return device_lock_fd;
+}
+
 void config_exit_cpcd(int status)
 {
   PRINT_INFO("Exiting CPCd...");
@@ -659,6 +971,32 @@ static bool is_comment_or_newline(const char* line)
   return is_nul(c) || is_line_break(c) || is_comment(c);
 }
 
+static int config_parse_int(const char *name, const char *val, long min, long max)
+{
+  char *endptr;
+  long value;
+
+  value = strtol(val, &endptr, 10);
+  if (*endptr != '\0' || value < min || value > max) {
+    FATAL("Config file error : bad %s value, must be between %ld and %ld", name, min, max);
+  }
+
+  return (int)value;
+}
+
+static int config_parse_sched_policy(const char *name, const char *val)
+{
+  if (0 == strcmp(val, "SCHED_OTHER")) {
+    return SCHED_OTHER;
+  } else if (0 == strcmp(val, "SCHED_FIFO")) {
+    return SCHED_FIFO;
+  } else if (0 == strcmp(val, "SCHED_RR")) {
+    return SCHED_RR;
+  } else {
+    FATAL("Config file error : bad %s value, must be SCHED_OTHER, SCHED_FIFO or SCHED_RR", name);
+  }
+}
+
 static void config_parse_config_file(void)
 {
   FILE *config_file = NULL;
@@ -693,6 +1031,10 @@ static void config_parse_config_file(void)
         config.bus = UART;
       } else if (0 == strcmp(val, "SPI")) {
         config.bus = SPI;
+      } else if (0 == strcmp(val, "NET")) {
+        config.bus = NET;
+      } else if (0 == strcmp(val, "EMUL")) {
+        config.bus = EMUL;
       } else {
         FATAL("Config file error : bad bus_type value\n");
       }
@@ -713,6 +1055,24 @@ static void config_parse_config_file(void)
       if (*endptr != '\0') {
         FATAL("Bad config line \"%s\"", line);
       }
+    } else if (0 == strcmp(name, "spi_cs_setup_us")) {
+      config.spi_cs_setup_us = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad spi_cs_setup_us value");
+      }
+    } else if (0 == strcmp(name, "spi_inter_transfer_gap_us")) {
+      config.spi_inter_transfer_gap_us = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad spi_inter_transfer_gap_us value");
+      }
+    } else if (0 == strcmp(name, "spi_full_duplex")) {
+      if (0 == strcmp(val, "true")) {
+        config.spi_full_duplex = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.spi_full_duplex = false;
+      } else {
+        FATAL("Config file error : bad spi_full_duplex value");
+      }
     } else if (0 == strcmp(name, "spi_device_bitrate")) {
       config.spi_bitrate = (unsigned int)strtoul(val, &endptr, 10);
       if (*endptr != '\0') {
@@ -738,6 +1098,39 @@ static void config_parse_config_file(void)
       } else {
         FATAL("Config file error : bad bootloader_recovery_pins_enabled value");
       }
+    } else if (0 == strcmp(name, "bootloader_xmodem_mode")) {
+      if (0 == strcmp(val, "auto")) {
+        config.fu_xmodem_mode = XMODEM_MODE_AUTO;
+      } else if (0 == strcmp(val, "crc")) {
+        config.fu_xmodem_mode = XMODEM_MODE_CRC;
+      } else if (0 == strcmp(val, "1k")) {
+        config.fu_xmodem_mode = XMODEM_MODE_1K;
+      } else if (0 == strcmp(val, "streaming")) {
+        config.fu_xmodem_mode = XMODEM_MODE_STREAMING;
+      } else {
+        FATAL("Config file error : bad bootloader_xmodem_mode value");
+      }
+    } else if (0 == strcmp(name, "bootloader_uart_baud")) {
+      config.fu_uart_baudrate = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Bad config line \"%s\"", line);
+      }
+    } else if (0 == strcmp(name, "bootloader_spi_pipelined")) {
+      if (0 == strcmp(val, "true")) {
+        config.fu_spi_pipelined = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.fu_spi_pipelined = false;
+      } else {
+        FATAL("Config file error : bad bootloader_spi_pipelined value");
+      }
+    } else if (0 == strcmp(name, "firmware_update_over_cpc")) {
+      if (0 == strcmp(val, "true")) {
+        config.fu_over_cpc = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.fu_over_cpc = false;
+      } else {
+        FATAL("Config file error : bad firmware_update_over_cpc value");
+      }
     } else if (0 == strcmp(name, "bootloader_wake_gpio_chip")) {
       config.fu_wake_chip = strdup(val);
     } else if (0 == strcmp(name, "bootloader_wake_gpio")) {
@@ -752,6 +1145,45 @@ static void config_parse_config_file(void)
       if (*endptr != '\0') {
         FATAL("Bad config line \"%s\"", line);
       }
+    } else if (0 == strcmp(name, "net_device_address")) {
+      config.net_address = strdup(val);
+      FATAL_ON(config.net_address == NULL);
+    } else if (0 == strcmp(name, "net_device_port")) {
+      config.net_port = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.net_port == 0 || config.net_port > 65535) {
+        FATAL("Config file error : bad net_device_port value");
+      }
+    } else if (0 == strcmp(name, "net_protocol")) {
+      if (0 == strcmp(val, "TCP")) {
+        config.net_protocol = NET_PROTOCOL_TCP;
+      } else if (0 == strcmp(val, "UDP")) {
+        config.net_protocol = NET_PROTOCOL_UDP;
+      } else {
+        FATAL("Config file error : bad net_protocol value");
+      }
+    } else if (0 == strcmp(name, "emul_mode")) {
+      if (0 == strcmp(val, "ECHO")) {
+        config.emul_mode = EMUL_MODE_ECHO;
+      } else if (0 == strcmp(val, "SINK")) {
+        config.emul_mode = EMUL_MODE_SINK;
+      } else {
+        FATAL("Config file error : bad emul_mode value");
+      }
+    } else if (0 == strcmp(name, "emul_bitrate")) {
+      config.emul_bitrate = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad emul_bitrate value");
+      }
+    } else if (0 == strcmp(name, "emul_latency_us")) {
+      config.emul_latency_us = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad emul_latency_us value");
+      }
+    } else if (0 == strcmp(name, "emul_loss_per_mille")) {
+      config.emul_loss_per_mille = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.emul_loss_per_mille > 1000) {
+        FATAL("Config file error : bad emul_loss_per_mille value, must be between 0 and 1000");
+      }
     } else if (0 == strcmp(name, "uart_device_file")) {
       config.uart_file = strdup(val);
       FATAL_ON(config.uart_file == NULL);
@@ -760,6 +1192,19 @@ static void config_parse_config_file(void)
       if (*endptr != '\0') {
         FATAL("Bad config line \"%s\"", line);
       }
+    } else if (0 == strcmp(name, "bond_uart_device_file")) {
+      config.bond_uart_file = strdup(val);
+      FATAL_ON(config.bond_uart_file == NULL);
+    } else if (0 == strcmp(name, "bond_uart_device_baud")) {
+      config.bond_uart_baudrate = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Bad config line \"%s\"", line);
+      }
+    } else if (0 == strcmp(name, "uart_max_baud")) {
+      config.uart_max_baudrate = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Bad config line \"%s\"", line);
+      }
     } else if (0 == strcmp(name, "uart_hardflow")) {
       if (0 == strcmp(val, "true")) {
         config.uart_hardflow = true;
@@ -768,6 +1213,27 @@ static void config_parse_config_file(void)
       } else {
         FATAL("Config file error : bad UART_HARDFLOW value");
       }
+    } else if (0 == strcmp(name, "uart_tx_drain_polling")) {
+      if (0 == strcmp(val, "true")) {
+        config.uart_tx_drain_polling = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.uart_tx_drain_polling = false;
+      } else {
+        FATAL("Config file error : bad uart_tx_drain_polling value");
+      }
+    } else if (0 == strcmp(name, "uart_low_latency")) {
+      if (0 == strcmp(val, "true")) {
+        config.uart_low_latency = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.uart_low_latency = false;
+      } else {
+        FATAL("Config file error : bad uart_low_latency value");
+      }
+    } else if (0 == strcmp(name, "uart_rx_realtime_priority")) {
+      config.uart_rx_realtime_priority = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.uart_rx_realtime_priority > 99) {
+        FATAL("Config file error : bad uart_rx_realtime_priority value, must be between 0 and 99");
+      }
     } else if (0 == strcmp(name, "noop_keep_alive")) {
       if (0 == strcmp(val, "true")) {
         config.use_noop_keep_alive = true;
@@ -816,9 +1282,191 @@ static void config_parse_config_file(void)
       } else {
         FATAL("Config file error : bad reset_sequence value");
       }
+    } else if (0 == strcmp(name, "link_qualification_endpoint")) {
+      unsigned long endpoint = strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || endpoint == SL_CPC_ENDPOINT_SYSTEM || endpoint > UINT8_MAX) {
+        FATAL("Config file error : bad link_qualification_endpoint value");
+      }
+      config.link_qualification_endpoint = (uint8_t)endpoint;
     } else if (0 == strcmp(name, "traces_folder")) {
       config.traces_folder = strdup(val);
       FATAL_ON(config.traces_folder == NULL);
+    } else if (0 == strcmp(name, "frame_capture_file")) {
+      config.frame_capture_file = strdup(val);
+      FATAL_SYSCALL_ON(config.frame_capture_file == NULL);
+    } else if (0 == strcmp(name, "flight_recorder_size")) {
+      config.flight_recorder_size = (uint32_t)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad flight_recorder_size value");
+      }
+    } else if (0 == strcmp(name, "trace_mask")) {
+      uint32_t mask;
+      if (!logging_parse_trace_mask(val, &mask)) {
+        FATAL("Config file error : bad trace_mask value");
+      }
+      config.trace_mask = mask;
+    } else if (0 == strcmp(name, "frame_trace_mask")) {
+      uint32_t mask;
+      if (!logging_parse_trace_mask(val, &mask)) {
+        FATAL("Config file error : bad frame_trace_mask value");
+      }
+      config.frame_trace_mask = mask;
+    } else if (0 == strcmp(name, "tx_window_size")) {
+      config.tx_window_size = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.tx_window_size < 1 || config.tx_window_size > 7) {
+        FATAL("Config file error : bad tx_window_size value, must be between 1 and 7");
+      }
+    } else if (0 == strcmp(name, "selective_reject")) {
+      if (0 == strcmp(val, "true")) {
+        config.selective_reject = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.selective_reject = false;
+      } else {
+        FATAL("Config file error : bad selective_reject value");
+      }
+    } else if (0 == strcmp(name, "delayed_ack_timeout_us")) {
+      config.delayed_ack_timeout_us = strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.delayed_ack_timeout_us > 100000) {
+        FATAL("Config file error : bad delayed_ack_timeout_us value, must be between 0 and 100000");
+      }
+    } else if (0 == strcmp(name, "fragmentation")) {
+      if (0 == strcmp(val, "true")) {
+        config.fragmentation = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.fragmentation = false;
+      } else {
+        FATAL("Config file error : bad fragmentation value");
+      }
+    } else if (0 == strcmp(name, "aggregation")) {
+      if (0 == strcmp(val, "true")) {
+        config.aggregation = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.aggregation = false;
+      } else {
+        FATAL("Config file error : bad aggregation value");
+      }
+    } else if (0 == strcmp(name, "compression")) {
+      if (0 == strcmp(val, "true")) {
+        config.compression = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.compression = false;
+      } else {
+        FATAL("Config file error : bad compression value");
+      }
+    } else if (0 == strcmp(name, "client_backlog_max_frames")) {
+      config.client_backlog_max_frames = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad client_backlog_max_frames value");
+      }
+    } else if (0 == strcmp(name, "client_backlog_max_bytes")) {
+      config.client_backlog_max_bytes = strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad client_backlog_max_bytes value");
+      }
+    } else if (0 == strcmp(name, "client_backlog_overflow_policy")) {
+      if (0 == strcmp(val, "disconnect")) {
+        config.client_backlog_overflow_policy = BACKLOG_OVERFLOW_DISCONNECT;
+      } else if (0 == strcmp(val, "drop-oldest")) {
+        config.client_backlog_overflow_policy = BACKLOG_OVERFLOW_DROP_OLDEST;
+      } else if (0 == strcmp(val, "drop-newest")) {
+        config.client_backlog_overflow_policy = BACKLOG_OVERFLOW_DROP_NEWEST;
+      } else {
+        FATAL("Config file error : bad client_backlog_overflow_policy value, must be disconnect, drop-oldest or drop-newest");
+      }
+    } else if (0 == strcmp(name, "client_socket_autotune")) {
+      if (0 == strcmp(val, "true")) {
+        config.client_socket_autotune = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.client_socket_autotune = false;
+      } else {
+        FATAL("Config file error : bad client_socket_autotune value");
+      }
+    } else if (0 == strcmp(name, "client_socket_max_bytes")) {
+      config.client_socket_max_bytes = strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.client_socket_max_bytes == 0 || config.client_socket_max_bytes > INT_MAX) {
+        FATAL("Config file error : bad client_socket_max_bytes value");
+      }
+    } else if (0 == strcmp(name, "client_socket_total_max_bytes")) {
+      config.client_socket_total_max_bytes = strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad client_socket_total_max_bytes value");
+      }
+    } else if (0 == strcmp(name, "server_io_thread")) {
+      if (0 == strcmp(val, "true")) {
+        config.server_io_thread = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.server_io_thread = false;
+      } else {
+        FATAL("Config file error : bad server_io_thread value");
+      }
+    } else if (0 == strcmp(name, "driver_rings")) {
+      if (0 == strcmp(val, "true")) {
+        config.driver_rings = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.driver_rings = false;
+      } else {
+        FATAL("Config file error : bad driver_rings value");
+      }
+    } else if (0 == strcmp(name, "deterministic_memory")) {
+      if (0 == strcmp(val, "true")) {
+        config.deterministic_memory = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.deterministic_memory = false;
+      } else {
+        FATAL("Config file error : bad deterministic_memory value");
+      }
+    } else if (0 == strcmp(name, "hot_restart")) {
+      if (0 == strcmp(val, "true")) {
+        config.hot_restart = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.hot_restart = false;
+      } else {
+        FATAL("Config file error : bad hot_restart value");
+      }
+    } else if (0 == strcmp(name, "driver_cpu")) {
+      config.driver_sched.cpu = config_parse_int(name, val, -1, INT_MAX);
+    } else if (0 == strcmp(name, "driver_sched_policy")) {
+      config.driver_sched.policy = config_parse_sched_policy(name, val);
+    } else if (0 == strcmp(name, "driver_sched_priority")) {
+      config.driver_sched.priority = config_parse_int(name, val, 0, 99);
+    } else if (0 == strcmp(name, "driver_nice")) {
+      config.driver_sched.nice = config_parse_int(name, val, -20, 19);
+    } else if (0 == strcmp(name, "core_cpu")) {
+      config.core_sched.cpu = config_parse_int(name, val, -1, INT_MAX);
+    } else if (0 == strcmp(name, "core_sched_policy")) {
+      config.core_sched.policy = config_parse_sched_policy(name, val);
+    } else if (0 == strcmp(name, "core_sched_priority")) {
+      config.core_sched.priority = config_parse_int(name, val, 0, 99);
+    } else if (0 == strcmp(name, "core_nice")) {
+      config.core_sched.nice = config_parse_int(name, val, -20, 19);
+    } else if (0 == strcmp(name, "security_cpu")) {
+      config.security_sched.cpu = config_parse_int(name, val, -1, INT_MAX);
+    } else if (0 == strcmp(name, "security_sched_policy")) {
+      config.security_sched.policy = config_parse_sched_policy(name, val);
+    } else if (0 == strcmp(name, "security_sched_priority")) {
+      config.security_sched.priority = config_parse_int(name, val, 0, 99);
+    } else if (0 == strcmp(name, "security_nice")) {
+      config.security_sched.nice = config_parse_int(name, val, -20, 19);
+    } else if (0 == strcmp(name, "event_loop_stats_sampling")) {
+      config.event_loop_stats_sampling = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0') {
+        FATAL("Config file error : bad event_loop_stats_sampling value");
+      }
+    } else if (0 == strcmp(name, "busy_poll_us")) {
+      config.busy_poll_us = (unsigned int)config_parse_int(name, val, 0, 1000000);
+    } else if (0 == strcmp(name, "frame_latency_stats")) {
+      if (0 == strcmp(val, "true")) {
+        config.frame_latency_stats = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.frame_latency_stats = false;
+      } else {
+        FATAL("Config file error : bad frame_latency_stats value");
+      }
+    } else if (0 == strcmp(name, "delayed_ack_frame_count")) {
+      config.delayed_ack_frame_count = (unsigned int)strtoul(val, &endptr, 10);
+      if (*endptr != '\0' || config.delayed_ack_frame_count < 1 || config.delayed_ack_frame_count > 7) {
+        FATAL("Config file error : bad delayed_ack_frame_count value, must be between 1 and 7");
+      }
     } else if (0 == strcmp(name, "rlimit_nofile")) {
       config.rlimit_nofile = strtoul(val, &endptr, 10);
       if (*endptr != '\0') {
@@ -842,11 +1490,35 @@ static void config_parse_config_file(void)
         fprintf(stderr, "Config file error : bad enable_lttng_tracing value\n");
       }
 #endif
+    } else if (0 == strcmp(name, "crypto_worker")) {
+      if (0 == strcmp(val, "true")) {
+        config.crypto_worker = true;
+      } else if (0 == strcmp(val, "false")) {
+        config.crypto_worker = false;
+      } else {
+        FATAL("Config file error : bad crypto_worker value");
+      }
+    } else if (0 == strcmp(name, "crypto_backend")) {
+      if (0 == strcmp(val, "mbedtls")) {
+        config.crypto_backend = CRYPTO_BACKEND_MBEDTLS;
+      } else if (0 == strcmp(val, "kernel")) {
+        config.crypto_backend = CRYPTO_BACKEND_KERNEL;
+      } else if (0 == strcmp(val, "openssl")) {
+#if !defined(ENABLE_OPENSSL_GCM)
+        FATAL("Config file error : the daemon was not compiled with -DENABLE_OPENSSL_GCM for crypto_backend openssl");
+#endif
+        config.crypto_backend = CRYPTO_BACKEND_OPENSSL;
+      } else {
+        FATAL("Config file error : bad crypto_backend value");
+      }
     } else if (0 == strcmp(name, "binding_key_file")) {
       if (config.binding_key_override == false) {
         config.binding_key_file = strdup(val);
         FATAL_SYSCALL_ON(config.binding_key_file == NULL);
       }
+    } else if (0 == strcmp(name, "session_ticket_file")) {
+      config.session_ticket_file = strdup(val);
+      FATAL_SYSCALL_ON(config.session_ticket_file == NULL);
     } else {
       FATAL("Config file error : key \"%s\" not recognized", name);
     }
@@ -870,7 +1542,8 @@ static void prevent_device_collision(const char* const device_name)
 
   if (ret == 0) {
     /* The device file is free to use, leave this file descriptor open
-     * to preserve the lock. */
+     * to preserve the lock. It is handed over on a hot restart. */
+    device_lock_fd = tmp_fd;
   } else if (errno == EWOULDBLOCK) {
     FATAL("The device \"%s\" is locked by another cpcd instance", device_name);
   } else {
@@ -923,30 +1596,128 @@ static void prevent_instance_collision(const char* const instance_name)
   }
 }
 
+static void config_validate_thread_sched(const char *thread_class, thread_sched_t sched)
+{
+  if (sched.cpu >= sysconf(_SC_NPROCESSORS_CONF)) {
+    FATAL("Config file error : %s_cpu %d is not a CPU of this system", thread_class, sched.cpu);
+  }
+
+  if (sched.policy == SCHED_OTHER && sched.priority != 0) {
+    FATAL("Config file error : %s_sched_priority needs %s_sched_policy SCHED_FIFO or SCHED_RR", thread_class, thread_class);
+  }
+
+  if (sched.policy != SCHED_OTHER && sched.priority == 0) {
+    FATAL("Config file error : %s_sched_policy %s needs a %s_sched_priority between 1 and 99",
+          thread_class, config_sched_policy_to_str(sched.policy), thread_class);
+  }
+
+  if (sched.policy != SCHED_OTHER && sched.nice != 0) {
+    FATAL("Config file error : %s_nice only applies with %s_sched_policy SCHED_OTHER", thread_class, thread_class);
+  }
+}
+
 static void config_validate_configuration(void)
 {
-  /* Validate bus configuration */
+  if (config.hot_restart_take_over && config.operation_mode != MODE_NORMAL) {
+    FATAL("--%s is only available in the normal mode", ARGV_OPT_HOT_RESTART);
+  }
+
+  /* Validate bus configuration. On a hot restart, the running daemon holds the
+   * device and the instance until it hands them over */
   {
     if (config.bus == SPI) {
       if (config.spi_file == NULL) {
         FATAL("SPI device file missing");
       }
 
-      prevent_device_collision(config.spi_file);
+      if (!config.hot_restart_take_over) {
+        prevent_device_collision(config.spi_file);
+      }
     } else if (config.bus == UART) {
       if (config.uart_file == NULL) {
         FATAL("UART device file missing");
       }
 
-      prevent_device_collision(config.uart_file);
+      if (!config.hot_restart_take_over) {
+        prevent_device_collision(config.uart_file);
+      }
+    } else if (config.bus == NET) {
+      if (config.net_address == NULL) {
+        FATAL("Network device address missing");
+      }
+    } else if (config.bus == EMUL) {
+#if !defined(CPC_BENCH)
+      FATAL("The EMUL bus is only available in cpc_bench, built with -DTARGET_GROUP=benchmark");
+#endif
+      /* The emulated secondary answers endpoint queries and echoes, nothing more */
+      if (config.operation_mode != MODE_NORMAL && config.operation_mode != MODE_LINK_QUALIFICATION) {
+        FATAL("The EMUL bus only supports the normal and link qualification modes");
+      }
+      if (config.use_encryption) {
+        FATAL("The EMUL bus does not support encryption");
+      }
+      if (config.reset_sequence) {
+        WARN("The emulated secondary does not play the reset sequence, skipping it");
+        config.reset_sequence = false;
+      }
     } else {
       FATAL("Invalid bus configuration.");
     }
   }
 
-  prevent_instance_collision(config.instance_name);
+  if (!config.hot_restart_take_over) {
+    prevent_instance_collision(config.instance_name);
+  }
+
+  /* What can't be handed over from one daemon to the next, see server_core/handoff/handoff.h */
+  if (config.hot_restart || config.hot_restart_take_over) {
+    if (config.use_encryption) {
+      FATAL("Hot restart is not supported with encryption, set disable_encryption");
+    }
+    if (config.bus == SPI) {
+      FATAL("Hot restart is not supported on the SPI bus");
+    }
+    if (config.server_io_thread) {
+      FATAL("Hot restart is not supported with server_io_thread");
+    }
+  }
+
+  if (config.busy_poll_us != 0 && (config.core_sched.cpu < 0 || config.driver_sched.cpu < 0)) {
+    WARN("busy_poll_us without core_cpu and driver_cpu, the spinning threads compete with the rest of the system");
+  }
+
+  /* A second link to the secondary, see driver/driver_bond.h */
+  if (config.bond_uart_file != NULL) {
+    if (config.operation_mode != MODE_NORMAL) {
+      WARN("The bonded UART is only used in the normal mode, ignoring bond_uart_device_file");
+      config.bond_uart_file = NULL;
+    } else {
+      if (config.bus != UART && config.bus != SPI) {
+        FATAL("bond_uart_device_file needs the UART or SPI bus");
+      }
+      if (config.uart_max_baudrate != 0) {
+        FATAL("uart_max_baud is not supported with a bonded UART, the secondary negotiates the rate of a single link");
+      }
+      if (config.hot_restart || config.hot_restart_take_over) {
+        FATAL("Hot restart is not supported with a bonded UART");
+      }
+      if (config.driver_rings) {
+        FATAL("driver_rings is not supported with a bonded UART");
+      }
+      if (config.bond_uart_baudrate == 0) {
+        config.bond_uart_baudrate = config.uart_baudrate;
+      }
+
+      prevent_device_collision(config.bond_uart_file);
+    }
+  }
 
   if (config.operation_mode == MODE_FIRMWARE_UPDATE) {
+    /* The bootloaders only speak XMODEM on a UART or their SPI protocol */
+    if (config.bus == NET && !config.fu_over_cpc) {
+      FATAL("Firmware update is not supported on the NET bus");
+    }
+
     if (access(config.fu_file, F_OK | R_OK) != 0) {
       FATAL("Firmware update file (%s) : %s", config.fu_file, strerror(errno));
     }
@@ -959,6 +1730,19 @@ static void config_validate_configuration(void)
 #endif
   }
 
+  if (config.crypto_worker && !config.use_encryption) {
+    WARN("Encryption is disabled, ignoring crypto_worker");
+    config.crypto_worker = false;
+  }
+
+  if (config.frame_capture_file != NULL && config.frame_capture_file[0] != '/') {
+    FATAL("Config file error : frame_capture_file must be an absolute path");
+  }
+
+  if (config.session_ticket_file != NULL && config.session_ticket_file[0] != '/') {
+    FATAL("Config file error : session_ticket_file must be an absolute path");
+  }
+
   if (config.use_encryption && config.operation_mode != MODE_BINDING_UNBIND) {
     if (config.binding_key_file == NULL) {
       FATAL("No binding key file provided needed for security. Provide BINDING_KEY_FILE in the configuration file or use the --key argument. ");
@@ -996,6 +1780,13 @@ static void config_validate_configuration(void)
     }
   }
 
+  /* With 3 bits sequence numbers, out of order frames ahead of the ack can't be
+   * told apart from duplicates behind it if the window is larger than half of
+   * the sequence space */
+  if (config.selective_reject && config.tx_window_size > 4) {
+    FATAL("selective_reject requires a tx_window_size of at most 4");
+  }
+
   if (config.fu_connect_to_bootloader && config.operation_mode != MODE_FIRMWARE_UPDATE) {
     FATAL("--connect-to-bootloader only supported with --firmware-update");
   }
@@ -1004,16 +1795,29 @@ static void config_validate_configuration(void)
     FATAL("Cannot select both --enter-bootloader and --connect-to-bootloader");
   }
 
+  /* The image is uploaded to the application, there is no bootloader to talk to */
+  if (config.fu_over_cpc && (config.fu_connect_to_bootloader || config.fu_enter_bootloader)) {
+    FATAL("firmware_update_over_cpc cannot be used with --enter-bootloader or --connect-to-bootloader");
+  }
+
   if (config.fu_enter_bootloader) {
     config.operation_mode = MODE_FIRMWARE_UPDATE;
   }
 
+  config_validate_thread_sched("driver", config.driver_sched);
+  config_validate_thread_sched("core", config.core_sched);
+  config_validate_thread_sched("security", config.security_sched);
+
+  flight_recorder_init();
+
+  logging_update_trace_masks();
+
   if (config.file_tracing) {
     init_file_logging();
   }
 
-  if (config.stats_interval > 0) {
-    init_stats_logging();
+  if (config.frame_capture_file != NULL) {
+    init_frame_capture();
   }
 }
 
@@ -1077,5 +1881,7 @@ static void config_print_help(FILE *stream, int exit_code)
   fprintf(stream, "  cpcd -s/--print-stats <interval> : print debug statistics to traces. Must provide a given interval in seconds.\n");
   fprintf(stream, "  cpcd -w/--wireless-kit-ip <ipaddress> : validates board controller vcom configuration.\n");
   fprintf(stream, "  cpcd -t/--uart-validation <test> : provide test option to run: 1 -> RX/TX, 2 -> RTS/CTS.\n");
+  fprintf(stream, "  cpcd -q/--link-qualification <seconds> : measure the throughput, latency and error rates of the bus against a secondary echoing on link_qualification_endpoint, for about that long.\n");
+  fprintf(stream, "  cpcd -H/--hot-restart : take the link over from the daemon running the same instance with hot_restart, without resetting the secondary nor disconnecting the clients.\n");
   exit(exit_code);
 }
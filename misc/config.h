@@ -19,8 +19,11 @@
 #define CONFIG_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/resource.h>
 
+#include "misc/thread.h"
+
 #ifndef DEFAULT_INSTANCE_NAME
   #define DEFAULT_INSTANCE_NAME "cpcd_0"
 #endif
@@ -28,9 +31,34 @@
 typedef enum {
   UART,
   SPI,
+  NET,
+  EMUL,
   UNCHOSEN
 }bus_t;
 
+typedef enum {
+  NET_PROTOCOL_TCP,
+  NET_PROTOCOL_UDP
+}net_protocol_t;
+
+typedef enum {
+  EMUL_MODE_ECHO,
+  EMUL_MODE_SINK
+}emul_mode_t;
+
+typedef enum {
+  CRYPTO_BACKEND_MBEDTLS,
+  CRYPTO_BACKEND_KERNEL,
+  CRYPTO_BACKEND_OPENSSL
+}crypto_backend_t;
+
+typedef enum {
+  XMODEM_MODE_AUTO,
+  XMODEM_MODE_CRC,
+  XMODEM_MODE_1K,
+  XMODEM_MODE_STREAMING
+}xmodem_mode_t;
+
 typedef enum {
   MODE_NORMAL,
   MODE_BINDING_UNKNOWN,
@@ -38,9 +66,16 @@ typedef enum {
   MODE_BINDING_PLAIN_TEXT,
   MODE_BINDING_UNBIND,
   MODE_FIRMWARE_UPDATE,
-  MODE_UART_VALIDATION
+  MODE_UART_VALIDATION,
+  MODE_LINK_QUALIFICATION
 }operation_mode_t;
 
+typedef enum {
+  BACKLOG_OVERFLOW_DISCONNECT,
+  BACKLOG_OVERFLOW_DROP_OLDEST,
+  BACKLOG_OVERFLOW_DROP_NEWEST
+}backlog_overflow_policy_t;
+
 typedef struct __attribute__((packed)) {
   const char *file_path;
 
@@ -52,10 +87,16 @@ typedef struct __attribute__((packed)) {
 
   bool use_encryption;
 
+  bool crypto_worker;
+
+  crypto_backend_t crypto_backend;
+
   char *binding_key_file;
 
   bool binding_key_override;
 
+  char *session_ticket_file;
+
   const char *binding_method;
 
   bool stdout_tracing;
@@ -63,13 +104,33 @@ typedef struct __attribute__((packed)) {
   int lttng_tracing;
   bool enable_frame_trace;
   const char *traces_folder;
+  char *frame_capture_file;
+  uint32_t flight_recorder_size;
+  uint32_t trace_mask;
+  uint32_t frame_trace_mask;
 
   bus_t bus;
 
   unsigned int uart_baudrate;
+  unsigned int uart_max_baudrate;
   bool uart_hardflow;
+  bool uart_tx_drain_polling;
+  bool uart_low_latency;
+  unsigned int uart_rx_realtime_priority;
   const char *uart_file;
 
+  const char *bond_uart_file;
+  unsigned int bond_uart_baudrate;
+
+  const char *net_address;
+  unsigned int net_port;
+  net_protocol_t net_protocol;
+
+  emul_mode_t emul_mode;
+  unsigned int emul_bitrate;
+  unsigned int emul_latency_us;
+  unsigned int emul_loss_per_mille;
+
   const char *spi_file;
   unsigned int spi_bitrate;
   unsigned int spi_mode;
@@ -78,6 +139,9 @@ typedef struct __attribute__((packed)) {
   unsigned int spi_cs_pin;
   const char *spi_irq_chip;
   unsigned int spi_irq_pin;
+  unsigned int spi_cs_setup_us;
+  unsigned int spi_inter_transfer_gap_us;
+  bool spi_full_duplex;
 
   const char *fu_reset_chip;
   unsigned int fu_spi_reset_pin;
@@ -87,9 +151,16 @@ typedef struct __attribute__((packed)) {
   bool fu_connect_to_bootloader;
   bool fu_enter_bootloader;
   const char *fu_file;
+  xmodem_mode_t fu_xmodem_mode;
+  unsigned int fu_uart_baudrate;
+  bool fu_spi_pipelined;
+  bool fu_over_cpc;
 
   bool restart_cpcd;
 
+  bool hot_restart;
+  bool hot_restart_take_over;
+
   const char *board_controller_ip_addr;
 
   const char *application_version_validation;
@@ -102,8 +173,46 @@ typedef struct __attribute__((packed)) {
 
   const char *uart_validation_test_option;
 
+  unsigned int link_qualification_duration;
+  uint8_t link_qualification_endpoint;
+
   long stats_interval;
 
+  unsigned int tx_window_size;
+
+  bool selective_reject;
+
+  unsigned long delayed_ack_timeout_us;
+
+  unsigned int delayed_ack_frame_count;
+
+  bool fragmentation;
+  bool aggregation;
+  bool compression;
+
+  unsigned int client_backlog_max_frames;
+
+  unsigned long client_backlog_max_bytes;
+
+  backlog_overflow_policy_t client_backlog_overflow_policy;
+
+  bool client_socket_autotune;
+  unsigned long client_socket_max_bytes;
+  unsigned long client_socket_total_max_bytes;
+
+  bool server_io_thread;
+  bool driver_rings;
+  bool deterministic_memory;
+
+  thread_sched_t driver_sched;
+  thread_sched_t core_sched;
+  thread_sched_t security_sched;
+
+  unsigned int busy_poll_us;
+
+  unsigned int event_loop_stats_sampling;
+  bool frame_latency_stats;
+
   rlim_t rlimit_nofile;
 } config_t;
 
@@ -111,6 +220,7 @@ extern config_t config;
 
 void config_init(int argc, char *argv[]);
 void config_exit_cpcd(int status);
+int config_get_device_lock_fd(void);
 void config_restart_cpcd(char **argv);
 void config_restart_cpcd_without_fw_update_args(void);
 void config_restart_cpcd_without_bind_arg(void);
@@ -0,0 +1,283 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Flight recorder
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "misc/flight_recorder.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "server_core/core/core.h"
+
+/* Largest ring, in records */
+#define FLIGHT_RECORDER_MAX_SIZE (1u << 20)
+
+typedef struct {
+  uint32_t sequence;      // Index of the record plus one once written, 0 while it is being written
+  uint8_t  event;         // flight_recorder_event_t
+  uint8_t  endpoint;
+  uint8_t  arg[2];
+  uint64_t timestamp_ns;  // CLOCK_MONOTONIC, like the time stamps of the capture
+  uint16_t length;        // Of the whole frame
+  uint8_t  data[FLIGHT_RECORDER_SNAP_LENGTH];
+} flight_record_t;
+
+typedef struct {
+  flight_record_t *records; // NULL when disabled
+  uint32_t mask;
+  uint32_t head;            // Records taken so far
+} flight_recorder_t;
+
+static flight_recorder_t flight_recorder;
+
+/* Numbers the files, several dumps can happen within a second */
+static unsigned int flight_recorder_dump_count;
+
+void flight_recorder_init(void)
+{
+  uint32_t size = 1;
+
+  if (config.flight_recorder_size == 0) {
+    return;
+  }
+
+  while (size < config.flight_recorder_size && size < FLIGHT_RECORDER_MAX_SIZE) {
+    size <<= 1;
+  }
+
+  flight_recorder.records = calloc(size, sizeof(flight_record_t));
+  FATAL_ON(flight_recorder.records == NULL);
+  flight_recorder.mask = size - 1;
+  flight_recorder.head = 0;
+}
+
+static uint64_t flight_recorder_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Take the next slot, the record is published by flight_recorder_publish() */
+static flight_record_t* flight_recorder_take(uint32_t *index)
+{
+  flight_record_t *record;
+
+  *index = __atomic_fetch_add(&flight_recorder.head, 1, __ATOMIC_RELAXED);
+  record = &flight_recorder.records[*index & flight_recorder.mask];
+
+  /* A dump must see the slot invalid before it sees any of the new content */
+  __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  record->timestamp_ns = flight_recorder_now_ns();
+
+  return record;
+}
+
+static void flight_recorder_publish(flight_record_t *record, uint32_t index)
+{
+  __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void flight_recorder_frame(bool outbound, const void *frame, size_t frame_length)
+{
+  flight_record_t *record;
+  uint32_t index;
+  size_t snap_length = frame_length < FLIGHT_RECORDER_SNAP_LENGTH ? frame_length : FLIGHT_RECORDER_SNAP_LENGTH;
+
+  if (flight_recorder.records == NULL) {
+    return;
+  }
+
+  record = flight_recorder_take(&index);
+  record->event = outbound ? FLIGHT_RECORDER_FRAME_TX : FLIGHT_RECORDER_FRAME_RX;
+  record->endpoint = 0xFF;
+  record->length = (uint16_t)frame_length;
+  memcpy(record->data, frame, snap_length);
+  flight_recorder_publish(record, index);
+}
+
+void flight_recorder_event(flight_recorder_event_t event, uint8_t endpoint, uint8_t arg0, uint8_t arg1)
+{
+  flight_record_t *record;
+  uint32_t index;
+
+  if (flight_recorder.records == NULL) {
+    return;
+  }
+
+  record = flight_recorder_take(&index);
+  record->event = (uint8_t)event;
+  record->endpoint = endpoint;
+  record->arg[0] = arg0;
+  record->arg[1] = arg1;
+  record->length = 0;
+  flight_recorder_publish(record, index);
+}
+
+static void flight_recorder_describe(const flight_record_t *record, char *comment, size_t size)
+{
+  switch ((flight_recorder_event_t)record->event) {
+    case FLIGHT_RECORDER_RE_TRANSMIT:
+      snprintf(comment, size, "ep#%u: re-transmit of seq %u, %u so far", record->endpoint, record->arg[0], record->arg[1]);
+      break;
+    case FLIGHT_RECORDER_SELECTIVE_RE_TRANSMIT:
+      snprintf(comment, size, "ep#%u: selective re-transmit of seq %u, %u so far", record->endpoint, record->arg[0], record->arg[1]);
+      break;
+    case FLIGHT_RECORDER_INVALID_HEADER_CHECKSUM:
+      snprintf(comment, size, "Invalid header checksum");
+      break;
+    case FLIGHT_RECORDER_INVALID_PAYLOAD_CHECKSUM:
+      snprintf(comment, size, "ep#%u: invalid payload checksum", record->endpoint);
+      break;
+    case FLIGHT_RECORDER_ENDPOINT_STATE:
+      snprintf(comment, size, "ep#%u: %s", record->endpoint, core_stringify_state((cpc_endpoint_state_t)record->arg[0]));
+      break;
+    default:
+      snprintf(comment, size, "Event %u", record->event);
+      break;
+  }
+}
+
+static int flight_recorder_write_all(int fd, const uint8_t *buffer, size_t length)
+{
+  while (length != 0) {
+    ssize_t ret = write(fd, buffer, length);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -errno;
+    }
+
+    buffer += ret;
+    length -= (size_t)ret;
+  }
+
+  return 0;
+}
+
+int flight_recorder_dump(const char *reason, char *path, size_t path_size)
+{
+  const flight_recorder_t *recorder = &flight_recorder;
+  uint8_t buffer[4096];
+  size_t length = 0;
+  struct timespec realtime;
+  struct tm tm_info;
+  char comment[64];
+  uint32_t head;
+  uint32_t count;
+  int fd;
+  int ret = 0;
+
+  if (recorder->records == NULL) {
+    return -EOPNOTSUPP;
+  }
+
+  if (mkdir(config.traces_folder, 0700) < 0 && errno != EEXIST) {
+    return -errno;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  localtime_r(&realtime.tv_sec, &tm_info);
+  snprintf(path, path_size, "%s/flight-recorder-%s-%04d%02d%02d-%02d%02d%02d-%u.pcapng",
+           config.traces_folder, config.instance_name,
+           tm_info.tm_year + 1900, tm_info.tm_mon + 1, tm_info.tm_mday,
+           tm_info.tm_hour, tm_info.tm_min, tm_info.tm_sec,
+           __atomic_fetch_add(&flight_recorder_dump_count, 1, __ATOMIC_RELAXED));
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return -errno;
+  }
+
+  length += trace_pcapng_headers(&buffer[length]);
+
+  /* The records being written meanwhile are skipped */
+  head = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+  count = head < recorder->mask + 1 ? head : recorder->mask + 1;
+
+  for (uint32_t index = head - count; index != head && ret == 0; index++) {
+    const flight_record_t *slot = &recorder->records[index & recorder->mask];
+    flight_record_t record;
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    memcpy(&record, slot, sizeof(record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (sequence != index + 1 || __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence) {
+      continue;
+    }
+
+    if (record.event == FLIGHT_RECORDER_FRAME_RX || record.event == FLIGHT_RECORDER_FRAME_TX) {
+      length += trace_pcapng_packet(&buffer[length], record.event == FLIGHT_RECORDER_FRAME_TX, record.timestamp_ns,
+                                    record.data,
+                                    record.length < FLIGHT_RECORDER_SNAP_LENGTH ? record.length : FLIGHT_RECORDER_SNAP_LENGTH,
+                                    record.length, NULL);
+    } else {
+      flight_recorder_describe(&record, comment, sizeof(comment));
+      length += trace_pcapng_packet(&buffer[length], false, record.timestamp_ns, NULL, 0, 0, comment);
+    }
+
+    if (sizeof(buffer) - length < TRACE_PCAPNG_BLOCK_MAX_SIZE) {
+      ret = flight_recorder_write_all(fd, buffer, length);
+      length = 0;
+    }
+  }
+
+  if (ret == 0) {
+    snprintf(comment, sizeof(comment), "Flight recorder dump on %s", reason);
+    length += trace_pcapng_packet(&buffer[length], false, flight_recorder_now_ns(), NULL, 0, 0, comment);
+    ret = flight_recorder_write_all(fd, buffer, length);
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+void flight_recorder_report(const char *reason)
+{
+  static bool dumping = false;
+  char path[256];
+  int ret;
+
+  /* A FATAL while dumping would come back here */
+  if (__atomic_exchange_n(&dumping, true, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  ret = flight_recorder_dump(reason, path, sizeof(path));
+  if (ret == 0) {
+    PRINT_INFO("Flight recorder written to %s", path);
+  } else if (ret != -EOPNOTSUPP) {
+    TRACE_WARN("Cannot write the flight recorder : %s\n", strerror(-ret));
+  }
+
+  __atomic_store_n(&dumping, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,68 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Flight recorder
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An always-on ring of the last config.flight_recorder_size frames exchanged
+ * with the secondary and core events, so that there is some history to look
+ * at after a link stall or a crash without having the frame traces enabled. A
+ * frame is recorded as its header and the first bytes of its payload, enough
+ * for the reason of a reject or the property of a U-frame.
+ *
+ * Recording takes a slot with an atomic increment and fills it, from any
+ * thread, without locks. The ring is written to the traces folder in the
+ * pcapng format of frame_capture_file on FATAL and BUG, on SIGUSR2, and when a
+ * client calls cpc_dump_flight_recorder(). The events are packets without
+ * data, described by their comment.
+ */
+
+/* Bytes of each frame kept, header included */
+#define FLIGHT_RECORDER_SNAP_LENGTH 14
+
+typedef enum {
+  FLIGHT_RECORDER_FRAME_RX,
+  FLIGHT_RECORDER_FRAME_TX,
+  FLIGHT_RECORDER_RE_TRANSMIT,           // arg0: seq, arg1: re-transmits on the endpoint
+  FLIGHT_RECORDER_SELECTIVE_RE_TRANSMIT, // arg0: seq, arg1: re-transmits on the endpoint
+  FLIGHT_RECORDER_INVALID_HEADER_CHECKSUM,
+  FLIGHT_RECORDER_INVALID_PAYLOAD_CHECKSUM,
+  FLIGHT_RECORDER_ENDPOINT_STATE,        // arg0: cpc_endpoint_state_t
+} flight_recorder_event_t;
+
+/* Set up the ring, if config.flight_recorder_size is not 0 */
+void flight_recorder_init(void);
+
+/* Record a frame, as given to or received from the driver */
+void flight_recorder_frame(bool outbound, const void *frame, size_t frame_length);
+
+/* Record an event, endpoint is 0xFF when it is not known */
+void flight_recorder_event(flight_recorder_event_t event, uint8_t endpoint, uint8_t arg0, uint8_t arg1);
+
+/* Write the ring to the traces folder.
+ * Returns 0 and the name of the file in path, or -errno. */
+int flight_recorder_dump(const char *reason, char *path, size_t path_size);
+
+/* Write the ring and log where, from the main thread or a crashing one */
+void flight_recorder_report(const char *reason);
+
+#endif //FLIGHT_RECORDER_H
@@ -20,12 +20,33 @@
 
 #include "sl_cpc.h"
 
+SL_ENUM(gpio_direction_t){
+  IN = 0,
+  OUT,
+  HIGH,
+  NO_DIRECTION
+};
+
+SL_ENUM(gpio_edge_t){
+  FALLING = 0,
+  RISING,
+  BOTH,
+  NO_EDGE
+};
+
+/*
+ * 'level' caches the last value written to an output, or the last value read
+ * from an input reporting both edges, -1 when unknown. Redundant writes are
+ * skipped and, on sysfs, an input is only read again once an edge is reported.
+ */
 #ifdef USE_LEGACY_GPIO_SYSFS
 #define gpio_t gpio_sysfs_t
 typedef struct {
   unsigned int pin;
   int value_fd;
   int irq_fd;
+  gpio_edge_t edge;
+  int level;
 } gpio_t;
 #define GPIO_EPOLL_EVENT EPOLLPRI
 #else
@@ -37,24 +58,11 @@ typedef struct {
   unsigned int pin;
   struct gpiod_line *line;
   int irq_fd;
+  int level;
 } gpio_t;
 #define GPIO_EPOLL_EVENT EPOLLIN
 #endif
 
-SL_ENUM(gpio_direction_t){
-  IN = 0,
-  OUT,
-  HIGH,
-  NO_DIRECTION
-};
-
-SL_ENUM(gpio_edge_t){
-  FALLING = 0,
-  RISING,
-  BOTH,
-  NO_EDGE
-};
-
 int gpio_init(gpio_t *gpio, const char *gpio_chip, unsigned int gpio_pin, gpio_direction_t direction, gpio_edge_t edge);
 int gpio_deinit(gpio_t *gpio);
 int gpio_get_fd(gpio_t *gpio);
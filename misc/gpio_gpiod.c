@@ -94,6 +94,7 @@ int gpio_init(gpio_gpiod_t *gpio, const char *gpio_chip, unsigned int gpio_pin,
   gpio->chip_name = gpio_chip;
   gpio->pin = gpio_pin;
   gpio->irq_fd = -1;
+  gpio->level = -1;
 
   chip = gpiod_chip_open_by_name(gpio->chip_name);
   FATAL_ON(chip == NULL);
@@ -123,6 +124,7 @@ int gpio_deinit(gpio_gpiod_t *gpio)
   }
 
   gpio->chip_name = NULL;
+  gpio->level = -1;
 
   if (gpio->line) {
     gpiod_line_release(gpio->line);
@@ -160,9 +162,15 @@ int gpio_write(gpio_gpiod_t *gpio, int value)
     return -1;
   }
 
+  if (value == gpio->level) {
+    return 0;
+  }
+
   ret = gpiod_line_set_value(gpio->line, value);
   FATAL_ON(ret < 0);
 
+  gpio->level = value;
+
   return ret;
 }
 
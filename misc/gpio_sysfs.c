@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -149,6 +150,8 @@ int gpio_init(gpio_sysfs_t *gpio, const char *gpio_chip, unsigned int gpio_pin,
   FATAL_SYSCALL_ON(gpio->irq_fd < 0);
 
   gpio->pin = gpio_pin;
+  gpio->edge = edge;
+  gpio->level = -1;
 
   FATAL_ON(set_direction(gpio, direction) < 0);
 
@@ -169,6 +172,7 @@ int gpio_deinit(gpio_sysfs_t *gpio)
   gpio->value_fd = -1;
   gpio->irq_fd = -1;
   gpio->pin = 0;
+  gpio->level = -1;
   return 0;
 }
 
@@ -184,21 +188,46 @@ int gpio_get_fd(gpio_sysfs_t *gpio)
 int gpio_clear_irq(gpio_sysfs_t *gpio)
 {
   char buf[8];
+  ssize_t ret;
 
   if (gpio == NULL) {
     return -1;
   }
 
   lseek(gpio->irq_fd, 0, SEEK_SET);
-  read(gpio->irq_fd, buf, sizeof(buf));
+  ret = read(gpio->irq_fd, buf, sizeof(buf));
+
+  // Acknowledging the edge reads the value of the line as well
+  if (gpio->edge == BOTH) {
+    gpio->level = (ret > 0) ? (buf[0] != '0') : -1;
+  }
 
   return 0;
 }
 
+/*
+ * An edge is reported on irq_fd until gpio_clear_irq() acknowledges it, the
+ * cached level of the line is only valid as long as none is pending.
+ */
+static bool edge_pending(gpio_sysfs_t *gpio)
+{
+  struct pollfd irq_poll = { .fd = gpio->irq_fd, .events = POLLPRI };
+  int ret;
+
+  ret = poll(&irq_poll, 1, 0);
+  FATAL_SYSCALL_ON(ret < 0 && errno != EINTR);
+
+  return ret != 0;
+}
+
 int gpio_write(gpio_sysfs_t *gpio, int value)
 {
   int ret = 0;
 
+  if (value == gpio->level) {
+    return 0;
+  }
+
   if (value == 1) {
     ret = (int)write(gpio->value_fd, "1", strlen("1"));
   } else if (value == 0) {
@@ -207,6 +236,8 @@ int gpio_write(gpio_sysfs_t *gpio, int value)
 
   FATAL_SYSCALL_ON(ret != 1);
 
+  gpio->level = value;
+
   return ret;
 }
 
@@ -215,11 +246,19 @@ int gpio_read(gpio_sysfs_t *gpio)
   ssize_t ret = 0;
   char state;
 
+  if (gpio->edge == BOTH && gpio->level != -1 && !edge_pending(gpio)) {
+    return gpio->level;
+  }
+
   ret = lseek(gpio->value_fd, 0, SEEK_SET);
   FATAL_SYSCALL_ON(ret < 0);
   ret = read(gpio->value_fd, &state, 1);
   FATAL_SYSCALL_ON(ret < 0);
 
+  if (gpio->edge == BOTH) {
+    gpio->level = (state != '0');
+  }
+
   if (state == '0') {
     return 0;
   } else {
@@ -30,13 +30,20 @@
 #include <fcntl.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <signal.h>
 #include <time.h>
 #include <sys/statfs.h>
 #include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <linux/magic.h>
 
 #include "misc/logging.h"
+#include "misc/busy_poll.h"
+#include "misc/memlock.h"
 #include "server_core/epoll/epoll.h"
+#include "server_core/epoll/loop_stats.h"
+#include "server_core/core/core.h"
+#include "server_core/server/server.h"
 #include "config.h"
 #include "utils.h"
 
@@ -78,72 +85,117 @@ static void write_until_success_or_error(int fd, uint8_t* buff, size_t size)
   } while (remaining != 0);
 }
 
+/*
+ * Each thread writes its traces in a ring of its own, which only the logger
+ * thread empties: producers never wait on one another nor on the logger. The
+ * logger merges the rings by the time stamp of the records. A thread takes a
+ * ring the first time it logs, the threads that come after the last ring is
+ * taken share ring 0 under a lock.
+ */
 #define ASYNC_LOGGER_PAGE_SIZE    4096
-#define ASYNC_LOGGER_PAGE_COUNT   7
-#define ASYNC_LOGGER_BUFFER_DEPTH (ASYNC_LOGGER_PAGE_SIZE * ASYNC_LOGGER_PAGE_COUNT)
+#define ASYNC_LOGGER_PAGE_COUNT   8
+#define ASYNC_LOGGER_RING_SIZE    (ASYNC_LOGGER_PAGE_SIZE * ASYNC_LOGGER_PAGE_COUNT)
+#define ASYNC_LOGGER_MAX_PRODUCERS 16
 #define ASYNC_LOGGER_TIMEOUT_MS   100
 #define ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE ASYNC_LOGGER_PAGE_SIZE
+#define ASYNC_LOGGER_SHARED_PRODUCER 0
 
-static volatile bool gracefully_exit = false;
+/* Records are 8 bytes aligned in the ring, a record may wrap around its end */
+typedef struct {
+  uint64_t timestamp_ns;
+  uint32_t length;
+  uint32_t reserved;
+} async_logger_record_t;
+
+#define ASYNC_LOGGER_RECORD_SIZE(length) (sizeof(async_logger_record_t) + (((length) + 7u) & ~(size_t)7u))
+
+typedef struct {
+  uint8_t*        buffer;
+  size_t          head;           // Free running, only written by the producer
+  size_t          tail;           // Free running, only written by the logger thread
+  size_t          highwater_mark; // Written by the producer
+  size_t          lost_logs;      // Written by the producer
+  size_t          reported_lost_logs;
+  char            thread_name[16];
+} async_logger_producer_t;
 
 static int stats_timer_fd;
 
 typedef struct {
   FILE            *file;
   int             fd;
-  uint8_t*        buffer;
-  volatile size_t buffer_size;
-  volatile size_t buffer_head;
-  volatile size_t buffer_tail;
-  volatile size_t buffer_count;
-  size_t          highwater_mark;
-  size_t          lost_logs;
+  unsigned int    id;
+  bool            binary;  // Records are written as is, the reports go to stdout with the other traces
+  volatile bool   gracefully_exit;
+  async_logger_producer_t* producers[ASYNC_LOGGER_MAX_PRODUCERS];
+  unsigned int    producer_count;
+  pthread_mutex_t shared_producer_lock;
   pthread_cond_t  condition;
   pthread_mutex_t mutex;
   struct timespec timeout;
   const char*     name;
 } async_logger_t;
 
+#define ASYNC_LOGGER_COUNT 3
+
 static async_logger_t file_logger;
 static async_logger_t stdout_logger;
+static async_logger_t capture_logger;
+
+/* The ring of the calling thread in each logger */
+static __thread async_logger_producer_t *thread_producers[ASYNC_LOGGER_COUNT];
 
 static pthread_t file_logger_thread;
 static pthread_t stdout_logger_thread;
+static pthread_t capture_logger_thread;
 
 static epoll_private_data_t* logging_private_data;
 
 static void* async_logger_thread_func(void* param);
 
-static void async_logger_init(async_logger_t* logger, int file_descriptor, const char* name)
+static async_logger_producer_t* async_logger_producer_create(void)
+{
+  async_logger_producer_t *producer = zalloc(sizeof(async_logger_producer_t));
+  NO_LOGGING_FATAL_ON(producer == NULL);
+
+  producer->buffer = zalloc(ASYNC_LOGGER_RING_SIZE);
+  NO_LOGGING_FATAL_ON(producer->buffer == NULL);
+
+  /* Lock the ring in RAM to prevent page faults on the logging path, if the
+   * memlock limit allows it */
+  (void)mlock(producer->buffer, ASYNC_LOGGER_RING_SIZE);
+
+  pthread_getname_np(pthread_self(), producer->thread_name, sizeof(producer->thread_name));
+
+  return producer;
+}
+
+static void async_logger_init(async_logger_t* logger, int file_descriptor, const char* name, unsigned int id)
 {
   int ret;
 
   NO_LOGGING_FATAL_ON(logger == NULL);
+  NO_LOGGING_FATAL_ON(id >= ASYNC_LOGGER_COUNT);
 
   logger->fd = file_descriptor;
-  logger->buffer_size = ASYNC_LOGGER_BUFFER_DEPTH;
-  logger->buffer_head = 0;
-  logger->buffer_tail = 0;
-  logger->buffer_count = 0;
-  logger->highwater_mark = 0;
-  logger->lost_logs = 0;
+  logger->id = id;
   logger->name = name;
 
+  /* The shared ring is there from the start, the others come with their thread */
+  logger->producers[ASYNC_LOGGER_SHARED_PRODUCER] = async_logger_producer_create();
+  strncpy(logger->producers[ASYNC_LOGGER_SHARED_PRODUCER]->thread_name, "shared",
+          sizeof(logger->producers[ASYNC_LOGGER_SHARED_PRODUCER]->thread_name));
+  logger->producer_count = 1;
+
+  ret = pthread_mutex_init(&logger->shared_producer_lock, NULL);
+  NO_LOGGING_FATAL_ON(ret != 0);
+
   ret = pthread_cond_init(&logger->condition, NULL);
   NO_LOGGING_FATAL_ON(ret != 0);
 
   ret = pthread_mutex_init(&logger->mutex, NULL);
   NO_LOGGING_FATAL_ON(ret != 0);
 
-  logger->buffer = zalloc(logger->buffer_size);
-  NO_LOGGING_FATAL_ON(logger->buffer == NULL);
-
-  /* Lock the buffer in RAM since it's a long buffer and we will use it often to prevent
-   * page faults. */
-  ret = mlock(logger->buffer,
-              logger->buffer_size);
-  NO_LOGGING_FATAL_SYSCALL_ON(ret != 0);
-
   logger->timeout.tv_sec = ASYNC_LOGGER_TIMEOUT_MS / 1000;
   logger->timeout.tv_nsec = (ASYNC_LOGGER_TIMEOUT_MS % 1000) * 1000000;
 }
@@ -152,7 +204,7 @@ static void stdout_logging_init(void)
 {
   int ret;
 
-  async_logger_init(&stdout_logger, STDOUT_FILENO, "stdout");
+  async_logger_init(&stdout_logger, STDOUT_FILENO, "stdout", 0);
 
   ret = pthread_create(&stdout_logger_thread,
                        NULL,
@@ -218,48 +270,320 @@ static void file_logging_init(void)
   pthread_setname_np(file_logger_thread, "file_logger");
 }
 
+static async_logger_producer_t* async_logger_get_producer(async_logger_t* logger)
+{
+  async_logger_producer_t *producer = thread_producers[logger->id];
+  unsigned int index;
+
+  if (producer != NULL) {
+    return producer;
+  }
+
+  index = __atomic_load_n(&logger->producer_count, __ATOMIC_RELAXED);
+  do {
+    if (index >= ASYNC_LOGGER_MAX_PRODUCERS) {
+      /* Out of rings, the calling thread shares ring 0 */
+      return NULL;
+    }
+  } while (!__atomic_compare_exchange_n(&logger->producer_count, &index, index + 1,
+                                        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  producer = async_logger_producer_create();
+
+  /* The logger thread skips the slot until the ring is published */
+  __atomic_store_n(&logger->producers[index], producer, __ATOMIC_RELEASE);
+  thread_producers[logger->id] = producer;
+
+  return producer;
+}
+
+static void async_logger_ring_copy(uint8_t* ring, size_t offset, const void* data, size_t length)
+{
+  size_t position = offset % ASYNC_LOGGER_RING_SIZE;
+  size_t remaining = ASYNC_LOGGER_RING_SIZE - position;
+
+  if (remaining >= length) {
+    memcpy(&ring[position], data, length);
+  } else { /* Split write at buffer boundary */
+    memcpy(&ring[position], data, remaining);
+    memcpy(&ring[0], (const uint8_t*)data + remaining, length - remaining);
+  }
+}
+
+static void async_logger_ring_read(const uint8_t* ring, size_t offset, void* data, size_t length)
+{
+  size_t position = offset % ASYNC_LOGGER_RING_SIZE;
+  size_t remaining = ASYNC_LOGGER_RING_SIZE - position;
+
+  if (remaining >= length) {
+    memcpy(data, &ring[position], length);
+  } else { /* Split read at buffer boundary */
+    memcpy(data, &ring[position], remaining);
+    memcpy((uint8_t*)data + remaining, &ring[0], length - remaining);
+  }
+}
+
+static uint64_t async_logger_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* Returns the bytes waiting in the ring once the record is pushed, 0 if it was lost */
+static size_t async_logger_producer_push(async_logger_producer_t* producer,
+                                         const struct iovec* iov, size_t iovcnt,
+                                         size_t length, uint64_t timestamp_ns)
+{
+  async_logger_record_t record;
+  size_t tail = __atomic_load_n(&producer->tail, __ATOMIC_ACQUIRE);
+  size_t head = producer->head;
+  size_t offset;
+  size_t count;
+
+  if (ASYNC_LOGGER_RING_SIZE - (head - tail) < ASYNC_LOGGER_RECORD_SIZE(length)) {
+    /* Overflowing traces are discarded, the logger thread reports it */
+    __atomic_store_n(&producer->lost_logs, producer->lost_logs + 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  record.timestamp_ns = timestamp_ns;
+  record.length = (uint32_t)length;
+  record.reserved = 0;
+
+  async_logger_ring_copy(producer->buffer, head, &record, sizeof(record));
+  offset = head + sizeof(record);
+  for (size_t i = 0; i < iovcnt; i++) {
+    async_logger_ring_copy(producer->buffer, offset, iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
+  }
+
+  head += ASYNC_LOGGER_RECORD_SIZE(length);
+  __atomic_store_n(&producer->head, head, __ATOMIC_RELEASE);
+
+  count = head - tail;
+  if (count > producer->highwater_mark) {
+    producer->highwater_mark = count;
+  }
+
+  return count;
+}
+
+static void async_logger_writev(async_logger_t* logger, const struct iovec* iov, size_t iovcnt, uint64_t timestamp_ns)
+{
+  async_logger_producer_t* producer = async_logger_get_producer(logger);
+  size_t length = 0;
+  size_t count;
+
+  for (size_t i = 0; i < iovcnt; i++) {
+    length += iov[i].iov_len;
+  }
+
+  if (producer != NULL) {
+    count = async_logger_producer_push(producer, iov, iovcnt, length, timestamp_ns);
+  } else {
+    pthread_mutex_lock(&logger->shared_producer_lock);
+    count = async_logger_producer_push(logger->producers[ASYNC_LOGGER_SHARED_PRODUCER], iov, iovcnt, length, timestamp_ns);
+    pthread_mutex_unlock(&logger->shared_producer_lock);
+  }
+
+  /* Don't wake up the logger thread until sufficient data is present.
+   * It will wake up at regular interval anyway to keep stdout traces (in a
+   * terminal for example) fluid. */
+  if (count >= ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE
+      && count - ASYNC_LOGGER_RECORD_SIZE(length) < ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE) {
+    pthread_cond_signal(&logger->condition);
+  }
+}
+
 static void async_logger_write(async_logger_t* logger, void* data, size_t length)
 {
-  bool do_signal = false;
-  size_t count_cpy;
+  struct iovec iov = { .iov_base = data, .iov_len = length };
 
-  pthread_mutex_lock(&logger->mutex);
-  {
-    if (logger->buffer_size - logger->buffer_count < length) {
-      /* Overflowing traces are discarded */
-      fprintf(stderr, "WARNING : %s logger buffer full, lost log.\n", logger->name);
-      logger->lost_logs++;
-    } else {
-      size_t remaining = logger->buffer_size - logger->buffer_head;
-
-      if (remaining >= length) {
-        memcpy(&logger->buffer[logger->buffer_head], data, length);
-        logger->buffer_head += length;
-      } else { /* Split write at buffer boundary */
-        memcpy(&logger->buffer[logger->buffer_head], data, remaining);
-        memcpy(&logger->buffer[0], data + remaining, length - remaining);
-        logger->buffer_head = length - remaining;
+  async_logger_writev(logger, &iov, 1, async_logger_now_ns());
+}
+
+static size_t async_logger_pending_bytes(async_logger_t* logger)
+{
+  unsigned int count = __atomic_load_n(&logger->producer_count, __ATOMIC_RELAXED);
+  size_t pending = 0;
+
+  for (unsigned int i = 0; i < count && i < ASYNC_LOGGER_MAX_PRODUCERS; i++) {
+    async_logger_producer_t* producer = __atomic_load_n(&logger->producers[i], __ATOMIC_ACQUIRE);
+
+    if (producer != NULL) {
+      pending += __atomic_load_n(&producer->head, __ATOMIC_ACQUIRE) - producer->tail;
+    }
+  }
+
+  return pending;
+}
+
+typedef struct {
+  uint8_t data[4 * ASYNC_LOGGER_PAGE_SIZE];
+  size_t  length;
+} async_logger_output_t;
+
+static void async_logger_flush(async_logger_t* logger, const uint8_t* data, size_t length)
+{
+  size_t written = 0;
+
+  if (!logger->binary) {
+    write_until_success_or_error(logger->fd, (uint8_t*)data, length);
+    return;
+  }
+
+  /* The capture stops on an error, a named pipe whose reader went away for instance */
+  while (logger->fd >= 0 && written < length) {
+    ssize_t ret = write(logger->fd, &data[written], length - written);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      TRACE_WARN("Frame capture stopped : %s\n", strerror(errno));
+      close(logger->fd);
+      logger->fd = -1;
+    } else {
+      written += (size_t)ret;
+    }
+  }
+}
+
+static void async_logger_output(async_logger_t* logger, async_logger_output_t* output, const void* data, size_t length)
+{
+  if (output->length + length > sizeof(output->data)) {
+    async_logger_flush(logger, output->data, output->length);
+    output->length = 0;
+  }
 
-      logger->buffer_count += length;
+  if (length > sizeof(output->data)) {
+    async_logger_flush(logger, data, length);
+  } else {
+    memcpy(&output->data[output->length], data, length);
+    output->length += length;
+  }
+}
+
+/*
+ * Write the records published so far, oldest first across the rings. A
+ * record published during the drain waits for the next one.
+ */
+static void async_logger_drain(async_logger_t* logger, async_logger_output_t* output)
+{
+  async_logger_producer_t* producers[ASYNC_LOGGER_MAX_PRODUCERS];
+  size_t heads[ASYNC_LOGGER_MAX_PRODUCERS];
+  unsigned int producer_count = 0;
+  unsigned int count = __atomic_load_n(&logger->producer_count, __ATOMIC_RELAXED);
+
+  for (unsigned int i = 0; i < count && i < ASYNC_LOGGER_MAX_PRODUCERS; i++) {
+    async_logger_producer_t* producer = __atomic_load_n(&logger->producers[i], __ATOMIC_ACQUIRE);
+
+    if (producer == NULL) {
+      continue;
+    }
 
-      /* Register the high water mark */
-      if (logger->buffer_count > logger->highwater_mark) {
-        logger->highwater_mark = logger->buffer_count;
+    size_t lost_logs = __atomic_load_n(&producer->lost_logs, __ATOMIC_RELAXED);
+    if (lost_logs != producer->reported_lost_logs && logger->binary) {
+      TRACE_WARN("%s logger buffer of thread %s full, lost %zu records.\n",
+                 logger->name,
+                 producer->thread_name,
+                 lost_logs - producer->reported_lost_logs);
+      producer->reported_lost_logs = lost_logs;
+    } else if (lost_logs != producer->reported_lost_logs) {
+      char buf[128];
+      int nchars = snprintf(buf,
+                            sizeof(buf),
+                            "WARNING : %s logger buffer of thread %s full, lost %zu logs.\n",
+                            logger->name,
+                            producer->thread_name,
+                            lost_logs - producer->reported_lost_logs);
+      /* Dont check for 'nchars' overflow, we know 128 bytes was sufficient. */
+      async_logger_output(logger, output, buf, (size_t)nchars);
+      producer->reported_lost_logs = lost_logs;
+    }
+
+    producers[producer_count] = producer;
+    heads[producer_count] = __atomic_load_n(&producer->head, __ATOMIC_ACQUIRE);
+    producer_count++;
+  }
+
+  while (1) {
+    async_logger_producer_t* oldest = NULL;
+    async_logger_record_t oldest_record = { 0 };
+
+    for (unsigned int i = 0; i < producer_count; i++) {
+      async_logger_record_t record;
+
+      if (producers[i]->tail == heads[i]) {
+        continue;
       }
 
-      do_signal = true;
-      count_cpy = logger->buffer_count;
+      async_logger_ring_read(producers[i]->buffer, producers[i]->tail, &record, sizeof(record));
+      if (oldest == NULL || record.timestamp_ns < oldest_record.timestamp_ns) {
+        oldest = producers[i];
+        oldest_record = record;
+      }
+    }
+
+    if (oldest == NULL) {
+      break;
     }
+
+    /* Copy to the output buffer in at most two parts, the record may wrap around */
+    {
+      size_t offset = oldest->tail + sizeof(async_logger_record_t);
+      size_t position = offset % ASYNC_LOGGER_RING_SIZE;
+      size_t remaining = ASYNC_LOGGER_RING_SIZE - position;
+
+      if (remaining >= oldest_record.length) {
+        async_logger_output(logger, output, &oldest->buffer[position], oldest_record.length);
+      } else {
+        async_logger_output(logger, output, &oldest->buffer[position], remaining);
+        async_logger_output(logger, output, &oldest->buffer[0], oldest_record.length - remaining);
+      }
+    }
+
+    /* The producer can reuse the space */
+    __atomic_store_n(&oldest->tail, oldest->tail + ASYNC_LOGGER_RECORD_SIZE(oldest_record.length), __ATOMIC_RELEASE);
+  }
+
+  if (output->length != 0) {
+    async_logger_flush(logger, output->data, output->length);
+    output->length = 0;
   }
-  pthread_mutex_unlock(&logger->mutex);
+}
+
+static void async_logger_print_stats(async_logger_t* logger)
+{
+  unsigned int count = __atomic_load_n(&logger->producer_count, __ATOMIC_RELAXED);
 
-  if (do_signal == true) {
-    /* Don't wake up the logger thread until sufficient data is present.
-     * It will wake up at regular interval anyway to keep stdout traces (in a
-     * terminal for example) fluid. */
-    if (count_cpy >= ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE) {
-      pthread_cond_signal(&logger->condition);
+  for (unsigned int i = 0; i < count && i < ASYNC_LOGGER_MAX_PRODUCERS; i++) {
+    async_logger_producer_t* producer = __atomic_load_n(&logger->producers[i], __ATOMIC_ACQUIRE);
+    char buf[256];
+    int ret;
+
+    if (producer == NULL) {
+      continue;
+    }
+
+    ret = snprintf(buf,
+                   sizeof(buf),
+                   "%s ring of thread %s size = %u, highwater mark = %zu : %.2f%%. Lost %s : %zu\n",
+                   logger->binary ? "Capture" : "Logger",
+                   producer->thread_name,
+                   ASYNC_LOGGER_RING_SIZE,
+                   producer->highwater_mark,
+                   100.0f * ((float) producer->highwater_mark / (float) ASYNC_LOGGER_RING_SIZE),
+                   logger->binary ? "frames" : "logs",
+                   producer->lost_logs);
+    /* Dont check for 'ret' overflow, we know 256 bytes was sufficient. */
+    if (logger->binary) {
+      TRACE_FORCE_STDOUT("Info : %s", buf);
+    } else {
+      (void)write(logger->fd, buf, (size_t)ret);
     }
   }
 }
@@ -267,17 +591,17 @@ static void async_logger_write(async_logger_t* logger, void* data, size_t length
 static void* async_logger_thread_func(void* param)
 {
   async_logger_t* logger = (async_logger_t*) param;
-  size_t chunk_size;
+  static async_logger_output_t outputs[ASYNC_LOGGER_COUNT];
+  async_logger_output_t* output = &outputs[logger->id];
   ssize_t ret;
 
   while (1) {
-    /* Lock the mutex because we need to condition wait on the predicate 'buffer_count'
-     * which is altered by both the producers and this consumer */
+    /* The mutex only pairs with the condition, the producers don't take it */
     pthread_mutex_lock(&logger->mutex);
     {
       /* Wait until there is at least the preferred no-wake-up-until data amount, a timeout or
        * a graceful exit request has been sent to us. */
-      while (logger->buffer_count < ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE && gracefully_exit == false) {
+      while (async_logger_pending_bytes(logger) < ASYNC_LOGGER_DONT_TRIGG_UNLESS_THIS_CHUNK_SIZE && logger->gracefully_exit == false) {
         struct timespec max_wait;
 
         clock_gettime(CLOCK_REALTIME, &max_wait);
@@ -295,76 +619,28 @@ static void* async_logger_thread_func(void* param)
           break;
         }
       }
-
-      /* We will write as much data as we have on hand */
-      chunk_size = logger->buffer_count;
-    } /* Unlock the mutex to allow other threads to continue to write data. */
+    }
     pthread_mutex_unlock(&logger->mutex);
 
-    if (chunk_size == 0) {
-      if (gracefully_exit == true) {
-        /* Graceful exit requested and no data, kill this thread right away. */
-        char buf[256];
-        int ret;
-        ret = snprintf(buf,
-                       sizeof(buf),
-                       "Logger buffer size = %zu, highwater mark = %zu : %.2f%%. Lost logs : %zu\n",
-                       logger->buffer_size,
-                       logger->highwater_mark,
-                       100.0f * ((float) logger->highwater_mark / (float) logger->buffer_size),
-                       logger->lost_logs);
-        /* Dont check for 'ret' overflow, we know 256 bytes was sufficient. */
-        (void)write(logger->fd, buf, (size_t)ret);
-        fsync(logger->fd);
-        if (logger->fd != STDOUT_FILENO) {
-          ret = fclose(logger->file);
-          FATAL_ON(ret != 0);
+    if (logger->gracefully_exit == true) {
+      /* Graceful exit requested, write what is left and kill this thread. */
+      async_logger_drain(logger, output);
+      async_logger_print_stats(logger);
+      if (logger->binary) {
+        if (logger->fd >= 0) {
+          close(logger->fd);
         }
-        free(logger->buffer);
         pthread_exit(NULL);
-      } else {
-        /* We have timed out, and there's not even a single byte of logging data available.
-         * Skip the rest and go back to waiting for data. */
-        continue;
       }
-    }
-
-    /* Remaining bytes between the tail and end end of the circular buffer */
-    size_t remaining = logger->buffer_size - logger->buffer_tail;
-
-    /* This consumer thread is the only one manipulating the tail, so we can safely use it while the
-     * lock is not held to write a chunk of data to the file. We can safely write this chunk and take
-     * the time we want outside of the lock because as far as the producers are concerned,
-     * this chunk is still in the buffer and cannot be overridden. */
-    {
-      if (remaining >= chunk_size) {
-        write_until_success_or_error(logger->fd,
-                                     &logger->buffer[logger->buffer_tail],
-                                     chunk_size);
-      } else { /* Split write at the buffer boundary */
-        write_until_success_or_error(logger->fd,
-                                     &logger->buffer[logger->buffer_tail],
-                                     remaining);
-
-        write_until_success_or_error(logger->fd,
-                                     &logger->buffer[0],
-                                     chunk_size - remaining);
+      fsync(logger->fd);
+      if (logger->fd != STDOUT_FILENO) {
+        ret = fclose(logger->file);
+        FATAL_ON(ret != 0);
       }
+      pthread_exit(NULL);
     }
 
-    /* Now that the chunk is written, take back the lock to update the tail and decrease the
-     * count, which is the shared variable. */
-    pthread_mutex_lock(&logger->mutex);
-    {
-      if (remaining >= chunk_size) {
-        logger->buffer_tail += chunk_size;
-      } else {
-        logger->buffer_tail = chunk_size - remaining;
-      }
-
-      logger->buffer_count -= chunk_size;
-    }
-    pthread_mutex_unlock(&logger->mutex);
+    async_logger_drain(logger, output);
   }
 
   return NULL;
@@ -390,7 +666,8 @@ void logging_init(void)
    * write them later on if the config file enables it. */
   async_logger_init(&file_logger,
                     -1,  /* No file descriptor for the moment */
-                    "file");
+                    "file",
+                    1);
 }
 
 static void logging_print_stats(epoll_private_data_t *event_private_data)
@@ -420,7 +697,17 @@ static void logging_print_stats(epoll_private_data_t *event_private_data)
         "\nretxd_data_frame %u"
         "\ndriver_packet_dropped %u"
         "\ninvalid_header_checksum %u"
-        "\ninvalid_payload_checksum %u\n",
+        "\ninvalid_payload_checksum %u"
+        "\ntxd_selective_reject %u"
+        "\nrxd_out_of_order_frame_recovered %u"
+        "\nretxd_selective_data_frame %u"
+        "\nack_coalesced %u"
+        "\nack_piggybacked %u"
+        "\nserver_data_socket_wakeups %u"
+        "\nserver_datagrams_drained %u"
+        "\nserver_max_datagrams_per_wakeup %u"
+        "\nnoop_keep_alive_sent %u"
+        "\nnoop_keep_alive_suppressed %u\n",
         primary_core_debug_counters.endpoint_opened,
         primary_core_debug_counters.endpoint_closed,
         primary_core_debug_counters.rxd_frame,
@@ -434,7 +721,17 @@ static void logging_print_stats(epoll_private_data_t *event_private_data)
         primary_core_debug_counters.retxd_data_frame,
         primary_core_debug_counters.driver_packet_dropped,
         primary_core_debug_counters.invalid_header_checksum,
-        primary_core_debug_counters.invalid_payload_checksum);
+        primary_core_debug_counters.invalid_payload_checksum,
+        primary_core_debug_counters.txd_selective_reject,
+        primary_core_debug_counters.rxd_out_of_order_frame_recovered,
+        primary_core_debug_counters.retxd_selective_data_frame,
+        primary_core_debug_counters.ack_coalesced,
+        primary_core_debug_counters.ack_piggybacked,
+        primary_core_debug_counters.server_data_socket_wakeups,
+        primary_core_debug_counters.server_datagrams_drained,
+        primary_core_debug_counters.server_max_datagrams_per_wakeup,
+        primary_core_debug_counters.noop_keep_alive_sent,
+        primary_core_debug_counters.noop_keep_alive_suppressed);
 
   TRACE("RCP core debug counters"
         "\nendpoint_opened %u"
@@ -468,6 +765,13 @@ static void logging_print_stats(epoll_private_data_t *event_private_data)
         secondary_core_debug_counters.invalid_header_checksum,
         secondary_core_debug_counters.invalid_payload_checksum);
 
+  core_print_buffer_pool_stats();
+  memlock_print_stats();
+  core_print_transmit_queue_stats();
+  server_print_client_backlog_stats();
+  loop_stats_print();
+  busy_poll_print_stats();
+
 #ifndef UNIT_TESTING
   if (config.bus == UART) {
     driver_uart_print_overruns();
@@ -497,27 +801,286 @@ void init_stats_logging(void)
     FATAL_ON(logging_private_data == NULL);
 
     logging_private_data->callback = logging_print_stats;
+    logging_private_data->callback_type = EPOLL_CALLBACK_STATS;
     logging_private_data->file_descriptor = stats_timer_fd;
 
     epoll_register(logging_private_data);
   }
 }
 
+void logging_update_stats_interval(void)
+{
+  struct itimerspec timeout_time = { .it_interval = { .tv_sec = config.stats_interval, .tv_nsec = 0 },
+                                     .it_value    = { .tv_sec = config.stats_interval, .tv_nsec = 0 } };
+  int ret;
+
+  if (logging_private_data == NULL) {
+    return;
+  }
+
+  ret = timerfd_settime(logging_private_data->file_descriptor,
+                        0,
+                        &timeout_time,
+                        NULL);
+
+  FATAL_SYSCALL_ON(ret < 0);
+}
+
 void init_file_logging()
 {
   file_logging_init();
 }
 
+/*
+ * The frames are captured in the pcapng format: a section header block, the
+ * description of a single interface, then an enhanced packet block per frame.
+ * Each block is built by the thread capturing the frame and written as is.
+ */
+#define PCAPNG_BLOCK_TYPE_SHB        0x0A0D0D0Au
+#define PCAPNG_BLOCK_TYPE_IDB        0x00000001u
+#define PCAPNG_BLOCK_TYPE_EPB        0x00000006u
+#define PCAPNG_BYTE_ORDER_MAGIC      0x1A2B3C4Du
+#define PCAPNG_LINKTYPE_USER0        147u
+#define PCAPNG_OPT_ENDOFOPT          0u
+#define PCAPNG_OPT_COMMENT           1u
+#define PCAPNG_OPT_IF_NAME           2u
+#define PCAPNG_OPT_IF_TSRESOL        9u
+#define PCAPNG_OPT_IF_TSOFFSET       14u
+#define PCAPNG_OPT_EPB_FLAGS         2u
+#define PCAPNG_EPB_FLAGS_INBOUND     0x1u
+#define PCAPNG_EPB_FLAGS_OUTBOUND    0x2u
+#define PCAPNG_PAD_TO_4_BYTES(x)     (((x) + 3u) & ~(size_t)3u)
+
+/* How often the capture thread checks for a reader on a named pipe */
+#define FRAME_CAPTURE_OPEN_RETRY_MS  100
+
+typedef struct {
+  uint32_t block_type;
+  uint32_t block_length;
+  uint32_t interface_id;
+  uint32_t timestamp_high;
+  uint32_t timestamp_low;
+  uint32_t captured_length;
+  uint32_t original_length;
+} pcapng_epb_header_t;
+
+typedef struct {
+  uint8_t  padding[3];
+  uint8_t  options[8 + 4];  // epb_flags, opt_endofopt
+  uint32_t block_length;
+} pcapng_epb_trailer_t;
+
+static size_t pcapng_put_option(uint8_t *buffer, uint16_t code, const void *value, uint16_t length)
+{
+  memcpy(&buffer[0], &code, sizeof(code));
+  memcpy(&buffer[2], &length, sizeof(length));
+  if (length != 0) {
+    memcpy(&buffer[4], value, length);
+  }
+  memset(&buffer[4 + length], 0, PCAPNG_PAD_TO_4_BYTES(length) - length);
+
+  return 4 + PCAPNG_PAD_TO_4_BYTES(length);
+}
+
+static size_t pcapng_put_u32(uint8_t *buffer, uint32_t value)
+{
+  memcpy(buffer, &value, sizeof(value));
+
+  return sizeof(value);
+}
+
+size_t trace_pcapng_headers(uint8_t *buffer)
+{
+  size_t length = 0;
+  size_t block_start;
+  struct timespec realtime;
+  struct timespec monotonic;
+  int64_t tsoffset;
+  const uint8_t tsresol = 9; // Nanoseconds
+  const int64_t section_length = -1;
+
+  /* Section header block */
+  length += pcapng_put_u32(&buffer[length], PCAPNG_BLOCK_TYPE_SHB);
+  length += pcapng_put_u32(&buffer[length], 28);
+  length += pcapng_put_u32(&buffer[length], PCAPNG_BYTE_ORDER_MAGIC);
+  length += pcapng_put_u32(&buffer[length], 1u); // Major 1, minor 0
+  memcpy(&buffer[length], &section_length, sizeof(section_length));
+  length += sizeof(section_length);
+  length += pcapng_put_u32(&buffer[length], 28);
+
+  /* Interface description block, the time stamps are monotonic and the offset
+   * at the time of capture gives the wall clock */
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  clock_gettime(CLOCK_MONOTONIC, &monotonic);
+  tsoffset = (int64_t)realtime.tv_sec - (int64_t)monotonic.tv_sec;
+
+  block_start = length;
+  length += pcapng_put_u32(&buffer[length], PCAPNG_BLOCK_TYPE_IDB);
+  length += pcapng_put_u32(&buffer[length], 0); // Set below
+  length += pcapng_put_u32(&buffer[length], PCAPNG_LINKTYPE_USER0); // Reserved 16 bits are 0
+  length += pcapng_put_u32(&buffer[length], 0); // No snap length
+  length += pcapng_put_option(&buffer[length], PCAPNG_OPT_IF_NAME, config.instance_name, (uint16_t)strnlen(config.instance_name, 32));
+  length += pcapng_put_option(&buffer[length], PCAPNG_OPT_IF_TSRESOL, &tsresol, sizeof(tsresol));
+  length += pcapng_put_option(&buffer[length], PCAPNG_OPT_IF_TSOFFSET, &tsoffset, sizeof(tsoffset));
+  length += pcapng_put_option(&buffer[length], PCAPNG_OPT_ENDOFOPT, NULL, 0);
+  length += pcapng_put_u32(&buffer[length], (uint32_t)(length - block_start + 4));
+  pcapng_put_u32(&buffer[block_start + 4], (uint32_t)(length - block_start));
+
+  return length;
+}
+
+size_t trace_pcapng_packet(uint8_t *buffer, bool outbound, uint64_t timestamp_ns,
+                           const void *data, size_t captured_length, size_t original_length,
+                           const char *comment)
+{
+  uint32_t flags = outbound ? PCAPNG_EPB_FLAGS_OUTBOUND : PCAPNG_EPB_FLAGS_INBOUND;
+  size_t length = 0;
+
+  BUG_ON(captured_length > 64);
+
+  length += pcapng_put_u32(&buffer[length], PCAPNG_BLOCK_TYPE_EPB);
+  length += pcapng_put_u32(&buffer[length], 0); // Set below
+  length += pcapng_put_u32(&buffer[length], 0); // Interface
+  length += pcapng_put_u32(&buffer[length], (uint32_t)(timestamp_ns >> 32));
+  length += pcapng_put_u32(&buffer[length], (uint32_t)timestamp_ns);
+  length += pcapng_put_u32(&buffer[length], (uint32_t)captured_length);
+  length += pcapng_put_u32(&buffer[length], (uint32_t)original_length);
+  if (captured_length != 0) {
+    memcpy(&buffer[length], data, captured_length);
+  }
+  memset(&buffer[length + captured_length], 0, PCAPNG_PAD_TO_4_BYTES(captured_length) - captured_length);
+  length += PCAPNG_PAD_TO_4_BYTES(captured_length);
+
+  if (comment != NULL) {
+    length += pcapng_put_option(&buffer[length], PCAPNG_OPT_COMMENT, comment, (uint16_t)strnlen(comment, 64));
+  } else {
+    length += pcapng_put_option(&buffer[length], PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+  }
+  length += pcapng_put_option(&buffer[length], PCAPNG_OPT_ENDOFOPT, NULL, 0);
+  length += pcapng_put_u32(&buffer[length], (uint32_t)(length + 4));
+  pcapng_put_u32(&buffer[4], (uint32_t)length);
+
+  return length;
+}
+
+static bool frame_capture_write_headers(void)
+{
+  uint8_t buffer[TRACE_PCAPNG_BLOCK_MAX_SIZE];
+
+  async_logger_flush(&capture_logger, buffer, trace_pcapng_headers(buffer));
+
+  return capture_logger.fd >= 0;
+}
+
+static void* frame_capture_thread_func(void* param)
+{
+  sigset_t sigpipe;
+  int fd;
+
+  /* A reader going away is reported by write() rather than by a SIGPIPE to the daemon */
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+  /* Opening a named pipe waits for a reader, poll for one so that the daemon can exit meanwhile */
+  while (1) {
+    fd = open(config.frame_capture_file, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0600);
+    if (fd >= 0 || errno != ENXIO || capture_logger.gracefully_exit) {
+      break;
+    }
+    usleep(FRAME_CAPTURE_OPEN_RETRY_MS * 1000);
+  }
+
+  if (fd < 0) {
+    if (!capture_logger.gracefully_exit) {
+      TRACE_WARN("Cannot capture frames to %s : %s\n", config.frame_capture_file, strerror(errno));
+    }
+  } else {
+    NO_LOGGING_FATAL_SYSCALL_ON(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) < 0);
+    capture_logger.fd = fd;
+    if (frame_capture_write_headers()) {
+      PRINT_INFO("Capturing frames to %s.", config.frame_capture_file);
+    }
+  }
+
+  return async_logger_thread_func(param);
+}
+
+void init_frame_capture(void)
+{
+  int ret;
+
+  async_logger_init(&capture_logger, -1, "capture", 2);
+  capture_logger.binary = true;
+
+  ret = pthread_create(&capture_logger_thread,
+                       NULL,
+                       frame_capture_thread_func,
+                       &capture_logger);
+  NO_LOGGING_FATAL_ON(ret != 0);
+
+  pthread_setname_np(capture_logger_thread, "frame_capture");
+}
+
+void trace_capture_frame(bool outbound, const void* buffer, size_t len)
+{
+  pcapng_epb_header_t header;
+  pcapng_epb_trailer_t trailer;
+  struct iovec iov[3];
+  uint64_t timestamp_ns;
+  uint32_t flags = outbound ? PCAPNG_EPB_FLAGS_OUTBOUND : PCAPNG_EPB_FLAGS_INBOUND;
+  size_t padding = PCAPNG_PAD_TO_4_BYTES(len) - len;
+  size_t options_length = 0;
+
+  if (config.frame_capture_file == NULL) {
+    return;
+  }
+
+  timestamp_ns = async_logger_now_ns();
+
+  options_length += pcapng_put_option(&trailer.options[options_length], PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+  options_length += pcapng_put_option(&trailer.options[options_length], PCAPNG_OPT_ENDOFOPT, NULL, 0);
+
+  header.block_type = PCAPNG_BLOCK_TYPE_EPB;
+  header.block_length = (uint32_t)(sizeof(header) + len + padding + options_length + sizeof(uint32_t));
+  header.interface_id = 0;
+  header.timestamp_high = (uint32_t)(timestamp_ns >> 32);
+  header.timestamp_low = (uint32_t)timestamp_ns;
+  header.captured_length = (uint32_t)len;
+  header.original_length = (uint32_t)len;
+
+  /* The padding and the options are contiguous, the block length follows them */
+  memset(trailer.padding, 0, sizeof(trailer.padding));
+  memmove(&trailer.padding[padding], trailer.options, options_length);
+  memcpy(&trailer.padding[padding + options_length], &header.block_length, sizeof(uint32_t));
+
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)buffer;
+  iov[1].iov_len = len;
+  iov[2].iov_base = trailer.padding;
+  iov[2].iov_len = padding + options_length + sizeof(uint32_t);
+
+  async_logger_writev(&capture_logger, iov, 3, timestamp_ns);
+}
+
 void logging_kill(void)
 {
   /* Note we don't cancel the threads, we let them finish */
 
-  gracefully_exit = true;
+  /* The capture reports to stdout, it goes first */
+  if (config.frame_capture_file != NULL) {
+    capture_logger.gracefully_exit = true;
+    pthread_cond_signal(&capture_logger.condition);
+    pthread_join(capture_logger_thread, NULL);
+  }
 
+  stdout_logger.gracefully_exit = true;
   pthread_cond_signal(&stdout_logger.condition);
   pthread_join(stdout_logger_thread, NULL);
 
   if (config.file_tracing) {
+    file_logger.gracefully_exit = true;
     pthread_cond_signal(&file_logger.condition);
     pthread_join(file_logger_thread, NULL);
   }
@@ -555,6 +1118,88 @@ static size_t get_time_string(char* time_string, size_t time_string_size)
   return nchar;
 }
 
+/* Everything is traced until the configuration is known, as the early traces always were */
+uint32_t trace_masks[CPC_TRACE_LEVEL_COUNT] = { TRACE_MASK_ALL, TRACE_MASK_ALL };
+
+static const char *const trace_subsystem_names[CPC_TRACE_SUBSYSTEM_COUNT] = {
+  [CPC_TRACE_SUBSYSTEM_MISC] = "misc",
+  [CPC_TRACE_SUBSYSTEM_CORE] = "core",
+  [CPC_TRACE_SUBSYSTEM_DRIVER] = "driver",
+  [CPC_TRACE_SUBSYSTEM_SERVER] = "server",
+  [CPC_TRACE_SUBSYSTEM_SECURITY] = "security",
+  [CPC_TRACE_SUBSYSTEM_SYSTEM] = "system",
+  [CPC_TRACE_SUBSYSTEM_RESET] = "reset",
+  [CPC_TRACE_SUBSYSTEM_GPIO] = "gpio",
+  [CPC_TRACE_SUBSYSTEM_XMODEM] = "xmodem",
+  [CPC_TRACE_SUBSYSTEM_EZSP_SPI] = "ezsp_spi",
+  [CPC_TRACE_SUBSYSTEM_UART_VALIDATION] = "uart_validation",
+  [CPC_TRACE_SUBSYSTEM_LIB] = "lib",
+  [CPC_TRACE_SUBSYSTEM_FIRMWARE_UPLOAD] = "firmware_upload",
+};
+
+uint32_t logging_set_trace_mask(cpc_trace_level_t level, uint32_t mask)
+{
+  BUG_ON(level >= CPC_TRACE_LEVEL_COUNT);
+
+  return __atomic_exchange_n(&trace_masks[level], mask & TRACE_MASK_ALL, __ATOMIC_RELAXED);
+}
+
+void logging_update_trace_masks(void)
+{
+  bool tracing = config.stdout_tracing || config.file_tracing || config.lttng_tracing;
+  uint32_t debug_mask = tracing ? config.trace_mask : 0;
+  uint32_t frame_mask = 0;
+
+  /* trace_frame() doesn't go to LTTng */
+  if ((config.stdout_tracing || config.file_tracing) && config.enable_frame_trace) {
+    frame_mask = config.frame_trace_mask;
+  }
+
+  logging_set_trace_mask(CPC_TRACE_LEVEL_DEBUG, debug_mask);
+  logging_set_trace_mask(CPC_TRACE_LEVEL_FRAME, frame_mask);
+}
+
+bool logging_parse_trace_mask(const char *list, uint32_t *mask)
+{
+  const char *name = list;
+  uint32_t parsed = 0;
+
+  if (0 == strcmp(list, "all")) {
+    *mask = TRACE_MASK_ALL;
+    return true;
+  }
+
+  if (0 == strcmp(list, "none")) {
+    *mask = 0;
+    return true;
+  }
+
+  while (*name != '\0') {
+    size_t len = strcspn(name, ",");
+    size_t i;
+
+    for (i = 0; i < CPC_TRACE_SUBSYSTEM_COUNT; i++) {
+      if (strlen(trace_subsystem_names[i]) == len
+          && 0 == strncmp(name, trace_subsystem_names[i], len)) {
+        parsed |= 1u << i;
+        break;
+      }
+    }
+
+    if (i == CPC_TRACE_SUBSYSTEM_COUNT) {
+      return false;
+    }
+
+    name += len;
+    if (*name == ',') {
+      name++;
+    }
+  }
+
+  *mask = parsed;
+  return true;
+}
+
 void trace(const bool force_stdout, const char* string, ...)
 {
   char log_string[512];
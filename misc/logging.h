@@ -24,6 +24,9 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include "lib/sl_cpc.h"
+#include "misc/flight_recorder.h"
+
 /// Struct representing CPC Core debug counters.
 typedef struct {
   uint32_t endpoint_opened;
@@ -41,6 +44,16 @@ typedef struct {
   uint32_t driver_packet_dropped;
   uint32_t invalid_header_checksum;
   uint32_t invalid_payload_checksum;
+  uint32_t txd_selective_reject;
+  uint32_t rxd_out_of_order_frame_recovered;
+  uint32_t retxd_selective_data_frame;
+  uint32_t ack_coalesced;
+  uint32_t ack_piggybacked;
+  uint32_t server_data_socket_wakeups;
+  uint32_t server_datagrams_drained;
+  uint32_t server_max_datagrams_per_wakeup;
+  uint32_t noop_keep_alive_sent;
+  uint32_t noop_keep_alive_suppressed;
 } core_debug_counters_t;
 
 void logging_init(void);
@@ -49,6 +62,9 @@ void init_file_logging();
 
 void init_stats_logging(void);
 
+/* Re-arm the statistics timer once config.stats_interval changed */
+void logging_update_stats_interval(void);
+
 void logging_kill(void);
 
 void trace(const bool force_stdout, const char* string, ...);
@@ -57,8 +73,49 @@ void trace_no_timestamp(const char* string, ...);
 
 void trace_frame(const char* string, const void* buffer, size_t len);
 
+void init_frame_capture(void);
+
+/* Record a frame exchanged with the secondary in the capture file, if any */
+void trace_capture_frame(bool outbound, const void* buffer, size_t len);
+
+/*
+ * The blocks of the capture file, for the files written in one go: the section
+ * header and the interface description, then an enhanced packet block per
+ * packet. A packet keeps 64 bytes and a comment 64 characters at most, each
+ * call writes TRACE_PCAPNG_BLOCK_MAX_SIZE bytes at most and returns the count.
+ */
+#define TRACE_PCAPNG_BLOCK_MAX_SIZE 192
+
+size_t trace_pcapng_headers(uint8_t *buffer);
+
+size_t trace_pcapng_packet(uint8_t *buffer, bool outbound, uint64_t timestamp_ns,
+                           const void *data, size_t captured_length, size_t original_length,
+                           const char *comment);
+
 void logging_driver_print_stats(void);
 
+/*
+ * Bit i of trace_masks[level] enables the traces of subsystem i at that level.
+ * They are the masks of the configuration, or 0 when there is nowhere to trace
+ * to, so that a disabled trace costs a load and a branch, its arguments are not
+ * evaluated. Written by the server core thread, read by every thread.
+ */
+extern uint32_t trace_masks[CPC_TRACE_LEVEL_COUNT];
+
+#define TRACE_MASK_ALL ((1u << CPC_TRACE_SUBSYSTEM_COUNT) - 1u)
+
+#define TRACE_IS_ENABLED(subsystem, level) \
+  __builtin_expect((__atomic_load_n(&trace_masks[level], __ATOMIC_RELAXED) & (1u << (subsystem))) != 0, 0)
+
+/* Change the mask of a level at runtime, returns the previous one */
+uint32_t logging_set_trace_mask(cpc_trace_level_t level, uint32_t mask);
+
+/* Apply the masks of the configuration, once the tracing options are known */
+void logging_update_trace_masks(void);
+
+/* Parse a comma separated list of subsystems, or 'all' or 'none' */
+bool logging_parse_trace_mask(const char *list, uint32_t *mask);
+
 extern core_debug_counters_t primary_core_debug_counters;
 extern core_debug_counters_t secondary_core_debug_counters;
 
@@ -72,51 +129,79 @@ extern core_debug_counters_t secondary_core_debug_counters;
 #define LTTNG_TRACE(string, ...) (void)0
 #endif
 
-#define TRACE(string, ...)                    do { LTTNG_TRACE(string, ##__VA_ARGS__); trace(false, string, ##__VA_ARGS__); } while (0)
+#define TRACE_SUBSYSTEM(subsystem, string, ...)                            \
+  do {                                                                     \
+    if (TRACE_IS_ENABLED(subsystem, CPC_TRACE_LEVEL_DEBUG)) {              \
+      LTTNG_TRACE(string, ##__VA_ARGS__); trace(false, string, ##__VA_ARGS__); \
+    }                                                                      \
+  } while (0)
+
+#define TRACE(string, ...)                    TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_MISC, string, ##__VA_ARGS__)
 
 #define TRACE_FORCE_STDOUT(string, ...)       do { LTTNG_TRACE(string, ##__VA_ARGS__); trace(true, string, ##__VA_ARGS__); } while (0)
 
 #define PRINT_INFO(string, ...)       TRACE_FORCE_STDOUT("Info : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_DRIVER(string, ...)     TRACE("Driver : "  string "\n", ##__VA_ARGS__)
+#define TRACE_DRIVER(string, ...)     TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_DRIVER, "Driver : "  string "\n", ##__VA_ARGS__)
+
+#define TRACE_GPIOD(string, ...)      TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_GPIO, "Gpiod : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_GPIOD(string, ...)      TRACE("Gpiod : "  string "\n", ##__VA_ARGS__)
+#define TRACE_CORE(string, ...)       TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_CORE, "Core : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_CORE(string, ...)       TRACE("Core : "  string "\n", ##__VA_ARGS__)
+#define TRACE_CORE_EVENT(event, string, ...)       do { EVENT_COUNTER_INC(event); TRACE_CORE(string, ##__VA_ARGS__); } while (0)
 
-#define TRACE_CORE_EVENT(event, string, ...)       do { EVENT_COUNTER_INC(event); TRACE("Core : "  string "\n", ##__VA_ARGS__); } while (0)
+#define TRACE_SECURITY(string, ...)   TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_SECURITY, "Security : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_SECURITY(string, ...)   TRACE("Security : "  string "\n", ##__VA_ARGS__)
+#define TRACE_SERVER(string, ...)     TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_SERVER, "Server : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_SERVER(string, ...)     TRACE("Server : "  string "\n", ##__VA_ARGS__)
+#define TRACE_SYSTEM(string, ...)     TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_SYSTEM, "System : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_SYSTEM(string, ...)     TRACE("System : "  string "\n", ##__VA_ARGS__)
+#define TRACE_UART_VALIDATION(string, ...)     TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_UART_VALIDATION, "UART VALIDATION : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_UART_VALIDATION(string, ...)     TRACE("UART VALIDATION : "  string "\n", ##__VA_ARGS__)
+#define TRACE_RESET(string, ...)      TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_RESET, "Reset Sequence : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_RESET(string, ...)      TRACE("Reset Sequence : "  string "\n", ##__VA_ARGS__)
+#define TRACE_XMODEM(string, ...)     TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_XMODEM, "XMODEM : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_XMODEM(string, ...)     TRACE("XMODEM : "  string "\n", ##__VA_ARGS__)
+#define TRACE_EZSP_SPI(string, ...)   TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_EZSP_SPI, "EZSPI-SPI : "  string "\n", ##__VA_ARGS__)
 
-#define TRACE_EZSP_SPI(string, ...)   TRACE("EZSPI-SPI : "  string "\n", ##__VA_ARGS__)
+#define TRACE_FIRMWARE_UPLOAD(string, ...)   TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_FIRMWARE_UPLOAD, "Firmware upload : "  string "\n", ##__VA_ARGS__)
 
-#define trace_lib(string, ...)        TRACE("Lib : "  string "\n", ##__VA_ARGS__)
+#define trace_lib(string, ...)        TRACE_SUBSYSTEM(CPC_TRACE_SUBSYSTEM_LIB, "Lib : "  string "\n", ##__VA_ARGS__)
 
 #define TRACE_ASSERT(string, ...)     TRACE_FORCE_STDOUT("*** ASSERT *** : " string, ##__VA_ARGS__)
 
 #define TRACE_WARN(string, ...)       TRACE_FORCE_STDOUT("WARNING : " string, ##__VA_ARGS__)
 
-#define TRACE_FRAME(string, buffer, length) trace_frame(string, buffer, length)
+#define TRACE_FRAME(subsystem, string, buffer, length)                 \
+  do {                                                               \
+    if (TRACE_IS_ENABLED(subsystem, CPC_TRACE_LEVEL_FRAME)) {        \
+      trace_frame(string, buffer, length);                           \
+    }                                                                \
+  } while (0)
+
+#define TRACE_CORE_FRAME(string, buffer, length)            TRACE_FRAME(CPC_TRACE_SUBSYSTEM_CORE, "Core : " string, buffer, length)
 
-#define TRACE_SERVER_RXD_FRAME(buffer, len)                 TRACE_FRAME("Server : rxd frame : ", buffer, len)
+#define TRACE_DRIVER_FRAME(string, buffer, length)          TRACE_FRAME(CPC_TRACE_SUBSYSTEM_DRIVER, "Driver : " string, buffer, length)
 
-#define TRACE_SERVER_TXD_FRAME(buffer, len)                 TRACE_FRAME("Server : txd frame : ", buffer, len)
+#define TRACE_SERVER_RXD_FRAME(buffer, len)                 TRACE_FRAME(CPC_TRACE_SUBSYSTEM_SERVER, "Server : rxd frame : ", buffer, len)
+
+#define TRACE_SERVER_TXD_FRAME(buffer, len)                 TRACE_FRAME(CPC_TRACE_SUBSYSTEM_SERVER, "Server : txd frame : ", buffer, len)
+
+#define TRACE_SERVER_DATAGRAMS_DRAINED(ep_id, count)                                                             \
+  do {                                                                                                          \
+    primary_core_debug_counters.server_data_socket_wakeups++;                                                   \
+    primary_core_debug_counters.server_datagrams_drained += (uint32_t)(count);                                  \
+    if ((uint32_t)(count) > primary_core_debug_counters.server_max_datagrams_per_wakeup) {                      \
+      primary_core_debug_counters.server_max_datagrams_per_wakeup = (uint32_t)(count);                          \
+    }                                                                                                           \
+    TRACE_SERVER("Drained %d datagrams from a data socket of ep#%u", (int)(count), ep_id);                       \
+  } while (0)
 
 #define TRACE_CORE_OPEN_ENDPOINT(ep_id)                      TRACE_CORE_EVENT(endpoint_opened, "open ep #%u", ep_id)
 
 #define TRACE_CORE_CLOSE_ENDPOINT(ep_id)                     TRACE_CORE_EVENT(endpoint_closed, "close ep #%u", ep_id)
 
-#define TRACE_CORE_RXD_FRAME(buffer, len)                 do { EVENT_COUNTER_INC(rxd_frame); TRACE_FRAME("Core : rxd frame : ", buffer, len); } while (0)
+#define TRACE_CORE_RXD_FRAME(buffer, len)                 do { EVENT_COUNTER_INC(rxd_frame); trace_capture_frame(false, buffer, len); flight_recorder_frame(false, buffer, len); TRACE_CORE_FRAME("rxd frame : ", buffer, len); } while (0)
 
 #define TRACE_CORE_RXD_VALID_IFRAME()                     TRACE_CORE_EVENT(rxd_valid_iframe, "rxd iframe with valid header checksum")
 
@@ -134,7 +219,7 @@ extern core_debug_counters_t secondary_core_debug_counters;
 
 #define TRACE_CORE_DRIVER_PACKET_DROPPED()                TRACE_CORE("driver packed dropped")
 
-#define TRACE_CORE_INVALID_HEADER_CHECKSUM()              TRACE_CORE_EVENT(invalid_header_checksum, "invalid header checksum")
+#define TRACE_CORE_INVALID_HEADER_CHECKSUM()              do { flight_recorder_event(FLIGHT_RECORDER_INVALID_HEADER_CHECKSUM, 0xFF, 0, 0); TRACE_CORE_EVENT(invalid_header_checksum, "invalid header checksum"); } while (0)
 
 #define TRACE_CORE_INVALID_PAYLOAD_CHECKSUM()              TRACE_CORE_EVENT(invalid_payload_checksum, "invalid payload checksum")
 
@@ -162,6 +247,12 @@ extern core_debug_counters_t secondary_core_debug_counters;
 
 #define TRACE_ENDPOINT_RXD_DUPLICATE_DATA_FRAME(ep)       TRACE_CORE("Endpoint #%u: rxd duplicate data frame", ep->id)
 
+#define TRACE_ENDPOINT_RXD_OUT_OF_ORDER_DATA_FRAME(ep)    TRACE_CORE("Endpoint #%u: rxd out of order data frame", ep->id)
+
+#define TRACE_ENDPOINT_RXD_OUT_OF_ORDER_RECOVERED(ep)     do { EVENT_COUNTER_INC(rxd_out_of_order_frame_recovered); TRACE_CORE("Endpoint #%u: rxd out of order data frame recovered", ep->id); } while (0)
+
+#define TRACE_ENDPOINT_RXD_SELECTIVE_REJECT(ep, seq)      TRACE_CORE("Endpoint #%u: rxd selective reject %u", ep->id, seq)
+
 #define TRACE_ENDPOINT_RXD_ACK(ep, ack)                        TRACE_CORE("Endpoint #%u: rxd ack %u", ep->id, ack)
 
 #define TRACE_ENDPOINT_RXD_REJECT_DESTINATION_UNREACHABLE(ep)  TRACE_CORE("Endpoint #%u: rxd reject destination unreachable", ep->id)
@@ -192,6 +283,14 @@ extern core_debug_counters_t secondary_core_debug_counters;
 
 #define TRACE_ENDPOINT_TXD_REJECT_FAULT(ep)               TRACE_CORE("Endpoint #%u: txd reject fault", ep->id)
 
+#define TRACE_ENDPOINT_TXD_SELECTIVE_REJECT(ep)           do { EVENT_COUNTER_INC(txd_selective_reject); TRACE_CORE("Endpoint #%u: txd selective reject %u", ep->id, ep->ack); } while (0)
+
+#define TRACE_ENDPOINT_RETXD_SELECTIVE_DATA_FRAME(ep)     do { EVENT_COUNTER_INC(retxd_selective_data_frame); TRACE_CORE("Endpoint #%u: selectively re-txd data frame", ep->id); } while (0)
+
+#define TRACE_ENDPOINT_ACK_COALESCED(ep, count)           do { primary_core_debug_counters.ack_coalesced += (count); TRACE_CORE("Endpoint #%u: ack %u covers %u frames", ep->id, ep->ack, (count) + 1); } while (0)
+
+#define TRACE_ENDPOINT_ACK_PIGGYBACKED(ep, count)         do { primary_core_debug_counters.ack_piggybacked += (count); TRACE_CORE("Endpoint #%u: ack %u piggybacked on a data frame", ep->id, ep->ack); } while (0)
+
 #define TRACE_ENDPOINT_RETXD_DATA_FRAME(ep)               do { EVENT_COUNTER_INC(retxd_data_frame); TRACE_CORE("Endpoint #%u: re-txd data frame", ep->id); } while (0)
 
 #define TRACE_ENDPOINT_FRAME_TRANSMIT_SUBMITTED(ep)       TRACE_CORE("Endpoint #%d: frame transmit submitted", (ep == NULL) ? -1 : (signed) ep->id)
@@ -202,9 +301,9 @@ extern core_debug_counters_t secondary_core_debug_counters;
 
 #define TRACE_ENDPOINT_SUPERVISORY_FRAME_TRANSMIT_COMPLETED(ep)  TRACE_CORE("Endpoint #%u: supervisory frame transmit completed", ep->id)
 
-#define TRACE_DRIVER_RXD_FRAME(buffer, len)               TRACE_FRAME("Driver : rxd frame : ", buffer, len)
+#define TRACE_DRIVER_RXD_FRAME(buffer, len)               TRACE_DRIVER_FRAME("rxd frame : ", buffer, len)
 
-#define TRACE_DRIVER_INVALID_HEADER_CHECKSUM()            do { EVENT_COUNTER_INC(invalid_header_checksum); TRACE_DRIVER("invalid header checksum in driver"); } while (0)
+#define TRACE_DRIVER_INVALID_HEADER_CHECKSUM()            do { EVENT_COUNTER_INC(invalid_header_checksum); flight_recorder_event(FLIGHT_RECORDER_INVALID_HEADER_CHECKSUM, 0xFF, 0, 0); TRACE_DRIVER("invalid header checksum in driver"); } while (0)
 
 #define OUT_FILE stderr
 
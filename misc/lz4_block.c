@@ -0,0 +1,243 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - LZ4 block compression
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "misc/lz4_block.h"
+
+#define LZ4_MIN_MATCH       4u
+#define LZ4_MAX_DISTANCE    UINT16_MAX
+#define LZ4_RUN_MASK        15u
+/* Set by the format: the last match starts 12 bytes before the end at the latest,
+ * and the last 5 bytes are literals */
+#define LZ4_MATCH_FIND_LIMIT  12u
+#define LZ4_LAST_LITERALS     5u
+
+#define LZ4_HASH_LOG  12u
+
+static uint32_t lz4_read32(const uint8_t *p)
+{
+  uint32_t value;
+
+  memcpy(&value, p, sizeof(value));
+
+  return value;
+}
+
+static uint32_t lz4_hash(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32u - LZ4_HASH_LOG);
+}
+
+/* The bytes that follow a length nibble of 15 */
+static bool lz4_write_length(uint8_t *dst, size_t *op, size_t dst_capacity, size_t length)
+{
+  while (length >= 255u) {
+    if (*op >= dst_capacity) {
+      return false;
+    }
+    dst[(*op)++] = 255u;
+    length -= 255u;
+  }
+
+  if (*op >= dst_capacity) {
+    return false;
+  }
+  dst[(*op)++] = (uint8_t)length;
+
+  return true;
+}
+
+/* A sequence: the literals, then the match. match_length is 0 for the last one, which has no match. */
+static bool lz4_write_sequence(uint8_t *dst, size_t *op, size_t dst_capacity,
+                               const uint8_t *literals, size_t literal_length,
+                               size_t offset, size_t match_length)
+{
+  size_t token = *op;
+  size_t match_code = (match_length != 0) ? match_length - LZ4_MIN_MATCH : 0;
+
+  if (*op >= dst_capacity) {
+    return false;
+  }
+  (*op)++;
+
+  if (literal_length >= LZ4_RUN_MASK) {
+    dst[token] = (uint8_t)(LZ4_RUN_MASK << 4);
+    if (!lz4_write_length(dst, op, dst_capacity, literal_length - LZ4_RUN_MASK)) {
+      return false;
+    }
+  } else {
+    dst[token] = (uint8_t)(literal_length << 4);
+  }
+
+  if (literal_length > dst_capacity - *op) {
+    return false;
+  }
+  memcpy(&dst[*op], literals, literal_length);
+  *op += literal_length;
+
+  if (match_length == 0) {
+    return true;
+  }
+
+  if (dst_capacity - *op < 2u) {
+    return false;
+  }
+  dst[(*op)++] = (uint8_t)offset;
+  dst[(*op)++] = (uint8_t)(offset >> 8);
+
+  if (match_code >= LZ4_RUN_MASK) {
+    dst[token] |= (uint8_t)LZ4_RUN_MASK;
+    return lz4_write_length(dst, op, dst_capacity, match_code - LZ4_RUN_MASK);
+  }
+
+  dst[token] |= (uint8_t)match_code;
+
+  return true;
+}
+
+size_t lz4_block_compress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity)
+{
+  uint16_t table[1u << LZ4_HASH_LOG];
+  size_t anchor = 0;
+  size_t ip = 0;
+  size_t op = 0;
+
+  if (src_length > LZ4_BLOCK_MAX_INPUT_SIZE) {
+    return 0;
+  }
+
+  // Stale entries are harmless, a candidate is only taken if its bytes match
+  memset(table, 0, sizeof(table));
+
+  while (ip + LZ4_MATCH_FIND_LIMIT <= src_length) {
+    uint32_t sequence = lz4_read32(&src[ip]);
+    uint32_t hash = lz4_hash(sequence);
+    size_t candidate = table[hash];
+
+    table[hash] = (uint16_t)ip;
+
+    if (candidate < ip && ip - candidate <= LZ4_MAX_DISTANCE && lz4_read32(&src[candidate]) == sequence) {
+      size_t match_length = LZ4_MIN_MATCH;
+      size_t match_end_limit = src_length - LZ4_LAST_LITERALS;
+
+      while (ip + match_length < match_end_limit && src[candidate + match_length] == src[ip + match_length]) {
+        match_length++;
+      }
+
+      if (!lz4_write_sequence(dst, &op, dst_capacity, &src[anchor], ip - anchor, ip - candidate, match_length)) {
+        return 0;
+      }
+
+      ip += match_length;
+      anchor = ip;
+    } else {
+      ip++;
+    }
+  }
+
+  if (!lz4_write_sequence(dst, &op, dst_capacity, &src[anchor], src_length - anchor, 0, 0)) {
+    return 0;
+  }
+
+  return op;
+}
+
+/* The bytes that follow a length nibble of 15, -EBADMSG past the end of the block */
+static ssize_t lz4_read_length(const uint8_t *src, size_t src_length, size_t *ip)
+{
+  size_t length = 0;
+  uint8_t byte;
+
+  do {
+    if (*ip >= src_length) {
+      return -EBADMSG;
+    }
+    byte = src[(*ip)++];
+    length += byte;
+  } while (byte == 255u);
+
+  return (ssize_t)length;
+}
+
+ssize_t lz4_block_decompress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity)
+{
+  size_t ip = 0;
+  size_t op = 0;
+
+  while (ip < src_length) {
+    uint8_t token = src[ip++];
+    size_t literal_length = token >> 4;
+    size_t match_length = token & LZ4_RUN_MASK;
+    size_t offset;
+
+    if (literal_length == LZ4_RUN_MASK) {
+      ssize_t extra = lz4_read_length(src, src_length, &ip);
+
+      if (extra < 0) {
+        return extra;
+      }
+      literal_length += (size_t)extra;
+    }
+
+    if (literal_length > src_length - ip || literal_length > dst_capacity - op) {
+      return -EBADMSG;
+    }
+    memcpy(&dst[op], &src[ip], literal_length);
+    ip += literal_length;
+    op += literal_length;
+
+    // The last sequence has no match
+    if (ip == src_length) {
+      break;
+    }
+
+    if (src_length - ip < 2u) {
+      return -EBADMSG;
+    }
+    offset = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+    ip += 2;
+
+    if (offset == 0 || offset > op) {
+      return -EBADMSG;
+    }
+
+    if (match_length == LZ4_RUN_MASK) {
+      ssize_t extra = lz4_read_length(src, src_length, &ip);
+
+      if (extra < 0) {
+        return extra;
+      }
+      match_length += (size_t)extra;
+    }
+    match_length += LZ4_MIN_MATCH;
+
+    if (match_length > dst_capacity - op) {
+      return -EBADMSG;
+    }
+
+    // The match may overlap what it produces, byte by byte
+    for (size_t i = 0; i < match_length; i++) {
+      dst[op + i] = dst[op - offset + i];
+    }
+    op += match_length;
+  }
+
+  return (ssize_t)op;
+}
@@ -0,0 +1,43 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - LZ4 block compression
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * The LZ4 block format, without the frame around it: the payload of a frame is
+ * compressed on its own, any LZ4 decoder reads it. The compressor is the greedy
+ * one with a single hash table, tuned for payloads of a few KiB: the tables are
+ * on the stack, and blocks are limited to 64 KiB.
+ */
+
+/* Largest block lz4_block_compress() accepts */
+#define LZ4_BLOCK_MAX_INPUT_SIZE  UINT16_MAX
+
+/* Returns the length of the compressed block, 0 if it doesn't fit in dst_capacity
+ * bytes or if src_length is larger than LZ4_BLOCK_MAX_INPUT_SIZE */
+size_t lz4_block_compress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity);
+
+/* Returns the length of the decompressed block, -EBADMSG if the block is malformed
+ * or doesn't fit in dst_capacity bytes */
+ssize_t lz4_block_decompress(const uint8_t *src, size_t src_length, uint8_t *dst, size_t dst_capacity);
+
+#endif //LZ4_BLOCK_H
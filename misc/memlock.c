@@ -0,0 +1,124 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Memory locking
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "misc/memlock.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/mempool.h"
+
+static bool enabled = false;
+
+/* Page faults of the whole process at the end of the startup */
+static uint64_t startup_page_faults;
+
+static uint64_t memlock_get_page_faults(void)
+{
+  struct rusage usage;
+  int ret;
+
+  ret = getrusage(RUSAGE_SELF, &usage);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  return (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+}
+
+/* Not inlined, for the array to be below the stack frame of the caller */
+static void __attribute__((noinline)) memlock_touch_stack(void)
+{
+  volatile uint8_t stack[MEMLOCK_STACK_PREFAULT_SIZE];
+  const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+  for (size_t i = 0; i < sizeof(stack); i += page_size) {
+    stack[i] = 0;
+  }
+}
+
+void memlock_init(void)
+{
+  int ret;
+
+  enabled = config.deterministic_memory;
+  if (!enabled) {
+    return;
+  }
+
+  /* The mappings made from now on, the thread stacks, the pools and the rings
+   * included, are faulted in and locked as they are made */
+  ret = mlockall(MCL_CURRENT | MCL_FUTURE);
+  if (ret < 0) {
+    FATAL("Failed to lock the daemon in memory : %s, cpcd needs CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK", strerror(errno));
+  }
+
+  /* The stack of the main thread grows on demand, the locked part is the one in use */
+  memlock_prefault_stack();
+
+  PRINT_INFO("Deterministic memory: the daemon is locked in memory");
+}
+
+bool memlock_is_enabled(void)
+{
+  return enabled;
+}
+
+void memlock_prefault_stack(void)
+{
+  if (enabled) {
+    memlock_touch_stack();
+  }
+}
+
+void memlock_startup_done(void)
+{
+  if (!enabled) {
+    return;
+  }
+
+  __atomic_store_n(&startup_page_faults, memlock_get_page_faults(), __ATOMIC_RELAXED);
+}
+
+void memlock_print_stats(void)
+{
+  uint64_t startup = __atomic_load_n(&startup_page_faults, __ATOMIC_RELAXED);
+
+  if (!enabled) {
+    return;
+  }
+
+  TRACE("Deterministic memory: %" PRIu64 " page faults since startup, %" PRIu64 " hot path allocations fell back to the heap",
+        startup == 0 ? 0 : memlock_get_page_faults() - startup,
+        mempool_get_fallback_count());
+}
+
+void memlock_add_metrics(metrics_t *metrics)
+{
+  uint64_t startup = __atomic_load_n(&startup_page_faults, __ATOMIC_RELAXED);
+
+  if (!enabled) {
+    return;
+  }
+
+  metrics_add_counter(metrics, "page_faults_since_startup", NULL, NULL, startup == 0 ? 0 : memlock_get_page_faults() - startup);
+  metrics_add_counter(metrics, "hot_path_heap_fallbacks", NULL, NULL, mempool_get_fallback_count());
+}
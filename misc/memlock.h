@@ -0,0 +1,55 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Memory locking
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef MEMLOCK_H
+#define MEMLOCK_H
+
+#include <stdbool.h>
+
+#include "misc/metrics.h"
+
+/*
+ * The deterministic memory mode, set with deterministic_memory in the config
+ * file. The daemon is locked in memory and the stacks of its threads are
+ * prefaulted, for the frame path never to wait on a page fault. The frames, the
+ * transmit queue items and the client backlogs come from pools allocated at
+ * startup. A hot path allocation the pools can't serve falls back to the heap
+ * and is counted, see mempool_get_fallback_count().
+ */
+
+/* Stack of the threads of the daemon in this mode, all of it is locked */
+#define MEMLOCK_THREAD_STACK_SIZE   (512u * 1024u)
+
+/* Part of the stack of a thread touched before it runs */
+#define MEMLOCK_STACK_PREFAULT_SIZE (128u * 1024u)
+
+/* Lock the daemon in memory, called by the main thread once the config is parsed */
+void memlock_init(void);
+
+bool memlock_is_enabled(void);
+
+/* Prefault the stack of the calling thread, if the mode is enabled */
+void memlock_prefault_stack(void);
+
+/* The page faults are counted from the end of the startup */
+void memlock_startup_done(void);
+
+void memlock_print_stats(void);
+
+void memlock_add_metrics(metrics_t *metrics);
+
+#endif //MEMLOCK_H
@@ -0,0 +1,122 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Fixed-size memory pool
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "misc/mempool.h"
+#include "misc/logging.h"
+#include "misc/utils.h"
+
+/* Keep every block aligned for the pointers and integers stored in it */
+#define MEMPOOL_ALIGNMENT 8u
+
+static uint64_t fallback_count = 0;
+
+static inline bool mempool_owns(const mempool_t *pool, const void *buffer)
+{
+  const uint8_t *ptr = (const uint8_t *)buffer;
+
+  return pool->storage != NULL
+         && ptr >= pool->storage
+         && ptr < pool->storage + pool->block_size * pool->block_count;
+}
+
+void mempool_init(mempool_t *pool, size_t block_size, size_t block_count)
+{
+  BUG_ON(pool->storage != NULL);
+  BUG_ON(block_size == 0);
+
+  /* Each free block holds its list node */
+  if (block_size < sizeof(sl_slist_node_t)) {
+    block_size = sizeof(sl_slist_node_t);
+  }
+  block_size = (block_size + MEMPOOL_ALIGNMENT - 1) & ~(MEMPOOL_ALIGNMENT - 1);
+
+  pool->storage = malloc(block_size * block_count);
+  FATAL_SYSCALL_ON(pool->storage == NULL);
+
+  pool->block_size = block_size;
+  pool->block_count = block_count;
+  sl_slist_init(&pool->free_blocks);
+
+  /* Push in reverse order so that blocks are handed out from the start of the storage */
+  for (size_t i = block_count; i > 0; i--) {
+    sl_slist_push(&pool->free_blocks, (sl_slist_node_t *)&pool->storage[(i - 1) * block_size]);
+  }
+}
+
+void* mempool_alloc(mempool_t *pool, size_t size)
+{
+  void *buffer;
+
+  if (size > pool->block_size || pool->free_blocks == NULL) {
+    pool->misses++;
+    if (pool->storage != NULL) {
+      __atomic_add_fetch(&fallback_count, 1, __ATOMIC_RELAXED);
+    }
+
+    buffer = malloc(size);
+    FATAL_SYSCALL_ON(buffer == NULL);
+
+    return buffer;
+  }
+
+  buffer = sl_slist_pop(&pool->free_blocks);
+
+  pool->hits++;
+  pool->in_use++;
+  if (pool->in_use > pool->high_water_mark) {
+    pool->high_water_mark = pool->in_use;
+  }
+
+  return buffer;
+}
+
+void* mempool_zalloc(mempool_t *pool, size_t size)
+{
+  void *buffer = mempool_alloc(pool, size);
+
+  memset(buffer, 0, size);
+
+  return buffer;
+}
+
+uint64_t mempool_get_fallback_count(void)
+{
+  return __atomic_load_n(&fallback_count, __ATOMIC_RELAXED);
+}
+
+void mempool_free(mempool_t *pool, void *buffer)
+{
+  if (buffer == NULL) {
+    return;
+  }
+
+  if (!mempool_owns(pool, buffer)) {
+    free(buffer);
+    return;
+  }
+
+  /* Must point at the start of a block */
+  BUG_ON((size_t)((uint8_t *)buffer - pool->storage) % pool->block_size != 0);
+  BUG_ON(pool->in_use == 0);
+
+  sl_slist_push(&pool->free_blocks, (sl_slist_node_t *)buffer);
+  pool->in_use--;
+}
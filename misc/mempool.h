@@ -0,0 +1,60 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Fixed-size memory pool
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "misc/sl_slist.h"
+
+/*
+ * A pool of fixed-size blocks carved out of a single allocation. Requests that
+ * don't fit in a block, or that arrive when the pool is exhausted, fall back to
+ * the heap and are counted as misses. mempool_free() tells both apart, so a
+ * pool that was never initialized simply behaves like malloc()/free().
+ * The misses of the initialized pools are also summed over the whole process,
+ * they are the hot path allocations the pools failed to serve.
+ *
+ * Not thread safe: a pool must only be used from a single thread.
+ */
+typedef struct {
+  uint8_t *storage;
+  size_t block_size;
+  size_t block_count;
+  sl_slist_node_t *free_blocks;
+  size_t in_use;
+  size_t high_water_mark;
+  uint32_t hits;
+  uint32_t misses;
+} mempool_t;
+
+void mempool_init(mempool_t *pool, size_t block_size, size_t block_count);
+
+/* Returns an uninitialized buffer of at least size bytes */
+void* mempool_alloc(mempool_t *pool, size_t size);
+
+/* Same as mempool_alloc(), with the size bytes zeroed */
+void* mempool_zalloc(mempool_t *pool, size_t size);
+
+void mempool_free(mempool_t *pool, void *buffer);
+
+/* Misses of all the initialized pools, from any thread */
+uint64_t mempool_get_fallback_count(void);
+
+#endif //MEMPOOL_H
@@ -0,0 +1,365 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Metrics snapshot
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc/metrics.h"
+#include "misc/busy_poll.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/memlock.h"
+#include "misc/utils.h"
+#include "server_core/core/core.h"
+#include "server_core/server/server.h"
+
+#ifndef UNIT_TESTING
+#include "driver/driver_uart.h"
+#include "driver/driver_bond.h"
+#endif
+
+#define METRICS_LABEL_VALUE_SIZE 32
+
+typedef struct {
+  const char *name;
+  metrics_type_t type;
+  const char *label_name;  // NULL if the sample has no label
+  char label_value[METRICS_LABEL_VALUE_SIZE];
+  uint64_t value;
+  const loop_stats_histogram_t *histogram;
+  size_t order;            // Keeps the samples of a name in the order they were added
+} metrics_sample_t;
+
+struct metrics {
+  metrics_sample_t *samples;
+  size_t count;
+  size_t capacity;
+};
+
+typedef struct {
+  char *buffer;
+  size_t size;
+  size_t length;
+} metrics_output_t;
+
+#define CORE_DEBUG_COUNTER(counter) { #counter, offsetof(core_debug_counters_t, counter) }
+
+static const struct {
+  const char *name;
+  size_t offset;
+} core_debug_counters[] = {
+  /* Reported by the secondary too */
+  CORE_DEBUG_COUNTER(endpoint_opened),
+  CORE_DEBUG_COUNTER(endpoint_closed),
+  CORE_DEBUG_COUNTER(rxd_frame),
+  CORE_DEBUG_COUNTER(rxd_valid_iframe),
+  CORE_DEBUG_COUNTER(rxd_valid_uframe),
+  CORE_DEBUG_COUNTER(rxd_valid_sframe),
+  CORE_DEBUG_COUNTER(rxd_data_frame_dropped),
+  CORE_DEBUG_COUNTER(txd_reject_destination_unreachable),
+  CORE_DEBUG_COUNTER(txd_reject_error_fault),
+  CORE_DEBUG_COUNTER(txd_completed),
+  CORE_DEBUG_COUNTER(retxd_data_frame),
+  CORE_DEBUG_COUNTER(driver_error),
+  CORE_DEBUG_COUNTER(driver_packet_dropped),
+  CORE_DEBUG_COUNTER(invalid_header_checksum),
+  CORE_DEBUG_COUNTER(invalid_payload_checksum),
+  /* Host only */
+  CORE_DEBUG_COUNTER(txd_selective_reject),
+  CORE_DEBUG_COUNTER(rxd_out_of_order_frame_recovered),
+  CORE_DEBUG_COUNTER(retxd_selective_data_frame),
+  CORE_DEBUG_COUNTER(ack_coalesced),
+  CORE_DEBUG_COUNTER(ack_piggybacked),
+  CORE_DEBUG_COUNTER(server_data_socket_wakeups),
+  CORE_DEBUG_COUNTER(server_datagrams_drained),
+  CORE_DEBUG_COUNTER(server_max_datagrams_per_wakeup),
+  CORE_DEBUG_COUNTER(noop_keep_alive_sent),
+  CORE_DEBUG_COUNTER(noop_keep_alive_suppressed),
+};
+
+/* The secondary reports the counters up to invalid_payload_checksum */
+#define SECONDARY_CORE_DEBUG_COUNTER_COUNT 15
+
+static void metrics_add(metrics_t *metrics, metrics_type_t type, const char *name,
+                        const char *label_name, const char *label_value,
+                        uint64_t value, const loop_stats_histogram_t *histogram)
+{
+  metrics_sample_t *sample;
+
+  if (metrics->count == metrics->capacity) {
+    metrics->capacity = metrics->capacity ? 2 * metrics->capacity : 256;
+    metrics->samples = realloc(metrics->samples, metrics->capacity * sizeof(metrics_sample_t));
+    FATAL_ON(metrics->samples == NULL);
+  }
+
+  sample = &metrics->samples[metrics->count];
+  sample->name = name;
+  sample->type = type;
+  sample->label_name = label_name;
+  sample->label_value[0] = '\0';
+  if (label_name != NULL) {
+    strncpy(sample->label_value, label_value, sizeof(sample->label_value) - 1);
+    sample->label_value[sizeof(sample->label_value) - 1] = '\0';
+  }
+  sample->value = value;
+  sample->histogram = histogram;
+  sample->order = metrics->count;
+
+  metrics->count++;
+}
+
+void metrics_add_counter(metrics_t *metrics, const char *name,
+                         const char *label_name, const char *label_value,
+                         uint64_t value)
+{
+  metrics_add(metrics, METRICS_TYPE_COUNTER, name, label_name, label_value, value, NULL);
+}
+
+void metrics_add_gauge(metrics_t *metrics, const char *name,
+                       const char *label_name, const char *label_value,
+                       uint64_t value)
+{
+  metrics_add(metrics, METRICS_TYPE_GAUGE, name, label_name, label_value, value, NULL);
+}
+
+void metrics_add_histogram(metrics_t *metrics, const char *name,
+                           const char *label_name, const char *label_value,
+                           const loop_stats_histogram_t *histogram)
+{
+  metrics_add(metrics, METRICS_TYPE_HISTOGRAM, name, label_name, label_value, 0, histogram);
+}
+
+static void metrics_add_core_debug_counters(metrics_t *metrics)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(core_debug_counters); i++) {
+    uint32_t value;
+
+    memcpy(&value, (const uint8_t *)&primary_core_debug_counters + core_debug_counters[i].offset, sizeof(value));
+    metrics_add_counter(metrics, core_debug_counters[i].name, "side", "primary", value);
+
+    /* As of the last time they were fetched, every stats_interval */
+    if (i < SECONDARY_CORE_DEBUG_COUNTER_COUNT) {
+      memcpy(&value, (const uint8_t *)&secondary_core_debug_counters + core_debug_counters[i].offset, sizeof(value));
+      metrics_add_counter(metrics, core_debug_counters[i].name, "side", "secondary", value);
+    }
+  }
+}
+
+static void metrics_add_loop_stats(metrics_t *metrics)
+{
+  const loop_stats_t *stats = loop_stats_get();
+  size_t type;
+
+  metrics_add_counter(metrics, "loop_waits", NULL, NULL, stats->waits);
+  metrics_add_counter(metrics, "loop_waits_timed_out", NULL, NULL, stats->waits_timed_out);
+  metrics_add_counter(metrics, "loop_events", NULL, NULL, stats->events);
+  metrics_add_gauge(metrics, "loop_max_events_per_wait", NULL, NULL, stats->max_events_per_wait);
+
+  metrics_add_histogram(metrics, "loop_iteration_busy_seconds", NULL, NULL, &stats->iteration_busy);
+  metrics_add_histogram(metrics, "loop_timer_lag_seconds", NULL, NULL, &stats->timer_lag);
+  metrics_add_histogram(metrics, "loop_timers_seconds", NULL, NULL, &stats->timers);
+
+  for (type = 0; type < EPOLL_CALLBACK_TYPE_COUNT; type++) {
+    metrics_add_histogram(metrics, "loop_callback_seconds",
+                          "type", loop_stats_callback_type_to_str((epoll_callback_type_t)type),
+                          &stats->callbacks[type]);
+  }
+}
+
+static void metrics_printf(metrics_output_t *output, const char *format, ...)
+{
+  va_list args;
+  int ret;
+
+  va_start(args, format);
+  if (output->length < output->size) {
+    ret = vsnprintf(output->buffer + output->length, output->size - output->length, format, args);
+  } else {
+    ret = vsnprintf(NULL, 0, format, args);
+  }
+  va_end(args);
+
+  FATAL_ON(ret < 0);
+  output->length += (size_t)ret;
+}
+
+static int metrics_sample_compare(const void *a, const void *b)
+{
+  const metrics_sample_t *sample_a = a;
+  const metrics_sample_t *sample_b = b;
+  int ret = strcmp(sample_a->name, sample_b->name);
+
+  if (ret != 0) {
+    return ret;
+  }
+
+  return sample_a->order < sample_b->order ? -1 : 1;
+}
+
+static const char* metrics_type_to_str(metrics_type_t type)
+{
+  switch (type) {
+    case METRICS_TYPE_COUNTER:
+      return "counter";
+    case METRICS_TYPE_GAUGE:
+      return "gauge";
+    case METRICS_TYPE_HISTOGRAM:
+      return "histogram";
+    default:
+      BUG("metrics_type_t value not supported (%d)", type);
+      return NULL;
+  }
+}
+
+/* Bucket i of a histogram counts the durations under 2^i us, the last one the rest */
+static double metrics_bucket_bound_seconds(size_t bucket)
+{
+  return (double)((uint64_t)1 << bucket) / 1e6;
+}
+
+static void metrics_render_json_sample(metrics_output_t *output, const metrics_sample_t *sample)
+{
+  metrics_printf(output, "{\"name\":\"cpcd_%s\",\"type\":\"%s\"", sample->name, metrics_type_to_str(sample->type));
+
+  if (sample->label_name != NULL) {
+    metrics_printf(output, ",\"labels\":{\"%s\":\"%s\"}", sample->label_name, sample->label_value);
+  }
+
+  if (sample->type == METRICS_TYPE_HISTOGRAM) {
+    const loop_stats_histogram_t *histogram = sample->histogram;
+    uint64_t cumulative = 0;
+    size_t bucket;
+
+    metrics_printf(output, ",\"count\":%llu,\"sum\":%.9g,\"buckets\":[",
+                   (unsigned long long)histogram->count,
+                   (double)histogram->total_ns / 1e9);
+
+    for (bucket = 0; bucket < LOOP_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+      cumulative += histogram->buckets[bucket];
+      metrics_printf(output, "{\"le\":\"%.9g\",\"count\":%llu},",
+                     metrics_bucket_bound_seconds(bucket), (unsigned long long)cumulative);
+    }
+    metrics_printf(output, "{\"le\":\"+Inf\",\"count\":%llu}]}", (unsigned long long)histogram->count);
+  } else {
+    metrics_printf(output, ",\"value\":%llu}", (unsigned long long)sample->value);
+  }
+}
+
+static void metrics_render_prometheus_labels(metrics_output_t *output, const metrics_sample_t *sample, const char *le)
+{
+  if (sample->label_name == NULL && le == NULL) {
+    return;
+  }
+
+  metrics_printf(output, "{");
+  if (sample->label_name != NULL) {
+    metrics_printf(output, "%s=\"%s\"%s", sample->label_name, sample->label_value, le ? "," : "");
+  }
+  if (le != NULL) {
+    metrics_printf(output, "le=\"%s\"", le);
+  }
+  metrics_printf(output, "}");
+}
+
+static void metrics_render_prometheus_sample(metrics_output_t *output, const metrics_sample_t *sample)
+{
+  if (sample->type == METRICS_TYPE_HISTOGRAM) {
+    const loop_stats_histogram_t *histogram = sample->histogram;
+    uint64_t cumulative = 0;
+    char le[24];
+    size_t bucket;
+
+    for (bucket = 0; bucket < LOOP_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+      cumulative += histogram->buckets[bucket];
+      snprintf(le, sizeof(le), "%.9g", metrics_bucket_bound_seconds(bucket));
+      metrics_printf(output, "cpcd_%s_bucket", sample->name);
+      metrics_render_prometheus_labels(output, sample, le);
+      metrics_printf(output, " %llu\n", (unsigned long long)cumulative);
+    }
+
+    metrics_printf(output, "cpcd_%s_bucket", sample->name);
+    metrics_render_prometheus_labels(output, sample, "+Inf");
+    metrics_printf(output, " %llu\n", (unsigned long long)histogram->count);
+
+    metrics_printf(output, "cpcd_%s_sum", sample->name);
+    metrics_render_prometheus_labels(output, sample, NULL);
+    metrics_printf(output, " %.9g\n", (double)histogram->total_ns / 1e9);
+
+    metrics_printf(output, "cpcd_%s_count", sample->name);
+    metrics_render_prometheus_labels(output, sample, NULL);
+    metrics_printf(output, " %llu\n", (unsigned long long)histogram->count);
+  } else {
+    metrics_printf(output, "cpcd_%s", sample->name);
+    metrics_render_prometheus_labels(output, sample, NULL);
+    metrics_printf(output, " %llu\n", (unsigned long long)sample->value);
+  }
+}
+
+size_t metrics_render(cpc_metrics_format_t format, char *buffer, size_t size)
+{
+  metrics_t metrics = { 0 };
+  metrics_output_t output = { .buffer = buffer, .size = size, .length = 0 };
+  size_t i;
+
+  metrics_add_core_debug_counters(&metrics);
+  metrics_add_loop_stats(&metrics);
+  core_add_metrics(&metrics);
+  server_add_metrics(&metrics);
+  memlock_add_metrics(&metrics);
+  busy_poll_add_metrics(&metrics);
+#ifndef UNIT_TESTING
+  if (config.bus == UART) {
+    driver_uart_add_metrics(&metrics);
+  }
+  if (driver_bond_is_enabled()) {
+    driver_bond_add_metrics(&metrics);
+  }
+#endif
+
+  /* Both formats want the samples of a metric next to one another */
+  qsort(metrics.samples, metrics.count, sizeof(metrics_sample_t), metrics_sample_compare);
+
+  if (size > 0) {
+    buffer[0] = '\0';
+  }
+
+  if (format == CPC_METRICS_FORMAT_JSON) {
+    metrics_printf(&output, "{\"version\":%d,\"metrics\":[", METRICS_SNAPSHOT_VERSION);
+    for (i = 0; i < metrics.count; i++) {
+      metrics_printf(&output, i ? "," : "");
+      metrics_render_json_sample(&output, &metrics.samples[i]);
+    }
+    metrics_printf(&output, "]}\n");
+  } else {
+    for (i = 0; i < metrics.count; i++) {
+      if (i == 0 || strcmp(metrics.samples[i].name, metrics.samples[i - 1].name) != 0) {
+        metrics_printf(&output, "# TYPE cpcd_%s %s\n",
+                       metrics.samples[i].name, metrics_type_to_str(metrics.samples[i].type));
+      }
+      metrics_render_prometheus_sample(&output, &metrics.samples[i]);
+    }
+  }
+
+  free(metrics.samples);
+
+  return output.length;
+}
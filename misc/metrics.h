@@ -0,0 +1,69 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Metrics snapshot
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lib/sl_cpc.h"
+#include "server_core/epoll/loop_stats.h"
+
+/*
+ * A snapshot of the counters of the core, the server, the driver, the event
+ * loop and the secondary, rendered as JSON or in the Prometheus text format
+ * for the clients that send an EXCHANGE_METRICS_QUERY.
+ *
+ * Each module adds its samples in whatever order suits it, they are grouped
+ * by name when rendered. Names, label names and label values are static or
+ * copied, histograms are referenced and must stay put until rendered. Only
+ * used from the server core thread.
+ */
+
+#define METRICS_SNAPSHOT_VERSION 1
+
+typedef enum {
+  METRICS_TYPE_COUNTER,
+  METRICS_TYPE_GAUGE,
+  METRICS_TYPE_HISTOGRAM
+} metrics_type_t;
+
+typedef struct metrics metrics_t;
+
+void metrics_add_counter(metrics_t *metrics, const char *name,
+                         const char *label_name, const char *label_value,
+                         uint64_t value);
+
+void metrics_add_gauge(metrics_t *metrics, const char *name,
+                       const char *label_name, const char *label_value,
+                       uint64_t value);
+
+/* The histogram is in nanoseconds, it is rendered in seconds */
+void metrics_add_histogram(metrics_t *metrics, const char *name,
+                           const char *label_name, const char *label_value,
+                           const loop_stats_histogram_t *histogram);
+
+/***************************************************************************//**
+ * Render a snapshot of every metric in buffer, NUL terminated if it fits.
+ *
+ * @return The length of the whole snapshot, without the NUL. The snapshot is
+ *         truncated if it is size or more.
+ ******************************************************************************/
+size_t metrics_render(cpc_metrics_format_t format, char *buffer, size_t size);
+
+#endif //METRICS_H
@@ -0,0 +1,250 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Shared memory broadcast ring
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+
+#include "misc/shm_broadcast.h"
+
+/* Same records as shm_ring: a length prefix, and padding to keep the prefixes aligned */
+#define SHM_BROADCAST_PREFIX_SIZE   sizeof(uint32_t)
+#define SHM_BROADCAST_RECORD_SIZE(length) ((SHM_BROADCAST_PREFIX_SIZE + (length) + 3u) & ~3u)
+
+size_t shm_broadcast_footprint(uint32_t size)
+{
+  return sizeof(shm_broadcast_header_t) + size;
+}
+
+void shm_broadcast_attach(shm_broadcast_t *ring, void *base, uint32_t size, bool reset)
+{
+  ring->header = (shm_broadcast_header_t *)base;
+  ring->data = (uint8_t *)base + sizeof(shm_broadcast_header_t);
+  ring->size = size;
+
+  if (reset) {
+    memset(ring->header, 0, sizeof(shm_broadcast_header_t));
+  }
+}
+
+static void shm_broadcast_copy_in(shm_broadcast_t *ring, uint32_t position, const void *source, uint32_t length)
+{
+  uint32_t offset = position & (ring->size - 1);
+  uint32_t first = ring->size - offset;
+
+  if (first >= length) {
+    memcpy(&ring->data[offset], source, length);
+  } else {
+    memcpy(&ring->data[offset], source, first);
+    memcpy(ring->data, (const uint8_t *)source + first, length - first);
+  }
+}
+
+static void shm_broadcast_copy_out(const shm_broadcast_t *ring, uint32_t position, void *destination, uint32_t length)
+{
+  uint32_t offset = position & (ring->size - 1);
+  uint32_t first = ring->size - offset;
+
+  if (first >= length) {
+    memcpy(destination, &ring->data[offset], length);
+  } else {
+    memcpy(destination, &ring->data[offset], first);
+    memcpy((uint8_t *)destination + first, ring->data, length - first);
+  }
+}
+
+void shm_broadcast_join(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor)
+{
+  __atomic_store_n(&cursor->head, ring->header->tail, __ATOMIC_SEQ_CST);
+}
+
+uint32_t shm_broadcast_lag(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor)
+{
+  uint32_t head = __atomic_load_n(&cursor->head, __ATOMIC_SEQ_CST);
+  uint32_t used = ring->header->tail - head;
+
+  if ((int32_t)(ring->header->floor - head) > 0 || used > ring->size) {
+    return ring->size;
+  }
+
+  return used;
+}
+
+uint32_t shm_broadcast_overwritten(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor, uint32_t length)
+{
+  uint32_t record_size = SHM_BROADCAST_RECORD_SIZE(length);
+  uint32_t tail = ring->header->tail;
+  uint32_t position = ring->header->floor;
+  uint32_t head = __atomic_load_n(&cursor->head, __ATOMIC_SEQ_CST);
+  uint32_t count = 0;
+
+  if (record_size > ring->size) {
+    return 0;
+  }
+
+  // Only the producer writes the ring, the lengths it walks through are its own
+  while (ring->size - (tail - position) < record_size) {
+    uint32_t oldest_length;
+
+    shm_broadcast_copy_out(ring, position, &oldest_length, SHM_BROADCAST_PREFIX_SIZE);
+    if ((int32_t)(position - head) >= 0) {
+      count++;
+    }
+    position += SHM_BROADCAST_RECORD_SIZE(oldest_length);
+  }
+
+  return count;
+}
+
+bool shm_broadcast_push(shm_broadcast_t *ring, const void *message, uint32_t length, uint32_t *previous_tail)
+{
+  uint32_t record_size = SHM_BROADCAST_RECORD_SIZE(length);
+  uint32_t tail = ring->header->tail;
+  uint32_t floor = ring->header->floor;
+
+  if (record_size > ring->size) {
+    return false;
+  }
+
+  if (ring->size - (tail - floor) < record_size) {
+    while (ring->size - (tail - floor) < record_size) {
+      uint32_t oldest_length;
+
+      shm_broadcast_copy_out(ring, floor, &oldest_length, SHM_BROADCAST_PREFIX_SIZE);
+      floor += SHM_BROADCAST_RECORD_SIZE(oldest_length);
+    }
+
+    // Move the floor before overwriting, so that a consumer copying one of these
+    // messages sees the floor past it once it is done
+    __atomic_store_n(&ring->header->floor, floor, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+
+  shm_broadcast_copy_in(ring, tail, &length, SHM_BROADCAST_PREFIX_SIZE);
+  shm_broadcast_copy_in(ring, tail + SHM_BROADCAST_PREFIX_SIZE, message, length);
+
+  __atomic_store_n(&ring->header->tail, tail + record_size, __ATOMIC_SEQ_CST);
+
+  *previous_tail = tail;
+
+  return true;
+}
+
+bool shm_broadcast_was_empty(const shm_broadcast_cursor_t *cursor, uint32_t previous_tail)
+{
+  // Like in shm_ring_push(), the new tail is published before looking at where the consumer is
+  return __atomic_load_n(&cursor->head, __ATOMIC_SEQ_CST) == previous_tail;
+}
+
+/* True if what was read at head may have been overwritten in the meantime */
+static bool shm_broadcast_is_lapped(const shm_broadcast_t *ring, uint32_t head)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  return (int32_t)(__atomic_load_n(&ring->header->floor, __ATOMIC_SEQ_CST) - head) > 0;
+}
+
+/* The length of the message at head, 0 if there is none, -EBADMSG if the ring is corrupted.
+ * head is moved to the oldest message left if the producer overwrote the one it was at. */
+static ssize_t shm_broadcast_next_length(const shm_broadcast_t *ring, uint32_t *head)
+{
+  uint32_t used;
+  uint32_t length;
+
+  do {
+    uint32_t floor = __atomic_load_n(&ring->header->floor, __ATOMIC_SEQ_CST);
+    uint32_t tail;
+
+    if ((int32_t)(floor - *head) > 0) {
+      *head = floor;
+    }
+
+    tail = __atomic_load_n(&ring->header->tail, __ATOMIC_SEQ_CST);
+    used = tail - *head;
+    length = 0;
+
+    if (used == 0) {
+      return 0;
+    }
+
+    if (used >= SHM_BROADCAST_PREFIX_SIZE && used <= ring->size) {
+      shm_broadcast_copy_out(ring, *head, &length, SHM_BROADCAST_PREFIX_SIZE);
+    }
+  } while (shm_broadcast_is_lapped(ring, *head));
+
+  if (length == 0 || length > ring->size || SHM_BROADCAST_RECORD_SIZE(length) > used) {
+    return -EBADMSG;
+  }
+
+  return (ssize_t)length;
+}
+
+ssize_t shm_broadcast_pop(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor, void *buffer, size_t buffer_size)
+{
+  uint32_t head = cursor->head;
+  ssize_t next_length;
+  uint32_t length;
+  uint32_t copied;
+
+  do {
+    next_length = shm_broadcast_next_length(ring, &head);
+    if (next_length <= 0) {
+      if (next_length == 0) {
+        __atomic_store_n(&cursor->head, head, __ATOMIC_SEQ_CST);
+      }
+      return next_length;
+    }
+
+    length = (uint32_t)next_length;
+    copied = (uint32_t)(length < buffer_size ? length : buffer_size);
+
+    // Like a datagram socket, the part of the message that doesn't fit is discarded
+    shm_broadcast_copy_out(ring, head + SHM_BROADCAST_PREFIX_SIZE, buffer, copied);
+  } while (shm_broadcast_is_lapped(ring, head));
+
+  __atomic_store_n(&cursor->head, head + SHM_BROADCAST_RECORD_SIZE(length), __ATOMIC_SEQ_CST);
+
+  return (ssize_t)copied;
+}
+
+ssize_t shm_broadcast_peek(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor, const void **message)
+{
+  uint32_t head = cursor->head;
+  ssize_t length = shm_broadcast_next_length(ring, &head);
+  uint32_t offset = (head + SHM_BROADCAST_PREFIX_SIZE) & (ring->size - 1);
+
+  *message = NULL;
+
+  if (head != cursor->head) {
+    __atomic_store_n(&cursor->head, head, __ATOMIC_SEQ_CST);
+  }
+
+  if (length > 0 && offset + (size_t)length <= ring->size) {
+    *message = &ring->data[offset];
+  }
+
+  return length;
+}
+
+void shm_broadcast_release(shm_broadcast_cursor_t *cursor, size_t length)
+{
+  __atomic_store_n(&cursor->head, cursor->head + SHM_BROADCAST_RECORD_SIZE((uint32_t)length), __ATOMIC_SEQ_CST);
+}
+
+bool shm_broadcast_is_empty(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor)
+{
+  return __atomic_load_n(&ring->header->tail, __ATOMIC_SEQ_CST) == cursor->head;
+}
@@ -0,0 +1,87 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Shared memory broadcast ring
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SHM_BROADCAST_H
+#define SHM_BROADCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A single producer, multiple consumer ring of variable-size messages, with the
+ * message format of shm_ring. Each message is written once and read by every
+ * consumer. The ring itself is only written by the producer, the consumers may
+ * map it read-only. Each consumer has its own cursor, which it keeps in memory
+ * of its own and which the producer only reads.
+ *
+ * A consumer doesn't hold the producer back: when a message doesn't fit, the
+ * oldest ones are overwritten. A consumer that was lapped starts over from the
+ * oldest message left, and detects one overwritten while it was copying it.
+ */
+
+typedef struct {
+  volatile uint32_t tail __attribute__((aligned(64)));  // Advanced by the producer
+  volatile uint32_t floor __attribute__((aligned(64))); // Oldest message not overwritten, advanced by the producer
+} shm_broadcast_header_t;
+
+typedef struct {
+  volatile uint32_t head __attribute__((aligned(64)));  // Advanced by the consumer
+} shm_broadcast_cursor_t;
+
+/* A process-local view of a ring */
+typedef struct {
+  shm_broadcast_header_t *header;
+  uint8_t *data;
+  uint32_t size;
+} shm_broadcast_t;
+
+/* Bytes to map for a ring of the given size, header included. The size must be a power of two. */
+size_t shm_broadcast_footprint(uint32_t size);
+
+/* Set up a view on the ring stored at base. The producer resets it. */
+void shm_broadcast_attach(shm_broadcast_t *ring, void *base, uint32_t size, bool reset);
+
+/* Producer: a new consumer only gets the messages pushed after it joined */
+void shm_broadcast_join(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor);
+
+/* Producer: the bytes the consumer has yet to read, or the size of the ring if it was lapped */
+uint32_t shm_broadcast_lag(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor);
+
+/* Producer: the number of messages that pushing one of the given length overwrites before the consumer reads them */
+uint32_t shm_broadcast_overwritten(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor, uint32_t length);
+
+/* Producer: returns false if the message is larger than the ring. previous_tail is passed to shm_broadcast_was_empty(). */
+bool shm_broadcast_push(shm_broadcast_t *ring, const void *message, uint32_t length, uint32_t *previous_tail);
+
+/* Producer: true if the consumer had read everything before the push, and must be woken up */
+bool shm_broadcast_was_empty(const shm_broadcast_cursor_t *cursor, uint32_t previous_tail);
+
+/* Consumer: same as shm_ring_pop() */
+ssize_t shm_broadcast_pop(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor, void *buffer, size_t buffer_size);
+
+/* Consumer: same as shm_ring_peek(). The message is only guaranteed to stay in place if the
+ * producer never overwrites messages the consumers have yet to read. */
+ssize_t shm_broadcast_peek(const shm_broadcast_t *ring, shm_broadcast_cursor_t *cursor, const void **message);
+
+/* Consumer: remove the message of the given length returned by shm_broadcast_peek() */
+void shm_broadcast_release(shm_broadcast_cursor_t *cursor, size_t length);
+
+bool shm_broadcast_is_empty(const shm_broadcast_t *ring, const shm_broadcast_cursor_t *cursor);
+
+#endif //SHM_BROADCAST_H
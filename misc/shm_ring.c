@@ -0,0 +1,169 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Shared memory message ring
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <string.h>
+
+#include "misc/shm_ring.h"
+
+/* Every message is prefixed with its length and padded to keep the prefixes aligned */
+#define SHM_RING_PREFIX_SIZE   sizeof(uint32_t)
+#define SHM_RING_RECORD_SIZE(length) ((SHM_RING_PREFIX_SIZE + (length) + 3u) & ~3u)
+
+size_t shm_ring_footprint(uint32_t size)
+{
+  return sizeof(shm_ring_header_t) + size;
+}
+
+void shm_ring_attach(shm_ring_t *ring, void *base, uint32_t size, bool reset)
+{
+  ring->header = (shm_ring_header_t *)base;
+  ring->data = (uint8_t *)base + sizeof(shm_ring_header_t);
+  ring->size = size;
+
+  if (reset) {
+    memset(ring->header, 0, sizeof(shm_ring_header_t));
+  }
+}
+
+static void shm_ring_copy_in(shm_ring_t *ring, uint32_t position, const void *source, uint32_t length)
+{
+  uint32_t offset = position & (ring->size - 1);
+  uint32_t first = ring->size - offset;
+
+  if (first >= length) {
+    memcpy(&ring->data[offset], source, length);
+  } else {
+    memcpy(&ring->data[offset], source, first);
+    memcpy(ring->data, (const uint8_t *)source + first, length - first);
+  }
+}
+
+static void shm_ring_copy_out(const shm_ring_t *ring, uint32_t position, void *destination, uint32_t length)
+{
+  uint32_t offset = position & (ring->size - 1);
+  uint32_t first = ring->size - offset;
+
+  if (first >= length) {
+    memcpy(destination, &ring->data[offset], length);
+  } else {
+    memcpy(destination, &ring->data[offset], first);
+    memcpy((uint8_t *)destination + first, ring->data, length - first);
+  }
+}
+
+bool shm_ring_push(shm_ring_t *ring, const void *message, uint32_t length, bool *was_empty)
+{
+  uint32_t record_size = SHM_RING_RECORD_SIZE(length);
+  uint32_t tail = ring->header->tail;
+  uint32_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+
+  if (record_size > ring->size - (tail - head)) {
+    return false;
+  }
+
+  shm_ring_copy_in(ring, tail, &length, SHM_RING_PREFIX_SIZE);
+  shm_ring_copy_in(ring, tail + SHM_RING_PREFIX_SIZE, message, length);
+
+  // Publish the message, then look at where the consumer is. Either the consumer
+  // sees the new tail before it goes to sleep, or this sees it already caught up.
+  __atomic_store_n(&ring->header->tail, tail + record_size, __ATOMIC_SEQ_CST);
+  head = __atomic_load_n(&ring->header->head, __ATOMIC_SEQ_CST);
+
+  *was_empty = (head == tail);
+
+  return true;
+}
+
+/* The length of the message at head, 0 if the ring is empty, -EBADMSG if it is corrupted */
+static ssize_t shm_ring_next_length(const shm_ring_t *ring, uint32_t head)
+{
+  uint32_t tail = __atomic_load_n(&ring->header->tail, __ATOMIC_SEQ_CST);
+  uint32_t used = tail - head;
+  uint32_t length;
+
+  if (used == 0) {
+    return 0;
+  }
+
+  if (used > ring->size || used < SHM_RING_PREFIX_SIZE) {
+    return -EBADMSG;
+  }
+
+  shm_ring_copy_out(ring, head, &length, SHM_RING_PREFIX_SIZE);
+
+  if (length == 0 || length > ring->size || SHM_RING_RECORD_SIZE(length) > used) {
+    return -EBADMSG;
+  }
+
+  return (ssize_t)length;
+}
+
+ssize_t shm_ring_pop(shm_ring_t *ring, void *buffer, size_t buffer_size)
+{
+  uint32_t head = ring->header->head;
+  ssize_t next_length = shm_ring_next_length(ring, head);
+  uint32_t length;
+
+  if (next_length <= 0) {
+    return next_length;
+  }
+
+  length = (uint32_t)next_length;
+
+  // Like a datagram socket, the part of the message that doesn't fit is discarded
+  shm_ring_copy_out(ring, head + SHM_RING_PREFIX_SIZE, buffer, (uint32_t)(length < buffer_size ? length : buffer_size));
+
+  __atomic_store_n(&ring->header->head, head + SHM_RING_RECORD_SIZE(length), __ATOMIC_SEQ_CST);
+
+  return (ssize_t)(length < buffer_size ? length : buffer_size);
+}
+
+ssize_t shm_ring_peek(const shm_ring_t *ring, const void **message)
+{
+  uint32_t head = ring->header->head;
+  ssize_t length = shm_ring_next_length(ring, head);
+  uint32_t offset = (head + SHM_RING_PREFIX_SIZE) & (ring->size - 1);
+
+  *message = NULL;
+
+  if (length > 0 && offset + (size_t)length <= ring->size) {
+    *message = &ring->data[offset];
+  }
+
+  return length;
+}
+
+void shm_ring_release(shm_ring_t *ring, size_t length)
+{
+  __atomic_store_n(&ring->header->head, ring->header->head + SHM_RING_RECORD_SIZE((uint32_t)length), __ATOMIC_SEQ_CST);
+}
+
+bool shm_ring_is_empty(const shm_ring_t *ring)
+{
+  return __atomic_load_n(&ring->header->tail, __ATOMIC_SEQ_CST) == ring->header->head;
+}
+
+void shm_ring_set_producer_waiting(shm_ring_t *ring)
+{
+  __atomic_store_n(&ring->header->producer_waiting, 1u, __ATOMIC_SEQ_CST);
+}
+
+bool shm_ring_take_producer_waiting(shm_ring_t *ring)
+{
+  return __atomic_exchange_n(&ring->header->producer_waiting, 0u, __ATOMIC_SEQ_CST) != 0;
+}
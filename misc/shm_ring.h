@@ -0,0 +1,80 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Shared memory message ring
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * A single producer, single consumer ring of variable-size messages, living in
+ * memory shared between two processes, or two threads. Each side only writes
+ * its own index, so no lock is needed. The producer learns whether the ring was
+ * empty before its push, so that the consumer only has to be woken up when it
+ * may be sleeping.
+ *
+ * The data is untrusted: the consumer validates every message before using it.
+ */
+
+/* Size of the data area of a ring, must be a power of two */
+#define SHM_RING_DEFAULT_SIZE (64u * 1024u)
+
+typedef struct {
+  volatile uint32_t head __attribute__((aligned(64)));          // Advanced by the consumer
+  volatile uint32_t tail __attribute__((aligned(64)));          // Advanced by the producer
+  volatile uint32_t producer_waiting __attribute__((aligned(64)));
+} shm_ring_header_t;
+
+/* A process-local view of a ring */
+typedef struct {
+  shm_ring_header_t *header;
+  uint8_t *data;
+  uint32_t size;
+} shm_ring_t;
+
+/* Bytes to map for a ring of the given size, header included */
+size_t shm_ring_footprint(uint32_t size);
+
+/* Set up a view on the ring stored at base. The creator of the memory resets it. */
+void shm_ring_attach(shm_ring_t *ring, void *base, uint32_t size, bool reset);
+
+/* Returns false if the message doesn't fit. was_empty tells if the consumer must be woken up. */
+bool shm_ring_push(shm_ring_t *ring, const void *message, uint32_t length, bool *was_empty);
+
+/* Returns the number of bytes copied to buffer, 0 if the ring is empty, -EBADMSG if it is corrupted.
+ * Like on a datagram socket, the end of a message larger than the buffer is discarded. */
+ssize_t shm_ring_pop(shm_ring_t *ring, void *buffer, size_t buffer_size);
+
+/* Like shm_ring_pop(), without copying nor removing the message. message points to it in the
+ * ring, or is NULL if the message wraps around the end and must be popped instead. */
+ssize_t shm_ring_peek(const shm_ring_t *ring, const void **message);
+
+/* Remove the message of the given length returned by shm_ring_peek() */
+void shm_ring_release(shm_ring_t *ring, size_t length);
+
+bool shm_ring_is_empty(const shm_ring_t *ring);
+
+/* The producer is about to sleep until the consumer frees up space */
+void shm_ring_set_producer_waiting(shm_ring_t *ring);
+
+/* Returns true if the producer was waiting for space, and clears the flag */
+bool shm_ring_take_producer_waiting(shm_ring_t *ring);
+
+#endif //SHM_RING_H
@@ -0,0 +1,140 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - tail-tracked FIFO queue
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "misc/sl_queue.h"
+
+/***************************************************************************//**
+ * Initializes an empty queue.
+ ******************************************************************************/
+void sl_queue_init(sl_queue_t *queue)
+{
+  assert(queue != NULL);
+
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->count = 0;
+}
+
+/***************************************************************************//**
+ * Add given item at the front of the queue.
+ ******************************************************************************/
+void sl_queue_push(sl_queue_t *queue,
+                   sl_slist_node_t *item)
+{
+  assert((item != NULL) && (queue != NULL));
+
+  item->node = queue->head;
+  queue->head = item;
+  if (queue->tail == NULL) {
+    queue->tail = item;
+  }
+  queue->count++;
+}
+
+/***************************************************************************//**
+ * Add given item at the end of the queue.
+ ******************************************************************************/
+void sl_queue_push_back(sl_queue_t *queue,
+                        sl_slist_node_t *item)
+{
+  assert((item != NULL) && (queue != NULL));
+
+  item->node = NULL;
+  if (queue->tail == NULL) {
+    queue->head = item;
+  } else {
+    queue->tail->node = item;
+  }
+  queue->tail = item;
+  queue->count++;
+}
+
+/***************************************************************************//**
+ * Removes and returns the first item of the queue.
+ ******************************************************************************/
+sl_slist_node_t *sl_queue_pop(sl_queue_t *queue)
+{
+  sl_slist_node_t *item;
+
+  assert(queue != NULL);
+
+  item = queue->head;
+  if (item == NULL) {
+    return NULL;
+  }
+
+  queue->head = item->node;
+  if (queue->head == NULL) {
+    queue->tail = NULL;
+  }
+  queue->count--;
+
+  item->node = NULL;
+
+  return item;
+}
+
+/***************************************************************************//**
+ * Remove item from the queue.
+ ******************************************************************************/
+void sl_queue_remove(sl_queue_t *queue,
+                     sl_slist_node_t *item)
+{
+  sl_slist_node_t **node_ptr;
+  sl_slist_node_t *previous = NULL;
+
+  assert((item != NULL) && (queue != NULL));
+
+  for (node_ptr = &queue->head; *node_ptr != NULL; node_ptr = &((*node_ptr)->node)) {
+    if (*node_ptr == item) {
+      *node_ptr = item->node;
+      if (queue->tail == item) {
+        queue->tail = previous;
+      }
+      queue->count--;
+      item->node = NULL;
+      return;
+    }
+    previous = *node_ptr;
+  }
+}
+
+/***************************************************************************//**
+ * Move every item of a queue at the end of another one.
+ ******************************************************************************/
+void sl_queue_append(sl_queue_t *dst,
+                     sl_queue_t *src)
+{
+  assert((dst != NULL) && (src != NULL));
+
+  if (src->head == NULL) {
+    return;
+  }
+
+  if (dst->tail == NULL) {
+    dst->head = src->head;
+  } else {
+    dst->tail->node = src->head;
+  }
+  dst->tail = src->tail;
+  dst->count += src->count;
+
+  sl_queue_init(src);
+}
@@ -0,0 +1,81 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - tail-tracked FIFO queue
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SL_QUEUE_H
+#define SL_QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "misc/sl_slist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * An intrusive singly-linked queue that keeps track of its tail and length, so
+ * that pushing at either end and popping are O(1). Items embed the same
+ * sl_slist_node_t as the lists, and the SL_SLIST_FOR_EACH* macros walk a queue
+ * from its head.
+ */
+typedef struct {
+  sl_slist_node_t *head;
+  sl_slist_node_t *tail;
+  size_t count;
+} sl_queue_t;
+
+#define  SL_QUEUE_FOR_EACH_ENTRY(queue, entry, type, member) SL_SLIST_FOR_EACH_ENTRY((queue)->head, entry, type, member)
+
+void sl_queue_init(sl_queue_t *queue);
+
+static inline bool sl_queue_is_empty(const sl_queue_t *queue)
+{
+  return queue->head == NULL;
+}
+
+static inline size_t sl_queue_len(const sl_queue_t *queue)
+{
+  return queue->count;
+}
+
+static inline sl_slist_node_t *sl_queue_peek(const sl_queue_t *queue)
+{
+  return queue->head;
+}
+
+void sl_queue_push(sl_queue_t *queue,
+                   sl_slist_node_t *item);
+
+void sl_queue_push_back(sl_queue_t *queue,
+                        sl_slist_node_t *item);
+
+sl_slist_node_t *sl_queue_pop(sl_queue_t *queue);
+
+/* O(n), walks the queue to find the item */
+void sl_queue_remove(sl_queue_t *queue,
+                     sl_slist_node_t *item);
+
+/* Move every item of src at the end of dst, src is left empty */
+void sl_queue_append(sl_queue_t *dst,
+                     sl_queue_t *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SL_QUEUE_H */
@@ -0,0 +1,130 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Threads
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "misc/logging.h"
+#include "misc/memlock.h"
+#include "misc/thread.h"
+#include "misc/utils.h"
+
+typedef struct {
+  thread_sched_t sched;
+  void *(*start_routine)(void *);
+  void *arg;
+} thread_start_t;
+
+/* The main thread is never rescheduled, it keeps the CPUs and the nice value
+ * cpcd was started with, and so do the logger threads it creates */
+static void thread_apply_sched(const thread_sched_t *sched)
+{
+  struct sched_param param = { .sched_priority = sched->priority };
+  cpu_set_t cpus;
+  int nice_value = sched->nice;
+  int ret;
+
+  if (sched->cpu < 0) {
+    ret = sched_getaffinity(getpid(), sizeof(cpus), &cpus);
+    FATAL_SYSCALL_ON(ret < 0);
+  } else {
+    CPU_ZERO(&cpus);
+    CPU_SET((size_t)sched->cpu, &cpus);
+  }
+
+  ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (ret != 0) {
+    FATAL("Failed to pin the thread to CPU %d (%d)", sched->cpu, ret);
+  }
+
+  ret = pthread_setschedparam(pthread_self(), sched->policy, &param);
+  if (ret == EPERM) {
+    FATAL("Not allowed to schedule the thread in real-time, cpcd needs CAP_SYS_NICE or a RLIMIT_RTPRIO of at least %d", sched->priority);
+  } else if (ret != 0) {
+    FATAL("Failed to set the scheduling policy of the thread (%d)", ret);
+  }
+
+  if (sched->policy == SCHED_OTHER) {
+    if (nice_value == 0) {
+      errno = 0;
+      nice_value = getpriority(PRIO_PROCESS, (id_t)getpid());
+      FATAL_SYSCALL_ON(nice_value == -1 && errno != 0);
+    }
+
+    /* Only changes the calling thread on Linux, its thread id standing for a process */
+    ret = setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice_value);
+    if (ret < 0 && errno == EACCES) {
+      FATAL("Not allowed to lower the nice value of the thread to %d, cpcd needs CAP_SYS_NICE or a RLIMIT_NICE of at least %d", nice_value, 20 - nice_value);
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+}
+
+static void *thread_func(void *param)
+{
+  thread_start_t start = *(thread_start_t *)param;
+
+  free(param);
+
+  thread_apply_sched(&start.sched);
+
+  memlock_prefault_stack();
+
+  return start.start_routine(start.arg);
+}
+
+int thread_create(pthread_t *thread,
+                  thread_sched_t sched,
+                  void *(*start_routine)(void *),
+                  void *arg)
+{
+  thread_start_t *start;
+  pthread_attr_t attr;
+  int ret;
+
+  start = (thread_start_t *)zalloc(sizeof(thread_start_t));
+  FATAL_ON(start == NULL);
+
+  start->sched = sched;
+  start->start_routine = start_routine;
+  start->arg = arg;
+
+  ret = pthread_attr_init(&attr);
+  FATAL_ON(ret != 0);
+
+  /* The whole stack gets locked, rather than the default of RLIMIT_STACK */
+  if (memlock_is_enabled()) {
+    ret = pthread_attr_setstacksize(&attr, MEMLOCK_THREAD_STACK_SIZE);
+    FATAL_ON(ret != 0);
+  }
+
+  ret = pthread_create(thread, &attr, thread_func, start);
+  if (ret != 0) {
+    free(start);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  return ret;
+}
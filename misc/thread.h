@@ -0,0 +1,39 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Threads
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <pthread.h>
+
+/* How a class of threads is scheduled, set in the config file */
+typedef struct {
+  int cpu;      // CPU the threads are pinned to, or -1 for the CPUs of the process
+  int policy;   // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+  int priority; // Real-time priority with SCHED_FIFO and SCHED_RR, 0 otherwise
+  int nice;     // Nice value with SCHED_OTHER, 0 for the one of the process
+} thread_sched_t;
+
+/* pthread_create() for a thread of the daemon. The new thread applies sched to
+ * itself before running start_routine, rather than inheriting the scheduling
+ * of the calling thread */
+int thread_create(pthread_t *thread,
+                  thread_sched_t sched,
+                  void *(*start_routine)(void *),
+                  void *arg);
+
+#endif //THREAD_H
@@ -0,0 +1,130 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - LTTng tracepoint provider
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+/*
+ * Typed events of the 'cpcd' provider, for the hot paths where formatting a
+ * tracef() string would cost more than the work being traced. A disabled
+ * tracepoint is a single predicted branch. To record them:
+ *
+ *   lttng create cpcd && lttng enable-event -u 'cpcd:*' && lttng start
+ *
+ * and the latency breakdowns can be computed from the babeltrace2 output, by
+ * matching client_recv, frame_tx, tx_complete and ack by endpoint and seq.
+ *
+ * Without COMPILE_LTTNG, the events compile to nothing.
+ */
+
+#ifdef COMPILE_LTTNG
+
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER cpcd
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "misc/tracepoints.h"
+
+#if !defined(TRACEPOINTS_H) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define TRACEPOINTS_H
+
+#include <stdint.h>
+#include <lttng/tracepoint.h>
+
+/* A frame the core received from the driver, with a valid header */
+TRACEPOINT_EVENT(cpcd, frame_rx,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, control, uint8_t, seq, uint8_t, ack, uint16_t, length),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer_hex(uint8_t, control, control)
+                           ctf_integer(uint8_t, seq, seq)
+                           ctf_integer(uint8_t, ack, ack)
+                           ctf_integer(uint16_t, length, length)))
+
+/* A frame the core pushed to the driver, re-transmissions included */
+TRACEPOINT_EVENT(cpcd, frame_tx,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, control, uint8_t, seq, uint8_t, ack, uint16_t, length),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer_hex(uint8_t, control, control)
+                           ctf_integer(uint8_t, seq, seq)
+                           ctf_integer(uint8_t, ack, ack)
+                           ctf_integer(uint16_t, length, length)))
+
+/* The driver reported a frame as written on the bus */
+TRACEPOINT_EVENT(cpcd, tx_complete,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, control, uint8_t, seq),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer_hex(uint8_t, control, control)
+                           ctf_integer(uint8_t, seq, seq)))
+
+/* An I-frame queued again, on timeout or selective reject */
+TRACEPOINT_EVENT(cpcd, retransmit,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, seq, uint8_t, attempt, uint8_t, selective),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer(uint8_t, seq, seq)
+                           ctf_integer(uint8_t, attempt, attempt)
+                           ctf_integer(uint8_t, selective, selective)))
+
+/* An ack released frames from the re-transmit queue */
+TRACEPOINT_EVENT(cpcd, ack,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, ack, uint8_t, seq, uint8_t, frames),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer(uint8_t, ack, ack)
+                           ctf_integer(uint8_t, seq, seq)
+                           ctf_integer(uint8_t, frames, frames)))
+
+/* Time spent encrypting or decrypting the payload of a frame */
+TRACEPOINT_EVENT(cpcd, crypto,
+                 TP_ARGS(uint8_t, endpoint, uint8_t, encrypt, uint16_t, length, uint64_t, duration_ns),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer(uint8_t, encrypt, encrypt)
+                           ctf_integer(uint16_t, length, length)
+                           ctf_integer(uint64_t, duration_ns, duration_ns)))
+
+/* A write of a client handed to the core */
+TRACEPOINT_EVENT(cpcd, client_recv,
+                 TP_ARGS(uint8_t, endpoint, uint32_t, length),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer(uint32_t, length, length)))
+
+/* Data of the secondary sent to one client of the endpoint, err is an errno */
+TRACEPOINT_EVENT(cpcd, client_send,
+                 TP_ARGS(uint8_t, endpoint, uint32_t, length, int, err),
+                 TP_FIELDS(ctf_integer(uint8_t, endpoint, endpoint)
+                           ctf_integer(uint32_t, length, length)
+                           ctf_integer(int, err, err)))
+
+#endif //TRACEPOINTS_H
+
+#include <lttng/tracepoint-event.h>
+
+#define CPCD_TRACEPOINT(event, ...)       tracepoint(cpcd, event, __VA_ARGS__)
+#define CPCD_TRACEPOINT_ENABLED(event)    tracepoint_enabled(cpcd, event)
+
+#else
+
+#ifndef TRACEPOINTS_H
+#define TRACEPOINTS_H
+
+/* Keeps the arguments used, and type checked against nothing, without evaluating them */
+static inline void cpcd_tracepoint_disabled(int unused, ...)
+{
+  (void)unused;
+}
+
+#define CPCD_TRACEPOINT(event, ...)       do { if (0) { cpcd_tracepoint_disabled(0, __VA_ARGS__); } } while (0)
+#define CPCD_TRACEPOINT_ENABLED(event)    0
+
+#endif //TRACEPOINTS_H
+
+#endif //COMPILE_LTTNG
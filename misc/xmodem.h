@@ -22,9 +22,13 @@
 
 /// Size of an XMODEM packet
 #define XMODEM_DATA_SIZE              128
+/// Size of an XMODEM-1K packet
+#define XMODEM_1K_DATA_SIZE           1024
 
 /// Start of Header
 #define XMODEM_CMD_SOH                (0x01)
+/// Start of Header of an XMODEM-1K packet
+#define XMODEM_CMD_STX                (0x02)
 /// End of Transmission
 #define XMODEM_CMD_EOT                (0x04)
 /// Acknowledge
@@ -46,6 +50,14 @@ typedef struct {
   uint16_t crc;                     ///< CRC
 } __attribute__((packed)) XmodemFrame_t;
 
+typedef struct {
+  uint8_t header;                   ///< Packet header (@ref XMODEM_CMD_STX)
+  uint8_t seq;                      ///< Packet sequence number
+  uint8_t seq_neg;                  ///< Complement of packet sequence number
+  uint8_t data[XMODEM_1K_DATA_SIZE];///< Payload
+  uint16_t crc;                     ///< CRC
+} __attribute__((packed)) Xmodem1kFrame_t;
+
 #define min(a, b)       ((a) < (b) ? (a) : (b))
 
 #endif /* XMODEM_H */
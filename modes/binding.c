@@ -22,6 +22,7 @@
 #include "security/security.h"
 #include "driver/driver_spi.h"
 #include "driver/driver_uart.h"
+#include "driver/driver_net.h"
 #include "misc/config.h"
 #include "misc/logging.h"
 
@@ -66,6 +67,12 @@ void run_binding_mode(void)
                                       config.spi_irq_pin,
                                       config.fu_wake_chip,
                                       config.fu_spi_wake_pin);
+    } else if (config.bus == NET) {
+      driver_thread = driver_net_init(&fd_socket_driver_core,
+                                      &fd_socket_driver_core_notify,
+                                      config.net_address,
+                                      config.net_port,
+                                      config.net_protocol);
     } else {
       BUG();
     }
@@ -15,15 +15,21 @@
  *
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
+#include <pthread.h>
+
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "modes/firmware_update.h"
+#include "modes/firmware_upload.h"
 #include "server_core/server_core.h"
 #include "server_core/system_endpoint/system.h"
 #include "driver/driver_uart.h"
 #include "driver/driver_spi.h"
+#include "driver/driver_net.h"
 #include "driver/driver_xmodem.h"
 #include "driver/driver_ezsp.h"
 #include "misc/config.h"
@@ -31,17 +37,24 @@
 #include "misc/logging.h"
 #include "misc/sl_status.h"
 #include "misc/sleep.h"
+#include "security/security.h"
 #include "version.h"
 
 #define MAX_EPOLL_EVENTS 10
 #define RESET_TIMEOUT_MS 5000
 
+/* Time given to the secondary to reset into its bootloader once it acknowledged the install */
+#define INSTALL_RESET_TIMEOUT_S 30
+
 extern pthread_t driver_thread;
 extern pthread_t server_core_thread;
 
 extern char *server_core_secondary_app_version;
 extern uint8_t server_core_secondary_protocol_version;
 extern sl_cpc_bootloader_t server_core_secondary_bootloader_type;
+extern uint32_t server_core_secondary_bootloader_capabilities;
+
+void main_wait_crash_or_graceful_exit(void);
 
 static gpio_t wake_gpio;
 static gpio_t irq_gpio;
@@ -57,12 +70,21 @@ static void deassert_wake(void);
 static void reboot_secondary_with_pins_into_bootloader(void);
 static void reboot_secondary_by_cpc(server_core_mode_t mode);
 
+static void init_driver(int *fd_socket_driver_core, int *fd_socket_driver_core_notify);
+
 static sl_status_t transfer_firmware(void);
 
+static void run_firmware_update_over_cpc(void);
+
 void run_firmware_update(void)
 {
   sl_status_t status;
 
+  if (config.fu_over_cpc) {
+    run_firmware_update_over_cpc();
+    return;
+  }
+
   // If fu_connect_to_bootloader is true,
   // we assume the bootloader is already running.
   if (!config.fu_connect_to_bootloader) {
@@ -145,6 +167,24 @@ void run_firmware_update(void)
   }
 }
 
+/* The capabilities are only known when the secondary was asked for them over CPC */
+static xmodem_mode_t select_xmodem_mode(void)
+{
+  if (config.fu_xmodem_mode != XMODEM_MODE_AUTO) {
+    return config.fu_xmodem_mode;
+  }
+
+  if (server_core_secondary_bootloader_capabilities & CPC_BOOTLOADER_CAPABILITIES_XMODEM_STREAMING_MASK) {
+    return XMODEM_MODE_STREAMING;
+  }
+
+  if (server_core_secondary_bootloader_capabilities & CPC_BOOTLOADER_CAPABILITIES_XMODEM_1K_MASK) {
+    return XMODEM_MODE_1K;
+  }
+
+  return XMODEM_MODE_CRC;
+}
+
 static sl_status_t transfer_firmware(void)
 {
   sl_status_t status;
@@ -154,8 +194,9 @@ static sl_status_t transfer_firmware(void)
   if (config.bus == UART) {
     status = xmodem_send(config.fu_file,
                          config.uart_file,
-                         config.uart_baudrate,
-                         config.uart_hardflow);
+                         config.fu_uart_baudrate ? config.fu_uart_baudrate : config.uart_baudrate,
+                         config.uart_hardflow,
+                         select_xmodem_mode());
   } else if (config.bus == SPI) {
     status = send_firmware(config.fu_file,
                            config.spi_file,
@@ -167,7 +208,8 @@ static sl_status_t transfer_firmware(void)
                            config.spi_irq_chip,
                            config.spi_irq_pin,
                            config.fu_wake_chip,
-                           config.fu_spi_wake_pin);
+                           config.fu_spi_wake_pin,
+                           config.fu_spi_pipelined);
   } else {
     BUG();
   }
@@ -175,23 +217,68 @@ static sl_status_t transfer_firmware(void)
   return status;
 }
 
-static void reboot_secondary_by_cpc(server_core_mode_t mode)
+static void* firmware_upload_thread_func(void* param)
+{
+  sl_status_t status;
+
+  (void)param;
+
+  status = firmware_upload_send(config.fu_file);
+  if (status == SL_STATUS_OK) {
+    PRINT_INFO("Firmware uploaded, requesting the secondary to install it...");
+    status = firmware_upload_install();
+  }
+
+  if (status != SL_STATUS_OK) {
+    PRINT_INFO("Firmware upgrade failed");
+    config_exit_cpcd(EXIT_FAILURE);
+  }
+
+  /* The core ends the update when the secondary resets */
+  sleep_s(INSTALL_RESET_TIMEOUT_S);
+
+  FATAL("The secondary did not reset to install the firmware");
+  return NULL;
+}
+
+/* The application keeps running, and serving the clients, while the image is uploaded */
+static void run_firmware_update_over_cpc(void)
 {
   int fd_socket_driver_core;
   int fd_socket_driver_core_notify;
-  void* join_value;
+  pthread_t firmware_upload_thread;
   int ret;
 
-  // Init the driver
+  init_driver(&fd_socket_driver_core, &fd_socket_driver_core_notify);
+
+  server_core_thread = server_core_init(fd_socket_driver_core, fd_socket_driver_core_notify, SERVER_CORE_MODE_NORMAL);
+
+#if defined(ENABLE_ENCRYPTION)
+  if (config.use_encryption == true) {
+    security_post_command(SECURITY_COMMAND_INITIALIZE_SESSION);
+  }
+#endif
+
+  ret = pthread_create(&firmware_upload_thread, NULL, firmware_upload_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(firmware_upload_thread, "fw_upload");
+  FATAL_ON(ret != 0);
+
+  main_wait_crash_or_graceful_exit();
+}
+
+static void init_driver(int *fd_socket_driver_core, int *fd_socket_driver_core_notify)
+{
   if (config.bus == UART) {
-    driver_thread = driver_uart_init(&fd_socket_driver_core,
-                                     &fd_socket_driver_core_notify,
+    driver_thread = driver_uart_init(fd_socket_driver_core,
+                                     fd_socket_driver_core_notify,
                                      config.uart_file,
                                      config.uart_baudrate,
                                      config.uart_hardflow);
   } else if (config.bus == SPI) {
-    driver_thread = driver_spi_init(&fd_socket_driver_core,
-                                    &fd_socket_driver_core_notify,
+    driver_thread = driver_spi_init(fd_socket_driver_core,
+                                    fd_socket_driver_core_notify,
                                     config.spi_file,
                                     config.spi_mode,
                                     config.spi_bit_per_word,
@@ -202,9 +289,25 @@ static void reboot_secondary_by_cpc(server_core_mode_t mode)
                                     config.spi_irq_pin,
                                     config.fu_wake_chip,
                                     config.fu_spi_wake_pin);
+  } else if (config.bus == NET) {
+    driver_thread = driver_net_init(fd_socket_driver_core,
+                                    fd_socket_driver_core_notify,
+                                    config.net_address,
+                                    config.net_port,
+                                    config.net_protocol);
   } else {
     BUG();
   }
+}
+
+static void reboot_secondary_by_cpc(server_core_mode_t mode)
+{
+  int fd_socket_driver_core;
+  int fd_socket_driver_core_notify;
+  void* join_value;
+  int ret;
+
+  init_driver(&fd_socket_driver_core, &fd_socket_driver_core_notify);
 
   server_core_thread = server_core_init(fd_socket_driver_core, fd_socket_driver_core_notify, mode);
 
@@ -0,0 +1,398 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Firmware Upload over CPC
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "modes/firmware_upload.h"
+#include "misc/config.h"
+#include "misc/endianess.h"
+#include "misc/logging.h"
+#include "misc/sleep.h"
+#include "server_core/server/server_ready_sync.h"
+#include "sl_cpc.h"
+
+/* Chunks sent ahead of the answers of the secondary, on top of the window of the core */
+#define FIRMWARE_UPLOAD_WINDOW 8
+
+/* Also bounds the time the secondary can take to check the stored image */
+#define FIRMWARE_UPLOAD_READ_TIMEOUT_SEC 10
+
+/* Sessions started again after losing the endpoint, before giving up */
+#define FIRMWARE_UPLOAD_MAX_ATTEMPTS 5
+
+static cpc_handle_t lib_handle;
+static cpc_endpoint_t upload_ep;
+static bool lib_initialized = false;
+static bool install_requested = false;
+
+static uint32_t crc32(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xFFFFFFFFu;
+
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+  }
+
+  return ~crc;
+}
+
+static int open_upload_endpoint(void)
+{
+  int max_retries = 5;
+  cpc_timeval_t timeout;
+  int ret;
+
+  if (!lib_initialized) {
+    /* Block until the server is up and running */
+    server_ready_wait();
+
+    ret = cpc_init(&lib_handle, config.instance_name, false, NULL);
+    FATAL_ON(ret < 0);
+    lib_initialized = true;
+  }
+
+  timeout.seconds      = FIRMWARE_UPLOAD_READ_TIMEOUT_SEC;
+  timeout.microseconds = 0;
+
+  do {
+    ret = cpc_open_endpoint(lib_handle, &upload_ep, SL_CPC_ENDPOINT_FIRMWARE_UPDATE, 1);
+    if (ret == -EAGAIN) {
+      max_retries--;
+      sleep_s(1);
+    }
+  } while (ret == -EAGAIN && max_retries > 0);
+
+  if (ret < 0) {
+    WARN("Failed to open the firmware update endpoint (%d). Make sure the secondary application implements it.", ret);
+    return ret;
+  }
+
+  ret = cpc_set_endpoint_option(upload_ep, CPC_OPTION_RX_TIMEOUT, &timeout, sizeof(timeout));
+  FATAL_ON(ret < 0);
+
+  return 0;
+}
+
+static void close_upload_endpoint(void)
+{
+  int ret;
+
+  ret = cpc_close_endpoint(&upload_ep);
+  FATAL_ON(ret < 0);
+}
+
+/* A negative errno if the endpoint was lost, the status and next offset otherwise */
+static int read_status(uint8_t *status, uint32_t *next_offset)
+{
+  uint8_t buffer[SL_CPC_READ_MINIMUM_SIZE];
+  const firmware_upload_status_t *answer = (const firmware_upload_status_t *)buffer;
+  ssize_t ret;
+
+  ret = cpc_read_endpoint(upload_ep, buffer, sizeof(buffer), CPC_ENDPOINT_READ_FLAG_NONE);
+  if (ret < 0) {
+    return (int)ret;
+  }
+
+  if ((size_t)ret < sizeof(firmware_upload_status_t) || answer->cmd != FIRMWARE_UPLOAD_CMD_STATUS) {
+    WARN("Malformed answer of the secondary, %zd bytes", ret);
+    *status = FIRMWARE_UPLOAD_STATUS_INVALID;
+    return 0;
+  }
+
+  *status = answer->status;
+  *next_offset = le32_to_cpu(answer->next_offset);
+
+  return 0;
+}
+
+static int write_command(const void *command, size_t length)
+{
+  ssize_t ret;
+
+  ret = cpc_write_endpoint(upload_ep, command, length, CPC_ENDPOINT_WRITE_FLAG_NONE);
+  if (ret < 0) {
+    return (int)ret;
+  }
+
+  return 0;
+}
+
+static int send_chunk(uint8_t *buffer, const uint8_t *image, uint32_t offset, size_t length)
+{
+  firmware_upload_chunk_t *chunk = (firmware_upload_chunk_t *)buffer;
+
+  chunk->cmd = FIRMWARE_UPLOAD_CMD_CHUNK;
+  chunk->offset = cpu_to_le32(offset);
+  memcpy(chunk->data, &image[offset], length);
+
+  return write_command(buffer, sizeof(firmware_upload_chunk_t) + length);
+}
+
+/* SL_STATUS_IN_PROGRESS if the endpoint was lost and the session can be started again */
+static sl_status_t upload_session(const uint8_t *image, uint32_t image_size, uint32_t image_crc)
+{
+  firmware_upload_start_t start;
+  uint8_t *buffer;
+  size_t max_write_size;
+  size_t chunk_size;
+  uint32_t acked;
+  uint32_t sent;
+  uint32_t next_offset = 0;
+  uint8_t status;
+  uint32_t last_progress = 0;
+  sl_status_t result = SL_STATUS_FAIL;
+  int ret;
+
+  ret = cpc_get_endpoint_max_write_size(upload_ep, &max_write_size);
+  FATAL_ON(ret < 0);
+  FATAL_ON(max_write_size <= sizeof(firmware_upload_chunk_t));
+
+  chunk_size = max_write_size - sizeof(firmware_upload_chunk_t);
+  if (chunk_size > UINT16_MAX) {
+    chunk_size = UINT16_MAX;
+  }
+
+  buffer = malloc(sizeof(firmware_upload_chunk_t) + chunk_size);
+  FATAL_ON(buffer == NULL);
+
+  start.cmd = FIRMWARE_UPLOAD_CMD_START;
+  start.image_size = cpu_to_le32(image_size);
+  start.image_crc = cpu_to_le32(image_crc);
+  start.chunk_size = cpu_to_le16((uint16_t)chunk_size);
+
+  ret = write_command(&start, sizeof(start));
+  if (ret == 0) {
+    ret = read_status(&status, &next_offset);
+  }
+  if (ret < 0) {
+    result = SL_STATUS_IN_PROGRESS;
+    goto out;
+  }
+
+  if (status != FIRMWARE_UPLOAD_STATUS_OK || next_offset > image_size) {
+    WARN("The secondary refused the image (status %u)", status);
+    goto out;
+  }
+
+  if (next_offset != 0) {
+    PRINT_INFO("Resuming the upload at %u of %u bytes", next_offset, image_size);
+  }
+
+  TRACE_FIRMWARE_UPLOAD("Sending %u bytes from %u in chunks of %zu bytes", image_size, next_offset, chunk_size);
+
+  acked = next_offset;
+  sent = next_offset;
+
+  while (acked < image_size) {
+    /* Keep the window full, the answers are cumulative */
+    while (sent < image_size && sent - acked < FIRMWARE_UPLOAD_WINDOW * chunk_size) {
+      size_t length = image_size - sent;
+
+      if (length > chunk_size) {
+        length = chunk_size;
+      }
+
+      ret = send_chunk(buffer, image, sent, length);
+      if (ret < 0) {
+        result = SL_STATUS_IN_PROGRESS;
+        goto out;
+      }
+      sent += (uint32_t)length;
+    }
+
+    ret = read_status(&status, &next_offset);
+    if (ret < 0) {
+      result = SL_STATUS_IN_PROGRESS;
+      goto out;
+    }
+
+    if (next_offset < acked || next_offset > sent) {
+      WARN("The secondary answered offset %u out of the window [%u, %u]", next_offset, acked, sent);
+      goto out;
+    }
+
+    if (status == FIRMWARE_UPLOAD_STATUS_OK) {
+      acked = next_offset;
+    } else if (status == FIRMWARE_UPLOAD_STATUS_REJECTED) {
+      TRACE_FIRMWARE_UPLOAD("Chunks rejected, resending from %u", next_offset);
+      acked = next_offset;
+      sent = next_offset;
+    } else {
+      WARN("The secondary failed to store the image at %u (status %u)", next_offset, status);
+      goto out;
+    }
+
+    if (acked - last_progress >= image_size / 10) {
+      last_progress = acked;
+      TRACE_FIRMWARE_UPLOAD("%u of %u bytes stored", acked, image_size);
+    }
+  }
+
+  {
+    uint8_t finish = FIRMWARE_UPLOAD_CMD_FINISH;
+
+    ret = write_command(&finish, sizeof(finish));
+    if (ret == 0) {
+      ret = read_status(&status, &next_offset);
+    }
+    if (ret < 0) {
+      result = SL_STATUS_IN_PROGRESS;
+      goto out;
+    }
+
+    if (status != FIRMWARE_UPLOAD_STATUS_OK) {
+      WARN("The secondary failed to verify the image (status %u)", status);
+      goto out;
+    }
+  }
+
+  result = SL_STATUS_OK;
+
+  out:
+  free(buffer);
+  return result;
+}
+
+sl_status_t firmware_upload_send(const char *image_file)
+{
+  uint8_t *image;
+  size_t image_len;
+  uint32_t image_crc;
+  struct timespec begin;
+  struct timespec end;
+  sl_status_t status = SL_STATUS_FAIL;
+  int attempt;
+
+  /* Memory map the firmware update file */
+  {
+    struct stat stat;
+    int image_file_fd;
+    int ret;
+
+    image_file_fd = open(image_file, O_RDONLY | O_CLOEXEC);
+    FATAL_SYSCALL_ON(image_file_fd < 0);
+
+    ret = fstat(image_file_fd, &stat);
+    FATAL_SYSCALL_ON(ret < 0);
+
+    image_len = (size_t)stat.st_size;
+    if (image_len == 0 || image_len > UINT32_MAX) {
+      FATAL("Firmware update file (%s) has an invalid size", image_file);
+    }
+
+    image = mmap(NULL, image_len, PROT_READ, MAP_PRIVATE, image_file_fd, 0);
+    FATAL_SYSCALL_ON(image == MAP_FAILED);
+
+    close(image_file_fd);
+  }
+
+  image_crc = crc32(image, image_len);
+
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  /* Each session resumes from what the secondary stored in the previous ones */
+  for (attempt = 0; attempt < FIRMWARE_UPLOAD_MAX_ATTEMPTS; attempt++) {
+    if (open_upload_endpoint() < 0) {
+      break;
+    }
+
+    status = upload_session(image, (uint32_t)image_len, image_crc);
+
+    close_upload_endpoint();
+
+    if (status != SL_STATUS_IN_PROGRESS) {
+      break;
+    }
+
+    WARN("Lost the firmware update endpoint, resuming the upload");
+    sleep_s(1);
+  }
+
+  if (status == SL_STATUS_IN_PROGRESS) {
+    status = SL_STATUS_FAIL;
+  }
+
+  if (status == SL_STATUS_OK) {
+    uint64_t elapsed_us;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_us = (uint64_t)(((int64_t)(end.tv_sec - begin.tv_sec) * 1000000000LL
+                             + ((int64_t)end.tv_nsec - (int64_t)begin.tv_nsec)) / 1000);
+    if (elapsed_us == 0) {
+      elapsed_us = 1;
+    }
+    PRINT_INFO("Uploaded %zu bytes in %llu ms, %llu bytes/s", image_len,
+               (unsigned long long)(elapsed_us / 1000u),
+               (unsigned long long)(image_len * 1000000u / elapsed_us));
+  }
+
+  munmap(image, image_len);
+
+  return status;
+}
+
+sl_status_t firmware_upload_install(void)
+{
+  uint8_t install = FIRMWARE_UPLOAD_CMD_INSTALL;
+  uint8_t status = FIRMWARE_UPLOAD_STATUS_INVALID;
+  uint32_t next_offset;
+  int ret;
+
+  if (open_upload_endpoint() < 0) {
+    return SL_STATUS_FAIL;
+  }
+
+  /* Set before the secondary can reset, its acknowledgement may be lost in the reset */
+  __atomic_store_n(&install_requested, true, __ATOMIC_RELEASE);
+
+  ret = write_command(&install, sizeof(install));
+  if (ret == 0) {
+    ret = read_status(&status, &next_offset);
+  }
+
+  if (ret == 0 && status != FIRMWARE_UPLOAD_STATUS_OK) {
+    __atomic_store_n(&install_requested, false, __ATOMIC_RELEASE);
+    WARN("The secondary refused to install the image (status %u)", status);
+    close_upload_endpoint();
+    return SL_STATUS_FAIL;
+  }
+
+  if (ret < 0) {
+    /* The endpoint closes when the secondary resets before the answer is read */
+    TRACE_FIRMWARE_UPLOAD("No answer to the install command (%d)", ret);
+  }
+
+  close_upload_endpoint();
+
+  return SL_STATUS_OK;
+}
+
+bool firmware_upload_install_requested(void)
+{
+  return __atomic_load_n(&install_requested, __ATOMIC_ACQUIRE);
+}
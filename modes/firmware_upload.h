@@ -0,0 +1,93 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Firmware Upload over CPC
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef FIRMWARE_UPLOAD_H
+#define FIRMWARE_UPLOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "misc/sl_status.h"
+
+/*
+ * The image is streamed to the application of the secondary on the
+ * SL_CPC_ENDPOINT_FIRMWARE_UPDATE endpoint, so it benefits from the window
+ * and the encryption of the link while the other endpoints keep running.
+ * Every field is little endian.
+ *
+ *   START   : image size, CRC-32 of the image and chunk size. The secondary
+ *             answers with the offset it already stored for that image,
+ *             0 for a new one.
+ *   CHUNK   : the data at an offset. The secondary answers with the offset
+ *             of the next chunk it expects, it may answer several chunks at
+ *             once. A chunk that does not start at that offset is answered
+ *             with a single REJECTED, the chunks that follow it are dropped
+ *             silently until the expected offset is sent again.
+ *   FINISH  : the secondary checks the CRC-32 of the stored image.
+ *   INSTALL : the secondary acknowledges, then reboots into its bootloader
+ *             to install the stored image.
+ */
+
+#define FIRMWARE_UPLOAD_CMD_START   0x01
+#define FIRMWARE_UPLOAD_CMD_CHUNK   0x02
+#define FIRMWARE_UPLOAD_CMD_FINISH  0x03
+#define FIRMWARE_UPLOAD_CMD_INSTALL 0x04
+#define FIRMWARE_UPLOAD_CMD_STATUS  0x80
+
+#define FIRMWARE_UPLOAD_STATUS_OK       0x00
+#define FIRMWARE_UPLOAD_STATUS_REJECTED 0x01 ///< Resend from the offset of the answer
+#define FIRMWARE_UPLOAD_STATUS_INVALID  0x02 ///< Malformed or unexpected command
+#define FIRMWARE_UPLOAD_STATUS_STORAGE  0x03 ///< The image does not fit, or could not be stored
+#define FIRMWARE_UPLOAD_STATUS_VERIFY   0x04 ///< The CRC-32 of the stored image does not match
+
+typedef struct {
+  uint8_t  cmd;
+  uint32_t image_size;
+  uint32_t image_crc;
+  uint16_t chunk_size;
+} __attribute__((packed)) firmware_upload_start_t;
+
+typedef struct {
+  uint8_t  cmd;
+  uint32_t offset;
+  uint8_t  data[];
+} __attribute__((packed)) firmware_upload_chunk_t;
+
+typedef struct {
+  uint8_t  cmd;
+  uint8_t  status;
+  uint32_t next_offset;
+} __attribute__((packed)) firmware_upload_status_t;
+
+/***************************************************************************//**
+ * Upload an image to the application of the secondary, resuming from what it
+ * already stored. The daemon must be running in the normal mode.
+ *
+ * @return SL_STATUS_OK once the secondary verified the whole image.
+ ******************************************************************************/
+sl_status_t firmware_upload_send(const char *image_file);
+
+/***************************************************************************//**
+ * Ask the secondary to install the uploaded image. It resets once it
+ * acknowledged, firmware_upload_install_requested() then tells the core that
+ * the reset is expected.
+ ******************************************************************************/
+sl_status_t firmware_upload_install(void);
+
+bool firmware_upload_install_requested(void);
+
+#endif //FIRMWARE_UPLOAD_H
@@ -0,0 +1,365 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Link Qualification Mode
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "modes/link_qualification.h"
+#include "server_core/server_core.h"
+#include "server_core/server/server_ready_sync.h"
+#include "driver/driver_uart.h"
+#include "driver/driver_net.h"
+#include "driver/driver_spi.h"
+#if defined(CPC_BENCH)
+#include "driver/driver_emul.h"
+#endif
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/sleep.h"
+#include "security/security.h"
+#include "sl_cpc.h"
+
+/* Round trips measured with a single frame in flight, for each size */
+#define RTT_SAMPLES 100
+
+/* Frames in flight while measuring the throughput, enough to keep the window of the core full */
+#define THROUGHPUT_IN_FLIGHT 16
+
+/* An echo that takes longer is counted as lost */
+#define ECHO_TIMEOUT_SEC 2
+
+extern pthread_t driver_thread;
+extern pthread_t server_core_thread;
+
+static cpc_handle_t lib_handle;
+static cpc_endpoint_t endpoint;
+
+static uint8_t tx_buffer[SL_CPC_READ_MINIMUM_SIZE];
+static uint8_t rx_buffer[SL_CPC_READ_MINIMUM_SIZE];
+
+/* Echoes that did not come back in time, or not as they were sent */
+static uint32_t lost_echoes;
+static uint32_t corrupted_echoes;
+
+/* External functions */
+__attribute__((noreturn)) void software_graceful_exit(void);
+
+static uint64_t now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void init_driver_and_core(void)
+{
+  int fd_socket_driver_core;
+  int fd_socket_driver_core_notify;
+
+  if (config.bus == UART) {
+    driver_thread = driver_uart_init(&fd_socket_driver_core, &fd_socket_driver_core_notify, config.uart_file, config.uart_baudrate, config.uart_hardflow);
+  } else if (config.bus == SPI) {
+    driver_thread = driver_spi_init(&fd_socket_driver_core,
+                                    &fd_socket_driver_core_notify,
+                                    config.spi_file,
+                                    config.spi_mode,
+                                    config.spi_bit_per_word,
+                                    config.spi_bitrate,
+                                    config.spi_cs_chip,
+                                    config.spi_cs_pin,
+                                    config.spi_irq_chip,
+                                    config.spi_irq_pin,
+                                    config.fu_wake_chip,
+                                    config.fu_spi_wake_pin);
+  } else if (config.bus == NET) {
+    driver_thread = driver_net_init(&fd_socket_driver_core,
+                                    &fd_socket_driver_core_notify,
+                                    config.net_address,
+                                    config.net_port,
+                                    config.net_protocol);
+#if defined(CPC_BENCH)
+  } else if (config.bus == EMUL) {
+    driver_thread = driver_emul_init(&fd_socket_driver_core, &fd_socket_driver_core_notify);
+#endif
+  } else {
+    BUG();
+  }
+
+  server_core_thread = server_core_init(fd_socket_driver_core, fd_socket_driver_core_notify, SERVER_CORE_MODE_NORMAL);
+
+#if defined(ENABLE_ENCRYPTION)
+  if (config.use_encryption == true) {
+    security_post_command(SECURITY_COMMAND_INITIALIZE_SESSION);
+  }
+#endif
+}
+
+static void open_echo_endpoint(void)
+{
+  int max_retries = 5;
+  cpc_timeval_t timeout;
+  int ret;
+
+  /* Block until the server is up and running */
+  server_ready_wait();
+
+  ret = cpc_init(&lib_handle, config.instance_name, false, NULL);
+  FATAL_ON(ret < 0);
+
+  do {
+    ret = cpc_open_endpoint(lib_handle, &endpoint, config.link_qualification_endpoint, 1);
+    if (ret == -EAGAIN) {
+      max_retries--;
+      sleep_s(1);
+    }
+  } while (ret == -EAGAIN && max_retries > 0);
+
+  if (ret < 0) {
+    FATAL("Failed to open endpoint #%u (%d). Make sure the secondary echoes on it.", config.link_qualification_endpoint, ret);
+  }
+
+  timeout.seconds      = ECHO_TIMEOUT_SEC;
+  timeout.microseconds = 0;
+
+  ret = cpc_set_endpoint_option(endpoint, CPC_OPTION_RX_TIMEOUT, &timeout, sizeof(timeout));
+  FATAL_ON(ret < 0);
+}
+
+/* Each frame has its own content, a late echo is not taken for the next one */
+static void fill_frame(uint32_t seq, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    tx_buffer[i] = (uint8_t)(seq * 31u + i);
+  }
+}
+
+static bool check_echo(uint32_t seq, const uint8_t *echo, size_t size)
+{
+  for (size_t i = 0; i < size; i++) {
+    if (echo[i] != (uint8_t)(seq * 31u + i)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void write_frame(uint32_t seq, size_t size)
+{
+  ssize_t ret;
+
+  fill_frame(seq, size);
+
+  ret = cpc_write_endpoint(endpoint, tx_buffer, size, CPC_ENDPOINT_WRITE_FLAG_NONE);
+  if (ret < 0) {
+    FATAL("FAILURE : Could not write a frame of %zu bytes (%zd)", size, ret);
+  }
+}
+
+/* False if no echo came back in time */
+static bool read_echo(uint32_t seq, size_t size)
+{
+  ssize_t ret;
+
+  ret = cpc_read_endpoint(endpoint, rx_buffer, sizeof(rx_buffer), CPC_ENDPOINT_READ_FLAG_NONE);
+  if (ret == -EAGAIN) {
+    lost_echoes++;
+    return false;
+  } else if (ret < 0) {
+    FATAL("FAILURE : Could not read an echo (%zd)", ret);
+  }
+
+  if ((size_t)ret != size || !check_echo(seq, rx_buffer, size)) {
+    corrupted_echoes++;
+  }
+
+  return true;
+}
+
+static void measure_rtt(size_t size)
+{
+  uint64_t samples[RTT_SAMPLES];
+  size_t count = 0;
+
+  for (uint32_t seq = 0; seq < RTT_SAMPLES; seq++) {
+    uint64_t begin = now_ns();
+
+    write_frame(seq, size);
+    if (read_echo(seq, size)) {
+      samples[count++] = now_ns() - begin;
+    }
+  }
+
+  if (count == 0) {
+    PRINT_INFO("RTT %5zu bytes : no echo", size);
+    return;
+  }
+
+  qsort(samples, count, sizeof(samples[0]), compare_u64);
+
+  PRINT_INFO("RTT %5zu bytes : min %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+             size,
+             (double)samples[0] / 1e6,
+             (double)samples[count / 2] / 1e6,
+             (double)samples[(count * 99) / 100] / 1e6,
+             (double)samples[count - 1] / 1e6);
+}
+
+static void measure_throughput(size_t size, uint64_t duration_ns)
+{
+  uint64_t begin = now_ns();
+  uint64_t end = begin + duration_ns;
+  uint64_t elapsed_ns;
+  uint32_t tx_seq = 0;
+  uint32_t rx_seq = 0;
+  uint64_t echoed = 0;
+
+  while (now_ns() < end || rx_seq != tx_seq) {
+    /* Stop sending at the end, and wait for what is in flight */
+    while (now_ns() < end && tx_seq - rx_seq < THROUGHPUT_IN_FLIGHT) {
+      write_frame(tx_seq++, size);
+    }
+
+    if (!read_echo(rx_seq, size)) {
+      /* The echoes still in flight will not match, start over */
+      break;
+    }
+    rx_seq++;
+    echoed++;
+  }
+
+  elapsed_ns = now_ns() - begin;
+
+  PRINT_INFO("Throughput %5zu bytes : %llu bytes/s each way, %llu frames/s",
+             size,
+             (unsigned long long)(echoed * size * 1000000000u / elapsed_ns),
+             (unsigned long long)(echoed * 1000000000u / elapsed_ns));
+
+  /* Let the late echoes arrive, and drop them */
+  while (rx_seq != tx_seq) {
+    if (cpc_read_endpoint(endpoint, rx_buffer, sizeof(rx_buffer), CPC_ENDPOINT_READ_FLAG_NONE) < 0) {
+      break;
+    }
+    rx_seq++;
+  }
+}
+
+static void print_bus(size_t max_write_size)
+{
+  if (config.bus == UART) {
+    PRINT_INFO("Qualifying the UART link at %u bauds%s, frames of up to %zu bytes on endpoint #%u",
+               driver_uart_get_baudrate(), config.uart_hardflow ? " with flow control" : "",
+               max_write_size, config.link_qualification_endpoint);
+  } else if (config.bus == SPI) {
+    PRINT_INFO("Qualifying the SPI link at %u Hz, frames of up to %zu bytes on endpoint #%u",
+               config.spi_bitrate, max_write_size, config.link_qualification_endpoint);
+  } else {
+    PRINT_INFO("Qualifying the link, frames of up to %zu bytes on endpoint #%u",
+               max_write_size, config.link_qualification_endpoint);
+  }
+}
+
+static void print_error_rates(const core_debug_counters_t *before)
+{
+  const core_debug_counters_t *after = &primary_core_debug_counters;
+  uint32_t rxd = after->rxd_frame - before->rxd_frame;
+  uint32_t txd = after->txd_completed - before->txd_completed;
+  uint32_t crc_errors = (after->invalid_header_checksum - before->invalid_header_checksum)
+                        + (after->invalid_payload_checksum - before->invalid_payload_checksum);
+  uint32_t retransmits = (after->retxd_data_frame - before->retxd_data_frame)
+                         + (after->retxd_selective_data_frame - before->retxd_selective_data_frame);
+  uint32_t dropped = after->driver_packet_dropped - before->driver_packet_dropped;
+
+  PRINT_INFO("CRC errors : %u in %u frames received (%.4f%%)",
+             crc_errors, rxd, rxd ? 100.0 * crc_errors / rxd : 0.0);
+  PRINT_INFO("Re-transmits : %u in %u frames sent (%.4f%%)",
+             retransmits, txd, txd ? 100.0 * retransmits / txd : 0.0);
+  PRINT_INFO("Dropped by the driver : %u, lost echoes : %u, corrupted echoes : %u",
+             dropped, lost_echoes, corrupted_echoes);
+}
+
+void run_link_qualification(void)
+{
+  static const size_t frame_sizes[] = { 1, 16, 64, 256, 1024, SL_CPC_READ_MINIMUM_SIZE };
+  size_t sizes[sizeof(frame_sizes) / sizeof(frame_sizes[0])];
+  size_t sizes_count = 0;
+  size_t max_write_size;
+  core_debug_counters_t before;
+  uint64_t duration_ns;
+  int ret;
+
+  init_driver_and_core();
+
+  open_echo_endpoint();
+
+  ret = cpc_get_endpoint_max_write_size(endpoint, &max_write_size);
+  FATAL_ON(ret < 0);
+
+  if (max_write_size > sizeof(tx_buffer)) {
+    max_write_size = sizeof(tx_buffer);
+  }
+
+  /* The sizes below the largest frame, and the largest frame */
+  for (size_t i = 0; i < sizeof(frame_sizes) / sizeof(frame_sizes[0]); i++) {
+    if (frame_sizes[i] < max_write_size) {
+      sizes[sizes_count++] = frame_sizes[i];
+    } else {
+      sizes[sizes_count++] = max_write_size;
+      break;
+    }
+  }
+
+  print_bus(max_write_size);
+
+  /* The counters of the core are not reset, only their increase is reported */
+  before = primary_core_debug_counters;
+
+  for (size_t i = 0; i < sizes_count; i++) {
+    measure_rtt(sizes[i]);
+  }
+
+  duration_ns = (uint64_t)config.link_qualification_duration * 1000000000u / sizes_count;
+  for (size_t i = 0; i < sizes_count; i++) {
+    measure_throughput(sizes[i], duration_ns);
+  }
+
+  print_error_rates(&before);
+
+  ret = cpc_close_endpoint(&endpoint);
+  FATAL_ON(ret < 0);
+
+  if (lost_echoes || corrupted_echoes) {
+    FATAL("FAILURE : The link lost or corrupted frames, it is not stable at this speed");
+  }
+
+  PRINT_INFO("SUCCESS : The link is stable at this speed");
+
+  software_graceful_exit();
+}
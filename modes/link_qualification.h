@@ -0,0 +1,30 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Link Qualification Mode
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef LINK_QUALIFICATION_H
+#define LINK_QUALIFICATION_H
+
+/*
+ * Saturate the bus with I-frames of increasing sizes on
+ * config.link_qualification_endpoint, which the secondary must echo, and
+ * report the round trip times, the sustained throughput and the CRC and
+ * re-transmit rates at the bus speed the reset sequence settled on. Exits the
+ * daemon with a failure if an echo was lost or corrupted.
+ */
+void run_link_qualification(void);
+
+#endif //LINK_QUALIFICATION_H
@@ -19,8 +19,14 @@
 
 #include "modes/normal.h"
 #include "server_core/server_core.h"
+#include "server_core/handoff/handoff.h"
 #include "driver/driver_uart.h"
+#include "driver/driver_bond.h"
+#include "driver/driver_net.h"
 #include "driver/driver_spi.h"
+#if defined(CPC_BENCH)
+#include "driver/driver_emul.h"
+#endif
 #include "misc/config.h"
 #include "misc/logging.h"
 #include "security/security.h"
@@ -35,6 +41,11 @@ void run_normal_mode(void)
   int fd_socket_driver_core;
   int fd_socket_driver_core_notify;
 
+  // Take the link over from the running daemon, before the driver touches the bus
+  if (config.hot_restart_take_over) {
+    handoff_take_over();
+  }
+
   // Init the driver
   {
     if (config.bus == UART) {
@@ -52,11 +63,41 @@ void run_normal_mode(void)
                                       config.spi_irq_pin,
                                       config.fu_wake_chip,
                                       config.fu_spi_wake_pin);
+    } else if (config.bus == NET) {
+      driver_thread = driver_net_init(&fd_socket_driver_core,
+                                      &fd_socket_driver_core_notify,
+                                      config.net_address,
+                                      config.net_port,
+                                      config.net_protocol);
+#if defined(CPC_BENCH)
+    } else if (config.bus == EMUL) {
+      driver_thread = driver_emul_init(&fd_socket_driver_core, &fd_socket_driver_core_notify);
+#endif
     } else {
       BUG();
     }
   }
 
+  // Bond the second UART with the bus, the core sees a single link
+  if (config.bond_uart_file != NULL) {
+    driver_bond_link_t links[2] = {
+      {
+        .fd_to_core = fd_socket_driver_core,
+        .fd_notify_core = fd_socket_driver_core_notify,
+        .thread = driver_thread,
+        .bytes_per_second = config.bus == UART ? config.uart_baudrate / 10 : config.spi_bitrate / 8,
+        .name = config.bus == UART ? config.uart_file : config.spi_file,
+      },
+      {
+        .bytes_per_second = config.bond_uart_baudrate / 10,
+        .name = config.bond_uart_file,
+      },
+    };
+
+    links[1].thread = driver_uart_init_bonded(&links[1].fd_to_core, &links[1].fd_notify_core, config.bond_uart_file, config.bond_uart_baudrate, config.uart_hardflow);
+    driver_thread = driver_bond_init(&fd_socket_driver_core, &fd_socket_driver_core_notify, links, 2);
+  }
+
   server_core_thread = server_core_init(fd_socket_driver_core, fd_socket_driver_core_notify, SERVER_CORE_MODE_NORMAL);
 
 #if defined(ENABLE_ENCRYPTION)
@@ -17,11 +17,14 @@ def client_read(client, endpoint, event):
     global stop_flag
     size = endpoint.get_option(libcpc_wrapper.Option.CPC_OPTION_MAX_WRITE_SIZE)
     verboseprint("Write size: {}".format(size))
+    # Received into and written from the same buffer, without a copy per message
+    buffer = bytearray(size)
+    view = memoryview(buffer)
     while not stop_flag:
         try:
-            buffer = client.recv(size)
-            assert len(buffer) != 0
-            ret = endpoint.write(buffer)
+            length = client.recv_into(buffer)
+            assert length != 0
+            ret = endpoint.write(view[:length])
             assert ret != 0
         except:
             event.set()
@@ -32,12 +35,14 @@ def client_read(client, endpoint, event):
 
 def client_write(client, endpoint, event):
     global stop_flag
+    buffer = bytearray(libcpc_wrapper.READ_MINIMUM_SIZE)
+    view = memoryview(buffer)
     while not stop_flag:
         try:
-            buffer = endpoint.read()
-            assert len(buffer) != 0
-            verboseprint(' '.join(format(x, '02x') for x in buffer))
-            client.sendall(buffer)
+            length = endpoint.readinto(buffer)
+            assert length != 0
+            verboseprint(' '.join(format(x, '02x') for x in view[:length]))
+            client.sendall(view[:length])
         except:
             event.set()
             break
@@ -0,0 +1,46 @@
+import argparse
+import libcpc_wrapper
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+cpc = None
+
+class MetricsHandler(BaseHTTPRequestHandler):
+    def do_GET(self):
+        if self.path != "/metrics":
+            self.send_error(404)
+            return
+        #end if
+
+        try:
+            body = cpc.get_metrics(libcpc_wrapper.MetricsFormat.CPC_METRICS_FORMAT_PROMETHEUS).encode("utf-8")
+        except Exception as e:
+            self.send_error(503, str(e))
+            return
+        #end try
+
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain; version=0.0.4")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+    #end def
+#end class
+
+def main():
+    global cpc
+
+    parser = argparse.ArgumentParser(description="Serve the metrics of CPCd to Prometheus over HTTP")
+    parser.add_argument("-l", "--lib", help="Path to libcpc.so", required=True)
+    parser.add_argument("-i", "--instance", help="Name of the CPCd instance", default="cpcd_0")
+    parser.add_argument("-a", "--address", help="Address to listen on", default="127.0.0.1")
+    parser.add_argument("-p", "--port", help="Port to listen on", type=int, default=9334)
+    args = parser.parse_args()
+
+    cpc = libcpc_wrapper.CPC(args.lib, args.instance)
+
+    HTTPServer((args.address, args.port), MetricsHandler).serve_forever()
+#end def
+
+if __name__ == "__main__":
+    main()
+#end if
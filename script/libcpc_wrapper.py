@@ -1,5 +1,6 @@
 from ctypes import *
-from enum import Enum
+from enum import Enum, IntFlag
+import errno
 import signal
 
 
@@ -21,6 +22,46 @@ class Option(Enum):
     CPC_OPTION_SOCKET_SIZE = 4
     CPC_OPTION_MAX_WRITE_SIZE = 5
     CPC_OPTION_ENCRYPTED = 6
+    CPC_OPTION_TX_PRIORITY = 7
+    CPC_OPTION_SHM_TRANSPORT = 8
+    CPC_OPTION_TX_CREDIT = 9
+    CPC_OPTION_FRAGMENTATION = 10
+    CPC_OPTION_AGGREGATION = 11
+    CPC_OPTION_COMPRESSION = 12
+#end class
+
+class MetricsFormat(Enum):
+    CPC_METRICS_FORMAT_JSON = 0
+    CPC_METRICS_FORMAT_PROMETHEUS = 1
+#end class
+
+class TraceSubsystem(Enum):
+    CPC_TRACE_SUBSYSTEM_MISC = 0
+    CPC_TRACE_SUBSYSTEM_CORE = 1
+    CPC_TRACE_SUBSYSTEM_DRIVER = 2
+    CPC_TRACE_SUBSYSTEM_SERVER = 3
+    CPC_TRACE_SUBSYSTEM_SECURITY = 4
+    CPC_TRACE_SUBSYSTEM_SYSTEM = 5
+    CPC_TRACE_SUBSYSTEM_RESET = 6
+    CPC_TRACE_SUBSYSTEM_GPIO = 7
+    CPC_TRACE_SUBSYSTEM_XMODEM = 8
+    CPC_TRACE_SUBSYSTEM_EZSP_SPI = 9
+    CPC_TRACE_SUBSYSTEM_UART_VALIDATION = 10
+    CPC_TRACE_SUBSYSTEM_LIB = 11
+#end class
+
+class TraceLevel(Enum):
+    CPC_TRACE_LEVEL_DEBUG = 0
+    CPC_TRACE_LEVEL_FRAME = 1
+#end class
+
+class ProtocolParameter(Enum):
+    CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS = 0
+    CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS = 1
+    CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_MAX_COUNT = 2
+    CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE = 3
+    CPC_PROTOCOL_PARAMETER_KEEP_ALIVE_INTERVAL_MS = 4
+    CPC_PROTOCOL_PARAMETER_STATS_INTERVAL_S = 5
 #end class
 
 class EndpointEventOption(Enum):
@@ -29,6 +70,34 @@ class EndpointEventOption(Enum):
   CPC_ENDPOINT_EVENT_OPTION_READ_TIMEOUT = 2
 #end class
 
+class WaitEvent(IntFlag):
+    CPC_WAIT_EVENT_NONE = 0
+    CPC_WAIT_EVENT_READABLE = (1 << 0)
+    CPC_WAIT_EVENT_WRITABLE = (1 << 1)
+    CPC_WAIT_EVENT_HANGUP = (1 << 2)
+#end class
+
+# Largest message read from an endpoint, SL_CPC_READ_MINIMUM_SIZE
+READ_MINIMUM_SIZE = 4087
+
+def _buffer_pointer(buffer, writable):
+    """
+    A ctypes array over the memory of an object of the buffer protocol
+    (bytearray, memoryview, array, mmap...), so that the library reads or
+    writes it in place. A read-only object is copied when only read from.
+    """
+    view = memoryview(buffer)
+    if not view.c_contiguous:
+        raise ValueError("The buffer must be contiguous")
+    if view.format != 'B' or view.ndim != 1:
+        view = view.cast('B')
+    if view.readonly:
+        if writable:
+            raise TypeError("The buffer must be writable")
+        return (c_char * len(view)).from_buffer_copy(view), len(view)
+    return (c_char * len(view)).from_buffer(view), len(view)
+#end def
+
 class CPCTimeval(Structure):
     _fields_ = [('seconds', c_int),
                 ('microseconds', c_int)]
@@ -46,6 +115,37 @@ class CPCTimeval(Structure):
 
 #end class
 
+class CPCTxPriority(Structure):
+    _fields_ = [('level', c_ubyte),
+                ('weight', c_ubyte)]
+
+    def __init__(self, level, weight=1):
+        """
+        Initialize CPCTxPriority with a priority level, 0 being the highest,
+        and a round robin weight within that level.
+        """
+        self.level = level
+        self.weight = weight
+
+    def __str__(self):
+        return f"<CPCTxPriority (level={self.level}, weight={self.weight}>"
+
+#end class
+
+class CPCEndpointMsg(Structure):
+    _fields_ = [('buffer', c_void_p),
+                ('length', c_size_t),
+                ('status', c_ssize_t)]
+#end class
+
+class CPCWaitItem(Structure):
+    # The endpoint and event handles are structures holding a single pointer
+    _fields_ = [('endpoint', c_void_p),
+                ('event_handle', c_void_p),
+                ('events', c_ubyte),
+                ('revents', c_ubyte)]
+#end class
+
 class Endpoint(Structure):
 
     class Id(Enum):
@@ -71,6 +171,9 @@ class Endpoint(Structure):
 
     def __init__(self, cpc_handle):
         self.cpc_handle = cpc_handle
+        self.read_buffer = bytearray(READ_MINIMUM_SIZE)
+        self.read_view = memoryview(self.read_buffer)
+        self.msgs = None
 
     # int cpc_close_endpoint(cpc_endpoint_t *endpoint)
     def close(self):
@@ -81,50 +184,144 @@ class Endpoint(Structure):
 
     # ssize_t cpc_read_endpoint(cpc_endpoint_t endpoint, void *buffer, size_t count, cpc_endpoint_read_flags_t flags)
     def read(self, nonblock=False):
-        count = 4087
-        read_buffer = bytearray(count)
+        ret = self.readinto(self.read_buffer, nonblock)
+        if ret is None:
+            raise Exception("Failed to read endpoint")
 
-        flags = 0
-        if nonblock:
-            flags = (1 << 0)
+        # Sliced through a view, the message is copied once, into the bytes returned
+        return bytes(self.read_view[:ret])
+    #end def
 
-        byte_array = bytes(read_buffer)
-        byte_count = c_int(count)
-        read_flag = c_ubyte(flags)
-        ret = self.cpc_handle.lib_cpc.cpc_read_endpoint(self, byte_array, byte_count, read_flag)
+    def readinto(self, buffer, nonblock=False):
+        """
+        Read a message into a writable buffer (bytearray, memoryview...) of at
+        least READ_MINIMUM_SIZE bytes, without copying it. Returns the number of
+        bytes read, or None when nonblock is set and there is nothing to read.
+        """
+        pointer, length = _buffer_pointer(buffer, True)
+        ret = self.cpc_handle.lib_cpc.cpc_read_endpoint(self, pointer, length, 1 if nonblock else 0)
+        if ret == -errno.EAGAIN and nonblock:
+            return None
         if ret < 0:
-            raise Exception("Failed to read endpoint")
+            raise Exception("Failed to read endpoint: {}".format(ret))
 
-        return byte_array[:ret]
+        return ret
     #end def
 
     # ssize_t cpc_write_endpoint(cpc_endpoint_t endpoint, const void *data, size_t data_length, cpc_endpoint_write_flags_t flags)
     def write(self, data, nonblock=False):
-        data_length = len(data)
+        """
+        Write a message from any object of the buffer protocol, in place unless
+        it is read-only. Returns the number of bytes written, or None when
+        nonblock is set and the message doesn't fit.
+        """
+        pointer, length = _buffer_pointer(data, False)
+        ret = self.cpc_handle.lib_cpc.cpc_write_endpoint(self, pointer, length, 1 if nonblock else 0)
+        if ret == -errno.EAGAIN and nonblock:
+            return None
+        if ret != length:
+            raise Exception("Failed to write to endpoint")
 
-        flags = 0
-        if nonblock:
-            flags = (1 << 0)
+        return ret
+    #end def
 
-        byte_array = bytes(data)
-        length = c_int(data_length)
-        write_flag = c_ubyte(flags)
-        ret = self.cpc_handle.lib_cpc.cpc_write_endpoint(self, byte_array, length, write_flag)
-        if ret != data_length:
-            raise Exception("Failed to write to endpoint")
+    def _get_msgs(self, count):
+        if self.msgs is None or len(self.msgs) < count:
+            self.msgs = (CPCEndpointMsg * count)()
+        return self.msgs
+    #end def
+
+    # int cpc_read_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_read_flags_t flags);
+    def readinto_batch(self, buffers, nonblock=False):
+        """
+        Read several messages in one call, each into the next of the writable
+        buffers, of at least READ_MINIMUM_SIZE bytes each. Only the first
+        message is waited for. Returns the number of bytes read into each
+        buffer filled, an empty list when nonblock is set and there is nothing
+        to read.
+        """
+        msgs = self._get_msgs(len(buffers))
+        pointers = []
+        for i, buffer in enumerate(buffers):
+            pointer, length = _buffer_pointer(buffer, True)
+            pointers.append(pointer)
+            msgs[i].buffer = addressof(pointer)
+            msgs[i].length = length
+            msgs[i].status = 0
+
+        ret = self.cpc_handle.lib_cpc.cpc_read_endpoint_batch(self, msgs, len(buffers), 1 if nonblock else 0)
+        if ret == -errno.EAGAIN and nonblock:
+            return []
+        if ret < 0:
+            raise Exception("Failed to read endpoint: {}".format(ret))
+
+        return [msgs[i].status for i in range(ret)]
+    #end def
+
+    def read_batch(self, count=16, nonblock=False):
+        """
+        Read up to count messages in one call, as a list of bytes
+        """
+        if len(getattr(self, 'batch_buffers', ())) < count:
+            self.batch_buffers = [memoryview(bytearray(READ_MINIMUM_SIZE)) for _ in range(count)]
+
+        lengths = self.readinto_batch(self.batch_buffers[:count], nonblock)
+
+        return [bytes(self.batch_buffers[i][:length]) for i, length in enumerate(lengths)]
+    #end def
+
+    # int cpc_write_endpoint_batch(cpc_endpoint_t endpoint, cpc_endpoint_msg_t *msgs, size_t count, cpc_endpoint_write_flags_t flags);
+    def write_batch(self, messages, nonblock=False):
+        """
+        Write several messages in one call, in order, each one from an object
+        of the buffer protocol. Returns the number of messages written, 0 when
+        nonblock is set and the first one doesn't fit.
+        """
+        msgs = self._get_msgs(len(messages))
+        pointers = []
+        for i, message in enumerate(messages):
+            pointer, length = _buffer_pointer(message, False)
+            pointers.append(pointer)
+            msgs[i].buffer = addressof(pointer)
+            msgs[i].length = length
+            msgs[i].status = 0
+
+        ret = self.cpc_handle.lib_cpc.cpc_write_endpoint_batch(self, msgs, len(messages), 1 if nonblock else 0)
+        if ret == -errno.EAGAIN and nonblock:
+            return 0
+        if ret < 0:
+            raise Exception("Failed to write to endpoint: {}".format(ret))
+
+        return ret
+    #end def
+
+    # int cpc_get_endpoint_fd(cpc_endpoint_t endpoint);
+    def fileno(self):
+        """
+        The file descriptor to poll for the endpoint, so that it can be given
+        to select, selectors or asyncio. It must not be read from nor closed.
+        """
+        ret = self.cpc_handle.lib_cpc.cpc_get_endpoint_fd(self)
+        if ret < 0:
+            raise Exception("Failed to get the endpoint file descriptor: {}".format(ret))
 
         return ret
     #end def
 
     # int cpc_set_endpoint_option(cpc_endpoint_t endpoint, cpc_option_t option, const void *optval, size_t optlen);
     def set_option(self, option, optval):
-        if option == Option.CPC_OPTION_BLOCKING:
+        if option == Option.CPC_OPTION_BLOCKING or option == Option.CPC_OPTION_SHM_TRANSPORT or option == Option.CPC_OPTION_FRAGMENTATION or option == Option.CPC_OPTION_COMPRESSION:
             optval = c_bool(optval)
         elif option == Option.CPC_OPTION_RX_TIMEOUT or option == Option.CPC_OPTION_TX_TIMEOUT:
             if type(optval) is not CPCTimeval:
                 raise Exception("Invalid option type {}, expected CPCTimeval".format(type(optval)))
         elif option == Option.CPC_OPTION_SOCKET_SIZE:
             optval = c_int(optval)
+        elif option == Option.CPC_OPTION_AGGREGATION:
+            optval = c_uint32(optval)
+        elif option == Option.CPC_OPTION_TX_PRIORITY:
+            if type(optval) is not CPCTxPriority:
+                raise Exception("Invalid option type {}, expected CPCTxPriority".format(type(optval)))
         else:
             # best effort, convert it to int and let the library handle the failure
             optval = c_int(optval)
@@ -146,8 +343,10 @@ class Endpoint(Structure):
             optval = c_int()
         elif option == Option.CPC_OPTION_MAX_WRITE_SIZE:
             optval = c_int()
-        elif option == Option.CPC_OPTION_ENCRYPTED:
+        elif option == Option.CPC_OPTION_ENCRYPTED or option == Option.CPC_OPTION_SHM_TRANSPORT or option == Option.CPC_OPTION_FRAGMENTATION or option == Option.CPC_OPTION_COMPRESSION:
             optval = c_bool()
+        elif option == Option.CPC_OPTION_TX_CREDIT or option == Option.CPC_OPTION_AGGREGATION:
+            optval = c_uint32()
         else:
             # best effort, try to pass an int and see how it goes
             optval = c_int()
@@ -234,6 +433,7 @@ class Event(Enum):
     ENDPOINT_ERROR_DESTINATION_UNREACHABLE  = 4
     ENDPOINT_ERROR_SECURITY_INCIDENT        = 5
     ENDPOINT_ERROR_FAULT                    = 6
+    ENDPOINT_TX_CREDIT                      = 7
 #end class
 
 
@@ -252,6 +452,15 @@ class EndpointEvent(Structure):
             raise Exception("Failed to close endpoint")
     #end def
 
+    # int cpc_get_endpoint_event_fd(cpc_endpoint_event_handle_t event_handle);
+    def fileno(self):
+        ret = self.cpc_handle.lib_cpc.cpc_get_endpoint_event_fd(self)
+        if ret < 0:
+            raise Exception("Failed to get the endpoint event file descriptor: {}".format(ret))
+
+        return ret
+    #end def
+
     # int cpc_read_endpoint_event(cpc_endpoint_event_handle_t event_handle, cpc_event_type_t *event_type, cpc_events_flags_t flags);
     def read(self, nonblock=False):
         flags = 0
@@ -351,6 +560,25 @@ class CPC(Structure):
         self.lib_cpc.cpc_read_endpoint.restype = c_ssize_t
         self.lib_cpc.cpc_write_endpoint.restype = c_ssize_t
 
+        # The data path is called the most, declaring its arguments spares ctypes guessing them on each call
+        self.lib_cpc.cpc_read_endpoint.argtypes = [Endpoint, c_void_p, c_size_t, c_ubyte]
+        self.lib_cpc.cpc_write_endpoint.argtypes = [Endpoint, c_void_p, c_size_t, c_ubyte]
+        self.lib_cpc.cpc_read_endpoint_batch.restype = c_int
+        self.lib_cpc.cpc_read_endpoint_batch.argtypes = [Endpoint, POINTER(CPCEndpointMsg), c_size_t, c_ubyte]
+        self.lib_cpc.cpc_write_endpoint_batch.restype = c_int
+        self.lib_cpc.cpc_write_endpoint_batch.argtypes = [Endpoint, POINTER(CPCEndpointMsg), c_size_t, c_ubyte]
+        self.lib_cpc.cpc_get_endpoint_fd.restype = c_int
+        self.lib_cpc.cpc_get_endpoint_fd.argtypes = [Endpoint]
+        self.lib_cpc.cpc_get_endpoint_event_fd.restype = c_int
+        self.lib_cpc.cpc_wait.restype = c_int
+        self.lib_cpc.cpc_wait.argtypes = [POINTER(CPCWaitItem), c_size_t, c_int]
+        self.lib_cpc.cpc_get_metrics.restype = c_ssize_t
+        self.lib_cpc.cpc_dump_flight_recorder.restype = c_int
+        self.lib_cpc.cpc_get_trace_mask.restype = c_int
+        self.lib_cpc.cpc_set_trace_mask.restype = c_int
+        self.lib_cpc.cpc_get_protocol_parameter.restype = c_int
+        self.lib_cpc.cpc_set_protocol_parameter.restype = c_int
+
         trace = c_bool(enable_tracing)
         if reset_callback != None:
             self.reset_callback = reset_callback
@@ -428,4 +656,83 @@ class CPC(Structure):
         self.lib_cpc.cpc_get_secondary_app_version.restype = c_char_p
         return self.lib_cpc.cpc_get_secondary_app_version(self).decode("utf-8")
     #end def
+
+    # ssize_t cpc_get_metrics(cpc_handle_t handle, cpc_metrics_format_t format, char *buffer, size_t size);
+    def get_metrics(self, format=MetricsFormat.CPC_METRICS_FORMAT_PROMETHEUS):
+        size = 16384
+        while True:
+            buffer = create_string_buffer(size)
+            ret = self.lib_cpc.cpc_get_metrics(self, c_int(format.value), buffer, c_size_t(size))
+            if ret < 0:
+                raise Exception("Failed to get the metrics: {}".format(ret))
+            if ret < size:
+                return buffer.value.decode("utf-8")
+            # Truncated, the snapshot may have grown a bit since
+            size = ret + 4096
+        #end while
+    #end def
+
+    # int cpc_dump_flight_recorder(cpc_handle_t handle, char *path, size_t size);
+    def dump_flight_recorder(self):
+        size = 256
+        path = create_string_buffer(size)
+        ret = self.lib_cpc.cpc_dump_flight_recorder(self, path, c_size_t(size))
+        if ret != 0:
+            raise Exception("Failed to dump the flight recorder: {}".format(ret))
+        return path.value.decode("utf-8")
+    #end def
+
+    # int cpc_get_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t *mask);
+    def get_trace_mask(self, level=TraceLevel.CPC_TRACE_LEVEL_DEBUG):
+        mask = c_uint32(0)
+        ret = self.lib_cpc.cpc_get_trace_mask(self, c_uint8(level.value), byref(mask))
+        if ret != 0:
+            raise Exception("Failed to get the trace mask: {}".format(ret))
+        return mask.value
+    #end def
+
+    # int cpc_set_trace_mask(cpc_handle_t handle, cpc_trace_level_t level, uint32_t mask);
+    def set_trace_mask(self, mask, level=TraceLevel.CPC_TRACE_LEVEL_DEBUG):
+        ret = self.lib_cpc.cpc_set_trace_mask(self, c_uint8(level.value), c_uint32(mask))
+        if ret != 0:
+            raise Exception("Failed to set the trace mask: {}".format(ret))
+    #end def
+
+    # int cpc_get_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t *value);
+    def get_protocol_parameter(self, parameter, endpoint_id=0):
+        value = c_uint32(0)
+        ret = self.lib_cpc.cpc_get_protocol_parameter(self, c_uint8(endpoint_id), c_uint8(parameter.value), byref(value))
+        if ret != 0:
+            raise Exception("Failed to get the protocol parameter: {}".format(ret))
+        return value.value
+    #end def
+
+    # int cpc_set_protocol_parameter(cpc_handle_t handle, uint8_t endpoint_id, cpc_protocol_parameter_t parameter, uint32_t value);
+    def set_protocol_parameter(self, parameter, value, endpoint_id=0):
+        ret = self.lib_cpc.cpc_set_protocol_parameter(self, c_uint8(endpoint_id), c_uint8(parameter.value), c_uint32(value))
+        if ret != 0:
+            raise Exception("Failed to set the protocol parameter: {}".format(ret))
+    #end def
+
+    # int cpc_wait(cpc_wait_item_t *items, size_t count, int timeout_ms);
+    def wait(self, items, timeout_ms=-1):
+        """
+        Wait for events on several endpoints and endpoint events, given as a
+        list of (Endpoint or EndpointEvent, WaitEvent) pairs. Returns the events
+        that occurred on each of them, in the same order, all none on a timeout.
+        """
+        wait_items = (CPCWaitItem * len(items))()
+        for i, (handle, events) in enumerate(items):
+            if isinstance(handle, Endpoint):
+                wait_items[i].endpoint = handle.ptr
+            else:
+                wait_items[i].event_handle = handle.ptr
+            wait_items[i].events = int(events)
+
+        ret = self.lib_cpc.cpc_wait(wait_items, len(items), timeout_ms)
+        if ret < 0:
+            raise Exception("Failed to wait: {}".format(ret))
+
+        return [WaitEvent(item.revents) for item in wait_items]
+    #end def
 #end class
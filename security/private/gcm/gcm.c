@@ -0,0 +1,216 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - AES-GCM backends
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include <time.h>
+
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "security/private/gcm/gcm.h"
+
+// How long the throughput of the backend is measured for at startup
+#define GCM_PROBE_DURATION_NS  (20u * 1000u * 1000u)
+#define GCM_PROBE_FRAME_SIZE   1024u
+
+static const security_gcm_backend_t *backend = NULL;
+
+/*
+ * AES-256 test case 16 of "The Galois/Counter Mode of Operation (GCM)",
+ * McGrew & Viega, with the tag truncated to the length CPC uses
+ */
+static const uint8_t kat_key[32] = {
+  0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08,
+  0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c, 0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08
+};
+
+static const uint8_t kat_iv[12] = {
+  0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88
+};
+
+static const uint8_t kat_aad[20] = {
+  0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+  0xab, 0xad, 0xda, 0xd2
+};
+
+static const uint8_t kat_plaintext[60] = {
+  0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+  0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+  0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+  0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39
+};
+
+static const uint8_t kat_ciphertext[60] = {
+  0x52, 0x2d, 0xc1, 0xf0, 0x99, 0x56, 0x7d, 0x07, 0xf4, 0x7f, 0x37, 0xa3, 0x2a, 0x84, 0x42, 0x7d,
+  0x64, 0x3a, 0x8c, 0xdc, 0xbf, 0xe5, 0xc0, 0xc9, 0x75, 0x98, 0xa2, 0xbd, 0x25, 0x55, 0xd1, 0xaa,
+  0x8c, 0xb0, 0x8e, 0x48, 0x59, 0x0d, 0xbb, 0x3d, 0xa7, 0xb0, 0x8b, 0x10, 0x56, 0x82, 0x88, 0x38,
+  0xc5, 0xf6, 0x1e, 0x63, 0x93, 0xba, 0x7a, 0x0a, 0xbc, 0xc9, 0xf6, 0x62
+};
+
+static const uint8_t kat_tag[8] = {
+  0x76, 0xfc, 0x6e, 0xce, 0x0f, 0x4e, 0x17, 0x68
+};
+
+static uint64_t security_gcm_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void security_gcm_self_test(void)
+{
+  security_gcm_t gcm;
+  uint8_t output[sizeof(kat_plaintext)];
+  uint8_t tag[sizeof(kat_tag)];
+  sl_status_t status;
+
+  security_gcm_init(&gcm);
+  security_gcm_setkey(&gcm, kat_key, sizeof(kat_key));
+
+  status = security_gcm_encrypt(&gcm,
+                                kat_iv, sizeof(kat_iv),
+                                kat_aad, sizeof(kat_aad),
+                                kat_plaintext, sizeof(kat_plaintext),
+                                output,
+                                tag, sizeof(tag));
+  FATAL_ON(status != SL_STATUS_OK);
+  FATAL_ON(memcmp(output, kat_ciphertext, sizeof(output)) != 0);
+  FATAL_ON(memcmp(tag, kat_tag, sizeof(tag)) != 0);
+
+  status = security_gcm_decrypt(&gcm,
+                                kat_iv, sizeof(kat_iv),
+                                kat_aad, sizeof(kat_aad),
+                                kat_ciphertext, sizeof(kat_ciphertext),
+                                output,
+                                kat_tag, sizeof(kat_tag));
+  FATAL_ON(status != SL_STATUS_OK);
+  FATAL_ON(memcmp(output, kat_plaintext, sizeof(output)) != 0);
+
+  /* A frame that doesn't authenticate must be rejected */
+  memcpy(tag, kat_tag, sizeof(tag));
+  tag[0] ^= 0x01;
+  status = security_gcm_decrypt(&gcm,
+                                kat_iv, sizeof(kat_iv),
+                                kat_aad, sizeof(kat_aad),
+                                kat_ciphertext, sizeof(kat_ciphertext),
+                                output,
+                                tag, sizeof(tag));
+  FATAL_ON(status != SL_STATUS_SECURITY_DECRYPT_ERROR);
+
+  security_gcm_free(&gcm);
+}
+
+static void security_gcm_probe_throughput(void)
+{
+  security_gcm_t gcm;
+  static uint8_t frame[GCM_PROBE_FRAME_SIZE];
+  uint8_t tag[sizeof(kat_tag)];
+  uint64_t start;
+  uint64_t elapsed;
+  uint64_t bytes = 0;
+
+  security_gcm_init(&gcm);
+  security_gcm_setkey(&gcm, kat_key, sizeof(kat_key));
+
+  start = security_gcm_now_ns();
+  do {
+    FATAL_ON(security_gcm_encrypt(&gcm,
+                                  kat_iv, sizeof(kat_iv),
+                                  kat_aad, sizeof(kat_aad),
+                                  frame, sizeof(frame),
+                                  frame,
+                                  tag, sizeof(tag)) != SL_STATUS_OK);
+    bytes += sizeof(frame);
+    elapsed = security_gcm_now_ns() - start;
+  } while (elapsed < GCM_PROBE_DURATION_NS);
+
+  security_gcm_free(&gcm);
+
+  PRINT_INFO("AES-GCM backend %s: %llu MB/s on %u bytes frames",
+             backend->name,
+             (unsigned long long)(bytes * 1000u / elapsed),
+             GCM_PROBE_FRAME_SIZE);
+}
+
+void security_gcm_select_backend(void)
+{
+  switch (config.crypto_backend) {
+    case CRYPTO_BACKEND_MBEDTLS:
+      backend = &security_gcm_mbedtls;
+      break;
+    case CRYPTO_BACKEND_KERNEL:
+      backend = &security_gcm_kernel;
+      break;
+#if defined(ENABLE_OPENSSL_GCM)
+    case CRYPTO_BACKEND_OPENSSL:
+      backend = &security_gcm_openssl;
+      break;
+#endif
+    default:
+      /* The config parser rejects the backends that are not built in */
+      BUG("crypto_backend_t value not supported (%d)", config.crypto_backend);
+      break;
+  }
+
+  security_gcm_self_test();
+  security_gcm_probe_throughput();
+}
+
+void security_gcm_init(security_gcm_t *gcm)
+{
+  BUG_ON(backend == NULL);
+
+  gcm->state = backend->create();
+  if (gcm->state == NULL) {
+    FATAL("The %s crypto backend is not available", backend->name);
+  }
+}
+
+void security_gcm_free(security_gcm_t *gcm)
+{
+  if (gcm->state != NULL) {
+    backend->destroy(gcm->state);
+    gcm->state = NULL;
+  }
+}
+
+void security_gcm_setkey(security_gcm_t *gcm, const uint8_t *key, size_t key_len)
+{
+  FATAL_ON(!backend->setkey(gcm->state, key, key_len));
+}
+
+sl_status_t security_gcm_encrypt(security_gcm_t *gcm,
+                                 const uint8_t *iv, size_t iv_len,
+                                 const uint8_t *aad, size_t aad_len,
+                                 const uint8_t *input, size_t length,
+                                 uint8_t *output,
+                                 uint8_t *tag, size_t tag_len)
+{
+  return backend->encrypt(gcm->state, iv, iv_len, aad, aad_len, input, length, output, tag, tag_len);
+}
+
+sl_status_t security_gcm_decrypt(security_gcm_t *gcm,
+                                 const uint8_t *iv, size_t iv_len,
+                                 const uint8_t *aad, size_t aad_len,
+                                 const uint8_t *input, size_t length,
+                                 uint8_t *output,
+                                 const uint8_t *tag, size_t tag_len)
+{
+  return backend->decrypt(gcm->state, iv, iv_len, aad, aad_len, input, length, output, tag, tag_len);
+}
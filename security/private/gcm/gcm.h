@@ -0,0 +1,94 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - AES-GCM backends
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SECURITY_GCM_H
+#define SECURITY_GCM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "misc/sl_status.h"
+
+/*
+ * The AES-GCM implementation the keys are used with, chosen at startup with
+ * config.crypto_backend. A context is only ever used by one thread at a time.
+ * The output may be the input, frames are encrypted and decrypted in place.
+ *
+ * encrypt() and decrypt() return SL_STATUS_OK, SL_STATUS_INVALID_PARAMETER,
+ * SL_STATUS_SECURITY_DECRYPT_ERROR when the tag doesn't match, or
+ * SL_STATUS_FAIL.
+ */
+typedef struct {
+  const char *name;
+
+  /* Returns NULL if the backend can't be used on this system */
+  void* (*create)(void);
+  void (*destroy)(void *state);
+  bool (*setkey)(void *state, const uint8_t *key, size_t key_len);
+  sl_status_t (*encrypt)(void *state,
+                         const uint8_t *iv, size_t iv_len,
+                         const uint8_t *aad, size_t aad_len,
+                         const uint8_t *input, size_t length,
+                         uint8_t *output,
+                         uint8_t *tag, size_t tag_len);
+  sl_status_t (*decrypt)(void *state,
+                         const uint8_t *iv, size_t iv_len,
+                         const uint8_t *aad, size_t aad_len,
+                         const uint8_t *input, size_t length,
+                         uint8_t *output,
+                         const uint8_t *tag, size_t tag_len);
+} security_gcm_backend_t;
+
+typedef struct {
+  void *state;
+} security_gcm_t;
+
+extern const security_gcm_backend_t security_gcm_mbedtls;
+extern const security_gcm_backend_t security_gcm_kernel;
+#if defined(ENABLE_OPENSSL_GCM)
+extern const security_gcm_backend_t security_gcm_openssl;
+#endif
+
+/*
+ * Select the backend of config.crypto_backend, check it against a known
+ * answer and log its throughput. Crashes the daemon if the backend is not
+ * available or gives wrong results.
+ */
+void security_gcm_select_backend(void);
+
+void security_gcm_init(security_gcm_t *gcm);
+
+void security_gcm_free(security_gcm_t *gcm);
+
+void security_gcm_setkey(security_gcm_t *gcm, const uint8_t *key, size_t key_len);
+
+sl_status_t security_gcm_encrypt(security_gcm_t *gcm,
+                                 const uint8_t *iv, size_t iv_len,
+                                 const uint8_t *aad, size_t aad_len,
+                                 const uint8_t *input, size_t length,
+                                 uint8_t *output,
+                                 uint8_t *tag, size_t tag_len);
+
+sl_status_t security_gcm_decrypt(security_gcm_t *gcm,
+                                 const uint8_t *iv, size_t iv_len,
+                                 const uint8_t *aad, size_t aad_len,
+                                 const uint8_t *input, size_t length,
+                                 uint8_t *output,
+                                 const uint8_t *tag, size_t tag_len);
+
+#endif //SECURITY_GCM_H
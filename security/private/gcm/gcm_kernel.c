@@ -0,0 +1,272 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - AES-GCM with the kernel
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_alg.h>
+
+#include "misc/logging.h"
+#include "misc/utils.h"
+#include "security/private/gcm/gcm.h"
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+/*
+ * The kernel crypto API, through AF_ALG sockets, uses the AES-GCM driver
+ * registered with the highest priority: the AES-NI/PMULL one, or a crypto
+ * engine of the SoC, which mbedtls can't reach.
+ *
+ * The request, AAD then input, is written to the operation socket and the
+ * result, AAD then output, is read back from it. The AAD read back is not
+ * of any use, it lands in a scratch buffer.
+ */
+#define GCM_KERNEL_AAD_MAX_LENGTH  64u
+
+typedef struct {
+  int fd_tfm;       // Holds the key and the tag length
+  int fd_op;        // Operations, accepted once the tfm is set up
+  size_t tag_len;
+  uint8_t aad_scratch[GCM_KERNEL_AAD_MAX_LENGTH];
+} gcm_kernel_t;
+
+typedef union {
+  char buf[CMSG_SPACE(sizeof(uint32_t))
+           + CMSG_SPACE(sizeof(struct af_alg_iv) + 16u)
+           + CMSG_SPACE(sizeof(uint32_t))];
+  struct cmsghdr align;
+} gcm_kernel_cmsg_t;
+
+static void gcm_kernel_close_op(gcm_kernel_t *gcm)
+{
+  if (gcm->fd_op >= 0) {
+    close(gcm->fd_op);
+    gcm->fd_op = -1;
+  }
+}
+
+static void* gcm_kernel_create(void)
+{
+  struct sockaddr_alg sa = {
+    .salg_family = AF_ALG,
+    .salg_type = "aead",
+    .salg_name = "gcm(aes)",
+  };
+  gcm_kernel_t *gcm;
+
+  gcm = zalloc(sizeof(gcm_kernel_t));
+  FATAL_ON(gcm == NULL);
+
+  gcm->fd_op = -1;
+
+  gcm->fd_tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (gcm->fd_tfm < 0) {
+    WARN("The kernel crypto API is not available (%m)");
+    free(gcm);
+    return NULL;
+  }
+
+  if (bind(gcm->fd_tfm, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    WARN("The kernel has no gcm(aes) (%m)");
+    close(gcm->fd_tfm);
+    free(gcm);
+    return NULL;
+  }
+
+  return gcm;
+}
+
+static void gcm_kernel_destroy(void *state)
+{
+  gcm_kernel_t *gcm = state;
+
+  gcm_kernel_close_op(gcm);
+  close(gcm->fd_tfm);
+  free(gcm);
+}
+
+static bool gcm_kernel_setkey(void *state, const uint8_t *key, size_t key_len)
+{
+  gcm_kernel_t *gcm = state;
+
+  /* The tfm can't be changed while an operation socket is attached to it */
+  gcm_kernel_close_op(gcm);
+
+  return setsockopt(gcm->fd_tfm, SOL_ALG, ALG_SET_KEY, key, (socklen_t)key_len) == 0;
+}
+
+static bool gcm_kernel_prepare(gcm_kernel_t *gcm, size_t tag_len)
+{
+  if (gcm->fd_op >= 0 && gcm->tag_len == tag_len) {
+    return true;
+  }
+
+  gcm_kernel_close_op(gcm);
+
+  /* The tag length is passed as optlen */
+  if (setsockopt(gcm->fd_tfm, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, NULL, (socklen_t)tag_len) < 0) {
+    return false;
+  }
+
+  gcm->fd_op = accept4(gcm->fd_tfm, NULL, NULL, SOCK_CLOEXEC);
+  if (gcm->fd_op < 0) {
+    return false;
+  }
+
+  gcm->tag_len = tag_len;
+
+  return true;
+}
+
+static void gcm_kernel_fill_cmsg(struct msghdr *msg, gcm_kernel_cmsg_t *cmsg_buf,
+                                 uint32_t op, const uint8_t *iv, size_t iv_len, size_t aad_len)
+{
+  struct cmsghdr *cmsg;
+  struct af_alg_iv *alg_iv;
+
+  memset(cmsg_buf, 0, sizeof(*cmsg_buf));
+  msg->msg_control = cmsg_buf->buf;
+  msg->msg_controllen = CMSG_SPACE(sizeof(uint32_t))
+                        + CMSG_SPACE(sizeof(struct af_alg_iv) + iv_len)
+                        + CMSG_SPACE(sizeof(uint32_t));
+
+  cmsg = CMSG_FIRSTHDR(msg);
+  cmsg->cmsg_level = SOL_ALG;
+  cmsg->cmsg_type = ALG_SET_OP;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+  memcpy(CMSG_DATA(cmsg), &op, sizeof(op));
+
+  cmsg = CMSG_NXTHDR(msg, cmsg);
+  cmsg->cmsg_level = SOL_ALG;
+  cmsg->cmsg_type = ALG_SET_IV;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + iv_len);
+  alg_iv = (struct af_alg_iv *)(void *)CMSG_DATA(cmsg);
+  alg_iv->ivlen = (uint32_t)iv_len;
+  memcpy(alg_iv->iv, iv, iv_len);
+
+  cmsg = CMSG_NXTHDR(msg, cmsg);
+  cmsg->cmsg_level = SOL_ALG;
+  cmsg->cmsg_type = ALG_SET_AEAD_ASSOCLEN;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+  memcpy(CMSG_DATA(cmsg), &(uint32_t){ (uint32_t)aad_len }, sizeof(uint32_t));
+}
+
+static sl_status_t gcm_kernel_transfer(gcm_kernel_t *gcm, struct msghdr *request,
+                                       struct iovec *response, size_t response_count,
+                                       size_t response_len)
+{
+  struct msghdr msg = { 0 };
+  ssize_t ret;
+
+  ret = sendmsg(gcm->fd_op, request, 0);
+  if (ret < 0) {
+    return errno == EINVAL ? SL_STATUS_INVALID_PARAMETER : SL_STATUS_FAIL;
+  }
+
+  msg.msg_iov = response;
+  msg.msg_iovlen = response_count;
+
+  ret = recvmsg(gcm->fd_op, &msg, 0);
+  if (ret < 0) {
+    return errno == EBADMSG ? SL_STATUS_SECURITY_DECRYPT_ERROR : SL_STATUS_FAIL;
+  }
+
+  return (size_t)ret == response_len ? SL_STATUS_OK : SL_STATUS_FAIL;
+}
+
+static sl_status_t gcm_kernel_encrypt(void *state,
+                                      const uint8_t *iv, size_t iv_len,
+                                      const uint8_t *aad, size_t aad_len,
+                                      const uint8_t *input, size_t length,
+                                      uint8_t *output,
+                                      uint8_t *tag, size_t tag_len)
+{
+  gcm_kernel_t *gcm = state;
+  gcm_kernel_cmsg_t cmsg_buf;
+  struct msghdr msg = { 0 };
+  struct iovec request[2];
+  struct iovec response[3];
+
+  if (iv_len > 16u || aad_len > GCM_KERNEL_AAD_MAX_LENGTH) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (!gcm_kernel_prepare(gcm, tag_len)) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  request[0] = (struct iovec){ .iov_base = (void *)aad, .iov_len = aad_len };
+  request[1] = (struct iovec){ .iov_base = (void *)input, .iov_len = length };
+  msg.msg_iov = request;
+  msg.msg_iovlen = 2;
+  gcm_kernel_fill_cmsg(&msg, &cmsg_buf, ALG_OP_ENCRYPT, iv, iv_len, aad_len);
+
+  response[0] = (struct iovec){ .iov_base = gcm->aad_scratch, .iov_len = aad_len };
+  response[1] = (struct iovec){ .iov_base = output, .iov_len = length };
+  response[2] = (struct iovec){ .iov_base = tag, .iov_len = tag_len };
+
+  return gcm_kernel_transfer(gcm, &msg, response, 3, aad_len + length + tag_len);
+}
+
+static sl_status_t gcm_kernel_decrypt(void *state,
+                                      const uint8_t *iv, size_t iv_len,
+                                      const uint8_t *aad, size_t aad_len,
+                                      const uint8_t *input, size_t length,
+                                      uint8_t *output,
+                                      const uint8_t *tag, size_t tag_len)
+{
+  gcm_kernel_t *gcm = state;
+  gcm_kernel_cmsg_t cmsg_buf;
+  struct msghdr msg = { 0 };
+  struct iovec request[3];
+  struct iovec response[2];
+
+  if (iv_len > 16u || aad_len > GCM_KERNEL_AAD_MAX_LENGTH) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (!gcm_kernel_prepare(gcm, tag_len)) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  request[0] = (struct iovec){ .iov_base = (void *)aad, .iov_len = aad_len };
+  request[1] = (struct iovec){ .iov_base = (void *)input, .iov_len = length };
+  request[2] = (struct iovec){ .iov_base = (void *)tag, .iov_len = tag_len };
+  msg.msg_iov = request;
+  msg.msg_iovlen = 3;
+  gcm_kernel_fill_cmsg(&msg, &cmsg_buf, ALG_OP_DECRYPT, iv, iv_len, aad_len);
+
+  response[0] = (struct iovec){ .iov_base = gcm->aad_scratch, .iov_len = aad_len };
+  response[1] = (struct iovec){ .iov_base = output, .iov_len = length };
+
+  return gcm_kernel_transfer(gcm, &msg, response, 2, aad_len + length);
+}
+
+const security_gcm_backend_t security_gcm_kernel = {
+  .name = "kernel",
+  .create = gcm_kernel_create,
+  .destroy = gcm_kernel_destroy,
+  .setkey = gcm_kernel_setkey,
+  .encrypt = gcm_kernel_encrypt,
+  .decrypt = gcm_kernel_decrypt,
+};
@@ -0,0 +1,108 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - AES-GCM with MbedTLS
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "mbedtls/gcm.h"
+
+#include "misc/utils.h"
+#include "security/private/gcm/gcm.h"
+
+static sl_status_t gcm_mbedtls_to_status(int ret)
+{
+  /* convert mbedtls error code to sl_status */
+  if (ret == 0) {
+    return SL_STATUS_OK;
+  } else if (ret == MBEDTLS_ERR_GCM_BAD_INPUT) {
+    return SL_STATUS_INVALID_PARAMETER;
+  } else if (ret == MBEDTLS_ERR_GCM_AUTH_FAILED) {
+    return SL_STATUS_SECURITY_DECRYPT_ERROR;
+  } else {
+    return SL_STATUS_FAIL;
+  }
+}
+
+static void* gcm_mbedtls_create(void)
+{
+  mbedtls_gcm_context *context = zalloc(sizeof(mbedtls_gcm_context));
+
+  if (context != NULL) {
+    mbedtls_gcm_init(context);
+  }
+
+  return context;
+}
+
+static void gcm_mbedtls_destroy(void *state)
+{
+  mbedtls_gcm_free(state);
+  free(state);
+}
+
+static bool gcm_mbedtls_setkey(void *state, const uint8_t *key, size_t key_len)
+{
+  if (key_len > UINT_MAX / 8) {
+    return false;
+  }
+
+  return mbedtls_gcm_setkey(state, MBEDTLS_CIPHER_ID_AES, key, (unsigned int)(key_len * 8)) == 0;
+}
+
+static sl_status_t gcm_mbedtls_encrypt(void *state,
+                                       const uint8_t *iv, size_t iv_len,
+                                       const uint8_t *aad, size_t aad_len,
+                                       const uint8_t *input, size_t length,
+                                       uint8_t *output,
+                                       uint8_t *tag, size_t tag_len)
+{
+  return gcm_mbedtls_to_status(mbedtls_gcm_crypt_and_tag(state,
+                                                         MBEDTLS_GCM_ENCRYPT,
+                                                         length,
+                                                         iv, iv_len,
+                                                         aad, aad_len,
+                                                         input,
+                                                         output,
+                                                         tag_len,
+                                                         tag));
+}
+
+static sl_status_t gcm_mbedtls_decrypt(void *state,
+                                       const uint8_t *iv, size_t iv_len,
+                                       const uint8_t *aad, size_t aad_len,
+                                       const uint8_t *input, size_t length,
+                                       uint8_t *output,
+                                       const uint8_t *tag, size_t tag_len)
+{
+  return gcm_mbedtls_to_status(mbedtls_gcm_auth_decrypt(state,
+                                                        length,
+                                                        iv, iv_len,
+                                                        aad, aad_len,
+                                                        tag, tag_len,
+                                                        input,
+                                                        output));
+}
+
+const security_gcm_backend_t security_gcm_mbedtls = {
+  .name = "mbedtls",
+  .create = gcm_mbedtls_create,
+  .destroy = gcm_mbedtls_destroy,
+  .setkey = gcm_mbedtls_setkey,
+  .encrypt = gcm_mbedtls_encrypt,
+  .decrypt = gcm_mbedtls_decrypt,
+};
@@ -0,0 +1,167 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - AES-GCM with OpenSSL
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <openssl/evp.h>
+
+#include "misc/utils.h"
+#include "security/private/gcm/gcm.h"
+
+/*
+ * The EVP contexts are keyed once and only get a new IV for each frame, an
+ * encryption and a decryption one since a context works one way.
+ */
+typedef struct {
+  EVP_CIPHER_CTX *encrypt;
+  EVP_CIPHER_CTX *decrypt;
+} gcm_openssl_t;
+
+static void gcm_openssl_destroy(void *state)
+{
+  gcm_openssl_t *gcm = state;
+
+  EVP_CIPHER_CTX_free(gcm->encrypt);
+  EVP_CIPHER_CTX_free(gcm->decrypt);
+  free(gcm);
+}
+
+static void* gcm_openssl_create(void)
+{
+  gcm_openssl_t *gcm = zalloc(sizeof(gcm_openssl_t));
+
+  if (gcm == NULL) {
+    return NULL;
+  }
+
+  gcm->encrypt = EVP_CIPHER_CTX_new();
+  gcm->decrypt = EVP_CIPHER_CTX_new();
+  if (gcm->encrypt == NULL || gcm->decrypt == NULL) {
+    gcm_openssl_destroy(gcm);
+    return NULL;
+  }
+
+  return gcm;
+}
+
+static bool gcm_openssl_setkey(void *state, const uint8_t *key, size_t key_len)
+{
+  gcm_openssl_t *gcm = state;
+  const EVP_CIPHER *cipher;
+
+  switch (key_len) {
+    case 16:
+      cipher = EVP_aes_128_gcm();
+      break;
+    case 24:
+      cipher = EVP_aes_192_gcm();
+      break;
+    case 32:
+      cipher = EVP_aes_256_gcm();
+      break;
+    default:
+      return false;
+  }
+
+  return EVP_EncryptInit_ex(gcm->encrypt, cipher, NULL, key, NULL) == 1
+         && EVP_DecryptInit_ex(gcm->decrypt, cipher, NULL, key, NULL) == 1;
+}
+
+static bool gcm_openssl_set_iv(EVP_CIPHER_CTX *ctx, const uint8_t *iv, size_t iv_len)
+{
+  if (iv_len == 0 || iv_len > INT_MAX) {
+    return false;
+  }
+
+  if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, (int)iv_len, NULL) != 1) {
+    return false;
+  }
+
+  /* A NULL key keeps the one already set */
+  return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, -1) == 1;
+}
+
+static sl_status_t gcm_openssl_encrypt(void *state,
+                                       const uint8_t *iv, size_t iv_len,
+                                       const uint8_t *aad, size_t aad_len,
+                                       const uint8_t *input, size_t length,
+                                       uint8_t *output,
+                                       uint8_t *tag, size_t tag_len)
+{
+  EVP_CIPHER_CTX *ctx = ((gcm_openssl_t *)state)->encrypt;
+  int out_len;
+
+  if (aad_len > INT_MAX || length > INT_MAX || tag_len < 4 || tag_len > 16) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (!gcm_openssl_set_iv(ctx, iv, iv_len)) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (EVP_EncryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) != 1
+      || EVP_EncryptUpdate(ctx, output, &out_len, input, (int)length) != 1
+      || EVP_EncryptFinal_ex(ctx, output + out_len, &out_len) != 1
+      || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, (int)tag_len, tag) != 1) {
+    return SL_STATUS_FAIL;
+  }
+
+  return SL_STATUS_OK;
+}
+
+static sl_status_t gcm_openssl_decrypt(void *state,
+                                       const uint8_t *iv, size_t iv_len,
+                                       const uint8_t *aad, size_t aad_len,
+                                       const uint8_t *input, size_t length,
+                                       uint8_t *output,
+                                       const uint8_t *tag, size_t tag_len)
+{
+  EVP_CIPHER_CTX *ctx = ((gcm_openssl_t *)state)->decrypt;
+  int out_len;
+
+  if (aad_len > INT_MAX || length > INT_MAX || tag_len < 4 || tag_len > 16) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (!gcm_openssl_set_iv(ctx, iv, iv_len)) {
+    return SL_STATUS_INVALID_PARAMETER;
+  }
+
+  if (EVP_DecryptUpdate(ctx, NULL, &out_len, aad, (int)aad_len) != 1
+      || EVP_DecryptUpdate(ctx, output, &out_len, input, (int)length) != 1
+      || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, (int)tag_len, (void *)tag) != 1) {
+    return SL_STATUS_FAIL;
+  }
+
+  /* Only fails when the tag doesn't match */
+  if (EVP_DecryptFinal_ex(ctx, output + out_len, &out_len) != 1) {
+    return SL_STATUS_SECURITY_DECRYPT_ERROR;
+  }
+
+  return SL_STATUS_OK;
+}
+
+const security_gcm_backend_t security_gcm_openssl = {
+  .name = "openssl",
+  .create = gcm_openssl_create,
+  .destroy = gcm_openssl_destroy,
+  .setkey = gcm_openssl_setkey,
+  .encrypt = gcm_openssl_encrypt,
+  .decrypt = gcm_openssl_decrypt,
+};
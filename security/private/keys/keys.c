@@ -17,7 +17,12 @@
 
 #include <stddef.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include "mbedtls/version.h"
@@ -28,10 +33,12 @@
 #include "mbedtls/pk.h"
 
 #include "misc/config.h"
+#include "misc/endianess.h"
 #include "misc/logging.h"
 #include "misc/sl_status.h"
 #include "misc/utils.h"
 #include "security/security.h"
+#include "security/private/gcm/gcm.h"
 #include "security/private/keys/keys.h"
 #include "server_core/core/hdlc.h"
 
@@ -47,7 +54,12 @@
 #define mbedtls_sha256 mbedtls_sha256_ret
 #endif
 
-static mbedtls_gcm_context gcm_context;
+/*
+ * A context per direction, keyed alike: the frames to the secondary may be
+ * encrypted on the crypto worker while the core decrypts those received.
+ */
+static security_gcm_t gcm_tx_context;
+static security_gcm_t gcm_rx_context;
 static mbedtls_entropy_context entropy_context;
 static mbedtls_ecp_group grp;
 static mbedtls_mpi shared_secret;
@@ -58,6 +70,32 @@ static mbedtls_ctr_drbg_context rng_context;
 static bool rng_context_initialized = false;
 static uint8_t binding_key[BINDING_KEY_LENGTH_BYTES] = { 0 };
 
+/* Derived from the last session key, or loaded from the session ticket */
+static uint8_t resumption_secret[SESSION_RESUMPTION_SECRET_LENGTH_BYTES];
+static uint8_t resumption_session_id[SESSION_ID_LENGTH_BYTES];
+
+#define SESSION_TICKET_VERSION          1
+#define SESSION_TICKET_LIFETIME_S       (24 * 60 * 60)
+#define SESSION_TICKET_IV_LENGTH_BYTES  12
+#define SESSION_TICKET_TAG_LENGTH_BYTES 16
+
+typedef struct __attribute__((packed)) {
+  uint64_t expires_at; // CLOCK_REALTIME, in seconds, little endian
+  uint8_t session_id[SESSION_ID_LENGTH_BYTES];
+  uint8_t secret[SESSION_RESUMPTION_SECRET_LENGTH_BYTES];
+} session_ticket_content_t;
+
+/* The header is authenticated, the content is encrypted */
+typedef struct __attribute__((packed)) {
+  uint8_t magic[4];
+  uint8_t version;
+  uint8_t iv[SESSION_TICKET_IV_LENGTH_BYTES];
+  session_ticket_content_t content;
+  uint8_t tag[SESSION_TICKET_TAG_LENGTH_BYTES];
+} session_ticket_t;
+
+static const uint8_t session_ticket_magic[4] = { 'C', 'P', 'C', 'T' };
+
 typedef struct __attribute__((packed)) {
   uint8_t endpoint_id;
   uint8_t session_id[7];
@@ -260,7 +298,11 @@ void security_keys_init(void)
   FATAL_ON(mbedtls_sha256_self_test(verbose) != 0);
   FATAL_ON(mbedtls_entropy_self_test(verbose) != 0);
 
-  mbedtls_gcm_init(&gcm_context);
+  /* The backend of the frame encryption runs its own self test */
+  security_gcm_select_backend();
+
+  security_gcm_init(&gcm_tx_context);
+  security_gcm_init(&gcm_rx_context);
   mbedtls_entropy_init(&entropy_context);
   mbedtls_ctr_drbg_init(&rng_context);
 
@@ -291,8 +333,10 @@ void security_keys_reset(void)
    * Clear GCM context and underlying cipher sub-context
    * and reinit the context for next session
    */
-  mbedtls_gcm_free(&gcm_context);
-  mbedtls_gcm_init(&gcm_context);
+  security_gcm_free(&gcm_tx_context);
+  security_gcm_init(&gcm_tx_context);
+  security_gcm_free(&gcm_rx_context);
+  security_gcm_init(&gcm_rx_context);
 
   security_nonce_init(&nonce_primary);
   security_nonce_init(&nonce_secondary);
@@ -418,15 +462,24 @@ uint8_t* security_keys_get_ecdh_public_key(void)
   return ecdh_exchange_buffer;
 }
 
-void security_compute_session_key_and_id(uint8_t * random1,
-                                         uint8_t * random2)
+/*
+ * The key material is the binding key for a new session, or the resumption
+ * secret of the previous one for a resumed session
+ */
+static void security_compute_session(uint8_t * random1,
+                                     uint8_t * random2,
+                                     const uint8_t *key_material,
+                                     size_t key_material_len)
 {
   int ret;
   const size_t half_random_len = SESSION_INIT_RANDOM_LENGTH_BYTES / 2;
+  const char resumption_label[] = "CPC session resumption";
   uint8_t random3[SESSION_INIT_RANDOM_LENGTH_BYTES];
   uint8_t sha256_random3[SHA256_LENGTH_BYTES];
-  uint8_t random4[2 * half_random_len + BINDING_KEY_LENGTH_BYTES];
-  uint8_t session_key[SESSION_KEY_LENGTH_BYTES] = { 0 };
+  uint8_t random4[2 * half_random_len + SESSION_RESUMPTION_SECRET_LENGTH_BYTES];
+  uint8_t session_key[SESSION_KEY_LENGTH_BYTES + sizeof(resumption_label) - 1] = { 0 };
+
+  FATAL_ON(key_material_len > SESSION_RESUMPTION_SECRET_LENGTH_BYTES);
 
   if (security_get_state() == SECURITY_STATE_RESETTING) {
     /* if security is resetting, clear previous context and reset nonces */
@@ -469,24 +522,219 @@ void security_compute_session_key_and_id(uint8_t * random1,
     /* To generate the session key a second string of bits is constructed: Rand-4 = Rand-1[256:511] || Rand-2[256:511] || Binding Key[0:128] */
     memcpy(&random4[0], &random1[half_random_len], half_random_len);
     memcpy(&random4[half_random_len], &random2[half_random_len], half_random_len);
-    memcpy(&random4[2 * half_random_len], binding_key, BINDING_KEY_LENGTH_BYTES);
+    memcpy(&random4[2 * half_random_len], key_material, key_material_len);
 
     /* Both devices perform SHA256 on RAND-4
      * The resulting 256 bit number is then used as the session key */
     ret = mbedtls_sha256(random4,
-                         sizeof(random4),
+                         2 * half_random_len + key_material_len,
                          session_key,
                          0); //is not sha224
     FATAL_ON(ret != 0);
   }
 
   /* The session key is then used to encrypt all remaining communication */
-  ret = mbedtls_gcm_setkey(&gcm_context, MBEDTLS_CIPHER_ID_AES, session_key, SESSION_KEY_LENGTH_BYTES * 8);
+  security_gcm_setkey(&gcm_tx_context, session_key, SESSION_KEY_LENGTH_BYTES);
+  security_gcm_setkey(&gcm_rx_context, session_key, SESSION_KEY_LENGTH_BYTES);
+
+  /* A session resumed later is keyed by SHA256(Session Key || label), never by the session key itself */
+  memcpy(&session_key[SESSION_KEY_LENGTH_BYTES], resumption_label, sizeof(resumption_label) - 1);
+  ret = mbedtls_sha256(session_key, sizeof(session_key), resumption_secret, 0);
   FATAL_ON(ret != 0);
+  memcpy(resumption_session_id, &sha256_random3[0], SESSION_ID_LENGTH_BYTES);
+
+  force_memset(session_key, 0x00, sizeof(session_key));
+  force_memset(random4, 0x00, sizeof(random4));
 
   security_set_state(SECURITY_STATE_INITIALIZED);
 }
 
+void security_compute_session_key_and_id(uint8_t * random1,
+                                         uint8_t * random2)
+{
+  security_compute_session(random1, random2, binding_key, BINDING_KEY_LENGTH_BYTES);
+}
+
+void security_compute_resumed_session_key_and_id(uint8_t * random1,
+                                                 uint8_t * random2)
+{
+  uint8_t secret[SESSION_RESUMPTION_SECRET_LENGTH_BYTES];
+
+  /* The new session replaces the resumption secret */
+  memcpy(secret, resumption_secret, sizeof(secret));
+  security_compute_session(random1, random2, secret, sizeof(secret));
+  force_memset(secret, 0x00, sizeof(secret));
+}
+
+/*
+ * Proves to the secondary that the primary holds the secret of the ticket:
+ * the first bytes of SHA256(Resumption Secret || Rand-1)
+ */
+void security_session_ticket_compute_proof(const uint8_t *random1, uint8_t *proof)
+{
+  uint8_t input[SESSION_RESUMPTION_SECRET_LENGTH_BYTES + SESSION_INIT_RANDOM_LENGTH_BYTES];
+  uint8_t output[SHA256_LENGTH_BYTES];
+  int ret;
+
+  memcpy(input, resumption_secret, SESSION_RESUMPTION_SECRET_LENGTH_BYTES);
+  memcpy(&input[SESSION_RESUMPTION_SECRET_LENGTH_BYTES], random1, SESSION_INIT_RANDOM_LENGTH_BYTES);
+
+  ret = mbedtls_sha256(input, sizeof(input), output, 0);
+  FATAL_ON(ret != 0);
+
+  memcpy(proof, output, SESSION_RESUMPTION_PROOF_LENGTH_BYTES);
+  force_memset(input, 0x00, sizeof(input));
+}
+
+/*
+ * Tickets are sealed with SHA256(Binding Key || label), a ticket of another
+ * binding doesn't open
+ */
+static void security_session_ticket_init_gcm(security_gcm_t *gcm)
+{
+  const char ticket_label[] = "CPC session ticket";
+  uint8_t input[BINDING_KEY_LENGTH_BYTES + sizeof(ticket_label) - 1];
+  uint8_t ticket_key[SHA256_LENGTH_BYTES];
+  int ret;
+
+  memcpy(input, binding_key, BINDING_KEY_LENGTH_BYTES);
+  memcpy(&input[BINDING_KEY_LENGTH_BYTES], ticket_label, sizeof(ticket_label) - 1);
+
+  ret = mbedtls_sha256(input, sizeof(input), ticket_key, 0);
+  FATAL_ON(ret != 0);
+
+  security_gcm_init(gcm);
+  security_gcm_setkey(gcm, ticket_key, sizeof(ticket_key));
+
+  force_memset(input, 0x00, sizeof(input));
+  force_memset(ticket_key, 0x00, sizeof(ticket_key));
+}
+
+void security_session_ticket_store(void)
+{
+  session_ticket_t ticket;
+  session_ticket_content_t content;
+  security_gcm_t gcm;
+  struct timespec now;
+  char tmp_path[PATH_MAX];
+  sl_status_t status;
+  ssize_t written;
+  int fd;
+  int ret;
+
+  if (config.session_ticket_file == NULL) {
+    return;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  content.expires_at = cpu_to_le64((uint64_t)now.tv_sec + SESSION_TICKET_LIFETIME_S);
+  memcpy(content.session_id, resumption_session_id, SESSION_ID_LENGTH_BYTES);
+  memcpy(content.secret, resumption_secret, SESSION_RESUMPTION_SECRET_LENGTH_BYTES);
+
+  memcpy(ticket.magic, session_ticket_magic, sizeof(ticket.magic));
+  ticket.version = SESSION_TICKET_VERSION;
+  ret = mbedtls_ctr_drbg_random(&rng_context, ticket.iv, sizeof(ticket.iv));
+  FATAL_ON(ret != 0);
+
+  security_session_ticket_init_gcm(&gcm);
+  status = security_gcm_encrypt(&gcm,
+                                ticket.iv, sizeof(ticket.iv),
+                                (const uint8_t *)&ticket, offsetof(session_ticket_t, iv),
+                                (const uint8_t *)&content, sizeof(content),
+                                (uint8_t *)&ticket.content,
+                                ticket.tag, sizeof(ticket.tag));
+  security_gcm_free(&gcm);
+  force_memset(&content, 0x00, sizeof(content));
+  FATAL_ON(status != SL_STATUS_OK);
+
+  /* Written aside and renamed, a ticket is never read half written */
+  ret = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config.session_ticket_file);
+  FATAL_ON(ret < 0 || (size_t)ret >= sizeof(tmp_path));
+
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    WARN("Failed to create the session ticket %s (%m)", tmp_path);
+    return;
+  }
+
+  written = write(fd, &ticket, sizeof(ticket));
+  ret = close(fd);
+  if (written != (ssize_t)sizeof(ticket) || ret != 0 || rename(tmp_path, config.session_ticket_file) != 0) {
+    WARN("Failed to write the session ticket %s (%m)", config.session_ticket_file);
+    unlink(tmp_path);
+    return;
+  }
+
+  TRACE_SECURITY("Stored the session ticket");
+}
+
+bool security_session_ticket_load(uint8_t *session_id)
+{
+  session_ticket_t ticket;
+  session_ticket_content_t content;
+  security_gcm_t gcm;
+  struct timespec now;
+  sl_status_t status;
+  ssize_t ret;
+  int fd;
+
+  if (config.session_ticket_file == NULL) {
+    return false;
+  }
+
+  fd = open(config.session_ticket_file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      WARN("Failed to open the session ticket %s (%m)", config.session_ticket_file);
+    }
+    return false;
+  }
+
+  ret = read(fd, &ticket, sizeof(ticket));
+  close(fd);
+
+  /* A ticket is used once, whether the resumption succeeds or not */
+  if (unlink(config.session_ticket_file) != 0) {
+    WARN("Failed to remove the session ticket %s (%m), not resuming the session", config.session_ticket_file);
+    return false;
+  }
+
+  if (ret != (ssize_t)sizeof(ticket)
+      || memcmp(ticket.magic, session_ticket_magic, sizeof(ticket.magic)) != 0
+      || ticket.version != SESSION_TICKET_VERSION) {
+    WARN("Ignoring the session ticket %s, bad format", config.session_ticket_file);
+    return false;
+  }
+
+  security_session_ticket_init_gcm(&gcm);
+  status = security_gcm_decrypt(&gcm,
+                                ticket.iv, sizeof(ticket.iv),
+                                (const uint8_t *)&ticket, offsetof(session_ticket_t, iv),
+                                (const uint8_t *)&ticket.content, sizeof(ticket.content),
+                                (uint8_t *)&content,
+                                ticket.tag, sizeof(ticket.tag));
+  security_gcm_free(&gcm);
+  if (status != SL_STATUS_OK) {
+    WARN("Ignoring the session ticket %s, it wasn't sealed with this binding key", config.session_ticket_file);
+    return false;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  if (le64_to_cpu(content.expires_at) <= (uint64_t)now.tv_sec) {
+    TRACE_SECURITY("The session ticket expired");
+    force_memset(&content, 0x00, sizeof(content));
+    return false;
+  }
+
+  memcpy(resumption_secret, content.secret, SESSION_RESUMPTION_SECRET_LENGTH_BYTES);
+  memcpy(session_id, content.session_id, SESSION_ID_LENGTH_BYTES);
+  force_memset(&content, 0x00, sizeof(content));
+
+  TRACE_SECURITY("Loaded the session ticket");
+
+  return true;
+}
+
 static FILE* security_open_or_create_plaintext_binding_key_file(const char *filename)
 {
   unsigned char key[BINDING_KEY_LENGTH_BYTES];
@@ -619,28 +867,27 @@ sl_status_t __security_encrypt(sl_cpc_endpoint_t *ep, sl_cpc_security_frame_t *s
                                uint8_t *output,
                                uint8_t *tag, const size_t tag_len)
 {
-  int status;
+  sl_status_t status;
 
   FATAL_ON(tag_len != TAG_LENGTH_BYTES);
 
   /* set the endpoint in the nonce */
   security_nonce_xfer_init(&nonce_primary, ep->id, sec_frame->frame_counter, true);
 
-  status = mbedtls_gcm_crypt_and_tag(&gcm_context,
-                                     MBEDTLS_GCM_ENCRYPT,
-                                     payload_len,
-                                     (uint8_t*)&(nonce_primary.iv),
-                                     sizeof(nonce_primary.iv),
-                                     // additional data is the header, it's
-                                     // authenticated but not encrypted
-                                     header,
-                                     header_len,
-                                     payload, //The input buffer is the payload
-                                     output,
-                                     tag_len,
-                                     tag);
-
-  if (status == 0) {
+  status = security_gcm_encrypt(&gcm_tx_context,
+                                (uint8_t*)&(nonce_primary.iv),
+                                sizeof(nonce_primary.iv),
+                                // additional data is the header, it's
+                                // authenticated but not encrypted
+                                header,
+                                header_len,
+                                payload, //The input buffer is the payload
+                                payload_len,
+                                output,
+                                tag,
+                                tag_len);
+
+  if (status == SL_STATUS_OK) {
     /* only upon successful encryption increase frame counter */
     security_nonce_xfer_finalize(&nonce_primary, &ep->frame_counter_tx, false);
 
@@ -649,12 +896,7 @@ sl_status_t __security_encrypt(sl_cpc_endpoint_t *ep, sl_cpc_security_frame_t *s
 
   security_nonce_xfer_finalize(&nonce_primary, &ep->frame_counter_tx, false);
 
-  /* convert mbedtls error code to sl_status */
-  if (status == MBEDTLS_ERR_GCM_BAD_INPUT) {
-    return SL_STATUS_INVALID_PARAMETER;
-  } else {
-    return SL_STATUS_FAIL;
-  }
+  return status;
 }
 
 sl_status_t __security_decrypt(sl_cpc_endpoint_t *ep,
@@ -663,24 +905,24 @@ sl_status_t __security_decrypt(sl_cpc_endpoint_t *ep,
                                uint8_t *output,
                                const uint8_t *tag, const size_t tag_len)
 {
-  int status;
+  sl_status_t status;
 
   FATAL_ON(tag_len != TAG_LENGTH_BYTES);
 
   security_nonce_xfer_init(&nonce_secondary, ep->id, ep->frame_counter_rx, false);
 
-  status = mbedtls_gcm_auth_decrypt(&gcm_context,
-                                    payload_len,
-                                    (uint8_t*)&(nonce_secondary.iv),
-                                    sizeof(nonce_secondary.iv),
-                                    header,
-                                    header_len,
-                                    tag,
-                                    tag_len,
-                                    payload,
-                                    output);
-
-  if (status == 0) {
+  status = security_gcm_decrypt(&gcm_rx_context,
+                                (uint8_t*)&(nonce_secondary.iv),
+                                sizeof(nonce_secondary.iv),
+                                header,
+                                header_len,
+                                payload,
+                                payload_len,
+                                output,
+                                tag,
+                                tag_len);
+
+  if (status == SL_STATUS_OK) {
     security_nonce_xfer_finalize(&nonce_secondary, &ep->frame_counter_rx, true);
 
     return SL_STATUS_OK;
@@ -688,14 +930,7 @@ sl_status_t __security_decrypt(sl_cpc_endpoint_t *ep,
 
   security_nonce_xfer_finalize(&nonce_secondary, &ep->frame_counter_rx, false);
 
-  /* convert mbedtls error code to sl_status */
-  if (status == MBEDTLS_ERR_GCM_BAD_INPUT) {
-    return SL_STATUS_INVALID_PARAMETER;
-  } else if (status == MBEDTLS_ERR_GCM_AUTH_FAILED) {
-    return SL_STATUS_SECURITY_DECRYPT_ERROR;
-  } else {
-    return SL_STATUS_FAIL;
-  }
+  return status;
 }
 
 #if defined(UNIT_TESTING)
@@ -705,28 +940,27 @@ sl_status_t __security_encrypt_secondary(sl_cpc_endpoint_t *ep,
                                          uint8_t *output,
                                          uint8_t *tag, const size_t tag_len)
 {
-  int status;
+  sl_status_t status;
 
   FATAL_ON(tag_len != TAG_LENGTH_BYTES);
 
   /* set the endpoint in the nonce */
   security_nonce_xfer_init(&secondary_nonce_secondary, ep->id, ep->frame_counter_tx, false);
 
-  status = mbedtls_gcm_crypt_and_tag(&gcm_context,
-                                     MBEDTLS_GCM_ENCRYPT,
-                                     payload_len,
-                                     (uint8_t*)&(secondary_nonce_secondary.iv),
-                                     sizeof(secondary_nonce_secondary.iv),
-                                     // additional data is the header, it's
-                                     // authenticated but not encrypted
-                                     header,
-                                     header_len,
-                                     payload, //The input buffer is the payload
-                                     output,
-                                     tag_len,
-                                     tag);
-
-  if (status == 0) {
+  status = security_gcm_encrypt(&gcm_rx_context,
+                                (uint8_t*)&(secondary_nonce_secondary.iv),
+                                sizeof(secondary_nonce_secondary.iv),
+                                // additional data is the header, it's
+                                // authenticated but not encrypted
+                                header,
+                                header_len,
+                                payload, //The input buffer is the payload
+                                payload_len,
+                                output,
+                                tag,
+                                tag_len);
+
+  if (status == SL_STATUS_OK) {
     /* only upon successful encryption increase frame counter */
     security_nonce_xfer_finalize(&secondary_nonce_secondary, &ep->frame_counter_tx, true);
 
@@ -735,12 +969,7 @@ sl_status_t __security_encrypt_secondary(sl_cpc_endpoint_t *ep,
 
   security_nonce_xfer_finalize(&secondary_nonce_secondary, &ep->frame_counter_tx, false);
 
-  /* convert mbedtls error code to sl_status */
-  if (status == MBEDTLS_ERR_GCM_BAD_INPUT) {
-    return SL_STATUS_INVALID_PARAMETER;
-  } else {
-    return SL_STATUS_FAIL;
-  }
+  return status;
 }
 
 sl_status_t __security_decrypt_secondary(sl_cpc_endpoint_t *ep,
@@ -749,24 +978,24 @@ sl_status_t __security_decrypt_secondary(sl_cpc_endpoint_t *ep,
                                          uint8_t *output,
                                          const uint8_t *tag, const size_t tag_len)
 {
-  int status;
+  sl_status_t status;
 
   FATAL_ON(tag_len != TAG_LENGTH_BYTES);
 
   security_nonce_xfer_init(&secondary_nonce_primary, ep->id, ep->frame_counter_rx, true);
 
-  status = mbedtls_gcm_auth_decrypt(&gcm_context,
-                                    payload_len,
-                                    (uint8_t*)&(secondary_nonce_primary.iv),
-                                    sizeof(secondary_nonce_primary.iv),
-                                    header,
-                                    header_len,
-                                    tag,
-                                    tag_len,
-                                    payload,
-                                    output);
-
-  if (status == 0) {
+  status = security_gcm_decrypt(&gcm_tx_context,
+                                (uint8_t*)&(secondary_nonce_primary.iv),
+                                sizeof(secondary_nonce_primary.iv),
+                                header,
+                                header_len,
+                                payload,
+                                payload_len,
+                                output,
+                                tag,
+                                tag_len);
+
+  if (status == SL_STATUS_OK) {
     security_nonce_xfer_finalize(&secondary_nonce_primary, &ep->frame_counter_rx, true);
 
     return SL_STATUS_OK;
@@ -774,25 +1003,19 @@ sl_status_t __security_decrypt_secondary(sl_cpc_endpoint_t *ep,
 
   security_nonce_xfer_finalize(&secondary_nonce_primary, &ep->frame_counter_rx, false);
 
-  /* convert mbedtls error code to sl_status */
-  if (status == MBEDTLS_ERR_GCM_BAD_INPUT) {
-    return SL_STATUS_INVALID_PARAMETER;
-  } else if (status == MBEDTLS_ERR_GCM_AUTH_FAILED) {
-    return SL_STATUS_SECURITY_DECRYPT_ERROR;
-  } else {
-    return SL_STATUS_FAIL;
-  }
+  return status;
 }
 #endif
 
-void security_xfer_rollback(sl_cpc_endpoint_t *ep)
+void security_xfer_rollback(sl_cpc_endpoint_t *ep, uint32_t frame_counter)
 {
 #if defined(ENABLE_ENCRYPTION)
   sl_cpc_security_state_t security_state = security_get_state();
 
   if (security_state == SECURITY_STATE_INITIALIZED) {
-    ep->frame_counter_rx--;
-    TRACE_SECURITY("Rolled back frame counter on ep #%d, counter decremented", ep->id);
+    /* the frames from this counter on are dropped, their re-transmissions must decrypt again */
+    ep->frame_counter_rx = frame_counter;
+    TRACE_SECURITY("Rolled back frame counter on ep #%d to 0x%x", ep->id, frame_counter);
   }
 #endif
 }
@@ -36,12 +36,25 @@
 #define SESSION_INIT_RANDOM_LENGTH_BYTES 64
 #define SHA256_LENGTH_BYTES              32
 #define TAG_LENGTH_BYTES                 8
+#define SESSION_RESUMPTION_SECRET_LENGTH_BYTES 32
+#define SESSION_RESUMPTION_PROOF_LENGTH_BYTES  8
 #define NONCE_FRAME_COUNTER_MAX_VALUE    (1UL << 29)
 #define NONCE_FRAME_COUNTER_PRIMARY_ENCRYPT_BITMASK (1UL << 31)
 
 void security_keys_init(void);
 
 void security_compute_session_key_and_id(uint8_t * random1, uint8_t * random2);
+
+/*
+ * Session resumption: once a session is established, its resumption secret
+ * can be stored in config.session_ticket_file, sealed with the binding key.
+ * The next daemon loads it, and removes the file, to resume a session keyed
+ * by the secret instead of the binding key.
+ */
+bool security_session_ticket_load(uint8_t *session_id);
+void security_session_ticket_store(void);
+void security_session_ticket_compute_proof(const uint8_t *random1, uint8_t *proof);
+void security_compute_resumed_session_key_and_id(uint8_t * random1, uint8_t * random2);
 void security_keys_reset(void);
 
 uint8_t* security_keys_get_ecdh_public_key(void);
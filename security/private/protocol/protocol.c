@@ -55,6 +55,11 @@ const sl_cpc_security_protocol_cmd_info_t sli_cpc_security_command[] = {
     .response_len = sizeof(sl_status_t),
     .command_id = UNBIND_REQUEST_ID
   },
+  [SESSION_RESUME_ID] =  {
+    .request_len = sizeof(session_resume_request_t),
+    .response_len = sizeof(sl_status_t) + SESSION_INIT_RANDOM_LENGTH_BYTES,
+    .command_id = SESSION_RESUME_ID
+  },
 };
 
 static sl_status_t send_request(sl_cpc_security_protocol_cmd_info_t request_command, uint8_t *payload, size_t payload_size, sl_cpc_security_protocol_cmd_t *response)
@@ -137,6 +142,14 @@ sl_status_t security_send_session_init_request(uint8_t *random1, sl_cpc_security
                       response);
 }
 
+sl_status_t security_send_session_resume_request(session_resume_request_t *request, sl_cpc_security_protocol_cmd_t *response)
+{
+  return send_request(sli_cpc_security_command[SESSION_RESUME_ID],
+                      (uint8_t *)request,
+                      sizeof(session_resume_request_t),
+                      response);
+}
+
 void security_request_unbind(void)
 {
   sl_status_t status;
@@ -254,7 +267,59 @@ void security_exchange_keys(sl_cpc_binding_request_t binding_method)
   }
 }
 
-void security_initialize_session(void)
+/*
+ * Returns false if the secondary doesn't resume the session of the ticket,
+ * a session is then initialized from the binding key
+ */
+static bool security_resume_session(void)
+{
+  int ret;
+  sl_status_t status;
+  session_resume_request_t request;
+  sl_cpc_security_protocol_cmd_t protocol_response;
+  session_init_response_t *session_resume_response;
+
+  if (!server_core_secondary_supports_session_resumption()) {
+    return false;
+  }
+
+  /* Only the first session of the daemon is resumed, the ticket is removed when loaded */
+  if (!security_session_ticket_load(request.session_id)) {
+    return false;
+  }
+
+  ret = mbedtls_ctr_drbg_random(security_keys_get_rng_context(),
+                                request.random1,
+                                sizeof(request.random1));
+  FATAL_ON(ret != 0);
+
+  security_session_ticket_compute_proof(request.random1, request.proof);
+
+  status = security_send_session_resume_request(&request, &protocol_response);
+  if (status != SL_STATUS_OK) {
+    WARN("Sending session resume request failed. Status = 0x%x", status);
+    return false;
+  }
+
+  session_resume_response = (session_init_response_t*) protocol_response.payload;
+  if (session_resume_response->status != SL_STATUS_OK) {
+    TRACE_SECURITY("The secondary did not resume the session. Status = 0x%x", session_resume_response->status);
+    return false;
+  }
+
+  /*
+   * The session id is derived from the randoms, like for a new session: the
+   * frame counters restart from zero with nonces never used by the session
+   * of the ticket
+   */
+  security_compute_resumed_session_key_and_id(request.random1, session_resume_response->random2);
+
+  PRINT_INFO("Resumed the encryption session");
+
+  return true;
+}
+
+static void security_init_new_session(void)
 {
   int ret;
   sl_status_t status;
@@ -287,6 +352,16 @@ void security_initialize_session(void)
   random2 = session_init_response->random2;
 
   security_compute_session_key_and_id(random1, random2);
+}
+
+void security_initialize_session(void)
+{
+  /* The reset of a session whose frame counters overflowed always starts over from the binding key */
+  if (security_get_state() == SECURITY_STATE_RESETTING || !security_resume_session()) {
+    security_init_new_session();
+  }
+
+  security_session_ticket_store();
 
   security_session_initialized = true;
 
@@ -49,7 +49,8 @@ SL_ENUM_GENERIC(sl_cpc_security_id_t, uint16_t)
   PLAIN_TEXT_KEY_SHARE_ID  = 0x0002,
   PUBLIC_KEY_SHARE_ID      = 0x0003,
   SESSION_INIT_ID          = 0x0004,
-  UNBIND_REQUEST_ID        = 0x0005
+  UNBIND_REQUEST_ID        = 0x0005,
+  SESSION_RESUME_ID        = 0x0006
 };
 
 typedef struct {
@@ -58,7 +59,18 @@ typedef struct {
   sl_cpc_security_id_t command_id;
 }sl_cpc_security_protocol_cmd_info_t;
 
-#define SLI_SECURITY_PROTOCOL_PAYLOAD_MAX_LENGTH (sizeof(sl_status_t) + SESSION_INIT_RANDOM_LENGTH_BYTES)
+/*
+ * Resumes the session of the ticket: Rand-1 and Rand-2 are exchanged like for
+ * a session init, the session key is derived with the resumption secret in
+ * place of the binding key. The reply is a session_init_response_t.
+ */
+typedef struct {
+  uint8_t session_id[SESSION_ID_LENGTH_BYTES];
+  uint8_t random1[SESSION_INIT_RANDOM_LENGTH_BYTES];
+  uint8_t proof[SESSION_RESUMPTION_PROOF_LENGTH_BYTES];
+}__attribute__((packed)) session_resume_request_t;
+
+#define SLI_SECURITY_PROTOCOL_PAYLOAD_MAX_LENGTH (sizeof(session_resume_request_t))
 
 typedef struct {
   uint16_t len;
@@ -81,6 +93,8 @@ sl_status_t security_send_unbind_request(sl_cpc_security_protocol_cmd_t *respons
 
 sl_status_t security_send_session_init_request(uint8_t *random1, sl_cpc_security_protocol_cmd_t *response);
 
+sl_status_t security_send_session_resume_request(session_resume_request_t *request, sl_cpc_security_protocol_cmd_t *response);
+
 void security_exchange_keys(sl_cpc_binding_request_t binding_method);
 
 void security_request_unbind(void);
@@ -21,6 +21,7 @@
 #include "security.h"
 #include "misc/config.h"
 #include "misc/logging.h"
+#include "misc/thread.h"
 #include "server_core/server/server_ready_sync.h"
 #include "security/private/keys/keys.h"
 #include "security/private/thread/command_synchronizer.h"
@@ -40,7 +41,7 @@ void security_init(void)
     return;
   }
 
-  ret = pthread_create(&security_thread, NULL, security_thread_func, NULL);
+  ret = thread_create(&security_thread, config.security_sched, security_thread_func, NULL);
   FATAL_ON(ret != 0);
 
   ret = pthread_setname_np(security_thread, "security");
@@ -101,7 +101,11 @@ sl_status_t security_decrypt_secondary(sl_cpc_endpoint_t *ep,
                                        const uint8_t *tag, const size_t tag_len);
 #endif
 
-void security_xfer_rollback(sl_cpc_endpoint_t *ep);
+/*
+ * Forget the frames decrypted from frame_counter on, because they were dropped
+ * and will be re-transmitted.
+ */
+void security_xfer_rollback(sl_cpc_endpoint_t *ep, uint32_t frame_counter);
 
 size_t security_encrypt_get_extra_buffer_size(void);
 
@@ -15,6 +15,8 @@
  *
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
@@ -23,23 +25,35 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include "misc/config.h"
 #include "misc/endianess.h"
 #include "misc/logging.h"
+#include "misc/lz4_block.h"
+#include "misc/mempool.h"
+#include "misc/sl_queue.h"
 #include "misc/sl_slist.h"
 #include "misc/sl_status.h"
 #include "misc/sleep.h"
+#include "misc/tracepoints.h"
 #include "misc/utils.h"
 #include "security/security.h"
 #include "server_core/cpcd_exchange.h"
+#include "server_core/server_core.h"
 #include "server_core/server/server.h"
 #include "server_core/epoll/epoll.h"
 #include "server_core/system_endpoint/system.h"
 #include "server_core/core/core.h"
 #include "server_core/core/hdlc.h"
 #include "server_core/core/crc.h"
+#include "driver/driver_ring.h"
+
+#if defined(ENABLE_ENCRYPTION)
+#include "server_core/core/crypto_worker.h"
+#endif
 
 #if defined(TARGET_TESTING)
 #include "cpc_test_cmd.h"
@@ -57,6 +71,15 @@
 #define SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE 0
 #endif
 
+/* Largest frame a driver delivers, and number of frames read per driver wakeup */
+#define SLI_CPC_RX_PAYLOAD_MAX_SIZE 4096
+#define SLI_CPC_RX_FRAME_MAX_SIZE (SLI_CPC_HDLC_HEADER_RAW_SIZE + SLI_CPC_RX_PAYLOAD_MAX_SIZE)
+#define SLI_CPC_RX_BATCH_SIZE     16
+
+/* Number of tx complete notifications, of up to SLI_CPC_DRIVER_TX_BATCH_SIZE
+ * frames each, read per system call */
+#define SLI_CPC_TX_COMPLETE_BATCH_SIZE 4
+
 #define ABS(a)  ((a) < 0 ? -(a) : (a))
 #define X_ENUM_TO_STR(x) #x
 #define ENUM_TO_STR(x) X_ENUM_TO_STR(x)
@@ -75,17 +98,78 @@ core_debug_counters_t secondary_core_debug_counters;
  ***************************  LOCAL VARIABLES   ********************************
  ******************************************************************************/
 
-static epoll_private_data_t driver_sock_private_data;
-static epoll_private_data_t driver_sock_notify_private_data;
-static int                  stats_timer_fd;
-static sl_cpc_endpoint_t    core_endpoints[SL_CPC_ENDPOINT_MAX_COUNT];
-static sl_slist_node_t      *transmit_queue = NULL;
-static sl_slist_node_t      *pending_on_security_ready_queue = NULL;
-static sl_slist_node_t      *pending_on_tx_complete = NULL;
+static struct {
+  epoll_private_data_t driver_sock_private_data;
+  epoll_private_data_t driver_sock_notify_private_data;
+  int                  stats_timer_fd;
+  sl_cpc_endpoint_t    endpoints[SL_CPC_ENDPOINT_MAX_COUNT];
+  /* Endpoints opened at least once, in that order. The loops over the endpoints
+   * walk these rather than the whole array, most of which is never used */
+  uint8_t              opened_endpoints[SL_CPC_ENDPOINT_MAX_COUNT];
+  size_t               opened_endpoint_count;
+  sl_queue_t           supervisory_transmit_queue;
+  sl_queue_t           pending_on_security_ready_queue;
+  sl_queue_t           pending_on_tx_complete;
+
+  /* Transmit scheduler: strict priority between levels, weighted round robin
+   * between the endpoints of a level. Supervisory frames bypass it. */
+  struct {
+    size_t backlog;       // Frames queued by the endpoints of this level
+    size_t current;       // Endpoint being served, index in opened_endpoints
+    uint8_t credit;       // Frames it may still send before the next endpoint's turn
+  } tx_scheduler[CPC_TX_PRIORITY_LEVEL_COUNT];
+
+  /* Frames received from the driver, read in batches into preallocated buffers */
+  struct {
+    struct mmsghdr msgs[SLI_CPC_RX_BATCH_SIZE];
+    struct iovec iovecs[SLI_CPC_RX_BATCH_SIZE];
+    uint8_t buffers[SLI_CPC_RX_BATCH_SIZE][SLI_CPC_RX_FRAME_MAX_SIZE] __attribute__((aligned(8)));
+  } rx_batch;
+
+  /* Tx complete notifications from the driver, all read on a wakeup. The
+   * re-transmit timers they start are armed once per endpoint, at the end */
+  struct {
+    struct mmsghdr msgs[SLI_CPC_TX_COMPLETE_BATCH_SIZE];
+    struct iovec iovecs[SLI_CPC_TX_COMPLETE_BATCH_SIZE];
+    sl_cpc_tx_complete_t records[SLI_CPC_TX_COMPLETE_BATCH_SIZE][SLI_CPC_DRIVER_TX_BATCH_SIZE];
+    uint32_t next_frame_id;    // Expected in the next record, the oldest frame pending on a tx complete
+    bool draining;
+    uint8_t deferred_timers[SL_CPC_ENDPOINT_MAX_COUNT]; // Endpoints whose re-transmit timer is to be armed
+    size_t deferred_timer_count;
+  } tx_complete;
+
+  /* Frames built by this loop iteration, handed to the driver with one syscall */
+  struct {
+    struct mmsghdr msgs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+    struct iovec iovecs[SLI_CPC_DRIVER_TX_BATCH_SIZE];
+    unsigned int count;
+  } tx_batch;
+
+  /* Buffer pools for the TX and RX hot path. They are sized once the secondary's
+   * rx capability and the tx window are known, until then every allocation
+   * falls back to the heap. */
+  mempool_t buffer_handle_pool;
+  mempool_t queue_item_pool;
+  mempool_t frame_pool;
+
+  /* Scratch buffers of the compression of the frames sent and of the decompression
+   * of the ones received, allocated on first use */
+  uint8_t *compress_buffer;
+  uint8_t *decompress_buffer;
+
+  /* Daemon-wide protocol parameters, the endpoints take them on open */
+  struct {
+    uint16_t min_re_transmit_timeout_ms;
+    uint16_t max_re_transmit_timeout_ms;
+    uint8_t max_re_transmit;
+    uint8_t max_tx_window_size;
+  } parameters;
 
 #if defined(ENABLE_ENCRYPTION)
-static bool security_session_last_packet_acked = false;
+  bool security_session_last_packet_acked;
+  epoll_private_data_t crypto_worker_private_data;
 #endif
+} core;
 
 /*******************************************************************************
  **************************   LOCAL FUNCTIONS   ********************************
@@ -93,7 +177,10 @@ static bool security_session_last_packet_acked = false;
 
 static void core_process_rx_driver_notification(epoll_private_data_t *event_private_data);
 static void core_process_rx_driver(epoll_private_data_t *event_private_data);
-static void core_process_ep_timeout(epoll_private_data_t *event_private_data);
+static void core_process_rx_frame(frame_t *rx_frame, size_t frame_size);
+static void core_process_ep_timeout(epoll_timer_t *timer);
+static void core_process_ack_timeout(epoll_timer_t *timer);
+static void core_process_aggregation_timeout(epoll_timer_t *timer);
 
 static void core_process_rx_i_frame(frame_t *rx_frame);
 static void core_process_rx_s_frame(frame_t *rx_frame);
@@ -101,13 +188,39 @@ static void core_process_rx_u_frame(frame_t *rx_frame);
 
 /* CPC core functions  */
 static bool core_process_tx_queue(void);
-static void core_clear_transmit_queue(sl_slist_node_t **head, int endpoint_id);
+static sl_status_t core_seal_frame(sl_cpc_buffer_handle_t *frame);
+static void core_frame_built(sl_cpc_buffer_handle_t *frame, uint16_t total_length);
+static void core_transmit_frame(sl_cpc_transmit_queue_item_t *item);
+static size_t core_clear_transmit_queue(sl_queue_t *queue, int endpoint_id);
+static void core_endpoint_tx_queue_push(sl_cpc_endpoint_t *endpoint, sl_cpc_transmit_queue_item_t *item, bool front);
+static sl_slist_node_t* core_tx_scheduler_pop(void);
+static bool core_tx_scheduler_is_empty(void);
 static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack);
 static void transmit_ack(sl_cpc_endpoint_t *endpoint);
+static void schedule_ack(sl_cpc_endpoint_t *endpoint);
+static void core_ack_sent(sl_cpc_endpoint_t *endpoint);
+static void core_record_frame_latency(sl_cpc_endpoint_t *endpoint, const sl_cpc_frame_timestamps_t *timestamps);
 static void re_transmit_frame(sl_cpc_endpoint_t *endpoint);
-static bool is_seq_valid(uint8_t seq, uint8_t ack);
+static void re_transmit_selective_frame(sl_cpc_endpoint_t *endpoint, uint8_t seq);
+static void transmit_selective_reject(sl_cpc_endpoint_t *endpoint);
+static bool is_seq_valid(uint8_t seq, uint8_t ack, uint8_t window);
+static bool is_seq_ahead_in_window(uint8_t seq, uint8_t ack, uint8_t window);
+static bool is_selective_reject_enabled(const sl_cpc_endpoint_t *endpoint);
+static uint8_t core_get_peer_tx_window_size(void);
+static bool core_has_out_of_order_frames(const sl_cpc_endpoint_t *endpoint);
+static void core_drop_out_of_order_frames(sl_cpc_endpoint_t *endpoint);
 static sl_cpc_endpoint_t* find_endpoint(uint8_t endpoint_number);
 static void transmit_reject(sl_cpc_endpoint_t *endpoint, uint8_t address, uint8_t ack, sl_cpc_reject_reason_t reason);
+static sl_cpc_buffer_handle_t* core_alloc_buffer_handle(uint16_t data_length);
+static sl_cpc_buffer_handle_t* core_alloc_supervisory_handle(uint8_t address, uint8_t control, sl_cpc_reject_reason_t reason);
+static sl_cpc_buffer_handle_t* core_attach_buffer_handle(frame_t *frame, uint16_t data_length);
+static void core_write_frame(uint8_t endpoint_number, frame_t *frame, const void* message, size_t message_len, uint8_t flags);
+static bool core_aggregate_write(uint8_t endpoint_number, const void *message, size_t message_len, uint8_t flags);
+static void core_flush_aggregate(sl_cpc_endpoint_t *endpoint);
+static void core_drop_aggregate(sl_cpc_endpoint_t *endpoint);
+static void core_compress_frame(sl_cpc_buffer_handle_t *buffer_handle);
+static ssize_t core_decompress_frame(sl_cpc_endpoint_t *endpoint, const uint8_t *payload, uint16_t payload_length);
+static void core_free_buffer_handle(sl_cpc_buffer_handle_t *handle);
 
 /* Functions to operate on linux fd timers */
 static void stop_re_transmit_timer(sl_cpc_endpoint_t* endpoint);
@@ -115,15 +228,25 @@ static void start_re_transmit_timer(sl_cpc_endpoint_t* endpoint, struct timespec
 
 /* Functions to communicate with the driver and server */
 static void core_push_frame_to_driver(const void *frame, size_t frame_len);
-static bool core_pull_frame_from_driver(frame_t** frame_buf, size_t* frame_buf_len);
+static void core_flush_frames_to_driver(void);
+static void core_process_tx_complete(const sl_cpc_tx_complete_t *tx_complete);
+static unsigned int core_pull_tx_completes_from_driver(void);
+static void core_arm_deferred_re_transmit_timers(void);
+static unsigned int core_pull_frames_from_driver(void);
 
 static sl_status_t core_push_data_to_server(uint8_t ep_id, const void *data, size_t data_len);
+static sl_status_t core_push_rx_fragment(sl_cpc_endpoint_t *endpoint, const uint8_t *payload, uint16_t payload_length, bool more_fragments);
+static sl_status_t core_push_rx_aggregate(sl_cpc_endpoint_t *endpoint, const uint8_t *payload, uint16_t payload_length);
 
 static bool security_is_ready(void);
 static bool should_encrypt_frame(sl_cpc_buffer_handle_t *frame);
 #if defined(ENABLE_ENCRYPTION)
 static bool should_decrypt_frame(sl_cpc_endpoint_t *endpoint, uint16_t payload_len);
+static uint64_t core_tracepoint_now_ns(void);
 static void core_on_security_state_change(sl_cpc_security_state_t old, sl_cpc_security_state_t new);
+static sl_status_t core_seal_job(void *job);
+static void core_process_crypto_worker(epoll_private_data_t *event_private_data);
+static void core_complete_sealed_frames(int dropped_endpoint_id);
 #endif
 static void core_fetch_secondary_debug_counters(epoll_private_data_t *event_private_data);
 
@@ -180,7 +303,7 @@ static void on_disconnect_notification(sl_cpc_system_command_handle_t *handle,
   (void)property_value;
 
   uint8_t ep_id = PROPERTY_ID_TO_EP_ID(property_id);
-  BUG_ON(core_endpoints[ep_id].state == SL_CPC_STATE_OPEN);
+  BUG_ON(core.endpoints[ep_id].state == SL_CPC_STATE_OPEN);
 
   switch (status) {
     case SL_STATUS_IN_PROGRESS:
@@ -200,64 +323,125 @@ static void on_disconnect_notification(sl_cpc_system_command_handle_t *handle,
   }
 }
 
-static void core_compute_re_transmit_timeout(sl_cpc_endpoint_t *endpoint)
+/***************************************************************************//**
+ * Fold the round trip time of an acknowledged frame in the RTT model of its
+ * endpoint. Implemented using Karn's algorithm: a frame that was re-transmitted
+ * gives no sample, the ack may be the one of any of its transmissions.
+ ******************************************************************************/
+static void core_update_rtt_model(sl_cpc_endpoint_t *endpoint, const sl_cpc_buffer_handle_t *frame)
 {
-  // Implemented using Karn’s algorithm
-  // Based off of RFC 2988 Computing TCP's Retransmission Timer
-  static bool first_rtt_measurement = true;
+  sl_cpc_rtt_model_t *rtt = &endpoint->rtt;
   struct timespec current_time;
-  int64_t current_timestamp_ms;
-  int64_t previous_timestamp_ms;
-  long round_trip_time_ms = 0;
-  long rto = 0;
-
-  const uint8_t k = 4; // This value is recommended by the Karn’s algorithm
+  int64_t round_trip_time_ns;
+  double length = (double)frame->frame_length;
+  double rtt_us;
 
   FATAL_ON(endpoint == NULL);
 
-  clock_gettime(CLOCK_MONOTONIC, &current_time);
+  if (frame->re_transmitted) {
+    return;
+  }
 
-  current_timestamp_ms = (current_time.tv_sec * 1000) + (current_time.tv_nsec / 1000000);
-  previous_timestamp_ms = (endpoint->last_iframe_sent_timestamp.tv_sec * 1000) + (endpoint->last_iframe_sent_timestamp.tv_nsec / 1000000);
+  clock_gettime(CLOCK_MONOTONIC, &current_time);
 
-  round_trip_time_ms = (long)(current_timestamp_ms - previous_timestamp_ms);
+  round_trip_time_ns = (int64_t)(current_time.tv_sec - frame->sent_timestamp.tv_sec) * 1000000000
+                       + (current_time.tv_nsec - frame->sent_timestamp.tv_nsec);
 
-  if (round_trip_time_ms <= 0) {
-    round_trip_time_ms = 1;
+  // The ack may be processed right after a late tx complete
+  if (round_trip_time_ns <= 0) {
+    round_trip_time_ns = 1000;
   }
 
-  TRACE_CORE("RTT on ep %d is %ldms", endpoint->id, round_trip_time_ms);
+  loop_stats_histogram_add(&endpoint->stats->rtt, (uint64_t)round_trip_time_ns);
+
+  rtt_us = (double)round_trip_time_ns / 1000.0;
 
-  FATAL_ON(round_trip_time_ms < 0);
+  TRACE_CORE("RTT on ep %d is %ldus for a frame of %zu bytes", endpoint->id, (long)rtt_us, frame->frame_length);
 
-  if (first_rtt_measurement) {
-    endpoint->smoothed_rtt = round_trip_time_ms;
-    endpoint->rtt_variation = round_trip_time_ms / 2;
-    first_rtt_measurement = false;
+  if (rtt->samples == 0) {
+    rtt->mean_length = length;
+    rtt->mean_rtt_us = rtt_us;
+    rtt->latency_us = rtt_us;
+    rtt->variation_us = rtt_us / 2;
   } else {
-    // RTTVAR <- (1 - beta) * RTTVAR + beta * |SRTT - R'| where beta is 0.25
-    endpoint->rtt_variation = 3 * (endpoint->rtt_variation / 4) +  ABS(endpoint->smoothed_rtt - round_trip_time_ms) / 4;
+    double deviation_us = rtt_us - (rtt->latency_us + rtt->byte_time_us * length);
+    double length_delta = length - rtt->mean_length;
+    double rtt_delta_us = rtt_us - rtt->mean_rtt_us;
+
+    // RTTVAR <- (1 - beta) * RTTVAR + beta * |prediction - R'| where beta is 0.25
+    rtt->variation_us += (ABS(deviation_us) - rtt->variation_us) / 4;
+
+    // Means, variance and covariance weighted with alpha = 0.125, like SRTT
+    rtt->mean_length += length_delta / 8;
+    rtt->mean_rtt_us += rtt_delta_us / 8;
+    rtt->length_variance += (length_delta * (length - rtt->mean_length) - rtt->length_variance) / 8;
+    rtt->length_rtt_covariance += (length_delta * (rtt_us - rtt->mean_rtt_us) - rtt->length_rtt_covariance) / 8;
+
+    // Until the lengths varied enough, the latency accounts for the whole round trip time
+    if (rtt->length_variance >= SL_CPC_RTT_MODEL_MIN_LENGTH_VARIANCE) {
+      rtt->byte_time_us = rtt->length_rtt_covariance / rtt->length_variance;
+      if (rtt->byte_time_us < 0) {
+        rtt->byte_time_us = 0;
+      }
+    }
 
-    //SRTT <- (1 - alpha) * SRTT + alpha * R' where alpha is 0.125
-    endpoint->smoothed_rtt = 7 * (endpoint->smoothed_rtt / 8) + round_trip_time_ms / 8;
+    rtt->latency_us = rtt->mean_rtt_us - rtt->byte_time_us * rtt->mean_length;
+    if (rtt->latency_us < 0) {
+      rtt->latency_us = 0;
+    }
+  }
+
+  rtt->samples++;
+
+  // A valid sample ends the back off
+  endpoint->re_transmit_backoff = 0;
+
+  TRACE_CORE("RTT model on ep %d: latency %ldus, %ldns per byte, variation %ldus", endpoint->id,
+             (long)rtt->latency_us, (long)(rtt->byte_time_us * 1000), (long)rtt->variation_us);
+}
+
+/***************************************************************************//**
+ * Re-transmit timeout of a frame: the round trip time the model predicts for
+ * its length plus four times the variation, as in RFC 6298, doubled for every
+ * time out since the last RTT sample
+ ******************************************************************************/
+static long core_get_re_transmit_timeout_ms(const sl_cpc_endpoint_t *endpoint, size_t frame_length)
+{
+  const sl_cpc_rtt_model_t *rtt = &endpoint->rtt;
+  long rto = endpoint->min_re_transmit_timeout_ms;
+  uint8_t i;
+
+  if (rtt->samples != 0) {
+    double variation_us = rtt->variation_us;
+    double rto_us;
+
+    // Impose a lowerbound on the variation, we don't want the RTO to converge too close to the RTT
+    if (variation_us < SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MINIMUM_VARIATION_MS * 1000.0) {
+      variation_us = SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MINIMUM_VARIATION_MS * 1000.0;
+    }
+
+    rto_us = rtt->latency_us + rtt->byte_time_us * (double)frame_length + 4 * variation_us;
+
+    if (rto_us < (double)endpoint->max_re_transmit_timeout_ms * 1000.0) {
+      rto = (long)((rto_us + 999.0) / 1000.0);
+    } else {
+      rto = endpoint->max_re_transmit_timeout_ms;
+    }
   }
 
-  // Impose a lowerbound on the variation, we don't want the RTO to converge too close to the RTT
-  if (endpoint->rtt_variation < SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MINIMUM_VARIATION_MS) {
-    endpoint->rtt_variation = SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MINIMUM_VARIATION_MS;
+  if (rto < endpoint->min_re_transmit_timeout_ms) {
+    rto = endpoint->min_re_transmit_timeout_ms;
   }
 
-  rto = endpoint->smoothed_rtt + k * endpoint->rtt_variation;
-  FATAL_ON(rto <= 0);
+  for (i = 0; i < endpoint->re_transmit_backoff && rto < endpoint->max_re_transmit_timeout_ms; i++) {
+    rto *= 2;
+  }
 
-  if (rto > SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS) {
-    rto = SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS;
-  } else if (rto < SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MS) {
-    rto = SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MS;
+  if (rto > endpoint->max_re_transmit_timeout_ms) {
+    rto = endpoint->max_re_transmit_timeout_ms;
   }
 
-  endpoint->re_transmit_timeout_ms = rto;
-  TRACE_CORE("RTO on ep %d is calulated to %ldms", endpoint->id, endpoint->re_transmit_timeout_ms);
+  return rto;
 }
 
 #if defined(ENABLE_ENCRYPTION)
@@ -266,19 +450,19 @@ static void core_on_security_state_change(sl_cpc_security_state_t old, sl_cpc_se
   TRACE_CORE("Security changed state: %d -> %d", (int)old, (int)new);
   if (old == SECURITY_STATE_INITIALIZING
       && new == SECURITY_STATE_INITIALIZED) {
-    core_endpoints[SL_CPC_ENDPOINT_SYSTEM].encrypted = true;
+    core.endpoints[SL_CPC_ENDPOINT_SYSTEM].encrypted = true;
   } else if (old == SECURITY_STATE_RESETTING
              && new == SECURITY_STATE_INITIALIZED) {
     for (size_t i = 0; i < SL_CPC_ENDPOINT_MAX_COUNT; i++) {
-      core_endpoints[i].frame_counter_tx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
-      core_endpoints[i].frame_counter_rx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
+      core.endpoints[i].frame_counter_tx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
+      core.endpoints[i].frame_counter_rx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
 #if defined(UNIT_TESTING)
       sli_cpc_drv_emul_set_frame_counter(i, SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE, true);
       sli_cpc_drv_emul_set_frame_counter(i, SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE, false);
 #endif
     }
   } else if (new == SECURITY_STATE_INITIALIZING) {
-    core_endpoints[SL_CPC_ENDPOINT_SYSTEM].encrypted = false;
+    core.endpoints[SL_CPC_ENDPOINT_SYSTEM].encrypted = false;
   }
 }
 #endif
@@ -287,24 +471,33 @@ void core_init(int driver_fd, int driver_notify_fd)
 {
   /* Init all endpoints */
   size_t i = 0;
+
+  core.parameters.min_re_transmit_timeout_ms = SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MS;
+  core.parameters.max_re_transmit_timeout_ms = SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS;
+  core.parameters.max_re_transmit = SLI_CPC_RE_TRANSMIT;
+  core.parameters.max_tx_window_size = TRANSMIT_WINDOW_MAX_SIZE;
+
   for (i = 0; i < SL_CPC_ENDPOINT_MAX_COUNT; i++) {
-    core_endpoints[i].id = (uint8_t)i;
-    core_endpoints[i].state = SL_CPC_STATE_CLOSED;
-    core_endpoints[i].ack = 0;
-    core_endpoints[i].configured_tx_window_size = 1;
-    core_endpoints[i].current_tx_window_space = 1;
-    core_endpoints[i].re_transmit_timer_private_data = NULL;
-    core_endpoints[i].on_uframe_data_reception = NULL;
-    core_endpoints[i].on_iframe_data_reception = NULL;
-    core_endpoints[i].last_iframe_sent_timestamp = (struct timespec){ 0 };
-    core_endpoints[i].smoothed_rtt = 0;
-    core_endpoints[i].rtt_variation = 0;
-    core_endpoints[i].re_transmit_timeout_ms = SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS;
-    core_endpoints[i].packet_re_transmit_count = 0;
+    core.endpoints[i].id = (uint8_t)i;
+    core.endpoints[i].state = SL_CPC_STATE_CLOSED;
+    core.endpoints[i].ack = 0;
+    core.endpoints[i].configured_tx_window_size = 1;
+    core.endpoints[i].current_tx_window_space = 1;
+    epoll_timer_init(&core.endpoints[i].re_transmit_timer, core_process_ep_timeout);
+    epoll_timer_init(&core.endpoints[i].ack_timer, core_process_ack_timeout);
+    core.endpoints[i].on_uframe_data_reception = NULL;
+    core.endpoints[i].on_iframe_data_reception = NULL;
+    core.endpoints[i].rtt = (sl_cpc_rtt_model_t){ 0 };
+    core.endpoints[i].re_transmit_timeout_ms = SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS;
+    core.endpoints[i].re_transmit_backoff = 0;
+    core.endpoints[i].packet_re_transmit_count = 0;
+    sl_queue_init(&core.endpoints[i].transmit_queue);
+    core.endpoints[i].tx_priority = CPC_TX_PRIORITY_LEVEL_DEFAULT;
+    core.endpoints[i].tx_weight = CPC_TX_PRIORITY_WEIGHT_DEFAULT;
 #if defined(ENABLE_ENCRYPTION)
-    core_endpoints[i].encrypted = false;
-    core_endpoints[i].frame_counter_tx = 0;
-    core_endpoints[i].frame_counter_rx = 0;
+    core.endpoints[i].encrypted = false;
+    core.endpoints[i].frame_counter_tx = 0;
+    core.endpoints[i].frame_counter_rx = 0;
 #endif
   }
 
@@ -316,32 +509,51 @@ void core_init(int driver_fd, int driver_notify_fd)
   {
     /* Setup the driver data socket */
     {
-      driver_sock_private_data.callback = core_process_rx_driver;
-      driver_sock_private_data.file_descriptor = driver_fd;
-      driver_sock_private_data.endpoint_number = 0; /* Irrelevant here */
-
-      epoll_register(&driver_sock_private_data);
+      core.driver_sock_private_data.callback = core_process_rx_driver;
+      core.driver_sock_private_data.file_descriptor = driver_fd;
+      core.driver_sock_private_data.callback_type = EPOLL_CALLBACK_DRIVER;
+      core.driver_sock_private_data.endpoint_number = 0; /* Irrelevant here */
+
+      /* The ring driver signals its frames on an eventfd, the others send them as datagrams */
+      if (driver_ring_is_enabled()) {
+        epoll_register(&core.driver_sock_private_data);
+      } else {
+        epoll_register_recv(&core.driver_sock_private_data, SLI_CPC_RX_FRAME_MAX_SIZE);
+      }
     }
 
     /* Setup the driver notification socket */
     {
-      driver_sock_notify_private_data.callback = core_process_rx_driver_notification;
-      driver_sock_notify_private_data.file_descriptor = driver_notify_fd;
-      driver_sock_notify_private_data.endpoint_number = 0; /* Irrelevant here */
+      core.driver_sock_notify_private_data.callback = core_process_rx_driver_notification;
+      core.driver_sock_notify_private_data.file_descriptor = driver_notify_fd;
+      core.driver_sock_notify_private_data.callback_type = EPOLL_CALLBACK_DRIVER;
+      core.driver_sock_notify_private_data.endpoint_number = 0; /* Irrelevant here */
+
+      epoll_register(&core.driver_sock_notify_private_data);
+    }
 
-      epoll_register(&driver_sock_notify_private_data);
+#if defined(ENABLE_ENCRYPTION)
+    /* Setup the frames finished by the crypto worker */
+    if (config.crypto_worker) {
+      core.crypto_worker_private_data.callback = core_process_crypto_worker;
+      core.crypto_worker_private_data.file_descriptor = crypto_worker_init(core_seal_job);
+      core.crypto_worker_private_data.callback_type = EPOLL_CALLBACK_SECURITY;
+      core.crypto_worker_private_data.endpoint_number = 0; /* Irrelevant here */
+
+      epoll_register(&core.crypto_worker_private_data);
     }
+#endif
   }
 
   /* Setup timer to fetch secondary debug counter */
   if (config.stats_interval > 0) {
-    stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-    FATAL_SYSCALL_ON(stats_timer_fd < 0);
+    core.stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    FATAL_SYSCALL_ON(core.stats_timer_fd < 0);
 
     struct itimerspec timeout_time = { .it_interval = { .tv_sec = config.stats_interval, .tv_nsec = 0 },
                                        .it_value    = { .tv_sec = config.stats_interval, .tv_nsec = 0 } };
 
-    int ret = timerfd_settime(stats_timer_fd,
+    int ret = timerfd_settime(core.stats_timer_fd,
                               0,
                               &timeout_time,
                               NULL);
@@ -354,36 +566,517 @@ void core_init(int driver_fd, int driver_notify_fd)
       FATAL_SYSCALL_ON(private_data == NULL);
 
       private_data->callback = core_fetch_secondary_debug_counters;
-      private_data->file_descriptor = stats_timer_fd;
+      private_data->file_descriptor = core.stats_timer_fd;
+      private_data->callback_type = EPOLL_CALLBACK_STATS;
 
       epoll_register(private_data);
     }
   }
 
-  sl_slist_init(&pending_on_tx_complete);
+  sl_queue_init(&core.pending_on_tx_complete);
+}
+
+/***************************************************************************//**
+ * Allocate a buffer handle along with the contiguous buffer its frame is built
+ * in: headroom for the HDLC header, the payload, and tailroom for the security
+ * tag and the FCS.
+ ******************************************************************************/
+static sl_cpc_buffer_handle_t* core_alloc_buffer_handle(uint16_t data_length)
+{
+  size_t frame_size = SLI_CPC_HDLC_HEADER_RAW_SIZE;
+
+  if (data_length != 0) {
+    frame_size += (size_t)data_length + SLI_CPC_HDLC_FCS_SIZE;
+#if defined(ENABLE_ENCRYPTION)
+    frame_size += security_encrypt_get_extra_buffer_size();
+#endif
+  }
+
+  return core_attach_buffer_handle((frame_t*) mempool_alloc(&core.frame_pool, frame_size), data_length);
+}
+
+/***************************************************************************//**
+ * Allocate a buffer handle for a frame allocated from the frame pool, whose
+ * payload is already filled.
+ ******************************************************************************/
+static sl_cpc_buffer_handle_t* core_attach_buffer_handle(frame_t *frame, uint16_t data_length)
+{
+  sl_cpc_buffer_handle_t *handle;
+
+  handle = (sl_cpc_buffer_handle_t*) mempool_zalloc(&core.buffer_handle_pool, sizeof(sl_cpc_buffer_handle_t));
+  handle->frame = frame;
+
+  handle->hdlc_header = handle->frame->header;
+  handle->data = (data_length != 0) ? handle->frame->payload : NULL;
+  handle->data_length = data_length;
+
+  return handle;
+}
+
+/***************************************************************************//**
+ * Allocate a buffer handle for a supervisory frame, already built from the
+ * prebuilt headers: no CRC is computed. An ack or a selective reject is sent
+ * as is from the shared table, a reject copies it along with its payload in a
+ * frame from the pool.
+ ******************************************************************************/
+static sl_cpc_buffer_handle_t* core_alloc_supervisory_handle(uint8_t address, uint8_t control, sl_cpc_reject_reason_t reason)
+{
+  const uint8_t *header = hdlc_get_supervisory_header(address, control);
+  sl_cpc_buffer_handle_t *handle;
+
+  if (hdlc_get_supervisory_function(control) == SLI_CPC_HDLC_REJECT_SUPERVISORY_FUNCTION) {
+    handle = core_alloc_buffer_handle(SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE);
+    memcpy(handle->frame->header, header, SLI_CPC_HDLC_HEADER_RAW_SIZE);
+    memcpy(handle->frame->payload, hdlc_get_reject_payload(reason), SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE + SLI_CPC_HDLC_FCS_SIZE);
+  } else {
+    handle = (sl_cpc_buffer_handle_t*) mempool_zalloc(&core.buffer_handle_pool, sizeof(sl_cpc_buffer_handle_t));
+    handle->frame = (frame_t*) header; // Only ever read
+    handle->hdlc_header = handle->frame->header;
+    handle->prebuilt_frame = true;
+  }
+
+  handle->address = address;
+  handle->control = control;
+  handle->frame_length = SLI_CPC_HDLC_HEADER_RAW_SIZE + (size_t)hdlc_get_length(header);
+
+  return handle;
+}
+
+/***************************************************************************//**
+ * Free a buffer handle, its frame and security information
+ ******************************************************************************/
+static void core_free_buffer_handle(sl_cpc_buffer_handle_t *handle)
+{
+#if defined(ENABLE_ENCRYPTION)
+  if (handle->security_info) {
+    free((void *)handle->security_info);
+  }
+#endif
+
+  if (!handle->prebuilt_frame) {
+    mempool_free(&core.frame_pool, handle->frame);
+  }
+  mempool_free(&core.buffer_handle_pool, handle);
+}
+
+void core_init_buffer_pools(void)
+{
+  size_t frame_block_size;
+  size_t frame_count;
+
+  /* Largest frame the secondary accepts, with room for the header, the FCS and the security tag */
+  frame_block_size = SLI_CPC_HDLC_HEADER_RAW_SIZE + server_core_get_secondary_rx_capability() + SLI_CPC_HDLC_FCS_SIZE;
+#if defined(ENABLE_ENCRYPTION)
+  frame_block_size += security_encrypt_get_extra_buffer_size();
+#endif
+
+  /* A full tx window in flight on a few endpoints, plus the frames that are being
+   * transmitted or received at any given time, and the ones the server keeps
+   * ready to receive from its clients */
+  frame_count = (size_t)server_core_get_tx_window_size() * SLI_CPC_BUFFER_POOL_ENDPOINT_COUNT
+                + SLI_CPC_BUFFER_POOL_EXTRA_FRAMES
+                + SERVER_HELD_WRITE_BUFFERS;
+
+  /* A fragmented message is queued whole */
+  if (server_core_secondary_supports_fragmentation()) {
+    frame_count += SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE / server_core_get_secondary_rx_capability() + 1;
+  }
+
+  TRACE_CORE("Buffer pools sized for %zu frames of %zu bytes", frame_count, frame_block_size);
+
+  mempool_init(&core.frame_pool, frame_block_size, frame_count);
+  mempool_init(&core.buffer_handle_pool, sizeof(sl_cpc_buffer_handle_t), frame_count);
+  /* Frames waiting on a tx complete use a second queue item */
+  mempool_init(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t), 2 * frame_count);
+}
+
+void core_print_buffer_pool_stats(void)
+{
+  const struct {
+    const char *name;
+    const mempool_t *pool;
+  } pools[] = {
+    { "frame", &core.frame_pool },
+    { "buffer_handle", &core.buffer_handle_pool },
+    { "queue_item", &core.queue_item_pool },
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(pools); i++) {
+    TRACE("Host core %s pool: size %zu, count %zu, in_use %zu, high_water_mark %zu, hits %u, misses %u",
+          pools[i].name,
+          pools[i].pool->block_size,
+          pools[i].pool->block_count,
+          pools[i].pool->in_use,
+          pools[i].pool->high_water_mark,
+          pools[i].pool->hits,
+          pools[i].pool->misses);
+  }
+}
+
+void core_print_transmit_queue_stats(void)
+{
+  for (size_t n = 0; n < core.opened_endpoint_count; n++) {
+    size_t i = core.opened_endpoints[n];
+    const sl_cpc_endpoint_t *ep = &core.endpoints[i];
+
+    if (ep->state != SL_CPC_STATE_OPEN && ep->stats->transmit_queue_dequeued == 0) {
+      continue;
+    }
+
+    TRACE("Host core ep#%zu tx queue: priority %u, weight %u, depth %zu, max_depth %zu, dequeued %" PRIu64 ", avg_delay %" PRIu64 " us, max_delay %" PRIu64 " us",
+          i,
+          ep->tx_priority,
+          ep->tx_weight,
+          sl_queue_len(&ep->transmit_queue),
+          ep->stats->transmit_queue_depth_max,
+          ep->stats->transmit_queue_dequeued,
+          ep->stats->transmit_queue_dequeued ? ep->stats->transmit_queue_delay_total_us / ep->stats->transmit_queue_dequeued : 0,
+          ep->stats->transmit_queue_delay_max_us);
+  }
+}
+
+void core_add_metrics(metrics_t *metrics)
+{
+  static const char *const protocol_parameter_names[CPC_PROTOCOL_PARAMETER_COUNT] = {
+    [CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS] = "re_transmit_timeout_min_ms",
+    [CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS] = "re_transmit_timeout_max_ms",
+    [CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_MAX_COUNT] = "re_transmit_max_count",
+    [CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE] = "tx_window_size",
+    [CPC_PROTOCOL_PARAMETER_KEEP_ALIVE_INTERVAL_MS] = "keep_alive_interval_ms",
+    [CPC_PROTOCOL_PARAMETER_STATS_INTERVAL_S] = "stats_interval_s",
+  };
+  const struct {
+    const char *name;
+    const mempool_t *pool;
+  } pools[] = {
+    { "frame", &core.frame_pool },
+    { "buffer_handle", &core.buffer_handle_pool },
+    { "queue_item", &core.queue_item_pool },
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(pools); i++) {
+    metrics_add_gauge(metrics, "pool_in_use", "pool", pools[i].name, pools[i].pool->in_use);
+    metrics_add_gauge(metrics, "pool_high_water_mark", "pool", pools[i].name, pools[i].pool->high_water_mark);
+    metrics_add_counter(metrics, "pool_misses", "pool", pools[i].name, pools[i].pool->misses);
+  }
+
+  for (size_t i = 0; i < ARRAY_SIZE(protocol_parameter_names); i++) {
+    uint32_t value;
+
+    if (core_get_protocol_parameter(0, (cpc_protocol_parameter_t)i, &value) == 0) {
+      metrics_add_gauge(metrics, "protocol_parameter", "parameter", protocol_parameter_names[i], value);
+    }
+  }
+
+  for (size_t n = 0; n < core.opened_endpoint_count; n++) {
+    size_t i = core.opened_endpoints[n];
+    const sl_cpc_endpoint_t *ep = &core.endpoints[i];
+    char id[4];
+
+    if (ep->state != SL_CPC_STATE_OPEN && ep->stats->transmit_queue_dequeued == 0) {
+      continue;
+    }
+
+    snprintf(id, sizeof(id), "%zu", i);
+
+    metrics_add_counter(metrics, "endpoint_txd_data_frames", "endpoint", id, ep->stats->txd_data_frames);
+    metrics_add_counter(metrics, "endpoint_txd_data_bytes", "endpoint", id, ep->stats->txd_data_bytes);
+    metrics_add_counter(metrics, "endpoint_rxd_data_frames", "endpoint", id, ep->stats->rxd_data_frames);
+    metrics_add_counter(metrics, "endpoint_rxd_data_bytes", "endpoint", id, ep->stats->rxd_data_bytes);
+    metrics_add_counter(metrics, "endpoint_retxd_data_frames", "endpoint", id, ep->stats->retxd_data_frames);
+    metrics_add_counter(metrics, "endpoint_txd_aggregated_messages", "endpoint", id, ep->stats->txd_aggregated_messages);
+    metrics_add_counter(metrics, "endpoint_rxd_aggregated_messages", "endpoint", id, ep->stats->rxd_aggregated_messages);
+    metrics_add_counter(metrics, "endpoint_txd_compression_input_bytes", "endpoint", id, ep->stats->txd_compression_input_bytes);
+    metrics_add_counter(metrics, "endpoint_txd_compression_output_bytes", "endpoint", id, ep->stats->txd_compression_output_bytes);
+    metrics_add_counter(metrics, "endpoint_rxd_compression_input_bytes", "endpoint", id, ep->stats->rxd_compression_input_bytes);
+    metrics_add_counter(metrics, "endpoint_rxd_compression_output_bytes", "endpoint", id, ep->stats->rxd_compression_output_bytes);
+    metrics_add_gauge(metrics, "endpoint_tx_queue_depth", "endpoint", id, sl_queue_len(&ep->transmit_queue));
+    metrics_add_gauge(metrics, "endpoint_tx_queue_max_depth", "endpoint", id, ep->stats->transmit_queue_depth_max);
+    metrics_add_counter(metrics, "endpoint_tx_queue_dequeued", "endpoint", id, ep->stats->transmit_queue_dequeued);
+    metrics_add_counter(metrics, "endpoint_tx_queue_delay_us", "endpoint", id, ep->stats->transmit_queue_delay_total_us);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_queue_depth", "endpoint", id, ep->frames_count_re_transmit_queue);
+    metrics_add_gauge(metrics, "endpoint_tx_window_space", "endpoint", id, ep->current_tx_window_space);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_timeout_ms", "endpoint", id, (uint64_t)ep->re_transmit_timeout_ms);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_backoff", "endpoint", id, ep->re_transmit_backoff);
+    metrics_add_gauge(metrics, "endpoint_smoothed_rtt_us", "endpoint", id, (uint64_t)ep->rtt.mean_rtt_us);
+    metrics_add_gauge(metrics, "endpoint_rtt_latency_us", "endpoint", id, (uint64_t)ep->rtt.latency_us);
+    metrics_add_gauge(metrics, "endpoint_rtt_byte_time_ns", "endpoint", id, (uint64_t)(ep->rtt.byte_time_us * 1000));
+    metrics_add_gauge(metrics, "endpoint_rtt_variation_us", "endpoint", id, (uint64_t)ep->rtt.variation_us);
+    metrics_add_counter(metrics, "endpoint_rtt_samples", "endpoint", id, ep->rtt.samples);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_timeout_min_ms", "endpoint", id, ep->min_re_transmit_timeout_ms);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_timeout_max_ms", "endpoint", id, ep->max_re_transmit_timeout_ms);
+    metrics_add_gauge(metrics, "endpoint_re_transmit_max_count", "endpoint", id, ep->max_re_transmit);
+    metrics_add_gauge(metrics, "endpoint_tx_window_size", "endpoint", id, ep->configured_tx_window_size);
+    metrics_add_histogram(metrics, "endpoint_rtt_seconds", "endpoint", id, &ep->stats->rtt);
+
+    if (config.frame_latency_stats) {
+      static const char *const stage_names[CORE_LATENCY_STAGE_COUNT] = {
+        [CORE_LATENCY_STAGE_QUEUE] = "endpoint_tx_latency_queue_seconds",
+        [CORE_LATENCY_STAGE_BUILD] = "endpoint_tx_latency_build_seconds",
+        [CORE_LATENCY_STAGE_BUS] = "endpoint_tx_latency_bus_seconds",
+        [CORE_LATENCY_STAGE_ACK] = "endpoint_tx_latency_ack_seconds",
+        [CORE_LATENCY_STAGE_TOTAL] = "endpoint_tx_latency_total_seconds",
+      };
+
+      for (size_t stage = 0; stage < CORE_LATENCY_STAGE_COUNT; stage++) {
+        metrics_add_histogram(metrics, stage_names[stage], "endpoint", id, &ep->stats->latency[stage]);
+      }
+    }
+  }
 }
 
 void core_process_transmit_queue(void)
 {
   /* Flush the transmit queue */
-  while (transmit_queue != NULL || pending_on_security_ready_queue != NULL) {
+  while (!core_tx_scheduler_is_empty() || !sl_queue_is_empty(&core.pending_on_security_ready_queue)) {
     if (!core_process_tx_queue()) {
       break;
     }
   }
+
+  core_flush_frames_to_driver();
+}
+
+size_t core_get_opened_endpoints(const uint8_t **ep_ids)
+{
+  *ep_ids = core.opened_endpoints;
+  return core.opened_endpoint_count;
+}
+
+bool core_is_idle(void)
+{
+  if (!sl_queue_is_empty(&core.supervisory_transmit_queue)
+      || !sl_queue_is_empty(&core.pending_on_security_ready_queue)
+      || !sl_queue_is_empty(&core.pending_on_tx_complete)
+      || core.tx_batch.count != 0) {
+    return false;
+  }
+
+  for (size_t i = 0; i < core.opened_endpoint_count; i++) {
+    const sl_cpc_endpoint_t *ep = &core.endpoints[core.opened_endpoints[i]];
+
+    if (ep->state == SL_CPC_STATE_CLOSING
+        || !sl_queue_is_empty(&ep->transmit_queue)
+        || !sl_queue_is_empty(&ep->re_transmit_queue)
+        || !sl_queue_is_empty(&ep->holding_list)
+        || ep->ack_pending_count != 0
+        || ep->selective_reject_pending
+        || ep->rx_fragments_length != 0
+        || ep->tx_aggregate != NULL
+        || ep->rx_aggregate_delivered != 0) {
+      return false;
+    }
+
+    for (size_t seq = 0; seq < ARRAY_SIZE(ep->out_of_order_frames); seq++) {
+      if (ep->out_of_order_frames[seq] != NULL) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void core_export_endpoint(uint8_t ep_id, handoff_endpoint_t *exported)
+{
+  const sl_cpc_endpoint_t *ep = &core.endpoints[ep_id];
+
+  memset(exported, 0, sizeof(*exported));
+  exported->id = ep_id;
+  exported->state = (uint8_t)ep->state;
+  exported->flags = ep->flags;
+  exported->seq = ep->seq;
+  exported->ack = ep->ack;
+  exported->tx_window_size = ep->configured_tx_window_size;
+  exported->tx_priority = ep->tx_priority;
+  exported->tx_weight = ep->tx_weight;
+  exported->fragmentation = ep->fragmentation;
+  exported->aggregation_deadline_us = ep->aggregation_deadline_us;
+  exported->compression = ep->compression;
+  exported->max_re_transmit = ep->max_re_transmit;
+  exported->min_re_transmit_timeout_ms = ep->min_re_transmit_timeout_ms;
+  exported->max_re_transmit_timeout_ms = ep->max_re_transmit_timeout_ms;
+  exported->re_transmit_timeout_ms = (uint32_t)ep->re_transmit_timeout_ms;
+}
+
+/***************************************************************************//**
+ * Set the re-transmit parameters of an endpoint, its current re-transmit
+ * timeout is brought within the new bounds
+ ******************************************************************************/
+static void core_apply_re_transmit_parameters(sl_cpc_endpoint_t *ep,
+                                              uint16_t min_re_transmit_timeout_ms,
+                                              uint16_t max_re_transmit_timeout_ms,
+                                              uint8_t max_re_transmit)
+{
+  ep->min_re_transmit_timeout_ms = min_re_transmit_timeout_ms;
+  ep->max_re_transmit_timeout_ms = max_re_transmit_timeout_ms;
+  ep->max_re_transmit = max_re_transmit;
+
+  if (ep->re_transmit_timeout_ms < min_re_transmit_timeout_ms) {
+    ep->re_transmit_timeout_ms = min_re_transmit_timeout_ms;
+  } else if (ep->re_transmit_timeout_ms > max_re_transmit_timeout_ms) {
+    ep->re_transmit_timeout_ms = max_re_transmit_timeout_ms;
+  }
+}
+
+int core_get_protocol_parameter(uint8_t ep_id, cpc_protocol_parameter_t parameter, uint32_t *value)
+{
+  const sl_cpc_endpoint_t *ep = &core.endpoints[ep_id];
+
+  if (ep_id != 0 && ep->state != SL_CPC_STATE_OPEN) {
+    return -ENOTCONN;
+  }
+
+  switch (parameter) {
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS:
+      *value = ep_id != 0 ? ep->min_re_transmit_timeout_ms : core.parameters.min_re_transmit_timeout_ms;
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS:
+      *value = ep_id != 0 ? ep->max_re_transmit_timeout_ms : core.parameters.max_re_transmit_timeout_ms;
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_MAX_COUNT:
+      *value = ep_id != 0 ? ep->max_re_transmit : core.parameters.max_re_transmit;
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE:
+      // The window an open endpoint was given can be read, not changed
+      *value = ep_id != 0 ? ep->configured_tx_window_size : core.parameters.max_tx_window_size;
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_KEEP_ALIVE_INTERVAL_MS:
+      if (ep_id != 0) {
+        return -EINVAL;
+      }
+      *value = server_get_noop_keep_alive_interval_ms();
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_STATS_INTERVAL_S:
+      if (ep_id != 0) {
+        return -EINVAL;
+      }
+      *value = (uint32_t)config.stats_interval;
+      return 0;
+
+    default:
+      return -EINVAL;
+  }
+}
+
+int core_set_protocol_parameter(uint8_t ep_id, cpc_protocol_parameter_t parameter, uint32_t value)
+{
+  sl_cpc_endpoint_t *ep = &core.endpoints[ep_id];
+  uint16_t min_re_transmit_timeout_ms;
+  uint16_t max_re_transmit_timeout_ms;
+  uint8_t max_re_transmit;
+
+  if (ep_id != 0 && ep->state != SL_CPC_STATE_OPEN) {
+    return -ENOTCONN;
+  }
+
+  switch (parameter) {
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS:
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS:
+    case CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_MAX_COUNT:
+      if (ep_id != 0) {
+        min_re_transmit_timeout_ms = ep->min_re_transmit_timeout_ms;
+        max_re_transmit_timeout_ms = ep->max_re_transmit_timeout_ms;
+        max_re_transmit = ep->max_re_transmit;
+      } else {
+        min_re_transmit_timeout_ms = core.parameters.min_re_transmit_timeout_ms;
+        max_re_transmit_timeout_ms = core.parameters.max_re_transmit_timeout_ms;
+        max_re_transmit = core.parameters.max_re_transmit;
+      }
+
+      if (parameter == CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MIN_MS) {
+        if (value == 0 || value > max_re_transmit_timeout_ms) {
+          return -EINVAL;
+        }
+        min_re_transmit_timeout_ms = (uint16_t)value;
+      } else if (parameter == CPC_PROTOCOL_PARAMETER_RE_TRANSMIT_TIMEOUT_MAX_MS) {
+        if (value < min_re_transmit_timeout_ms || value > SL_CPC_RE_TRANSMIT_TIMEOUT_LIMIT_MS) {
+          return -EINVAL;
+        }
+        max_re_transmit_timeout_ms = (uint16_t)value;
+      } else {
+        if (value == 0 || value > UINT8_MAX) {
+          return -EINVAL;
+        }
+        max_re_transmit = (uint8_t)value;
+      }
+
+      if (ep_id != 0) {
+        core_apply_re_transmit_parameters(ep, min_re_transmit_timeout_ms, max_re_transmit_timeout_ms, max_re_transmit);
+        return 0;
+      }
+
+      core.parameters.min_re_transmit_timeout_ms = min_re_transmit_timeout_ms;
+      core.parameters.max_re_transmit_timeout_ms = max_re_transmit_timeout_ms;
+      core.parameters.max_re_transmit = max_re_transmit;
+
+      // The daemon-wide values replace the ones tuned on the open endpoints
+      for (size_t n = 0; n < core.opened_endpoint_count; n++) {
+        core_apply_re_transmit_parameters(&core.endpoints[core.opened_endpoints[n]],
+                                          min_re_transmit_timeout_ms,
+                                          max_re_transmit_timeout_ms,
+                                          max_re_transmit);
+      }
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_TX_WINDOW_SIZE:
+      if (ep_id != 0 || value < TRANSMIT_WINDOW_MIN_SIZE || value > TRANSMIT_WINDOW_MAX_SIZE) {
+        return -EINVAL;
+      }
+      core.parameters.max_tx_window_size = (uint8_t)value;
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_KEEP_ALIVE_INTERVAL_MS:
+      if (ep_id != 0 || value == 0) {
+        return -EINVAL;
+      }
+      if (!config.use_noop_keep_alive) {
+        return -ENOTSUP;
+      }
+      server_set_noop_keep_alive_interval_ms(value);
+      return 0;
+
+    case CPC_PROTOCOL_PARAMETER_STATS_INTERVAL_S:
+      if (ep_id != 0 || value == 0 || value > INT32_MAX) {
+        return -EINVAL;
+      }
+      // The timers only exist if the statistics were enabled on startup
+      if (config.stats_interval == 0) {
+        return -ENOTSUP;
+      }
+      config.stats_interval = (long)value;
+      {
+        struct itimerspec timeout_time = { .it_interval = { .tv_sec = config.stats_interval, .tv_nsec = 0 },
+                                           .it_value    = { .tv_sec = config.stats_interval, .tv_nsec = 0 } };
+        int ret = timerfd_settime(core.stats_timer_fd, 0, &timeout_time, NULL);
+
+        FATAL_SYSCALL_ON(ret < 0);
+      }
+      logging_update_stats_interval();
+      return 0;
+
+    default:
+      return -EINVAL;
+  }
 }
 
 cpc_endpoint_state_t core_get_endpoint_state(uint8_t ep_id)
 {
   FATAL_ON(ep_id == 0);
-  return core_endpoints[ep_id].state;
+  return core.endpoints[ep_id].state;
 }
 
 void core_set_endpoint_state(uint8_t ep_id, cpc_endpoint_state_t state)
 {
-  if (core_endpoints[ep_id].state != state) {
-    TRACE_CORE("Changing ep#%d state from %s to %s", ep_id, core_stringify_state(core_endpoints[ep_id].state), core_stringify_state(state));
-    core_endpoints[ep_id].state = state;
+  if (core.endpoints[ep_id].state != state) {
+    TRACE_CORE("Changing ep#%d state from %s to %s", ep_id, core_stringify_state(core.endpoints[ep_id].state), core_stringify_state(state));
+    core.endpoints[ep_id].state = state;
+    flight_recorder_event(FLIGHT_RECORDER_ENDPOINT_STATE, ep_id, (uint8_t)state, 0);
     server_on_endpoint_state_change(ep_id, state);
   }
 }
@@ -391,13 +1084,28 @@ void core_set_endpoint_state(uint8_t ep_id, cpc_endpoint_state_t state)
 bool core_get_endpoint_encryption(uint8_t ep_id)
 {
 #if defined(ENABLE_ENCRYPTION)
-  return core_endpoints[ep_id].encrypted;
+  return core.endpoints[ep_id].encrypted;
 #else
   (void) ep_id;
   return false;
 #endif
 }
 
+/***************************************************************************//**
+ * Number of frames the endpoint can send right away. Past that, writes wait in
+ * the holding list for the secondary to acknowledge frames in flight.
+ ******************************************************************************/
+uint32_t core_get_endpoint_tx_credit(uint8_t ep_id)
+{
+  const sl_cpc_endpoint_t *endpoint = &core.endpoints[ep_id];
+
+  if (endpoint->state != SL_CPC_STATE_OPEN || !sl_queue_is_empty(&endpoint->holding_list)) {
+    return 0;
+  }
+
+  return endpoint->current_tx_window_space;
+}
+
 static void core_update_secondary_debug_counter(sl_cpc_system_command_handle_t *handle,
                                                 sl_cpc_property_id_t property_id,
                                                 void* property_value,
@@ -448,52 +1156,132 @@ static void core_fetch_secondary_debug_counters(epoll_private_data_t *event_priv
 static void core_process_rx_driver_notification(epoll_private_data_t *event_private_data)
 {
   (void)event_private_data;
-  uint8_t frame_type;
-  sl_slist_node_t *node;
-  sl_cpc_transmit_queue_item_t *item;
-  sl_cpc_buffer_handle_t *frame;
+  unsigned int count;
+  unsigned int i;
+  size_t j;
+
+  BUG_ON(core.driver_sock_notify_private_data.file_descriptor < 1);
+
+  core.tx_complete.draining = true;
+
+  /* Drain every completion available, a full read means there may be more */
+  do {
+    count = core_pull_tx_completes_from_driver();
+
+    for (i = 0; i < count; i++) {
+      /* A driver batch carries one record per frame */
+      BUG_ON(core.tx_complete.msgs[i].msg_len % sizeof(sl_cpc_tx_complete_t) != 0);
+
+      for (j = 0; j < core.tx_complete.msgs[i].msg_len / sizeof(sl_cpc_tx_complete_t); j++) {
+        core_process_tx_complete(&core.tx_complete.records[i][j]);
+      }
+    }
+  } while (count == SLI_CPC_TX_COMPLETE_BATCH_SIZE);
+
+  core.tx_complete.draining = false;
+
+  core_arm_deferred_re_transmit_timers();
+}
+
+/***************************************************************************//**
+ * Read the pending tx complete notifications into the batch, returns how many
+ * were read
+ ******************************************************************************/
+static unsigned int core_pull_tx_completes_from_driver(void)
+{
+  int retval;
+  unsigned int i;
+
+  if (core.driver_sock_notify_private_data.file_descriptor < 1) {
+    return 0;
+  }
+
+  for (i = 0; i < SLI_CPC_TX_COMPLETE_BATCH_SIZE; i++) {
+    core.tx_complete.iovecs[i].iov_base = core.tx_complete.records[i];
+    core.tx_complete.iovecs[i].iov_len = sizeof(core.tx_complete.records[i]);
+    memset(&core.tx_complete.msgs[i], 0, sizeof(core.tx_complete.msgs[i]));
+    core.tx_complete.msgs[i].msg_hdr.msg_iov = &core.tx_complete.iovecs[i];
+    core.tx_complete.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  if (driver_ring_is_enabled()) {
+    return (unsigned int)driver_ring_pop_tx_complete(core.tx_complete.msgs, SLI_CPC_TX_COMPLETE_BATCH_SIZE);
+  }
 
-  struct timespec tx_complete_timestamp;
+  retval = recvmmsg(core.driver_sock_notify_private_data.file_descriptor, core.tx_complete.msgs, SLI_CPC_TX_COMPLETE_BATCH_SIZE, MSG_DONTWAIT, NULL);
 
-  BUG_ON(driver_sock_notify_private_data.file_descriptor < 1);
-  ssize_t ret = recv(driver_sock_notify_private_data.file_descriptor, &tx_complete_timestamp, sizeof(tx_complete_timestamp), MSG_DONTWAIT);
+  /* Spurious wakeup, or the previous read took the last ones */
+  if (retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
+  }
 
-  /* Socket closed */
-  if (ret == 0 || (ret < 0 && errno == ECONNRESET)) {
+  /* Socket closed. An empty datagram is how it shows in a batch */
+  if (retval == 0 || (retval < 0 && errno == ECONNRESET) || (retval > 0 && core.tx_complete.msgs[0].msg_len == 0)) {
     TRACE_CORE("Driver closed the notification socket");
-    epoll_unregister(&driver_sock_notify_private_data);
-    int ret_close = close(driver_sock_notify_private_data.file_descriptor);
+    epoll_unregister(&core.driver_sock_notify_private_data);
+    int ret_close = close(core.driver_sock_notify_private_data.file_descriptor);
     FATAL_SYSCALL_ON(ret_close != 0);
-    driver_sock_notify_private_data.file_descriptor = -1;
-    return;
+    core.driver_sock_notify_private_data.file_descriptor = -1;
+    return 0;
+  }
+
+  FATAL_SYSCALL_ON(retval < 0);
+
+  for (i = 0; i < (unsigned int)retval; i++) {
+    /* Notifications past an empty datagram are not processed, the closure is seen on the next read */
+    if (core.tx_complete.msgs[i].msg_len == 0) {
+      return i;
+    }
   }
 
-  FATAL_SYSCALL_ON(ret < 0);
+  return (unsigned int)retval;
+}
+
+/***************************************************************************//**
+ * The oldest frame handed to the driver was transmitted
+ ******************************************************************************/
+static void core_process_tx_complete(const sl_cpc_tx_complete_t *tx_complete)
+{
+  const struct timespec *tx_complete_timestamp = &tx_complete->timestamp;
+  uint8_t frame_type;
+  sl_slist_node_t *node;
+  sl_cpc_transmit_queue_item_t *item;
+  sl_cpc_buffer_handle_t *frame;
 
   // Get first queued frame for transmission
-  node = sl_slist_pop(&pending_on_tx_complete);
+  node = sl_queue_pop(&core.pending_on_tx_complete);
   item = SL_SLIST_ENTRY(node, sl_cpc_transmit_queue_item_t, node);
   FATAL_ON(item == NULL);
 
+  // The driver completes the frames in the order they were handed over
+  if (tx_complete->frame_id != core.tx_complete.next_frame_id) {
+    BUG("Tx complete of frame %u while waiting on frame %u", tx_complete->frame_id, core.tx_complete.next_frame_id);
+  }
+  core.tx_complete.next_frame_id++;
+
   frame = item->handle;
   frame->pending_tx_complete = false;
   frame_type = hdlc_get_frame_type(frame->control);
 
+  CPCD_TRACEPOINT(tx_complete, hdlc_get_address(frame->hdlc_header), frame->control, hdlc_get_seq(frame->control));
+
   switch (frame_type) {
     case SLI_CPC_HDLC_FRAME_TYPE_INFORMATION:
 
+      if (frame->timestamps.written_ns != 0 && frame->timestamps.tx_complete_ns == 0) {
+        frame->timestamps.tx_complete_ns = (uint64_t)tx_complete_timestamp->tv_sec * 1000000000u
+                                           + (uint64_t)tx_complete_timestamp->tv_nsec;
+      }
+
       if (frame->endpoint->state != SL_CPC_STATE_OPEN) {
         // Now that tx is completed, we can clear any frames still in the re-tx queue
-        core_clear_transmit_queue(&core_endpoints[frame->endpoint->id].re_transmit_queue, -1);
+        core_clear_transmit_queue(&core.endpoints[frame->endpoint->id].re_transmit_queue, -1);
       } else {
-        // Remember when we sent this i-frame in order to calculate round trip time
-        // Only do so if this is not a re_transmit
-        if (frame->endpoint->packet_re_transmit_count == 0u) {
-          frame->endpoint->last_iframe_sent_timestamp = tx_complete_timestamp;
-        }
+        // The round trip time of the frame is measured from there
+        frame->sent_timestamp = *tx_complete_timestamp;
 
-        if (frame->endpoint->re_transmit_queue != NULL && frame->acked == false) {
-          start_re_transmit_timer(frame->endpoint, tx_complete_timestamp);
+        if (!sl_queue_is_empty(&frame->endpoint->re_transmit_queue) && frame->acked == false) {
+          start_re_transmit_timer(frame->endpoint, *tx_complete_timestamp);
         }
 
         if (frame->acked) {
@@ -507,11 +1295,7 @@ static void core_process_rx_driver_notification(epoll_private_data_t *event_priv
     // manages s-frame resources.  In case of unnumbered, all buffers can be freed since the core doesn't deal with retransmits
     case SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED:
     case SLI_CPC_HDLC_FRAME_TYPE_SUPERVISORY:
-      if (frame->data_length != 0) {
-        free((void*)frame->data); // Not expecting a reply
-      }
-      free(frame->hdlc_header);
-      free(frame);
+      core_free_buffer_handle(frame); // Not expecting a reply
       break;
 
     default:
@@ -519,20 +1303,30 @@ static void core_process_rx_driver_notification(epoll_private_data_t *event_priv
       break;
   }
 
-  free(item);
+  mempool_free(&core.queue_item_pool, item);
 }
 
 static void core_process_rx_driver(epoll_private_data_t *event_private_data)
 {
   (void)event_private_data;
-  frame_t *rx_frame;
-  size_t frame_size;
+  unsigned int frame_count;
+  unsigned int i;
 
-  /* The driver unblocked, read the frame. Frames from the driver are complete */
-  if (core_pull_frame_from_driver(&rx_frame, &frame_size) == false) {
-    return;
+  /* The driver unblocked, read the pending frames. Frames from the driver are complete */
+  frame_count = core_pull_frames_from_driver();
+
+  for (i = 0; i < frame_count; i++) {
+    core_process_rx_frame((frame_t *)core.rx_batch.iovecs[i].iov_base, core.rx_batch.msgs[i].msg_len);
   }
+}
 
+/***************************************************************************//**
+ * Process a frame received from the driver
+ *
+ * The frame buffer belongs to the receive batch and is reused once this returns.
+ ******************************************************************************/
+static void core_process_rx_frame(frame_t *rx_frame, size_t frame_size)
+{
   TRACE_CORE_RXD_FRAME(rx_frame, frame_size);
 
   /* Validate header checksum */
@@ -541,7 +1335,6 @@ static void core_process_rx_driver(epoll_private_data_t *event_private_data)
 
     if (!sli_cpc_validate_crc_sw(rx_frame->header, SLI_CPC_HDLC_HEADER_SIZE, hcs)) {
       TRACE_CORE_INVALID_HEADER_CHECKSUM();
-      free(rx_frame);
       return;
     }
   }
@@ -552,6 +1345,8 @@ static void core_process_rx_driver(epoll_private_data_t *event_private_data)
   uint8_t  type        = hdlc_get_frame_type(control);
   uint8_t  ack         = hdlc_get_ack(control);
 
+  CPCD_TRACEPOINT(frame_rx, address, control, hdlc_get_seq(control), ack, data_length);
+
   /* Make sure the length from the header matches the length reported by the driver*/
   BUG_ON(data_length != frame_size - SLI_CPC_HDLC_HEADER_RAW_SIZE);
 
@@ -562,7 +1357,6 @@ static void core_process_rx_driver(epoll_private_data_t *event_private_data)
     if (type != SLI_CPC_HDLC_FRAME_TYPE_SUPERVISORY) {
       transmit_reject(NULL, address, 0, HDLC_REJECT_UNREACHABLE_ENDPOINT);
     }
-    free(rx_frame);
     return;
   }
 
@@ -589,27 +1383,31 @@ static void core_process_rx_driver(epoll_private_data_t *event_private_data)
       TRACE_ENDPOINT_RXD_SUPERVISORY_DROPPED(endpoint);
       break;
   }
-
-  /* core_pull_frame_from_driver() malloced rx_frame */
-  free(rx_frame);
 }
 
 bool core_ep_is_closing(uint8_t ep_id)
 {
-  return core_endpoints[ep_id].state == SL_CPC_STATE_CLOSING;
+  return core.endpoints[ep_id].state == SL_CPC_STATE_CLOSING;
 }
 
 void core_process_endpoint_change(uint8_t endpoint_number, cpc_endpoint_state_t ep_state, bool encryption)
 {
   if (ep_state == SL_CPC_STATE_OPEN) {
-    if (core_endpoints[endpoint_number].state == SL_CPC_STATE_OPEN) {
+    /* The tx window negotiated with the secondary, unless tuned smaller */
+    uint8_t tx_window_size = server_core_get_tx_window_size();
+
+    if (core.endpoints[endpoint_number].state == SL_CPC_STATE_OPEN) {
       return; // Nothing to do
     }
 
+    if (tx_window_size > core.parameters.max_tx_window_size) {
+      tx_window_size = core.parameters.max_tx_window_size;
+    }
+
     core_open_endpoint(endpoint_number,
-                       0,           /* No flags : iframe enables, uframe disabled*/
-                       1,           /* tx window of 1*/
-                       encryption); /* encryption of the underlying endpoint */
+                       0,                                /* No flags : iframe enables, uframe disabled*/
+                       tx_window_size,
+                       encryption);                      /* encryption of the underlying endpoint */
   } else {
     core_close_endpoint(endpoint_number, true, false);
   }
@@ -617,22 +1415,274 @@ void core_process_endpoint_change(uint8_t endpoint_number, cpc_endpoint_state_t
 
 bool core_ep_is_busy(uint8_t ep_id)
 {
-  if (core_endpoints[ep_id].holding_list != NULL) {
+  if (!sl_queue_is_empty(&core.endpoints[ep_id].holding_list)) {
     return true;
   }
   return false;
 }
 
-static void core_process_rx_i_frame(frame_t *rx_frame)
+/***************************************************************************//**
+ * Decrypt the next I-frame in sequence in place, if it is encrypted. Only the
+ * encrypted frames take a frame counter of the endpoint, which is why a frame
+ * held out of order is decrypted once it is in sequence. Returns false if the
+ * frame could not be decrypted.
+ ******************************************************************************/
+static bool core_decrypt_rx_i_frame(sl_cpc_endpoint_t *endpoint, frame_t *rx_frame, uint16_t *rx_frame_payload_length)
 {
-  sl_cpc_endpoint_t* endpoint;
 #if defined(ENABLE_ENCRYPTION)
-  bool frame_was_decrypted = false;
+  if (should_decrypt_frame(endpoint, *rx_frame_payload_length)) {
+    uint16_t tag_len = (uint16_t)security_encrypt_get_extra_buffer_size();
+    uint16_t payload_length = *rx_frame_payload_length;
+    sl_status_t status;
+    uint64_t start_ns = CPCD_TRACEPOINT_ENABLED(crypto) ? core_tracepoint_now_ns() : 0;
+
+    /* the payload buffer must be longer than the security tag */
+    BUG_ON(payload_length < tag_len);
+    payload_length = (uint16_t)(payload_length - tag_len);
+
+    /* decrypt in place, the payload of a frame that fails is clobbered but dropped anyway */
+    status = security_decrypt(endpoint,
+                              rx_frame->header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
+                              rx_frame->payload, payload_length,
+                              rx_frame->payload,
+                              &(rx_frame->payload[payload_length]), tag_len);
+    if (start_ns != 0) {
+      CPCD_TRACEPOINT(crypto, endpoint->id, false, payload_length, core_tracepoint_now_ns() - start_ns);
+    }
+
+    if (status != SL_STATUS_OK) {
+      WARN("Failed to decrypt frame, status=0x%x", status);
+      return false;
+    }
+
+    *rx_frame_payload_length = payload_length;
+  }
+#else
+  (void)endpoint;
+  (void)rx_frame;
+  (void)rx_frame_payload_length;
+#endif
+
+  return true;
+}
+
+/***************************************************************************//**
+ * Deliver an in-sequence, decrypted, I-frame to its destination and update the
+ * endpoint acknowledge number. Returns false if the frame could not be
+ * delivered, in which case a reject was sent or the endpoint closed.
+ ******************************************************************************/
+static bool core_deliver_rx_i_frame(sl_cpc_endpoint_t *endpoint, frame_t *rx_frame, uint16_t rx_frame_payload_length)
+{
+  uint8_t address = hdlc_get_address(rx_frame->header);
+  uint8_t control = hdlc_get_control(rx_frame->header);
+
+  // Check if the received message is a final reply for the system endpoint
+  if (hdlc_is_poll_final(control) && endpoint->id == SL_CPC_ENDPOINT_SYSTEM) {
+    BUG_ON(endpoint->poll_final.on_final == NULL); // Received final, but no callback assigned
+    endpoint->poll_final.on_final(endpoint->id, (void *)SLI_CPC_HDLC_FRAME_TYPE_INFORMATION, rx_frame->payload, rx_frame_payload_length);
+  } else {
+    if (endpoint->id == SL_CPC_ENDPOINT_SYSTEM) {
+      // unsolicited i-frame
+      if (endpoint->on_iframe_data_reception != NULL) {
+        endpoint->on_iframe_data_reception(endpoint->id, rx_frame->payload, rx_frame_payload_length);
+      }
+    } else {
+      // On the other endpoints, P/F is set on every fragment of a message but the last one
+      const uint8_t *payload = rx_frame->payload;
+      uint16_t payload_length = rx_frame_payload_length;
+      sl_status_t status;
+
+      if (hdlc_is_compressed(rx_frame->header) && !server_core_secondary_supports_compression()) {
+        // The secondary is at fault, it only compresses once compression is enabled on it
+        WARN("Received a compressed frame on ep#%d, compression is not enabled, closing it", endpoint->id);
+        core_close_endpoint(endpoint->id, true, false);
+        return false;
+      } else if (hdlc_is_compressed(rx_frame->header)) {
+        ssize_t decompressed_length = core_decompress_frame(endpoint, rx_frame->payload, rx_frame_payload_length);
+
+        if (decompressed_length < 0) {
+          // Went through the FCS and the decryption, the secondary is at fault
+          WARN("Failed to decompress a frame on ep#%d, closing it", endpoint->id);
+          core_close_endpoint(endpoint->id, true, false);
+          return false;
+        }
+
+        payload = core.decompress_buffer;
+        payload_length = (uint16_t)decompressed_length;
+      }
+
+      if (hdlc_is_aggregated(rx_frame->header) && !server_core_secondary_supports_aggregation()) {
+        // Same, it only aggregates once aggregation is enabled on it
+        WARN("Received an aggregate on ep#%d, aggregation is not enabled, closing it", endpoint->id);
+        core_close_endpoint(endpoint->id, true, false);
+        return false;
+      } else if (hdlc_is_aggregated(rx_frame->header)) {
+        status = core_push_rx_aggregate(endpoint, payload, payload_length);
+      } else if (hdlc_is_poll_final(control) && !server_core_secondary_supports_fragmentation()) {
+        // Same, it only fragments once fragmentation is enabled on it
+        WARN("Received a fragment on ep#%d, fragmentation is not enabled, closing it", endpoint->id);
+        core_close_endpoint(endpoint->id, true, false);
+        return false;
+      } else {
+        status = core_push_rx_fragment(endpoint,
+                                       payload,
+                                       payload_length,
+                                       hdlc_is_poll_final(control));
+      }
+      if (status == SL_STATUS_FAIL) {
+        // can't recover from that, close endpoint
+        core_close_endpoint(endpoint->id, true, false);
+        return false;
+      } else if (status == SL_STATUS_WOULD_BLOCK) {
+        transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_OUT_OF_MEMORY);
+        return false;
+      }
+    }
+  }
+
+  endpoint->stats->rxd_data_frames++;
+  endpoint->stats->rxd_data_bytes += rx_frame_payload_length;
+  TRACE_ENDPOINT_RXD_DATA_FRAME_QUEUED(endpoint);
+
+#ifdef UNIT_TESTING
+  if (endpoint->id != SL_CPC_ENDPOINT_SYSTEM && endpoint->id != SL_CPC_ENDPOINT_SECURITY) {
+    cpc_unity_test_read_rx_callback(endpoint->id);
+  }
 #endif
 
+  // Update endpoint acknowledge number
+  endpoint->ack++;
+  endpoint->ack %= 8;
+
+  return true;
+}
+
+/***************************************************************************//**
+ * Push the payload of an I-frame to the server, or add it to the message being
+ * reassembled. A message is pushed whole once its last fragment is received,
+ * same return values as core_push_data_to_server().
+ ******************************************************************************/
+static sl_status_t core_push_rx_fragment(sl_cpc_endpoint_t *endpoint,
+                                         const uint8_t *payload,
+                                         uint16_t payload_length,
+                                         bool more_fragments)
+{
+  size_t message_length = endpoint->rx_fragments_length + payload_length;
+  sl_status_t status = SL_STATUS_OK;
+
+  if (!more_fragments && endpoint->rx_fragments_length == 0) {
+    return core_push_data_to_server(endpoint->id, payload, payload_length);
+  }
+
+  /* Past the largest message, the fragments are only counted until the last one */
+  if (message_length <= SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE) {
+    if (endpoint->rx_fragments == NULL) {
+      endpoint->rx_fragments = (uint8_t *)malloc(SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE);
+      FATAL_ON(endpoint->rx_fragments == NULL);
+    }
+    memcpy(&endpoint->rx_fragments[endpoint->rx_fragments_length], payload, payload_length);
+  }
+
+  if (more_fragments) {
+    endpoint->rx_fragments_length = message_length;
+    return SL_STATUS_OK;
+  }
+
+  if (message_length > SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE) {
+    WARN("Dropped a message of %zu bytes on ep#%d, larger than %u bytes", message_length, endpoint->id, SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE);
+  } else {
+    status = core_push_data_to_server(endpoint->id, endpoint->rx_fragments, message_length);
+  }
+
+  // The last fragment is received again after the reject, the others are kept
+  if (status != SL_STATUS_WOULD_BLOCK) {
+    endpoint->rx_fragments_length = 0;
+  }
+
+  return status;
+}
+
+/***************************************************************************//**
+ * Push the messages of an aggregated I-frame to the server, one at a time. The
+ * frame is received again after a reject, the messages pushed before one would
+ * block are then skipped. Same return values as core_push_data_to_server().
+ ******************************************************************************/
+static sl_status_t core_push_rx_aggregate(sl_cpc_endpoint_t *endpoint,
+                                          const uint8_t *payload,
+                                          uint16_t payload_length)
+{
+  size_t offset = 0;
+  uint16_t index = 0;
+
+  while (offset < payload_length) {
+    size_t message_length;
+
+    if (payload_length - offset < SL_CPC_AGGREGATE_PREFIX_SIZE) {
+      WARN("Dropped the end of a malformed aggregate on ep#%d", endpoint->id);
+      break;
+    }
+
+    message_length = (size_t)payload[offset] | ((size_t)payload[offset + 1] << 8);
+    offset += SL_CPC_AGGREGATE_PREFIX_SIZE;
+
+    if (message_length > payload_length - offset) {
+      WARN("Dropped the end of a malformed aggregate on ep#%d", endpoint->id);
+      break;
+    }
+
+    if (index >= endpoint->rx_aggregate_delivered) {
+      sl_status_t status = core_push_data_to_server(endpoint->id, &payload[offset], message_length);
+
+      if (status == SL_STATUS_WOULD_BLOCK) {
+        endpoint->rx_aggregate_delivered = index;
+        return status;
+      } else if (status != SL_STATUS_OK) {
+        endpoint->rx_aggregate_delivered = 0;
+        return status;
+      }
+
+      endpoint->stats->rxd_aggregated_messages++;
+    }
+
+    offset += message_length;
+    index++;
+  }
+
+  endpoint->rx_aggregate_delivered = 0;
+
+  return SL_STATUS_OK;
+}
+
+/***************************************************************************//**
+ * Decompress the payload of an I-frame into the decompression buffer. Returns
+ * its length, -EBADMSG if it is malformed.
+ ******************************************************************************/
+static ssize_t core_decompress_frame(sl_cpc_endpoint_t *endpoint, const uint8_t *payload, uint16_t payload_length)
+{
+  ssize_t length;
+
+  if (core.decompress_buffer == NULL) {
+    core.decompress_buffer = (uint8_t *)malloc(SLI_CPC_RX_PAYLOAD_MAX_SIZE);
+    FATAL_ON(core.decompress_buffer == NULL);
+  }
+
+  // The payload was no larger than a frame before it was compressed
+  length = lz4_block_decompress(payload, payload_length, core.decompress_buffer, SLI_CPC_RX_PAYLOAD_MAX_SIZE);
+  if (length >= 0) {
+    endpoint->stats->rxd_compression_input_bytes += payload_length;
+    endpoint->stats->rxd_compression_output_bytes += (uint64_t)length;
+  }
+
+  return length;
+}
+
+static void core_process_rx_i_frame(frame_t *rx_frame)
+{
+  sl_cpc_endpoint_t* endpoint;
+
   uint8_t address = hdlc_get_address(rx_frame->header);
 
-  endpoint = &core_endpoints[hdlc_get_address(rx_frame->header)];
+  endpoint = &core.endpoints[hdlc_get_address(rx_frame->header)];
 
   TRACE_ENDPOINT_RXD_DATA_FRAME(endpoint);
 
@@ -650,8 +1700,16 @@ static void core_process_rx_i_frame(frame_t *rx_frame)
 
   /* Validate payload checksum. In case it is invalid, NAK the packet. */
   if (!sli_cpc_validate_crc_sw(rx_frame->payload, rx_frame_payload_length, fcs)) {
-    transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_CHECKSUM_MISMATCH);
+    if (is_selective_reject_enabled(endpoint)) {
+      // Only the missing frame needs to be sent again
+      if (!endpoint->selective_reject_pending) {
+        transmit_selective_reject(endpoint);
+      }
+    } else {
+      transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_CHECKSUM_MISMATCH);
+    }
     TRACE_CORE_INVALID_PAYLOAD_CHECKSUM();
+    flight_recorder_event(FLIGHT_RECORDER_INVALID_PAYLOAD_CHECKSUM, endpoint->id, 0, 0);
     return;
   }
 
@@ -660,87 +1718,90 @@ static void core_process_rx_i_frame(frame_t *rx_frame)
 
   // data received, Push in Rx Queue and send Ack
   if (seq == endpoint->ack) {
+    bool held_frame_dropped = false;
 #if defined(ENABLE_ENCRYPTION)
-    if (should_decrypt_frame(endpoint, rx_frame_payload_length)) {
-      uint16_t tag_len = (uint16_t)security_encrypt_get_extra_buffer_size();
-      uint8_t *output;
-      sl_status_t status;
+    // Counter of the frame to deliver, given back if it can't be
+    uint32_t frame_counter = endpoint->frame_counter_rx;
+#endif
+
+    if (!core_decrypt_rx_i_frame(endpoint, rx_frame, &rx_frame_payload_length)) {
+      transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_SECURITY_ISSUE);
+      return;
+    }
+
+    if (!core_deliver_rx_i_frame(endpoint, rx_frame, rx_frame_payload_length)) {
+      // The reject makes the secondary re-transmit the held frames as well
+#if defined(ENABLE_ENCRYPTION)
+      security_xfer_rollback(endpoint, frame_counter);
+#endif
+      core_drop_out_of_order_frames(endpoint);
+      return;
+    }
 
-      /* the payload buffer must be longer than the security tag */
-      BUG_ON(rx_frame_payload_length < tag_len);
-      rx_frame_payload_length = (uint16_t)(rx_frame_payload_length - tag_len);
+    // Deliver the frames that were held until this one was received, decrypted now that they are in sequence
+    while (endpoint->out_of_order_frames[endpoint->ack] != NULL) {
+      frame_t *held_frame = endpoint->out_of_order_frames[endpoint->ack];
+      uint16_t held_payload_length = (uint16_t)(hdlc_get_length(held_frame->header) - SLI_CPC_HDLC_FCS_SIZE);
+      bool delivered;
 
-      output = zalloc(rx_frame_payload_length);
-      FATAL_ON(output == NULL);
+      endpoint->out_of_order_frames[endpoint->ack] = NULL;
 
-      status = security_decrypt(endpoint,
-                                rx_frame->header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
-                                rx_frame->payload, rx_frame_payload_length,
-                                output,
-                                &(rx_frame->payload[rx_frame_payload_length]), tag_len);
+#if defined(ENABLE_ENCRYPTION)
+      frame_counter = endpoint->frame_counter_rx;
+#endif
 
-      if (status != SL_STATUS_OK) {
-        WARN("Failed to decrypt frame, status=0x%x", status);
-        free(output);
-        transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_SECURITY_ISSUE);
-        return;
+      if (!core_decrypt_rx_i_frame(endpoint, held_frame, &held_payload_length)) {
+        // Not a reason to reject the stream: drop it and the ones after it, and ask for them again
+        mempool_free(&core.frame_pool, held_frame);
+        core_drop_out_of_order_frames(endpoint);
+        held_frame_dropped = true;
+        break;
       }
 
-      frame_was_decrypted = true;
-      memcpy(&rx_frame->payload[0], output, rx_frame_payload_length);
-      free(output);
-    }
-#endif
+      delivered = core_deliver_rx_i_frame(endpoint, held_frame, held_payload_length);
+      mempool_free(&core.frame_pool, held_frame);
 
-    // Check if the received message is a final reply for the system endpoint
-    if (hdlc_is_poll_final(control)) {
-      BUG_ON(endpoint->id != 0); // Only system endpoint can receive final messages
-      BUG_ON(endpoint->poll_final.on_final == NULL); // Received final, but no callback assigned
-      endpoint->poll_final.on_final(endpoint->id, (void *)SLI_CPC_HDLC_FRAME_TYPE_INFORMATION, rx_frame->payload, rx_frame_payload_length);
-    } else {
-      if (endpoint->id == SL_CPC_ENDPOINT_SYSTEM) {
-        // unsolicited i-frame
-        if (endpoint->on_iframe_data_reception != NULL) {
-          endpoint->on_iframe_data_reception(endpoint->id, rx_frame->payload, rx_frame_payload_length);
-        }
-      } else {
-        sl_status_t status = core_push_data_to_server(endpoint->id,
-                                                      rx_frame->payload,
-                                                      rx_frame_payload_length);
-        if (status == SL_STATUS_FAIL) {
-          // can't recover from that, close endpoint
-          core_close_endpoint(endpoint->id, true, false);
-          return;
-        } else if (status == SL_STATUS_WOULD_BLOCK) {
+      if (!delivered) {
+        // The remaining frames will be re-transmitted
 #if defined(ENABLE_ENCRYPTION)
-          if (frame_was_decrypted) {
-            security_xfer_rollback(endpoint);
-          }
+        security_xfer_rollback(endpoint, frame_counter);
 #endif
-          transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_OUT_OF_MEMORY);
-          return;
-        }
+        core_drop_out_of_order_frames(endpoint);
+        return;
       }
-    }
-
-    TRACE_ENDPOINT_RXD_DATA_FRAME_QUEUED(endpoint);
 
-#ifdef UNIT_TESTING
-    if (endpoint->id != SL_CPC_ENDPOINT_SYSTEM && endpoint->id != SL_CPC_ENDPOINT_SECURITY) {
-      cpc_unity_test_read_rx_callback(endpoint->id);
+      TRACE_ENDPOINT_RXD_OUT_OF_ORDER_RECOVERED(endpoint);
     }
-#endif
 
-    // Update endpoint acknowledge number
-    endpoint->ack++;
-    endpoint->ack %= 8;
+    endpoint->selective_reject_pending = false;
 
-    // Send ack
-    transmit_ack(endpoint);
-  } else if (is_seq_valid(seq, endpoint->ack)) {
+    if (core_has_out_of_order_frames(endpoint) || held_frame_dropped) {
+      // Another frame is missing, ask for it. This also acknowledges the frames delivered so far
+      transmit_selective_reject(endpoint);
+    } else {
+      // Send ack, possibly later to coalesce it
+      schedule_ack(endpoint);
+    }
+  } else if (is_seq_valid(seq, endpoint->ack, core_get_peer_tx_window_size())) {
     // The packet was already received. We must re-send a ACK because the other side missed it the first time
     TRACE_ENDPOINT_RXD_DUPLICATE_DATA_FRAME(endpoint);
     transmit_ack(endpoint);
+  } else if (is_selective_reject_enabled(endpoint)
+             && is_seq_ahead_in_window(seq, endpoint->ack, core_get_peer_tx_window_size())) {
+    // A frame is missing: hold this one until the missing one is re-transmitted
+    TRACE_ENDPOINT_RXD_OUT_OF_ORDER_DATA_FRAME(endpoint);
+
+    if (endpoint->out_of_order_frames[seq] == NULL) {
+      size_t frame_size = SLI_CPC_HDLC_HEADER_RAW_SIZE + hdlc_get_length(rx_frame->header);
+
+      // Held as received, its frame counter is only known once the frames before it are
+      endpoint->out_of_order_frames[seq] = mempool_alloc(&core.frame_pool, frame_size);
+      memcpy(endpoint->out_of_order_frames[seq], rx_frame, frame_size);
+    }
+
+    if (!endpoint->selective_reject_pending) {
+      transmit_selective_reject(endpoint);
+    }
   } else {
     transmit_reject(endpoint, address, endpoint->ack, HDLC_REJECT_SEQUENCE_MISMATCH);
     return;
@@ -775,15 +1836,23 @@ static void core_process_rx_s_frame(frame_t *rx_frame)
 
       switch (*((sl_cpc_reject_reason_t *)rx_frame->payload)) {
         case HDLC_REJECT_SEQUENCE_MISMATCH:
-          // This is not a fatal error when the tx window is > 1
-          fatal_error = true;
-          new_state = SL_CPC_STATE_ERROR_FAULT;
           TRACE_ENDPOINT_RXD_REJECT_SEQ_MISMATCH(endpoint);
-          WARN("Sequence mismatch on endpoint #%d", endpoint->id);
+          if (endpoint->configured_tx_window_size > 1) {
+            // This is not a fatal error when the tx window is > 1, the secondary
+            // missed a frame and discarded the ones that followed: go back N
+            if (!sl_queue_is_empty(&endpoint->re_transmit_queue)) {
+              re_transmit_frame(endpoint);
+            }
+            TRACE_CORE("Sequence mismatch on endpoint #%d, re-transmitting outstanding frames", endpoint->id);
+          } else {
+            fatal_error = true;
+            new_state = SL_CPC_STATE_ERROR_FAULT;
+            WARN("Sequence mismatch on endpoint #%d", endpoint->id);
+          }
           break;
 
         case HDLC_REJECT_CHECKSUM_MISMATCH:
-          if (endpoint->re_transmit_queue != NULL) {
+          if (!sl_queue_is_empty(&endpoint->re_transmit_queue)) {
             re_transmit_frame(endpoint);
           }
           TRACE_ENDPOINT_RXD_REJECT_CHECKSUM_MISMATCH(endpoint);
@@ -818,6 +1887,18 @@ static void core_process_rx_s_frame(frame_t *rx_frame)
       }
       break;
 
+    case SLI_CPC_HDLC_SELECTIVE_REJECT_SUPERVISORY_FUNCTION:
+    {
+      uint8_t seq = hdlc_get_ack(hdlc_get_control(rx_frame->header));
+
+      TRACE_ENDPOINT_RXD_SUPERVISORY_PROCESSED(endpoint);
+      TRACE_ENDPOINT_RXD_SELECTIVE_REJECT(endpoint, seq);
+
+      // The ack field was already processed as an acknowledgement of the frames before seq
+      re_transmit_selective_frame(endpoint, seq);
+      break;
+    }
+
     default:
       BUG("Illegal switch");
       break;
@@ -861,6 +1942,7 @@ static void core_process_rx_u_frame(frame_t *rx_frame)
 
       if (!sli_cpc_validate_crc_sw(rx_frame->payload, payload_length, fcs)) {
         TRACE_CORE_INVALID_PAYLOAD_CHECKSUM();
+        flight_recorder_event(FLIGHT_RECORDER_INVALID_PAYLOAD_CHECKSUM, endpoint->id, 0, 0);
         TRACE_ENDPOINT_RXD_UNNUMBERED_DROPPED(endpoint, "Bad payload checksum");
         return;
       }
@@ -914,14 +1996,200 @@ static void core_process_rx_u_frame(frame_t *rx_frame)
  * Write data from an endpoint
  ******************************************************************************/
 void core_write(uint8_t endpoint_number, const void* message, size_t message_len, uint8_t flags)
+{
+  const uint8_t *fragment = (const uint8_t *)message;
+  size_t fragment_size = core_get_write_buffer_size();
+
+  if (core_aggregate_write(endpoint_number, message, message_len, flags)) {
+    return;
+  }
+
+  /* A message larger than a frame is sent in as many I-frames as needed, they go
+   * through the tx window like any other, all of them but the last one with P/F set */
+  while (message_len > fragment_size) {
+    BUG_ON(!core.endpoints[endpoint_number].fragmentation);
+
+    core_write_frame(endpoint_number, NULL, fragment, fragment_size, flags | SL_CPC_FLAG_INFORMATION_MORE_FRAGMENTS);
+    fragment += fragment_size;
+    message_len -= fragment_size;
+  }
+
+  core_write_frame(endpoint_number, NULL, fragment, message_len, flags);
+}
+
+/***************************************************************************//**
+ * Allocate a buffer that can be passed to core_write_buffer(). The payload is
+ * stored as is in the frame that is sent, which saves a copy.
+ ******************************************************************************/
+void *core_alloc_write_buffer(void)
+{
+  frame_t *frame = (frame_t*) mempool_alloc(&core.frame_pool, core.frame_pool.block_size);
+
+  return frame->payload;
+}
+
+/***************************************************************************//**
+ * Largest payload that fits in a buffer from core_alloc_write_buffer()
+ ******************************************************************************/
+size_t core_get_write_buffer_size(void)
+{
+  size_t overhead = SLI_CPC_HDLC_HEADER_RAW_SIZE + SLI_CPC_HDLC_FCS_SIZE;
+
+#if defined(ENABLE_ENCRYPTION)
+  overhead += security_encrypt_get_extra_buffer_size();
+#endif
+
+  return core.frame_pool.block_size - overhead;
+}
+
+/***************************************************************************//**
+ * Same as core_write(), for a buffer from core_alloc_write_buffer(). The core
+ * takes ownership of the buffer.
+ ******************************************************************************/
+void core_write_buffer(uint8_t endpoint_number, void* buffer, size_t message_len, uint8_t flags)
+{
+  frame_t *frame = container_of(buffer, frame_t, payload);
+
+  FATAL_ON(message_len > core_get_write_buffer_size());
+
+  if (core_aggregate_write(endpoint_number, buffer, message_len, flags)) {
+    mempool_free(&core.frame_pool, frame);
+    return;
+  }
+
+  core_write_frame(endpoint_number, frame, buffer, message_len, flags);
+}
+
+/***************************************************************************//**
+ * Add a message to the aggregate of an endpoint, the small messages written
+ * within its deadline are sent in a single I-frame, each prefixed with its
+ * length. Returns false if the message is to be sent in a frame of its own,
+ * once the aggregate is flushed to keep the messages in order.
+ ******************************************************************************/
+static bool core_aggregate_write(uint8_t endpoint_number, const void *message, size_t message_len, uint8_t flags)
+{
+  sl_cpc_endpoint_t *endpoint = &core.endpoints[endpoint_number];
+  size_t capacity = core_get_write_buffer_size();
+  size_t record_size = SL_CPC_AGGREGATE_PREFIX_SIZE + message_len;
+  uint8_t *record;
+
+  if (endpoint->aggregation_deadline_us == 0) {
+    return false;
+  }
+
+  if (flags != 0 || record_size > capacity || endpoint->state != SL_CPC_STATE_OPEN) {
+    core_flush_aggregate(endpoint);
+    return false;
+  }
+
+  if (endpoint->tx_aggregate != NULL && endpoint->tx_aggregate_length + record_size > capacity) {
+    core_flush_aggregate(endpoint);
+  }
+
+  if (endpoint->tx_aggregate == NULL) {
+    endpoint->tx_aggregate = (frame_t *)mempool_alloc(&core.frame_pool, core.frame_pool.block_size);
+    endpoint->tx_aggregate_length = 0;
+    endpoint->tx_aggregate_count = 0;
+    epoll_timer_start(&endpoint->aggregation_timer, endpoint->aggregation_deadline_us);
+  }
+
+  record = &endpoint->tx_aggregate->payload[endpoint->tx_aggregate_length];
+  record[0] = (uint8_t)message_len;
+  record[1] = (uint8_t)(message_len >> 8);
+  if (message_len != 0) {
+    memcpy(&record[SL_CPC_AGGREGATE_PREFIX_SIZE], message, message_len);
+  }
+
+  endpoint->tx_aggregate_length = (uint16_t)(endpoint->tx_aggregate_length + record_size);
+  endpoint->tx_aggregate_count++;
+
+  // Not even an empty message would fit anymore
+  if (capacity - endpoint->tx_aggregate_length < SL_CPC_AGGREGATE_PREFIX_SIZE) {
+    core_flush_aggregate(endpoint);
+  }
+
+  return true;
+}
+
+/***************************************************************************//**
+ * Send the aggregate of an endpoint, if any. A lone message goes as it was
+ * written, the receiver only splits the frames flagged as aggregated.
+ ******************************************************************************/
+static void core_flush_aggregate(sl_cpc_endpoint_t *endpoint)
+{
+  frame_t *frame = endpoint->tx_aggregate;
+  size_t length = endpoint->tx_aggregate_length;
+
+  if (frame == NULL) {
+    return;
+  }
+
+  epoll_timer_stop(&endpoint->aggregation_timer);
+  endpoint->tx_aggregate = NULL;
+
+  if (endpoint->tx_aggregate_count == 1) {
+    length -= SL_CPC_AGGREGATE_PREFIX_SIZE;
+    memmove(frame->payload, &frame->payload[SL_CPC_AGGREGATE_PREFIX_SIZE], length);
+    core_write_frame(endpoint->id, frame, frame->payload, length, 0);
+  } else {
+    TRACE_CORE("Sending %u messages in one frame on ep #%d", endpoint->tx_aggregate_count, endpoint->id);
+    endpoint->stats->txd_aggregated_messages += endpoint->tx_aggregate_count;
+    core_write_frame(endpoint->id, frame, frame->payload, length, SL_CPC_FLAG_INFORMATION_AGGREGATED);
+  }
+}
+
+/***************************************************************************//**
+ * Compress the payload of an I-frame in place, when that makes it shorter. The
+ * frame is then flagged as compressed in its header, and encrypted as usual.
+ ******************************************************************************/
+static void core_compress_frame(sl_cpc_buffer_handle_t *buffer_handle)
+{
+  sl_cpc_endpoint_stats_t *stats = buffer_handle->endpoint->stats;
+  uint16_t length = buffer_handle->data_length;
+  size_t compressed_length = 0;
+
+  if (length >= SL_CPC_COMPRESSION_MIN_SIZE) {
+    if (core.compress_buffer == NULL) {
+      core.compress_buffer = (uint8_t *)malloc(core_get_write_buffer_size());
+      FATAL_ON(core.compress_buffer == NULL);
+    }
+
+    // Anything not shorter is given up on
+    compressed_length = lz4_block_compress(buffer_handle->frame->payload, length, core.compress_buffer, length - 1u);
+  }
+
+  stats->txd_compression_input_bytes += length;
+
+  if (compressed_length == 0) {
+    stats->txd_compression_output_bytes += length;
+    return;
+  }
+
+  memcpy(buffer_handle->frame->payload, core.compress_buffer, compressed_length);
+  buffer_handle->data_length = (uint16_t)compressed_length;
+  buffer_handle->compressed = true;
+
+  stats->txd_compression_output_bytes += compressed_length;
+}
+
+/***************************************************************************//**
+ * Drop the aggregate of an endpoint being closed, like its other queued frames
+ ******************************************************************************/
+static void core_drop_aggregate(sl_cpc_endpoint_t *endpoint)
+{
+  epoll_timer_stop(&endpoint->aggregation_timer);
+  mempool_free(&core.frame_pool, endpoint->tx_aggregate);
+  endpoint->tx_aggregate = NULL;
+}
+
+static void core_write_frame(uint8_t endpoint_number, frame_t *frame, const void* message, size_t message_len, uint8_t flags)
 {
   sl_cpc_endpoint_t* endpoint;
   sl_cpc_buffer_handle_t* buffer_handle;
   sl_cpc_transmit_queue_item_t * transmit_queue_item;
   bool iframe = true;
-  bool poll = (flags & SL_CPC_FLAG_INFORMATION_POLL) ? true : false;
+  bool poll = (flags & (SL_CPC_FLAG_INFORMATION_POLL | SL_CPC_FLAG_INFORMATION_MORE_FRAGMENTS)) ? true : false;
   uint8_t type = SLI_CPC_HDLC_CONTROL_UNNUMBERED_TYPE_UNKNOWN;
-  void* payload = NULL;
 
   FATAL_ON(message_len > UINT16_MAX);
 
@@ -932,6 +2200,7 @@ void core_write(uint8_t endpoint_number, const void* message, size_t message_len
     /* Make sure the endpoint it opened */
     if (endpoint->state != SL_CPC_STATE_OPEN) {
       WARN("Tried to write on closed endpoint #%d", endpoint_number);
+      mempool_free(&core.frame_pool, frame);
       return;
     }
 
@@ -957,17 +2226,27 @@ void core_write(uint8_t endpoint_number, const void* message, size_t message_len
 
   /* Fill the buffer handle */
   {
-    buffer_handle = (sl_cpc_buffer_handle_t*) zalloc(sizeof(sl_cpc_buffer_handle_t));
-    FATAL_SYSCALL_ON(buffer_handle == NULL);
+    if (frame != NULL) {
+      buffer_handle = core_attach_buffer_handle(frame, (uint16_t)message_len);
+    } else {
+      buffer_handle = core_alloc_buffer_handle((uint16_t)message_len);
 
-    payload = zalloc(message_len);
-    FATAL_SYSCALL_ON(payload == NULL);
-    memcpy(payload, message, message_len);
+      if (message_len != 0) {
+        memcpy(buffer_handle->frame->payload, message, message_len);
+      }
+    }
 
-    buffer_handle->data                = payload;
-    buffer_handle->data_length         = (uint16_t)message_len;
     buffer_handle->endpoint            = endpoint;
     buffer_handle->address             = endpoint_number;
+    buffer_handle->aggregated          = (flags & SL_CPC_FLAG_INFORMATION_AGGREGATED) != 0;
+
+    if (iframe && endpoint->compression) {
+      core_compress_frame(buffer_handle);
+    }
+
+    if (iframe && config.frame_latency_stats) {
+      buffer_handle->timestamps.written_ns = loop_stats_now_ns();
+    }
 
     if (iframe) {
       // Set the SEQ number and ACK number in the control byte
@@ -976,22 +2255,17 @@ void core_write(uint8_t endpoint_number, const void* message, size_t message_len
       endpoint->seq++;
       endpoint->seq %= 8;
       TRACE_CORE("Sequence # is now %d on ep %d", endpoint->seq, endpoint->id);
+
+      if (endpoint_number == SL_CPC_ENDPOINT_SYSTEM && poll) {
+        buffer_handle->system_command_seq = ((const sl_cpc_system_cmd_t *)message)->command_seq;
+      }
     } else {
       FATAL_ON(type == SLI_CPC_HDLC_CONTROL_UNNUMBERED_TYPE_UNKNOWN);
       buffer_handle->control = hdlc_create_control_unumbered(type);
     }
-
-    /* Compute the payload's checksum  */
-    {
-      uint16_t fcs = sli_cpc_get_crc_sw(message, (uint16_t)message_len);
-
-      buffer_handle->fcs[0] = (uint8_t)fcs;
-      buffer_handle->fcs[1] = (uint8_t)(fcs >> 8);
-    }
   }
 
-  transmit_queue_item = (sl_cpc_transmit_queue_item_t*) zalloc(sizeof(sl_cpc_transmit_queue_item_t));
-  FATAL_SYSCALL_ON(transmit_queue_item == NULL);
+  transmit_queue_item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
 
   transmit_queue_item->handle = buffer_handle;
 
@@ -999,18 +2273,18 @@ void core_write(uint8_t endpoint_number, const void* message, size_t message_len
   {
     // If U-Frame, skip the window and send immediately
     if (iframe == false) {
-      sl_slist_push_back(&transmit_queue, &transmit_queue_item->node);
+      core_endpoint_tx_queue_push(endpoint, transmit_queue_item, false);
       core_process_transmit_queue();
     } else {
       if (endpoint->current_tx_window_space > 0) {
         endpoint->current_tx_window_space--;
 
         //Put frame in Tx Q so that it can be transmitted by CPC Core later
-        sl_slist_push_back(&transmit_queue, &transmit_queue_item->node);
+        core_endpoint_tx_queue_push(endpoint, transmit_queue_item, false);
         core_process_transmit_queue();
       } else {
         //Put frame in endpoint holding list to wait for more space in the transmit window
-        sl_slist_push_back(&endpoint->holding_list, &transmit_queue_item->node);
+        sl_queue_push_back(&endpoint->holding_list, &transmit_queue_item->node);
       }
     }
   }
@@ -1019,12 +2293,14 @@ void core_write(uint8_t endpoint_number, const void* message, size_t message_len
 void core_open_endpoint(uint8_t endpoint_number, uint8_t flags, uint8_t tx_window_size, bool encryption)
 {
   sl_cpc_endpoint_t *ep;
+  sl_cpc_endpoint_stats_t *stats;
+  uint8_t *rx_fragments;
   cpc_endpoint_state_t previous_state;
 
   FATAL_ON(tx_window_size < TRANSMIT_WINDOW_MIN_SIZE);
   FATAL_ON(tx_window_size > TRANSMIT_WINDOW_MAX_SIZE);
 
-  ep = &core_endpoints[endpoint_number];
+  ep = &core.endpoints[endpoint_number];
 
   /* Check if endpoint was already opened */
   if (ep->state != SL_CPC_STATE_CLOSED) {
@@ -1032,48 +2308,99 @@ void core_open_endpoint(uint8_t endpoint_number, uint8_t flags, uint8_t tx_windo
     return;
   }
 
+  /* The statistics are allocated once, the endpoints never opened don't have any */
+  stats = ep->stats;
+  if (stats == NULL) {
+    stats = zalloc(sizeof(sl_cpc_endpoint_stats_t));
+    FATAL_ON(stats == NULL);
+    core.opened_endpoints[core.opened_endpoint_count++] = endpoint_number;
+  } else {
+    memset(stats, 0x00, sizeof(sl_cpc_endpoint_stats_t));
+  }
+
   /* Keep the previous state to log the transition */
   previous_state = ep->state;
+  rx_fragments = ep->rx_fragments;
   memset(ep, 0x00, sizeof(sl_cpc_endpoint_t));
   ep->state = previous_state;
+  ep->stats = stats;
+  ep->rx_fragments = rx_fragments;
   core_set_endpoint_state(endpoint_number, SL_CPC_STATE_OPEN);
 
   ep->id = endpoint_number;
   ep->flags = flags;
   ep->configured_tx_window_size = tx_window_size;
   ep->current_tx_window_space = ep->configured_tx_window_size;
-  ep->re_transmit_timeout_ms = SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MS;
+  ep->min_re_transmit_timeout_ms = core.parameters.min_re_transmit_timeout_ms;
+  ep->max_re_transmit_timeout_ms = core.parameters.max_re_transmit_timeout_ms;
+  ep->max_re_transmit = core.parameters.max_re_transmit;
+  ep->re_transmit_timeout_ms = ep->min_re_transmit_timeout_ms;
+  // Control traffic of the daemon itself is never held back by user endpoints
+  if (endpoint_number == SL_CPC_ENDPOINT_SYSTEM || endpoint_number == SL_CPC_ENDPOINT_SECURITY) {
+    ep->tx_priority = 0;
+  } else {
+    ep->tx_priority = CPC_TX_PRIORITY_LEVEL_DEFAULT;
+  }
+  ep->tx_weight = CPC_TX_PRIORITY_WEIGHT_DEFAULT;
 #if defined(ENABLE_ENCRYPTION)
   ep->encrypted = encryption;
+  server_on_endpoint_encryption_change(endpoint_number, encryption);
   ep->frame_counter_tx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
   ep->frame_counter_rx = SLI_CPC_SECURITY_NONCE_FRAME_COUNTER_RESET_VALUE;
 #else
   (void)encryption;
 #endif
 
-  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-  FATAL_SYSCALL_ON(timer_fd < 0);
+  epoll_timer_init(&ep->re_transmit_timer, core_process_ep_timeout);
+  epoll_timer_init(&ep->ack_timer, core_process_ack_timeout);
+  epoll_timer_init(&ep->aggregation_timer, core_process_aggregation_timeout);
 
-  /* Setup epoll */
-  {
-    epoll_private_data_t* private_data = (epoll_private_data_t*) zalloc(sizeof(epoll_private_data_t));
-    FATAL_SYSCALL_ON(private_data == NULL);
+  sl_queue_init(&ep->re_transmit_queue);
+  sl_queue_init(&ep->holding_list);
+  sl_queue_init(&ep->transmit_queue);
 
-    ep->re_transmit_timer_private_data = private_data;
+  TRACE_CORE_OPEN_ENDPOINT(ep->id);
 
-    private_data->callback = core_process_ep_timeout;
-    private_data->file_descriptor = timer_fd;
-    private_data->endpoint_number = endpoint_number;
+  return;
+}
 
-    epoll_register(private_data);
-  }
+/***************************************************************************//**
+ * Resume an endpoint where the previous daemon left it. The system endpoint was
+ * opened by sl_cpc_system_init(), it only takes its sequence numbers back.
+ ******************************************************************************/
+void core_import_endpoint(const handoff_endpoint_t *imported)
+{
+  sl_cpc_endpoint_t *ep = &core.endpoints[imported->id];
+  cpc_endpoint_state_t state = (cpc_endpoint_state_t)imported->state;
 
-  sl_slist_init(&ep->re_transmit_queue);
-  sl_slist_init(&ep->holding_list);
+  if (imported->id != SL_CPC_ENDPOINT_SYSTEM) {
+    if (state != SL_CPC_STATE_OPEN) {
+      // An endpoint in error, until the clients close it
+      core_set_endpoint_state(imported->id, state);
+      return;
+    }
 
-  TRACE_CORE_OPEN_ENDPOINT(ep->id);
+    uint8_t tx_priority = imported->tx_priority;
+    uint8_t tx_weight = imported->tx_weight;
 
-  return;
+    core_open_endpoint(imported->id, imported->flags, imported->tx_window_size, false);
+
+    core_set_endpoint_tx_priority(imported->id, &tx_priority, &tx_weight);
+    ep->fragmentation = imported->fragmentation;
+    ep->aggregation_deadline_us = imported->aggregation_deadline_us;
+    ep->compression = imported->compression;
+    core_apply_re_transmit_parameters(ep,
+                                      imported->min_re_transmit_timeout_ms,
+                                      imported->max_re_transmit_timeout_ms,
+                                      imported->max_re_transmit);
+    ep->re_transmit_timeout_ms = (long)imported->re_transmit_timeout_ms;
+  }
+
+  ep->seq = imported->seq;
+  ep->ack = imported->ack;
+
+  TRACE_CORE("Endpoint #%d resumed in state %s, seq %u ack %u",
+             imported->id, core_stringify_state(state), ep->seq, ep->ack);
 }
 
 /***************************************************************************//**
@@ -1098,21 +2425,138 @@ void core_set_endpoint_in_error(uint8_t endpoint_number, cpc_endpoint_state_t ne
  ******************************************************************************/
 void core_reset_endpoint_sequence(uint8_t endpoint_number)
 {
-  core_endpoints[endpoint_number].seq = 0;
-  core_endpoints[endpoint_number].ack = 0;
+  core.endpoints[endpoint_number].seq = 0;
+  core.endpoints[endpoint_number].ack = 0;
+  core_drop_out_of_order_frames(&core.endpoints[endpoint_number]);
+  epoll_timer_stop(&core.endpoints[endpoint_number].ack_timer);
+  core.endpoints[endpoint_number].ack_pending_count = 0;
+  core.endpoints[endpoint_number].rx_fragments_length = 0;
+  core.endpoints[endpoint_number].rx_aggregate_delivered = 0;
 }
 
-static void core_clear_transmit_queue(sl_slist_node_t **head, int endpoint_id)
+/***************************************************************************//**
+ * Accept writes larger than a frame on an endpoint, up to
+ * SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE bytes. Returns whether it is enabled,
+ * which it can't be if the secondary doesn't support fragmentation.
+ ******************************************************************************/
+bool core_set_endpoint_fragmentation(uint8_t endpoint_number, bool enable)
 {
-  sl_slist_node_t *current_node;
-  sl_slist_node_t *next_node;
-  bool filter_with_endpoint_id;
-  uint8_t ep_id;
+  sl_cpc_endpoint_t *ep = find_endpoint(endpoint_number);
 
-  if (!*head) {
-    return;
+  ep->fragmentation = enable && server_core_secondary_supports_fragmentation();
+
+  TRACE_CORE("Endpoint #%d fragmentation %s", endpoint_number, ep->fragmentation ? "enabled" : "disabled");
+
+  return ep->fragmentation;
+}
+
+bool core_get_endpoint_fragmentation(uint8_t endpoint_number)
+{
+  return core.endpoints[endpoint_number].fragmentation;
+}
+
+/***************************************************************************//**
+ * Hold the small writes on an endpoint for up to deadline_us, to send those
+ * written in the meantime in a single I-frame. 0 disables it, and sends what
+ * is held right away. Returns the deadline applied, 0 if the secondary doesn't
+ * support aggregation.
+ ******************************************************************************/
+uint32_t core_set_endpoint_aggregation(uint8_t endpoint_number, uint32_t deadline_us)
+{
+  sl_cpc_endpoint_t *ep = find_endpoint(endpoint_number);
+
+  if (!server_core_secondary_supports_aggregation()) {
+    deadline_us = 0;
+  } else if (deadline_us > SL_CPC_AGGREGATION_DEADLINE_MAX_US) {
+    deadline_us = SL_CPC_AGGREGATION_DEADLINE_MAX_US;
+  }
+
+  if (deadline_us == 0) {
+    core_flush_aggregate(ep);
+  }
+
+  ep->aggregation_deadline_us = deadline_us;
+
+  TRACE_CORE("Endpoint #%d aggregation deadline set to %uus", endpoint_number, deadline_us);
+
+  return deadline_us;
+}
+
+uint32_t core_get_endpoint_aggregation(uint8_t endpoint_number)
+{
+  return core.endpoints[endpoint_number].aggregation_deadline_us;
+}
+
+/***************************************************************************//**
+ * Compress the payloads sent on an endpoint, those that LZ4 shrinks. Returns
+ * whether it is enabled, which it can't be if the secondary doesn't support
+ * compression.
+ ******************************************************************************/
+bool core_set_endpoint_compression(uint8_t endpoint_number, bool enable)
+{
+  sl_cpc_endpoint_t *ep = find_endpoint(endpoint_number);
+
+  ep->compression = enable && server_core_secondary_supports_compression();
+
+  TRACE_CORE("Endpoint #%d compression %s", endpoint_number, ep->compression ? "enabled" : "disabled");
+
+  return ep->compression;
+}
+
+bool core_get_endpoint_compression(uint8_t endpoint_number)
+{
+  return core.endpoints[endpoint_number].compression;
+}
+
+/***************************************************************************//**
+ * Largest message a client can write to an endpoint
+ ******************************************************************************/
+size_t core_get_endpoint_max_write_size(uint8_t endpoint_number)
+{
+  if (core.endpoints[endpoint_number].fragmentation) {
+    return SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE;
+  }
+
+  return core_get_write_buffer_size();
+}
+
+/***************************************************************************//**
+ * Set the transmit priority level and weight of an endpoint
+ *
+ * Invalid values are clamped, the values actually applied are returned in place.
+ ******************************************************************************/
+void core_set_endpoint_tx_priority(uint8_t endpoint_number, uint8_t *priority, uint8_t *weight)
+{
+  sl_cpc_endpoint_t *ep = find_endpoint(endpoint_number);
+
+  if (*priority >= CPC_TX_PRIORITY_LEVEL_COUNT) {
+    WARN("Invalid tx priority %u on ep#%d, using %u", *priority, endpoint_number, CPC_TX_PRIORITY_LEVEL_COUNT - 1);
+    *priority = CPC_TX_PRIORITY_LEVEL_COUNT - 1;
+  }
+
+  if (*weight == 0) {
+    WARN("Invalid tx weight 0 on ep#%d, using 1", endpoint_number);
+    *weight = 1;
   }
 
+  // Frames already queued follow their endpoint to its new level
+  core.tx_scheduler[ep->tx_priority].backlog -= sl_queue_len(&ep->transmit_queue);
+  core.tx_scheduler[*priority].backlog += sl_queue_len(&ep->transmit_queue);
+
+  ep->tx_priority = *priority;
+  ep->tx_weight = *weight;
+
+  TRACE_CORE("Endpoint #%d tx priority set to %u, weight %u", endpoint_number, ep->tx_priority, ep->tx_weight);
+}
+
+static size_t core_clear_transmit_queue(sl_queue_t *queue, int endpoint_id)
+{
+  sl_slist_node_t *node;
+  sl_queue_t kept;
+  bool filter_with_endpoint_id;
+  uint8_t ep_id;
+  size_t cleared = 0;
+
   if (endpoint_id < 0) {
     filter_with_endpoint_id = false;
   } else {
@@ -1120,42 +2564,35 @@ static void core_clear_transmit_queue(sl_slist_node_t **head, int endpoint_id)
     ep_id = (uint8_t)endpoint_id;
   }
 
-  // init current_node to the first element in the list
-  current_node = *head;
+  // Rebuild the queue with the items that must stay, in their original order
+  sl_queue_init(&kept);
 
-  while (current_node) {
-    // store next_node right away as the element containing
-    // current_node might get free'd below
-    next_node = current_node->node;
+  while ((node = sl_queue_pop(queue)) != NULL) {
+    sl_cpc_transmit_queue_item_t *item = SL_SLIST_ENTRY(node, sl_cpc_transmit_queue_item_t, node);
 
-    sl_cpc_transmit_queue_item_t *item = SL_SLIST_ENTRY(current_node, sl_cpc_transmit_queue_item_t, node);
     if (!filter_with_endpoint_id
         || (filter_with_endpoint_id && item->handle->address == ep_id)) {
-      if (item->handle->pending_tx_complete == false) {
-        free(item->handle->hdlc_header);
-
-        // free payload if any
-        if (item->handle->data_length != 0) {
-          // free payload
-          free((void*)item->handle->data);
-        }
-#if defined(ENABLE_ENCRYPTION)
-        if (item->handle->security_info) {
-          free((void *)item->handle->security_info);
-        }
-#endif
-        free(item->handle);
-
-        // remove element from list and free it
-        sl_slist_remove(head, &item->node);
-        free(item);
+      if (item->handle->selective_re_transmit_queued) {
+        // Only found in a Tx Q, which is cleared before the re-transmit queue:
+        // the frame itself is owned by the re-transmit queue of its endpoint
+        item->handle->selective_re_transmit_queued = false;
+        mempool_free(&core.queue_item_pool, item);
+        cleared++;
+        continue;
+      } else if (item->handle->pending_tx_complete == false) {
+        core_free_buffer_handle(item->handle);
+        mempool_free(&core.queue_item_pool, item);
+        cleared++;
+        continue;
       }
     }
 
-    // prepare next while iteration by moving current_node
-    // to the next element in the list
-    current_node = next_node;
+    sl_queue_push_back(&kept, node);
   }
+
+  *queue = kept;
+
+  return cleared;
 }
 
 /***************************************************************************//**
@@ -1171,12 +2608,26 @@ sl_status_t core_close_endpoint(uint8_t endpoint_number, bool notify_secondary,
 
   TRACE_CORE("Closing endpoint #%d", endpoint_number);
 
+#if defined(ENABLE_ENCRYPTION)
+  // Take the frames back from the crypto worker, none of them is sent anymore
+  if (ep->crypto_pending_count != 0) {
+    crypto_worker_wait_idle();
+    core_complete_sealed_frames(ep->id);
+  }
+#endif
+
   stop_re_transmit_timer(ep);
+  epoll_timer_stop(&ep->ack_timer);
+  ep->ack_pending_count = 0;
+  core_drop_aggregate(ep);
 
+  // Clear the Tx Q first, it may reference frames owned by the re-transmit queue
+  core.tx_scheduler[ep->tx_priority].backlog -= core_clear_transmit_queue(&ep->transmit_queue, -1);
+  core_clear_transmit_queue(&core.supervisory_transmit_queue, endpoint_number);
   core_clear_transmit_queue(&ep->re_transmit_queue, -1);
   core_clear_transmit_queue(&ep->holding_list, -1);
-  core_clear_transmit_queue(&transmit_queue, endpoint_number);
-  core_clear_transmit_queue(&pending_on_security_ready_queue, endpoint_number);
+  core_clear_transmit_queue(&core.pending_on_security_ready_queue, endpoint_number);
+  core_drop_out_of_order_frames(ep);
 
   if (notify_secondary && endpoint_number != SL_CPC_ENDPOINT_SECURITY) {
     // State will be set to closed when secondary closes its endpoint
@@ -1192,15 +2643,6 @@ sl_status_t core_close_endpoint(uint8_t endpoint_number, bool notify_secondary,
                                    false);
   }
 
-  if (ep->re_transmit_timer_private_data != NULL) {
-    epoll_unregister(ep->re_transmit_timer_private_data);
-
-    close(((epoll_private_data_t *)ep->re_transmit_timer_private_data)->file_descriptor);
-    free(ep->re_transmit_timer_private_data);
-
-    ep->re_transmit_timer_private_data = NULL;
-  }
-
   if (force_close) {
     core_set_endpoint_state(ep->id, SL_CPC_STATE_CLOSED);
     TRACE_CORE_CLOSE_ENDPOINT(ep->id);
@@ -1213,7 +2655,7 @@ void core_set_endpoint_option(uint8_t endpoint_number,
                               sl_cpc_endpoint_option_t option,
                               void *value)
 {
-  sl_cpc_endpoint_t *ep = &core_endpoints[endpoint_number];
+  sl_cpc_endpoint_t *ep = &core.endpoints[endpoint_number];
 
   FATAL_ON(ep->state != SL_CPC_STATE_OPEN);
 
@@ -1262,6 +2704,35 @@ void core_set_endpoint_option(uint8_t endpoint_number,
 /***************************************************************************//**
  * Process receive ACK frame
  ******************************************************************************/
+/***************************************************************************//**
+ * Add the stages of an acknowledged frame to the histograms of its endpoint.
+ * A stage the frame skipped, or whose end came from another clock, counts as 0.
+ ******************************************************************************/
+static void core_record_frame_latency(sl_cpc_endpoint_t *endpoint, const sl_cpc_frame_timestamps_t *timestamps)
+{
+  uint64_t ends[CORE_LATENCY_STAGE_TOTAL];
+  uint64_t start = timestamps->written_ns;
+  uint64_t acked_ns = loop_stats_now_ns();
+
+  ends[CORE_LATENCY_STAGE_QUEUE] = timestamps->dequeued_ns;
+  ends[CORE_LATENCY_STAGE_BUILD] = timestamps->pushed_ns;
+  ends[CORE_LATENCY_STAGE_BUS] = timestamps->tx_complete_ns;
+  ends[CORE_LATENCY_STAGE_ACK] = acked_ns;
+
+  for (size_t i = 0; i < ARRAY_SIZE(ends); i++) {
+    uint64_t end = ends[i];
+
+    if (end < start) {
+      end = start;
+    }
+
+    loop_stats_histogram_add(&endpoint->stats->latency[i], end - start);
+    start = end;
+  }
+
+  loop_stats_histogram_add(&endpoint->stats->latency[CORE_LATENCY_STAGE_TOTAL], acked_ns - timestamps->written_ns);
+}
+
 static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
 {
   sl_cpc_transmit_queue_item_t *item;
@@ -1272,14 +2743,15 @@ static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
   uint8_t ack_range_min;
   uint8_t ack_range_max;
   uint8_t frames_count_ack = 0;
+  bool had_tx_credit = core_get_endpoint_tx_credit(endpoint->id) > 0;
 
   // Return if no frame to acknowledge
-  if (endpoint->re_transmit_queue == NULL) {
+  if (sl_queue_is_empty(&endpoint->re_transmit_queue)) {
     return;
   }
 
   // Get the sequence number of the first frame in the re-transmission queue
-  item = SL_SLIST_ENTRY(endpoint->re_transmit_queue, sl_cpc_transmit_queue_item_t, node);
+  item = SL_SLIST_ENTRY(sl_queue_peek(&endpoint->re_transmit_queue), sl_cpc_transmit_queue_item_t, node);
   frame = item->handle;
 
   control_byte = hdlc_get_control(frame->hdlc_header);
@@ -1318,7 +2790,7 @@ static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
   stop_re_transmit_timer(endpoint);
 
   // This can happen during a re_transmit, process the ack once the frame is sent
-  if (frame->pending_tx_complete == true) {
+  if (frame->pending_tx_complete == true || frame->selective_re_transmit_queued == true) {
     frame->acked = true;
     frame->pending_ack = ack;
     return;
@@ -1328,15 +2800,24 @@ static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
   endpoint->packet_re_transmit_count = 0u;
 
   TRACE_CORE("%d Received ack %d seq number %d", endpoint->id, ack, seq_number);
-  core_compute_re_transmit_timeout(endpoint);
+  CPCD_TRACEPOINT(ack, endpoint->id, ack, seq_number, frames_count_ack);
 
-  // Remove all acknowledged frames in re-transmit queue
+  // Remove all acknowledged frames in re-transmit queue. With a window > 1, a
+  // single ack can cumulatively acknowledge several frames
   for (uint8_t i = 0; i < frames_count_ack; i++) {
-    item_node = sl_slist_pop(&endpoint->re_transmit_queue);
+    item = SL_SLIST_ENTRY(sl_queue_peek(&endpoint->re_transmit_queue), sl_cpc_transmit_queue_item_t, node);
+    frame = item->handle;
+
+    // The driver still holds this frame, or is about to, finish processing the ack once it is sent
+    if (frame->pending_tx_complete == true || frame->selective_re_transmit_queued == true) {
+      frame->acked = true;
+      frame->pending_ack = ack;
+      break;
+    }
+
+    item_node = sl_queue_pop(&endpoint->re_transmit_queue);
     BUG_ON(item_node == NULL);
 
-    item = SL_SLIST_ENTRY(item_node, sl_cpc_transmit_queue_item_t, node);
-    frame = item->handle;
     control_byte = hdlc_get_control(frame->hdlc_header);
 
     BUG_ON(hdlc_get_frame_type(frame->control) != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION);
@@ -1346,23 +2827,31 @@ static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
 #endif
 
     if (endpoint->id == SL_CPC_ENDPOINT_SYSTEM && hdlc_is_poll_final(control_byte)) {
-      sl_cpc_system_cmd_poll_acknowledged(frame->data);
+      sl_cpc_system_cmd_poll_acknowledged(frame->system_command_seq);
     }
 
 #if defined(ENABLE_ENCRYPTION)
     if (frame->security_session_last_packet) {
-      security_session_last_packet_acked = true;
+      core.security_session_last_packet_acked = true;
     }
+#endif
+
+    endpoint->stats->txd_data_frames++;
+    endpoint->stats->txd_data_bytes += frame->data_length;
 
-    if (frame->security_info) {
-      free((void *)frame->security_info);
+    // The ack was sent on receiving the newest of the frames it acknowledges,
+    // the round trip time of the others includes the wait for the next ones.
+    // An ack received before the tx complete of its frame tells nothing either.
+    if (hdlc_get_seq(frame->control) == (uint8_t)((ack + 7u) % 8u) && !frame->acked) {
+      core_update_rtt_model(endpoint, frame);
+    }
+
+    if (frame->timestamps.written_ns != 0) {
+      core_record_frame_latency(endpoint, &frame->timestamps);
     }
-#endif
 
-    free((void *)frame->data);
-    free(frame->hdlc_header);
-    free(frame);
-    free(item);
+    core_free_buffer_handle(frame);
+    mempool_free(&core.queue_item_pool, item);
 
     // Update number of frames in re-transmit queue
     endpoint->frames_count_re_transmit_queue--;
@@ -1370,19 +2859,36 @@ static void process_ack(sl_cpc_endpoint_t *endpoint, uint8_t ack)
     // Update transmit window
     endpoint->current_tx_window_space++;
 
-    if (endpoint->re_transmit_queue == NULL) {
+    if (sl_queue_is_empty(&endpoint->re_transmit_queue)) {
       break;
     }
   }
 
+  // Frames still in flight must be covered by a new re-transmit timeout
+  if (!sl_queue_is_empty(&endpoint->re_transmit_queue)) {
+    item = SL_SLIST_ENTRY(sl_queue_peek(&endpoint->re_transmit_queue), sl_cpc_transmit_queue_item_t, node);
+
+    if (item->handle->pending_tx_complete == false && item->handle->selective_re_transmit_queued == false) {
+      struct timespec now;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      start_re_transmit_timer(endpoint, now);
+    }
+  }
+
   // Put data frames hold in the endpoint in the tx queue if space in transmit window
-  while (endpoint->holding_list != NULL && endpoint->current_tx_window_space > 0) {
-    sl_slist_node_t *item = sl_slist_pop(&endpoint->holding_list);
-    sl_slist_push_back(&transmit_queue, item);
+  while (!sl_queue_is_empty(&endpoint->holding_list) && endpoint->current_tx_window_space > 0) {
+    sl_slist_node_t *item_node = sl_queue_pop(&endpoint->holding_list);
+    core_endpoint_tx_queue_push(endpoint, SL_SLIST_ENTRY(item_node, sl_cpc_transmit_queue_item_t, node), false);
     endpoint->current_tx_window_space--;
     epoll_watch_back(endpoint->id);
   }
 
+  // Let the writers know that they can go on
+  if (!had_tx_credit && core_get_endpoint_tx_credit(endpoint->id) > 0) {
+    server_on_endpoint_tx_credit(endpoint->id, core_get_endpoint_tx_credit(endpoint->id));
+  }
+
   TRACE_ENDPOINT_RXD_ACK(endpoint, ack);
 }
 
@@ -1394,65 +2900,192 @@ static void transmit_ack(sl_cpc_endpoint_t *endpoint)
   sl_cpc_buffer_handle_t *handle;
   sl_cpc_transmit_queue_item_t *item;
 
-  // Get new frame handler
-  handle = (sl_cpc_buffer_handle_t*) zalloc(sizeof(sl_cpc_buffer_handle_t));
-  FATAL_SYSCALL_ON(handle == NULL);
+  // Get new frame handler, with the ACK number in the supervisory control byte
+  handle = core_alloc_supervisory_handle(endpoint->id,
+                                         hdlc_create_control_supervisory(endpoint->ack, SLI_CPC_HDLC_ACK_SUPERVISORY_FUNCTION),
+                                         HDLC_REJECT_NO_ERROR);
 
   handle->endpoint = endpoint;
-  handle->address = endpoint->id;
-
-  // Set ACK number in the supervisory control byte
-  handle->control = hdlc_create_control_supervisory(endpoint->ack, 0);
 
   // Put frame in Tx Q so that it can be transmitted by CPC Core later
-  item = (sl_cpc_transmit_queue_item_t*) zalloc(sizeof(sl_cpc_transmit_queue_item_t));
-  FATAL_SYSCALL_ON(item == NULL);
+  item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
 
   item->handle = handle;
 
-  sl_slist_push_back(&transmit_queue, &item->node);
+  sl_queue_push_back(&core.supervisory_transmit_queue, &item->node);
   TRACE_CORE("Endpoint #%d sent ACK: %d", endpoint->id, endpoint->ack);
 
+  if (endpoint->ack_pending_count > 1) {
+    TRACE_ENDPOINT_ACK_COALESCED(endpoint, endpoint->ack_pending_count - 1u);
+  }
+  core_ack_sent(endpoint);
+
   core_process_transmit_queue();
 
   TRACE_ENDPOINT_TXD_ACK(endpoint);
 }
 
 /***************************************************************************//**
- * Re-transmit frame
+ * Acknowledge a received I-frame
+ *
+ * In delayed ack mode, the ack is held until the deadline expires or enough
+ * frames were received, unless an I-frame of the endpoint carries it first.
+ ******************************************************************************/
+static void schedule_ack(sl_cpc_endpoint_t *endpoint)
+{
+  if (config.delayed_ack_timeout_us == 0) {
+    transmit_ack(endpoint);
+    return;
+  }
+
+  endpoint->ack_pending_count++;
+
+  if (endpoint->ack_pending_count >= config.delayed_ack_frame_count) {
+    transmit_ack(endpoint);
+    return;
+  }
+
+  if (!epoll_timer_is_running(&endpoint->ack_timer)) {
+    epoll_timer_start(&endpoint->ack_timer, config.delayed_ack_timeout_us);
+  }
+}
+
+/***************************************************************************//**
+ * The current ack of the endpoint was sent, nothing is left to acknowledge
+ ******************************************************************************/
+static void core_ack_sent(sl_cpc_endpoint_t *endpoint)
+{
+  endpoint->ack_pending_count = 0;
+  epoll_timer_stop(&endpoint->ack_timer);
+}
+
+/***************************************************************************//**
+ * Re-transmit frames
+ *
+ * Go-back-N: every frame still in the re-transmit queue is sent again, in
+ * sequence order, ahead of any new frame waiting in the transmit queue.
  ******************************************************************************/
 static void re_transmit_frame(sl_cpc_endpoint_t *endpoint)
 {
   sl_cpc_transmit_queue_item_t *item;
   sl_slist_node_t *item_node;
+  sl_slist_node_t *re_transmit_list;
 
-  item_node = sl_slist_pop(&endpoint->re_transmit_queue);
+  BUG_ON(sl_queue_is_empty(&endpoint->re_transmit_queue));
 
-  BUG_ON(item_node == NULL);
+  // Don't re_transmit while one of the frames is still being transmitted, the
+  // re-transmit queue must stay ordered by sequence number. The re-transmit
+  // timer is restarted once its transmission completes.
+  SL_QUEUE_FOR_EACH_ENTRY(&endpoint->re_transmit_queue, item, sl_cpc_transmit_queue_item_t, node) {
+    if (item->handle->pending_tx_complete == true || item->handle->selective_re_transmit_queued == true) {
+      return;
+    }
+  }
 
-  item = SL_SLIST_ENTRY(item_node, sl_cpc_transmit_queue_item_t, node);
+  endpoint->packet_re_transmit_count++;
+
+  // Reverse the re-transmit queue into a local list...
+  sl_slist_init(&re_transmit_list);
+  while ((item_node = sl_queue_pop(&endpoint->re_transmit_queue)) != NULL) {
+    item = SL_SLIST_ENTRY(item_node, sl_cpc_transmit_queue_item_t, node);
+
+    // Only i-frames support retransmission
+    BUG_ON(hdlc_get_frame_type(item->handle->control) != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION);
+
+    endpoint->frames_count_re_transmit_queue--;
+
+    sl_slist_push(&re_transmit_list, item_node);
+
+    endpoint->stats->retxd_data_frames++;
+    item->handle->re_transmitted = true;
+    item->handle->timestamps.written_ns = 0;
+    TRACE_ENDPOINT_RETXD_DATA_FRAME(endpoint);
+    CPCD_TRACEPOINT(retransmit, endpoint->id, hdlc_get_seq(item->handle->control),
+                    (uint8_t)endpoint->packet_re_transmit_count, false);
+    flight_recorder_event(FLIGHT_RECORDER_RE_TRANSMIT, endpoint->id, hdlc_get_seq(item->handle->control),
+                          (uint8_t)endpoint->packet_re_transmit_count);
+  }
+
+  // ...so that pushing each frame at the front of the Tx Q restores the sequence order
+  while ((item_node = sl_slist_pop(&re_transmit_list)) != NULL) {
+    core_endpoint_tx_queue_push(endpoint, SL_SLIST_ENTRY(item_node, sl_cpc_transmit_queue_item_t, node), true);
+  }
+
+  return;
+}
+
+/***************************************************************************//**
+ * Re-transmit the single frame the remote selectively rejected
+ *
+ * The frame stays in the re-transmit queue, which must remain ordered by
+ * sequence number, and is also referenced from the front of the Tx Q.
+ ******************************************************************************/
+static void re_transmit_selective_frame(sl_cpc_endpoint_t *endpoint, uint8_t seq)
+{
+  sl_cpc_transmit_queue_item_t *item;
+  sl_cpc_transmit_queue_item_t *re_transmit_item;
+
+  SL_QUEUE_FOR_EACH_ENTRY(&endpoint->re_transmit_queue, item, sl_cpc_transmit_queue_item_t, node) {
+    sl_cpc_buffer_handle_t *frame = item->handle;
+
+    if (hdlc_get_seq(frame->control) != seq) {
+      continue;
+    }
 
-  // Don't re_transmit the frame if it is already being transmitted
-  if (item->handle->pending_tx_complete == true) {
-    sl_slist_push(&endpoint->re_transmit_queue, &item->node);
+    // The frame is already on its way to the remote
+    if (frame->pending_tx_complete || frame->selective_re_transmit_queued) {
+      return;
+    }
+
+    endpoint->packet_re_transmit_count++;
+
+    re_transmit_item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
+    re_transmit_item->handle = frame;
+    frame->selective_re_transmit_queued = true;
+
+    core_endpoint_tx_queue_push(endpoint, re_transmit_item, true);
+
+    endpoint->stats->retxd_data_frames++;
+    frame->re_transmitted = true;
+    frame->timestamps.written_ns = 0;
+    TRACE_ENDPOINT_RETXD_SELECTIVE_DATA_FRAME(endpoint);
+    CPCD_TRACEPOINT(retransmit, endpoint->id, seq, (uint8_t)endpoint->packet_re_transmit_count, true);
+    flight_recorder_event(FLIGHT_RECORDER_SELECTIVE_RE_TRANSMIT, endpoint->id, seq, (uint8_t)endpoint->packet_re_transmit_count);
     return;
   }
 
-  // Only i-frames support retransmission
-  BUG_ON(hdlc_get_frame_type(item->handle->control) != SLI_CPC_HDLC_FRAME_TYPE_INFORMATION);
+  WARN("Endpoint #%d: selective reject of seq %d which is not in flight", endpoint->id, seq);
+}
 
-  // Free the previous header buffer. The tx queue process will malloc a new one and fill it.
-  free(item->handle->hdlc_header);
+/***************************************************************************//**
+ * Transmit SELECTIVE REJECT frame, requesting the frame the ack number refers to
+ ******************************************************************************/
+static void transmit_selective_reject(sl_cpc_endpoint_t *endpoint)
+{
+  sl_cpc_buffer_handle_t *handle;
+  sl_cpc_transmit_queue_item_t *item;
 
-  endpoint->packet_re_transmit_count++;
-  endpoint->frames_count_re_transmit_queue--;
+  // The ack field is the sequence number of the missing frame
+  handle = core_alloc_supervisory_handle(endpoint->id,
+                                         hdlc_create_control_supervisory(endpoint->ack, SLI_CPC_HDLC_SELECTIVE_REJECT_SUPERVISORY_FUNCTION),
+                                         HDLC_REJECT_NO_ERROR);
 
-  //Put frame in Tx Q so that it can be transmitted by CPC Core later
-  sl_slist_push(&transmit_queue, &item->node);
+  handle->endpoint = endpoint;
 
-  TRACE_ENDPOINT_RETXD_DATA_FRAME(endpoint);
+  item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
 
-  return;
+  item->handle = handle;
+
+  sl_queue_push_back(&core.supervisory_transmit_queue, &item->node);
+
+  // The selective reject also acknowledges the frames before the missing one
+  core_ack_sent(endpoint);
+
+  endpoint->selective_reject_pending = true;
+
+  TRACE_ENDPOINT_TXD_SELECTIVE_REJECT(endpoint);
+
+  core_process_transmit_queue();
 }
 
 /***************************************************************************//**
@@ -1463,37 +3096,20 @@ static void transmit_reject(sl_cpc_endpoint_t *endpoint,
                             uint8_t ack,
                             sl_cpc_reject_reason_t reason)
 {
-  uint16_t fcs;
   sl_cpc_buffer_handle_t *handle;
   sl_cpc_transmit_queue_item_t *item;
 
-  handle = (sl_cpc_buffer_handle_t*) zalloc(sizeof(sl_cpc_buffer_handle_t));
-  FATAL_ON(handle == NULL);
-
-  handle->address = address;
-
-  // Set the SEQ number and ACK number in the control byte
-  handle->control = hdlc_create_control_supervisory(ack, SLI_CPC_HDLC_REJECT_SUPERVISORY_FUNCTION);
-
-  handle->data = zalloc(sizeof(uint8_t));
-  FATAL_SYSCALL_ON(handle->data == NULL);
-
-  // Set in reason
-  *((uint8_t *)handle->data) = (uint8_t)reason;
-  handle->data_length = sizeof(uint8_t);
-
-  // Compute payload CRC
-  fcs = sli_cpc_get_crc_sw(handle->data, 1);
-  handle->fcs[0] = (uint8_t)fcs;
-  handle->fcs[1] = (uint8_t)(fcs >> 8);
+  // Set the ACK number in the control byte, and the reason in the payload
+  handle = core_alloc_supervisory_handle(address,
+                                         hdlc_create_control_supervisory(ack, SLI_CPC_HDLC_REJECT_SUPERVISORY_FUNCTION),
+                                         reason);
 
   // Put frame in Tx Q so that it can be transmitted by CPC Core later
-  item = (sl_cpc_transmit_queue_item_t*) zalloc(sizeof(sl_cpc_transmit_queue_item_t));
-  FATAL_SYSCALL_ON(item == NULL);
+  item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
 
   item->handle = handle;
 
-  sl_slist_push_back(&transmit_queue, &item->node);
+  sl_queue_push_back(&core.supervisory_transmit_queue, &item->node);
 
   if (endpoint != NULL) {
     switch (reason) {
@@ -1537,9 +3153,7 @@ static bool core_process_tx_queue(void)
 {
   sl_slist_node_t *node;
   sl_cpc_transmit_queue_item_t *item;
-  sl_cpc_transmit_queue_item_t *tx_complete_item;
   sl_cpc_buffer_handle_t *frame;
-  uint16_t total_length;
   uint8_t frame_type;
 
   // If the security is setup, prioritize sending packets that were hold back
@@ -1547,196 +3161,276 @@ static bool core_process_tx_queue(void)
   // If the queue is empty, or if the security is not ready, process packets
   // from the regular transmit queue. Later down this function, it will be
   // determined if the packet can be sent or if it must be hold back.
-  if (pending_on_security_ready_queue != NULL && security_is_ready()) {
+  if (!sl_queue_is_empty(&core.pending_on_security_ready_queue) && security_is_ready()) {
     TRACE_CORE("Sending packet that were hold back because security was not ready");
-    node = sl_slist_pop(&pending_on_security_ready_queue);
+    node = sl_queue_pop(&core.pending_on_security_ready_queue);
   } else {
-    // Return if nothing to transmit
-    if (transmit_queue == NULL) {
+    // Get the next frame for transmission, return if nothing to transmit
+    node = core_tx_scheduler_pop();
+    if (node == NULL) {
       TRACE_CORE("transmit_queue is empty and core is not ready yet to process hold back packets");
       return false;
     }
-
-    // Get first queued frame for transmission
-    node = sl_slist_pop(&transmit_queue);
   }
 
   item = SL_SLIST_ENTRY(node, sl_cpc_transmit_queue_item_t, node);
   frame = item->handle;
 
-  frame->hdlc_header = zalloc(SLI_CPC_HDLC_HEADER_RAW_SIZE);
-  FATAL_SYSCALL_ON(frame->hdlc_header == NULL);
-
-  // Form the HDLC header
-  total_length = (frame->data_length != 0) ? (uint16_t)(frame->data_length + 2) : 0;
-
   frame_type = hdlc_get_frame_type(frame->control);
 
-  if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
-    hdlc_set_control_ack(&frame->control, frame->endpoint->ack);
-  } else if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED) {
-    BUG_ON(frame->endpoint->id != SL_CPC_ENDPOINT_SYSTEM);
+  if (frame->timestamps.written_ns != 0 && frame->timestamps.dequeued_ns == 0) {
+    frame->timestamps.dequeued_ns = loop_stats_now_ns();
   }
 
-  bool encrypt = should_encrypt_frame(frame);
-  if (encrypt) {
-    // if security subsystem is not ready yet and the frame must be encrypted
-    // delay its transmission until ready
-    if (!security_is_ready()) {
-      WARN("Tried to encrypt an I-Frame on endpoint #%d but security is not ready. "
-           "Moving packet to pending on security queue", frame->endpoint->id);
-      sl_slist_push_back(&pending_on_security_ready_queue, &item->node);
+  // The frame is built in place only once. A re-transmission sends the very same
+  // bytes: the ack number it carries may be stale, which the remote ignores.
+  if (frame->frame_length == 0) {
+    uint16_t payload_length = frame->data_length;
+    uint16_t total_length;
 
-      // Return true to keep processing other packets in the queue
-      return true;
+    if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
+      hdlc_set_control_ack(&frame->control, frame->endpoint->ack);
+    } else if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED) {
+      BUG_ON(frame->endpoint->id != SL_CPC_ENDPOINT_SYSTEM);
     }
 
-    TRACE_CORE("Security: Encrypting frame on ep #%d", frame->endpoint->id);
-  }
+    bool encrypt = should_encrypt_frame(frame);
+    if (encrypt) {
+      // if security subsystem is not ready yet and the frame must be encrypted
+      // delay its transmission until ready
+      if (!security_is_ready()) {
+        WARN("Tried to encrypt an I-Frame on endpoint #%d but security is not ready. "
+             "Moving packet to pending on security queue", frame->endpoint->id);
+        sl_queue_push_back(&core.pending_on_security_ready_queue, &item->node);
+
+        // Return true to keep processing other packets in the queue
+        return true;
+      }
+
+      TRACE_CORE("Security: Encrypting frame on ep #%d", frame->endpoint->id);
+    }
 
 #if defined(ENABLE_ENCRYPTION)
-  uint16_t security_buffer_size = 0;
-  if (encrypt) {
-    /* add up a few extra bytes to store security tag */
-    security_buffer_size = (uint16_t)security_encrypt_get_extra_buffer_size();
+    if (encrypt) {
+      /* the security tag is stored right after the payload, in the tailroom */
+      uint16_t security_buffer_size = (uint16_t)security_encrypt_get_extra_buffer_size();
 
-    /* bug if the sum is going to overflow */
-    BUG_ON(total_length > UINT16_MAX - security_buffer_size);
-    total_length = (uint16_t)(total_length + security_buffer_size);
-  }
+      /* bug if the sum is going to overflow */
+      BUG_ON(payload_length > UINT16_MAX - SLI_CPC_HDLC_FCS_SIZE - security_buffer_size);
+      payload_length = (uint16_t)(payload_length + security_buffer_size);
+    }
 #else
-  BUG_ON(encrypt);
+    BUG_ON(encrypt);
 #endif
 
-  /* create header after checking if the frame must be encrypted or not
-   * as it has an impact on the total size of the payload, and the fcs */
-  hdlc_create_header(frame->hdlc_header, frame->address, total_length, frame->control, true);
-
-  uint16_t encrypted_data_length = frame->data_length;
-  uint8_t *encrypted_payload = (uint8_t*)frame->data;
+    // total_length takes into account FCS and security tag
+    total_length = (payload_length != 0) ? (uint16_t)(payload_length + SLI_CPC_HDLC_FCS_SIZE) : 0;
+
+    /* create header after checking if the frame must be encrypted or not
+     * as it has an impact on the total size of the payload, and the fcs */
+    hdlc_create_header(frame->hdlc_header,
+                       frame->address,
+                       (uint16_t)(total_length
+                                  | (frame->aggregated ? SLI_CPC_HDLC_LENGTH_AGGREGATED : 0)
+                                  | (frame->compressed ? SLI_CPC_HDLC_LENGTH_COMPRESSED : 0)),
+                       frame->control,
+                       true);
 
 #if defined(ENABLE_ENCRYPTION)
-  if (frame->endpoint && frame->endpoint->packet_re_transmit_count == 0u && encrypt) {
-    frame->security_info = security_encrypt_prepare_next_frame(frame->endpoint);
-  }
+    if (encrypt) {
+      /* the frame counters are taken here, in the order the frames are sent */
+      if (frame->security_info == NULL) {
+        frame->security_info = security_encrypt_prepare_next_frame(frame->endpoint);
+      }
 
-  if (encrypt) {
-    uint8_t *security_offset;
-    uint16_t fcs;
-    sl_status_t encrypt_status;
+      frame->security_session_last_packet = security_session_has_reset();
+      security_session_reset_clear_flag();
+      if (frame->security_session_last_packet) {
+        core.security_session_last_packet_acked = false;
+      }
+    }
 
-    /*
-     * encrypted_data_length is size of encrypted payload + size of security tag.
-     * This operation should be safe to cast to uint16_t as it was already checked
-     * earlier that the following sum doesn't overflow:
-     *   total_length + security_buffer_size
-     *
-     * And total_length is frame->data_length + 2 bytes for the FCS.
-     * So if the first operation doesn't overflow, this one won't as it's
-     * two-byte shorter.
-     */
-    encrypted_data_length = (uint16_t)(frame->data_length + security_buffer_size);
-
-    /* allocate buffer and make sure it succeeded */
-    encrypted_payload = (uint8_t*)zalloc(encrypted_data_length);
-    FATAL_ON(encrypted_payload == NULL);
-
-    /*
-     * compute offset at which security tag must be stored. It should be right
-     * after the encrypted payload.
-     */
-    security_offset = &encrypted_payload[frame->data_length];
+    // The frames of an endpoint that has some with the crypto worker follow them there,
+    // to be sent in order
+    if (crypto_worker_is_enabled() && (encrypt || frame->endpoint->crypto_pending_count != 0)) {
+      core_frame_built(frame, total_length);
+      frame->endpoint->crypto_pending_count++;
+      crypto_worker_submit(item);
 
-    encrypt_status = security_encrypt(frame->endpoint, frame->security_info,
-                                      frame->hdlc_header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
-                                      frame->data, frame->data_length,
-                                      encrypted_payload,
-                                      security_offset, security_buffer_size);
+      return true;
+    }
+#endif
 
-    if (encrypt_status != SL_STATUS_OK) {
+    if (core_seal_frame(frame) != SL_STATUS_OK) {
       WARN("Encryption failed, leaving core_process_tx_queue");
-      free(encrypted_payload);
       return false;
     }
 
-    frame->security_session_last_packet = security_session_has_reset();
-    security_session_reset_clear_flag();
-    if (frame->security_session_last_packet) {
-      security_session_last_packet_acked = false;
+    core_frame_built(frame, total_length);
+  }
+
+  core_transmit_frame(item);
+
+  return true;
+}
+
+/***************************************************************************//**
+ * Encrypt the payload of a built header in place if the frame has security
+ * information, then store the FCS, over the payload and its security tag, in
+ * the tailroom. Runs on the crypto worker when it is enabled.
+ ******************************************************************************/
+static sl_status_t core_seal_frame(sl_cpc_buffer_handle_t *frame)
+{
+  uint16_t payload_length = frame->data_length;
+
+#if defined(ENABLE_ENCRYPTION)
+  if (frame->security_info != NULL) {
+    uint16_t security_buffer_size = (uint16_t)security_encrypt_get_extra_buffer_size();
+    sl_status_t encrypt_status;
+    uint64_t start_ns = CPCD_TRACEPOINT_ENABLED(crypto) ? core_tracepoint_now_ns() : 0;
+
+    /* encrypt the payload in place, the header is authenticated */
+    encrypt_status = security_encrypt(frame->endpoint, frame->security_info,
+                                      frame->hdlc_header, SLI_CPC_HDLC_HEADER_RAW_SIZE,
+                                      frame->frame->payload, frame->data_length,
+                                      frame->frame->payload,
+                                      &frame->frame->payload[frame->data_length], security_buffer_size);
+    if (start_ns != 0) {
+      CPCD_TRACEPOINT(crypto, frame->endpoint->id, true, frame->data_length, core_tracepoint_now_ns() - start_ns);
+    }
+    if (encrypt_status != SL_STATUS_OK) {
+      return encrypt_status;
     }
 
-    fcs = sli_cpc_get_crc_sw(encrypted_payload, (uint16_t)encrypted_data_length);
-    frame->fcs[0] = (uint8_t)fcs;
-    frame->fcs[1] = (uint8_t)(fcs >> 8);
+    payload_length = (uint16_t)(payload_length + security_buffer_size);
   }
-#else
-  BUG_ON(encrypt);
 #endif
 
-  /* Construct and send the frame to the driver */
-  {
-    // total_length takes into account FCS and security tag
-    size_t frame_length = SLI_CPC_HDLC_HEADER_RAW_SIZE + total_length;
+  if (payload_length != 0) {
+    uint16_t fcs = sli_cpc_get_crc_sw(frame->frame->payload, payload_length);
 
-    frame_t* frame_buffer = (frame_t*) zalloc(frame_length);
-    FATAL_ON(frame_buffer == NULL);
+    frame->frame->payload[payload_length] = (uint8_t)fcs;
+    frame->frame->payload[payload_length + 1] = (uint8_t)(fcs >> 8);
+  }
 
-    /* copy the header */
-    memcpy(frame_buffer->header, frame->hdlc_header, SLI_CPC_HDLC_HEADER_RAW_SIZE);
+  return SL_STATUS_OK;
+}
 
-    /* copy the payload */
-    memcpy(frame_buffer->payload, encrypted_payload, encrypted_data_length);
+/***************************************************************************//**
+ * Mark a frame as built, re-transmissions send it as is from now on
+ ******************************************************************************/
+static void core_frame_built(sl_cpc_buffer_handle_t *frame, uint16_t total_length)
+{
+  frame->frame_length = SLI_CPC_HDLC_HEADER_RAW_SIZE + (size_t)total_length;
 
-    if (encrypted_data_length != 0) {
-      memcpy(&frame_buffer->payload[encrypted_data_length], frame->fcs, sizeof(frame->fcs));
-    }
+  // The ack carried by this frame makes the delayed one unnecessary
+  if (hdlc_get_frame_type(frame->control) == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION && frame->endpoint->ack_pending_count != 0) {
+    TRACE_ENDPOINT_ACK_PIGGYBACKED(frame->endpoint, frame->endpoint->ack_pending_count);
+    core_ack_sent(frame->endpoint);
+  }
+}
 
+/***************************************************************************//**
+ * Send a built frame to the driver, and keep it for re-transmission if it's an
+ * I-frame
+ ******************************************************************************/
+static void core_transmit_frame(sl_cpc_transmit_queue_item_t *item)
+{
+  sl_cpc_buffer_handle_t *frame = item->handle;
+  sl_cpc_transmit_queue_item_t *tx_complete_item;
+
+  /* Send the frame to the driver */
+  {
     frame->pending_tx_complete = true;
 
-    tx_complete_item = (sl_cpc_transmit_queue_item_t*) zalloc(sizeof(sl_cpc_transmit_queue_item_t));
-    FATAL_SYSCALL_ON(tx_complete_item == NULL);
+    tx_complete_item = (sl_cpc_transmit_queue_item_t*) mempool_zalloc(&core.queue_item_pool, sizeof(sl_cpc_transmit_queue_item_t));
     tx_complete_item->handle = frame;
 
-    sl_slist_push_back(&pending_on_tx_complete, &tx_complete_item->node);
-
-    core_push_frame_to_driver(frame_buffer, frame_length);
+    sl_queue_push_back(&core.pending_on_tx_complete, &tx_complete_item->node);
 
-    free(frame_buffer);
-    if (frame->data != encrypted_payload) {
-      /* in case a buffer was allocated for allocation, free it */
-      free((void*)encrypted_payload);
+    if (frame->timestamps.written_ns != 0 && frame->timestamps.pushed_ns == 0) {
+      frame->timestamps.pushed_ns = loop_stats_now_ns();
     }
+
+    core_push_frame_to_driver(frame->frame, frame->frame_length);
   }
 
   TRACE_ENDPOINT_FRAME_TRANSMIT_SUBMITTED(frame->endpoint);
 
-  if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
+  if (frame->selective_re_transmit_queued) {
+    // Selective re-transmission, the frame never left the re-transmit queue
+    frame->selective_re_transmit_queued = false;
+    mempool_free(&core.queue_item_pool, item);
+  } else if (hdlc_get_frame_type(frame->control) == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION) {
     // Put frame in in re-transmission queue if it's a I-frame type (with data)
-    sl_slist_push_back(&frame->endpoint->re_transmit_queue, &item->node);
+    sl_queue_push_back(&frame->endpoint->re_transmit_queue, &item->node);
     frame->endpoint->frames_count_re_transmit_queue++;
   } else {
-    free(item); // Free transmit queue item
+    mempool_free(&core.queue_item_pool, item); // Free transmit queue item
   }
+}
 
-  return true;
+#if defined(ENABLE_ENCRYPTION)
+static sl_status_t core_seal_job(void *job)
+{
+  sl_cpc_transmit_queue_item_t *item = (sl_cpc_transmit_queue_item_t *)job;
+
+  return core_seal_frame(item->handle);
 }
 
+/***************************************************************************//**
+ * Send the frames the crypto worker finished, in the order they were handed
+ * over. Those of dropped_endpoint_id, if not negative, are freed instead.
+ ******************************************************************************/
+static void core_complete_sealed_frames(int dropped_endpoint_id)
+{
+  sl_cpc_transmit_queue_item_t *item;
+  sl_status_t status;
+
+  while ((item = (sl_cpc_transmit_queue_item_t *)crypto_worker_pop_finished(&status)) != NULL) {
+    sl_cpc_buffer_handle_t *frame = item->handle;
+
+    frame->endpoint->crypto_pending_count--;
+
+    if (status != SL_STATUS_OK || frame->endpoint->id == dropped_endpoint_id) {
+      if (status != SL_STATUS_OK) {
+        WARN("Encryption failed on endpoint #%d, dropping frame", frame->endpoint->id);
+      }
+      core_free_buffer_handle(frame);
+      mempool_free(&core.queue_item_pool, item);
+      continue;
+    }
+
+    core_transmit_frame(item);
+  }
+
+  core_flush_frames_to_driver();
+}
+
+static void core_process_crypto_worker(epoll_private_data_t *event_private_data)
+{
+  (void)event_private_data;
+
+  core_complete_sealed_frames(-1);
+}
+#endif
+
 /***************************************************************************//**
  * Callback for re-transmit frame
  ******************************************************************************/
 static void re_transmit_timeout(sl_cpc_endpoint_t* endpoint)
 {
-  if (endpoint->packet_re_transmit_count >= SLI_CPC_RE_TRANSMIT) {
+  if (endpoint->packet_re_transmit_count >= endpoint->max_re_transmit) {
     WARN("Retransmit limit reached on endpoint #%d", endpoint->id);
     core_set_endpoint_in_error(endpoint->id, SL_CPC_STATE_ERROR_DESTINATION_UNREACHABLE);
   } else {
-    endpoint->re_transmit_timeout_ms *= 2; // RTO(new) = RTO(before retransmission) *2 )
-                                           // this is explained in Karn’s Algorithm
-    if (endpoint->re_transmit_timeout_ms > SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS) {
-      endpoint->re_transmit_timeout_ms = SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS;
+    // RTO(new) = RTO(before retransmission) * 2, until an ack gives a new RTT
+    // sample. This is explained in Karn’s Algorithm
+    if (endpoint->re_transmit_backoff < SL_CPC_RE_TRANSMIT_BACKOFF_MAX) {
+      endpoint->re_transmit_backoff++;
     }
 
-    TRACE_CORE("New RTO calculated on ep %d, after re_transmit timeout: %ldms", endpoint->id, endpoint->re_transmit_timeout_ms);
+    TRACE_CORE("RTO backed off on ep %d, after re_transmit timeout: x%u", endpoint->id, 1u << endpoint->re_transmit_backoff);
 
     re_transmit_frame(endpoint);
   }
@@ -1779,6 +3473,16 @@ bool should_encrypt_frame(sl_cpc_buffer_handle_t *frame)
 }
 
 #if defined(ENABLE_ENCRYPTION)
+/* Only read when the crypto tracepoint is enabled, never 0 */
+static uint64_t core_tracepoint_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
 static bool should_decrypt_frame(sl_cpc_endpoint_t *endpoint, uint16_t payload_len)
 {
   /*
@@ -1807,7 +3511,7 @@ static bool should_decrypt_frame(sl_cpc_endpoint_t *endpoint, uint16_t payload_l
   }
 
   if (security_state == SECURITY_STATE_RESETTING
-      && security_session_last_packet_acked == true) {
+      && core.security_session_last_packet_acked == true) {
     return false;
   } else {
     return true;
@@ -1828,19 +3532,187 @@ static bool security_is_ready(void)
 }
 
 /***************************************************************************//**
- * Check if seq equal ack minus one
+ * Check if seq is one of the last `window` sequence numbers before ack, ie. a
+ * frame that was already received and acknowledged
+ ******************************************************************************/
+static bool is_seq_valid(uint8_t seq, uint8_t ack, uint8_t window)
+{
+  uint8_t distance = (uint8_t)((ack - seq) % 8u);
+
+  return distance >= 1u && distance <= window;
+}
+
+/***************************************************************************//**
+ * Check if a sequence number is ahead of the ack, but still within the window
+ ******************************************************************************/
+static bool is_seq_ahead_in_window(uint8_t seq, uint8_t ack, uint8_t window)
+{
+  uint8_t distance = (uint8_t)((seq - ack) % 8u);
+
+  return distance >= 1u && distance < window;
+}
+
+/***************************************************************************//**
+ * Check if out of order frames are held and selectively rejected on an endpoint.
+ * Past a window of 4, a frame ahead of the ack can't be told apart from a
+ * duplicate in the 3-bit seq space.
+ ******************************************************************************/
+static bool is_selective_reject_enabled(const sl_cpc_endpoint_t *endpoint)
+{
+  uint8_t peer_tx_window_size = core_get_peer_tx_window_size();
+
+  (void)endpoint;
+
+  return config.selective_reject && peer_tx_window_size > 1 && peer_tx_window_size <= 4;
+}
+
+/***************************************************************************//**
+ * The window the secondary transmits with, the one it advertises. Ours is the
+ * smaller of it and the config, and is never set on the secondary, so the
+ * received frames are checked against the window of the peer.
  ******************************************************************************/
-static bool is_seq_valid(uint8_t seq, uint8_t ack)
+static uint8_t core_get_peer_tx_window_size(void)
 {
-  bool result = false;
+  return server_core_get_secondary_tx_window_size();
+}
 
-  if (seq == (ack - 1u)) {
-    result = true;
-  } else if (ack == 0u && seq == 7u) {
-    result = true;
+/***************************************************************************//**
+ * Check if an endpoint holds frames received out of order
+ ******************************************************************************/
+static bool core_has_out_of_order_frames(const sl_cpc_endpoint_t *endpoint)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(endpoint->out_of_order_frames); i++) {
+    if (endpoint->out_of_order_frames[i] != NULL) {
+      return true;
+    }
   }
 
-  return result;
+  return false;
+}
+
+/***************************************************************************//**
+ * Free the frames an endpoint holds because they were received out of order
+ ******************************************************************************/
+static void core_drop_out_of_order_frames(sl_cpc_endpoint_t *endpoint)
+{
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(endpoint->out_of_order_frames); i++) {
+    mempool_free(&core.frame_pool, endpoint->out_of_order_frames[i]);
+    endpoint->out_of_order_frames[i] = NULL;
+  }
+
+  endpoint->selective_reject_pending = false;
+}
+
+/***************************************************************************//**
+ * Queue a frame on the transmit queue of its endpoint
+ ******************************************************************************/
+static void core_endpoint_tx_queue_push(sl_cpc_endpoint_t *endpoint, sl_cpc_transmit_queue_item_t *item, bool front)
+{
+  clock_gettime(CLOCK_MONOTONIC, &item->enqueue_timestamp);
+
+  if (front) {
+    sl_queue_push(&endpoint->transmit_queue, &item->node);
+  } else {
+    sl_queue_push_back(&endpoint->transmit_queue, &item->node);
+  }
+
+  if (sl_queue_len(&endpoint->transmit_queue) > endpoint->stats->transmit_queue_depth_max) {
+    endpoint->stats->transmit_queue_depth_max = sl_queue_len(&endpoint->transmit_queue);
+  }
+
+  core.tx_scheduler[endpoint->tx_priority].backlog++;
+}
+
+/***************************************************************************//**
+ * Pick the next frame to transmit
+ *
+ * Supervisory frames go first. Data and unnumbered frames are then taken from
+ * the lowest priority level with a backlog, where each endpoint may send up to
+ * its weight in frames before the next endpoint of that level gets its turn.
+ ******************************************************************************/
+static sl_slist_node_t* core_tx_scheduler_pop(void)
+{
+  sl_slist_node_t *node;
+  sl_cpc_endpoint_t *endpoint;
+  sl_cpc_transmit_queue_item_t *item;
+  struct timespec now;
+  uint64_t delay_us;
+  uint8_t level;
+  size_t current;
+
+  node = sl_queue_pop(&core.supervisory_transmit_queue);
+  if (node != NULL) {
+    return node;
+  }
+
+  for (level = 0; level < CPC_TX_PRIORITY_LEVEL_COUNT; level++) {
+    if (core.tx_scheduler[level].backlog != 0) {
+      break;
+    }
+  }
+
+  if (level == CPC_TX_PRIORITY_LEVEL_COUNT) {
+    return NULL;
+  }
+
+  current = core.tx_scheduler[level].current;
+  endpoint = &core.endpoints[core.opened_endpoints[current]];
+
+  if (endpoint->tx_priority != level
+      || sl_queue_is_empty(&endpoint->transmit_queue)
+      || core.tx_scheduler[level].credit == 0) {
+    // The backlog guarantees an endpoint of this level has something queued,
+    // possibly the current one once every other endpoint has been visited.
+    // Only the endpoints opened at least once can have frames queued
+    do {
+      current = (current + 1) % core.opened_endpoint_count;
+      endpoint = &core.endpoints[core.opened_endpoints[current]];
+    } while (endpoint->tx_priority != level || sl_queue_is_empty(&endpoint->transmit_queue));
+
+    core.tx_scheduler[level].current = current;
+    core.tx_scheduler[level].credit = endpoint->tx_weight;
+  }
+
+  core.tx_scheduler[level].credit--;
+  core.tx_scheduler[level].backlog--;
+
+  node = sl_queue_pop(&endpoint->transmit_queue);
+  endpoint->stats->transmit_queue_dequeued++;
+
+  item = SL_SLIST_ENTRY(node, sl_cpc_transmit_queue_item_t, node);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  delay_us = (uint64_t)(((int64_t)(now.tv_sec - item->enqueue_timestamp.tv_sec) * 1000000000LL
+                         + ((int64_t)now.tv_nsec - (int64_t)item->enqueue_timestamp.tv_nsec)) / 1000);
+  endpoint->stats->transmit_queue_delay_total_us += delay_us;
+  if (delay_us > endpoint->stats->transmit_queue_delay_max_us) {
+    endpoint->stats->transmit_queue_delay_max_us = delay_us;
+  }
+
+  return node;
+}
+
+/***************************************************************************//**
+ * Returns true if no frame is waiting for its turn to be transmitted
+ ******************************************************************************/
+static bool core_tx_scheduler_is_empty(void)
+{
+  uint8_t level;
+
+  if (!sl_queue_is_empty(&core.supervisory_transmit_queue)) {
+    return false;
+  }
+
+  for (level = 0; level < CPC_TX_PRIORITY_LEVEL_COUNT; level++) {
+    if (core.tx_scheduler[level].backlog != 0) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
 /***************************************************************************//**
@@ -1848,7 +3720,7 @@ static bool is_seq_valid(uint8_t seq, uint8_t ack)
  ******************************************************************************/
 static sl_cpc_endpoint_t* find_endpoint(uint8_t endpoint_number)
 {
-  return &core_endpoints[endpoint_number];
+  return &core.endpoints[endpoint_number];
 }
 
 #ifdef UNIT_TESTING
@@ -1856,7 +3728,7 @@ void core_reset_endpoint(uint8_t endpoint_number)
 {
   sl_cpc_endpoint_t *ep;
 
-  ep = &core_endpoints[endpoint_number];
+  ep = &core.endpoints[endpoint_number];
 
   while (ep->state != SL_CPC_STATE_CLOSED) {
     sleep_ms(1);
@@ -1875,7 +3747,7 @@ void core_reset_endpoint(uint8_t endpoint_number)
 
 uint32_t core_endpoint_get_frame_counter(uint8_t endpoint_number, bool tx)
 {
-  sl_cpc_endpoint_t *ep = &core_endpoints[endpoint_number];
+  sl_cpc_endpoint_t *ep = &core.endpoints[endpoint_number];
 
   if (tx) {
     return ep->frame_counter_tx;
@@ -1886,7 +3758,7 @@ uint32_t core_endpoint_get_frame_counter(uint8_t endpoint_number, bool tx)
 
 void core_endpoint_set_frame_counter(uint8_t endpoint_number, uint32_t new_value, bool tx)
 {
-  sl_cpc_endpoint_t *ep = &core_endpoints[endpoint_number];
+  sl_cpc_endpoint_t *ep = &core.endpoints[endpoint_number];
 
   if (tx) {
     ep->frame_counter_tx = new_value;
@@ -1901,31 +3773,8 @@ void core_endpoint_set_frame_counter(uint8_t endpoint_number, uint32_t new_value
  ******************************************************************************/
 static void stop_re_transmit_timer(sl_cpc_endpoint_t* endpoint)
 {
-  int ret;
-  epoll_private_data_t* fd_timer_private_data;
-
-  /* Passing itimerspec with it_value of 0 stops the timer. */
-  const struct itimerspec cancel_time = { .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
-                                          .it_value    = { .tv_sec = 0, .tv_nsec = 0 } };
-
-  fd_timer_private_data = endpoint->re_transmit_timer_private_data;
-
-  if (fd_timer_private_data == NULL) {
-    return;
-  }
-
-  ret = timerfd_settime(fd_timer_private_data->file_descriptor,
-                        0,
-                        &cancel_time,
-                        NULL);
-
-  FATAL_SYSCALL_ON(ret < 0);
-}
-
-static double diff_timespec_ms(const struct timespec *final, const struct timespec *initial)
-{
-  return (double)((final->tv_sec - initial->tv_sec) * 1000)
-         + (double)(final->tv_nsec - initial->tv_nsec) / 1000000.0;
+  endpoint->re_transmit_timer_deferred = false;
+  epoll_timer_stop(&endpoint->re_transmit_timer);
 }
 
 /***************************************************************************//**
@@ -1933,21 +3782,8 @@ static double diff_timespec_ms(const struct timespec *final, const struct timesp
  ******************************************************************************/
 static void start_re_transmit_timer(sl_cpc_endpoint_t* endpoint, struct timespec offset)
 {
-  int ret;
-  epoll_private_data_t* fd_timer_private_data;
-
   struct timespec current_timestamp;
-  clock_gettime(CLOCK_MONOTONIC, &current_timestamp);
-
-  long offset_in_ms;
-
-  offset_in_ms = (long)diff_timespec_ms(&offset, &current_timestamp);
-
-  fd_timer_private_data = endpoint->re_transmit_timer_private_data;
-
-  if (offset_in_ms < 0) {
-    offset_in_ms = 0;
-  }
+  struct timespec expiry = offset;
 
   if (endpoint->state != SL_CPC_STATE_OPEN) {
     return; // Don't start the timer if we're not open.
@@ -1955,138 +3791,258 @@ static void start_re_transmit_timer(sl_cpc_endpoint_t* endpoint, struct timespec
             // and an endpoint closed right after.
   }
 
-  /* Make sure the timer file descriptor is open*/
-  FATAL_ON(fd_timer_private_data == NULL);
-  FATAL_ON(fd_timer_private_data->file_descriptor < 0);
+  // While tx completes are processed, only the last start of the endpoint counts
+  if (core.tx_complete.draining) {
+    if (!endpoint->re_transmit_timer_deferred) {
+      endpoint->re_transmit_timer_deferred = true;
+      core.tx_complete.deferred_timers[core.tx_complete.deferred_timer_count++] = endpoint->id;
+    }
+    endpoint->re_transmit_timer_offset = offset;
+    return;
+  }
 
-  struct itimerspec timeout_time = { .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
-                                     .it_value    = { .tv_sec = ((offset_in_ms + endpoint->re_transmit_timeout_ms) / 1000), .tv_nsec = (((offset_in_ms + endpoint->re_transmit_timeout_ms) % 1000) * 1000000) } };
+  // The oldest frame in flight is the one the timer covers
+  if (!sl_queue_is_empty(&endpoint->re_transmit_queue)) {
+    sl_cpc_transmit_queue_item_t *oldest_item = SL_SLIST_ENTRY(sl_queue_peek(&endpoint->re_transmit_queue), sl_cpc_transmit_queue_item_t, node);
 
-  ret = timerfd_settime(fd_timer_private_data->file_descriptor,
-                        0,
-                        &timeout_time,
-                        NULL);
+    endpoint->re_transmit_timeout_ms = core_get_re_transmit_timeout_ms(endpoint, oldest_item->handle->frame_length);
+  } else {
+    endpoint->re_transmit_timeout_ms = core_get_re_transmit_timeout_ms(endpoint, 0);
+  }
+
+  // The timer expires re_transmit_timeout_ms after the offset, or after now if
+  // the offset is already in the past
+  clock_gettime(CLOCK_MONOTONIC, &current_timestamp);
+  if (expiry.tv_sec < current_timestamp.tv_sec
+      || (expiry.tv_sec == current_timestamp.tv_sec && expiry.tv_nsec < current_timestamp.tv_nsec)) {
+    expiry = current_timestamp;
+  }
+
+  expiry.tv_sec += endpoint->re_transmit_timeout_ms / 1000;
+  expiry.tv_nsec += (endpoint->re_transmit_timeout_ms % 1000) * 1000000;
+  if (expiry.tv_nsec >= 1000000000) {
+    expiry.tv_sec++;
+    expiry.tv_nsec -= 1000000000;
+  }
 
-  FATAL_SYSCALL_ON(ret < 0);
+  epoll_timer_start_at(&endpoint->re_transmit_timer, &expiry);
 }
 
 /***************************************************************************//**
- * Loops through all the endpoints and if its timer has elapsed, perform a re-transmit
+ * Arm the re-transmit timers started while tx completes were processed
  ******************************************************************************/
-static void core_process_ep_timeout(epoll_private_data_t *event_private_data)
+static void core_arm_deferred_re_transmit_timers(void)
 {
-  int fd_timer = event_private_data->file_descriptor;
-  uint8_t endpoint_number = event_private_data->endpoint_number;
+  size_t i;
 
-  /* Ack the timer */
-  {
-    uint64_t expiration;
-    ssize_t ret;
+  for (i = 0; i < core.tx_complete.deferred_timer_count; i++) {
+    sl_cpc_endpoint_t *endpoint = &core.endpoints[core.tx_complete.deferred_timers[i]];
 
-    ret = read(fd_timer, &expiration, sizeof(expiration));
-    FATAL_ON(ret < 0);
+    // Stopped since then
+    if (!endpoint->re_transmit_timer_deferred) {
+      continue;
+    }
 
-    /* we missed a timeout*/
-    WARN_ON(expiration != 1);
+    endpoint->re_transmit_timer_deferred = false;
+    start_re_transmit_timer(endpoint, endpoint->re_transmit_timer_offset);
   }
 
-  re_transmit_timeout(&core_endpoints[endpoint_number]);
+  core.tx_complete.deferred_timer_count = 0;
+}
+
+/***************************************************************************//**
+ * Re-transmit timer of an endpoint expired
+ ******************************************************************************/
+static void core_process_ep_timeout(epoll_timer_t *timer)
+{
+  sl_cpc_endpoint_t *endpoint = container_of(timer, sl_cpc_endpoint_t, re_transmit_timer);
+
+  re_transmit_timeout(endpoint);
+}
+
+/***************************************************************************//**
+ * Delayed ack deadline of an endpoint expired
+ ******************************************************************************/
+static void core_process_ack_timeout(epoll_timer_t *timer)
+{
+  sl_cpc_endpoint_t *endpoint = container_of(timer, sl_cpc_endpoint_t, ack_timer);
+
+  transmit_ack(endpoint);
+}
+
+/***************************************************************************//**
+ * Aggregation deadline of an endpoint expired
+ ******************************************************************************/
+static void core_process_aggregation_timeout(epoll_timer_t *timer)
+{
+  sl_cpc_endpoint_t *endpoint = container_of(timer, sl_cpc_endpoint_t, aggregation_timer);
+
+  core_flush_aggregate(endpoint);
 }
 
 /***************************************************************************//**
  * Pushes a complete frame to the driver.
  *
- *
+ * The frame is added to the current batch, which is sent once full or when the
+ * transmit queue was processed. The frame must stay valid until then.
  ******************************************************************************/
 static void core_push_frame_to_driver(const void *frame, size_t frame_len)
 {
-  TRACE_FRAME("Core : Pushed frame to driver : ", frame, frame_len);
+  trace_capture_frame(true, frame, frame_len);
+  flight_recorder_frame(true, frame, frame_len);
+  TRACE_CORE_FRAME("Pushed frame to driver : ", frame, frame_len);
+  CPCD_TRACEPOINT(frame_tx,
+                  hdlc_get_address(frame),
+                  hdlc_get_control(frame),
+                  hdlc_get_seq(hdlc_get_control(frame)),
+                  hdlc_get_ack(hdlc_get_control(frame)),
+                  hdlc_get_length(frame));
+
+  core.tx_batch.iovecs[core.tx_batch.count].iov_base = (void *)frame;
+  core.tx_batch.iovecs[core.tx_batch.count].iov_len = frame_len;
+  core.tx_batch.count++;
+
+  if (core.tx_batch.count == SLI_CPC_DRIVER_TX_BATCH_SIZE) {
+    core_flush_frames_to_driver();
+  }
+}
 
-  if (driver_sock_private_data.file_descriptor < 1) {
-    TRACE_CORE("Core already closed the data socket");
+/***************************************************************************//**
+ * Sends the batch of frames to the driver, one datagram per frame.
+ ******************************************************************************/
+static void core_flush_frames_to_driver(void)
+{
+  unsigned int sent = 0;
+  unsigned int i;
+
+  if (core.tx_batch.count == 0) {
     return;
   }
 
-  ssize_t ret = send(driver_sock_private_data.file_descriptor, frame, frame_len, 0);
+  if (core.driver_sock_private_data.file_descriptor < 1) {
+    TRACE_CORE("Core already closed the data socket");
+    core.tx_batch.count = 0;
+    return;
+  }
 
-  /* Socket closed */
-  if (ret < 0 && errno == ECONNRESET) {
-    TRACE_CORE("Driver closed the data socket");
-    epoll_unregister(&driver_sock_private_data);
-    int ret_close = close(driver_sock_private_data.file_descriptor);
-    FATAL_SYSCALL_ON(ret_close != 0);
-    driver_sock_private_data.file_descriptor = -1;
+  if (driver_ring_is_enabled()) {
+    driver_ring_push_frames_to_driver(core.tx_batch.iovecs, core.tx_batch.count);
+    for (i = 0; i < core.tx_batch.count; i++) {
+      TRACE_CORE_TXD_TRANSMIT_COMPLETED();
+    }
+    core.tx_batch.count = 0;
     return;
   }
 
-  FATAL_SYSCALL_ON(ret < 0);
+  for (i = 0; i < core.tx_batch.count; i++) {
+    memset(&core.tx_batch.msgs[i], 0, sizeof(core.tx_batch.msgs[i]));
+    core.tx_batch.msgs[i].msg_hdr.msg_iov = &core.tx_batch.iovecs[i];
+    core.tx_batch.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // sendmmsg() stops early if the socket buffer fills, send the rest
+  while (sent < core.tx_batch.count) {
+    int ret = sendmmsg(core.driver_sock_private_data.file_descriptor, &core.tx_batch.msgs[sent], core.tx_batch.count - sent, 0);
+
+    /* Socket closed */
+    if (ret < 0 && errno == ECONNRESET) {
+      TRACE_CORE("Driver closed the data socket");
+      epoll_unregister(&core.driver_sock_private_data);
+      int ret_close = close(core.driver_sock_private_data.file_descriptor);
+      FATAL_SYSCALL_ON(ret_close != 0);
+      core.driver_sock_private_data.file_descriptor = -1;
+      break;
+    }
+
+    FATAL_SYSCALL_ON(ret < 0);
+
+    for (i = sent; i < sent + (unsigned int)ret; i++) {
+      FATAL_ON(core.tx_batch.msgs[i].msg_len != core.tx_batch.iovecs[i].iov_len);
+      TRACE_CORE_TXD_TRANSMIT_COMPLETED();
+    }
 
-  FATAL_ON((size_t) ret != frame_len);
+    sent += (unsigned int)ret;
+  }
 
-  TRACE_CORE_TXD_TRANSMIT_COMPLETED();
+  core.tx_batch.count = 0;
 }
 
 /***************************************************************************//**
- * Fetches the next frame from the driver.
+ * Fetches the frames pending on the driver socket.
  *
- * The buffer for the retrieved frame is dynamically allocated inside this
- * function and passed to the caller. It is the caller's job to free the buffer
- * when done with it.
+ * Up to SLI_CPC_RX_BATCH_SIZE frames are read with a single syscall into the
+ * receive batch buffers, or handed out of those the event loop received them
+ * in, which the iovecs of the batch then point at. They stay valid until the
+ * next call.
  *
- * Returns true is data is valid
+ * Returns the number of frames read
  ******************************************************************************/
-static bool core_pull_frame_from_driver(frame_t** frame_buf, size_t* frame_buf_len)
+static unsigned int core_pull_frames_from_driver(void)
 {
-  size_t datagram_length;
+  int retval;
+  unsigned int i;
 
-  /* Poll the socket to get the next pending datagram size */
-  {
-    if (driver_sock_private_data.file_descriptor < 1) {
-      TRACE_CORE("Core already closed the data socket");
-      return false;
-    }
+  if (core.driver_sock_private_data.file_descriptor < 1) {
+    TRACE_CORE("Core already closed the data socket");
+    return 0;
+  }
 
-    ssize_t retval = recv(driver_sock_private_data.file_descriptor, NULL, 0, MSG_PEEK | MSG_TRUNC | MSG_DONTWAIT);
+  for (i = 0; i < SLI_CPC_RX_BATCH_SIZE; i++) {
+    core.rx_batch.iovecs[i].iov_base = core.rx_batch.buffers[i];
+    core.rx_batch.iovecs[i].iov_len = SLI_CPC_RX_FRAME_MAX_SIZE;
+    core.rx_batch.msgs[i].msg_hdr.msg_name = NULL;
+    core.rx_batch.msgs[i].msg_hdr.msg_namelen = 0;
+    core.rx_batch.msgs[i].msg_hdr.msg_iov = &core.rx_batch.iovecs[i];
+    core.rx_batch.msgs[i].msg_hdr.msg_iovlen = 1;
+    core.rx_batch.msgs[i].msg_hdr.msg_control = NULL;
+    core.rx_batch.msgs[i].msg_hdr.msg_controllen = 0;
+    core.rx_batch.msgs[i].msg_hdr.msg_flags = 0;
+  }
 
-    /* Socket closed */
-    if (retval == 0 || (retval < 0 && errno == ECONNRESET)) {
-      TRACE_CORE("Driver closed the data socket");
-      epoll_unregister(&driver_sock_private_data);
-      int ret_close = close(driver_sock_private_data.file_descriptor);
-      FATAL_SYSCALL_ON(ret_close != 0);
-      driver_sock_private_data.file_descriptor = -1;
-      return false;
+  if (driver_ring_is_enabled()) {
+    retval = driver_ring_pop_frames_from_driver(core.rx_batch.msgs, SLI_CPC_RX_BATCH_SIZE);
+
+    for (i = 0; i < (unsigned int)retval; i++) {
+      /* The length of the frame should be at minimum a header length */
+      BUG_ON(core.rx_batch.msgs[i].msg_len < sizeof(frame_t));
     }
 
-    FATAL_SYSCALL_ON(retval < 0);
+    return (unsigned int)retval;
+  }
 
-    /* The socket had no data. This function is intended to be called
-     * when we know the socket has data. */
-    datagram_length = (size_t)retval;
-    BUG_ON(datagram_length == 0);
+  retval = epoll_recvmmsg(&core.driver_sock_private_data, core.rx_batch.msgs, SLI_CPC_RX_BATCH_SIZE);
 
-    /* The length of the frame should be at minimum a header length */
-    BUG_ON(datagram_length < sizeof(frame_t));
+  /* Spurious wakeup, the frames were already read */
+  if (retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return 0;
   }
 
-  /* Allocate a buffer of the right size */
-  {
-    *frame_buf = (frame_t*) zalloc((size_t)datagram_length);
-    FATAL_SYSCALL_ON(*frame_buf == NULL);
+  /* Socket closed. An empty datagram is how it shows in a batch */
+  if (retval == 0 || (retval < 0 && errno == ECONNRESET) || (retval > 0 && core.rx_batch.msgs[0].msg_len == 0)) {
+    TRACE_CORE("Driver closed the data socket");
+    epoll_unregister(&core.driver_sock_private_data);
+    int ret_close = close(core.driver_sock_private_data.file_descriptor);
+    FATAL_SYSCALL_ON(ret_close != 0);
+    core.driver_sock_private_data.file_descriptor = -1;
+    return 0;
   }
 
-  /* Fetch the datagram from the driver socket */
-  {
-    ssize_t ret = recv(driver_sock_private_data.file_descriptor, *frame_buf, (size_t)datagram_length, 0);
+  FATAL_SYSCALL_ON(retval < 0);
 
-    FATAL_SYSCALL_ON(ret < 0);
+  for (i = 0; i < (unsigned int)retval; i++) {
+    /* Frames past an empty datagram are not processed, the closure is seen on the next read */
+    if (core.rx_batch.msgs[i].msg_len == 0) {
+      return i;
+    }
 
-    /* The next pending datagram size should be equal to what we just read */
-    FATAL_ON((size_t)ret != (size_t)datagram_length);
+    /* The length of the frame should be at minimum a header length */
+    BUG_ON(core.rx_batch.msgs[i].msg_len < sizeof(frame_t));
+
+    /* Drivers don't deliver frames larger than their own buffers */
+    BUG_ON(core.rx_batch.msgs[i].msg_hdr.msg_flags & MSG_TRUNC);
   }
 
-  *frame_buf_len = (size_t)datagram_length;
-  return true;
+  return (unsigned int)retval;
 }
 
 /***************************************************************************//**
@@ -23,8 +23,12 @@
 #include "sl_cpc.h"
 
 #include "hdlc.h"
+#include "misc/sl_queue.h"
 #include "misc/sl_slist.h"
+#include "misc/metrics.h"
+#include "server_core/epoll/timer.h"
 #include "server_core/cpcd_exchange.h"
+#include "server_core/handoff/handoff.h"
 
 #define SL_CPC_OPEN_ENDPOINT_FLAG_IFRAME_DISABLE    0x01 << 0   // I-frame is enabled by default; This flag MUST be set to disable the i-frame support by the endpoint
 #define SL_CPC_OPEN_ENDPOINT_FLAG_UFRAME_ENABLE     0x01 << 1   // U-frame is disabled by default; This flag MUST be set to enable u-frame support by the endpoint
@@ -34,15 +38,41 @@
 #define SL_CPC_FLAG_UNNUMBERED_POLL             0x01 << 2
 #define SL_CPC_FLAG_UNNUMBERED_RESET_COMMAND    0x01 << 3
 #define SL_CPC_FLAG_INFORMATION_POLL            0x01 << 4
+#define SL_CPC_FLAG_INFORMATION_MORE_FRAGMENTS  0x01 << 5   // Same P/F bit, on the other endpoints than the system one
+#define SL_CPC_FLAG_INFORMATION_AGGREGATED      0x01 << 6   // Payload made of length-prefixed messages, see core_flush_aggregate()
 
 // Maximum number of retry while sending a frame
+// These are the defaults of the protocol parameters, see core_set_protocol_parameter()
 #define SLI_CPC_RE_TRANSMIT 10
 #define SL_CPC_MAX_RE_TRANSMIT_TIMEOUT_MS 5000
 #define SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MS 5
+#define SL_CPC_RE_TRANSMIT_TIMEOUT_LIMIT_MS 60000 // Largest value the bounds can be tuned to
 #define SL_CPC_MIN_RE_TRANSMIT_TIMEOUT_MINIMUM_VARIATION_MS  5
+#define SL_CPC_RE_TRANSMIT_BACKOFF_MAX 16 // Doublings of the re-transmit timeout, it is capped way before anyway
+
+// Variance of the frame lengths, in bytes squared, from which the RTT model
+// tells the time per byte apart from the latency
+#define SL_CPC_RTT_MODEL_MIN_LENGTH_VARIANCE 64.0
+
+// Buffer pools are sized for this many endpoints with a full tx window in flight,
+// plus a few frames being transmitted or received. Beyond that, allocations fall
+// back to the heap.
+#define SLI_CPC_BUFFER_POOL_ENDPOINT_COUNT  8u
+#define SLI_CPC_BUFFER_POOL_EXTRA_FRAMES    8u
+
+// Largest message written to an endpoint with fragmentation, or reassembled from the secondary
+#define SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE  (64u * 1024u)
+
+// Each message of an aggregated I-frame is prefixed with its length, 16 bits little endian
+#define SL_CPC_AGGREGATE_PREFIX_SIZE        2u
+// Longest a small write is held back to share its I-frame with the next ones
+#define SL_CPC_AGGREGATION_DEADLINE_MAX_US  100000u
+
+// Smaller payloads are sent as they are, LZ4 can hardly shrink them
+#define SL_CPC_COMPRESSION_MIN_SIZE  32u
 
 #define TRANSMIT_WINDOW_MIN_SIZE  1u
-#define TRANSMIT_WINDOW_MAX_SIZE  1u
+#define TRANSMIT_WINDOW_MAX_SIZE  7u // Limited by the 3-bit seq/ack space
 
 #define SL_CPC_VERSION_MAJOR 1u
 #define SL_CPC_VERSION_MINOR 1u
@@ -53,6 +83,30 @@ void core_init(int driver_fd, int driver_notify_fd);
 
 void core_open_endpoint(uint8_t endpoit_number, uint8_t flags, uint8_t tx_window_size, bool encryption);
 
+void core_init_buffer_pools(void);
+
+void core_print_buffer_pool_stats(void);
+
+void core_print_transmit_queue_stats(void);
+
+void core_add_metrics(metrics_t *metrics);
+
+void core_set_endpoint_tx_priority(uint8_t endpoint_number, uint8_t *priority, uint8_t *weight);
+
+bool core_set_endpoint_fragmentation(uint8_t endpoint_number, bool enable);
+
+bool core_get_endpoint_fragmentation(uint8_t endpoint_number);
+
+uint32_t core_set_endpoint_aggregation(uint8_t endpoint_number, uint32_t deadline_us);
+
+uint32_t core_get_endpoint_aggregation(uint8_t endpoint_number);
+
+bool core_set_endpoint_compression(uint8_t endpoint_number, bool enable);
+
+bool core_get_endpoint_compression(uint8_t endpoint_number);
+
+size_t core_get_endpoint_max_write_size(uint8_t endpoint_number);
+
 void core_process_transmit_queue(void);
 
 #ifdef UNIT_TESTING
@@ -67,10 +121,28 @@ bool core_ep_is_busy(uint8_t ep_id);
 
 sl_status_t core_close_endpoint(uint8_t endpoint_number, bool notify_secondary, bool force_close);
 
+/* Endpoints opened at least once since the daemon started, in that order */
+size_t core_get_opened_endpoints(const uint8_t **ep_ids);
+
+/* No frame queued nor in flight, nothing being reassembled nor closed: the
+ * link can be handed over, see handoff.h */
+bool core_is_idle(void);
+
+/* Hot restart, the state of an endpoint not closed */
+void core_export_endpoint(uint8_t ep_id, handoff_endpoint_t *exported);
+void core_import_endpoint(const handoff_endpoint_t *imported);
+
+/* Protocol parameters tuned at runtime, on an open endpoint or daemon-wide on
+ * endpoint 0, see cpc_protocol_parameter_t. Return 0 or -errno */
+int core_get_protocol_parameter(uint8_t ep_id, cpc_protocol_parameter_t parameter, uint32_t *value);
+int core_set_protocol_parameter(uint8_t ep_id, cpc_protocol_parameter_t parameter, uint32_t value);
+
 cpc_endpoint_state_t core_get_endpoint_state(uint8_t ep_id);
 
 bool core_get_endpoint_encryption(uint8_t ep_id);
 
+uint32_t core_get_endpoint_tx_credit(uint8_t ep_id);
+
 void core_set_endpoint_state(uint8_t ep_id, cpc_endpoint_state_t state);
 
 cpc_endpoint_state_t core_state_mapper(uint8_t state);
@@ -79,6 +151,12 @@ const char* core_stringify_state(cpc_endpoint_state_t state);
 
 void core_write(uint8_t endpoint_number, const void* message, size_t message_len, uint8_t flags);
 
+void *core_alloc_write_buffer(void);
+
+size_t core_get_write_buffer_size(void);
+
+void core_write_buffer(uint8_t endpoint_number, void* buffer, size_t message_len, uint8_t flags);
+
 SL_ENUM(sl_cpc_endpoint_option_t){
   SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE = 0,
   SL_CPC_ENDPOINT_ON_IFRAME_RECEIVE_ARG,
@@ -115,9 +193,67 @@ typedef struct {
 
 typedef void (*sl_cpc_on_data_reception_t)(uint8_t endpoint_id, const void* data, size_t data_len);
 
+/* Stages of the data frames sent to the secondary, see frame_latency_stats */
+typedef enum {
+  CORE_LATENCY_STAGE_QUEUE,    // Waiting for the tx window and the scheduler
+  CORE_LATENCY_STAGE_BUILD,    // Header, encryption and FCS, with the crypto worker if enabled
+  CORE_LATENCY_STAGE_BUS,      // Driver socket, then the bus
+  CORE_LATENCY_STAGE_ACK,      // Waiting for the acknowledgement of the secondary
+  CORE_LATENCY_STAGE_TOTAL,    // Handed to the core until acknowledged
+  CORE_LATENCY_STAGE_COUNT
+} core_latency_stage_t;
+
+typedef struct {
+  uint8_t  header[SLI_CPC_HDLC_HEADER_RAW_SIZE];
+  uint8_t  payload[];     // last two bytes are little endian 16bits
+}frame_t;
+
 /*
  * Internal state for the endpoints. Will be filled by cpc_register_endpoint()
  */
+/* Counters and histograms of an endpoint, for the statistics and the metrics.
+ * Allocated the first time the endpoint is opened, kept until the next open */
+typedef struct {
+  size_t transmit_queue_depth_max;
+  uint64_t transmit_queue_dequeued;
+  uint64_t transmit_queue_delay_total_us;
+  uint64_t transmit_queue_delay_max_us;
+  uint64_t txd_data_frames;  // Acknowledged, re-transmissions not included
+  uint64_t txd_data_bytes;
+  uint64_t rxd_data_frames;  // Delivered in sequence
+  uint64_t rxd_data_bytes;
+  uint64_t retxd_data_frames;
+  uint64_t txd_aggregated_messages; // Sent in the I-frames of others, see core_write()
+  uint64_t rxd_aggregated_messages;
+  uint64_t txd_compression_input_bytes;  // Payloads of the endpoint with compression, before
+  uint64_t txd_compression_output_bytes; // and after, the ones left as they were included
+  uint64_t rxd_compression_input_bytes;  // Payloads received compressed, before and after decompression
+  uint64_t rxd_compression_output_bytes;
+  loop_stats_histogram_t rtt;
+  loop_stats_histogram_t latency[CORE_LATENCY_STAGE_COUNT]; // With frame_latency_stats only
+} sl_cpc_endpoint_stats_t;
+
+/* Round trip time of the I-frames of an endpoint, modeled as a latency plus a
+ * time per byte sent. It is fitted on the exponentially weighted means,
+ * variance and covariance of the lengths and round trip times of the frames
+ * acknowledged without having been re-transmitted. */
+typedef struct {
+  uint32_t samples;
+  double mean_length;
+  double mean_rtt_us;
+  double length_variance;
+  double length_rtt_covariance;
+  double latency_us;    // Round trip time of an empty frame
+  double byte_time_us;  // Added per byte of the frame
+  double variation_us;  // Mean deviation of the samples from the model
+} sl_cpc_rtt_model_t;
+
+/*
+ * The fields are ordered by how often the frame path touches them: the first
+ * cache line holds what every frame sent or received reads, the second one the
+ * re-transmission state, then come the timers and the fields only used on open,
+ * close and poll/final exchanges. The counters are out of line, see stats.
+ */
 typedef struct endpoint {
   uint8_t id;
   uint8_t flags;
@@ -127,35 +263,77 @@ typedef struct endpoint {
   uint8_t current_tx_window_space;
   uint8_t frames_count_re_transmit_queue;
   uint8_t packet_re_transmit_count;
-  long    re_transmit_timeout_ms;
-  void*   re_transmit_timer_private_data;
   cpc_endpoint_state_t state;
-  sl_slist_node_t *re_transmit_queue;
-  sl_slist_node_t *holding_list;
-  sl_cpc_on_data_reception_t on_uframe_data_reception;
-  sl_cpc_on_data_reception_t on_iframe_data_reception;
-  sl_cpc_poll_final_t poll_final;
-  struct timespec last_iframe_sent_timestamp;
-  long smoothed_rtt;
-  long rtt_variation;
+  uint8_t tx_priority;
+  uint8_t tx_weight;
+  uint8_t ack_pending_count;    // Delayed ack mode, frames received and not acknowledged yet
+  bool selective_reject_pending;
+  bool fragmentation;           // Writes larger than a frame are accepted, see core_write()
+  bool compression;             // Payloads sent compressed when it shrinks them, see core_compress_frame()
 #if defined(ENABLE_ENCRYPTION)
   bool encrypted;
   uint32_t frame_counter_tx;
   uint32_t frame_counter_rx;
+  uint32_t crypto_pending_count; // Frames with the crypto worker, the next ones follow them there
 #endif
-}sl_cpc_endpoint_t;
+  sl_queue_t transmit_queue; // Frames ready to be scheduled for transmission
+  sl_cpc_on_data_reception_t on_iframe_data_reception;
+
+  sl_queue_t re_transmit_queue;
+  sl_queue_t holding_list;
+  sl_cpc_endpoint_stats_t *stats; // NULL until the endpoint is opened
+  long    re_transmit_timeout_ms; // The one the re-transmit timer was last armed with
+  uint8_t re_transmit_backoff;    // Doublings of the timeout since the last RTT sample
+
+  sl_cpc_rtt_model_t rtt;
+  uint16_t min_re_transmit_timeout_ms; // Protocol parameters, the daemon-wide ones on open
+  uint16_t max_re_transmit_timeout_ms;
+  uint8_t max_re_transmit;
+  epoll_timer_t re_transmit_timer;
+  struct timespec re_transmit_timer_offset; // Start deferred to the end of the tx completes, see start_re_transmit_timer()
+  bool re_transmit_timer_deferred;
+  epoll_timer_t ack_timer;      // Delayed ack mode, deadline of the pending ack
+  frame_t *out_of_order_frames[8]; // Selective reject mode, in-window frames received ahead of ack, by seq
+  sl_cpc_on_data_reception_t on_uframe_data_reception;
+  sl_cpc_poll_final_t poll_final;
+  uint8_t *rx_fragments;        // Message being reassembled, allocated on the first fragment received
+  size_t rx_fragments_length;
+  uint32_t aggregation_deadline_us; // Small writes wait this long for others to share their I-frame, 0 if they don't
+  uint16_t tx_aggregate_length;
+  uint16_t tx_aggregate_count;
+  frame_t *tx_aggregate;        // Messages waiting to be sent together, NULL if none
+  epoll_timer_t aggregation_timer;
+  uint16_t rx_aggregate_delivered; // Messages of an aggregate pushed before one would block, skipped once it is received again
+} __attribute__((aligned(64))) sl_cpc_endpoint_t;
 
 typedef struct {
   uint32_t frame_counter;
 } sl_cpc_security_frame_t;
 
+/* When the stages of a data frame ended, in loop_stats_now_ns() time. Set
+ * with frame_latency_stats only, written_ns is 0 if the frame is not measured */
 typedef struct {
+  uint64_t written_ns;     // Handed to the core by the server
+  uint64_t dequeued_ns;    // Popped from the Tx Q
+  uint64_t pushed_ns;      // Pushed to the driver, built and sealed
+  uint64_t tx_complete_ns; // Reported written on the bus by the driver
+} sl_cpc_frame_timestamps_t;
+
+/*
+ * A frame is built once, in place, in a single contiguous buffer:
+ *   | HDLC header | payload | security tag (if encrypted) | FCS |
+ * hdlc_header and data point inside that buffer. Once built, frame_length is
+ * set and re-transmissions send the very same bytes.
+ */
+typedef struct {
+  frame_t *frame;
+  size_t frame_length;
   void *hdlc_header;
   const void *data;
   uint16_t data_length;
-  uint8_t fcs[2];
   uint8_t control;
   uint8_t address;
+  uint8_t system_command_seq; // System endpoint only, the payload may be encrypted once built
   sl_cpc_endpoint_t *endpoint;
 #if defined(ENABLE_ENCRYPTION)
   bool security_session_last_packet;
@@ -164,16 +342,19 @@ typedef struct {
   uint8_t pending_ack;
   bool acked;
   bool pending_tx_complete;
+  bool selective_re_transmit_queued; // Also referenced from the Tx Q, on top of the re-transmit queue
+  bool re_transmitted;               // Its ack gives no RTT sample, see core_update_rtt_model()
+  struct timespec sent_timestamp;    // Tx complete of its last transmission
+  bool prebuilt_frame;               // Points to a shared supervisory frame, not to one from the pool
+  bool aggregated;                   // Flagged as such in its header, see core_flush_aggregate()
+  bool compressed;                   // Same, see core_compress_frame()
+  sl_cpc_frame_timestamps_t timestamps;
 } sl_cpc_buffer_handle_t;
 
 typedef struct {
   sl_slist_node_t node;
   sl_cpc_buffer_handle_t *handle;
+  struct timespec enqueue_timestamp;
 } sl_cpc_transmit_queue_item_t;
 
-typedef struct {
-  uint8_t  header[SLI_CPC_HDLC_HEADER_RAW_SIZE];
-  uint8_t  payload[];     // last two bytes are little endian 16bits
-}frame_t;
-
 #endif
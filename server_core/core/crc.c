@@ -15,14 +15,57 @@
  *
  ******************************************************************************/
 
+#include <pthread.h>
+
 #include "crc.h"
 
+#define SLI_CPC_CRC_SLICE_COUNT 8u
+
 static uint16_t sli_cpc_compute_crc16(uint8_t new_byte, uint16_t prev_result);
+static void sli_cpc_crc_init_tables(void);
+
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+// crc_tables[k][x] is the CRC of the byte x followed by k zero bytes
+static uint16_t crc_tables[SLI_CPC_CRC_SLICE_COUNT][256];
 
 /***************************************************************************//**
- * Computes CRC-16 CCITT (XMODEM) on given buffer. Software implementation.
+ * Computes CRC-16 CCITT (XMODEM) on given buffer. Software implementation,
+ * slice-by-8 table driven.
  ******************************************************************************/
 uint16_t sli_cpc_get_crc_sw(const void* buffer, uint16_t buffer_length)
+{
+  const uint8_t *data = (const uint8_t *)buffer;
+  uint16_t crc = 0;
+
+  pthread_once(&crc_tables_once, sli_cpc_crc_init_tables);
+
+  while (buffer_length >= SLI_CPC_CRC_SLICE_COUNT) {
+    crc = (uint16_t)(crc_tables[7][(uint8_t)(data[0] ^ (crc >> 8))]
+                     ^ crc_tables[6][(uint8_t)(data[1] ^ crc)]
+                     ^ crc_tables[5][data[2]]
+                     ^ crc_tables[4][data[3]]
+                     ^ crc_tables[3][data[4]]
+                     ^ crc_tables[2][data[5]]
+                     ^ crc_tables[1][data[6]]
+                     ^ crc_tables[0][data[7]]);
+
+    data += SLI_CPC_CRC_SLICE_COUNT;
+    buffer_length = (uint16_t)(buffer_length - SLI_CPC_CRC_SLICE_COUNT);
+  }
+
+  while (buffer_length--) {
+    crc = (uint16_t)((crc << 8) ^ crc_tables[0][(uint8_t)((crc >> 8) ^ *data++)]);
+  }
+
+  return crc;
+}
+
+/***************************************************************************//**
+ * Computes CRC-16 CCITT (XMODEM) on given buffer. Reference implementation,
+ * one byte at a time.
+ ******************************************************************************/
+uint16_t sli_cpc_get_crc_ref(const void* buffer, uint16_t buffer_length)
 {
   uint16_t i;
   uint16_t crc = 0;
@@ -46,6 +89,30 @@ bool sli_cpc_validate_crc_sw(const void* buffer, uint16_t buffer_length, uint16_
   return (computed_crc == expected_crc);
 }
 
+/***************************************************************************//**
+ * Builds the slice-by-8 tables from the reference implementation. Both the core
+ * and the driver threads compute CRCs, hence the pthread_once guard.
+ ******************************************************************************/
+static void sli_cpc_crc_init_tables(void)
+{
+  unsigned int i;
+  unsigned int k;
+
+  for (i = 0; i < 256; i++) {
+    // CRC of the byte i with a zero initial value
+    crc_tables[0][i] = sli_cpc_compute_crc16((uint8_t)i, 0);
+  }
+
+  for (k = 1; k < SLI_CPC_CRC_SLICE_COUNT; k++) {
+    for (i = 0; i < 256; i++) {
+      uint16_t prev = crc_tables[k - 1][i];
+
+      // Feed one more zero byte
+      crc_tables[k][i] = (uint16_t)((prev << 8) ^ crc_tables[0][prev >> 8]);
+    }
+  }
+}
+
 static uint16_t sli_cpc_compute_crc16(uint8_t new_byte, uint16_t prev_result)
 {
   prev_result = ((uint16_t) (prev_result >> 8)) | ((uint16_t) (prev_result << 8));
@@ -31,6 +31,17 @@
  ******************************************************************************/
 uint16_t sli_cpc_get_crc_sw(const void* buffer, uint16_t buffer_length);
 
+/***************************************************************************//**
+ * Computes CRC-16 CCITT on given buffer. Bit-wise reference implementation,
+ * one byte at a time. Slower than sli_cpc_get_crc_sw, kept to cross-check it.
+ *
+ * @param buffer Pointer to the buffer on which the CRC must be computed.
+ * @param buffer_length Length of the buffer, in bytes.
+ *
+ * @return CRC value.
+ ******************************************************************************/
+uint16_t sli_cpc_get_crc_ref(const void* buffer, uint16_t buffer_length);
+
 /***************************************************************************//**
  * Validates CRC-16 CCITT on given buffer. Software implementation.
  *
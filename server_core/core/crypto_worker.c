@@ -0,0 +1,228 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Crypto worker
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "server_core/core/crypto_worker.h"
+#include "misc/thread.h"
+#include "misc/logging.h"
+#include "misc/shm_ring.h"
+#include "misc/sleep.h"
+
+/*
+ * The frames the core hands over are bounded by the tx windows of the
+ * endpoints, these hold many times that many jobs.
+ */
+#define CRYPTO_WORKER_RING_SIZE  (64u * 1024u)
+
+typedef struct {
+  shm_ring_t ring;
+  int fd_doorbell;  // Rung by the producer when the ring was empty
+  int fd_room;      // Rung by the consumer when the producer waits for room
+} crypto_worker_ring_t;
+
+typedef struct {
+  void *job;
+  sl_status_t status;
+} crypto_worker_finished_t;
+
+static crypto_worker_ring_t to_worker;
+static crypto_worker_ring_t finished;
+static crypto_worker_job_func_t job_func;
+static pthread_t worker_thread;
+static bool enabled;
+
+static uint64_t submitted_count;        // Written by the core only
+static volatile uint64_t finished_count; // Written by the worker only
+
+static void crypto_worker_ring(int fd)
+{
+  const uint64_t event_value = 1;
+  ssize_t ret;
+
+  ret = write(fd, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret != sizeof(event_value));
+}
+
+static void crypto_worker_clear(int fd)
+{
+  uint64_t event_value;
+  ssize_t ret;
+
+  ret = read(fd, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret < 0 && errno != EAGAIN);
+}
+
+static void crypto_worker_wait(int fd)
+{
+  struct pollfd pollfd = { .fd = fd, .events = POLLIN };
+
+  if (poll(&pollfd, 1, -1) < 0) {
+    FATAL_SYSCALL_ON(errno != EINTR);
+  }
+}
+
+static void crypto_worker_alloc(crypto_worker_ring_t *ring)
+{
+  size_t footprint = shm_ring_footprint(CRYPTO_WORKER_RING_SIZE);
+  void *base = aligned_alloc(64, (footprint + 63u) & ~(size_t)63u);
+  FATAL_ON(base == NULL);
+
+  shm_ring_attach(&ring->ring, base, CRYPTO_WORKER_RING_SIZE, true);
+
+  ring->fd_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(ring->fd_doorbell < 0);
+
+  ring->fd_room = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(ring->fd_room < 0);
+}
+
+/* Blocks until the message fits, the consumer rings fd_room once it made some */
+static void crypto_worker_push(crypto_worker_ring_t *ring, const void *message, size_t length)
+{
+  bool was_empty;
+
+  while (!shm_ring_push(&ring->ring, message, (uint32_t)length, &was_empty)) {
+    /* Either the consumer sees the flag, or the second attempt sees the room it made */
+    shm_ring_set_producer_waiting(&ring->ring);
+    if (shm_ring_push(&ring->ring, message, (uint32_t)length, &was_empty)) {
+      break;
+    }
+
+    crypto_worker_wait(ring->fd_room);
+    crypto_worker_clear(ring->fd_room);
+  }
+
+  if (was_empty) {
+    crypto_worker_ring(ring->fd_doorbell);
+  }
+}
+
+/*
+ * The doorbell is cleared before popping, and rung again if messages are left
+ * behind, so that the level-triggered epoll entry of the core stays ready
+ * while the ring is not empty.
+ */
+static bool crypto_worker_pop(crypto_worker_ring_t *ring, void *message, size_t length)
+{
+  ssize_t ret;
+
+  crypto_worker_clear(ring->fd_doorbell);
+
+  ret = shm_ring_pop(&ring->ring, message, length);
+
+  /* The ring never leaves the process, a corrupted one is a bug */
+  BUG_ON(ret < 0 || (ret != 0 && (size_t)ret != length));
+
+  if (shm_ring_take_producer_waiting(&ring->ring)) {
+    crypto_worker_ring(ring->fd_room);
+  }
+
+  if (!shm_ring_is_empty(&ring->ring)) {
+    crypto_worker_ring(ring->fd_doorbell);
+  }
+
+  return ret != 0;
+}
+
+static void* crypto_worker_thread_func(void* param)
+{
+  (void)param;
+
+  while (1) {
+    crypto_worker_finished_t done;
+
+    crypto_worker_wait(to_worker.fd_doorbell);
+
+    while (crypto_worker_pop(&to_worker, &done.job, sizeof(done.job))) {
+      done.status = job_func(done.job);
+
+      crypto_worker_push(&finished, &done, sizeof(done));
+      __atomic_store_n(&finished_count, finished_count + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+bool crypto_worker_is_enabled(void)
+{
+  return enabled;
+}
+
+int crypto_worker_init(crypto_worker_job_func_t func)
+{
+  int ret;
+
+  BUG_ON(enabled);
+
+  job_func = func;
+
+  crypto_worker_alloc(&to_worker);
+  crypto_worker_alloc(&finished);
+
+  ret = thread_create(&worker_thread, config.security_sched, crypto_worker_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(worker_thread, "crypto_worker");
+  FATAL_ON(ret != 0);
+
+  enabled = true;
+
+  PRINT_INFO("Frames to the secondary are encrypted on a worker thread");
+
+  return finished.fd_doorbell;
+}
+
+void crypto_worker_submit(void *job)
+{
+  BUG_ON(!enabled);
+
+  submitted_count++;
+  crypto_worker_push(&to_worker, &job, sizeof(job));
+}
+
+void *crypto_worker_pop_finished(sl_status_t *status)
+{
+  crypto_worker_finished_t done;
+
+  BUG_ON(!enabled);
+
+  if (!crypto_worker_pop(&finished, &done, sizeof(done))) {
+    return NULL;
+  }
+
+  *status = done.status;
+
+  return done.job;
+}
+
+void crypto_worker_wait_idle(void)
+{
+  BUG_ON(!enabled);
+
+  while (__atomic_load_n(&finished_count, __ATOMIC_ACQUIRE) != submitted_count) {
+    sleep_ms(1);
+  }
+}
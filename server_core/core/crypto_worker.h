@@ -0,0 +1,55 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol (CPC) - Crypto worker
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef CRYPTO_WORKER_H
+#define CRYPTO_WORKER_H
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+
+#include "misc/sl_status.h"
+
+/*
+ * With config.crypto_worker, the core hands the frames to encrypt over to a
+ * worker thread once their header is built and their frame counter taken,
+ * and gets them back, in the order it handed them, ready to be sent. Jobs go
+ * both ways through in-process single producer, single consumer rings, the
+ * core waits on the doorbell returned by crypto_worker_init() for finished
+ * ones like it does on the driver sockets.
+ *
+ * A single worker keeps the frames in order, and the encryption of the frames
+ * to the secondary is serialized on the primary nonce anyway.
+ */
+
+/* Runs on the worker thread, for each job handed over */
+typedef sl_status_t (*crypto_worker_job_func_t)(void *job);
+
+bool crypto_worker_is_enabled(void);
+
+/* Starts the worker thread, returns the doorbell rung when jobs are finished */
+int crypto_worker_init(crypto_worker_job_func_t job_func);
+
+/* Core side, blocks while the worker is that far behind */
+void crypto_worker_submit(void *job);
+
+/* Core side, returns NULL if no job is finished, otherwise the job and what the job function returned */
+void *crypto_worker_pop_finished(sl_status_t *status);
+
+/* Core side, blocks until every job submitted is finished */
+void crypto_worker_wait_idle(void);
+
+#endif //CRYPTO_WORKER_H
@@ -15,9 +15,26 @@
  *
  ******************************************************************************/
 
+#include <pthread.h>
+
 #include "hdlc.h"
 #include "crc.h"
 
+#define SLI_CPC_HDLC_ADDRESS_COUNT               256u
+#define SLI_CPC_HDLC_SUPERVISORY_FUNCTION_COUNT  4u
+#define SLI_CPC_HDLC_ACK_COUNT                   8u
+#define SLI_CPC_HDLC_REJECT_REASON_COUNT         (HDLC_REJECT_ERROR + 1u)
+
+static void hdlc_init_supervisory_frames(void);
+
+static pthread_once_t supervisory_frames_once = PTHREAD_ONCE_INIT;
+
+// The header of every supervisory frame, indexed by address, function and ack
+static uint8_t supervisory_headers[SLI_CPC_HDLC_ADDRESS_COUNT][SLI_CPC_HDLC_SUPERVISORY_FUNCTION_COUNT][SLI_CPC_HDLC_ACK_COUNT][SLI_CPC_HDLC_HEADER_RAW_SIZE];
+
+// The payload of a reject, its reason followed by the FCS, indexed by reason
+static uint8_t reject_payloads[SLI_CPC_HDLC_REJECT_REASON_COUNT][SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE + SLI_CPC_HDLC_FCS_SIZE];
+
 void hdlc_create_header(uint8_t *header_buf,
                         uint8_t address,
                         uint16_t length,
@@ -43,3 +60,58 @@ void hdlc_create_header(uint8_t *header_buf,
     header_buf[6] = hcs_union.bytes[1];
   }
 }
+
+const uint8_t* hdlc_get_supervisory_header(uint8_t address, uint8_t control)
+{
+  pthread_once(&supervisory_frames_once, hdlc_init_supervisory_frames);
+
+  return supervisory_headers[address][hdlc_get_supervisory_function(control)][hdlc_get_ack(control)];
+}
+
+const uint8_t* hdlc_get_reject_payload(sl_cpc_reject_reason_t reason)
+{
+  pthread_once(&supervisory_frames_once, hdlc_init_supervisory_frames);
+
+  if (reason >= SLI_CPC_HDLC_REJECT_REASON_COUNT) {
+    reason = HDLC_REJECT_ERROR;
+  }
+
+  return reject_payloads[reason];
+}
+
+/***************************************************************************//**
+ * Builds the supervisory headers and the reject payloads, on their first use
+ * from any thread, hence the pthread_once guard.
+ ******************************************************************************/
+static void hdlc_init_supervisory_frames(void)
+{
+  unsigned int address;
+  uint8_t function;
+  uint8_t ack;
+  uint8_t reason;
+
+  for (address = 0; address < SLI_CPC_HDLC_ADDRESS_COUNT; address++) {
+    for (function = 0; function < SLI_CPC_HDLC_SUPERVISORY_FUNCTION_COUNT; function++) {
+      // Only a reject carries a payload
+      uint16_t length = (function == SLI_CPC_HDLC_REJECT_SUPERVISORY_FUNCTION)
+                        ? SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE + SLI_CPC_HDLC_FCS_SIZE : 0;
+
+      for (ack = 0; ack < SLI_CPC_HDLC_ACK_COUNT; ack++) {
+        hdlc_create_header(supervisory_headers[address][function][ack],
+                           (uint8_t)address,
+                           length,
+                           hdlc_create_control_supervisory(ack, function),
+                           true);
+      }
+    }
+  }
+
+  for (reason = 0; reason < SLI_CPC_HDLC_REJECT_REASON_COUNT; reason++) {
+    uint16_u fcs_union;
+
+    reject_payloads[reason][0] = reason;
+    fcs_union.uint16 = cpu_to_le16(sli_cpc_get_crc_sw(&reject_payloads[reason][0], SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE));
+    reject_payloads[reason][1] = fcs_union.bytes[0];
+    reject_payloads[reason][2] = fcs_union.bytes[1];
+  }
+}
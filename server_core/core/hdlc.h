@@ -22,6 +22,7 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "sl_cpc.h"
 #include "misc/endianess.h"
@@ -37,6 +38,13 @@
 #define SLI_CPC_HDLC_CONTROL_POS 4
 #define SLI_CPC_HDLC_HCS_POS     5
 
+// Top bits of the length field, flags of the I-frames. Frames are under 16 KiB,
+// the length is the 14 other bits.
+#define SLI_CPC_HDLC_LENGTH_AGGREGATED  0x8000U // Carries several messages, see core_write()
+#define SLI_CPC_HDLC_LENGTH_COMPRESSED  0x4000U // Payload compressed, see core_compress_frame()
+#define SLI_CPC_HDLC_LENGTH_FLAGS       (SLI_CPC_HDLC_LENGTH_AGGREGATED | SLI_CPC_HDLC_LENGTH_COMPRESSED)
+#define SLI_CPC_HDLC_LENGTH_MAX         0x3FFFU
+
 #define SLI_CPC_HDLC_FRAME_TYPE_INFORMATION  0
 #define SLI_CPC_HDLC_FRAME_TYPE_SUPERVISORY  2
 #define SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED   3
@@ -60,8 +68,15 @@
 #define SLI_CPC_HDLC_REJECT_SUPERVISORY_FUNCTION   1
 #define SLI_CPC_HDLC_REJECT_PAYLOAD_SIZE  1
 
+// Requests the re-transmission of the single frame whose seq is the ack field
+#define SLI_CPC_HDLC_SELECTIVE_REJECT_SUPERVISORY_FUNCTION   3
+
 #define SLI_CPC_HDLC_FCS_SIZE 2
 
+// Most frames the core hands to a driver at once. A tx complete notification
+// from a driver carries one sl_cpc_tx_complete_t per frame, in transmission order.
+#define SLI_CPC_DRIVER_TX_BATCH_SIZE 16
+
 SL_ENUM(sl_cpc_reject_reason_t){
   HDLC_REJECT_NO_ERROR = 0,
   HDLC_REJECT_CHECKSUM_MISMATCH,
@@ -77,6 +92,14 @@ typedef union {
   uint16_t uint16;
 }uint16_u;
 
+// The completion of a frame sent by a driver. A driver numbers the frames from
+// 0, in the order the core handed them over, the core checks the records
+// against the frames it is waiting on.
+typedef struct {
+  uint32_t frame_id;
+  struct timespec timestamp;
+} sl_cpc_tx_complete_t;
+
 /***************************************************************************//**
  * Gets HDLC header flag value.
  *
@@ -115,7 +138,45 @@ static inline uint16_t hdlc_get_length(const uint8_t *header_buf)
   u.bytes[0] = header_buf[SLI_CPC_HDLC_LENGTH_POS];
   u.bytes[1] = header_buf[SLI_CPC_HDLC_LENGTH_POS + 1];
 
-  return le16_to_cpu(u.uint16);
+  return (uint16_t)(le16_to_cpu(u.uint16) & ~SLI_CPC_HDLC_LENGTH_FLAGS);
+}
+
+/***************************************************************************//**
+ * Gets the flags of the HDLC header length field.
+ *
+ * @param header_buf Pointer to the buffer that contains the HDLC header.
+ *
+ * @return SLI_CPC_HDLC_LENGTH_FLAGS bits of the length field.
+ ******************************************************************************/
+static inline uint16_t hdlc_get_length_flags(const uint8_t *header_buf)
+{
+  return (uint16_t)((header_buf[SLI_CPC_HDLC_LENGTH_POS + 1] << 8) & SLI_CPC_HDLC_LENGTH_FLAGS);
+}
+
+/***************************************************************************//**
+ * Gets whether the payload of an I-frame is made of several messages, each
+ * prefixed with its length on 16 bits, little endian.
+ *
+ * @param header_buf Pointer to the buffer that contains the HDLC header.
+ *
+ * @return true if the frame is aggregated.
+ ******************************************************************************/
+static inline bool hdlc_is_aggregated(const uint8_t *header_buf)
+{
+  return (hdlc_get_length_flags(header_buf) & SLI_CPC_HDLC_LENGTH_AGGREGATED) != 0;
+}
+
+/***************************************************************************//**
+ * Gets whether the payload of an I-frame is an LZ4 block, to be decompressed
+ * once decrypted.
+ *
+ * @param header_buf Pointer to the buffer that contains the HDLC header.
+ *
+ * @return true if the frame is compressed.
+ ******************************************************************************/
+static inline bool hdlc_is_compressed(const uint8_t *header_buf)
+{
+  return (hdlc_get_length_flags(header_buf) & SLI_CPC_HDLC_LENGTH_COMPRESSED) != 0;
 }
 
 /***************************************************************************//**
@@ -261,6 +322,26 @@ void hdlc_create_header(uint8_t *header_buf,
                         uint8_t control,
                         bool compute_crc);
 
+/***************************************************************************//**
+ * Gets the prebuilt header of a supervisory frame, HCS included. The table is
+ * built once, on the first call.
+ *
+ * @param address Address value.
+ * @param control Supervisory control value, see hdlc_create_control_supervisory().
+ *
+ * @return Pointer to the header, shared and never to be written.
+ ******************************************************************************/
+const uint8_t* hdlc_get_supervisory_header(uint8_t address, uint8_t control);
+
+/***************************************************************************//**
+ * Gets the prebuilt payload of a reject frame: the reason followed by its FCS.
+ *
+ * @param reason Reject reason.
+ *
+ * @return Pointer to the payload, shared and never to be written.
+ ******************************************************************************/
+const uint8_t* hdlc_get_reject_payload(sl_cpc_reject_reason_t reason);
+
 /***************************************************************************//**
  * Creates header control value data frame type.
  *
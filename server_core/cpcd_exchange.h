@@ -20,6 +20,7 @@
 
 #include "lib/sl_cpc.h"
 #include "misc/sl_status.h"
+#include "version.h"
 
 /* NOTE: New exchange types must be added to the end of the enum to prevent
  *       an incompatibility between older library versions */
@@ -35,7 +36,19 @@ SL_ENUM_GENERIC(cpcd_exchange_type_t, uint8_t)
   EXCHANGE_SECONDARY_APP_VERSION_STRING_QUERY,
   EXCHANGE_SECONDARY_APP_VERSION_SIZE_QUERY,
   EXCHANGE_OPEN_ENDPOINT_EVENT_SOCKET_QUERY,
-  EXCHANGE_NORMAL_OPERATION_MODE_QUERY
+  EXCHANGE_NORMAL_OPERATION_MODE_QUERY,
+  EXCHANGE_SET_ENDPOINT_TX_PRIORITY_QUERY,
+  EXCHANGE_OPEN_SHM_TRANSPORT_QUERY,
+  EXCHANGE_ENDPOINT_TX_CREDIT_QUERY,
+  EXCHANGE_METRICS_QUERY,
+  EXCHANGE_TRACE_MASK_QUERY,
+  EXCHANGE_INIT_QUERY,
+  EXCHANGE_PROTOCOL_PARAMETER_QUERY,
+  EXCHANGE_SET_ENDPOINT_FRAGMENTATION_QUERY,
+  EXCHANGE_STATE_TABLE_QUERY,
+  EXCHANGE_SET_ENDPOINT_AGGREGATION_QUERY,
+  EXCHANGE_SET_ENDPOINT_COMPRESSION_QUERY,
+  EXCHANGE_FLIGHT_RECORDER_QUERY
 };
 
 typedef struct {
@@ -44,4 +57,116 @@ typedef struct {
   uint8_t payload[];
 } cpcd_exchange_buffer_t;
 
+/* Payload of EXCHANGE_OPEN_SHM_TRANSPORT_QUERY. When accepted, the reply carries
+ * the memfds holding the rings and the three doorbell eventfds, in the order of
+ * cpcd_exchange_shm_transport_fd_t */
+typedef struct {
+  int data_socket;     // Server side data socket of the connection, as received on open
+  uint32_t ring_size;  // Size of each ring, 0 if the daemon refused
+  uint32_t overwrites; // Non-zero if the broadcast ring overwrites messages a lagging client has yet to read
+} cpcd_exchange_shm_transport_t;
+
+/* Payload of EXCHANGE_METRICS_QUERY. The reply has the length of the query, the
+ * snapshot fills the rest of it and length is the one of the whole snapshot,
+ * which was truncated if it is not smaller than the room the client left */
+typedef struct {
+  uint32_t format; // cpc_metrics_format_t
+  uint32_t length;
+  char text[];
+} cpcd_exchange_metrics_t;
+
+/* Payload of EXCHANGE_TRACE_MASK_QUERY. The mask is applied first when set is
+ * non-zero, the reply carries the mask of the level in effect */
+typedef struct {
+  uint8_t level; // cpc_trace_level_t
+  uint8_t set;
+  uint8_t reserved[2];
+  uint32_t mask;
+} cpcd_exchange_trace_mask_t;
+
+/* Payload of EXCHANGE_PROTOCOL_PARAMETER_QUERY, on the endpoint of the query,
+ * or daemon-wide on endpoint 0. The value is applied first when set is non-zero,
+ * the reply carries the value in effect and the status, 0 or -errno */
+typedef struct {
+  uint8_t parameter; // cpc_protocol_parameter_t
+  uint8_t set;
+  uint8_t reserved[2];
+  int32_t status;
+  uint32_t value;
+} cpcd_exchange_protocol_parameter_t;
+
+/* Payload of EXCHANGE_SET_ENDPOINT_FRAGMENTATION_QUERY. The reply carries whether
+ * it is enabled and the largest write the endpoint accepts from then on */
+typedef struct {
+  uint8_t enable;
+  uint8_t reserved[3];
+  uint32_t max_write_size;
+} cpcd_exchange_fragmentation_t;
+
+/* Payload of EXCHANGE_SET_ENDPOINT_AGGREGATION_QUERY. The reply carries the
+ * deadline applied, 0 if the secondary doesn't support aggregation */
+typedef struct {
+  uint32_t deadline_us;
+} cpcd_exchange_aggregation_t;
+
+/* Payload of EXCHANGE_SET_ENDPOINT_COMPRESSION_QUERY. The reply carries whether
+ * it is enabled */
+typedef struct {
+  uint8_t enable;
+  uint8_t reserved[3];
+} cpcd_exchange_compression_t;
+
+/* Payload of EXCHANGE_FLIGHT_RECORDER_QUERY. The reply has the length of the
+ * query, status is 0 or -errno and the name of the file the flight recorder was
+ * written to fills the rest of it, NUL terminated and possibly truncated */
+typedef struct {
+  int32_t status;
+  char path[];
+} cpcd_exchange_flight_recorder_t;
+
+/* Payload of EXCHANGE_INIT_QUERY, what the version, set pid, normal operation
+ * mode, max write size and secondary app version queries return, in one round
+ * trip. The client sends its version and pid. The reply has the length of the
+ * query, app_version fills the rest of it and app_version_length is the one of
+ * the whole string, which was truncated if it is larger than the room the
+ * client left. On a version mismatch, only the version is set and the daemon
+ * closes the connection. */
+typedef struct {
+  char version[PROJECT_MAX_VERSION_SIZE];
+  pid_t pid;
+  uint32_t max_write_size;
+  uint16_t app_version_length;
+  uint8_t can_connect;
+  uint8_t normal_operation_mode;
+  char app_version[];
+} cpcd_exchange_init_t;
+
+/* Payload of EXCHANGE_STATE_TABLE_QUERY. When size is not 0, the reply carries
+ * the memfd holding a cpcd_exchange_state_table_t of that size */
+typedef struct {
+  uint32_t size;
+} cpcd_exchange_state_table_query_t;
+
+/* What the state, encryption and max write size queries return, kept up to date
+ * by the daemon and mapped read-only by the clients. The sequence is odd while
+ * the daemon updates the table, a client retries a read during which it was odd
+ * or changed. reset_count is incremented when the secondary reset: the daemon
+ * restarts then, and the table is no longer updated. */
+typedef struct {
+  volatile uint32_t sequence;
+  volatile uint32_t reset_count;
+  volatile uint32_t max_write_size;
+  volatile uint8_t endpoint_state[256];     // cpc_endpoint_state_t
+  volatile uint8_t endpoint_encrypted[256];
+} cpcd_exchange_state_table_t;
+
+typedef enum {
+  SHM_TRANSPORT_FD_MEMFD,           // Client to daemon ring, followed by the cursor of the client in the broadcast ring
+  SHM_TRANSPORT_FD_BROADCAST_MEMFD, // Daemon to clients ring of the endpoint, shared by its clients and read-only for them
+  SHM_TRANSPORT_FD_DAEMON_DOORBELL, // Rung by the client when its ring becomes non-empty
+  SHM_TRANSPORT_FD_RX_DOORBELL,     // Rung by the daemon when the broadcast ring becomes non-empty for the client
+  SHM_TRANSPORT_FD_TX_DOORBELL,     // Rung by the daemon when it frees space for a waiting client
+  SHM_TRANSPORT_FD_COUNT
+} cpcd_exchange_shm_transport_fd_t;
+
 #endif //CPCD_EXCHANGE_H
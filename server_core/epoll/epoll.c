@@ -15,36 +15,67 @@
  *
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include "epoll.h"
+#include "timer.h"
+#include "loop_stats.h"
+#include "misc/busy_poll.h"
 #include "misc/logging.h"
+#include "misc/memlock.h"
+#include "misc/mempool.h"
 #include "misc/sl_slist.h"
 #include "misc/utils.h"
 #include "server_core/core/core.h"
 #include "server_core/server/server.h"
+#include "server_core/server/server_io.h"
+#if defined(ENABLE_IO_URING)
+#include "server_core/epoll/epoll_uring.h"
+#endif
 
 #include <sys/epoll.h>
+#include <sys/socket.h>
 #include <string.h>
 #include <errno.h>
 
+/* Data sockets unwatched at a time, in the deterministic memory mode */
+#define EPOLL_UNWATCHED_POOL_SIZE 64u
+
 typedef struct {
   sl_slist_node_t node;
   struct epoll_private_data* unregistered_epoll_private_data;
 }unwatched_endpoint_list_item_t;
 
-/* List to keep track of every connected library instance over the control socket */
-static sl_slist_node_t *unwatched_endpoint_list;
+static struct {
+  /* List to keep track of every connected library instance over the control socket */
+  sl_slist_node_t *unwatched_endpoint_list;
+  mempool_t unwatched_item_pool;
 
-static int fd_epoll;
+  int fd_epoll;
+
+#if defined(ENABLE_IO_URING)
+  bool use_io_uring;
+#endif
+} epoll;
 
 void epoll_init(void)
 {
+#if defined(ENABLE_IO_URING)
+  epoll.use_io_uring = epoll_uring_init();
+  if (!epoll.use_io_uring)
+#endif
   /* Create the epoll set */
   {
-    fd_epoll = epoll_create1(EPOLL_CLOEXEC);
-    FATAL_SYSCALL_ON(fd_epoll < 0);
+    epoll.fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    FATAL_SYSCALL_ON(epoll.fd_epoll < 0);
   }
 
-  sl_slist_init(&unwatched_endpoint_list);
+  sl_slist_init(&epoll.unwatched_endpoint_list);
+
+  /* Flow control unwatches the data sockets of the clients on the frame path */
+  if (memlock_is_enabled()) {
+    mempool_init(&epoll.unwatched_item_pool, sizeof(unwatched_endpoint_list_item_t), EPOLL_UNWATCHED_POOL_SIZE);
+  }
 }
 
 void epoll_register(epoll_private_data_t *private_data)
@@ -56,13 +87,49 @@ void epoll_register(epoll_private_data_t *private_data)
   FATAL_ON(private_data->callback == NULL);
   FATAL_ON(private_data->file_descriptor < 1);
 
-  event.events = EPOLLIN; /* Level-triggered read() availability */
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    epoll_uring_add(private_data);
+    return;
+  }
+#endif
+
+  event.events = EPOLLIN | private_data->events; /* Level-triggered read() availability */
   event.data.ptr = private_data;
 
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_ADD, private_data->file_descriptor, &event);
+  ret = epoll_ctl(epoll.fd_epoll, EPOLL_CTL_ADD, private_data->file_descriptor, &event);
   FATAL_SYSCALL_ON(ret < 0);
 }
 
+void epoll_register_recv(epoll_private_data_t *private_data, size_t buffer_size)
+{
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    FATAL_ON(private_data == NULL);
+    FATAL_ON(private_data->callback == NULL);
+    FATAL_ON(private_data->file_descriptor < 1);
+
+    epoll_uring_add_recv(private_data, buffer_size);
+    return;
+  }
+#endif
+
+  (void)buffer_size;
+
+  epoll_register(private_data);
+}
+
+int epoll_recvmmsg(epoll_private_data_t *private_data, struct mmsghdr *msgs, unsigned int vlen)
+{
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    return epoll_uring_recvmmsg(private_data, msgs, vlen);
+  }
+#endif
+
+  return recvmmsg(private_data->file_descriptor, msgs, vlen, MSG_DONTWAIT, NULL);
+}
+
 void epoll_unregister(epoll_private_data_t *private_data)
 {
   int ret;
@@ -75,18 +142,25 @@ void epoll_unregister(epoll_private_data_t *private_data)
   /* Before unregistering, check if this private data if for an endpoint
    * that was previously unwatched. If so, delete it from the unwatch list
    * but don't call epoll_ctl::EPOLL_CTL_DEL on it since it was already deleted */
-  SL_SLIST_FOR_EACH_ENTRY(unwatched_endpoint_list,
+  SL_SLIST_FOR_EACH_ENTRY(epoll.unwatched_endpoint_list,
                           item,
                           unwatched_endpoint_list_item_t,
                           node){
     if (private_data == item->unregistered_epoll_private_data) {
-      sl_slist_remove(&unwatched_endpoint_list, &item->node);
-      free(item);
+      sl_slist_remove(&epoll.unwatched_endpoint_list, &item->node);
+      mempool_free(&epoll.unwatched_item_pool, item);
       return;
     }
   }
 
-  ret = epoll_ctl(fd_epoll, EPOLL_CTL_DEL, private_data->file_descriptor, NULL);
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    epoll_uring_del(private_data);
+    return;
+  }
+#endif
+
+  ret = epoll_ctl(epoll.fd_epoll, EPOLL_CTL_DEL, private_data->file_descriptor, NULL);
 
   FATAL_SYSCALL_ON(ret < 0);
 }
@@ -95,22 +169,24 @@ void epoll_unwatch(epoll_private_data_t *private_data)
 {
   epoll_unregister(private_data);
 
-  unwatched_endpoint_list_item_t *item = zalloc(sizeof(unwatched_endpoint_list_item_t));
-  FATAL_ON(item == NULL);
+  unwatched_endpoint_list_item_t *item = mempool_alloc(&epoll.unwatched_item_pool, sizeof(unwatched_endpoint_list_item_t));
 
   item->unregistered_epoll_private_data = private_data;
 
-  sl_slist_push(&unwatched_endpoint_list, &item->node);
+  sl_slist_push(&epoll.unwatched_endpoint_list, &item->node);
 }
 
 void epoll_watch_back(uint8_t endpoint_number)
 {
   unwatched_endpoint_list_item_t* item;
 
+  /* Data sockets read on the server I/O thread are watched back over there */
+  server_io_watch_back(endpoint_number);
+
   /* More than one library connection can exist for one endpoint. When watching back for an
    * endpoint, we want to go through all the connections and watch them back */
 
-  sl_slist_node_t *item_node = unwatched_endpoint_list;
+  sl_slist_node_t *item_node = epoll.unwatched_endpoint_list;
   while (1) {
     item = SL_SLIST_ENTRY(item_node,
                           unwatched_endpoint_list_item_t,
@@ -121,24 +197,81 @@ void epoll_watch_back(uint8_t endpoint_number)
     item_node = item_node->node;
     if (endpoint_number == item->unregistered_epoll_private_data->endpoint_number) {
       epoll_register(item->unregistered_epoll_private_data);
-      sl_slist_remove(&unwatched_endpoint_list, &item->node);
-      free(item);
+      sl_slist_remove(&epoll.unwatched_endpoint_list, &item->node);
+      mempool_free(&epoll.unwatched_item_pool, item);
+    }
+  }
+}
+
+void epoll_set_events(epoll_private_data_t *private_data, uint32_t events)
+{
+  struct epoll_event event = {};
+  unwatched_endpoint_list_item_t* item;
+  int ret;
+
+  if (private_data->events == events) {
+    return;
+  }
+
+  private_data->events = events;
+
+  /* An unwatched file descriptor gets its events when it is watched back */
+  SL_SLIST_FOR_EACH_ENTRY(epoll.unwatched_endpoint_list,
+                          item,
+                          unwatched_endpoint_list_item_t,
+                          node){
+    if (private_data == item->unregistered_epoll_private_data) {
+      return;
     }
   }
+
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    epoll_uring_del(private_data);
+    epoll_uring_add(private_data);
+    return;
+  }
+#endif
+
+  event.events = EPOLLIN | events;
+  event.data.ptr = private_data;
+
+  ret = epoll_ctl(epoll.fd_epoll, EPOLL_CTL_MOD, private_data->file_descriptor, &event);
+  FATAL_SYSCALL_ON(ret < 0);
 }
 
 size_t epoll_wait_for_event(struct epoll_event events[], size_t max_event_number)
 {
+  struct timespec timeout;
+  bool has_timeout;
   int event_count;
 
+#if defined(ENABLE_IO_URING)
+  if (epoll.use_io_uring) {
+    size_t ready_count;
+
+    has_timeout = epoll_timer_get_next_timeout(&timeout);
+    loop_stats_begin_wait();
+    ready_count = epoll_uring_wait(events, max_event_number, has_timeout ? &timeout : NULL);
+    loop_stats_end_wait(ready_count);
+
+    epoll_timer_process_expired();
+
+    return ready_count;
+  }
+#endif
+
+  /* Sleep until a file descriptor is ready or until the next timer expires */
+  loop_stats_begin_wait();
   do {
-    event_count = epoll_wait(fd_epoll, events, (int) max_event_number, -1);
+    has_timeout = epoll_timer_get_next_timeout(&timeout);
+    event_count = busy_poll_epoll_pwait2(BUSY_POLL_THREAD_CORE, epoll.fd_epoll, events, (int) max_event_number, has_timeout ? &timeout : NULL);
   } while ((event_count == -1) && (errno == EINTR));
 
   FATAL_SYSCALL_ON(event_count < 0);
+  loop_stats_end_wait((size_t)event_count);
 
-  /* Timeouts should not occur */
-  FATAL_ON(event_count == 0);
+  epoll_timer_process_expired();
 
   return (size_t)event_count;
 }
@@ -26,24 +26,56 @@ struct epoll_private_data;
 
 typedef struct epoll_private_data epoll_private_data_t;
 
+/* Of sys/socket.h, with _GNU_SOURCE */
+struct mmsghdr;
+
 typedef void (*epoll_callback_t)(epoll_private_data_t *private_data);
 
+/* What a callback serves, to account for its run time in the event loop statistics */
+typedef enum {
+  EPOLL_CALLBACK_OTHER = 0,
+  EPOLL_CALLBACK_DRIVER,
+  EPOLL_CALLBACK_SERVER_CONTROL,
+  EPOLL_CALLBACK_SERVER_DATA,
+  EPOLL_CALLBACK_SERVER_EVENT,
+  EPOLL_CALLBACK_SERVER_IO,
+  EPOLL_CALLBACK_SECURITY,
+  EPOLL_CALLBACK_STATS,
+  EPOLL_CALLBACK_TYPE_COUNT
+} epoll_callback_type_t;
+
 struct epoll_private_data{
   epoll_callback_t callback;
   int file_descriptor;
   uint8_t endpoint_number;
+  uint32_t events;       // Watched on top of EPOLLIN
+  uint32_t ready_events; // Events that triggered the callback
+  void *uring_registration; // Owned by the io_uring backend, when it is used
+  epoll_callback_type_t callback_type;
 };
 
 void epoll_init(void);
 
 void epoll_register(epoll_private_data_t *private_data);
 
+/* Register a datagram socket whose callback reads it with epoll_recvmmsg().
+ * On io_uring, the datagrams are received in buffers of buffer_size bytes
+ * ahead of the callback, with no system call per read */
+void epoll_register_recv(epoll_private_data_t *private_data, size_t buffer_size);
+
+/* recvmmsg() with MSG_DONTWAIT on a socket of epoll_register_recv(). The
+ * datagrams received ahead are handed out by pointing the first iovec of each
+ * message at them, the memory they are in stays valid until the next wait */
+int epoll_recvmmsg(epoll_private_data_t *private_data, struct mmsghdr *msgs, unsigned int vlen);
+
 void epoll_unregister(epoll_private_data_t *private_data);
 
 void epoll_unwatch(epoll_private_data_t *private_data);
 
 void epoll_watch_back(uint8_t endpoint_number);
 
+void epoll_set_events(epoll_private_data_t *private_data, uint32_t events);
+
 size_t epoll_wait_for_event(struct epoll_event events[], size_t max_event_number);
 
 #endif //EPOLL_H
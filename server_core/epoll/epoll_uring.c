@@ -0,0 +1,596 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - io_uring event loop backend
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "server_core/epoll/epoll_uring.h"
+#include "misc/logging.h"
+#include "misc/utils.h"
+
+#define EPOLL_URING_ENTRIES 256u
+
+/* user_data of requests whose completion is of no interest */
+#define EPOLL_URING_IGNORED_USER_DATA 0u
+
+/* Buffers the kernel receives the datagrams of the recv registration in, a power of 2 */
+#define EPOLL_URING_RECV_BUFFERS 32u
+#define EPOLL_URING_RECV_BUFFER_GROUP 0u
+
+/*
+ * One poll request is in flight per registration. It is single-shot and armed
+ * again once the callback ran, which keeps the level-triggered behavior the
+ * callbacks rely on (they don't always drain their file descriptor).
+ *
+ * One registration per ring may receive instead, see epoll_uring_add_recv():
+ * its multishot recv request stays in flight, each datagram completing in a
+ * buffer of the provided buffer ring, and is only armed again once the kernel
+ * ended it, out of buffers for one.
+ *
+ * A registration outlives its private data: once unregistered, it waits for
+ * the completion of its request before being freed, so that a completion
+ * never refers to freed memory.
+ */
+typedef struct {
+  epoll_private_data_t *private_data;
+  int file_descriptor;
+  uint32_t events;
+  bool registered;
+  bool armed;
+  bool multishot; // Receives with a multishot recv request rather than polls
+} epoll_uring_registration_t;
+
+static struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  unsigned sq_entries;
+  unsigned to_submit;
+
+  /* Registrations reported by the last wait, armed again at the next one */
+  epoll_uring_registration_t **reported;
+  size_t reported_count;
+  size_t reported_capacity;
+
+  /* The registration whose datagrams the kernel receives, and its buffers */
+  epoll_uring_registration_t *recv_registration;
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *recv_buffers;
+  size_t recv_buffer_size;
+  unsigned recv_buffers_in_kernel;
+  bool recv_closed; // The peer closed the socket, reported once the datagrams before are
+  /* Received datagrams, in order, not handed to the callback yet */
+  struct {
+    uint16_t buffer_id;
+    uint32_t length;
+  } received[EPOLL_URING_RECV_BUFFERS];
+  unsigned received_head;
+  unsigned received_count;
+  /* Buffers handed to the callback, given back to the kernel at the next wait */
+  uint16_t consumed[EPOLL_URING_RECV_BUFFERS];
+  unsigned consumed_count;
+} ring = { .fd = -1 };
+
+static int epoll_uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void *arg, size_t arg_size)
+{
+  return (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static void epoll_uring_give_back_buffer(uint16_t buffer_id)
+{
+  uint16_t tail = ring.buf_ring->tail;
+  struct io_uring_buf *buf = &ring.buf_ring->bufs[tail & (EPOLL_URING_RECV_BUFFERS - 1)];
+
+  /* The tail shares the first entry with its reserved field, which is left alone */
+  buf->addr = (uint64_t)(uintptr_t)&ring.recv_buffers[(size_t)buffer_id * ring.recv_buffer_size];
+  buf->len = (uint32_t)ring.recv_buffer_size;
+  buf->bid = buffer_id;
+
+  __atomic_store_n(&ring.buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+  ring.recv_buffers_in_kernel++;
+}
+
+/* Returns false if the kernel predates provided buffer rings, from Linux 5.19 */
+static bool epoll_uring_setup_recv_buffers(size_t buffer_size)
+{
+  struct io_uring_buf_reg reg;
+  uint16_t i;
+  int ret;
+
+  if (ring.buf_ring != NULL) {
+    BUG_ON(buffer_size != ring.recv_buffer_size);
+    return true;
+  }
+
+  ring.buf_ring = mmap(NULL, EPOLL_URING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  FATAL_SYSCALL_ON(ring.buf_ring == MAP_FAILED);
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)ring.buf_ring;
+  reg.ring_entries = EPOLL_URING_RECV_BUFFERS;
+  reg.bgid = EPOLL_URING_RECV_BUFFER_GROUP;
+
+  ret = (int)syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1);
+  if (ret < 0) {
+    WARN("io_uring_register() failed with %m, polling rather than receiving");
+    munmap(ring.buf_ring, EPOLL_URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+    ring.buf_ring = NULL;
+    return false;
+  }
+
+  ring.recv_buffers = malloc(EPOLL_URING_RECV_BUFFERS * buffer_size);
+  FATAL_ON(ring.recv_buffers == NULL);
+  ring.recv_buffer_size = buffer_size;
+
+  for (i = 0; i < EPOLL_URING_RECV_BUFFERS; i++) {
+    epoll_uring_give_back_buffer(i);
+  }
+
+  return true;
+}
+
+bool epoll_uring_init(void)
+{
+  struct io_uring_params params;
+  size_t sq_size;
+  size_t cq_size;
+  uint8_t *sq_ptr;
+  uint8_t *cq_ptr;
+
+  memset(&params, 0, sizeof(params));
+
+  ring.fd = (int)syscall(__NR_io_uring_setup, EPOLL_URING_ENTRIES, &params);
+  if (ring.fd < 0) {
+    WARN("io_uring_setup() failed with %m, using epoll");
+    return false;
+  }
+
+  /* A single mapping of both rings, no dropped completions and a timeout on the wait */
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)
+      || !(params.features & IORING_FEAT_NODROP)
+      || !(params.features & IORING_FEAT_EXT_ARG)) {
+    WARN("The kernel is missing io_uring features, using epoll");
+    close(ring.fd);
+    ring.fd = -1;
+    return false;
+  }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (cq_size > sq_size) {
+    sq_size = cq_size;
+  }
+
+  sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  FATAL_SYSCALL_ON(sq_ptr == MAP_FAILED);
+  cq_ptr = sq_ptr;
+
+  ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  FATAL_SYSCALL_ON(ring.sqes == MAP_FAILED);
+
+  ring.sq_head = (unsigned *)(sq_ptr + params.sq_off.head);
+  ring.sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+  ring.sq_mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+  ring.sq_entries = params.sq_entries;
+
+  ring.cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+  ring.cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+  ring.cq_mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+  PRINT_INFO("Event loop running on io_uring");
+
+  return true;
+}
+
+static void epoll_uring_submit(void)
+{
+  int ret;
+
+  while (ring.to_submit > 0) {
+    ret = epoll_uring_enter(ring.to_submit, 0, 0, NULL, 0);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    FATAL_SYSCALL_ON(ret < 0);
+
+    ring.to_submit -= (unsigned)ret;
+  }
+}
+
+static struct io_uring_sqe* epoll_uring_get_sqe(void)
+{
+  unsigned tail = *ring.sq_tail;
+  unsigned index;
+  struct io_uring_sqe *sqe;
+
+  /* The submission queue is full, hand it to the kernel right away */
+  if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) == ring.sq_entries) {
+    epoll_uring_submit();
+  }
+
+  index = tail & *ring.sq_mask;
+  sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+
+  ring.sq_array[index] = index;
+  __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring.to_submit++;
+
+  return sqe;
+}
+
+static void epoll_uring_arm(epoll_uring_registration_t *registration)
+{
+  struct io_uring_sqe *sqe = epoll_uring_get_sqe();
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = registration->file_descriptor;
+  sqe->poll32_events = EPOLLIN | registration->events;
+  sqe->user_data = (uint64_t)(uintptr_t)registration;
+
+  registration->armed = true;
+}
+
+static void epoll_uring_arm_recv(epoll_uring_registration_t *registration)
+{
+  struct io_uring_sqe *sqe = epoll_uring_get_sqe();
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = registration->file_descriptor;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = EPOLL_URING_RECV_BUFFER_GROUP;
+  sqe->user_data = (uint64_t)(uintptr_t)registration;
+
+  registration->armed = true;
+}
+
+void epoll_uring_add(epoll_private_data_t *private_data)
+{
+  epoll_uring_registration_t *registration = zalloc(sizeof(epoll_uring_registration_t));
+  FATAL_ON(registration == NULL);
+
+  registration->private_data = private_data;
+  registration->file_descriptor = private_data->file_descriptor;
+  registration->events = private_data->events;
+  registration->registered = true;
+
+  private_data->uring_registration = registration;
+
+  epoll_uring_arm(registration);
+}
+
+void epoll_uring_add_recv(epoll_private_data_t *private_data, size_t buffer_size)
+{
+  epoll_uring_registration_t *registration;
+
+  if (ring.recv_registration != NULL || !epoll_uring_setup_recv_buffers(buffer_size)) {
+    epoll_uring_add(private_data);
+    return;
+  }
+
+  registration = zalloc(sizeof(epoll_uring_registration_t));
+  FATAL_ON(registration == NULL);
+
+  registration->private_data = private_data;
+  registration->file_descriptor = private_data->file_descriptor;
+  registration->events = private_data->events;
+  registration->registered = true;
+  registration->multishot = true;
+
+  private_data->uring_registration = registration;
+
+  ring.recv_registration = registration;
+  ring.recv_closed = false;
+
+  epoll_uring_arm_recv(registration);
+}
+
+int epoll_uring_recvmmsg(epoll_private_data_t *private_data, struct mmsghdr *msgs, unsigned int vlen)
+{
+  epoll_uring_registration_t *registration = private_data->uring_registration;
+  unsigned int i;
+
+  if (registration == NULL || !registration->multishot) {
+    return recvmmsg(private_data->file_descriptor, msgs, vlen, MSG_DONTWAIT, NULL);
+  }
+
+  for (i = 0; i < vlen && ring.received_count > 0; i++) {
+    uint16_t buffer_id = ring.received[ring.received_head].buffer_id;
+
+    msgs[i].msg_hdr.msg_iov[0].iov_base = &ring.recv_buffers[(size_t)buffer_id * ring.recv_buffer_size];
+    msgs[i].msg_hdr.msg_flags = 0;
+    msgs[i].msg_len = ring.received[ring.received_head].length;
+
+    ring.consumed[ring.consumed_count++] = buffer_id;
+    ring.received_head = (ring.received_head + 1) % EPOLL_URING_RECV_BUFFERS;
+    ring.received_count--;
+  }
+
+  /* Like recvmmsg(), the closure shows as an empty datagram */
+  if (i < vlen && ring.recv_closed) {
+    msgs[i].msg_hdr.msg_flags = 0;
+    msgs[i].msg_len = 0;
+    i++;
+  }
+
+  if (i == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  return (int)i;
+}
+
+void epoll_uring_del(epoll_private_data_t *private_data)
+{
+  epoll_uring_registration_t *registration = private_data->uring_registration;
+
+  BUG_ON(registration == NULL || !registration->registered);
+
+  private_data->uring_registration = NULL;
+  registration->registered = false;
+  registration->private_data = NULL;
+
+  if (registration->multishot) {
+    /* The datagrams not handed out yet are dropped, their buffers given back with those handed out */
+    while (ring.received_count > 0) {
+      ring.consumed[ring.consumed_count++] = ring.received[ring.received_head].buffer_id;
+      ring.received_head = (ring.received_head + 1) % EPOLL_URING_RECV_BUFFERS;
+      ring.received_count--;
+    }
+    ring.recv_registration = NULL;
+    ring.recv_closed = false;
+
+    /* Freed when its recv request ends */
+    if (registration->armed) {
+      struct io_uring_sqe *sqe = epoll_uring_get_sqe();
+
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = (uint64_t)(uintptr_t)registration;
+      sqe->user_data = EPOLL_URING_IGNORED_USER_DATA;
+    } else {
+      free(registration);
+    }
+    return;
+  }
+
+  /* Freed when its poll request completes, or when its report is processed */
+  if (registration->armed) {
+    struct io_uring_sqe *sqe = epoll_uring_get_sqe();
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = (uint64_t)(uintptr_t)registration;
+    sqe->user_data = EPOLL_URING_IGNORED_USER_DATA;
+  }
+}
+
+static void epoll_uring_rearm_reported(void)
+{
+  size_t i;
+
+  /* The callbacks are done with the datagrams they were handed */
+  for (i = 0; i < ring.consumed_count; i++) {
+    epoll_uring_give_back_buffer(ring.consumed[i]);
+  }
+  ring.consumed_count = 0;
+
+  /* The kernel ended the recv request, out of buffers for one, it has some again */
+  if (ring.recv_registration != NULL && !ring.recv_registration->armed
+      && !ring.recv_closed && ring.recv_buffers_in_kernel > 0) {
+    epoll_uring_arm_recv(ring.recv_registration);
+  }
+
+  for (i = 0; i < ring.reported_count; i++) {
+    if (ring.reported[i]->registered) {
+      epoll_uring_arm(ring.reported[i]);
+    } else {
+      free(ring.reported[i]);
+    }
+  }
+
+  ring.reported_count = 0;
+}
+
+static void epoll_uring_report(epoll_uring_registration_t *registration)
+{
+  if (ring.reported_count == ring.reported_capacity) {
+    size_t new_capacity = ring.reported_capacity ? ring.reported_capacity * 2 : 16u;
+    epoll_uring_registration_t **new_reported = realloc(ring.reported, new_capacity * sizeof(*ring.reported));
+    FATAL_ON(new_reported == NULL);
+
+    ring.reported = new_reported;
+    ring.reported_capacity = new_capacity;
+  }
+
+  ring.reported[ring.reported_count++] = registration;
+}
+
+/* A datagram received, or the end of the recv request */
+static void epoll_uring_complete_recv(epoll_uring_registration_t *registration, const struct io_uring_cqe *cqe)
+{
+  bool has_buffer = (cqe->flags & IORING_CQE_F_BUFFER) != 0;
+  uint16_t buffer_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+  unsigned index;
+
+  if (has_buffer) {
+    ring.recv_buffers_in_kernel--;
+  }
+
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    registration->armed = false;
+  }
+
+  if (!registration->registered) {
+    if (has_buffer) {
+      epoll_uring_give_back_buffer(buffer_id);
+    }
+    if (!registration->armed) {
+      free(registration);
+    }
+    return;
+  }
+
+  if (cqe->res > 0) {
+    BUG_ON(!has_buffer || ring.received_count == EPOLL_URING_RECV_BUFFERS);
+
+    index = (ring.received_head + ring.received_count) % EPOLL_URING_RECV_BUFFERS;
+    ring.received[index].buffer_id = buffer_id;
+    ring.received[index].length = (uint32_t)cqe->res;
+    ring.received_count++;
+    return;
+  }
+
+  if (has_buffer) {
+    epoll_uring_give_back_buffer(buffer_id);
+  }
+
+  if (cqe->res == 0 || cqe->res == -ECONNRESET) {
+    ring.recv_closed = true;
+  } else if (cqe->res == -EINVAL) {
+    /* Multishot recv is from Linux 6.0, poll like the other registrations */
+    WARN("The kernel can't receive with multishot requests, polling rather than receiving");
+    registration->multishot = false;
+    ring.recv_registration = NULL;
+    epoll_uring_report(registration);
+  } else {
+    /* Out of buffers, armed again once the callback gave some back */
+    FATAL_ON(cqe->res != -ENOBUFS && cqe->res != -ECANCELED);
+  }
+}
+
+/* Move up to max_event_number ready registrations from the completion queue to events */
+static size_t epoll_uring_reap(struct epoll_event events[], size_t max_event_number)
+{
+  unsigned head = *ring.cq_head;
+  unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+  size_t event_count = 0;
+
+  while (head != tail && event_count < max_event_number) {
+    const struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+    epoll_uring_registration_t *registration = (epoll_uring_registration_t *)(uintptr_t)cqe->user_data;
+
+    head++;
+
+    if (registration == NULL) {
+      continue;
+    }
+
+    if (registration->multishot) {
+      epoll_uring_complete_recv(registration, cqe);
+      continue;
+    }
+
+    registration->armed = false;
+
+    if (!registration->registered) {
+      free(registration);
+      continue;
+    }
+
+    /* Armed again once the callback ran, whether it reports an event or not */
+    epoll_uring_report(registration);
+
+    if (cqe->res < 0) {
+      FATAL_ON(cqe->res != -ECANCELED);
+      continue;
+    }
+
+    events[event_count].events = (uint32_t)cqe->res;
+    events[event_count].data.ptr = registration->private_data;
+    event_count++;
+  }
+
+  __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+  return event_count;
+}
+
+/* Report the recv registration ready while datagrams, or its closure, are left to hand out */
+static size_t epoll_uring_report_received(struct epoll_event events[], size_t event_count, size_t max_event_number)
+{
+  if (ring.recv_registration != NULL && (ring.received_count > 0 || ring.recv_closed)
+      && event_count < max_event_number) {
+    events[event_count].events = EPOLLIN;
+    events[event_count].data.ptr = ring.recv_registration->private_data;
+    event_count++;
+  }
+
+  return event_count;
+}
+
+size_t epoll_uring_wait(struct epoll_event events[], size_t max_event_number, const struct timespec *timeout)
+{
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  size_t event_count;
+  int ret;
+
+  epoll_uring_rearm_reported();
+
+  /* What is already there is served without waiting. A stream of datagrams can keep it
+   * coming, the requests armed again are submitted all the same */
+  event_count = epoll_uring_reap(events, max_event_number);
+  event_count = epoll_uring_report_received(events, event_count, max_event_number);
+  if (event_count > 0) {
+    epoll_uring_submit();
+    return event_count;
+  }
+
+  memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if (timeout != NULL) {
+    ts.tv_sec = timeout->tv_sec;
+    ts.tv_nsec = timeout->tv_nsec;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+
+  /* Submit the pending registrations and wait, in one go */
+  do {
+    ret = epoll_uring_enter(ring.to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret >= 0) {
+      ring.to_submit -= (unsigned)ret;
+    }
+  } while (ret < 0 && errno == EINTR);
+
+  FATAL_SYSCALL_ON(ret < 0 && errno != ETIME);
+
+  event_count = epoll_uring_reap(events, max_event_number);
+
+  return epoll_uring_report_received(events, event_count, max_event_number);
+}
@@ -0,0 +1,51 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - io_uring event loop backend
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef EPOLL_URING_H
+#define EPOLL_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "server_core/epoll/epoll.h"
+
+/*
+ * Same contract as the epoll set in epoll.c: level-triggered readiness of the
+ * registered file descriptors, reported through their epoll_private_data_t.
+ * Registrations and the wait are batched in a single io_uring_enter() per
+ * loop iteration, instead of one epoll_ctl() per change plus epoll_wait().
+ * The datagrams of a socket registered with epoll_uring_add_recv() are
+ * received by the kernel ahead of its callback, which no longer needs a
+ * recvmmsg() of its own.
+ */
+
+/* Returns false if the kernel can't provide the features needed, epoll is used then */
+bool epoll_uring_init(void);
+
+void epoll_uring_add(epoll_private_data_t *private_data);
+
+/* Receive the datagrams of a socket with a multishot recv request, see epoll_register_recv() */
+void epoll_uring_add_recv(epoll_private_data_t *private_data, size_t buffer_size);
+
+int epoll_uring_recvmmsg(epoll_private_data_t *private_data, struct mmsghdr *msgs, unsigned int vlen);
+
+void epoll_uring_del(epoll_private_data_t *private_data);
+
+size_t epoll_uring_wait(struct epoll_event events[], size_t max_event_number, const struct timespec *timeout);
+
+#endif //EPOLL_URING_H
@@ -0,0 +1,228 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Event loop statistics
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <time.h>
+
+#include "server_core/epoll/loop_stats.h"
+#include "misc/config.h"
+#include "misc/logging.h"
+
+static struct {
+  loop_stats_t stats;
+
+  unsigned int sampling_period;
+  unsigned int iterations_to_next_sample;
+  bool sampling;
+
+  uint64_t iteration_start_ns;
+  uint64_t wait_start_ns;
+  uint64_t blocked_ns;
+} loop;
+
+static const char *callback_type_names[EPOLL_CALLBACK_TYPE_COUNT] = {
+  [EPOLL_CALLBACK_OTHER] = "other",
+  [EPOLL_CALLBACK_DRIVER] = "driver",
+  [EPOLL_CALLBACK_SERVER_CONTROL] = "server_control",
+  [EPOLL_CALLBACK_SERVER_DATA] = "server_data",
+  [EPOLL_CALLBACK_SERVER_EVENT] = "server_event",
+  [EPOLL_CALLBACK_SERVER_IO] = "server_io",
+  [EPOLL_CALLBACK_SECURITY] = "security",
+  [EPOLL_CALLBACK_STATS] = "stats",
+};
+
+void loop_stats_init(void)
+{
+  /* Nothing reads the statistics if they are not printed */
+  if (config.stats_interval > 0) {
+    loop.sampling_period = config.event_loop_stats_sampling;
+  }
+}
+
+uint64_t loop_stats_now_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void loop_stats_histogram_add(loop_stats_histogram_t *histogram, uint64_t duration_ns)
+{
+  uint64_t duration_us = duration_ns / 1000u;
+  size_t bucket = 0;
+
+  while (duration_us != 0 && bucket < LOOP_STATS_HISTOGRAM_BUCKETS - 1) {
+    duration_us >>= 1;
+    bucket++;
+  }
+
+  histogram->count++;
+  histogram->total_ns += duration_ns;
+  if (duration_ns > histogram->max_ns) {
+    histogram->max_ns = duration_ns;
+  }
+  histogram->buckets[bucket]++;
+}
+
+void loop_stats_begin_iteration(void)
+{
+  loop.sampling = false;
+
+  if (loop.sampling_period == 0) {
+    return;
+  }
+
+  if (loop.iterations_to_next_sample != 0) {
+    loop.iterations_to_next_sample--;
+    return;
+  }
+
+  loop.iterations_to_next_sample = loop.sampling_period - 1;
+  loop.sampling = true;
+  loop.blocked_ns = 0;
+  loop.iteration_start_ns = loop_stats_now_ns();
+}
+
+void loop_stats_end_iteration(void)
+{
+  if (!loop.sampling) {
+    return;
+  }
+
+  loop_stats_histogram_add(&loop.stats.iteration_busy, loop_stats_now_ns() - loop.iteration_start_ns - loop.blocked_ns);
+}
+
+bool loop_stats_is_sampling(void)
+{
+  return loop.sampling;
+}
+
+void loop_stats_begin_wait(void)
+{
+  if (loop.sampling) {
+    loop.wait_start_ns = loop_stats_now_ns();
+  }
+}
+
+void loop_stats_end_wait(size_t event_count)
+{
+  if (!loop.sampling) {
+    return;
+  }
+
+  loop.blocked_ns += loop_stats_now_ns() - loop.wait_start_ns;
+
+  loop.stats.waits++;
+  loop.stats.events += event_count;
+  if (event_count == 0) {
+    loop.stats.waits_timed_out++;
+  }
+  if (event_count > loop.stats.max_events_per_wait) {
+    loop.stats.max_events_per_wait = event_count;
+  }
+}
+
+void loop_stats_record_callback(epoll_callback_type_t type, uint64_t start_ns)
+{
+  BUG_ON(type >= EPOLL_CALLBACK_TYPE_COUNT);
+
+  loop_stats_histogram_add(&loop.stats.callbacks[type], loop_stats_now_ns() - start_ns);
+}
+
+void loop_stats_record_timer(uint64_t lag_ns, uint64_t start_ns)
+{
+  loop_stats_histogram_add(&loop.stats.timer_lag, lag_ns);
+  loop_stats_histogram_add(&loop.stats.timers, loop_stats_now_ns() - start_ns);
+}
+
+const loop_stats_t* loop_stats_get(void)
+{
+  return &loop.stats;
+}
+
+uint64_t loop_stats_histogram_percentile_us(const loop_stats_histogram_t *histogram, unsigned int per_mille)
+{
+  uint64_t threshold = (histogram->count * per_mille + 999u) / 1000u;
+  uint64_t cumulated = 0;
+  size_t bucket;
+
+  if (histogram->count == 0) {
+    return 0;
+  }
+
+  for (bucket = 0; bucket < LOOP_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+    cumulated += histogram->buckets[bucket];
+    if (cumulated >= threshold) {
+      return (uint64_t)1 << bucket;
+    }
+  }
+
+  /* The last bucket has no upper bound, the maximum is the best estimate */
+  return histogram->max_ns / 1000u;
+}
+
+const char* loop_stats_callback_type_to_str(epoll_callback_type_t type)
+{
+  BUG_ON(type >= EPOLL_CALLBACK_TYPE_COUNT);
+
+  return callback_type_names[type];
+}
+
+static void loop_stats_print_histogram(const char *name, const loop_stats_histogram_t *histogram)
+{
+  if (histogram->count == 0) {
+    return;
+  }
+
+  TRACE("  %-16s count %llu avg %llu us p50 <%llu us p99 <%llu us p999 <%llu us max %llu us",
+        name,
+        (unsigned long long)histogram->count,
+        (unsigned long long)(histogram->total_ns / histogram->count / 1000u),
+        (unsigned long long)loop_stats_histogram_percentile_us(histogram, 500),
+        (unsigned long long)loop_stats_histogram_percentile_us(histogram, 990),
+        (unsigned long long)loop_stats_histogram_percentile_us(histogram, 999),
+        (unsigned long long)(histogram->max_ns / 1000u));
+}
+
+void loop_stats_print(void)
+{
+  size_t type;
+
+  if (loop.sampling_period == 0) {
+    return;
+  }
+
+  TRACE("Event loop statistics, one iteration out of %u sampled:"
+        "\nwaits %llu"
+        "\nwaits_timed_out %llu"
+        "\nevents %llu"
+        "\nmax_events_per_wait %llu",
+        loop.sampling_period,
+        (unsigned long long)loop.stats.waits,
+        (unsigned long long)loop.stats.waits_timed_out,
+        (unsigned long long)loop.stats.events,
+        (unsigned long long)loop.stats.max_events_per_wait);
+
+  loop_stats_print_histogram("iteration_busy", &loop.stats.iteration_busy);
+  loop_stats_print_histogram("timer_lag", &loop.stats.timer_lag);
+  loop_stats_print_histogram("timers", &loop.stats.timers);
+
+  for (type = 0; type < EPOLL_CALLBACK_TYPE_COUNT; type++) {
+    loop_stats_print_histogram(callback_type_names[type], &loop.stats.callbacks[type]);
+  }
+}
@@ -0,0 +1,89 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Event loop statistics
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef LOOP_STATS_H
+#define LOOP_STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "server_core/epoll/epoll.h"
+
+/*
+ * Where the time of the server core thread goes: how long each type of
+ * callback runs, how late timers fire, how long an iteration of the loop keeps
+ * the thread busy and how many events each wait returns.
+ *
+ * Only one loop iteration out of config.event_loop_stats_sampling is measured,
+ * the others cost a counter increment. Every function below is called on the
+ * server core thread, printing included.
+ */
+
+#define LOOP_STATS_HISTOGRAM_BUCKETS 16
+
+/* Bucket 0 counts durations under 1us, bucket i durations under 2^i us, the last one the rest */
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[LOOP_STATS_HISTOGRAM_BUCKETS];
+} loop_stats_histogram_t;
+
+typedef struct {
+  loop_stats_histogram_t callbacks[EPOLL_CALLBACK_TYPE_COUNT];
+  loop_stats_histogram_t timers;
+  loop_stats_histogram_t timer_lag;
+  loop_stats_histogram_t iteration_busy;
+  uint64_t waits;
+  uint64_t waits_timed_out;
+  uint64_t events;
+  uint64_t max_events_per_wait;
+} loop_stats_t;
+
+void loop_stats_init(void);
+
+/* Bracket one iteration of the loop, decide whether it is sampled */
+void loop_stats_begin_iteration(void);
+void loop_stats_end_iteration(void);
+
+bool loop_stats_is_sampling(void);
+
+/* Monotonic time in nanoseconds */
+uint64_t loop_stats_now_ns(void);
+
+/* Bracket the time the loop is blocked waiting, it is not counted as busy */
+void loop_stats_begin_wait(void);
+void loop_stats_end_wait(size_t event_count);
+
+void loop_stats_record_callback(epoll_callback_type_t type, uint64_t start_ns);
+
+void loop_stats_record_timer(uint64_t lag_ns, uint64_t start_ns);
+
+const loop_stats_t* loop_stats_get(void);
+
+/* Also used for the histograms kept outside of the loop stats */
+void loop_stats_histogram_add(loop_stats_histogram_t *histogram, uint64_t duration_ns);
+
+/* Upper bound of the bucket reaching the given per mille of the samples, in us */
+uint64_t loop_stats_histogram_percentile_us(const loop_stats_histogram_t *histogram, unsigned int per_mille);
+
+const char* loop_stats_callback_type_to_str(epoll_callback_type_t type);
+
+void loop_stats_print(void);
+
+#endif //LOOP_STATS_H
@@ -0,0 +1,219 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Timers
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "server_core/epoll/timer.h"
+#include "server_core/epoll/loop_stats.h"
+#include "misc/logging.h"
+
+#define TIMER_HEAP_INITIAL_CAPACITY 32u
+
+static struct {
+  epoll_timer_t **heap;
+  size_t heap_size;
+  size_t heap_capacity;
+} timers;
+
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec < b->tv_sec) || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void heap_set(size_t index, epoll_timer_t *timer)
+{
+  timers.heap[index] = timer;
+  timer->heap_index = index + 1;
+}
+
+static void heap_sift_up(size_t index)
+{
+  epoll_timer_t *timer = timers.heap[index];
+
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+
+    if (!timespec_before(&timer->expiry, &timers.heap[parent]->expiry)) {
+      break;
+    }
+
+    heap_set(index, timers.heap[parent]);
+    index = parent;
+  }
+
+  heap_set(index, timer);
+}
+
+static void heap_sift_down(size_t index)
+{
+  epoll_timer_t *timer = timers.heap[index];
+
+  while (1) {
+    size_t child = 2 * index + 1;
+
+    if (child >= timers.heap_size) {
+      break;
+    }
+
+    if (child + 1 < timers.heap_size && timespec_before(&timers.heap[child + 1]->expiry, &timers.heap[child]->expiry)) {
+      child++;
+    }
+
+    if (!timespec_before(&timers.heap[child]->expiry, &timer->expiry)) {
+      break;
+    }
+
+    heap_set(index, timers.heap[child]);
+    index = child;
+  }
+
+  heap_set(index, timer);
+}
+
+void epoll_timer_init(epoll_timer_t *timer, epoll_timer_callback_t callback)
+{
+  FATAL_ON(timer == NULL);
+  FATAL_ON(callback == NULL);
+
+  timer->callback = callback;
+  timer->expiry = (struct timespec){ 0 };
+  timer->heap_index = 0;
+}
+
+void epoll_timer_start(epoll_timer_t *timer, uint64_t timeout_us)
+{
+  struct timespec expiry;
+
+  clock_gettime(CLOCK_MONOTONIC, &expiry);
+
+  expiry.tv_sec += (time_t)(timeout_us / 1000000);
+  expiry.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+  if (expiry.tv_nsec >= 1000000000) {
+    expiry.tv_sec++;
+    expiry.tv_nsec -= 1000000000;
+  }
+
+  epoll_timer_start_at(timer, &expiry);
+}
+
+void epoll_timer_start_at(epoll_timer_t *timer, const struct timespec *expiry)
+{
+  FATAL_ON(timer == NULL);
+  BUG_ON(timer->callback == NULL);
+
+  epoll_timer_stop(timer);
+
+  if (timers.heap_size == timers.heap_capacity) {
+    size_t new_capacity = timers.heap_capacity ? timers.heap_capacity * 2 : TIMER_HEAP_INITIAL_CAPACITY;
+    epoll_timer_t **new_heap = realloc(timers.heap, new_capacity * sizeof(epoll_timer_t *));
+    FATAL_ON(new_heap == NULL);
+
+    timers.heap = new_heap;
+    timers.heap_capacity = new_capacity;
+  }
+
+  timer->expiry = *expiry;
+  timers.heap[timers.heap_size] = timer;
+  timers.heap_size++;
+  heap_sift_up(timers.heap_size - 1);
+}
+
+void epoll_timer_stop(epoll_timer_t *timer)
+{
+  size_t index;
+  epoll_timer_t *last;
+
+  FATAL_ON(timer == NULL);
+
+  if (timer->heap_index == 0) {
+    return;
+  }
+
+  index = timer->heap_index - 1;
+  BUG_ON(index >= timers.heap_size || timers.heap[index] != timer);
+
+  timer->heap_index = 0;
+  timers.heap_size--;
+
+  if (index == timers.heap_size) {
+    return;
+  }
+
+  // Move the last timer in the hole and restore the heap property
+  last = timers.heap[timers.heap_size];
+  heap_set(index, last);
+  if (index > 0 && timespec_before(&last->expiry, &timers.heap[(index - 1) / 2]->expiry)) {
+    heap_sift_up(index);
+  } else {
+    heap_sift_down(index);
+  }
+}
+
+bool epoll_timer_is_running(const epoll_timer_t *timer)
+{
+  return timer->heap_index != 0;
+}
+
+bool epoll_timer_get_next_timeout(struct timespec *timeout)
+{
+  struct timespec now;
+
+  if (timers.heap_size == 0) {
+    return false;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  if (!timespec_before(&now, &timers.heap[0]->expiry)) {
+    *timeout = (struct timespec){ 0 };
+    return true;
+  }
+
+  timeout->tv_sec = timers.heap[0]->expiry.tv_sec - now.tv_sec;
+  timeout->tv_nsec = timers.heap[0]->expiry.tv_nsec - now.tv_nsec;
+  if (timeout->tv_nsec < 0) {
+    timeout->tv_sec--;
+    timeout->tv_nsec += 1000000000;
+  }
+
+  return true;
+}
+
+void epoll_timer_process_expired(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while (timers.heap_size != 0 && !timespec_before(&now, &timers.heap[0]->expiry)) {
+    epoll_timer_t *timer = timers.heap[0];
+
+    if (loop_stats_is_sampling()) {
+      uint64_t start_ns = loop_stats_now_ns();
+      uint64_t expiry_ns = (uint64_t)timer->expiry.tv_sec * 1000000000u + (uint64_t)timer->expiry.tv_nsec;
+
+      epoll_timer_stop(timer);
+      timer->callback(timer);
+      loop_stats_record_timer(start_ns > expiry_ns ? start_ns - expiry_ns : 0, start_ns);
+      continue;
+    }
+
+    epoll_timer_stop(timer);
+    timer->callback(timer);
+  }
+}
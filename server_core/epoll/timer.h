@@ -0,0 +1,87 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Timers
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef EPOLL_TIMER_H
+#define EPOLL_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Timers of the server core thread. They are kept in a min-heap and driven by
+ * the timeout of epoll_pwait2() rather than by one timerfd each, so arming and
+ * cancelling a timer costs no system call. The timeout is to the nanosecond, a
+ * timer of less than a millisecond is not rounded up to one. They must only be
+ * used from the server core thread.
+ */
+
+//forward declaration for interdependency
+struct epoll_timer;
+
+typedef struct epoll_timer epoll_timer_t;
+
+typedef void (*epoll_timer_callback_t)(epoll_timer_t *timer);
+
+struct epoll_timer{
+  epoll_timer_callback_t callback;
+  struct timespec expiry;
+  size_t heap_index; // Position in the heap plus one, 0 when not running
+};
+
+/***************************************************************************//**
+ * Initialize a timer. The callback retrieves its context with container_of.
+ ******************************************************************************/
+void epoll_timer_init(epoll_timer_t *timer, epoll_timer_callback_t callback);
+
+/***************************************************************************//**
+ * Start, or restart, a one-shot timer expiring in timeout_us from now.
+ ******************************************************************************/
+void epoll_timer_start(epoll_timer_t *timer, uint64_t timeout_us);
+
+/***************************************************************************//**
+ * Start, or restart, a one-shot timer expiring at an absolute CLOCK_MONOTONIC
+ * time.
+ ******************************************************************************/
+void epoll_timer_start_at(epoll_timer_t *timer, const struct timespec *expiry);
+
+/***************************************************************************//**
+ * Stop a timer. Stopping a timer that is not running is a no-op.
+ ******************************************************************************/
+void epoll_timer_stop(epoll_timer_t *timer);
+
+/***************************************************************************//**
+ * @return true if the timer is running
+ ******************************************************************************/
+bool epoll_timer_is_running(const epoll_timer_t *timer);
+
+/***************************************************************************//**
+ * Get the time until the earliest timer expires, 0 if it already has.
+ * Suitable as the epoll_pwait2() timeout.
+ *
+ * @return false if no timer is running, timeout is then left untouched
+ ******************************************************************************/
+bool epoll_timer_get_next_timeout(struct timespec *timeout);
+
+/***************************************************************************//**
+ * Call the callback of every timer that is expired. A callback may start or
+ * stop any timer, including its own.
+ ******************************************************************************/
+void epoll_timer_process_expired(void);
+
+#endif //EPOLL_TIMER_H
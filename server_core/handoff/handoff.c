@@ -0,0 +1,730 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Hot restart handoff
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "misc/config.h"
+#include "misc/logging.h"
+#include "misc/sleep.h"
+#include "misc/utils.h"
+#include "driver/driver_kill.h"
+#include "driver/driver_uart.h"
+#include "driver/driver_net.h"
+#if defined(CPC_BENCH)
+#include "driver/driver_emul.h"
+#endif
+#include "server_core/handoff/handoff.h"
+#include "server_core/server_core.h"
+#include "server_core/server/server.h"
+#include "server_core/core/core.h"
+#include "server_core/epoll/epoll.h"
+#include "server_core/system_endpoint/system.h"
+
+/* Bounds each exchange, neither daemon waits on the other forever */
+#define HANDOFF_TIMEOUT_MS 5000
+
+/* While the link is busy, the new daemon asks again for up to 5 seconds */
+#define HANDOFF_RETRY_COUNT     50
+#define HANDOFF_RETRY_PERIOD_MS 100
+
+typedef struct {
+  handoff_record_t record;
+  int fd; // Received with the record, -1 if none
+} handoff_received_t;
+
+static struct {
+  /* Running daemon */
+  int fd_listen;
+  epoll_private_data_t listen_private_data;
+
+  /* New daemon */
+  bool resuming;
+  handoff_received_t *received;
+  size_t received_count;
+  int parking_base;       // The file descriptors received are kept from there, see handoff_park()
+  handoff_secondary_t secondary;
+  int fd_bus;
+  int fd_ctrl_socket;
+#if defined(CPC_BENCH)
+  handoff_released_t released;
+#endif
+} handoff;
+
+static void handoff_get_socket_path(struct sockaddr_un *name)
+{
+  int nchars;
+  const size_t size = sizeof(name->sun_path) - 1;
+
+  memset(name, 0, sizeof(*name));
+  name->sun_family = AF_UNIX;
+
+  nchars = snprintf(name->sun_path, size, "%s/cpcd/%s/handoff.cpcd.sock", config.socket_folder, config.instance_name);
+
+  /* Make sure the path fitted entirely in the struct's static buffer */
+  FATAL_ON(nchars < 0 || (size_t) nchars >= size);
+}
+
+static void handoff_set_timeouts(int fd_handoff)
+{
+  const struct timeval timeout = {
+    .tv_sec = HANDOFF_TIMEOUT_MS / 1000,
+    .tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000
+  };
+
+  FATAL_SYSCALL_ON(setsockopt(fd_handoff, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0);
+  FATAL_SYSCALL_ON(setsockopt(fd_handoff, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0);
+}
+
+int handoff_send_record(int fd_handoff, const handoff_record_t *record, int fd)
+{
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t ret;
+
+  iov.iov_base = (void *)record;
+  iov.iov_len = sizeof(*record);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (fd != -1) {
+    struct cmsghdr *cmsg;
+
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  ret = sendmsg(fd_handoff, &msg, MSG_NOSIGNAL);
+  if (ret < 0) {
+    return -errno;
+  }
+
+  return (size_t)ret == sizeof(*record) ? 0 : -EMSGSIZE;
+}
+
+static int handoff_send_type(int fd_handoff, handoff_record_type_t type)
+{
+  handoff_record_t record;
+
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+
+  return handoff_send_record(fd_handoff, &record, -1);
+}
+
+/* Returns 0 or -errno, fd is set to the file descriptor that came with the record, if any */
+static int handoff_receive_record(int fd_handoff, handoff_record_t *record, int *fd)
+{
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t ret;
+
+  *fd = -1;
+
+  iov.iov_base = record;
+  iov.iov_len = sizeof(*record);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  ret = recvmsg(fd_handoff, &msg, MSG_CMSG_CLOEXEC);
+  if (ret < 0) {
+    return -errno;
+  }
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET
+        && cmsg->cmsg_type == SCM_RIGHTS
+        && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+
+  if (ret == 0) {
+    return -ECONNRESET;
+  }
+
+  if ((size_t)ret != sizeof(*record) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+    return -EBADMSG;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ **************************   RUNNING DAEMON   *********************************
+ ******************************************************************************/
+
+/* The reason the link can't be handed over now, NULL if it can */
+static const char* handoff_refusal(const handoff_hello_t *hello, bool *transient)
+{
+  const char *reason;
+
+  *transient = false;
+
+  if (hello->version != HANDOFF_VERSION || hello->record_size != sizeof(handoff_record_t)) {
+    return "the new daemon speaks another version of the handoff";
+  }
+
+  *transient = true;
+
+  /* Without the reset sequence, the state of the secondary is never known to be reset */
+  if (config.reset_sequence && server_core_reset_sequence_in_progress()) {
+    return "the secondary is being reset";
+  }
+
+  reason = server_handoff_refusal(transient);
+  if (reason != NULL) {
+    return reason;
+  }
+
+  *transient = true;
+
+  if (!sl_cpc_system_is_idle()) {
+    return "a system command is in flight";
+  }
+
+  if (!core_is_idle()) {
+    return "frames are in flight";
+  }
+
+  return NULL;
+}
+
+static void handoff_send_refusal(int fd_handoff, const char *reason, bool transient)
+{
+  handoff_record_t record;
+  int ret;
+
+  memset(&record, 0, sizeof(record));
+  record.type = HANDOFF_RECORD_REFUSED;
+  record.data.reason.transient = transient;
+  strncpy(record.data.reason.text, reason, sizeof(record.data.reason.text) - 1);
+
+  ret = handoff_send_record(fd_handoff, &record, -1);
+  if (ret < 0) {
+    TRACE_SERVER("Hot restart: could not refuse, %s", strerror(-ret));
+  }
+}
+
+/* Everything the new daemon needs to resume, in the order it restores it */
+static int handoff_export(int fd_handoff)
+{
+  handoff_record_t record;
+  const uint8_t *ep_ids;
+  size_t ep_count;
+  int fd_bus = -1;
+  int ret;
+
+  memset(&record, 0, sizeof(record));
+  record.type = HANDOFF_RECORD_SECONDARY;
+  server_core_export_secondary(&record.data.secondary);
+  record.data.secondary.bus = (uint32_t)config.bus;
+  record.data.secondary.next_command_seq = sl_cpc_system_get_next_command_seq();
+  if (config.bus == UART) {
+    record.data.secondary.bus_speed = driver_uart_get_baudrate();
+    fd_bus = driver_uart_get_fd();
+  } else if (config.bus == NET) {
+    fd_bus = driver_net_get_fd();
+  }
+
+  ret = handoff_send_record(fd_handoff, &record, fd_bus);
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (config_get_device_lock_fd() != -1) {
+    memset(&record, 0, sizeof(record));
+    record.type = HANDOFF_RECORD_DEVICE_LOCK;
+
+    ret = handoff_send_record(fd_handoff, &record, config_get_device_lock_fd());
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ep_count = core_get_opened_endpoints(&ep_ids);
+  for (size_t i = 0; i < ep_count; i++) {
+    memset(&record, 0, sizeof(record));
+    record.type = HANDOFF_RECORD_ENDPOINT;
+    record.endpoint_number = ep_ids[i];
+    core_export_endpoint(ep_ids[i], &record.data.endpoint);
+
+    if (record.data.endpoint.state == SL_CPC_STATE_CLOSED) {
+      continue;
+    }
+
+    ret = handoff_send_record(fd_handoff, &record, -1);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  ret = server_export(fd_handoff);
+  if (ret < 0) {
+    return ret;
+  }
+
+  return handoff_send_type(fd_handoff, HANDOFF_RECORD_END);
+}
+
+/* The new daemon accepted the link, stop using it and leave */
+static void handoff_release(int fd_handoff)
+{
+  handoff_record_t record;
+  int ret;
+
+  /* The driver must be done with the bus before the one of the new daemon starts */
+  ret = driver_kill_signal_and_join();
+  FATAL_ON(ret != 0);
+
+  memset(&record, 0, sizeof(record));
+  record.type = HANDOFF_RECORD_RELEASED;
+#if defined(CPC_BENCH)
+  if (config.bus == EMUL) {
+    driver_emul_get_bench_sequences(record.data.released.emul_seq, record.data.released.emul_ack);
+  }
+#endif
+
+  ret = handoff_send_record(fd_handoff, &record, -1);
+  if (ret < 0) {
+    WARN("Hot restart: the new daemon is gone, %s", strerror(-ret));
+  }
+
+  close(fd_handoff);
+
+  server_on_handoff_released();
+
+  PRINT_INFO("The link was handed over to the new daemon");
+  config_exit_cpcd(EXIT_SUCCESS);
+}
+
+static void handoff_process_epoll_fd_listen(epoll_private_data_t *private_data)
+{
+  struct ucred credentials;
+  socklen_t credentials_length = sizeof(credentials);
+  handoff_record_t record;
+  const char *reason;
+  bool transient;
+  int fd_handoff;
+  int fd;
+  int ret;
+
+  fd_handoff = accept4(private_data->file_descriptor, NULL, NULL, SOCK_CLOEXEC);
+  if (fd_handoff < 0) {
+    WARN("Hot restart: accept failed, %m");
+    return;
+  }
+
+  /* The file permissions of the socket folder are the first barrier */
+  ret = getsockopt(fd_handoff, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length);
+  if (ret < 0 || credentials.uid != geteuid()) {
+    WARN("Hot restart: refusing a daemon run by another user");
+    close(fd_handoff);
+    return;
+  }
+
+  handoff_set_timeouts(fd_handoff);
+
+  ret = handoff_receive_record(fd_handoff, &record, &fd);
+  if (fd != -1) {
+    close(fd);
+  }
+  if (ret < 0 || record.type != HANDOFF_RECORD_HELLO) {
+    WARN("Hot restart: unexpected request from pid %d", credentials.pid);
+    close(fd_handoff);
+    return;
+  }
+
+  reason = handoff_refusal(&record.data.hello, &transient);
+  if (reason != NULL) {
+    if (transient) {
+      TRACE_SERVER("Hot restart: not now, %s", reason);
+    } else {
+      WARN("Hot restart: refused, %s", reason);
+    }
+    handoff_send_refusal(fd_handoff, reason, transient);
+    close(fd_handoff);
+    return;
+  }
+
+  PRINT_INFO("Handing the link over to the new daemon (pid %d)", credentials.pid);
+
+  ret = handoff_export(fd_handoff);
+  if (ret == 0) {
+    ret = handoff_receive_record(fd_handoff, &record, &fd);
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  if (ret < 0 || record.type != HANDOFF_RECORD_ACCEPTED) {
+    WARN("Hot restart: aborted, %s. Resuming", ret < 0 ? strerror(-ret) : "the new daemon rejected the link");
+    close(fd_handoff);
+    return;
+  }
+
+  handoff_release(fd_handoff);
+}
+
+void handoff_listen(void)
+{
+  struct sockaddr_un name;
+  int ret;
+
+  handoff_get_socket_path(&name);
+
+  handoff.fd_listen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  FATAL_SYSCALL_ON(handoff.fd_listen < 0);
+
+  /* The one of the daemon this one took the link over from */
+  ret = unlink(name.sun_path);
+  FATAL_SYSCALL_ON(ret < 0 && errno != ENOENT);
+
+  ret = bind(handoff.fd_listen, (const struct sockaddr *) &name, sizeof(name));
+  FATAL_SYSCALL_ON(ret < 0);
+
+  ret = listen(handoff.fd_listen, 1);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  handoff.listen_private_data.callback = handoff_process_epoll_fd_listen;
+  handoff.listen_private_data.callback_type = EPOLL_CALLBACK_OTHER;
+  handoff.listen_private_data.endpoint_number = 0; /* Irrelevant here */
+  handoff.listen_private_data.file_descriptor = handoff.fd_listen;
+
+  epoll_register(&handoff.listen_private_data);
+
+  TRACE_SERVER("Hot restart: listening on %s", name.sun_path);
+}
+
+/*******************************************************************************
+ ****************************   NEW DAEMON   ***********************************
+ ******************************************************************************/
+
+/*
+ * The file descriptors received are moved out of the way, to the upper half of
+ * RLIMIT_NOFILE. The client connections can then be given back the numbers the
+ * clients know them by, whatever order they came in.
+ */
+static int handoff_park(int fd)
+{
+  int parked;
+
+  if (fd == -1) {
+    return -1;
+  }
+
+  parked = fcntl(fd, F_DUPFD_CLOEXEC, handoff.parking_base);
+  FATAL_SYSCALL_ON(parked < 0);
+  close(fd);
+
+  return parked;
+}
+
+static int handoff_connect(const struct sockaddr_un *name)
+{
+  int fd_handoff;
+  int ret;
+
+  fd_handoff = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  FATAL_SYSCALL_ON(fd_handoff < 0);
+
+  ret = connect(fd_handoff, (const struct sockaddr *) name, sizeof(*name));
+  if (ret < 0) {
+    FATAL("No daemon with hot_restart is running instance %s (%s : %m)", config.instance_name, name->sun_path);
+  }
+
+  handoff_set_timeouts(fd_handoff);
+
+  return handoff_park(fd_handoff);
+}
+
+static void handoff_keep(const handoff_record_t *record, int fd)
+{
+  handoff_received_t *received;
+
+  received = realloc(handoff.received, (handoff.received_count + 1) * sizeof(handoff_received_t));
+  FATAL_ON(received == NULL);
+  handoff.received = received;
+
+  received[handoff.received_count].record = *record;
+  received[handoff.received_count].fd = handoff_park(fd);
+  handoff.received_count++;
+}
+
+/* Put the state received where the resume takes it from. Returns why it can't be, NULL if it can */
+static const char* handoff_place(void)
+{
+  bool secondary_received = false;
+
+  for (size_t i = 0; i < handoff.received_count; i++) {
+    handoff_received_t *received = &handoff.received[i];
+    const handoff_record_t *record = &received->record;
+
+    switch (record->type) {
+      case HANDOFF_RECORD_SECONDARY:
+        if (record->data.secondary.bus != (uint32_t)config.bus) {
+          return "the running daemon is configured with another bus";
+        }
+        if ((config.bus == UART || config.bus == NET) && received->fd == -1) {
+          return "the bus was not handed over";
+        }
+        if (record->data.secondary.secondary_tx_window_size < TRANSMIT_WINDOW_MIN_SIZE
+            || record->data.secondary.secondary_tx_window_size > TRANSMIT_WINDOW_MAX_SIZE) {
+          return "the secondary has an invalid tx window";
+        }
+        handoff.secondary = record->data.secondary;
+        handoff.secondary.app_version[sizeof(handoff.secondary.app_version) - 1] = '\0';
+        handoff.fd_bus = received->fd;
+        secondary_received = true;
+        break;
+
+      case HANDOFF_RECORD_DEVICE_LOCK:
+        /* Kept open for as long as this daemon runs, like in prevent_device_collision() */
+        break;
+
+      case HANDOFF_RECORD_ENDPOINT:
+        if (record->data.endpoint.tx_window_size < TRANSMIT_WINDOW_MIN_SIZE
+            || record->data.endpoint.tx_window_size > TRANSMIT_WINDOW_MAX_SIZE) {
+          return "an endpoint has an invalid tx window";
+        }
+        break;
+
+      case HANDOFF_RECORD_CTRL_SOCKET:
+        handoff.fd_ctrl_socket = received->fd;
+        break;
+
+      case HANDOFF_RECORD_DATA_CONNECTION:
+      {
+        int fd_number = record->data.connection.fd_number;
+
+        if (received->fd == -1) {
+          return "a client connection was not handed over";
+        }
+        if (fd_number < 0 || fd_number >= handoff.parking_base) {
+          return "a client connection has a file descriptor number out of reach, raise rlimit_nofile";
+        }
+        if (fcntl(fd_number, F_GETFD) != -1) {
+          return "a client connection has a file descriptor number already in use";
+        }
+
+        FATAL_SYSCALL_ON(dup3(received->fd, fd_number, O_CLOEXEC) < 0);
+        close(received->fd);
+        received->fd = fd_number;
+      }
+      break;
+
+      case HANDOFF_RECORD_ENDPOINT_SOCKET:
+      case HANDOFF_RECORD_ENDPOINT_EVENT_SOCKET:
+      case HANDOFF_RECORD_CTRL_CONNECTION:
+      case HANDOFF_RECORD_EVENT_CONNECTION:
+        if (received->fd == -1) {
+          return "a socket was not handed over";
+        }
+        break;
+
+      default:
+        return "the running daemon sent an unexpected record";
+    }
+  }
+
+  if (!secondary_received || handoff.fd_ctrl_socket == -1) {
+    return "the state handed over is incomplete";
+  }
+
+  return NULL;
+}
+
+void handoff_take_over(void)
+{
+  struct sockaddr_un name;
+  struct rlimit limit;
+  handoff_record_t record;
+  const char *reason;
+  int fd_handoff;
+  int fd = -1;
+  int ret;
+
+  handoff.fd_bus = -1;
+  handoff.fd_ctrl_socket = -1;
+
+  FATAL_SYSCALL_ON(getrlimit(RLIMIT_NOFILE, &limit) < 0);
+  handoff.parking_base = (int)(limit.rlim_cur / 2);
+
+  handoff_get_socket_path(&name);
+
+  PRINT_INFO("Taking the link over from the daemon running instance %s...", config.instance_name);
+
+  /* The running daemon only lets go of an idle link */
+  for (unsigned int attempt = 1;; attempt++) {
+    fd_handoff = handoff_connect(&name);
+
+    memset(&record, 0, sizeof(record));
+    record.type = HANDOFF_RECORD_HELLO;
+    record.data.hello.version = HANDOFF_VERSION;
+    record.data.hello.record_size = sizeof(handoff_record_t);
+
+    ret = handoff_send_record(fd_handoff, &record, -1);
+    if (ret == 0) {
+      ret = handoff_receive_record(fd_handoff, &record, &fd);
+    }
+    if (ret < 0) {
+      FATAL("Hot restart: no answer from the running daemon, %s", strerror(-ret));
+    }
+
+    if (record.type != HANDOFF_RECORD_REFUSED) {
+      break;
+    }
+
+    close(fd_handoff);
+    record.data.reason.text[sizeof(record.data.reason.text) - 1] = '\0';
+
+    if (!record.data.reason.transient || attempt == HANDOFF_RETRY_COUNT) {
+      FATAL("The running daemon refused the hot restart : %s", record.data.reason.text);
+    }
+
+    TRACE_SERVER("Hot restart: the running daemon is busy, %s", record.data.reason.text);
+    sleep_ms(HANDOFF_RETRY_PERIOD_MS);
+  }
+
+  while (record.type != HANDOFF_RECORD_END) {
+    handoff_keep(&record, fd);
+
+    ret = handoff_receive_record(fd_handoff, &record, &fd);
+    if (ret < 0) {
+      FATAL("Hot restart: the running daemon stopped handing the link over, %s", strerror(-ret));
+    }
+  }
+
+  reason = handoff_place();
+  if (reason != NULL) {
+    (void)handoff_send_type(fd_handoff, HANDOFF_RECORD_REJECTED);
+    FATAL("Can't take the link over : %s", reason);
+  }
+
+  ret = handoff_send_type(fd_handoff, HANDOFF_RECORD_ACCEPTED);
+  if (ret == 0) {
+    ret = handoff_receive_record(fd_handoff, &record, &fd);
+  }
+  if (ret < 0 || record.type != HANDOFF_RECORD_RELEASED) {
+    FATAL("Hot restart: the running daemon didn't release the link");
+  }
+
+#if defined(CPC_BENCH)
+  handoff.released = record.data.released;
+#endif
+
+  close(fd_handoff);
+
+  handoff.resuming = true;
+
+  PRINT_INFO("Took the link over, %zu records handed over", handoff.received_count);
+}
+
+bool handoff_is_resuming(void)
+{
+  return handoff.resuming;
+}
+
+const handoff_secondary_t *handoff_get_secondary(void)
+{
+  BUG_ON(!handoff.resuming);
+  return &handoff.secondary;
+}
+
+int handoff_get_bus_fd(void)
+{
+  BUG_ON(!handoff.resuming);
+  return handoff.fd_bus;
+}
+
+int handoff_get_ctrl_socket(void)
+{
+  BUG_ON(!handoff.resuming);
+  return handoff.fd_ctrl_socket;
+}
+
+#if defined(CPC_BENCH)
+const handoff_released_t *handoff_get_released(void)
+{
+  BUG_ON(!handoff.resuming);
+  return &handoff.released;
+}
+#endif
+
+void handoff_resume(void)
+{
+  BUG_ON(!handoff.resuming);
+
+  /* The endpoints come first, then their sockets and connections */
+  for (size_t i = 0; i < handoff.received_count; i++) {
+    const handoff_received_t *received = &handoff.received[i];
+
+    switch (received->record.type) {
+      case HANDOFF_RECORD_ENDPOINT:
+        core_import_endpoint(&received->record.data.endpoint);
+        break;
+
+      case HANDOFF_RECORD_ENDPOINT_SOCKET:
+      case HANDOFF_RECORD_ENDPOINT_EVENT_SOCKET:
+      case HANDOFF_RECORD_CTRL_CONNECTION:
+      case HANDOFF_RECORD_DATA_CONNECTION:
+      case HANDOFF_RECORD_EVENT_CONNECTION:
+        server_import(&received->record, received->fd);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  sl_cpc_system_set_next_command_seq(handoff.secondary.next_command_seq);
+
+  free(handoff.received);
+  handoff.received = NULL;
+  handoff.received_count = 0;
+}
@@ -0,0 +1,162 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Hot restart handoff
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2023 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A daemon started with --hot-restart takes the link over from the one running
+ * with hot_restart enabled, without resetting the secondary nor disconnecting
+ * the clients. The running daemon passes the bus, its listening sockets and the
+ * connections of the clients over SCM_RIGHTS on handoff.cpcd.sock, along with
+ * what the reset sequence learned and the state of the open endpoints. Once the
+ * new daemon accepted them, the old one stops its driver and exits, and the new
+ * one resumes the link where it was, sequence numbers included.
+ *
+ * The link is only handed over when it is idle: no frame in flight, no system
+ * command pending, no client being connected or disconnected. Otherwise the
+ * running daemon refuses, and the new one tries again for a while.
+ */
+
+/* Bumped on any change of the records below, both daemons must agree on it */
+#define HANDOFF_VERSION 4u
+
+#define HANDOFF_REASON_MAX_LENGTH       128
+#define HANDOFF_APP_VERSION_MAX_LENGTH  64
+
+typedef enum {
+  HANDOFF_RECORD_HELLO,                   // New to old, first of all
+  HANDOFF_RECORD_REFUSED,                 // Old to new, instead of the state
+  HANDOFF_RECORD_SECONDARY,               // With the bus, if it is a file descriptor
+  HANDOFF_RECORD_DEVICE_LOCK,             // The lock on the device, see prevent_device_collision()
+  HANDOFF_RECORD_ENDPOINT,                // The core side of an endpoint not closed
+  HANDOFF_RECORD_CTRL_SOCKET,             // ctrl.cpcd.sock
+  HANDOFF_RECORD_ENDPOINT_SOCKET,         // epX.cpcd.sock
+  HANDOFF_RECORD_ENDPOINT_EVENT_SOCKET,   // epX.event.cpcd.sock
+  HANDOFF_RECORD_CTRL_CONNECTION,
+  HANDOFF_RECORD_DATA_CONNECTION,
+  HANDOFF_RECORD_EVENT_CONNECTION,
+  HANDOFF_RECORD_END,                     // Old to new, the state is complete
+  HANDOFF_RECORD_ACCEPTED,                // New to old, the old one can let go
+  HANDOFF_RECORD_REJECTED,                // New to old, the old one resumes
+  HANDOFF_RECORD_RELEASED,                // Old to new, the driver of the old one is stopped
+} handoff_record_type_t;
+
+typedef struct {
+  uint32_t version;
+  uint32_t record_size;
+} handoff_hello_t;
+
+typedef struct {
+  bool transient; // Worth trying again, the link is busy
+  char text[HANDOFF_REASON_MAX_LENGTH];
+} handoff_reason_t;
+
+/* What the reset sequence learned from the secondary */
+typedef struct {
+  uint32_t bus;             // bus_t, the new daemon must be configured with the same
+  uint32_t bus_speed;       // UART baud rate in use
+  uint32_t rx_capability;
+  uint32_t capabilities;
+  uint32_t secondary_max_bus_speed;
+  uint8_t tx_window_size;
+  uint8_t secondary_tx_window_size; // The one it transmits with
+  bool fragmentation;
+  bool aggregation;
+  bool compression;
+  uint8_t protocol_version;
+  uint8_t next_command_seq; // Of the system endpoint
+  char app_version[HANDOFF_APP_VERSION_MAX_LENGTH]; // Empty if not known
+} handoff_secondary_t;
+
+/* The core state of an endpoint, the system endpoint only needs its sequence numbers */
+typedef struct {
+  uint8_t id;
+  uint8_t state;            // cpc_endpoint_state_t
+  uint8_t flags;
+  uint8_t seq;
+  uint8_t ack;
+  uint8_t tx_window_size;
+  uint8_t tx_priority;
+  uint8_t tx_weight;
+  bool fragmentation;
+  uint8_t max_re_transmit;
+  uint32_t aggregation_deadline_us; // 0 if the endpoint doesn't aggregate
+  bool compression;
+  uint16_t min_re_transmit_timeout_ms;
+  uint16_t max_re_transmit_timeout_ms;
+  uint32_t re_transmit_timeout_ms;
+} handoff_endpoint_t;
+
+/* A client connection, the data ones keep their file descriptor number: the clients refer to it */
+typedef struct {
+  int32_t fd_number;
+  int32_t pid;              // Of the client of a control connection
+} handoff_connection_t;
+
+/* The emulated secondary of cpc_bench lives in the daemon, it is handed over too */
+typedef struct {
+  uint8_t emul_seq[256];
+  uint8_t emul_ack[256];
+} handoff_released_t;
+
+typedef struct {
+  uint32_t type;            // handoff_record_type_t
+  uint8_t endpoint_number;
+  union {
+    handoff_hello_t hello;
+    handoff_reason_t reason;
+    handoff_secondary_t secondary;
+    handoff_endpoint_t endpoint;
+    handoff_connection_t connection;
+    handoff_released_t released;
+  } data;
+} handoff_record_t;
+
+/* Running daemon: listen on handoff.cpcd.sock if config.hot_restart is set */
+void handoff_listen(void);
+
+/* New daemon: take the link over, before the driver starts. Crashes the app if refused. */
+void handoff_take_over(void);
+
+/* New daemon: whether the link was taken over */
+bool handoff_is_resuming(void);
+
+/* New daemon: what the running daemon knew about the secondary */
+const handoff_secondary_t *handoff_get_secondary(void);
+
+/* New daemon: the bus the driver adopts instead of opening it, -1 on the EMUL bus */
+int handoff_get_bus_fd(void);
+
+/* New daemon: the listening control socket the server adopts */
+int handoff_get_ctrl_socket(void);
+
+#if defined(CPC_BENCH)
+/* New daemon: the sequence numbers the emulated secondary resumes from */
+const handoff_released_t *handoff_get_released(void);
+#endif
+
+/* Send a record, with a file descriptor if fd is not -1. Returns 0 or -errno. */
+int handoff_send_record(int fd_handoff, const handoff_record_t *record, int fd);
+
+/* New daemon: restore the endpoints and the connections, once the server is initialized */
+void handoff_resume(void);
+
+#endif //HANDOFF_H
@@ -15,8 +15,12 @@
  *
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <sys/stat.h>
-#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/epoll.h>
@@ -27,38 +31,57 @@
 #include <signal.h>
 
 #include "misc/errno_codename.h"
+#include "misc/flight_recorder.h"
 #include "misc/logging.h"
 #include "misc/config.h"
+#include "misc/memlock.h"
+#include "misc/mempool.h"
 #include "misc/utils.h"
+#include "misc/shm_ring.h"
+#include "misc/shm_broadcast.h"
+#include "misc/sl_queue.h"
 #include "misc/sl_slist.h"
+#include "misc/tracepoints.h"
 #include "security/security.h"
 #include "server_core/server/server.h"
 #include "server_core/server/server_internal.h"
 #include "server_core/server/server_ready_sync.h"
+#include "server_core/server/server_io.h"
 #include "server_core/server_core.h"
 #include "server_core/system_endpoint/system_callbacks.h"
 #include "server_core/system_endpoint/system.h"
 #include "server_core/epoll/epoll.h"
+#include "server_core/epoll/timer.h"
 #include "server_core/core/core.h"
+#include "server_core/handoff/handoff.h"
 #include "server_core/cpcd_exchange.h"
 #include "server_core/cpcd_event.h"
 #include "sl_cpc.h"
 #include "version.h"
 
+/* Not known to older C libraries */
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
 /*******************************************************************************
  ***************************  LOCAL DECLARATIONS   *****************************
  ******************************************************************************/
 
 typedef struct {
-  sl_slist_node_t node;
+  sl_slist_node_t node;       // In the queue of the waiting opens, or the list of those in flight
+  sl_slist_node_t ctrl_node;  // In the list of its control connection, until it closes
   uint8_t endpoint_id;
-  int fd_ctrl_data_socket;
+  int fd_ctrl_data_socket;    // -1 once the control connection closed
+  bool in_flight;
 }pending_connection_list_item_t;
 
 typedef struct {
-  sl_slist_node_t node;
+  sl_slist_node_t node;       // In its bucket of the control connections by file descriptor
+  sl_slist_node_t pid_node;   // In its bucket of the control connections by pid, once it is set
   epoll_private_data_t data_socket_epoll_private_data;
   pid_t pid;
+  sl_slist_node_t *pending_connections;
 }ctrl_socket_private_data_list_item_t;
 
 typedef struct {
@@ -69,10 +92,39 @@ typedef struct {
 typedef struct {
   sl_slist_node_t node;
   epoll_private_data_t data_socket_epoll_private_data;
+  /* Shared memory transport, set up when the client asks for it */
+  void *shm_base;
+  size_t shm_length;
+  shm_ring_t tx_ring;                // Client to daemon
+  shm_broadcast_cursor_t *rx_cursor; // Where the client is in the broadcast ring of the endpoint
+  bool lapped;                       // The last frame overwrote messages the client had yet to read, or was lost
+  epoll_private_data_t doorbell_epoll_private_data;
+  int fd_rx_doorbell;
+  int fd_tx_doorbell;
+  /* Frames waiting for room in the socket of a slow client */
+  sl_queue_t backlog;
+  size_t backlog_bytes;
+  size_t backlog_max_frames;
+  size_t backlog_max_bytes;
+  uint32_t backlog_dropped;
+  /* Send buffer sized by client_socket_autotune, as reported by SO_SNDBUF */
+  int sndbuf;
+  size_t sndbuf_bytes_sent;      // During the current autotune period
+  size_t sndbuf_throughput;      // Bytes sent during the last autotune period
+  uint32_t sndbuf_idle_periods;
+  /* Identifies the socket to the server I/O thread, which may still report on a previous one with the same fd */
+  uint32_t io_connection_id;
 }data_socket_private_data_list_item_t;
 
 typedef struct {
   sl_slist_node_t node;
+  size_t length;
+  uint8_t data[];
+}backlog_list_item_t;
+
+typedef struct {
+  sl_slist_node_t node;       // In its bucket of the socket pairs by data socket
+  uint8_t endpoint_number;
   int fd_data_socket;
   int fd_ctrl_data_socket;
 }data_ctrl_data_socket_pair_close_list_item_t;
@@ -85,36 +137,119 @@ typedef struct {
   epoll_private_data_t connection_socket_epoll_private_data;
   sl_slist_node_t* event_data_socket_epoll_private_data;
   sl_slist_node_t* data_socket_epoll_private_data;
-  sl_slist_node_t* data_ctrl_data_socket_pair;
+  uint32_t data_ctrl_data_socket_pairs;
+  /* Frames are written once to this ring for all the clients on the shared memory transport */
+  shm_broadcast_t broadcast;
+  void *broadcast_base;
+  size_t broadcast_length;
+  int fd_broadcast;
+  uint32_t broadcast_clients;
 #if defined(ENABLE_ENCRYPTION)
   bool encrypted;
 #endif
 }endpoint_control_block_t;
 
-/*******************************************************************************
- ***************************  GLOBAL VARIABLES   *******************************
- ******************************************************************************/
+/* Maximum number of endpoint open handshakes waiting on the secondary at once */
+#define SERVER_MAX_PENDING_OPENS_IN_FLIGHT 8
+
+/* Waiting endpoint opens looked at per iteration of the loop, so that a storm of
+ * reconnections doesn't hold the bus. The rest are looked at in the next ones */
+#define SERVER_PENDING_CONNECTIONS_PER_ITERATION 32
+
+/* Buckets of the tables of the connections, by file descriptor or by pid. The
+ * kernel hands both out in sequence, their low bits spread them evenly */
+#define SERVER_CONNECTION_BUCKET_COUNT 64
+#define SERVER_CONNECTION_BUCKET(key) ((size_t)(unsigned int)(key) & (SERVER_CONNECTION_BUCKET_COUNT - 1))
 
-endpoint_control_block_t endpoints[256];
+/* The traffic of each client is looked at once per period by client_socket_autotune */
+#define SOCKET_AUTOTUNE_PERIOD_US 1000000u
 
-/* List to keep track of libraries that are blocking on the cpc_open call */
-static sl_slist_node_t *pending_connections;
+/* Periods without traffic after which the send buffer of a client is halved */
+#define SOCKET_AUTOTUNE_IDLE_PERIODS 5
 
-/* List to keep track of every connected library instance over the control socket */
-static sl_slist_node_t *ctrl_connections;
+/* A grown send buffer holds at least this fraction of a period of the throughput of the client */
+#define SOCKET_AUTOTUNE_THROUGHPUT_DIVIDER 10
+
+#if !defined(UNIT_TESTING)
+/* Idle time of the link after which a no-op keep alive is sent, until tuned at runtime */
+#define NOOP_KEEP_ALIVE_PERIOD_US 5000000u
+#endif
 
 /*******************************************************************************
  ***************************  LOCAL VARIABLES   ********************************
  ******************************************************************************/
 
-static int fd_socket_ctrl;
+static struct {
+  endpoint_control_block_t endpoints[256];
+
+  /* List to keep track of libraries that are blocking on the cpc_open call */
+  sl_queue_t pending_connections;
+
+  /* The waiting ones are looked at in rounds, a few per iteration of the loop */
+  size_t pending_connections_unseen;        // At the head of the queue, left to look at in this round
+  bool pending_connections_queued;          // At its tail since the round started
+  epoll_timer_t pending_connections_timer;  // Brings the loop around again to go on with the round
+
+  /* Those with their handshake with the secondary started */
+  sl_slist_node_t *pending_connections_in_flight;
+  size_t pending_opens_in_flight;
+
+  /* Every connected library instance over the control socket, by file descriptor and by pid */
+  sl_slist_node_t *ctrl_connections[SERVER_CONNECTION_BUCKET_COUNT];
+  sl_slist_node_t *ctrl_connections_by_pid[SERVER_CONNECTION_BUCKET_COUNT];
+  size_t ctrl_connection_count;
+
+  /* Clients to notify when a data socket closes, by data socket */
+  sl_slist_node_t *data_ctrl_data_socket_pairs[SERVER_CONNECTION_BUCKET_COUNT];
+
+  int fd_socket_ctrl;
+  epoll_private_data_t fd_socket_ctrl_private_data;
+
+  /* Datagrams are received directly in buffers of the core, which are handed over to it as is */
+  struct {
+    struct mmsghdr msgs[SERVER_DATA_SOCKET_BATCH_SIZE];
+    struct iovec iovecs[SERVER_DATA_SOCKET_BATCH_SIZE];
+    void *buffers[SERVER_DATA_SOCKET_BATCH_SIZE];
+  } data_socket_batch;
+
+  /* Core buffer the next message of a shared memory ring is popped into */
+  void *shm_write_buffer;
+
+  /* Datagrams of the endpoints with fragmentation, larger than a core buffer */
+  uint8_t *fragmented_datagram;
+
+  /* Frames waiting for slow clients, preallocated in the deterministic memory mode */
+  mempool_t backlog_pool;
+
+  uint32_t next_io_connection_id;
+
+  /* Table of the endpoint states the clients read without a query, see cpcd_exchange_state_table_t */
+  cpcd_exchange_state_table_t *state_table;
+  int fd_state_table;
+
+  /* client_socket_autotune */
+  epoll_timer_t socket_autotune_timer;
+  int default_sndbuf;            // Of a new data socket
+  size_t sndbuf_granted;         // Above default_sndbuf, summed over the clients
+  uint64_t sndbuf_grown;
+  uint64_t sndbuf_shrunk;
+
+#if !defined(UNIT_TESTING)
+  epoll_timer_t noop_timer;
+  uint64_t noop_keep_alive_period_us;
+
+  /* Valid frames received from the secondary when the link was last known to be idle */
+  uint32_t noop_keep_alive_rx_frames;
+#endif
+} server;
 
 /*******************************************************************************
  **************************   LOCAL FUNCTIONS   ********************************
  ******************************************************************************/
 
 #if !defined(UNIT_TESTING)
-static void server_process_epoll_fd_timeout_noop(epoll_private_data_t *private_data);
+static uint32_t server_rxd_valid_frames(void);
+static void server_process_timeout_noop(epoll_timer_t *timer);
 #endif
 
 static void server_process_epoll_fd_ctrl_connection_socket(epoll_private_data_t *private_data);
@@ -133,23 +268,41 @@ static void server_handle_client_closed_event_connection(int fd_data_socket, uin
 static void server_ep_push_close_socket_pair(int fd_data_socket, int fd_ctrl_data_socket, uint8_t endpoint_number);
 static bool server_ep_find_close_socket_pair(int fd_data_socket, int fd_ctrl_data_socket, uint8_t endpoint_number);
 static int server_pull_data_from_data_socket(int fd_data_socket, uint8_t** buffer_ptr, size_t* buffer_len_ptr);
+static void server_pull_fragmented_datagrams(int fd_data_socket, uint8_t endpoint_number);
+static void server_open_shm_transport(int fd_ctrl_data_socket, cpcd_exchange_buffer_t *interface_buffer, size_t buffer_len);
+static void server_open_state_table(void);
+static void server_send_state_table(int fd_ctrl_data_socket, cpcd_exchange_buffer_t *interface_buffer, size_t buffer_len);
+static void server_process_epoll_fd_shm_doorbell(epoll_private_data_t *private_data);
+static void server_close_shm_transport(data_socket_private_data_list_item_t *item);
+static sl_status_t server_push_to_broadcast(uint8_t endpoint_number, const uint8_t* data, size_t data_len);
+static int server_send_to_data_socket(data_socket_private_data_list_item_t *item, const uint8_t* data, size_t data_len);
+static int server_flush_backlog(data_socket_private_data_list_item_t *item);
+static void server_clear_backlog(data_socket_private_data_list_item_t *item);
+static void server_watch_data_socket(data_socket_private_data_list_item_t *item);
+static void server_unwatch_data_socket(data_socket_private_data_list_item_t *item);
+static void server_set_data_socket_events(data_socket_private_data_list_item_t *item, uint32_t events);
+static void server_close_data_socket(data_socket_private_data_list_item_t *item);
+static void server_init_socket_autotune(void);
+static void server_track_sndbuf(data_socket_private_data_list_item_t *item);
+static bool server_grow_sndbuf(data_socket_private_data_list_item_t *item, size_t pending);
+static void server_process_timeout_socket_autotune(epoll_timer_t *timer);
+static void server_process_timeout_pending_connections(epoll_timer_t *timer);
 
 /*******************************************************************************
  **************************   IMPLEMENTATION    ********************************
  ******************************************************************************/
 void server_init(void)
 {
-#if !defined(UNIT_TESTING)
-  int fd_timer_noop;
-#endif
-
   int ret;
 
-  /* Create the control socket /tmp/cpcd/{instance_name}/ctrl.cpcd.sock and start listening for connections */
-  {
+  /* Create the control socket /tmp/cpcd/{instance_name}/ctrl.cpcd.sock and start listening for connections.
+   * On a hot restart, it is the one of the previous daemon, with the clients it has yet to accept */
+  if (handoff_is_resuming()) {
+    server.fd_socket_ctrl = handoff_get_ctrl_socket();
+  } else {
     /* Create datagram socket for control */
-    fd_socket_ctrl = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-    FATAL_SYSCALL_ON(fd_socket_ctrl < 0);
+    server.fd_socket_ctrl = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    FATAL_SYSCALL_ON(server.fd_socket_ctrl < 0);
 
     /* Bind socket to socket name. */
     {
@@ -171,7 +324,7 @@ void server_init(void)
         FATAL_ON(nchars < 0 || (size_t) nchars >= size);
       }
 
-      ret = bind(fd_socket_ctrl, (const struct sockaddr *) &name, sizeof(name));
+      ret = bind(server.fd_socket_ctrl, (const struct sockaddr *) &name, sizeof(name));
       FATAL_SYSCALL_ON(ret < 0);
     }
 
@@ -180,61 +333,52 @@ void server_init(void)
      * to 5. So while one request is being processed other requests
      * can be waiting.
      */
-    ret = listen(fd_socket_ctrl, 5);
+    ret = listen(server.fd_socket_ctrl, 5);
     FATAL_SYSCALL_ON(ret < 0);
+  }
 
-    /* Init the linked list of connected instances of the library to /run/cpc/ctrl.cpcd.sock (to empty) */
-    sl_slist_init(&ctrl_connections);
-
-    /* Init the linked list of pending client connections */
-    sl_slist_init(&pending_connections);
+  /* Init the tables of connected instances of the library to /run/cpc/ctrl.cpcd.sock (to empty) */
+  for (size_t i = 0; i != SERVER_CONNECTION_BUCKET_COUNT; i++) {
+    sl_slist_init(&server.ctrl_connections[i]);
+    sl_slist_init(&server.ctrl_connections_by_pid[i]);
+    sl_slist_init(&server.data_ctrl_data_socket_pairs[i]);
   }
 
+  /* Init the linked list of pending client connections */
+  sl_queue_init(&server.pending_connections);
+  sl_slist_init(&server.pending_connections_in_flight);
+  epoll_timer_init(&server.pending_connections_timer, server_process_timeout_pending_connections);
+
   /* Initialize every endpoint control block */
   {
     size_t i;
 
     for (i = 1; i != 256; i++) { /* dont care for ep#0 */
-      endpoints[i].open_data_connections = 0;
-      endpoints[i].open_event_connections = 0;
-      endpoints[i].pending_close = 0;
-      endpoints[i].connection_socket_epoll_private_data.endpoint_number = (uint8_t)i;
-      endpoints[i].connection_socket_epoll_private_data.file_descriptor = -1;
-      endpoints[i].event_connection_socket_epoll_private_data.file_descriptor = -1;
-      sl_slist_init(&endpoints[i].data_socket_epoll_private_data);
-      sl_slist_init(&endpoints[i].event_data_socket_epoll_private_data);
-      sl_slist_init(&endpoints[i].data_ctrl_data_socket_pair);
+      server.endpoints[i].open_data_connections = 0;
+      server.endpoints[i].open_event_connections = 0;
+      server.endpoints[i].pending_close = 0;
+      server.endpoints[i].connection_socket_epoll_private_data.endpoint_number = (uint8_t)i;
+      server.endpoints[i].connection_socket_epoll_private_data.file_descriptor = -1;
+      server.endpoints[i].event_connection_socket_epoll_private_data.file_descriptor = -1;
+      sl_slist_init(&server.endpoints[i].data_socket_epoll_private_data);
+      sl_slist_init(&server.endpoints[i].event_data_socket_epoll_private_data);
+      server.endpoints[i].data_ctrl_data_socket_pairs = 0;
     }
   }
 
-  /* Setup no-op timer. Trig in 1 sec, and every 1 sec after that */
-  if (config.use_noop_keep_alive) {
-#if !defined(UNIT_TESTING)
-    const struct itimerspec timeout = { .it_interval = { .tv_sec = 5, .tv_nsec = 0 },
-                                        .it_value    = { .tv_sec = 5, .tv_nsec = 0 } };
-
-    /* Periodic no-op timer  */
-    {
-      fd_timer_noop = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-      FATAL_SYSCALL_ON(fd_timer_noop < 0);
-
-      ret = timerfd_settime(fd_timer_noop,
-                            0,
-                            &timeout,
-                            NULL);
-      FATAL_SYSCALL_ON(ret < 0);
-    }
-
-    /* Setup the timerfd for noop polling */
-    {
-      static epoll_private_data_t private_data;
+  server_open_state_table();
 
-      private_data.callback = server_process_epoll_fd_timeout_noop;
-      private_data.file_descriptor = fd_timer_noop;
-      private_data.endpoint_number = 0; /* Irrelevant here */
+  if (config.client_socket_autotune) {
+    server_init_socket_autotune();
+  }
 
-      epoll_register(&private_data);
-    }
+  /* Setup no-op timer. Trig after 5 sec without any frame from the secondary */
+  if (config.use_noop_keep_alive) {
+#if !defined(UNIT_TESTING)
+    server.noop_keep_alive_rx_frames = server_rxd_valid_frames();
+    server.noop_keep_alive_period_us = NOOP_KEEP_ALIVE_PERIOD_US;
+    epoll_timer_init(&server.noop_timer, server_process_timeout_noop);
+    epoll_timer_start(&server.noop_timer, server.noop_keep_alive_period_us);
 #endif
   }
 
@@ -242,13 +386,14 @@ void server_init(void)
   {
     /* Setup the control socket */
     {
-      static epoll_private_data_t private_data;
+      epoll_private_data_t *private_data = &server.fd_socket_ctrl_private_data;
 
-      private_data.callback = server_process_epoll_fd_ctrl_connection_socket;
-      private_data.file_descriptor = fd_socket_ctrl;
-      private_data.endpoint_number = 0; /* Irrelevant here */
+      private_data->callback = server_process_epoll_fd_ctrl_connection_socket;
+      private_data->file_descriptor = server.fd_socket_ctrl;
+      private_data->callback_type = EPOLL_CALLBACK_SERVER_CONTROL;
+      private_data->endpoint_number = 0; /* Irrelevant here */
 
-      epoll_register(&private_data);
+      epoll_register(private_data);
     }
 
     /* per-endpoint connection sockets are dynamically created [and added to epoll set] when endpoints are opened */
@@ -258,10 +403,58 @@ void server_init(void)
     /* per-endpoint data sockets are dynamically created [and added to epoll set] when instances of library are connecting to an endpoint */
   }
 
+  /* Data sockets are then read on a thread of their own */
+  if (server_io_is_enabled()) {
+    server_io_init();
+  } else if (server_core_secondary_supports_fragmentation()) {
+    server.fragmented_datagram = (uint8_t *)malloc(SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE);
+    FATAL_ON(server.fragmented_datagram == NULL);
+  }
+
+  /* The backlog of one client filled up, the frames to the clients are no larger than what they read at least */
+  if (memlock_is_enabled() && config.client_backlog_max_frames > 0) {
+    mempool_init(&server.backlog_pool,
+                 sizeof(backlog_list_item_t) + SL_CPC_READ_MINIMUM_SIZE,
+                 config.client_backlog_max_frames);
+  }
+
+  /* A new daemon may take the link over from this one */
+  if (config.hot_restart) {
+    handoff_listen();
+  }
+
   /* The server up and running, unblock possible threads waiting for it. */
   server_ready_post();
 }
 
+/* Add a connection accepted on the event socket of an endpoint */
+static void server_add_event_connection(uint8_t endpoint_number, int fd_event_data_socket)
+{
+  event_socket_private_data_list_item_t* new_item;
+
+  /* Allocate resources for this new connection */
+  {
+    new_item = (event_socket_private_data_list_item_t*) zalloc(sizeof(event_socket_private_data_list_item_t));
+    FATAL_ON(new_item == NULL);
+
+    sl_slist_push(&server.endpoints[endpoint_number].event_data_socket_epoll_private_data, &new_item->node);
+  }
+
+  /* Register this new connection's socket to epoll set */
+  {
+    epoll_private_data_t* private_data = &new_item->event_socket_epoll_private_data;
+
+    private_data->callback = server_process_epoll_fd_event_data_socket;
+    private_data->callback_type = EPOLL_CALLBACK_SERVER_EVENT;
+    private_data->endpoint_number = endpoint_number;
+    private_data->file_descriptor = fd_event_data_socket;
+
+    epoll_register(private_data);
+  }
+
+  server.endpoints[endpoint_number].open_event_connections++;
+}
+
 static void server_process_epoll_fd_event_connection_socket(epoll_private_data_t *private_data)
 {
   int new_data_socket, flags;
@@ -274,7 +467,7 @@ static void server_process_epoll_fd_event_connection_socket(epoll_private_data_t
     BUG_ON(endpoint_number == 0);
 
     /* Make sure the connection socket exists */
-    BUG_ON(endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor == -1);
+    BUG_ON(server.endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor == -1);
   }
 
   /* Accept the new connection for that endpoint */
@@ -294,32 +487,66 @@ static void server_process_epoll_fd_event_connection_socket(epoll_private_data_t
     FATAL("fcntl F_SETFL failed.%s", strerror(errno));
   }
 
-  /* Add the new data socket in the list of data sockets for that endpoint */
+  server_add_event_connection(endpoint_number, new_data_socket);
+  PRINT_INFO("Endpoint event socket #%d: Client connected (%d). %d connections", endpoint_number, new_data_socket, server.endpoints[endpoint_number].open_event_connections);
+}
+
+/* Add a connection accepted on the control socket, its client sets its pid later */
+static ctrl_socket_private_data_list_item_t* server_add_ctrl_connection(int fd_ctrl_data_socket)
+{
+  ctrl_socket_private_data_list_item_t* new_item;
+
+  /* Allocate resources for this new connection */
+  new_item = zalloc(sizeof *new_item);
+  FATAL_ON(new_item == NULL);
+  new_item->pid = -1;
+
+  /* Register this new data socket to epoll set */
   {
-    event_socket_private_data_list_item_t* new_item;
+    epoll_private_data_t* private_data = &new_item->data_socket_epoll_private_data;
 
-    /* Allocate resources for this new connection */
-    {
-      new_item = (event_socket_private_data_list_item_t*) zalloc(sizeof(event_socket_private_data_list_item_t));
-      FATAL_ON(new_item == NULL);
+    private_data->callback = server_process_epoll_fd_ctrl_data_socket;
+    private_data->callback_type = EPOLL_CALLBACK_SERVER_CONTROL;
+    private_data->endpoint_number = 0; /* Irrelevent information in the case of ctrl data sockets */
+    private_data->file_descriptor = fd_ctrl_data_socket;
 
-      sl_slist_push(&endpoints[endpoint_number].event_data_socket_epoll_private_data, &new_item->node);
-    }
+    epoll_register(private_data);
+  }
 
-    /* Register this new connection's socket to epoll set */
-    {
-      epoll_private_data_t* private_data = &new_item->event_socket_epoll_private_data;
+  /* Finally, add this new socket item to the table */
+  sl_slist_push(&server.ctrl_connections[SERVER_CONNECTION_BUCKET(fd_ctrl_data_socket)], &new_item->node);
+  server.ctrl_connection_count++;
 
-      private_data->callback = server_process_epoll_fd_event_data_socket;
-      private_data->endpoint_number = endpoint_number;
-      private_data->file_descriptor = new_data_socket;
+  return new_item;
+}
 
-      epoll_register(private_data);
+static ctrl_socket_private_data_list_item_t* server_find_ctrl_connection(int fd_ctrl_data_socket)
+{
+  ctrl_socket_private_data_list_item_t* item;
+
+  SL_SLIST_FOR_EACH_ENTRY(server.ctrl_connections[SERVER_CONNECTION_BUCKET(fd_ctrl_data_socket)],
+                          item,
+                          ctrl_socket_private_data_list_item_t,
+                          node){
+    if (item->data_socket_epoll_private_data.file_descriptor == fd_ctrl_data_socket) {
+      return item;
     }
   }
 
-  endpoints[endpoint_number].open_event_connections++;
-  PRINT_INFO("Endpoint event socket #%d: Client connected (%d). %d connections", endpoint_number, new_data_socket, endpoints[endpoint_number].open_event_connections);
+  return NULL;
+}
+
+static void server_index_ctrl_connection_pid(ctrl_socket_private_data_list_item_t *item, pid_t pid)
+{
+  if (item->pid != -1) {
+    sl_slist_remove(&server.ctrl_connections_by_pid[SERVER_CONNECTION_BUCKET(item->pid)], &item->pid_node);
+  }
+
+  item->pid = pid;
+
+  if (pid != -1) {
+    sl_slist_push(&server.ctrl_connections_by_pid[SERVER_CONNECTION_BUCKET(pid)], &item->pid_node);
+  }
 }
 
 static void server_process_epoll_fd_ctrl_connection_socket(epoll_private_data_t *private_data)
@@ -330,7 +557,7 @@ static void server_process_epoll_fd_ctrl_connection_socket(epoll_private_data_t
   int ret;
 
   /* Accept the new ctrl connection for that client */
-  new_data_socket = accept(fd_socket_ctrl, NULL, NULL);
+  new_data_socket = accept(server.fd_socket_ctrl, NULL, NULL);
   FATAL_SYSCALL_ON(new_data_socket < 0);
 
   /* Set socket as non-blocking */
@@ -339,28 +566,7 @@ static void server_process_epoll_fd_ctrl_connection_socket(epoll_private_data_t
   ret = fcntl(new_data_socket, F_SETFL, flags | O_NONBLOCK);
   FATAL_SYSCALL_ON(ret < 0);
 
-  /* Add the new data socket in the list of data sockets for ctrl */
-  {
-    ctrl_socket_private_data_list_item_t* new_item;
-
-    /* Allocate resources for this new connection */
-    new_item = zalloc(sizeof *new_item);
-    new_item->pid = -1;
-
-    /* Register this new data socket to epoll set */
-    {
-      epoll_private_data_t* private_data = &new_item->data_socket_epoll_private_data;
-
-      private_data->callback = server_process_epoll_fd_ctrl_data_socket;
-      private_data->endpoint_number = 0; /* Irrelevent information in the case of ctrl data sockets */
-      private_data->file_descriptor = new_data_socket;
-
-      epoll_register(private_data);
-    }
-
-    /* Finally, add this new socket item to the list */
-    sl_slist_push(&ctrl_connections, &new_item->node);
-  }
+  server_add_ctrl_connection(new_data_socket);
 }
 
 static void server_process_epoll_fd_event_data_socket(epoll_private_data_t *private_data)
@@ -378,7 +584,7 @@ static void server_process_epoll_fd_event_data_socket(epoll_private_data_t *priv
     BUG_ON(endpoint_number == 0);
 
     /* Make sure the connection socket exists */
-    BUG_ON(endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor == -1);
+    BUG_ON(server.endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor == -1);
   }
 
   /* Check if the event is about the client closing the connection */
@@ -409,6 +615,31 @@ static void server_process_epoll_fd_event_data_socket(epoll_private_data_t *priv
   free(buffer);
 }
 
+/* Set the PID of the client of a control socket. Returns false if another
+ * control socket already has it. */
+static bool server_set_ctrl_connection_pid(epoll_private_data_t *private_data, pid_t library_pid)
+{
+  bool can_connect = true;
+  ctrl_socket_private_data_list_item_t* item;
+
+#if !defined(UNIT_TESTING)
+  SL_SLIST_FOR_EACH_ENTRY(server.ctrl_connections_by_pid[SERVER_CONNECTION_BUCKET(library_pid)],
+                          item,
+                          ctrl_socket_private_data_list_item_t,
+                          pid_node){
+    if (library_pid ==  item->pid) {
+      can_connect = false;
+    }
+  }
+#endif
+
+  // Set the control socket PID
+  item = container_of(private_data, ctrl_socket_private_data_list_item_t, data_socket_epoll_private_data);
+  server_index_ctrl_connection_pid(item, library_pid);
+
+  return can_connect;
+}
+
 static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *private_data)
 {
   int fd_ctrl_data_socket = private_data->file_descriptor;
@@ -572,7 +803,7 @@ static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *priva
 
       //Be careful when asked about opening the security endpoint...
       if (interface_buffer->endpoint_number == SL_CPC_ENDPOINT_SECURITY) {
-        if (endpoints[SL_CPC_ENDPOINT_SECURITY].data_socket_epoll_private_data != NULL // Make sure only 1 client is connected (ie, the daemon' security thread)
+        if (server.endpoints[SL_CPC_ENDPOINT_SECURITY].data_socket_epoll_private_data != NULL // Make sure only 1 client is connected (ie, the daemon' security thread)
             || config.use_encryption == false) {                                      // Make sure security is enabled
           // Reuse the same buffer to send a negative reply
           *(bool*)(interface_buffer->payload) = false;
@@ -596,7 +827,11 @@ static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *priva
 
       pending_connection->endpoint_id = interface_buffer->endpoint_number;
       pending_connection->fd_ctrl_data_socket = fd_ctrl_data_socket;
-      sl_slist_push_back(&pending_connections, &pending_connection->node);
+      sl_queue_push_back(&server.pending_connections, &pending_connection->node);
+      server.pending_connections_queued = true;
+
+      ctrl_socket_private_data_list_item_t *ctrl_item = container_of(private_data, ctrl_socket_private_data_list_item_t, data_socket_epoll_private_data);
+      sl_slist_push(&ctrl_item->pending_connections, &pending_connection->ctrl_node);
     }
     break;
 
@@ -604,9 +839,9 @@ static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *priva
     {
       TRACE_SERVER("Received a endpoint close query");
       /* Endpoint was closed by secondary */
-      if (endpoints[interface_buffer->endpoint_number].pending_close > 0) {
-        endpoints[interface_buffer->endpoint_number].pending_close--;
-        if (endpoints[interface_buffer->endpoint_number].pending_close == 0) {
+      if (server.endpoints[interface_buffer->endpoint_number].pending_close > 0) {
+        server.endpoints[interface_buffer->endpoint_number].pending_close--;
+        if (server.endpoints[interface_buffer->endpoint_number].pending_close == 0) {
           core_close_endpoint(interface_buffer->endpoint_number, true, false);
         }
 
@@ -686,24 +921,7 @@ static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *priva
 
     case EXCHANGE_SET_PID_QUERY:
     {
-      bool can_connect = true;
-      ctrl_socket_private_data_list_item_t* item;
-      pid_t library_pid =  *(pid_t*)interface_buffer->payload;
-
-#if !defined(UNIT_TESTING)
-      SL_SLIST_FOR_EACH_ENTRY(ctrl_connections,
-                              item,
-                              ctrl_socket_private_data_list_item_t,
-                              node){
-        if (library_pid ==  item->pid) {
-          can_connect = false;
-        }
-      }
-#endif
-
-      // Set the control socket PID
-      item = container_of(private_data, ctrl_socket_private_data_list_item_t, data_socket_epoll_private_data);
-      item->pid = *(pid_t*)interface_buffer->payload;
+      bool can_connect = server_set_ctrl_connection_pid(private_data, *(pid_t*)interface_buffer->payload);
 
       memcpy(interface_buffer->payload, &can_connect, sizeof(bool));
 
@@ -768,209 +986,652 @@ static void server_process_epoll_fd_ctrl_data_socket(epoll_private_data_t *priva
     }
     break;
 
-    case EXCHANGE_OPEN_ENDPOINT_EVENT_SOCKET_QUERY:
+    case EXCHANGE_SET_ENDPOINT_TX_PRIORITY_QUERY:
     {
-      server_open_endpoint_event_socket(interface_buffer->endpoint_number);
+      cpc_tx_priority_t priority;
+      TRACE_SERVER("Received an endpoint tx priority query");
+
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpc_tx_priority_t));
+
+      memcpy(&priority, interface_buffer->payload, sizeof(cpc_tx_priority_t));
+
+      // Reply with the priority actually applied
+      core_set_endpoint_tx_priority(interface_buffer->endpoint_number, &priority.level, &priority.weight);
+
+      memcpy(interface_buffer->payload, &priority, sizeof(cpc_tx_priority_t));
 
-      // Ack the query
       ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+
       if (ret < 0 && errno == EPIPE) {
         server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
       } else {
         FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
-        FATAL_ON((size_t)ret != sizeof(cpcd_exchange_buffer_t));
+        FATAL_ON((size_t)ret != sizeof(cpcd_exchange_buffer_t) + sizeof(cpc_tx_priority_t));
       }
     }
     break;
 
-    default:
-      break;
-  }
-
-  free(buffer);
-}
+    case EXCHANGE_SET_ENDPOINT_FRAGMENTATION_QUERY:
+    {
+      cpcd_exchange_fragmentation_t fragmentation;
+      TRACE_SERVER("Received an endpoint fragmentation query");
 
-#if defined(ENABLE_ENCRYPTION)
-static pending_connection_list_item_t* server_reorder_pending_connections(void)
-{
-  pending_connection_list_item_t *pending_connection;
-  pending_connection = SL_SLIST_ENTRY(pending_connections, pending_connection_list_item_t, node);
-  sl_cpc_security_state_t security_state = security_get_state();
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_fragmentation_t));
 
-  if (config.use_encryption && security_state != SECURITY_STATE_DISABLED) {
-    if (security_state != SECURITY_STATE_INITIALIZED) {
-      uint8_t head_endpoint_id = pending_connection->endpoint_id;
+      memcpy(&fragmentation, interface_buffer->payload, sizeof(fragmentation));
 
-      if (head_endpoint_id != SL_CPC_ENDPOINT_SECURITY) {
-        sl_slist_node_t *node;
+      // The server I/O thread hands over datagrams no larger than a frame
+      if (server.fragmented_datagram == NULL) {
+        fragmentation.enable = 0;
+      }
 
-        TRACE_SERVER("Delaying opening of endpoint #%d as security is not initialized yet",
-                     head_endpoint_id);
+      // Reply with what is actually applied
+      fragmentation.enable = core_set_endpoint_fragmentation(interface_buffer->endpoint_number, fragmentation.enable != 0);
+      fragmentation.max_write_size = (uint32_t)core_get_endpoint_max_write_size(interface_buffer->endpoint_number);
 
-        do {
-          node = sl_slist_pop(&pending_connections);
-          sl_slist_push_back(&pending_connections, node);
+      memcpy(interface_buffer->payload, &fragmentation, sizeof(fragmentation));
 
-          pending_connection = SL_SLIST_ENTRY(pending_connections,
-                                              pending_connection_list_item_t,
-                                              node);
-        } while (pending_connection->endpoint_id != SL_CPC_ENDPOINT_SECURITY
-                 && pending_connection->endpoint_id != head_endpoint_id);
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
 
-        if (pending_connection->endpoint_id == head_endpoint_id) {
-          pending_connection = NULL;
-        }
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
       }
     }
-  }
+    break;
 
-  return pending_connection;
-}
-#endif
+    case EXCHANGE_SET_ENDPOINT_AGGREGATION_QUERY:
+    {
+      cpcd_exchange_aggregation_t aggregation;
+      TRACE_SERVER("Received an endpoint aggregation query");
 
-void server_process_pending_connections(void)
-{
-  pending_connection_list_item_t *pending_connection;
-  pending_connection = SL_SLIST_ENTRY(pending_connections, pending_connection_list_item_t, node);
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_aggregation_t));
 
-  if (pending_connection != NULL) {
-    if (core_ep_is_closing(pending_connection->endpoint_id)) {
-      TRACE_SERVER("Endpoint #%d is currently closing, waiting before opening", pending_connection->endpoint_id);
-      return;
-    }
+      memcpy(&aggregation, interface_buffer->payload, sizeof(aggregation));
 
-    if (system_open_ep_step == SL_CPC_SYSTEM_OPEN_STEP_IDLE) {
-#if defined(ENABLE_ENCRYPTION)
-      pending_connection = server_reorder_pending_connections();
-      if (pending_connection == NULL) {
-        TRACE_SERVER("Delaying processing of pending connections, waiting on security");
-        return;
-      }
-#endif
-      system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_STATE_WAITING;
-      sl_cpc_system_set_pending_connection(pending_connection->fd_ctrl_data_socket);
-      sl_cpc_system_cmd_property_get(property_get_single_endpoint_state_and_reply_to_pending_open_callback,
-                                     (sl_cpc_property_id_t)(PROP_ENDPOINT_STATE_0 + pending_connection->endpoint_id),
-                                     5,
-                                     100000,
-                                     false);
-    } else if (system_open_ep_step == SL_CPC_SYSTEM_OPEN_STEP_STATE_FETCHED) {
-#if defined(ENABLE_ENCRYPTION)
-      system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_ENCRYPTION_WAITING;
-      // Fetch encryption state of the endpoint
-      sl_cpc_system_cmd_property_get(property_get_single_endpoint_encryption_state_and_reply_to_pending_open_callback,
-                                     EP_ID_TO_PROPERTY_ENCRYPTION(pending_connection->endpoint_id),
-                                     5,
-                                     100000,
-                                     false);
-#endif
-    } else if (system_open_ep_step == SL_CPC_SYSTEM_OPEN_STEP_DONE) {
-      system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_IDLE;
+      // Reply with what is actually applied
+      aggregation.deadline_us = core_set_endpoint_aggregation(interface_buffer->endpoint_number, aggregation.deadline_us);
 
-      sl_cpc_system_set_pending_connection(0);
-      sl_slist_remove(&pending_connections, &pending_connection->node);
-      free(pending_connection);
+      memcpy(interface_buffer->payload, &aggregation, sizeof(aggregation));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
     }
-  }
-}
+    break;
 
-#if !defined(UNIT_TESTING)
-static void server_process_epoll_fd_timeout_noop(epoll_private_data_t *private_data)
-{
-  int fd_timer_noop = private_data->file_descriptor;
+    case EXCHANGE_SET_ENDPOINT_COMPRESSION_QUERY:
+    {
+      cpcd_exchange_compression_t compression;
+      TRACE_SERVER("Received an endpoint compression query");
 
-  /* Ack the timer */
-  {
-    uint64_t expiration;
-    ssize_t retval;
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_compression_t));
 
-    retval = read(fd_timer_noop, &expiration, sizeof(expiration));
+      memcpy(&compression, interface_buffer->payload, sizeof(compression));
 
-    FATAL_SYSCALL_ON(retval < 0);
+      // Reply with what is actually applied
+      compression.enable = core_set_endpoint_compression(interface_buffer->endpoint_number, compression.enable != 0);
 
-    FATAL_ON(retval != sizeof(expiration));
+      memcpy(interface_buffer->payload, &compression, sizeof(compression));
 
-    WARN_ON(expiration != 1); /* we missed a timeout*/
-  }
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
 
-  TRACE_SERVER("NOOP keep alive");
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
+    }
+    break;
 
-  sl_cpc_system_cmd_noop(system_noop_cmd_callback_t,
-                         5,
-                         100000);
-}
-#endif
+    case EXCHANGE_ENDPOINT_TX_CREDIT_QUERY:
+    {
+      uint32_t tx_credit;
+      TRACE_SERVER("Received an endpoint tx credit query");
 
-/*
- * The main loop calls this function when an endpoint connection socket is ready.
- * When this happens, it means that someone tries to establish a connection on
- * this named socket. An endpoint connection socket is not the one on which the data
- * transit, its just the one that waits for connections. When a connection occurs,
- * accept it and place the new data_socket in the list of data_sockets for that
- * endpoint number
- */
-static void server_process_epoll_fd_ep_connection_socket(epoll_private_data_t *private_data)
-{
-  int new_data_socket, flags;
-  int fd_connection_socket = private_data->file_descriptor;
-  uint8_t endpoint_number = private_data->endpoint_number;
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(uint32_t));
 
-  /* Sanity checks */
-  {
-    /* We don't deal with system endpoint here*/
-    BUG_ON(endpoint_number == 0);
+      tx_credit = core_get_endpoint_tx_credit(interface_buffer->endpoint_number);
 
-    /* Make sure the connection socket exists */
-    BUG_ON(endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1);
-  }
+      memcpy(interface_buffer->payload, &tx_credit, sizeof(uint32_t));
 
-  /* Accept the new connection for that endpoint */
-  new_data_socket = accept(fd_connection_socket, NULL, NULL);
-  FATAL_SYSCALL_ON(new_data_socket < 0);
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
 
-  /* Set socket as non-blocking */
-  flags = fcntl(new_data_socket, F_GETFL, NULL);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != sizeof(cpcd_exchange_buffer_t) + sizeof(uint32_t));
+      }
+    }
+    break;
 
-  if (flags < 0) {
-    FATAL("fcntl F_GETFL failed.%s", strerror(errno));
-  }
+    case EXCHANGE_OPEN_SHM_TRANSPORT_QUERY:
+    {
+      TRACE_SERVER("Received a shared memory transport query");
 
-  flags |= O_NONBLOCK;
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_shm_transport_t));
 
-  if (fcntl(new_data_socket, F_SETFL, flags) < 0) {
-    FATAL("fcntl F_SETFL failed.%s", strerror(errno));
-  }
+      server_open_shm_transport(fd_ctrl_data_socket, interface_buffer, buffer_len);
+    }
+    break;
 
-  /* Add the new data socket in the list of data sockets for that endpoint */
-  {
-    data_socket_private_data_list_item_t* new_item;
+    case EXCHANGE_STATE_TABLE_QUERY:
+    {
+      TRACE_SERVER("Received a state table query");
 
-    /* Allocate resources for this new connection */
+      BUG_ON(buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_state_table_query_t));
+
+      server_send_state_table(fd_ctrl_data_socket, interface_buffer, buffer_len);
+    }
+    break;
+
+    case EXCHANGE_OPEN_ENDPOINT_EVENT_SOCKET_QUERY:
     {
-      new_item = (data_socket_private_data_list_item_t*) zalloc(sizeof(data_socket_private_data_list_item_t));
-      FATAL_ON(new_item == NULL);
+      server_open_endpoint_event_socket(interface_buffer->endpoint_number);
 
-      sl_slist_push(&endpoints[endpoint_number].data_socket_epoll_private_data, &new_item->node);
+      // Ack the query
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != sizeof(cpcd_exchange_buffer_t));
+      }
     }
+    break;
 
-    /* Register this new connection's socket to epoll set */
+    case EXCHANGE_METRICS_QUERY:
     {
-      epoll_private_data_t* private_data = &new_item->data_socket_epoll_private_data;
+      cpcd_exchange_metrics_t query;
+      size_t room;
 
-      private_data->callback = server_process_epoll_fd_ep_data_socket;
-      private_data->endpoint_number = endpoint_number;
-      private_data->file_descriptor = new_data_socket;
+      TRACE_SERVER("Received a metrics query");
 
-      epoll_register(private_data);
+      if (buffer_len < sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_metrics_t)) {
+        WARN("Metrics query of %zu bytes is too short", buffer_len);
+        break;
+      }
+
+      /* The payload is not aligned */
+      memcpy(&query, interface_buffer->payload, sizeof(query));
+      room = buffer_len - sizeof(cpcd_exchange_buffer_t) - sizeof(cpcd_exchange_metrics_t);
+      query.length = (uint32_t)metrics_render((cpc_metrics_format_t)query.format,
+                                              (char *)interface_buffer->payload + sizeof(query),
+                                              room);
+      memcpy(interface_buffer->payload, &query, sizeof(query));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
+    }
+    break;
+
+    case EXCHANGE_FLIGHT_RECORDER_QUERY:
+    {
+      cpcd_exchange_flight_recorder_t query;
+      char path[256];
+      size_t room;
+
+      TRACE_SERVER("Received a flight recorder query");
+
+      if (buffer_len < sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_flight_recorder_t)) {
+        WARN("Flight recorder query of %zu bytes is too short", buffer_len);
+        break;
+      }
+
+      query.status = flight_recorder_dump("cpc_dump_flight_recorder()", path, sizeof(path));
+      if (query.status == 0) {
+        PRINT_INFO("Flight recorder written to %s", path);
+      }
+
+      /* The payload is not aligned */
+      room = buffer_len - sizeof(cpcd_exchange_buffer_t) - sizeof(cpcd_exchange_flight_recorder_t);
+      if (room != 0) {
+        char *reply_path = (char *)interface_buffer->payload + sizeof(query);
+
+        if (query.status == 0) {
+          strncpy(reply_path, path, room);
+          reply_path[room - 1] = '\0';
+        } else {
+          reply_path[0] = '\0';
+        }
+      }
+      memcpy(interface_buffer->payload, &query, sizeof(query));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
+    }
+    break;
+
+    case EXCHANGE_TRACE_MASK_QUERY:
+    {
+      cpcd_exchange_trace_mask_t query;
+
+      if (buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_trace_mask_t)) {
+        WARN("Trace mask query of %zu bytes has the wrong size", buffer_len);
+        break;
+      }
+
+      /* The payload is not aligned */
+      memcpy(&query, interface_buffer->payload, sizeof(query));
+      if (query.level >= CPC_TRACE_LEVEL_COUNT) {
+        WARN("Trace mask query for unknown level %u", query.level);
+        break;
+      }
+
+      if (query.set) {
+        uint32_t previous = logging_set_trace_mask((cpc_trace_level_t)query.level, query.mask);
+        PRINT_INFO("Trace mask of level %u changed from 0x%x to 0x%x", query.level, previous, query.mask & TRACE_MASK_ALL);
+      }
+
+      query.mask = __atomic_load_n(&trace_masks[query.level], __ATOMIC_RELAXED);
+      memcpy(interface_buffer->payload, &query, sizeof(query));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
+    }
+    break;
+
+    case EXCHANGE_PROTOCOL_PARAMETER_QUERY:
+    {
+      cpcd_exchange_protocol_parameter_t query;
+
+      if (buffer_len != sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_protocol_parameter_t)) {
+        WARN("Protocol parameter query of %zu bytes has the wrong size", buffer_len);
+        break;
+      }
+
+      /* The payload is not aligned */
+      memcpy(&query, interface_buffer->payload, sizeof(query));
+      if (query.parameter >= CPC_PROTOCOL_PARAMETER_COUNT) {
+        query.status = -EINVAL;
+      } else if (query.set) {
+        query.status = core_set_protocol_parameter(interface_buffer->endpoint_number, (cpc_protocol_parameter_t)query.parameter, query.value);
+        if (query.status == 0) {
+          PRINT_INFO("Protocol parameter %u of ep#%u set to %u", query.parameter, interface_buffer->endpoint_number, query.value);
+        }
+      } else {
+        query.status = 0;
+      }
+
+      if (query.status == 0) {
+        query.status = core_get_protocol_parameter(interface_buffer->endpoint_number, (cpc_protocol_parameter_t)query.parameter, &query.value);
+      }
+      memcpy(interface_buffer->payload, &query, sizeof(query));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if (ret < 0 && errno == EPIPE) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
+    }
+    break;
+
+    case EXCHANGE_INIT_QUERY:
+      /* Client requested all it needs to initialize. The version query it sends
+       * right after, for older daemons, is answered next and logs the connection */
+    {
+      cpcd_exchange_init_t init;
+      const char *app_version = server_core_get_secondary_app_version();
+      size_t app_version_length = strlen(app_version);
+      size_t room;
+      bool do_close_client = false;
+
+      TRACE_SERVER("Received an init query");
+
+      if (buffer_len < sizeof(cpcd_exchange_buffer_t) + sizeof(cpcd_exchange_init_t)) {
+        WARN("Init query of %zu bytes is too short", buffer_len);
+        break;
+      }
+
+      /* The payload is not aligned */
+      memcpy(&init, interface_buffer->payload, sizeof(init));
+      room = buffer_len - sizeof(cpcd_exchange_buffer_t) - sizeof(cpcd_exchange_init_t);
+
+      if (strnlen(init.version, PROJECT_MAX_VERSION_SIZE) == PROJECT_MAX_VERSION_SIZE) {
+        do_close_client = true;
+        WARN("Client used invalid library version, version string is invalid");
+      } else if (strcmp(init.version, PROJECT_VER) != 0) {
+        do_close_client = true;
+        WARN("Client used invalid library version, (v%s) expected (v%s)", init.version, PROJECT_VER);
+      } else {
+        init.can_connect = server_set_ctrl_connection_pid(private_data, init.pid);
+        init.normal_operation_mode = config.operation_mode == MODE_NORMAL || init.pid == getpid();
+        init.max_write_size = server_core_get_secondary_rx_capability();
+        init.app_version_length = (uint16_t)app_version_length;
+        memcpy(interface_buffer->payload + sizeof(init), app_version, app_version_length < room ? app_version_length : room);
+      }
+
+      strncpy(init.version, PROJECT_VER, PROJECT_MAX_VERSION_SIZE);
+      memcpy(interface_buffer->payload, &init, sizeof(init));
+
+      ssize_t ret = send(fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
+      if ((ret < 0 && errno == EPIPE) || do_close_client) {
+        server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+      } else {
+        FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+        FATAL_ON((size_t)ret != buffer_len);
+      }
     }
+    break;
+
+    default:
+      break;
   }
 
-  endpoints[endpoint_number].open_data_connections++;
-  PRINT_INFO("Endpoint socket #%d: Client connected. %d connections", endpoint_number, endpoints[endpoint_number].open_data_connections);
+  free(buffer);
+}
+
+#if defined(ENABLE_ENCRYPTION)
+/***************************************************************************//**
+ * While security is being initialized, only the security endpoint can be
+ * opened. Other endpoints stay in the pending list until it's done.
+ ******************************************************************************/
+static bool server_security_allows_open(uint8_t endpoint_id)
+{
+  sl_cpc_security_state_t security_state = security_get_state();
+
+  if (config.use_encryption
+      && security_state != SECURITY_STATE_DISABLED
+      && security_state != SECURITY_STATE_INITIALIZED
+      && endpoint_id != SL_CPC_ENDPOINT_SECURITY) {
+    TRACE_SERVER("Delaying opening of endpoint #%d as security is not initialized yet", endpoint_id);
+    return false;
+  }
+
+  return true;
+}
+#endif
+
+/***************************************************************************//**
+ * Advance the open handshake of an endpoint that already has one in flight.
+ * Return true once the handshake is over and the connection can be dropped.
+ ******************************************************************************/
+static bool server_advance_pending_connection(pending_connection_list_item_t *pending_connection)
+{
+  uint8_t endpoint_id = pending_connection->endpoint_id;
+
+  switch (sl_cpc_system_get_open_step(endpoint_id)) {
+    case SL_CPC_SYSTEM_OPEN_STEP_STATE_FETCHED:
+#if defined(ENABLE_ENCRYPTION)
+      sl_cpc_system_set_open_step(endpoint_id, SL_CPC_SYSTEM_OPEN_STEP_ENCRYPTION_WAITING);
+      // Fetch encryption state of the endpoint
+      sl_cpc_system_cmd_property_get(property_get_single_endpoint_encryption_state_and_reply_to_pending_open_callback,
+                                     EP_ID_TO_PROPERTY_ENCRYPTION(endpoint_id),
+                                     5,
+                                     100000,
+                                     false);
+#endif
+      return false;
+
+    case SL_CPC_SYSTEM_OPEN_STEP_DONE:
+      sl_cpc_system_set_open_step(endpoint_id, SL_CPC_SYSTEM_OPEN_STEP_IDLE);
+      sl_cpc_system_set_pending_connection(endpoint_id, 0);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+/* Whether a waiting open can start its handshake with the secondary now */
+static bool server_can_start_pending_connection(uint8_t endpoint_id)
+{
+  // Another client is already opening this endpoint, wait for it
+  if (sl_cpc_system_get_open_step(endpoint_id) != SL_CPC_SYSTEM_OPEN_STEP_IDLE) {
+    return false;
+  }
+
+  if (core_ep_is_closing(endpoint_id)) {
+    TRACE_SERVER("Endpoint #%d is currently closing, waiting before opening", endpoint_id);
+    return false;
+  }
+
+#if defined(ENABLE_ENCRYPTION)
+  if (!server_security_allows_open(endpoint_id)) {
+    return false;
+  }
+#endif
+
+  return true;
+}
+
+static void server_free_pending_connection(pending_connection_list_item_t *pending_connection)
+{
+  /* Still in the list of its control connection */
+  if (pending_connection->fd_ctrl_data_socket != -1) {
+    ctrl_socket_private_data_list_item_t *ctrl_item = server_find_ctrl_connection(pending_connection->fd_ctrl_data_socket);
+
+    BUG_ON(ctrl_item == NULL);
+    sl_slist_remove(&ctrl_item->pending_connections, &pending_connection->ctrl_node);
+  }
+
+  free(pending_connection);
+}
+
+static void server_process_timeout_pending_connections(epoll_timer_t *timer)
+{
+  (void) timer;
+
+  /* Nothing to do, the loop looks at the pending connections after each of its iterations */
+}
+
+void server_process_pending_connections(void)
+{
+  pending_connection_list_item_t *pending_connection;
+  sl_slist_node_t *node = server.pending_connections_in_flight;
+  size_t budget = SERVER_PENDING_CONNECTIONS_PER_ITERATION;
+
+  while (node != NULL) {
+    pending_connection = SL_SLIST_ENTRY(node, pending_connection_list_item_t, node);
+    node = node->node;
+
+    if (server_advance_pending_connection(pending_connection)) {
+      sl_slist_remove(&server.pending_connections_in_flight, &pending_connection->node);
+      server_free_pending_connection(pending_connection);
+      server.pending_opens_in_flight--;
+    }
+  }
+
+  /* Look at the waiting ones from the head of the queue, those that can't start
+   * go back at its tail. A round looks at each of them once, over as many
+   * iterations as it takes to stay within the budget of each */
+  if (server.pending_connections_unseen == 0) {
+    server.pending_connections_unseen = sl_queue_len(&server.pending_connections);
+    server.pending_connections_queued = false;
+  }
+
+  while (server.pending_connections_unseen != 0
+         && budget != 0
+         && server.pending_opens_in_flight < SERVER_MAX_PENDING_OPENS_IN_FLIGHT) {
+    pending_connection = SL_SLIST_ENTRY(sl_queue_pop(&server.pending_connections), pending_connection_list_item_t, node);
+    server.pending_connections_unseen--;
+    budget--;
+
+    uint8_t endpoint_id = pending_connection->endpoint_id;
+
+    // Its client left before its turn
+    if (pending_connection->fd_ctrl_data_socket == -1) {
+      free(pending_connection);
+      continue;
+    }
+
+    if (!server_can_start_pending_connection(endpoint_id)) {
+      sl_queue_push_back(&server.pending_connections, &pending_connection->node);
+      continue;
+    }
+
+    pending_connection->in_flight = true;
+    sl_slist_push(&server.pending_connections_in_flight, &pending_connection->node);
+    server.pending_opens_in_flight++;
+
+    sl_cpc_system_set_open_step(endpoint_id, SL_CPC_SYSTEM_OPEN_STEP_STATE_WAITING);
+    sl_cpc_system_set_pending_connection(endpoint_id, pending_connection->fd_ctrl_data_socket);
+    sl_cpc_system_cmd_property_get(property_get_single_endpoint_state_and_reply_to_pending_open_callback,
+                                   (sl_cpc_property_id_t)(PROP_ENDPOINT_STATE_0 + endpoint_id),
+                                   5,
+                                   100000,
+                                   false);
+  }
+
+  /* Go on with the round, or start the next one for the opens queued during this
+   * one, right after the next iteration rather than on the next event. With the
+   * opens in flight at their maximum, the completion of one brings the loop back */
+  if ((server.pending_connections_unseen != 0 || server.pending_connections_queued)
+      && server.pending_opens_in_flight < SERVER_MAX_PENDING_OPENS_IN_FLIGHT
+      && !epoll_timer_is_running(&server.pending_connections_timer)) {
+    epoll_timer_start(&server.pending_connections_timer, 0);
+  }
+}
+
+#if !defined(UNIT_TESTING)
+static uint32_t server_rxd_valid_frames(void)
+{
+  return primary_core_debug_counters.rxd_valid_iframe
+         + primary_core_debug_counters.rxd_valid_uframe
+         + primary_core_debug_counters.rxd_valid_sframe;
+}
+
+static void server_noop_keep_alive_reply(sl_cpc_system_command_handle_t *handle,
+                                         sl_status_t status)
+{
+  /* The reply to the keep alive is not traffic, the link is idle from here */
+  server.noop_keep_alive_rx_frames = server_rxd_valid_frames();
+
+  system_noop_cmd_callback_t(handle, status);
+}
+
+/*
+ * Rather than re-arming the timer on each frame received, the timer checks
+ * on expiry whether a frame was received during the last period. A no-op is
+ * thus only sent once the link has been idle for one to two periods, and
+ * receiving costs nothing more.
+ */
+static void server_process_timeout_noop(epoll_timer_t *timer)
+{
+  uint32_t rx_frames = server_rxd_valid_frames();
+
+  epoll_timer_start(timer, server.noop_keep_alive_period_us);
+
+  if (rx_frames != server.noop_keep_alive_rx_frames) {
+    /* The secondary is alive, frames are flowing */
+    server.noop_keep_alive_rx_frames = rx_frames;
+    EVENT_COUNTER_INC(noop_keep_alive_suppressed);
+    return;
+  }
+
+  TRACE_SERVER("NOOP keep alive");
+  EVENT_COUNTER_INC(noop_keep_alive_sent);
+
+  sl_cpc_system_cmd_noop(server_noop_keep_alive_reply,
+                         5,
+                         100000);
+}
+#endif
+
+/* Add a connection accepted on the socket of an endpoint */
+static void server_add_data_connection(uint8_t endpoint_number, int fd_data_socket)
+{
+  data_socket_private_data_list_item_t* new_item;
+
+  /* Allocate resources for this new connection */
+  {
+    new_item = (data_socket_private_data_list_item_t*) zalloc(sizeof(data_socket_private_data_list_item_t));
+    FATAL_ON(new_item == NULL);
+
+    sl_slist_push(&server.endpoints[endpoint_number].data_socket_epoll_private_data, &new_item->node);
+  }
+
+  /* Register this new connection's socket to epoll set */
+  {
+    epoll_private_data_t* private_data = &new_item->data_socket_epoll_private_data;
+
+    private_data->callback = server_process_epoll_fd_ep_data_socket;
+    private_data->callback_type = EPOLL_CALLBACK_SERVER_DATA;
+    private_data->endpoint_number = endpoint_number;
+    private_data->file_descriptor = fd_data_socket;
+
+    server_watch_data_socket(new_item);
+  }
+
+  if (config.client_socket_autotune) {
+    server_track_sndbuf(new_item);
+  }
+
+  server.endpoints[endpoint_number].open_data_connections++;
+}
+
+/*
+ * The main loop calls this function when an endpoint connection socket is ready.
+ * When this happens, it means that someone tries to establish a connection on
+ * this named socket. An endpoint connection socket is not the one on which the data
+ * transit, its just the one that waits for connections. When a connection occurs,
+ * accept it and place the new data_socket in the list of data_sockets for that
+ * endpoint number
+ */
+static void server_process_epoll_fd_ep_connection_socket(epoll_private_data_t *private_data)
+{
+  int new_data_socket, flags;
+  int fd_connection_socket = private_data->file_descriptor;
+  uint8_t endpoint_number = private_data->endpoint_number;
+
+  /* Sanity checks */
+  {
+    /* We don't deal with system endpoint here*/
+    BUG_ON(endpoint_number == 0);
+
+    /* Make sure the connection socket exists */
+    BUG_ON(server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1);
+  }
+
+  /* Accept the new connection for that endpoint */
+  new_data_socket = accept(fd_connection_socket, NULL, NULL);
+  FATAL_SYSCALL_ON(new_data_socket < 0);
+
+  /* Set socket as non-blocking */
+  flags = fcntl(new_data_socket, F_GETFL, NULL);
+
+  if (flags < 0) {
+    FATAL("fcntl F_GETFL failed.%s", strerror(errno));
+  }
+
+  flags |= O_NONBLOCK;
+
+  if (fcntl(new_data_socket, F_SETFL, flags) < 0) {
+    FATAL("fcntl F_SETFL failed.%s", strerror(errno));
+  }
+
+  server_add_data_connection(endpoint_number, new_data_socket);
+  PRINT_INFO("Endpoint socket #%d: Client connected. %d connections", endpoint_number, server.endpoints[endpoint_number].open_data_connections);
 
   bool encryption = false;
 #if defined(ENABLE_ENCRYPTION)
-  encryption = endpoints[endpoint_number].encrypted;
+  encryption = server.endpoints[endpoint_number].encrypted;
 #endif
 
   /* Tell the core that this endpoint is open */
@@ -997,11 +1658,29 @@ static void server_process_epoll_fd_ep_connection_socket(epoll_private_data_t *p
 
 static void server_process_epoll_fd_ep_data_socket(epoll_private_data_t *private_data)
 {
-  uint8_t* buffer;
-  size_t buffer_len;
   int fd_data_socket = private_data->file_descriptor;
   uint8_t endpoint_number = private_data->endpoint_number;
-  int ret;
+  size_t buffer_size;
+  int count;
+  int i;
+
+  /* The socket of a slow client has room again */
+  if (private_data->ready_events & EPOLLOUT) {
+    data_socket_private_data_list_item_t *item = container_of(private_data,
+                                                              data_socket_private_data_list_item_t,
+                                                              data_socket_epoll_private_data);
+    int err = server_flush_backlog(item);
+
+    if (err != 0 && err != EAGAIN) {
+      TRACE_SERVER("send() failed with %s", ERRNO_CODENAME[err]);
+      server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
+      return;
+    }
+
+    if (!(private_data->ready_events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+      return;
+    }
+  }
 
   if (core_ep_is_busy(endpoint_number)) {
     /* Prevent epoll from unblocking right away on this [still marked as ready-read] file descriptor the next time
@@ -1010,51 +1689,196 @@ static void server_process_epoll_fd_ep_data_socket(epoll_private_data_t *private
     return;
   }
 
-  /* Check if the event is about the client closing the connection */
-  {
-    int length;
+  if (core_get_endpoint_fragmentation(endpoint_number)) {
+    server_pull_fragmented_datagrams(fd_data_socket, endpoint_number);
+    return;
+  }
 
-    ret = ioctl(fd_data_socket, FIONREAD, &length);
-    FATAL_SYSCALL_ON(ret < 0);
+  /* Buffers handed to the core are replaced, the others are reused */
+  buffer_size = core_get_write_buffer_size();
+  for (i = 0; i < SERVER_DATA_SOCKET_BATCH_SIZE; i++) {
+    if (server.data_socket_batch.buffers[i] == NULL) {
+      server.data_socket_batch.buffers[i] = core_alloc_write_buffer();
+    }
+
+    server.data_socket_batch.iovecs[i].iov_base = server.data_socket_batch.buffers[i];
+    server.data_socket_batch.iovecs[i].iov_len = buffer_size;
+
+    memset(&server.data_socket_batch.msgs[i], 0, sizeof(server.data_socket_batch.msgs[i]));
+    server.data_socket_batch.msgs[i].msg_hdr.msg_iov = &server.data_socket_batch.iovecs[i];
+    server.data_socket_batch.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  count = recvmmsg(fd_data_socket, server.data_socket_batch.msgs, SERVER_DATA_SOCKET_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (count < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    }
+
+    TRACE_SERVER("recvmmsg() failed with %s", ERRNO_CODENAME[errno]);
+    FATAL_SYSCALL_ON(errno != ECONNRESET);
+    server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
+    return;
+  }
+
+  TRACE_SERVER_DATAGRAMS_DRAINED(endpoint_number, count);
 
+  for (i = 0; i < count; i++) {
+    size_t length = server.data_socket_batch.msgs[i].msg_len;
+
+    /* Clients never send empty datagrams, this is the client closing the connection */
     if (length == 0) {
       server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
       return;
     }
+
+    if (server.data_socket_batch.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      WARN("Dropped a datagram larger than %zu bytes on ep#%d", buffer_size, endpoint_number);
+      continue;
+    }
+
+    /* Send the data to the core */
+    if (core_get_endpoint_state(endpoint_number) != SL_CPC_STATE_OPEN) {
+      WARN("User tried to push on endpoint %d but it's not open, state is %d", endpoint_number, core_get_endpoint_state(endpoint_number));
+      server_close_endpoint(endpoint_number, false);
+      return;
+    }
+
+    CPCD_TRACEPOINT(client_recv, endpoint_number, (uint32_t)length);
+    core_write_buffer(endpoint_number, server.data_socket_batch.buffers[i], length, 0);
+    server.data_socket_batch.buffers[i] = NULL;
   }
+}
 
-  /* The event is about rx data */
+/* With fragmentation, a datagram can be larger than a core buffer. It is received
+ * in a buffer of the largest message instead, that the core copies to the frames. */
+static void server_pull_fragmented_datagrams(int fd_data_socket, uint8_t endpoint_number)
+{
+  ssize_t length;
+  int i;
 
-  /* Retrieve the payload from the endpoint data connection */
-  ret = server_pull_data_from_data_socket(fd_data_socket, &buffer, &buffer_len);
-  if (ret != 0) {
-    server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
+  for (i = 0; i < SERVER_DATA_SOCKET_BATCH_SIZE; i++) {
+    length = recv(fd_data_socket, server.fragmented_datagram, SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE, MSG_DONTWAIT | MSG_TRUNC);
+    if (length < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+
+      TRACE_SERVER("recv() failed with %s", ERRNO_CODENAME[errno]);
+      FATAL_SYSCALL_ON(errno != ECONNRESET);
+      server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
+      return;
+    }
+
+    /* Clients never send empty datagrams, this is the client closing the connection */
+    if (length == 0) {
+      server_handle_client_closed_ep_connection(fd_data_socket, endpoint_number);
+      return;
+    }
+
+    if ((size_t)length > SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE) {
+      WARN("Dropped a datagram of %zd bytes on ep#%d, larger than %u bytes", length, endpoint_number, SL_CPC_FRAGMENTED_MESSAGE_MAX_SIZE);
+      continue;
+    }
+
+    if (core_get_endpoint_state(endpoint_number) != SL_CPC_STATE_OPEN) {
+      WARN("User tried to push on endpoint %d but it's not open, state is %d", endpoint_number, core_get_endpoint_state(endpoint_number));
+      server_close_endpoint(endpoint_number, false);
+      return;
+    }
+
+    CPCD_TRACEPOINT(client_recv, endpoint_number, (uint32_t)length);
+    core_write(endpoint_number, server.fragmented_datagram, (size_t)length, 0);
+
+    /* The fragments beyond the tx window wait in the holding list, no need to add more */
+    if (core_ep_is_busy(endpoint_number)) {
+      return;
+    }
+  }
+}
+
+static data_socket_private_data_list_item_t* server_find_io_data_socket(uint8_t endpoint_number, uint32_t connection_id)
+{
+  data_socket_private_data_list_item_t *item;
+
+  SL_SLIST_FOR_EACH_ENTRY(server.endpoints[endpoint_number].data_socket_epoll_private_data,
+                          item,
+                          data_socket_private_data_list_item_t,
+                          node) {
+    if (item->io_connection_id == connection_id) {
+      return item;
+    }
+  }
+
+  /* Reported by the server I/O thread before the socket was closed on this side */
+  return NULL;
+}
+
+void server_on_io_datagram(uint8_t endpoint_number, uint32_t connection_id, const void *data, size_t length)
+{
+  if (server_find_io_data_socket(endpoint_number, connection_id) == NULL) {
     return;
   }
 
   /* Send the data to the core */
-  if (core_get_endpoint_state(endpoint_number) == SL_CPC_STATE_OPEN) {
-    core_write(endpoint_number, buffer, buffer_len, 0);
-    free(buffer);
-  } else {
-    free(buffer);
+  if (core_get_endpoint_state(endpoint_number) != SL_CPC_STATE_OPEN) {
     WARN("User tried to push on endpoint %d but it's not open, state is %d", endpoint_number, core_get_endpoint_state(endpoint_number));
     server_close_endpoint(endpoint_number, false);
+    return;
+  }
+
+  CPCD_TRACEPOINT(client_recv, endpoint_number, (uint32_t)length);
+  core_write(endpoint_number, data, length, 0);
+
+  /* The server I/O thread stops reading the endpoint until the core watches it back.
+   * What it already pushed is still written, within the size of its ring. */
+  if (core_ep_is_busy(endpoint_number)) {
+    server_io_unwatch(endpoint_number);
+  }
+}
+
+void server_on_io_hangup(uint8_t endpoint_number, uint32_t connection_id)
+{
+  data_socket_private_data_list_item_t *item = server_find_io_data_socket(endpoint_number, connection_id);
+
+  if (item != NULL) {
+    server_handle_client_closed_ep_connection(item->data_socket_epoll_private_data.file_descriptor, endpoint_number);
+  }
+}
+
+void server_on_io_writable(uint8_t endpoint_number, uint32_t connection_id)
+{
+  data_socket_private_data_list_item_t *item = server_find_io_data_socket(endpoint_number, connection_id);
+  int err;
+
+  if (item == NULL) {
+    return;
+  }
+
+  /* The server I/O thread reports it once, it must be asked again if the socket fills up */
+  item->data_socket_epoll_private_data.events = 0;
+
+  err = server_flush_backlog(item);
+  if (err == EAGAIN) {
+    server_set_data_socket_events(item, EPOLLOUT);
+  } else if (err != 0) {
+    TRACE_SERVER("send() failed with %s", ERRNO_CODENAME[err]);
+    server_handle_client_closed_ep_connection(item->data_socket_epoll_private_data.file_descriptor, endpoint_number);
   }
 }
 
 static void server_handle_client_disconnected(uint8_t endpoint_number)
 {
-  FATAL_ON(endpoints[endpoint_number].open_data_connections == 0);
+  FATAL_ON(server.endpoints[endpoint_number].open_data_connections == 0);
 
-  endpoints[endpoint_number].open_data_connections--;
-  PRINT_INFO("Endpoint socket #%d: Client disconnected. %d connections", endpoint_number, endpoints[endpoint_number].open_data_connections);
+  server.endpoints[endpoint_number].open_data_connections--;
+  PRINT_INFO("Endpoint socket #%d: Client disconnected. %d connections", endpoint_number, server.endpoints[endpoint_number].open_data_connections);
 
-  if (endpoints[endpoint_number].open_data_connections == 0) {
+  if (server.endpoints[endpoint_number].open_data_connections == 0) {
     TRACE_SERVER("Closing endpoint socket, no more listeners");
     server_close_endpoint(endpoint_number, false);
 
-    if (endpoints[endpoint_number].pending_close == 0) {
+    if (server.endpoints[endpoint_number].pending_close == 0) {
       TRACE_SERVER("No pending close on the endpoint, closing it");
       core_close_endpoint(endpoint_number, true, false);
     }
@@ -1069,7 +1893,7 @@ static void server_handle_client_closed_ep_connection(int fd_data_socket, uint8_
   /* The while loop that follows is the macro SL_SLIST_FOR_EACH_ENTRY exploded to allow
    * for free()ing items during iteration */
 
-  item = SL_SLIST_ENTRY(endpoints[endpoint_number].data_socket_epoll_private_data,
+  item = SL_SLIST_ENTRY(server.endpoints[endpoint_number].data_socket_epoll_private_data,
                         data_socket_private_data_list_item_t,
                         node);
 
@@ -1087,20 +1911,19 @@ static void server_handle_client_closed_ep_connection(int fd_data_socket, uint8_
      * check if this iteration is the good one*/
     if (item->data_socket_epoll_private_data.file_descriptor == fd_data_socket) {
       /* Unregister the data socket file descriptor from epoll watch list */
-      epoll_unregister(&item->data_socket_epoll_private_data);
+      server_unwatch_data_socket(item);
+
+      server_close_shm_transport(item);
+      server_clear_backlog(item);
 
       /* Remove the item from the list*/
-      sl_slist_remove(&endpoints[endpoint_number].data_socket_epoll_private_data, &item->node);
+      sl_slist_remove(&server.endpoints[endpoint_number].data_socket_epoll_private_data, &item->node);
 
       /* Notify the client */
       server_handle_client_closed_ep_notify_close(item->data_socket_epoll_private_data.file_descriptor, endpoint_number);
 
       /* Properly shutdown and close this socket on our side (it is on the client's side)*/
-      int ret = shutdown(fd_data_socket, SHUT_RDWR);
-      FATAL_SYSCALL_ON(ret < 0);
-
-      ret = close(fd_data_socket);
-      FATAL_SYSCALL_ON(ret < 0);
+      server_close_data_socket(item);
 
       /* Inform server and core that the endpoint lost a listener */
       server_handle_client_disconnected(endpoint_number);
@@ -1123,37 +1946,41 @@ static void server_ep_push_close_socket_pair(int fd_data_socket, int fd_ctrl_dat
   data_ctrl_data_socket_pair_close_list_item_t *item;
   item = zalloc(sizeof(data_ctrl_data_socket_pair_close_list_item_t));
   FATAL_SYSCALL_ON(item == NULL);
+  item->endpoint_number = endpoint_number;
   item->fd_data_socket = fd_data_socket;
   item->fd_ctrl_data_socket = fd_ctrl_data_socket;
-  sl_slist_push(&endpoints[endpoint_number].data_ctrl_data_socket_pair, &item->node);
+  sl_slist_push(&server.data_ctrl_data_socket_pairs[SERVER_CONNECTION_BUCKET(fd_data_socket)], &item->node);
+  server.endpoints[endpoint_number].data_ctrl_data_socket_pairs++;
+}
+
+static void server_ep_remove_close_socket_pair(data_ctrl_data_socket_pair_close_list_item_t *item)
+{
+  sl_slist_remove(&server.data_ctrl_data_socket_pairs[SERVER_CONNECTION_BUCKET(item->fd_data_socket)], &item->node);
+  server.endpoints[item->endpoint_number].data_ctrl_data_socket_pairs--;
+  free(item);
 }
 
 static bool server_ep_find_close_socket_pair(int fd_data_socket, int fd_ctrl_data_socket, uint8_t endpoint_number)
 {
   data_ctrl_data_socket_pair_close_list_item_t *item;
-  data_ctrl_data_socket_pair_close_list_item_t *next_item;
-  bool found = false;
 
-  item = SL_SLIST_ENTRY(endpoints[endpoint_number].data_ctrl_data_socket_pair,
-                        data_ctrl_data_socket_pair_close_list_item_t,
-                        node);
-
-  while (item) {
-    next_item = SL_SLIST_ENTRY((item)->node.node,
-                               data_ctrl_data_socket_pair_close_list_item_t,
-                               node);
+  if (server.endpoints[endpoint_number].data_ctrl_data_socket_pairs == 0) {
+    return false;
+  }
 
-    if (item->fd_data_socket == fd_data_socket && item->fd_ctrl_data_socket == fd_ctrl_data_socket) {
-      sl_slist_remove(&endpoints[endpoint_number].data_ctrl_data_socket_pair, &item->node);
-      free(item);
-      found = true;
-      break;
+  SL_SLIST_FOR_EACH_ENTRY(server.data_ctrl_data_socket_pairs[SERVER_CONNECTION_BUCKET(fd_data_socket)],
+                          item,
+                          data_ctrl_data_socket_pair_close_list_item_t,
+                          node){
+    if (item->endpoint_number == endpoint_number
+        && item->fd_data_socket == fd_data_socket
+        && item->fd_ctrl_data_socket == fd_ctrl_data_socket) {
+      server_ep_remove_close_socket_pair(item);
+      return true;
     }
-
-    item = next_item;
   }
 
-  return found;
+  return false;
 }
 
 static bool server_handle_client_closed_ep_notify_close(int fd_data_socket, uint8_t endpoint_number)
@@ -1162,7 +1989,11 @@ static bool server_handle_client_closed_ep_notify_close(int fd_data_socket, uint
   data_ctrl_data_socket_pair_close_list_item_t *next_item;
   bool notified = false;
 
-  item = SL_SLIST_ENTRY(endpoints[endpoint_number].data_ctrl_data_socket_pair,
+  if (server.endpoints[endpoint_number].data_ctrl_data_socket_pairs == 0) {
+    return false;
+  }
+
+  item = SL_SLIST_ENTRY(server.data_ctrl_data_socket_pairs[SERVER_CONNECTION_BUCKET(fd_data_socket)],
                         data_ctrl_data_socket_pair_close_list_item_t,
                         node);
 
@@ -1171,9 +2002,7 @@ static bool server_handle_client_closed_ep_notify_close(int fd_data_socket, uint
                                data_ctrl_data_socket_pair_close_list_item_t,
                                node);
 
-    if (item->fd_data_socket == fd_data_socket && item->fd_ctrl_data_socket > 0) {
-      sl_slist_remove(&endpoints[endpoint_number].data_ctrl_data_socket_pair, &item->node);
-
+    if (item->endpoint_number == endpoint_number && item->fd_data_socket == fd_data_socket && item->fd_ctrl_data_socket > 0) {
       if (!notified) {
         ssize_t ret;
         uint8_t query_close_buffer[sizeof(cpcd_exchange_buffer_t) + sizeof(int)];
@@ -1194,7 +2023,7 @@ static bool server_handle_client_closed_ep_notify_close(int fd_data_socket, uint
         }
       }
 
-      free(item);
+      server_ep_remove_close_socket_pair(item);
     }
 
     item = next_item;
@@ -1203,56 +2032,59 @@ static bool server_handle_client_closed_ep_notify_close(int fd_data_socket, uint
   return notified;
 }
 
+/* Forget the opens of a closed control connection. One in flight completes
+ * without replying, rather than to a new owner of the file descriptor, one
+ * waiting is dropped when its turn comes. */
+static void server_drop_pending_connections(ctrl_socket_private_data_list_item_t *ctrl_item)
+{
+  pending_connection_list_item_t *pending_connection;
+  sl_slist_node_t *node;
+
+  while ((node = sl_slist_pop(&ctrl_item->pending_connections)) != NULL) {
+    pending_connection = SL_SLIST_ENTRY(node, pending_connection_list_item_t, ctrl_node);
+    pending_connection->fd_ctrl_data_socket = -1;
+
+    if (pending_connection->in_flight) {
+      sl_cpc_system_set_pending_connection(pending_connection->endpoint_id, -1);
+    }
+  }
+}
+
 static void server_handle_client_closed_ctrl_connection(int fd_data_socket)
 {
   ctrl_socket_private_data_list_item_t* item;
-  ctrl_socket_private_data_list_item_t* next_item;
-
-  /* The while loop that follows is the macro SL_SLIST_FOR_EACH_ENTRY exploded to allow
-   * for free()ing items during iteration */
+  int ret;
 
-  item = SL_SLIST_ENTRY(ctrl_connections,
-                        ctrl_socket_private_data_list_item_t,
-                        node);
+  if (server.ctrl_connection_count == 0) {
+    FATAL("ctrl data connection not found in the table of the ctrl socket");
+  }
 
+  item = server_find_ctrl_connection(fd_data_socket);
   if (item == NULL) {
-    FATAL("ctrl data connection not found in the linked list of the ctrl socket");
+    return;
   }
 
-  while (1) {
-    /* Get the next item */
-    next_item = SL_SLIST_ENTRY((item)->node.node,
-                               ctrl_socket_private_data_list_item_t,
-                               node);
-
-    /* We are iterating through the linked list of opened connections,
-     * check if this iteration is the good one*/
-    if (item->data_socket_epoll_private_data.file_descriptor == fd_data_socket) {
-      /* Unregister the data socket file descriptor from epoll watch list */
-      epoll_unregister(&item->data_socket_epoll_private_data);
+  server_drop_pending_connections(item);
 
-      /* Remove the item from the list*/
-      sl_slist_remove(&ctrl_connections, &item->node);
+  /* Unregister the data socket file descriptor from epoll watch list */
+  epoll_unregister(&item->data_socket_epoll_private_data);
 
-      /* Properly shutdown and close this socket on our side (it is on the client's side)*/
-      int ret = shutdown(fd_data_socket, SHUT_RDWR);
-      FATAL_SYSCALL_ON(ret < 0);
+  /* Remove the item from the tables */
+  sl_slist_remove(&server.ctrl_connections[SERVER_CONNECTION_BUCKET(fd_data_socket)], &item->node);
+  server_index_ctrl_connection_pid(item, -1);
+  server.ctrl_connection_count--;
 
-      ret = close(fd_data_socket);
-      FATAL_SYSCALL_ON(ret < 0);
+  /* Properly shutdown and close this socket on our side (it is on the client's side)*/
+  ret = shutdown(fd_data_socket, SHUT_RDWR);
+  FATAL_SYSCALL_ON(ret < 0);
 
-      PRINT_INFO("Client disconnected");
+  ret = close(fd_data_socket);
+  FATAL_SYSCALL_ON(ret < 0);
 
-      /* data connections items are malloced */
-      free(item);
-    }
+  PRINT_INFO("Client disconnected");
 
-    /* End of list ? */
-    item = next_item;
-    if (item == NULL) {
-      break;
-    }
-  }
+  /* data connections items are malloced */
+  free(item);
 }
 
 static void server_handle_client_closed_event_connection(int fd_data_socket, uint8_t endpoint_number)
@@ -1260,12 +2092,12 @@ static void server_handle_client_closed_event_connection(int fd_data_socket, uin
   event_socket_private_data_list_item_t* item;
   event_socket_private_data_list_item_t* next_item;
 
-  BUG_ON(endpoints[endpoint_number].open_event_connections == 0);
+  BUG_ON(server.endpoints[endpoint_number].open_event_connections == 0);
 
   /* The while loop that follows is the macro SL_SLIST_FOR_EACH_ENTRY exploded to allow
    * for free()ing items during iteration */
 
-  item = SL_SLIST_ENTRY(endpoints[endpoint_number].event_data_socket_epoll_private_data,
+  item = SL_SLIST_ENTRY(server.endpoints[endpoint_number].event_data_socket_epoll_private_data,
                         event_socket_private_data_list_item_t,
                         node);
 
@@ -1286,7 +2118,7 @@ static void server_handle_client_closed_event_connection(int fd_data_socket, uin
       epoll_unregister(&item->event_socket_epoll_private_data);
 
       /* Remove the item from the list*/
-      sl_slist_remove(&endpoints[endpoint_number].event_data_socket_epoll_private_data, &item->node);
+      sl_slist_remove(&server.endpoints[endpoint_number].event_data_socket_epoll_private_data, &item->node);
 
       /* Properly shutdown and close this socket on our side (it is on the client's side)*/
       int ret = shutdown(fd_data_socket, SHUT_RDWR);
@@ -1306,8 +2138,8 @@ static void server_handle_client_closed_event_connection(int fd_data_socket, uin
     }
   }
 
-  endpoints[endpoint_number].open_event_connections--;
-  PRINT_INFO("Endpoint event socket #%u: Client disconnected (%d). %d connections", endpoint_number, fd_data_socket, endpoints[endpoint_number].open_event_connections);
+  server.endpoints[endpoint_number].open_event_connections--;
+  PRINT_INFO("Endpoint event socket #%u: Client disconnected (%d). %d connections", endpoint_number, fd_data_socket, server.endpoints[endpoint_number].open_event_connections);
 }
 
 void server_set_endpoint_encryption(uint8_t endpoint_id, bool encryption_enabled)
@@ -1315,7 +2147,7 @@ void server_set_endpoint_encryption(uint8_t endpoint_id, bool encryption_enabled
 #if defined(ENABLE_ENCRYPTION)
   if (endpoint_id != SL_CPC_ENDPOINT_SYSTEM
       && endpoint_id != SL_CPC_ENDPOINT_SECURITY) {
-    endpoints[endpoint_id].encrypted = encryption_enabled;
+    server.endpoints[endpoint_id].encrypted = encryption_enabled;
   }
 #else
   (void)endpoint_id;
@@ -1323,6 +2155,19 @@ void server_set_endpoint_encryption(uint8_t endpoint_id, bool encryption_enabled
 #endif
 }
 
+/* Start monitoring the event socket of an endpoint in epoll */
+static void server_watch_endpoint_event_socket(uint8_t endpoint_number, int fd_connection_sock)
+{
+  epoll_private_data_t* private_data = &server.endpoints[endpoint_number].event_connection_socket_epoll_private_data;
+
+  private_data->callback = server_process_epoll_fd_event_connection_socket;
+  private_data->callback_type = EPOLL_CALLBACK_SERVER_EVENT;
+  private_data->endpoint_number = endpoint_number;
+  private_data->file_descriptor = fd_connection_sock;
+
+  epoll_register(private_data);
+}
+
 static void server_open_endpoint_event_socket(uint8_t endpoint_number)
 {
   struct sockaddr_un name;
@@ -1331,7 +2176,7 @@ static void server_open_endpoint_event_socket(uint8_t endpoint_number)
 
   /* Sanity checks */
   {
-    if (endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor != -1) {
+    if (server.endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor != -1) {
       return; // Nothing to do, endpoint socket is already opened
     }
 
@@ -1339,10 +2184,10 @@ static void server_open_endpoint_event_socket(uint8_t endpoint_number)
     BUG_ON(endpoint_number == 0);
 
     /* Its a bug if we try to open an already opened endpoint */
-    BUG_ON(endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor != -1);
+    BUG_ON(server.endpoints[endpoint_number].event_connection_socket_epoll_private_data.file_descriptor != -1);
 
     /* Make sure the list of data sockets is empty (no leftovers from previous open/close */
-    BUG_ON(endpoints[endpoint_number].event_data_socket_epoll_private_data != NULL);
+    BUG_ON(server.endpoints[endpoint_number].event_data_socket_epoll_private_data != NULL);
   }
 
   /* Create the connection socket and start listening new connections on /run/cpc/epX.cpcd.sock */
@@ -1386,18 +2231,22 @@ static void server_open_endpoint_event_socket(uint8_t endpoint_number)
     FATAL_SYSCALL_ON(ret < 0);
   }
 
-  /* Start monitoring this connection socket in epoll */
-  {
-    epoll_private_data_t* private_data = &endpoints[endpoint_number].event_connection_socket_epoll_private_data;
+  server_watch_endpoint_event_socket(endpoint_number, fd_connection_sock);
 
-    private_data->callback = server_process_epoll_fd_event_connection_socket;
-    private_data->endpoint_number = endpoint_number;
-    private_data->file_descriptor = fd_connection_sock;
+  PRINT_INFO("Opened connection event socket for ep#%u", endpoint_number);
+}
 
-    epoll_register(private_data);
-  }
+/* Start monitoring the connection socket of an endpoint in epoll */
+static void server_watch_endpoint_socket(uint8_t endpoint_number, int fd_connection_sock)
+{
+  epoll_private_data_t* private_data = &server.endpoints[endpoint_number].connection_socket_epoll_private_data;
 
-  PRINT_INFO("Opened connection event socket for ep#%u", endpoint_number);
+  private_data->callback = server_process_epoll_fd_ep_connection_socket;
+  private_data->callback_type = EPOLL_CALLBACK_SERVER_DATA;
+  private_data->endpoint_number = endpoint_number; /* server_process_epoll_fd_ep_connection_socket() callback WILL use the endpoint number and the file descriptor */
+  private_data->file_descriptor = fd_connection_sock;
+
+  epoll_register(private_data);
 }
 
 /*
@@ -1413,7 +2262,7 @@ void server_open_endpoint(uint8_t endpoint_number) /* <-- has been made public f
 
   /* Sanity checks */
   {
-    if (endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor != -1) {
+    if (server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor != -1) {
       return; // Nothing to do, endpoint socket is already opened
     }
 
@@ -1421,10 +2270,10 @@ void server_open_endpoint(uint8_t endpoint_number) /* <-- has been made public f
     BUG_ON(endpoint_number == 0);
 
     /* Its a bug if we try to open an already opened endpoint */
-    BUG_ON(endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor != -1);
+    BUG_ON(server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor != -1);
 
     /* Make sure the list of data sockets is empty (no leftovers from previous open/close */
-    BUG_ON(endpoints[endpoint_number].data_socket_epoll_private_data != NULL);
+    BUG_ON(server.endpoints[endpoint_number].data_socket_epoll_private_data != NULL);
   }
 
   /* Create the connection socket and start listening new connections on /run/cpc/epX.cpcd.sock */
@@ -1468,23 +2317,14 @@ void server_open_endpoint(uint8_t endpoint_number) /* <-- has been made public f
     FATAL_SYSCALL_ON(ret < 0);
   }
 
-  /* Start monitoring this connection socket in epoll */
-  {
-    epoll_private_data_t* private_data = &endpoints[endpoint_number].connection_socket_epoll_private_data;
-
-    private_data->callback = server_process_epoll_fd_ep_connection_socket;
-    private_data->endpoint_number = endpoint_number; /* server_process_epoll_fd_ep_connection_socket() callback WILL use the endpoint number and the file descriptor */
-    private_data->file_descriptor = fd_connection_sock;
-
-    epoll_register(private_data);
-  }
+  server_watch_endpoint_socket(endpoint_number, fd_connection_sock);
 
   PRINT_INFO("Opened connection socket for ep#%u", endpoint_number);
 }
 
 bool server_is_endpoint_open(uint8_t endpoint_number)
 {
-  return endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1 ? false : true;
+  return server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1 ? false : true;
 }
 
 /* Close an endpoint in the server layer
@@ -1502,26 +2342,29 @@ void server_close_endpoint(uint8_t endpoint_number, bool error)
     /* System endpoint is not like the others, if we create a socket for it, there's a bug */
     BUG_ON(endpoint_number == 0);
 
-    if (endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1) {
+    if (server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1) {
       return; // Endpoint was previously closed
     }
   }
 
   /* Close every open connection on that endpoint (data socket) */
-  while (endpoints[endpoint_number].data_socket_epoll_private_data != NULL) {
+  while (server.endpoints[endpoint_number].data_socket_epoll_private_data != NULL) {
     data_socket_private_data_list_item_t* item;
     data_sock_i++;
 
     /* Pop the first element of the list */
     {
-      sl_slist_node_t* node = sl_slist_pop(&endpoints[endpoint_number].data_socket_epoll_private_data);
+      sl_slist_node_t* node = sl_slist_pop(&server.endpoints[endpoint_number].data_socket_epoll_private_data);
 
       item = SL_SLIST_ENTRY(node, data_socket_private_data_list_item_t, node);
     }
 
     /* Unregister the data socket file descriptor from epoll watch list */
     {
-      epoll_unregister(&item->data_socket_epoll_private_data);
+      server_unwatch_data_socket(item);
+
+      server_close_shm_transport(item);
+      server_clear_backlog(item);
     }
 
     /* Notify the client */
@@ -1531,11 +2374,7 @@ void server_close_endpoint(uint8_t endpoint_number, bool error)
 
     /* Close the socket */
     {
-      ret = shutdown(item->data_socket_epoll_private_data.file_descriptor, SHUT_RDWR);
-      FATAL_SYSCALL_ON(ret < 0);
-
-      ret = close(item->data_socket_epoll_private_data.file_descriptor);
-      FATAL_SYSCALL_ON(ret < 0);
+      server_close_data_socket(item);
     }
 
     /* Free per-connection allocated sources  */
@@ -1548,16 +2387,16 @@ void server_close_endpoint(uint8_t endpoint_number, bool error)
       free(item);
     }
 
-    TRACE_SERVER("Closed data socket #%u on ep#%u", data_sock_i, endpoint_number);
+    TRACE_SERVER("Closed data socket #%zu on ep#%u", data_sock_i, endpoint_number);
   }
 
   /* Close the connection socket */
   {
-    int fd_connection_socket = endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor;
+    int fd_connection_socket = server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor;
 
     if (fd_connection_socket > 0) {
       /* Unregister the connection socket file descriptor from epoll watch list */
-      epoll_unregister(&endpoints[endpoint_number].connection_socket_epoll_private_data);
+      epoll_unregister(&server.endpoints[endpoint_number].connection_socket_epoll_private_data);
 
       /* Close the connection socket */
       ret = shutdown(fd_connection_socket, SHUT_RDWR);
@@ -1589,14 +2428,14 @@ void server_close_endpoint(uint8_t endpoint_number, bool error)
     }
 
     /* Set the connection socket file descriptor to -1 to signify that the endpoint is closed */
-    endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor = -1;
+    server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor = -1;
 
     /* At this point the endpoint socket is closed.. there can't be any listeners */
     if (error) {
       // We expect all open connections to call cpc_close to clear the error via the control socket
-      endpoints[endpoint_number].pending_close = endpoints[endpoint_number].open_data_connections;
+      server.endpoints[endpoint_number].pending_close = server.endpoints[endpoint_number].open_data_connections;
     }
-    endpoints[endpoint_number].open_data_connections = 0;
+    server.endpoints[endpoint_number].open_data_connections = 0;
   }
 }
 
@@ -1615,33 +2454,41 @@ sl_status_t server_push_data_to_endpoint(uint8_t endpoint_number, const uint8_t*
     /* If we receive data for an endpoint from the core and try to push it to an
      * endpoint socket that is closed (that is, doesn't have its connection socket
      * up), its a bug. Server and core should be coherent */
-    BUG_ON(endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1);
+    BUG_ON(server.endpoints[endpoint_number].connection_socket_epoll_private_data.file_descriptor == -1);
 
     /* Give a warning if we want to push data but no apps are connected to the
      * endpoint. That is, the list of data sockets is empty */
-    WARN_ON(endpoints[endpoint_number].data_socket_epoll_private_data == NULL);
+    WARN_ON(server.endpoints[endpoint_number].data_socket_epoll_private_data == NULL);
+  }
+
+  /* The clients on the shared memory transport all read the one copy of the ring */
+  if (server.endpoints[endpoint_number].broadcast_clients != 0) {
+    sl_status_t status = server_push_to_broadcast(endpoint_number, data, data_len);
+    if (status != SL_STATUS_OK) {
+      return status;
+    }
   }
 
   /* Push the buffer's payload to each connected app */
-  item = SL_SLIST_ENTRY(endpoints[endpoint_number].data_socket_epoll_private_data,
+  item = SL_SLIST_ENTRY(server.endpoints[endpoint_number].data_socket_epoll_private_data,
                         data_socket_private_data_list_item_t,
                         node);
 
   /* Iterate through all data sockets for that endpoint */
   while (item != NULL) {
-    ssize_t wc = send(item->data_socket_epoll_private_data.file_descriptor,
-                      data,
-                      data_len,
-                      MSG_DONTWAIT);
-    if (wc < 0) {
-      TRACE_SERVER("send() failed with %s", ERRNO_CODENAME[errno]);
+    int err = server_send_to_data_socket(item, data, data_len);
+
+    CPCD_TRACEPOINT(client_send, endpoint_number, (uint32_t)data_len, err);
+
+    if (err != 0) {
+      TRACE_SERVER("send() failed with %s", ERRNO_CODENAME[err]);
     }
 
     /* keep track of number of clients the data have been sent to */
     nb_clients++;
 
     /* Close unresponsive sockets */
-    if (wc < 0 && (errno == EAGAIN || errno == EPIPE || errno == ECONNRESET || errno == EWOULDBLOCK)) {
+    if (err == EAGAIN || err == EPIPE || err == ECONNRESET || err == EWOULDBLOCK) {
       WARN("Unresponsive data socket on ep#%d, closing", endpoint_number);
 
       /*
@@ -1650,59 +2497,584 @@ sl_status_t server_push_data_to_endpoint(uint8_t endpoint_number, const uint8_t*
        * was only one client connected. If there were two clients and for some
        * reasons sending to both of them fail, we want to close the two connections.
        */
-      if (endpoints[endpoint_number].open_data_connections == 1 && nb_clients == 1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      if (server.endpoints[endpoint_number].open_data_connections == 1 && nb_clients == 1) {
+        if (err == EAGAIN || err == EWOULDBLOCK) {
           return SL_STATUS_WOULD_BLOCK;
         }
-      }
+      }
+
+      /* Unregister the data socket file descriptor from epoll watch list */
+      server_unwatch_data_socket(item);
+
+      server_close_shm_transport(item);
+      server_clear_backlog(item);
+
+      /* Push close pair */
+      server_ep_push_close_socket_pair(item->data_socket_epoll_private_data.file_descriptor, -1, endpoint_number);
+
+      /* Properly shutdown and close this socket on our side */
+      server_close_data_socket(item);
+
+      /* Remove the item from the list*/
+      sl_slist_remove(&server.endpoints[endpoint_number].data_socket_epoll_private_data, &item->node);
+
+      /* data connections items are malloced */
+      free(item);
+
+      FATAL_ON(server.endpoints[endpoint_number].open_data_connections == 0);
+
+      server.endpoints[endpoint_number].open_data_connections--;
+      PRINT_INFO("Endpoint socket #%d: Client disconnected. %d connections", endpoint_number, server.endpoints[endpoint_number].open_data_connections);
+
+      if (server.endpoints[endpoint_number].open_data_connections == 0) {
+        TRACE_SERVER("Endpoint was unresponsive, closing endpoint socket, no more listeners");
+        server_close_endpoint(endpoint_number, false);
+        return SL_STATUS_FAIL;
+      }
+
+      /* Get the next data socket for that endpoint*/
+      item = SL_SLIST_ENTRY(server.endpoints[endpoint_number].data_socket_epoll_private_data,
+                            data_socket_private_data_list_item_t,
+                            node);
+    } else {
+      /* The data should have been be completely written to the socket */
+      FATAL_SYSCALL_ON(err != 0);
+
+      /* Get the next data socket for that endpoint*/
+      item = SL_SLIST_ENTRY((item)->node.node,
+                            data_socket_private_data_list_item_t,
+                            node);
+    }
+  }
+
+  return SL_STATUS_OK;
+}
+
+/* Append a frame to the backlog of a client, or apply the overflow policy when it is full.
+ * Returns 0 if the frame was queued or dropped, EAGAIN if the client must be considered unresponsive. */
+static int server_push_to_backlog(data_socket_private_data_list_item_t *item, const uint8_t* data, size_t data_len)
+{
+  backlog_list_item_t *entry;
+
+  if (config.client_backlog_max_frames == 0) {
+    return EAGAIN;
+  }
+
+  while (sl_queue_len(&item->backlog) + 1 > config.client_backlog_max_frames
+         || item->backlog_bytes + data_len > config.client_backlog_max_bytes) {
+    switch (config.client_backlog_overflow_policy) {
+      case BACKLOG_OVERFLOW_DROP_OLDEST:
+        if (!sl_queue_is_empty(&item->backlog)) {
+          entry = SL_SLIST_ENTRY(sl_queue_pop(&item->backlog), backlog_list_item_t, node);
+          item->backlog_bytes -= entry->length;
+          item->backlog_dropped++;
+          mempool_free(&server.backlog_pool, entry);
+          break;
+        }
+      // The frame alone is larger than the backlog
+      // fall through
+      case BACKLOG_OVERFLOW_DROP_NEWEST:
+        item->backlog_dropped++;
+        return 0;
+      case BACKLOG_OVERFLOW_DISCONNECT:
+      default:
+        return EAGAIN;
+    }
+  }
+
+  entry = (backlog_list_item_t*) mempool_alloc(&server.backlog_pool, sizeof(backlog_list_item_t) + data_len);
+
+  entry->length = data_len;
+  memcpy(entry->data, data, data_len);
+
+  sl_queue_push_back(&item->backlog, &entry->node);
+  item->backlog_bytes += data_len;
+
+  if (sl_queue_len(&item->backlog) > item->backlog_max_frames) {
+    item->backlog_max_frames = sl_queue_len(&item->backlog);
+  }
+  if (item->backlog_bytes > item->backlog_max_bytes) {
+    item->backlog_max_bytes = item->backlog_bytes;
+  }
+
+  /* Get notified when the client reads again */
+  server_set_data_socket_events(item, EPOLLOUT);
+
+  return 0;
+}
+
+/* Send as much of the backlog as the socket accepts.
+ * Returns 0 once it is empty, or the errno that stopped it. */
+static int server_flush_backlog(data_socket_private_data_list_item_t *item)
+{
+  while (!sl_queue_is_empty(&item->backlog)) {
+    backlog_list_item_t *entry = SL_SLIST_ENTRY(sl_queue_peek(&item->backlog), backlog_list_item_t, node);
+    ssize_t wc = send(item->data_socket_epoll_private_data.file_descriptor,
+                      entry->data,
+                      entry->length,
+                      MSG_DONTWAIT);
+    if (wc < 0) {
+      return (errno == EWOULDBLOCK) ? EAGAIN : errno;
+    }
+    FATAL_ON((size_t)wc != entry->length);
+
+    sl_queue_pop(&item->backlog);
+    item->backlog_bytes -= entry->length;
+    item->sndbuf_bytes_sent += entry->length;
+    mempool_free(&server.backlog_pool, entry);
+  }
+
+  server_set_data_socket_events(item, 0);
+
+  return 0;
+}
+
+static void server_watch_data_socket(data_socket_private_data_list_item_t *item)
+{
+  if (server_io_is_enabled()) {
+    item->io_connection_id = server.next_io_connection_id++;
+    server_io_attach(item->data_socket_epoll_private_data.file_descriptor,
+                     item->data_socket_epoll_private_data.endpoint_number,
+                     item->io_connection_id);
+  } else {
+    epoll_register(&item->data_socket_epoll_private_data);
+  }
+}
+
+static void server_unwatch_data_socket(data_socket_private_data_list_item_t *item)
+{
+  /* The server I/O thread stops watching it when it is closed */
+  if (!server_io_is_enabled()) {
+    epoll_unregister(&item->data_socket_epoll_private_data);
+  }
+}
+
+static void server_set_data_socket_events(data_socket_private_data_list_item_t *item, uint32_t events)
+{
+  if (!server_io_is_enabled()) {
+    epoll_set_events(&item->data_socket_epoll_private_data, events);
+    return;
+  }
+
+  if (item->data_socket_epoll_private_data.events != events) {
+    item->data_socket_epoll_private_data.events = events;
+    server_io_set_events(item->io_connection_id, events);
+  }
+}
+
+static void server_close_data_socket(data_socket_private_data_list_item_t *item)
+{
+  int fd_data_socket = item->data_socket_epoll_private_data.file_descriptor;
+  int ret;
+
+  if (item->sndbuf > server.default_sndbuf) {
+    server.sndbuf_granted -= (size_t)(item->sndbuf - server.default_sndbuf);
+  }
+
+  ret = shutdown(fd_data_socket, SHUT_RDWR);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  /* The server I/O thread closes it once it no longer uses it, so that the fd can't be reused under its feet */
+  if (server_io_is_enabled()) {
+    server_io_detach(item->io_connection_id);
+  } else {
+    ret = close(fd_data_socket);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+}
+
+static void server_clear_backlog(data_socket_private_data_list_item_t *item)
+{
+  while (!sl_queue_is_empty(&item->backlog)) {
+    mempool_free(&server.backlog_pool, SL_SLIST_ENTRY(sl_queue_pop(&item->backlog), backlog_list_item_t, node));
+  }
+  item->backlog_bytes = 0;
+}
+
+/* Write a frame to the broadcast ring of an endpoint, and wake up the clients
+ * that had read everything. The ring is the backlog of these clients: when the
+ * frame overwrites messages a client has yet to read, it loses the oldest ones,
+ * or is flagged as lapped to be disconnected, depending on the overflow policy.
+ * A single client gets SL_STATUS_WOULD_BLOCK instead, like with a full socket. */
+static sl_status_t server_push_to_broadcast(uint8_t endpoint_number, const uint8_t* data, size_t data_len)
+{
+  endpoint_control_block_t *endpoint = &server.endpoints[endpoint_number];
+  bool disconnect = (config.client_backlog_overflow_policy == BACKLOG_OVERFLOW_DISCONNECT);
+  data_socket_private_data_list_item_t *item;
+  uint32_t previous_tail = 0;
+  bool pushed;
+
+  SL_SLIST_FOR_EACH_ENTRY(endpoint->data_socket_epoll_private_data,
+                          item,
+                          data_socket_private_data_list_item_t,
+                          node) {
+    uint32_t overwritten;
+
+    if (item->shm_base == NULL) {
+      continue;
+    }
+
+    overwritten = shm_broadcast_overwritten(&endpoint->broadcast, item->rx_cursor, (uint32_t)data_len);
+
+    item->lapped = disconnect && overwritten != 0;
+    if (item->lapped && endpoint->open_data_connections == 1) {
+      return SL_STATUS_WOULD_BLOCK;
+    } else if (!disconnect) {
+      item->backlog_dropped += overwritten;
+    }
+  }
+
+  pushed = shm_broadcast_push(&endpoint->broadcast, data, (uint32_t)data_len, &previous_tail);
+
+  SL_SLIST_FOR_EACH_ENTRY(endpoint->data_socket_epoll_private_data,
+                          item,
+                          data_socket_private_data_list_item_t,
+                          node) {
+    uint32_t lag;
+
+    if (item->shm_base == NULL || item->lapped) {
+      continue;
+    }
+
+    /* Larger than the ring, every client misses it */
+    if (!pushed) {
+      if (disconnect) {
+        item->lapped = true;
+      } else {
+        item->backlog_dropped++;
+      }
+      continue;
+    }
+
+    lag = shm_broadcast_lag(&endpoint->broadcast, item->rx_cursor);
+    if (lag > item->backlog_max_bytes) {
+      item->backlog_max_bytes = lag;
+    }
+
+    if (shm_broadcast_was_empty(item->rx_cursor, previous_tail)) {
+      const uint64_t one = 1;
+      FATAL_SYSCALL_ON(write(item->fd_rx_doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN);
+    }
+  }
+
+  return SL_STATUS_OK;
+}
+
+/* Send a frame to one client. Returns 0 if it was sent, queued or dropped by
+ * the overflow policy, otherwise the errno of the failure. */
+static int server_send_to_data_socket(data_socket_private_data_list_item_t *item, const uint8_t* data, size_t data_len)
+{
+  ssize_t wc;
+  int err;
+
+  /* The frame was already written to the broadcast ring by server_push_to_broadcast() */
+  if (item->shm_base != NULL) {
+    return item->lapped ? EAGAIN : 0;
+  }
+
+  /* Frames already waiting go first, to keep the order */
+  if (!sl_queue_is_empty(&item->backlog)) {
+    err = server_flush_backlog(item);
+    if (err == EAGAIN && server_grow_sndbuf(item, item->backlog_bytes + data_len)) {
+      err = server_flush_backlog(item);
+    }
+    if (err != 0 && err != EAGAIN) {
+      return err;
+    }
+  }
+
+  if (sl_queue_is_empty(&item->backlog)) {
+    wc = send(item->data_socket_epoll_private_data.file_descriptor,
+              data,
+              data_len,
+              MSG_DONTWAIT);
+    if (wc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && server_grow_sndbuf(item, data_len)) {
+      wc = send(item->data_socket_epoll_private_data.file_descriptor,
+                data,
+                data_len,
+                MSG_DONTWAIT);
+    }
+    if (wc >= 0) {
+      FATAL_ON((size_t)wc != data_len);
+      item->sndbuf_bytes_sent += data_len;
+      return 0;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      return errno;
+    }
+  }
+
+  return server_push_to_backlog(item, data, data_len);
+}
+
+static int server_get_sndbuf(int fd)
+{
+  socklen_t length = sizeof(int);
+  int size;
+
+  FATAL_SYSCALL_ON(getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &length) < 0);
+
+  return size;
+}
+
+static void server_init_socket_autotune(void)
+{
+  int fd;
+
+  /* The size a client is brought back to when idle */
+  fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  FATAL_SYSCALL_ON(fd < 0);
+  server.default_sndbuf = server_get_sndbuf(fd);
+  close(fd);
+
+  epoll_timer_init(&server.socket_autotune_timer, server_process_timeout_socket_autotune);
+  epoll_timer_start(&server.socket_autotune_timer, SOCKET_AUTOTUNE_PERIOD_US);
+}
+
+/* A new client, or one handed over by the previous daemon with the size it gave it */
+static void server_track_sndbuf(data_socket_private_data_list_item_t *item)
+{
+  item->sndbuf = server_get_sndbuf(item->data_socket_epoll_private_data.file_descriptor);
+
+  if (item->sndbuf > server.default_sndbuf) {
+    server.sndbuf_granted += (size_t)(item->sndbuf - server.default_sndbuf);
+  }
+}
+
+/* Resize the send buffer of a client, size being what SO_SNDBUF reports. Returns the size it got. */
+static int server_resize_sndbuf(data_socket_private_data_list_item_t *item, int size)
+{
+  int fd = item->data_socket_epoll_private_data.file_descriptor;
+  int requested = size / 2; // The kernel doubles it for its bookkeeping
+
+  /* Past net.core.wmem_max if the daemon is allowed to, the caps of the configuration apply anyway */
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &requested, sizeof(requested)) < 0) {
+    FATAL_SYSCALL_ON(errno != EPERM);
+    FATAL_SYSCALL_ON(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &requested, sizeof(requested)) < 0);
+  }
+
+  if (item->sndbuf > server.default_sndbuf) {
+    server.sndbuf_granted -= (size_t)(item->sndbuf - server.default_sndbuf);
+  }
+
+  item->sndbuf = server_get_sndbuf(fd);
+
+  if (item->sndbuf > server.default_sndbuf) {
+    server.sndbuf_granted += (size_t)(item->sndbuf - server.default_sndbuf);
+  }
+
+  TRACE_SERVER("Send buffer of client %d on ep#%u: %d bytes",
+               fd, item->data_socket_epoll_private_data.endpoint_number, item->sndbuf);
+
+  return item->sndbuf;
+}
+
+/* The socket of a client is full: give it room for what is pending, twice as much as it had,
+ * and enough for a fraction of its throughput, within the caps of the configuration.
+ * Returns false if it can't grow. */
+static bool server_grow_sndbuf(data_socket_private_data_list_item_t *item, size_t pending)
+{
+  size_t size = (size_t)item->sndbuf;
+  size_t throughput;
+  size_t others;
+  size_t limit;
+  size_t target;
+
+  if (!config.client_socket_autotune) {
+    return false;
+  }
+
+  throughput = item->sndbuf_throughput > item->sndbuf_bytes_sent ? item->sndbuf_throughput : item->sndbuf_bytes_sent;
+
+  target = 2 * size;
+  if (size + pending > target) {
+    target = size + pending;
+  }
+  if (throughput / SOCKET_AUTOTUNE_THROUGHPUT_DIVIDER > target) {
+    target = throughput / SOCKET_AUTOTUNE_THROUGHPUT_DIVIDER;
+  }
+
+  /* What is left of the total, this client keeping what it has */
+  others = server.sndbuf_granted;
+  if (size > (size_t)server.default_sndbuf) {
+    others -= size - (size_t)server.default_sndbuf;
+  }
+  limit = others < config.client_socket_total_max_bytes ? (size_t)server.default_sndbuf + config.client_socket_total_max_bytes - others : size;
+  if (limit > config.client_socket_max_bytes) {
+    limit = config.client_socket_max_bytes;
+  }
+  if (target > limit) {
+    target = limit;
+  }
+
+  if (target <= size) {
+    return false;
+  }
+
+  /* The kernel may cap it below, at net.core.wmem_max */
+  if ((size_t)server_resize_sndbuf(item, (int)target) <= size) {
+    return false;
+  }
+
+  server.sndbuf_grown++;
+
+  return true;
+}
+
+static void server_process_timeout_socket_autotune(epoll_timer_t *timer)
+{
+  data_socket_private_data_list_item_t *item;
+  const uint8_t *ep_ids;
+  size_t ep_count;
+
+  epoll_timer_start(timer, SOCKET_AUTOTUNE_PERIOD_US);
+
+  ep_count = core_get_opened_endpoints(&ep_ids);
+  for (size_t n = 0; n < ep_count; n++) {
+    SL_SLIST_FOR_EACH_ENTRY(server.endpoints[ep_ids[n]].data_socket_epoll_private_data,
+                            item,
+                            data_socket_private_data_list_item_t,
+                            node) {
+      /* The clients on the shared memory transport don't read from their socket */
+      if (item->shm_base != NULL) {
+        continue;
+      }
+
+      item->sndbuf_throughput = item->sndbuf_bytes_sent;
+
+      if (item->sndbuf_bytes_sent == 0 && sl_queue_is_empty(&item->backlog)) {
+        item->sndbuf_idle_periods++;
+      } else {
+        item->sndbuf_idle_periods = 0;
+      }
+      item->sndbuf_bytes_sent = 0;
+
+      /* Give back what an idle client was given, a period of traffic grows it again */
+      if (item->sndbuf_idle_periods >= SOCKET_AUTOTUNE_IDLE_PERIODS && item->sndbuf > server.default_sndbuf) {
+        int size = item->sndbuf / 2;
+
+        if (size < server.default_sndbuf) {
+          size = server.default_sndbuf;
+        }
 
-      /* Unregister the data socket file descriptor from epoll watch list */
-      epoll_unregister(&item->data_socket_epoll_private_data);
+        server_resize_sndbuf(item, size);
+        server.sndbuf_shrunk++;
+        item->sndbuf_idle_periods = 0;
+      }
+    }
+  }
+}
 
-      /* Push close pair */
-      server_ep_push_close_socket_pair(item->data_socket_epoll_private_data.file_descriptor, -1, endpoint_number);
+uint32_t server_get_noop_keep_alive_interval_ms(void)
+{
+#if !defined(UNIT_TESTING)
+  if (config.use_noop_keep_alive) {
+    return (uint32_t)(server.noop_keep_alive_period_us / 1000u);
+  }
+#endif
 
-      /* Properly shutdown and close this socket on our side */
-      int ret = shutdown(item->data_socket_epoll_private_data.file_descriptor, SHUT_RDWR);
-      FATAL_SYSCALL_ON(ret < 0);
+  return 0;
+}
 
-      ret = close(item->data_socket_epoll_private_data.file_descriptor);
-      FATAL_SYSCALL_ON(ret < 0);
+void server_set_noop_keep_alive_interval_ms(uint32_t interval_ms)
+{
+#if !defined(UNIT_TESTING)
+  BUG_ON(!config.use_noop_keep_alive || interval_ms == 0);
 
-      /* Remove the item from the list*/
-      sl_slist_remove(&endpoints[endpoint_number].data_socket_epoll_private_data, &item->node);
+  /* The link has to be idle for a whole new period */
+  server.noop_keep_alive_period_us = (uint64_t)interval_ms * 1000u;
+  server.noop_keep_alive_rx_frames = server_rxd_valid_frames();
+  epoll_timer_start(&server.noop_timer, server.noop_keep_alive_period_us);
+#else
+  (void)interval_ms;
+#endif
+}
 
-      /* data connections items are malloced */
-      free(item);
+/* The bytes waiting for a client, in its backlog or in the broadcast ring of the endpoint */
+static size_t server_get_client_backlog_bytes(uint8_t endpoint_number, data_socket_private_data_list_item_t *item)
+{
+  if (item->shm_base != NULL) {
+    return shm_broadcast_lag(&server.endpoints[endpoint_number].broadcast, item->rx_cursor);
+  }
 
-      FATAL_ON(endpoints[endpoint_number].open_data_connections == 0);
+  return item->backlog_bytes;
+}
 
-      endpoints[endpoint_number].open_data_connections--;
-      PRINT_INFO("Endpoint socket #%d: Client disconnected. %d connections", endpoint_number, endpoints[endpoint_number].open_data_connections);
+void server_print_client_backlog_stats(void)
+{
+  data_socket_private_data_list_item_t *item;
+  const uint8_t *ep_ids;
+  size_t ep_count;
 
-      if (endpoints[endpoint_number].open_data_connections == 0) {
-        TRACE_SERVER("Endpoint was unresponsive, closing endpoint socket, no more listeners");
-        server_close_endpoint(endpoint_number, false);
-        return SL_STATUS_FAIL;
-      }
+  /* Clients only connect to the endpoints the core opened */
+  ep_count = core_get_opened_endpoints(&ep_ids);
+  for (size_t n = 0; n < ep_count; n++) {
+    size_t i = ep_ids[n];
 
-      /* Get the next data socket for that endpoint*/
-      item = SL_SLIST_ENTRY(endpoints[endpoint_number].data_socket_epoll_private_data,
+    SL_SLIST_FOR_EACH_ENTRY(server.endpoints[i].data_socket_epoll_private_data,
+                            item,
                             data_socket_private_data_list_item_t,
-                            node);
-    } else {
-      /* The data should have been be completely written to the socket */
-      FATAL_SYSCALL_ON(wc < 0);
-      FATAL_ON((size_t)wc != data_len);
+                            node) {
+      TRACE("Server ep#%zu client %d backlog: frames %zu, bytes %zu, max_frames %zu, max_bytes %zu, dropped %u, send buffer %d",
+            i,
+            item->data_socket_epoll_private_data.file_descriptor,
+            sl_queue_len(&item->backlog),
+            server_get_client_backlog_bytes((uint8_t)i, item),
+            item->backlog_max_frames,
+            item->backlog_max_bytes,
+            item->backlog_dropped,
+            item->sndbuf);
+    }
+  }
+}
 
-      /* Get the next data socket for that endpoint*/
-      item = SL_SLIST_ENTRY((item)->node.node,
+void server_add_metrics(metrics_t *metrics)
+{
+  data_socket_private_data_list_item_t *item;
+  const uint8_t *ep_ids;
+  size_t ep_count;
+
+  ep_count = core_get_opened_endpoints(&ep_ids);
+  for (size_t n = 0; n < ep_count; n++) {
+    size_t i = ep_ids[n];
+    size_t backlog_frames = 0;
+    size_t backlog_bytes = 0;
+    uint64_t backlog_dropped = 0;
+    uint64_t send_buffer_bytes = 0;
+    char id[4];
+
+    if (server.endpoints[i].data_socket_epoll_private_data == NULL) {
+      continue;
+    }
+
+    /* Summed over the clients of the endpoint */
+    SL_SLIST_FOR_EACH_ENTRY(server.endpoints[i].data_socket_epoll_private_data,
+                            item,
                             data_socket_private_data_list_item_t,
-                            node);
+                            node) {
+      backlog_frames += sl_queue_len(&item->backlog);
+      backlog_bytes += server_get_client_backlog_bytes((uint8_t)i, item);
+      backlog_dropped += item->backlog_dropped;
+      if (item->shm_base == NULL) {
+        send_buffer_bytes += (uint64_t)item->sndbuf;
+      }
+    }
+
+    snprintf(id, sizeof(id), "%zu", i);
+
+    metrics_add_gauge(metrics, "endpoint_clients", "endpoint", id, server.endpoints[i].open_data_connections);
+    metrics_add_gauge(metrics, "endpoint_client_backlog_frames", "endpoint", id, backlog_frames);
+    metrics_add_gauge(metrics, "endpoint_client_backlog_bytes", "endpoint", id, backlog_bytes);
+    metrics_add_counter(metrics, "endpoint_client_backlog_dropped", "endpoint", id, backlog_dropped);
+    if (config.client_socket_autotune) {
+      metrics_add_gauge(metrics, "endpoint_client_send_buffer_bytes", "endpoint", id, send_buffer_bytes);
     }
   }
 
-  return SL_STATUS_OK;
+  if (config.client_socket_autotune) {
+    metrics_add_gauge(metrics, "client_send_buffer_granted_bytes", NULL, NULL, server.sndbuf_granted);
+    metrics_add_counter(metrics, "client_send_buffer_resizes", "direction", "grow", server.sndbuf_grown);
+    metrics_add_counter(metrics, "client_send_buffer_resizes", "direction", "shrink", server.sndbuf_shrunk);
+  }
 }
 
 static int server_pull_data_from_data_socket(int fd_data_socket, uint8_t** buffer_ptr, size_t* buffer_len_ptr)
@@ -1751,24 +3123,338 @@ static int server_pull_data_from_data_socket(int fd_data_socket, uint8_t** buffe
   return 0;
 }
 
+/* Only the main loop updates the table, the sequence is odd in between */
+static void server_state_table_begin_update(void)
+{
+  __atomic_store_n(&server.state_table->sequence, server.state_table->sequence + 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void server_state_table_end_update(void)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  __atomic_store_n(&server.state_table->sequence, server.state_table->sequence + 1, __ATOMIC_SEQ_CST);
+}
+
+/* Sealed like the broadcast rings, every client maps the same table */
+static void server_open_state_table(void)
+{
+  server.fd_state_table = memfd_create("cpcd_state_table", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  FATAL_SYSCALL_ON(server.fd_state_table < 0);
+
+  FATAL_SYSCALL_ON(ftruncate(server.fd_state_table, (off_t)sizeof(cpcd_exchange_state_table_t)) < 0);
+
+  server.state_table = mmap(NULL, sizeof(cpcd_exchange_state_table_t), PROT_READ | PROT_WRITE, MAP_SHARED, server.fd_state_table, 0);
+  FATAL_SYSCALL_ON(server.state_table == MAP_FAILED);
+
+  if (fcntl(server.fd_state_table, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+    FATAL_SYSCALL_ON(errno != EINVAL);
+    WARN("The kernel can't seal the state table, the clients could write to it");
+  }
+
+  /* The endpoints the secondary opened before the server was up */
+  server.state_table->max_write_size = server_core_get_secondary_rx_capability();
+  for (size_t i = 1; i != 256; i++) {
+    server.state_table->endpoint_state[i] = (uint8_t)core_get_endpoint_state((uint8_t)i);
+    server.state_table->endpoint_encrypted[i] = core_get_endpoint_encryption((uint8_t)i);
+  }
+}
+
+static void server_send_state_table(int fd_ctrl_data_socket, cpcd_exchange_buffer_t *interface_buffer, size_t buffer_len)
+{
+  cpcd_exchange_state_table_query_t reply = { .size = sizeof(cpcd_exchange_state_table_t) };
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t ret;
+
+  memcpy(interface_buffer->payload, &reply, sizeof(reply));
+
+  iov.iov_base = interface_buffer;
+  iov.iov_len = buffer_len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &server.fd_state_table, sizeof(int));
+
+  ret = sendmsg(fd_ctrl_data_socket, &msg, 0);
+
+  if (ret < 0 && errno == EPIPE) {
+    server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+  } else {
+    FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+    FATAL_ON((size_t)ret != buffer_len);
+  }
+}
+
+/* The broadcast ring is created with the first client on the shared memory transport,
+ * and shared by the next ones. Sealing it keeps the clients from mapping it writable,
+ * so that none can corrupt what the others read. */
+static void server_open_broadcast(uint8_t endpoint_number)
+{
+  endpoint_control_block_t *endpoint = &server.endpoints[endpoint_number];
+
+  endpoint->fd_broadcast = memfd_create("cpcd_shm_broadcast", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  FATAL_SYSCALL_ON(endpoint->fd_broadcast < 0);
+
+  endpoint->broadcast_length = shm_broadcast_footprint(SHM_RING_DEFAULT_SIZE);
+  FATAL_SYSCALL_ON(ftruncate(endpoint->fd_broadcast, (off_t)endpoint->broadcast_length) < 0);
+
+  endpoint->broadcast_base = mmap(NULL, endpoint->broadcast_length, PROT_READ | PROT_WRITE, MAP_SHARED, endpoint->fd_broadcast, 0);
+  FATAL_SYSCALL_ON(endpoint->broadcast_base == MAP_FAILED);
+
+  if (fcntl(endpoint->fd_broadcast, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+    FATAL_SYSCALL_ON(errno != EINVAL);
+    WARN("The kernel can't seal the broadcast ring of ep#%d, its clients could write to it", endpoint_number);
+  }
+
+  shm_broadcast_attach(&endpoint->broadcast, endpoint->broadcast_base, SHM_RING_DEFAULT_SIZE, true);
+}
+
+static void server_close_broadcast(uint8_t endpoint_number)
+{
+  endpoint_control_block_t *endpoint = &server.endpoints[endpoint_number];
+
+  FATAL_SYSCALL_ON(munmap(endpoint->broadcast_base, endpoint->broadcast_length) < 0);
+  FATAL_SYSCALL_ON(close(endpoint->fd_broadcast) < 0);
+
+  endpoint->broadcast_base = NULL;
+  endpoint->fd_broadcast = -1;
+}
+
+/* Set up the shared memory transport of a data connection, and hand it to the client.
+ * The client to daemon ring is only read and written by the two ends of this one
+ * connection, the daemon to client ring is the broadcast ring of the endpoint. */
+static void server_open_shm_transport(int fd_ctrl_data_socket, cpcd_exchange_buffer_t *interface_buffer, size_t buffer_len)
+{
+  uint8_t endpoint_number = interface_buffer->endpoint_number;
+  const size_t footprint = shm_ring_footprint(SHM_RING_DEFAULT_SIZE);
+  cpcd_exchange_shm_transport_t request;
+  data_socket_private_data_list_item_t *item;
+  data_socket_private_data_list_item_t *connection = NULL;
+  int fds[SHM_TRANSPORT_FD_COUNT] = { 0 };
+  union {
+    struct cmsghdr header;
+    uint8_t buffer[CMSG_SPACE(sizeof(fds))];
+  } control;
+  struct iovec iov;
+  struct msghdr msg = { 0 };
+  ssize_t ret;
+
+  memcpy(&request, interface_buffer->payload, sizeof(request));
+
+  /* The client designates its connection with the data socket it received on open */
+  SL_SLIST_FOR_EACH_ENTRY(server.endpoints[endpoint_number].data_socket_epoll_private_data,
+                          item,
+                          data_socket_private_data_list_item_t,
+                          node) {
+    if (item->data_socket_epoll_private_data.file_descriptor == request.data_socket) {
+      connection = item;
+      break;
+    }
+  }
+
+  if (connection == NULL || connection->shm_base != NULL) {
+    WARN("Refused shared memory transport on ep#%d", endpoint_number);
+    request.ring_size = 0;
+  } else {
+    if (server.endpoints[endpoint_number].broadcast_clients++ == 0) {
+      server_open_broadcast(endpoint_number);
+    }
+
+    fds[SHM_TRANSPORT_FD_MEMFD] = memfd_create("cpcd_shm_transport", MFD_CLOEXEC);
+    FATAL_SYSCALL_ON(fds[SHM_TRANSPORT_FD_MEMFD] < 0);
+
+    connection->shm_length = footprint + sizeof(shm_broadcast_cursor_t);
+    FATAL_SYSCALL_ON(ftruncate(fds[SHM_TRANSPORT_FD_MEMFD], (off_t)connection->shm_length) < 0);
+
+    connection->shm_base = mmap(NULL, connection->shm_length, PROT_READ | PROT_WRITE, MAP_SHARED, fds[SHM_TRANSPORT_FD_MEMFD], 0);
+    FATAL_SYSCALL_ON(connection->shm_base == MAP_FAILED);
+
+    shm_ring_attach(&connection->tx_ring, connection->shm_base, SHM_RING_DEFAULT_SIZE, true);
+
+    connection->rx_cursor = (shm_broadcast_cursor_t *)((uint8_t *)connection->shm_base + footprint);
+    shm_broadcast_join(&server.endpoints[endpoint_number].broadcast, connection->rx_cursor);
+    connection->lapped = false;
+
+    fds[SHM_TRANSPORT_FD_BROADCAST_MEMFD] = server.endpoints[endpoint_number].fd_broadcast;
+
+    for (int i = SHM_TRANSPORT_FD_DAEMON_DOORBELL; i < SHM_TRANSPORT_FD_COUNT; i++) {
+      fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      FATAL_SYSCALL_ON(fds[i] < 0);
+    }
+
+    connection->fd_rx_doorbell = fds[SHM_TRANSPORT_FD_RX_DOORBELL];
+    connection->fd_tx_doorbell = fds[SHM_TRANSPORT_FD_TX_DOORBELL];
+
+    connection->doorbell_epoll_private_data.callback = server_process_epoll_fd_shm_doorbell;
+    connection->doorbell_epoll_private_data.callback_type = EPOLL_CALLBACK_SERVER_DATA;
+    connection->doorbell_epoll_private_data.endpoint_number = endpoint_number;
+    connection->doorbell_epoll_private_data.file_descriptor = fds[SHM_TRANSPORT_FD_DAEMON_DOORBELL];
+
+    epoll_register(&connection->doorbell_epoll_private_data);
+
+    request.ring_size = SHM_RING_DEFAULT_SIZE;
+    request.overwrites = (config.client_backlog_overflow_policy != BACKLOG_OVERFLOW_DISCONNECT);
+    TRACE_SERVER("Opened shared memory transport on ep#%d, %u clients on it", endpoint_number, server.endpoints[endpoint_number].broadcast_clients);
+  }
+
+  memcpy(interface_buffer->payload, &request, sizeof(request));
+
+  iov.iov_base = interface_buffer;
+  iov.iov_len = buffer_len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (request.ring_size != 0) {
+    struct cmsghdr *cmsg;
+
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  }
+
+  ret = sendmsg(fd_ctrl_data_socket, &msg, 0);
+
+  /* The mapping keeps the memory alive, the daemon doesn't need the memfd itself.
+   * The one of the broadcast ring is kept for the next clients. */
+  if (request.ring_size != 0) {
+    FATAL_SYSCALL_ON(close(fds[SHM_TRANSPORT_FD_MEMFD]) < 0);
+  }
+
+  if (ret < 0 && errno == EPIPE) {
+    server_handle_client_closed_ctrl_connection(fd_ctrl_data_socket);
+  } else {
+    FATAL_SYSCALL_ON(ret < 0 && errno != EPIPE);
+    FATAL_ON((size_t)ret != buffer_len);
+  }
+}
+
+/* The client pushed to an empty ring, or the daemon left messages behind when the endpoint got busy */
+static void server_process_epoll_fd_shm_doorbell(epoll_private_data_t *private_data)
+{
+  data_socket_private_data_list_item_t *item = container_of(private_data,
+                                                            data_socket_private_data_list_item_t,
+                                                            doorbell_epoll_private_data);
+  uint8_t endpoint_number = private_data->endpoint_number;
+  const uint64_t one = 1;
+  uint64_t count;
+  ssize_t length;
+
+  FATAL_SYSCALL_ON(read(private_data->file_descriptor, &count, sizeof(count)) < 0 && errno != EAGAIN);
+
+  while (1) {
+    if (core_ep_is_busy(endpoint_number)) {
+      if (!shm_ring_is_empty(&item->tx_ring)) {
+        /* Keep the doorbell rung so that the rest is pulled once the endpoint is watched back */
+        FATAL_SYSCALL_ON(write(private_data->file_descriptor, &one, sizeof(one)) < 0 && errno != EAGAIN);
+        epoll_unwatch(private_data);
+      }
+      return;
+    }
+
+    if (server.shm_write_buffer == NULL) {
+      server.shm_write_buffer = core_alloc_write_buffer();
+    }
+
+    length = shm_ring_pop(&item->tx_ring, server.shm_write_buffer, core_get_write_buffer_size());
+    if (length == 0) {
+      return;
+    }
+
+    if (length < 0) {
+      WARN("Corrupted shared memory ring on ep#%d, closing the connection", endpoint_number);
+      server_handle_client_closed_ep_connection(item->data_socket_epoll_private_data.file_descriptor, endpoint_number);
+      return;
+    }
+
+    if (shm_ring_take_producer_waiting(&item->tx_ring)) {
+      FATAL_SYSCALL_ON(write(item->fd_tx_doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN);
+    }
+
+    if (core_get_endpoint_state(endpoint_number) != SL_CPC_STATE_OPEN) {
+      WARN("User tried to push on endpoint %d but it's not open, state is %d", endpoint_number, core_get_endpoint_state(endpoint_number));
+      server_close_endpoint(endpoint_number, false);
+      return;
+    }
+
+    CPCD_TRACEPOINT(client_recv, endpoint_number, (uint32_t)length);
+    core_write_buffer(endpoint_number, server.shm_write_buffer, (size_t)length, 0);
+    server.shm_write_buffer = NULL;
+  }
+}
+
+static void server_close_shm_transport(data_socket_private_data_list_item_t *item)
+{
+  uint8_t endpoint_number;
+
+  if (item->shm_base == NULL) {
+    return;
+  }
+
+  endpoint_number = item->doorbell_epoll_private_data.endpoint_number;
+
+  /* Also takes care of a doorbell that is currently unwatched */
+  epoll_unregister(&item->doorbell_epoll_private_data);
+
+  FATAL_SYSCALL_ON(close(item->doorbell_epoll_private_data.file_descriptor) < 0);
+  FATAL_SYSCALL_ON(close(item->fd_rx_doorbell) < 0);
+  FATAL_SYSCALL_ON(close(item->fd_tx_doorbell) < 0);
+  FATAL_SYSCALL_ON(munmap(item->shm_base, item->shm_length) < 0);
+
+  item->shm_base = NULL;
+  item->rx_cursor = NULL;
+
+  BUG_ON(server.endpoints[endpoint_number].broadcast_clients == 0);
+  if (--server.endpoints[endpoint_number].broadcast_clients == 0) {
+    server_close_broadcast(endpoint_number);
+  }
+}
+
 bool server_listener_list_empty(uint8_t endpoint_number)
 {
-  return endpoints[endpoint_number].open_data_connections == 0;
+  return server.endpoints[endpoint_number].open_data_connections == 0;
 }
 
 void server_notify_connected_libs_of_secondary_reset(void)
 {
   ctrl_socket_private_data_list_item_t* item;
+  size_t bucket;
 
-  SL_SLIST_FOR_EACH_ENTRY(ctrl_connections,
-                          item,
-                          ctrl_socket_private_data_list_item_t,
-                          node){
-    if (item->pid != getpid()) {
-      if (item->pid > 1) {
-        kill(item->pid, SIGUSR1);
-      } else {
-        BUG("Connected library's pid it not set");
+  /* Before the signal, so that a client reading the table from its handler sees it is stale */
+  if (server.state_table != NULL) {
+    server_state_table_begin_update();
+    server.state_table->reset_count++;
+    server_state_table_end_update();
+  }
+
+  /* The connections of cpc_open_endpoint_async() don't register a pid, the one of cpc_init() does */
+  for (bucket = 0; bucket != SERVER_CONNECTION_BUCKET_COUNT; bucket++) {
+    SL_SLIST_FOR_EACH_ENTRY(server.ctrl_connections_by_pid[bucket],
+                            item,
+                            ctrl_socket_private_data_list_item_t,
+                            pid_node){
+      if (item->pid != getpid()) {
+        if (item->pid > 1) {
+          kill(item->pid, SIGUSR1);
+        } else {
+          BUG("Connected library's pid it not set");
+        }
       }
     }
   }
@@ -1831,7 +3517,7 @@ static void server_notify_connected_libs_of_endpoint_state_change(uint8_t ep_id,
 
   BUG_ON(ep_id == SL_CPC_ENDPOINT_SYSTEM || ep_id == SL_CPC_ENDPOINT_SECURITY);
 
-  SL_SLIST_FOR_EACH_ENTRY(endpoints[ep_id].event_data_socket_epoll_private_data, item,
+  SL_SLIST_FOR_EACH_ENTRY(server.endpoints[ep_id].event_data_socket_epoll_private_data, item,
                           event_socket_private_data_list_item_t,
                           node){
     server_send_event(item->event_socket_epoll_private_data.file_descriptor,
@@ -1842,9 +3528,203 @@ static void server_notify_connected_libs_of_endpoint_state_change(uint8_t ep_id,
   }
 }
 
+void server_on_endpoint_tx_credit(uint8_t ep_id, uint32_t tx_credit)
+{
+  event_socket_private_data_list_item_t* item;
+
+  if (ep_id == SL_CPC_ENDPOINT_SYSTEM || ep_id == SL_CPC_ENDPOINT_SECURITY) {
+    return;
+  }
+
+  SL_SLIST_FOR_EACH_ENTRY(server.endpoints[ep_id].event_data_socket_epoll_private_data, item,
+                          event_socket_private_data_list_item_t,
+                          node){
+    server_send_event(item->event_socket_epoll_private_data.file_descriptor,
+                      SL_CPC_EVENT_ENDPOINT_TX_CREDIT,
+                      ep_id,
+                      (uint8_t *)&tx_credit,
+                      sizeof(tx_credit));
+  }
+}
+
 void server_on_endpoint_state_change(uint8_t ep_id, cpc_endpoint_state_t state)
 {
+  if (server.state_table != NULL) {
+    server_state_table_begin_update();
+    server.state_table->endpoint_state[ep_id] = (uint8_t)state;
+    server_state_table_end_update();
+  }
+
   if (ep_id != SL_CPC_ENDPOINT_SYSTEM && ep_id != SL_CPC_ENDPOINT_SECURITY ) {
     server_notify_connected_libs_of_endpoint_state_change(ep_id, state);
   }
 }
+
+void server_on_endpoint_encryption_change(uint8_t ep_id, bool encrypted)
+{
+  if (server.state_table != NULL) {
+    server_state_table_begin_update();
+    server.state_table->endpoint_encrypted[ep_id] = encrypted;
+    server_state_table_end_update();
+  }
+}
+
+const char* server_handoff_refusal(bool *transient)
+{
+  *transient = true;
+
+  if (!sl_queue_is_empty(&server.pending_connections) || server.pending_connections_in_flight != NULL) {
+    return "a client is opening an endpoint";
+  }
+
+  for (size_t i = 1; i != 256; i++) {
+    endpoint_control_block_t *ep = &server.endpoints[i];
+    data_socket_private_data_list_item_t *item;
+
+    if (ep->pending_close != 0 || ep->data_ctrl_data_socket_pairs != 0) {
+      return "a client is closing an endpoint";
+    }
+
+    SL_SLIST_FOR_EACH_ENTRY(ep->data_socket_epoll_private_data,
+                            item,
+                            data_socket_private_data_list_item_t,
+                            node){
+      /* Its rings are mapped in both processes, and the broadcast ring is sealed against the next daemon */
+      if (item->shm_base != NULL) {
+        *transient = false;
+        return "a client uses the shared memory transport";
+      }
+
+      if (!sl_queue_is_empty(&item->backlog)) {
+        return "a client is behind on its frames";
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static int server_export_socket(int fd_handoff, handoff_record_type_t type, uint8_t endpoint_number, int fd, pid_t pid)
+{
+  handoff_record_t record;
+
+  memset(&record, 0, sizeof(record));
+  record.type = type;
+  record.endpoint_number = endpoint_number;
+  record.data.connection.fd_number = fd;
+  record.data.connection.pid = pid;
+
+  return handoff_send_record(fd_handoff, &record, fd);
+}
+
+int server_export(int fd_handoff)
+{
+  ctrl_socket_private_data_list_item_t *ctrl_item;
+  int ret;
+
+  ret = server_export_socket(fd_handoff, HANDOFF_RECORD_CTRL_SOCKET, 0, server.fd_socket_ctrl, -1);
+  if (ret < 0) {
+    return ret;
+  }
+
+  for (size_t bucket = 0; bucket != SERVER_CONNECTION_BUCKET_COUNT; bucket++) {
+    SL_SLIST_FOR_EACH_ENTRY(server.ctrl_connections[bucket],
+                            ctrl_item,
+                            ctrl_socket_private_data_list_item_t,
+                            node){
+      ret = server_export_socket(fd_handoff, HANDOFF_RECORD_CTRL_CONNECTION, 0,
+                                 ctrl_item->data_socket_epoll_private_data.file_descriptor, ctrl_item->pid);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+
+  for (size_t i = 1; i != 256; i++) {
+    endpoint_control_block_t *ep = &server.endpoints[i];
+    data_socket_private_data_list_item_t *data_item;
+    event_socket_private_data_list_item_t *event_item;
+    uint8_t endpoint_number = (uint8_t)i;
+
+    if (ep->connection_socket_epoll_private_data.file_descriptor != -1) {
+      ret = server_export_socket(fd_handoff, HANDOFF_RECORD_ENDPOINT_SOCKET, endpoint_number,
+                                 ep->connection_socket_epoll_private_data.file_descriptor, -1);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+
+    if (ep->event_connection_socket_epoll_private_data.file_descriptor != -1) {
+      ret = server_export_socket(fd_handoff, HANDOFF_RECORD_ENDPOINT_EVENT_SOCKET, endpoint_number,
+                                 ep->event_connection_socket_epoll_private_data.file_descriptor, -1);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+
+    SL_SLIST_FOR_EACH_ENTRY(ep->data_socket_epoll_private_data,
+                            data_item,
+                            data_socket_private_data_list_item_t,
+                            node){
+      ret = server_export_socket(fd_handoff, HANDOFF_RECORD_DATA_CONNECTION, endpoint_number,
+                                 data_item->data_socket_epoll_private_data.file_descriptor, -1);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+
+    SL_SLIST_FOR_EACH_ENTRY(ep->event_data_socket_epoll_private_data,
+                            event_item,
+                            event_socket_private_data_list_item_t,
+                            node){
+      ret = server_export_socket(fd_handoff, HANDOFF_RECORD_EVENT_CONNECTION, endpoint_number,
+                                 event_item->event_socket_epoll_private_data.file_descriptor, -1);
+      if (ret < 0) {
+        return ret;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void server_import(const handoff_record_t *record, int fd)
+{
+  uint8_t endpoint_number = record->endpoint_number;
+
+  switch (record->type) {
+    case HANDOFF_RECORD_ENDPOINT_SOCKET:
+      server_watch_endpoint_socket(endpoint_number, fd);
+      break;
+
+    case HANDOFF_RECORD_ENDPOINT_EVENT_SOCKET:
+      server_watch_endpoint_event_socket(endpoint_number, fd);
+      break;
+
+    case HANDOFF_RECORD_CTRL_CONNECTION:
+      server_index_ctrl_connection_pid(server_add_ctrl_connection(fd), record->data.connection.pid);
+      break;
+
+    case HANDOFF_RECORD_DATA_CONNECTION:
+      /* The client was acknowledged by the previous daemon, it knows the connection by this same number */
+      server_add_data_connection(endpoint_number, fd);
+      break;
+
+    case HANDOFF_RECORD_EVENT_CONNECTION:
+      server_add_event_connection(endpoint_number, fd);
+      break;
+
+    default:
+      BUG("Unexpected handoff record %u", record->type);
+  }
+}
+
+void server_on_handoff_released(void)
+{
+  /* The next daemon has a table of its own, the clients reading this one go back to the queries */
+  if (server.state_table != NULL) {
+    server_state_table_begin_update();
+    server.state_table->reset_count++;
+    server_state_table_end_update();
+  }
+}
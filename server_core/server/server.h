@@ -21,8 +21,17 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "misc/metrics.h"
 #include "misc/sl_status.h"
 #include "server_core/cpcd_exchange.h"
+#include "server_core/handoff/handoff.h"
+
+/* Maximum number of datagrams pulled from a data socket per epoll event */
+#define SERVER_DATA_SOCKET_BATCH_SIZE 16
+
+/* Write buffers from core_alloc_write_buffer() the server holds while idle, the
+ * data socket batch and the shared memory one */
+#define SERVER_HELD_WRITE_BUFFERS (SERVER_DATA_SOCKET_BATCH_SIZE + 1)
 
 void server_init(void);
 
@@ -38,5 +47,27 @@ bool server_listener_list_empty(uint8_t endpoint_number);
 
 void server_notify_connected_libs_of_secondary_reset(void);
 void server_on_endpoint_state_change(uint8_t ep_id, cpc_endpoint_state_t state);
+void server_on_endpoint_encryption_change(uint8_t ep_id, bool encrypted);
+void server_on_endpoint_tx_credit(uint8_t ep_id, uint32_t tx_credit);
+
+/* Idle time of the link before a no-op keep alive, 0 without use_noop_keep_alive */
+uint32_t server_get_noop_keep_alive_interval_ms(void);
+void server_set_noop_keep_alive_interval_ms(uint32_t interval_ms);
+
+void server_print_client_backlog_stats(void);
+
+void server_add_metrics(metrics_t *metrics);
+
+/* Hot restart, see handoff.h. The reason the link can't be handed over, NULL if it can */
+const char* server_handoff_refusal(bool *transient);
+
+/* Send the sockets and the client connections. Returns 0 or -errno */
+int server_export(int fd_handoff);
+
+/* Take over a socket or a client connection, the endpoints are imported first */
+void server_import(const handoff_record_t *record, int fd);
+
+/* The next daemon took over, the clients must stop relying on the state table */
+void server_on_handoff_released(void);
 
 #endif
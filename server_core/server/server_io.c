@@ -0,0 +1,623 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Server I/O thread
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "misc/config.h"
+#include "misc/errno_codename.h"
+#include "misc/logging.h"
+#include "misc/shm_ring.h"
+#include "misc/sl_slist.h"
+#include "misc/utils.h"
+#include "server_core/core/core.h"
+#include "server_core/epoll/epoll.h"
+#include "server_core/server/server_io.h"
+
+/* Size of each ring, must be a power of two */
+#define SERVER_IO_RING_SIZE (256u * 1024u)
+
+/* Maximum number of datagrams pulled from a data socket per epoll event */
+#define SERVER_IO_BATCH_SIZE 16
+
+/* Maximum number of messages handled by the core thread before it goes back to its other events */
+#define SERVER_IO_MESSAGES_PER_WAKEUP 32
+
+#define SERVER_IO_MAX_EPOLL_EVENTS 16
+
+typedef enum {
+  SERVER_IO_COMMAND_ATTACH,
+  SERVER_IO_COMMAND_DETACH,
+  SERVER_IO_COMMAND_SET_EVENTS,
+  SERVER_IO_COMMAND_UNWATCH,
+  SERVER_IO_COMMAND_WATCH_BACK,
+} server_io_command_type_t;
+
+/* Core thread to I/O thread */
+typedef struct {
+  uint8_t type;
+  uint8_t endpoint_number;
+  int fd;
+  uint32_t connection_id;
+  uint32_t events;
+} server_io_command_t;
+
+typedef enum {
+  SERVER_IO_MESSAGE_DATAGRAM,
+  SERVER_IO_MESSAGE_HANGUP,
+  SERVER_IO_MESSAGE_WRITABLE,
+} server_io_message_type_t;
+
+/* I/O thread to core thread */
+typedef struct {
+  uint8_t type;
+  uint8_t endpoint_number;
+  uint32_t connection_id;
+  uint8_t payload[];
+} server_io_message_t;
+
+/* A data socket, as known by the I/O thread */
+typedef struct {
+  sl_slist_node_t node;
+  int fd;
+  uint8_t endpoint_number;
+  uint32_t connection_id;
+  uint32_t events;
+  bool watched;
+  bool closing; // Hung up or detached, never watched again
+} server_io_connection_t;
+
+static struct {
+  /* Shared by both threads, through the rings only */
+  shm_ring_t to_io_ring;
+  shm_ring_t to_core_ring;
+  int fd_io_doorbell;
+  int fd_core_doorbell;
+
+  /* Owned by the core thread */
+  bool core_endpoint_unwatched[256];
+  uint8_t *core_message_buffer;
+  size_t core_message_buffer_size;
+  epoll_private_data_t core_doorbell_epoll_private_data;
+
+  /* Owned by the I/O thread */
+  int io_fd_epoll;
+  sl_slist_node_t *io_connections;
+  sl_slist_node_t *io_detached_connections; // Freed once no epoll event refers to them
+  bool io_endpoint_unwatched[256];
+  size_t io_datagram_size;
+  struct {
+    struct mmsghdr msgs[SERVER_IO_BATCH_SIZE];
+    struct iovec iovecs[SERVER_IO_BATCH_SIZE];
+    uint8_t *buffers[SERVER_IO_BATCH_SIZE];
+  } io_batch;
+} server_io;
+
+static void* server_io_thread_func(void* param);
+static void server_io_process_core_doorbell(epoll_private_data_t *private_data);
+
+bool server_io_is_enabled(void)
+{
+  return config.server_io_thread;
+}
+
+static void server_io_ring_doorbell(int fd_doorbell)
+{
+  const uint64_t event_value = 1;
+  ssize_t ret;
+
+  ret = write(fd_doorbell, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret != sizeof(event_value));
+}
+
+static void server_io_clear_doorbell(int fd_doorbell)
+{
+  uint64_t event_value;
+  ssize_t ret;
+
+  ret = read(fd_doorbell, &event_value, sizeof(event_value));
+  FATAL_SYSCALL_ON(ret < 0 && errno != EAGAIN);
+}
+
+static void server_io_alloc_ring(shm_ring_t *ring)
+{
+  size_t footprint = shm_ring_footprint(SERVER_IO_RING_SIZE);
+  void *base = aligned_alloc(64, (footprint + 63u) & ~(size_t)63u);
+  FATAL_ON(base == NULL);
+
+  shm_ring_attach(ring, base, SERVER_IO_RING_SIZE, true);
+}
+
+void server_io_init(void)
+{
+  pthread_t server_io_thread;
+  int ret;
+  int i;
+
+  server_io_alloc_ring(&server_io.to_io_ring);
+  server_io_alloc_ring(&server_io.to_core_ring);
+
+  server_io.fd_io_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(server_io.fd_io_doorbell < 0);
+
+  server_io.fd_core_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  FATAL_SYSCALL_ON(server_io.fd_core_doorbell < 0);
+
+  /* Messages are popped in one piece, a datagram is as large as a core write buffer */
+  server_io.io_datagram_size = core_get_write_buffer_size();
+  server_io.core_message_buffer_size = sizeof(server_io_message_t) + server_io.io_datagram_size;
+  server_io.core_message_buffer = malloc(server_io.core_message_buffer_size);
+  FATAL_ON(server_io.core_message_buffer == NULL);
+
+  /* Datagrams are received right behind their message header, so that they are pushed with a single copy */
+  for (i = 0; i < SERVER_IO_BATCH_SIZE; i++) {
+    server_io.io_batch.buffers[i] = malloc(sizeof(server_io_message_t) + server_io.io_datagram_size);
+    FATAL_ON(server_io.io_batch.buffers[i] == NULL);
+  }
+
+  server_io.io_fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+  FATAL_SYSCALL_ON(server_io.io_fd_epoll < 0);
+
+  /* The doorbell is the only entry without a connection */
+  {
+    struct epoll_event event = {};
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+
+    ret = epoll_ctl(server_io.io_fd_epoll, EPOLL_CTL_ADD, server_io.fd_io_doorbell, &event);
+    FATAL_SYSCALL_ON(ret < 0);
+  }
+
+  sl_slist_init(&server_io.io_connections);
+  sl_slist_init(&server_io.io_detached_connections);
+
+  server_io.core_doorbell_epoll_private_data.callback = server_io_process_core_doorbell;
+  server_io.core_doorbell_epoll_private_data.callback_type = EPOLL_CALLBACK_SERVER_IO;
+  server_io.core_doorbell_epoll_private_data.file_descriptor = server_io.fd_core_doorbell;
+  server_io.core_doorbell_epoll_private_data.endpoint_number = 0; /* Irrelevant here */
+  epoll_register(&server_io.core_doorbell_epoll_private_data);
+
+  ret = thread_create(&server_io_thread, config.core_sched, server_io_thread_func, NULL);
+  FATAL_ON(ret != 0);
+
+  ret = pthread_setname_np(server_io_thread, "server_io");
+  FATAL_ON(ret != 0);
+
+  ret = pthread_detach(server_io_thread);
+  FATAL_ON(ret != 0);
+
+  PRINT_INFO("Data sockets are read on the server I/O thread");
+}
+
+/*******************************************************************************
+ *****************************   CORE THREAD   *********************************
+ ******************************************************************************/
+
+static void server_io_send_command(const server_io_command_t *command)
+{
+  bool was_empty;
+
+  /* The I/O thread takes commands even while it waits on the core thread, room is made shortly */
+  while (!shm_ring_push(&server_io.to_io_ring, command, sizeof(*command), &was_empty)) {
+    server_io_ring_doorbell(server_io.fd_io_doorbell);
+    sched_yield();
+  }
+
+  if (was_empty) {
+    server_io_ring_doorbell(server_io.fd_io_doorbell);
+  }
+}
+
+void server_io_attach(int fd_data_socket, uint8_t endpoint_number, uint32_t connection_id)
+{
+  server_io_command_t command = {
+    .type = SERVER_IO_COMMAND_ATTACH,
+    .endpoint_number = endpoint_number,
+    .fd = fd_data_socket,
+    .connection_id = connection_id,
+  };
+
+  server_io_send_command(&command);
+}
+
+void server_io_detach(uint32_t connection_id)
+{
+  server_io_command_t command = {
+    .type = SERVER_IO_COMMAND_DETACH,
+    .connection_id = connection_id,
+  };
+
+  server_io_send_command(&command);
+}
+
+void server_io_set_events(uint32_t connection_id, uint32_t events)
+{
+  server_io_command_t command = {
+    .type = SERVER_IO_COMMAND_SET_EVENTS,
+    .connection_id = connection_id,
+    .events = events,
+  };
+
+  server_io_send_command(&command);
+}
+
+void server_io_unwatch(uint8_t endpoint_number)
+{
+  server_io_command_t command = {
+    .type = SERVER_IO_COMMAND_UNWATCH,
+    .endpoint_number = endpoint_number,
+  };
+
+  if (!server_io_is_enabled() || server_io.core_endpoint_unwatched[endpoint_number]) {
+    return;
+  }
+
+  server_io.core_endpoint_unwatched[endpoint_number] = true;
+  server_io_send_command(&command);
+}
+
+void server_io_watch_back(uint8_t endpoint_number)
+{
+  server_io_command_t command = {
+    .type = SERVER_IO_COMMAND_WATCH_BACK,
+    .endpoint_number = endpoint_number,
+  };
+
+  if (!server_io_is_enabled() || !server_io.core_endpoint_unwatched[endpoint_number]) {
+    return;
+  }
+
+  server_io.core_endpoint_unwatched[endpoint_number] = false;
+  server_io_send_command(&command);
+}
+
+static void server_io_process_core_doorbell(epoll_private_data_t *private_data)
+{
+  const server_io_message_t *message = (const server_io_message_t *)server_io.core_message_buffer;
+  int i;
+
+  (void)private_data;
+
+  server_io_clear_doorbell(server_io.fd_core_doorbell);
+
+  for (i = 0; i < SERVER_IO_MESSAGES_PER_WAKEUP; i++) {
+    ssize_t length = shm_ring_pop(&server_io.to_core_ring, server_io.core_message_buffer, server_io.core_message_buffer_size);
+
+    if (length == 0) {
+      break;
+    }
+
+    BUG_ON(length < (ssize_t)sizeof(server_io_message_t));
+
+    switch (message->type) {
+      case SERVER_IO_MESSAGE_DATAGRAM:
+        server_on_io_datagram(message->endpoint_number,
+                              message->connection_id,
+                              message->payload,
+                              (size_t)length - sizeof(server_io_message_t));
+        break;
+      case SERVER_IO_MESSAGE_HANGUP:
+        server_on_io_hangup(message->endpoint_number, message->connection_id);
+        break;
+      case SERVER_IO_MESSAGE_WRITABLE:
+        server_on_io_writable(message->endpoint_number, message->connection_id);
+        break;
+      default:
+        BUG("Unknown server I/O message %d", message->type);
+    }
+  }
+
+  if (shm_ring_take_producer_waiting(&server_io.to_core_ring)) {
+    server_io_ring_doorbell(server_io.fd_io_doorbell);
+  }
+
+  /* Leave the rest for later, so that the bus is serviced in between */
+  if (!shm_ring_is_empty(&server_io.to_core_ring)) {
+    server_io_ring_doorbell(server_io.fd_core_doorbell);
+  }
+}
+
+/*******************************************************************************
+ ******************************   I/O THREAD   *********************************
+ ******************************************************************************/
+
+static server_io_connection_t* server_io_find_connection(uint32_t connection_id)
+{
+  server_io_connection_t *connection;
+
+  SL_SLIST_FOR_EACH_ENTRY(server_io.io_connections, connection, server_io_connection_t, node) {
+    if (connection->connection_id == connection_id) {
+      return connection;
+    }
+  }
+
+  return NULL;
+}
+
+static void server_io_watch_connection(server_io_connection_t *connection, int op)
+{
+  struct epoll_event event = {};
+  int ret;
+
+  event.events = EPOLLIN | connection->events;
+  event.data.ptr = connection;
+
+  ret = epoll_ctl(server_io.io_fd_epoll, op, connection->fd, &event);
+  FATAL_SYSCALL_ON(ret < 0);
+}
+
+static void server_io_unwatch_connection(server_io_connection_t *connection)
+{
+  int ret;
+
+  if (!connection->watched) {
+    return;
+  }
+
+  ret = epoll_ctl(server_io.io_fd_epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+  FATAL_SYSCALL_ON(ret < 0);
+
+  connection->watched = false;
+}
+
+static void server_io_process_command(const server_io_command_t *command)
+{
+  server_io_connection_t *connection;
+
+  switch (command->type) {
+    case SERVER_IO_COMMAND_ATTACH:
+      connection = zalloc(sizeof(server_io_connection_t));
+      FATAL_ON(connection == NULL);
+
+      connection->fd = command->fd;
+      connection->endpoint_number = command->endpoint_number;
+      connection->connection_id = command->connection_id;
+      sl_slist_push(&server_io.io_connections, &connection->node);
+
+      if (!server_io.io_endpoint_unwatched[connection->endpoint_number]) {
+        server_io_watch_connection(connection, EPOLL_CTL_ADD);
+        connection->watched = true;
+      }
+      break;
+
+    case SERVER_IO_COMMAND_DETACH:
+      connection = server_io_find_connection(command->connection_id);
+      BUG_ON(connection == NULL);
+
+      server_io_unwatch_connection(connection);
+      sl_slist_remove(&server_io.io_connections, &connection->node);
+
+      /* The core thread shut it down already, only this side still uses it */
+      FATAL_SYSCALL_ON(close(connection->fd) < 0);
+      connection->closing = true;
+      sl_slist_push(&server_io.io_detached_connections, &connection->node);
+      break;
+
+    case SERVER_IO_COMMAND_SET_EVENTS:
+      connection = server_io_find_connection(command->connection_id);
+      BUG_ON(connection == NULL);
+
+      connection->events = command->events;
+      if (connection->watched) {
+        server_io_watch_connection(connection, EPOLL_CTL_MOD);
+      }
+      break;
+
+    case SERVER_IO_COMMAND_UNWATCH:
+      /* Connections are unwatched lazily, when they become readable */
+      server_io.io_endpoint_unwatched[command->endpoint_number] = true;
+      break;
+
+    case SERVER_IO_COMMAND_WATCH_BACK:
+      server_io.io_endpoint_unwatched[command->endpoint_number] = false;
+
+      SL_SLIST_FOR_EACH_ENTRY(server_io.io_connections, connection, server_io_connection_t, node) {
+        if (connection->endpoint_number == command->endpoint_number
+            && !connection->watched && !connection->closing) {
+          server_io_watch_connection(connection, EPOLL_CTL_ADD);
+          connection->watched = true;
+        }
+      }
+      break;
+
+    default:
+      BUG("Unknown server I/O command %d", command->type);
+  }
+}
+
+static void server_io_process_commands(void)
+{
+  server_io_command_t command;
+  ssize_t length;
+
+  server_io_clear_doorbell(server_io.fd_io_doorbell);
+
+  while ((length = shm_ring_pop(&server_io.to_io_ring, &command, sizeof(command))) != 0) {
+    BUG_ON(length != sizeof(command));
+    server_io_process_command(&command);
+  }
+}
+
+/* Push a message to the core thread, waiting for room if the core thread is behind */
+static void server_io_push_message(const void *message, size_t length)
+{
+  bool was_empty;
+
+  while (!shm_ring_push(&server_io.to_core_ring, message, (uint32_t)length, &was_empty)) {
+    struct pollfd doorbell = { .fd = server_io.fd_io_doorbell, .events = POLLIN };
+
+    /* The core thread rings back once it made room. Checking again after raising
+     * the flag closes the window where it did so right before. */
+    shm_ring_set_producer_waiting(&server_io.to_core_ring);
+    if (shm_ring_push(&server_io.to_core_ring, message, (uint32_t)length, &was_empty)) {
+      break;
+    }
+
+    /* Commands keep flowing meanwhile, the core thread may be waiting on them */
+    while (poll(&doorbell, 1, -1) < 0) {
+      FATAL_SYSCALL_ON(errno != EINTR);
+    }
+    server_io_process_commands();
+  }
+
+  if (was_empty) {
+    server_io_ring_doorbell(server_io.fd_core_doorbell);
+  }
+}
+
+static void server_io_push_event(server_io_connection_t *connection, server_io_message_type_t type)
+{
+  server_io_message_t message = {
+    .type = (uint8_t)type,
+    .endpoint_number = connection->endpoint_number,
+    .connection_id = connection->connection_id,
+  };
+
+  server_io_push_message(&message, sizeof(message));
+}
+
+static void server_io_read_connection(server_io_connection_t *connection)
+{
+  int count;
+  int i;
+
+  for (i = 0; i < SERVER_IO_BATCH_SIZE; i++) {
+    server_io.io_batch.iovecs[i].iov_base = server_io.io_batch.buffers[i] + sizeof(server_io_message_t);
+    server_io.io_batch.iovecs[i].iov_len = server_io.io_datagram_size;
+
+    memset(&server_io.io_batch.msgs[i], 0, sizeof(server_io.io_batch.msgs[i]));
+    server_io.io_batch.msgs[i].msg_hdr.msg_iov = &server_io.io_batch.iovecs[i];
+    server_io.io_batch.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  count = recvmmsg(connection->fd, server_io.io_batch.msgs, SERVER_IO_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (count < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    }
+
+    TRACE_SERVER("recvmmsg() failed with %s", ERRNO_CODENAME[errno]);
+    FATAL_SYSCALL_ON(errno != ECONNRESET);
+    server_io_unwatch_connection(connection);
+    connection->closing = true;
+    server_io_push_event(connection, SERVER_IO_MESSAGE_HANGUP);
+    return;
+  }
+
+  for (i = 0; i < count; i++) {
+    server_io_message_t *message = (server_io_message_t *)server_io.io_batch.buffers[i];
+    size_t length = server_io.io_batch.msgs[i].msg_len;
+
+    /* Clients never send empty datagrams, this is the client closing the connection.
+     * The socket stays quiet until the core thread detaches it. */
+    if (length == 0) {
+      server_io_unwatch_connection(connection);
+      connection->closing = true;
+      server_io_push_event(connection, SERVER_IO_MESSAGE_HANGUP);
+      return;
+    }
+
+    if (server_io.io_batch.msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      WARN("Dropped a datagram larger than %zu bytes on ep#%d", server_io.io_datagram_size, connection->endpoint_number);
+      continue;
+    }
+
+    message->type = SERVER_IO_MESSAGE_DATAGRAM;
+    message->endpoint_number = connection->endpoint_number;
+    message->connection_id = connection->connection_id;
+
+    server_io_push_message(message, sizeof(server_io_message_t) + length);
+  }
+}
+
+static void server_io_process_connection(server_io_connection_t *connection, uint32_t ready_events)
+{
+  if (connection->closing) {
+    return;
+  }
+
+  /* The core thread sends the backlog, it re-arms EPOLLOUT if the socket fills up again */
+  if ((ready_events & EPOLLOUT) && (connection->events & EPOLLOUT)) {
+    connection->events &= ~(uint32_t)EPOLLOUT;
+    server_io_watch_connection(connection, EPOLL_CTL_MOD);
+    server_io_push_event(connection, SERVER_IO_MESSAGE_WRITABLE);
+  }
+
+  /* Pushing may have waited on the core thread, which may have detached it */
+  if (connection->closing || !(ready_events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    return;
+  }
+
+  /* Leave the datagrams in the socket while the endpoint can't take them */
+  if (server_io.io_endpoint_unwatched[connection->endpoint_number]) {
+    server_io_unwatch_connection(connection);
+    return;
+  }
+
+  server_io_read_connection(connection);
+}
+
+static void* server_io_thread_func(void* param)
+{
+  struct epoll_event events[SERVER_IO_MAX_EPOLL_EVENTS];
+  int event_count;
+  int i;
+
+  (void)param;
+
+  while (1) {
+    do {
+      event_count = epoll_wait(server_io.io_fd_epoll, events, SERVER_IO_MAX_EPOLL_EVENTS, -1);
+    } while ((event_count == -1) && (errno == EINTR));
+
+    FATAL_SYSCALL_ON(event_count < 0);
+
+    /* Commands go first, a connection reported below may have been detached */
+    for (i = 0; i < event_count; i++) {
+      if (events[i].data.ptr == NULL) {
+        server_io_process_commands();
+      }
+    }
+
+    for (i = 0; i < event_count; i++) {
+      server_io_connection_t *connection = events[i].data.ptr;
+
+      if (connection == NULL) {
+        continue;
+      }
+
+      server_io_process_connection(connection, events[i].events);
+    }
+
+    while (server_io.io_detached_connections != NULL) {
+      free(SL_SLIST_ENTRY(sl_slist_pop(&server_io.io_detached_connections), server_io_connection_t, node));
+    }
+  }
+
+  return NULL;
+}
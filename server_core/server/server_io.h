@@ -0,0 +1,58 @@
+/***************************************************************************//**
+ * @file
+ * @brief Co-Processor Communication Protocol(CPC) - Server I/O thread
+ *******************************************************************************
+ * # License
+ * <b>Copyright 2022 Silicon Laboratories Inc. www.silabs.com</b>
+ *******************************************************************************
+ *
+ * The licensor of this software is Silicon Laboratories Inc. Your use of this
+ * software is governed by the terms of Silicon Labs Master Software License
+ * Agreement (MSLA) available at
+ * www.silabs.com/about-us/legal/master-software-license-agreement. This
+ * software is distributed to you in Source Code format and is governed by the
+ * sections of the MSLA applicable to Source Code.
+ *
+ ******************************************************************************/
+
+#ifndef SERVER_IO_H
+#define SERVER_IO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * When enabled, reading the data sockets of the clients is done on a thread of
+ * its own, so that a client flooding the daemon doesn't hold the core thread
+ * back from processing acknowledgements and timers.
+ *
+ * The two threads share no state: the core thread hands over the data sockets
+ * and the I/O thread hands back datagrams, each through its own single
+ * producer, single consumer ring with an eventfd to wake up the other side.
+ * Every function below is called on the core thread.
+ */
+
+bool server_io_is_enabled(void);
+
+void server_io_init(void);
+
+/* Hand a data socket over to the I/O thread */
+void server_io_attach(int fd_data_socket, uint8_t endpoint_number, uint32_t connection_id);
+
+/* Take back a data socket, the I/O thread closes it once it stopped using it */
+void server_io_detach(uint32_t connection_id);
+
+/* Extra events to watch on a data socket, on top of EPOLLIN */
+void server_io_set_events(uint32_t connection_id, uint32_t events);
+
+/* Stop and resume reading the data sockets of an endpoint while it is busy */
+void server_io_unwatch(uint8_t endpoint_number);
+void server_io_watch_back(uint8_t endpoint_number);
+
+/* Implemented by the server, called on the core thread for what the I/O thread handed back */
+void server_on_io_datagram(uint8_t endpoint_number, uint32_t connection_id, const void *data, size_t length);
+void server_on_io_hangup(uint8_t endpoint_number, uint32_t connection_id);
+void server_on_io_writable(uint8_t endpoint_number, uint32_t connection_id);
+
+#endif //SERVER_IO_H
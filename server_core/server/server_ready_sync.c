@@ -39,7 +39,8 @@ void server_ready_post(void)
 
     server_ready_synchronizer.is_ready = true;
 
-    ret = pthread_cond_signal(&server_ready_synchronizer.is_ready_condition);
+    /* The security thread and the firmware upload can both be waiting */
+    ret = pthread_cond_broadcast(&server_ready_synchronizer.is_ready_condition);
     FATAL_ON(ret != 0);
   }
   pthread_mutex_unlock(&server_ready_synchronizer.is_ready_mutex);
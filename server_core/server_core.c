@@ -30,74 +30,121 @@
 
 #include "misc/config.h"
 #include "misc/logging.h"
+#include "misc/memlock.h"
 #include "misc/sleep.h"
 #include "misc/utils.h"
+#include "modes/firmware_upload.h"
 #include "modes/uart_validation.h"
 #include "server_core.h"
 #include "server_core/epoll/epoll.h"
+#include "server_core/epoll/timer.h"
+#include "server_core/epoll/loop_stats.h"
 #include "server_core/server/server.h"
 #include "server_core/core/core.h"
 #include "server_core/system_endpoint/system.h"
+#include "server_core/handoff/handoff.h"
 #include "security/security.h"
 #include "version.h"
+#include "driver/driver_emul.h"
 #include "driver/driver_kill.h"
+#include "driver/driver_uart.h"
 
 #define MAX_EPOLL_EVENTS 1
 
 char *server_core_secondary_app_version = NULL;
 uint8_t server_core_secondary_protocol_version;
 sl_cpc_bootloader_t server_core_secondary_bootloader_type = SL_CPC_BOOTLOADER_UNKNOWN;
-
-static bool set_reset_mode_ack = false;
-
-static bool reset_ack = false;
-static bool secondary_cpc_version_received = false;
-static bool secondary_app_version_received_or_not_available = false;
-static bool bootloader_info_received_or_not_available = false;
-static bool secondary_bus_speed_received = false;
-static bool failed_to_receive_secondary_bus_speed = false;
-static bool reset_reason_received = false;
-static bool capabilities_received = false;
-static bool rx_capability_received = false;
-static bool protocol_version_received = false;
-
-static server_core_mode_t server_core_mode = SERVER_CORE_MODE_NORMAL;
-
-static sl_cpc_system_reboot_mode_t pending_mode;
-
-static int kill_eventfd = -1;
-static int security_ready_eventfd = -1;
-
-static enum {
-  SET_NORMAL_REBOOT_MODE,
-  WAIT_NORMAL_REBOOT_MODE_ACK,
-  WAIT_NORMAL_RESET_ACK,
-  WAIT_RESET_REASON,
-  WAIT_FOR_CAPABILITIES,
-  WAIT_FOR_RX_CAPABILITY,
-  WAIT_FOR_BOOTLOADER_INFO,
-  WAIT_FOR_SECONDARY_CPC_VERSION,
-  WAIT_FOR_SECONDARY_APP_VERSION,
-  WAIT_FOR_PROTOCOL_VERSION,
-  WAIT_FOR_SECONDARY_BUS_SPEED,
-  RESET_SEQUENCE_DONE
-} reset_sequence_state = SET_NORMAL_REBOOT_MODE;
-
-static enum {
-  SET_BOOTLOADER_REBOOT_MODE,
-  WAIT_BOOTLOADER_REBOOT_MODE_ACK,
-  WAIT_BOOTLOADER_RESET_ACK
-} reboot_into_bootloader_state = SET_BOOTLOADER_REBOOT_MODE;
+uint32_t server_core_secondary_bootloader_capabilities = 0;
 
 bool ignore_reset_reason = true;
 
-#if defined(UNIT_TESTING)
-static uint32_t rx_capability = 1024;
-#else
-static uint32_t rx_capability = 0;
+static struct {
+  bool set_reset_mode_ack;
+
+  bool reset_ack;
+  bool secondary_cpc_version_received;
+  bool secondary_app_version_received_or_not_available;
+  bool bootloader_info_received_or_not_available;
+  bool secondary_bus_speed_received;
+  bool failed_to_receive_secondary_bus_speed;
+  bool secondary_max_bus_speed_received_or_not_available;
+  bool bus_speed_switch_replied;
+  bool bus_speed_switch_acked;
+  bool bus_speed_confirmation_replied;
+  bool bus_speed_confirmed;
+  bool reset_reason_received;
+  bool reboot_wait_expired;
+  bool capabilities_received;
+  bool rx_capability_received;
+  bool tx_window_size_received_or_not_available;
+  bool protocol_version_received;
+
+  server_core_mode_t server_core_mode;
+
+  sl_cpc_system_reboot_mode_t pending_mode;
+
+  int kill_eventfd;
+  int security_ready_eventfd;
+  epoll_private_data_t kill_private_data;
+  epoll_private_data_t security_ready_data;
+
+  enum {
+    SET_NORMAL_REBOOT_MODE,
+    WAIT_NORMAL_REBOOT_MODE_ACK,
+    WAIT_NORMAL_RESET_ACK,
+    WAIT_RESET_REASON,
+    WAIT_FOR_SECONDARY_INFO,
+    WAIT_FOR_SECONDARY_MAX_BUS_SPEED,
+    WAIT_FOR_BUS_SPEED_SWITCH,
+    WAIT_FOR_BUS_SPEED_CONFIRMATION,
+    RESET_SEQUENCE_DONE
+  } reset_sequence_state;
+
+  enum {
+    SET_BOOTLOADER_REBOOT_MODE,
+    WAIT_BOOTLOADER_REBOOT_MODE_ACK,
+    WAIT_BOOTLOADER_RESET_ACK
+  } reboot_into_bootloader_state;
+
+  uint32_t rx_capability;
+
+  uint32_t capabilities;
+
+  /* Messages larger than a frame are sent and received in several I-frames, see core_write() */
+  bool fragmentation;
+
+  /* Several messages are sent and received in a single I-frame, see core_write() */
+  bool aggregation;
+
+  /* The payload of I-frames may be an LZ4 block, see core_compress_frame() */
+  bool compression;
+
+  /* Window of I-frames in flight per endpoint, until negotiated with the secondary */
+  uint8_t tx_window_size;
+
+  /* Window the secondary advertises, the one it transmits with */
+  uint8_t secondary_tx_window_size;
+
+  /* Highest UART baud rate the secondary advertises, 0 if it doesn't */
+  uint32_t secondary_max_bus_speed;
+
+  /* UART baud rate being negotiated with the secondary */
+  uint32_t bus_speed_candidate;
+
+  /* Bounds the wait for the reset reason of the secondary to CPCD_REBOOT_TIME_MS */
+  epoll_timer_t reboot_wait_timer;
+} server_core = {
+  .server_core_mode = SERVER_CORE_MODE_NORMAL,
+  .kill_eventfd = -1,
+  .security_ready_eventfd = -1,
+  .reset_sequence_state = SET_NORMAL_REBOOT_MODE,
+  .reboot_into_bootloader_state = SET_BOOTLOADER_REBOOT_MODE,
+#if defined(UNIT_TESTING) || defined(CORE_BENCH)
+  .rx_capability = 1024,
 #endif
-
-static uint32_t capabilities = 0;
+  .tx_window_size = 1,
+  .secondary_tx_window_size = 1,
+};
 
 static void on_unsolicited_status(sl_cpc_system_status_t status);
 
@@ -131,6 +178,8 @@ void reset_callback(sl_cpc_system_command_handle_t *handle,
                     sl_status_t status,
                     sl_cpc_system_status_t reset_status);
 
+static void server_core_resume(void);
+
 static void cleanup_socket_folder(const char *folder)
 {
   struct dirent *next_file;
@@ -152,8 +201,18 @@ static void cleanup_socket_folder(const char *folder)
 
 uint32_t server_core_get_secondary_rx_capability(void)
 {
-  FATAL_ON(rx_capability == 0); // Need to go through reset sequence first
-  return rx_capability;
+  FATAL_ON(server_core.rx_capability == 0); // Need to go through reset sequence first
+  return server_core.rx_capability;
+}
+
+uint8_t server_core_get_tx_window_size(void)
+{
+  return server_core.tx_window_size;
+}
+
+uint8_t server_core_get_secondary_tx_window_size(void)
+{
+  return server_core.secondary_tx_window_size;
 }
 
 void server_core_kill_signal(void)
@@ -161,11 +220,11 @@ void server_core_kill_signal(void)
   ssize_t ret;
   const uint64_t event_value = 1; //doesn't matter what it is
 
-  if (kill_eventfd == -1) {
+  if (server_core.kill_eventfd == -1) {
     return;
   }
 
-  ret = write(kill_eventfd, &event_value, sizeof(event_value));
+  ret = write(server_core.kill_eventfd, &event_value, sizeof(event_value));
   FATAL_ON(ret != sizeof(event_value));
 }
 
@@ -174,11 +233,11 @@ void server_core_notify_security_ready(void)
   const uint64_t event_value = 1;
   ssize_t ret;
 
-  if (security_ready_eventfd == -1) {
+  if (server_core.security_ready_eventfd == -1) {
     return;
   }
 
-  ret = write(security_ready_eventfd, &event_value, sizeof(event_value));
+  ret = write(server_core.security_ready_eventfd, &event_value, sizeof(event_value));
   FATAL_ON(ret != sizeof(event_value));
 }
 
@@ -186,13 +245,19 @@ pthread_t server_core_init(int fd_socket_driver_core, int fd_socket_driver_core_
 {
   char* socket_folder = NULL;
   struct stat sb = { 0 };
-  pthread_t server_core_thread = { 0 };
+  pthread_t thread = { 0 };
   int ret = 0;
 
+  loop_stats_init();
+
   core_init(fd_socket_driver_core, fd_socket_driver_core_notify);
 
   sl_cpc_system_init();
 
+  if (config.stats_interval > 0) {
+    init_stats_logging();
+  }
+
 #if !defined(UNIT_TESTING)
   sl_cpc_system_register_unsolicited_prop_last_status_callback(on_unsolicited_status);
 #endif
@@ -207,8 +272,10 @@ pthread_t server_core_init(int fd_socket_driver_core, int fd_socket_driver_core_
     FATAL_ON(ret < 0 || (size_t) ret >= socket_folder_string_size);
   }
 
-  /* Check if the socket folder exists */
-  if (stat(socket_folder, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+  /* Check if the socket folder exists. On a hot restart, its sockets are the ones handed over */
+  if (handoff_is_resuming()) {
+    TRACE_SERVER("Keeping socket folder %s", socket_folder);
+  } else if (stat(socket_folder, &sb) == 0 && S_ISDIR(sb.st_mode)) {
     TRACE_SERVER("Cleaning up socket folder %s", socket_folder);
     cleanup_socket_folder(socket_folder);
   } else {
@@ -221,17 +288,31 @@ pthread_t server_core_init(int fd_socket_driver_core, int fd_socket_driver_core_
   free(socket_folder);
 
   /* The server is not initialized immediately because we want to perform a successful reset sequence
-   * of the secondary before. That is, unless we explicitly disable the reset sequence in the config file */
-  if (config.reset_sequence == false) {
+   * of the secondary before. That is, unless we explicitly disable the reset sequence in the config file,
+   * or the link is taken over from a running daemon, which went through it */
+  if (handoff_is_resuming()) {
+    server_core_resume();
+  } else if (config.reset_sequence == false) {
     /* FIXME : If we don't perform a reset sequence, the rx_capability won't be fetched. Lets put a very conservative
      * value in place to be able to work . */
-    rx_capability = 256;
+    server_core.rx_capability = 256;
+#if defined(CPC_BENCH)
+    /* Nor the capabilities, but the emulated secondary's are known */
+    if (config.bus == EMUL) {
+      server_core.capabilities = driver_emul_get_capabilities();
+    }
+#endif
+    server_core.fragmentation = config.fragmentation && (server_core.capabilities & CPC_CAPABILITIES_FRAGMENTATION_MASK);
+    server_core.aggregation = config.aggregation && (server_core.capabilities & CPC_CAPABILITIES_AGGREGATION_MASK);
+    server_core.compression = config.compression && (server_core.capabilities & CPC_CAPABILITIES_COMPRESSION_MASK);
+    core_init_buffer_pools();
     server_init();
 #if defined(ENABLE_ENCRYPTION)
     if (config.operation_mode != MODE_UART_VALIDATION) {
       security_init();
     }
 #endif
+    memlock_startup_done();
   }
 
 #if defined(UNIT_TESTING)
@@ -240,43 +321,40 @@ pthread_t server_core_init(int fd_socket_driver_core, int fd_socket_driver_core_
 
   /* Setup the kill eventfd */
   {
-    kill_eventfd = eventfd(0, //Start with 0 value
+    server_core.kill_eventfd = eventfd(0, //Start with 0 value
                            EFD_CLOEXEC);
-    FATAL_ON(kill_eventfd == -1);
-
-    static epoll_private_data_t private_data;
+    FATAL_ON(server_core.kill_eventfd == -1);
 
-    private_data.callback = server_core_cleanup;
-    private_data.file_descriptor = kill_eventfd; /* Irrelevant here */
-    private_data.endpoint_number = 0; /* Irrelevant here */
+    server_core.kill_private_data.callback = server_core_cleanup;
+    server_core.kill_private_data.file_descriptor = server_core.kill_eventfd; /* Irrelevant here */
+    server_core.kill_private_data.endpoint_number = 0; /* Irrelevant here */
 
-    epoll_register(&private_data);
+    epoll_register(&server_core.kill_private_data);
   }
 
   /* Setup event to be called when security has been initialized */
   {
-    security_ready_eventfd = eventfd(0, EFD_CLOEXEC);
-    FATAL_ON(security_ready_eventfd == -1);
+    server_core.security_ready_eventfd = eventfd(0, EFD_CLOEXEC);
+    FATAL_ON(server_core.security_ready_eventfd == -1);
 
-    static epoll_private_data_t security_ready_data;
-
-    security_ready_data.callback = security_fetch_remote_security_state;
+    server_core.security_ready_data.callback = security_fetch_remote_security_state;
     /* These fields are initialized but values are not relevant */
-    security_ready_data.file_descriptor = security_ready_eventfd;
-    security_ready_data.endpoint_number = 0;
+    server_core.security_ready_data.file_descriptor = server_core.security_ready_eventfd;
+    server_core.security_ready_data.callback_type = EPOLL_CALLBACK_SECURITY;
+    server_core.security_ready_data.endpoint_number = 0;
 
-    epoll_register(&security_ready_data);
+    epoll_register(&server_core.security_ready_data);
   }
 
   /* create server_core thread */
-  server_core_mode = mode;
-  ret = pthread_create(&server_core_thread, NULL, server_core_thread_func, NULL);
+  server_core.server_core_mode = mode;
+  ret = thread_create(&thread, config.core_sched, server_core_thread_func, NULL);
   FATAL_ON(ret != 0);
 
-  ret = pthread_setname_np(server_core_thread, "server_core");
+  ret = pthread_setname_np(thread, "server_core");
   FATAL_ON(ret != 0);
 
-  return server_core_thread;
+  return thread;
 }
 
 static void* server_core_thread_func(void* param)
@@ -286,16 +364,18 @@ static void* server_core_thread_func(void* param)
   size_t event_count;
 
   while (1) {
+    loop_stats_begin_iteration();
+
 #if !defined(UNIT_TESTING)
-    if ((config.reset_sequence == true) && (server_core_mode == SERVER_CORE_MODE_NORMAL)) {
+    if ((config.reset_sequence == true) && (server_core.server_core_mode == SERVER_CORE_MODE_NORMAL)) {
       process_reset_sequence(false);
     }
 
-    if (server_core_mode == SERVER_CORE_MODE_FIRMWARE_RESET) {
+    if (server_core.server_core_mode == SERVER_CORE_MODE_FIRMWARE_RESET) {
       process_reset_sequence(true);
     }
 
-    if (server_core_mode == SERVER_CORE_MODE_FIRMWARE_BOOTLOADER) {
+    if (server_core.server_core_mode == SERVER_CORE_MODE_FIRMWARE_BOOTLOADER) {
       process_reboot_enter_bootloader();
     }
 #endif
@@ -308,10 +388,23 @@ static void* server_core_thread_func(void* param)
     size_t event_i;
     for (event_i = 0; event_i != (size_t)event_count; event_i++) {
       epoll_private_data_t* private_data = (epoll_private_data_t*) events[event_i].data.ptr;
-      private_data->callback(private_data);
+      private_data->ready_events = events[event_i].events;
+
+      if (loop_stats_is_sampling()) {
+        /* The callback may free its private data */
+        epoll_callback_type_t callback_type = private_data->callback_type;
+        uint64_t start_ns = loop_stats_now_ns();
+
+        private_data->callback(private_data);
+        loop_stats_record_callback(callback_type, start_ns);
+      } else {
+        private_data->callback(private_data);
+      }
     }
 
     server_process_pending_connections();
+
+    loop_stats_end_iteration();
   }
 
   return NULL;
@@ -340,12 +433,12 @@ static void property_set_reset_mode_callback(sl_cpc_system_command_handle_t *han
 
       switch (*mode) {
         case REBOOT_APPLICATION:
-          if (pending_mode == REBOOT_BOOTLOADER) {
+          if (server_core.pending_mode == REBOOT_BOOTLOADER) {
             FATAL("The secondary does not support rebooting into bootloader mode: application reboot received as a confirmation instead of bootloader.");
           }
           break;
         case REBOOT_BOOTLOADER:
-          if (pending_mode != REBOOT_BOOTLOADER) {
+          if (server_core.pending_mode != REBOOT_BOOTLOADER) {
             BUG("Requested reboot mode was not bootloader, but received it as a reply");
           }
           break;
@@ -354,14 +447,14 @@ static void property_set_reset_mode_callback(sl_cpc_system_command_handle_t *han
           break;
       }
 
-      set_reset_mode_ack = true;
+      server_core.set_reset_mode_ack = true;
       break;
 
     case SL_STATUS_TIMEOUT:
     case SL_STATUS_ABORT:
       PRINT_INFO("Failed to connect, secondary seems unresponsive");
       ignore_reset_reason = false; // Don't ignore a secondary that resets
-      reset_sequence_state = SET_NORMAL_REBOOT_MODE;
+      server_core.reset_sequence_state = SET_NORMAL_REBOOT_MODE;
       break;
     default:
       BUG("Unhandled property_set_reset_mode_callback status");
@@ -382,7 +475,7 @@ void reset_callback(sl_cpc_system_command_handle_t *handle,
       TRACE_RESET("Reset request response received : %d", reset_status);
 
       if (reset_status == SL_STATUS_OK) {
-        reset_ack = true;
+        server_core.reset_ack = true;
       }
       break;
 
@@ -390,7 +483,7 @@ void reset_callback(sl_cpc_system_command_handle_t *handle,
     case SL_STATUS_ABORT:
       WARN("Failed to reset Secondary");
       ignore_reset_reason = false; // Don't ignore a secondary that resets
-      reset_sequence_state = SET_NORMAL_REBOOT_MODE;
+      server_core.reset_sequence_state = SET_NORMAL_REBOOT_MODE;
       break;
     default:
       BUG("Unhandled reset_callback status");
@@ -412,10 +505,12 @@ static void on_unsolicited_status(sl_cpc_system_status_t status)
 
   if (status <= STATUS_RESET_WATCHDOG && status >= STATUS_RESET_POWER_ON) {
     TRACE_RESET("Received reset reason : %u", status);
-    TRACE_RESET("Reset sequence: %u", reset_sequence_state);
+    TRACE_RESET("Reset sequence: %u", server_core.reset_sequence_state);
 
-    if (reset_sequence_state == WAIT_RESET_REASON) {
-      reset_reason_received = true;
+    if (server_core.reset_sequence_state == WAIT_RESET_REASON
+        || (server_core.reset_sequence_state == WAIT_FOR_SECONDARY_INFO && !server_core.reset_reason_received)) {
+      /* Also the reset reason of a secondary that took longer than CPCD_REBOOT_TIME_MS to reboot */
+      server_core.reset_reason_received = true;
     } else {
       int ret;
 
@@ -433,6 +528,16 @@ static void on_unsolicited_status(sl_cpc_system_status_t status)
         server_close_endpoint(i, false);
       }
 
+      /* The secondary went to install the image uploaded over CPC, the update is done */
+      if (firmware_upload_install_requested()) {
+        PRINT_INFO("Firmware upgrade successful");
+        if (config.restart_cpcd) {
+          config_restart_cpcd_without_fw_update_args();
+        } else {
+          config_exit_cpcd(EXIT_SUCCESS);
+        }
+      }
+
       /* Restart the daemon with the same arguments as this process */
       /* All file descriptors except stdout, stdin and stderr are supposed to be closed automatically with O_CLOEXEC */
       {
@@ -448,11 +553,35 @@ char* server_core_get_secondary_app_version(void)
 #if defined(UNIT_TESTING)
   return "UNDEFINED";
 #else
-  BUG_ON(server_core_secondary_app_version == NULL);
+  // Not fetched without the reset sequence, nor given by every secondary
+  if (server_core_secondary_app_version == NULL) {
+    return "UNDEFINED";
+  }
   return server_core_secondary_app_version;
 #endif
 }
 
+bool server_core_secondary_supports_session_resumption(void)
+{
+  // Only known after the reset sequence
+  return server_core.capabilities_received && (server_core.capabilities & CPC_CAPABILITIES_SESSION_RESUMPTION_MASK);
+}
+
+bool server_core_secondary_supports_fragmentation(void)
+{
+  return server_core.fragmentation;
+}
+
+bool server_core_secondary_supports_aggregation(void)
+{
+  return server_core.aggregation;
+}
+
+bool server_core_secondary_supports_compression(void)
+{
+  return server_core.compression;
+}
+
 #if !defined(UNIT_TESTING)
 static void property_get_capabilities_callback(sl_cpc_system_command_handle_t *handle,
                                                sl_cpc_property_id_t property_id,
@@ -466,25 +595,41 @@ static void property_get_capabilities_callback(sl_cpc_system_command_handle_t *h
   FATAL_ON(status != SL_STATUS_OK && status != SL_STATUS_IN_PROGRESS);
   FATAL_ON(property_value == NULL || property_length != sizeof(uint32_t));
 
-  capabilities = *((uint32_t *)property_value);
+  server_core.capabilities = *((uint32_t *)property_value);
 
-  if (capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK) {
+  if (server_core.capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK) {
     TRACE_RESET("Received capability : Security endpoint");
   }
 
-  if (capabilities & CPC_CAPABILITIES_PACKED_ENDPOINT_MASK) {
+  if (server_core.capabilities & CPC_CAPABILITIES_PACKED_ENDPOINT_MASK) {
     TRACE_RESET("Received capability : Packed endpoint");
   }
 
-  if (capabilities & CPC_CAPABILITIES_GPIO_ENDPOINT_MASK) {
+  if (server_core.capabilities & CPC_CAPABILITIES_GPIO_ENDPOINT_MASK) {
     TRACE_RESET("Received capability : GPIO endpoint");
   }
 
-  if (capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK) {
+  if (server_core.capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK) {
     TRACE_RESET("Received capability : UART flow control");
   }
 
-  capabilities_received = true;
+  if (server_core.capabilities & CPC_CAPABILITIES_SESSION_RESUMPTION_MASK) {
+    TRACE_RESET("Received capability : Session resumption");
+  }
+
+  if (server_core.capabilities & CPC_CAPABILITIES_FRAGMENTATION_MASK) {
+    TRACE_RESET("Received capability : Fragmentation");
+  }
+
+  if (server_core.capabilities & CPC_CAPABILITIES_AGGREGATION_MASK) {
+    TRACE_RESET("Received capability : Aggregation");
+  }
+
+  if (server_core.capabilities & CPC_CAPABILITIES_COMPRESSION_MASK) {
+    TRACE_RESET("Received capability : Compression");
+  }
+
+  server_core.capabilities_received = true;
 }
 
 static void property_get_rx_capability_callback(sl_cpc_system_command_handle_t *handle,
@@ -500,8 +645,48 @@ static void property_get_rx_capability_callback(sl_cpc_system_command_handle_t *
   FATAL_ON(property_value == NULL || property_length != sizeof(uint16_t));
 
   TRACE_RESET("Received RX capability of %u bytes", *((uint16_t *)property_value));
-  rx_capability = *((uint16_t *)property_value);
-  rx_capability_received = true;
+  server_core.rx_capability = *((uint16_t *)property_value);
+  server_core.rx_capability_received = true;
+}
+
+static void property_get_tx_window_size_callback(sl_cpc_system_command_handle_t *handle,
+                                                 sl_cpc_property_id_t property_id,
+                                                 void* property_value,
+                                                 size_t property_length,
+                                                 sl_status_t status)
+{
+  (void)handle;
+
+  if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS) && property_id == PROP_TX_WINDOW_SIZE) {
+    FATAL_ON(property_value == NULL || property_length != sizeof(uint8_t));
+
+    uint8_t secondary_tx_window_size = *((uint8_t *)property_value);
+
+    PRINT_INFO("Secondary supports a tx window of %u frames", secondary_tx_window_size);
+
+    /* The secondary transmits with its own window, whatever is agreed for ours */
+    server_core.secondary_tx_window_size = secondary_tx_window_size;
+    if (server_core.secondary_tx_window_size < 1) {
+      server_core.secondary_tx_window_size = 1;
+    } else if (server_core.secondary_tx_window_size > TRANSMIT_WINDOW_MAX_SIZE) {
+      server_core.secondary_tx_window_size = TRANSMIT_WINDOW_MAX_SIZE;
+    }
+
+    /* Use the largest window both sides agree on */
+    server_core.tx_window_size = (uint8_t)config.tx_window_size;
+    if (secondary_tx_window_size < server_core.tx_window_size) {
+      server_core.tx_window_size = secondary_tx_window_size;
+    }
+    if (server_core.tx_window_size < 1) {
+      server_core.tx_window_size = 1;
+    }
+  } else {
+    WARN("Secondary doesn't support a tx window larger than 1, falling back to a window of 1");
+    server_core.tx_window_size = 1;
+    server_core.secondary_tx_window_size = 1;
+  }
+
+  server_core.tx_window_size_received_or_not_available = true;
 }
 
 static void property_get_secondary_bootloader_info(sl_cpc_system_command_handle_t *handle,
@@ -519,12 +704,14 @@ static void property_get_secondary_bootloader_info(sl_cpc_system_command_handle_
     // property_value:
     //  [0]: bootloader type
     //  [1]: version (unused for now)
-    //  [2]: capability mask (unused for now)
+    //  [2]: capability mask
     server_core_secondary_bootloader_type = ((uint32_t*)property_value)[0];
     BUG_ON(server_core_secondary_bootloader_type >= SL_CPC_BOOTLOADER_UNKNOWN);
+    server_core_secondary_bootloader_capabilities = ((uint32_t*)property_value)[2];
 
-    PRINT_INFO("Secondary bootloader: %s",
-               sl_cpc_system_bootloader_type_to_str((sl_cpc_bootloader_t)server_core_secondary_bootloader_type));
+    PRINT_INFO("Secondary bootloader: %s, capabilities 0x%08x",
+               sl_cpc_system_bootloader_type_to_str((sl_cpc_bootloader_t)server_core_secondary_bootloader_type),
+               server_core_secondary_bootloader_capabilities);
   } else if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS) && property_id == PROP_LAST_STATUS) {
     WARN("Secondary doesn't implement bootloader information");
     server_core_secondary_bootloader_type = SL_CPC_BOOTLOADER_UNKNOWN;
@@ -533,7 +720,7 @@ static void property_get_secondary_bootloader_info(sl_cpc_system_command_handle_
     server_core_secondary_bootloader_type = SL_CPC_BOOTLOADER_UNKNOWN;
   }
 
-  bootloader_info_received_or_not_available = true;
+  server_core.bootloader_info_received_or_not_available = true;
 }
 
 static void property_get_secondary_cpc_version_callback(sl_cpc_system_command_handle_t *handle,
@@ -545,7 +732,6 @@ static void property_get_secondary_cpc_version_callback(sl_cpc_system_command_ha
   (void) handle;
 
   uint32_t version[3];
-  memcpy(version, property_value, 3 * sizeof(uint32_t));
 
   if ( (property_id != PROP_SECONDARY_CPC_VERSION)
        || (status != SL_STATUS_OK && status != SL_STATUS_IN_PROGRESS)
@@ -553,8 +739,10 @@ static void property_get_secondary_cpc_version_callback(sl_cpc_system_command_ha
     FATAL("Cannot get Secondary CPC version (obsolete RCP firmware?)");
   }
 
+  memcpy(version, property_value, 3 * sizeof(uint32_t));
+
   PRINT_INFO("Secondary CPC v%d.%d.%d", version[0], version[1], version[2]);
-  secondary_cpc_version_received = true;
+  server_core.secondary_cpc_version_received = true;
 }
 
 static void property_get_secondary_app_version_callback(sl_cpc_system_command_handle_t *handle,
@@ -583,7 +771,7 @@ static void property_get_secondary_app_version_callback(sl_cpc_system_command_ha
     WARN("Cannot get Secondary APP version (obsolete RCP firmware?)");
   }
 
-  secondary_app_version_received_or_not_available = true;
+  server_core.secondary_app_version_received_or_not_available = true;
 }
 
 static void property_get_secondary_bus_speed_callback(sl_cpc_system_command_handle_t *handle,
@@ -608,11 +796,212 @@ static void property_get_secondary_bus_speed_callback(sl_cpc_system_command_hand
             config.uart_baudrate, bus_speed);
     }
 
-    secondary_bus_speed_received = true;
+    server_core.secondary_bus_speed_received = true;
   } else {
     WARN("Could not obtain the secondary's bus speed");
-    failed_to_receive_secondary_bus_speed = true;
+    server_core.failed_to_receive_secondary_bus_speed = true;
+  }
+}
+
+static void property_get_secondary_max_bus_speed_callback(sl_cpc_system_command_handle_t *handle,
+                                                          sl_cpc_property_id_t property_id,
+                                                          void* property_value,
+                                                          size_t property_length,
+                                                          sl_status_t status)
+{
+  (void) handle;
+
+  if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS) && property_id == PROP_BUS_SPEED_MAX) {
+    FATAL_ON(property_value == NULL);
+    FATAL_ON(property_length != sizeof(uint32_t));
+
+    memcpy(&server_core.secondary_max_bus_speed, property_value, sizeof(uint32_t));
+
+    PRINT_INFO("Secondary supports a bus speed up to %u", server_core.secondary_max_bus_speed);
+  } else {
+    WARN("Secondary doesn't support changing its bus speed, staying at %u", config.uart_baudrate);
+    server_core.secondary_max_bus_speed = 0;
   }
+
+  server_core.secondary_max_bus_speed_received_or_not_available = true;
+}
+
+static void property_set_bus_speed_callback(sl_cpc_system_command_handle_t *handle,
+                                            sl_cpc_property_id_t property_id,
+                                            void* property_value,
+                                            size_t property_length,
+                                            sl_status_t status)
+{
+  (void) handle;
+
+  server_core.bus_speed_switch_acked = (status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS)
+                           && property_id == PROP_BUS_SPEED_VALUE
+                           && property_value != NULL
+                           && property_length == sizeof(uint32_t)
+                           && memcmp(property_value, &server_core.bus_speed_candidate, sizeof(uint32_t)) == 0;
+
+  server_core.bus_speed_switch_replied = true;
+}
+
+static void property_set_fragmentation_callback(sl_cpc_system_command_handle_t *handle,
+                                                sl_cpc_property_id_t property_id,
+                                                void* property_value,
+                                                size_t property_length,
+                                                sl_status_t status)
+{
+  (void) handle;
+
+  if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS)
+      && property_id == PROP_FRAGMENTATION
+      && property_value != NULL
+      && property_length == sizeof(uint8_t)
+      && *(uint8_t *)property_value == 1) {
+    TRACE_RESET("Fragmentation enabled on the secondary");
+    return;
+  }
+
+  /* The endpoints that enabled it in the meantime keep it for what they send */
+  WARN("The secondary did not enable fragmentation, writes larger than a frame are refused");
+  server_core.fragmentation = false;
+}
+
+/* The secondary only fragments what it sends once it knows the daemon reassembles */
+static void enable_secondary_fragmentation(void)
+{
+  static const uint8_t enable = 1;
+
+  server_core.fragmentation = true;
+
+  sl_cpc_system_cmd_property_set(property_set_fragmentation_callback,
+                                 5,       /* 5 retries */
+                                 100000,  /* 100ms between retries*/
+                                 PROP_FRAGMENTATION,
+                                 &enable,
+                                 sizeof(enable),
+                                 true);
+}
+
+static void property_set_aggregation_callback(sl_cpc_system_command_handle_t *handle,
+                                              sl_cpc_property_id_t property_id,
+                                              void* property_value,
+                                              size_t property_length,
+                                              sl_status_t status)
+{
+  (void) handle;
+
+  if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS)
+      && property_id == PROP_AGGREGATION
+      && property_value != NULL
+      && property_length == sizeof(uint8_t)
+      && *(uint8_t *)property_value == 1) {
+    TRACE_RESET("Aggregation enabled on the secondary");
+    return;
+  }
+
+  /* The endpoints that enabled it in the meantime are only refused new aggregates */
+  WARN("The secondary did not enable aggregation, messages are sent in their own frames");
+  server_core.aggregation = false;
+}
+
+/* The secondary only aggregates what it sends once it knows the daemon splits */
+static void enable_secondary_aggregation(void)
+{
+  static const uint8_t enable = 1;
+
+  server_core.aggregation = true;
+
+  sl_cpc_system_cmd_property_set(property_set_aggregation_callback,
+                                 5,       /* 5 retries */
+                                 100000,  /* 100ms between retries*/
+                                 PROP_AGGREGATION,
+                                 &enable,
+                                 sizeof(enable),
+                                 true);
+}
+
+static void property_set_compression_callback(sl_cpc_system_command_handle_t *handle,
+                                              sl_cpc_property_id_t property_id,
+                                              void* property_value,
+                                              size_t property_length,
+                                              sl_status_t status)
+{
+  (void) handle;
+
+  if ((status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS)
+      && property_id == PROP_COMPRESSION
+      && property_value != NULL
+      && property_length == sizeof(uint8_t)
+      && *(uint8_t *)property_value == 1) {
+    TRACE_RESET("Compression enabled on the secondary");
+    return;
+  }
+
+  /* The frames already compressed are in flight, the next ones are not compressed */
+  WARN("The secondary did not enable compression, payloads are sent as they are");
+  server_core.compression = false;
+}
+
+/* The secondary only compresses what it sends once it knows the daemon decompresses */
+static void enable_secondary_compression(void)
+{
+  static const uint8_t enable = 1;
+
+  // The flag takes a bit of the length field, the frames must stay under 16 KiB,
+  // FCS and a security tag of up to 16 bytes included
+  if (server_core.rx_capability + SLI_CPC_HDLC_FCS_SIZE + 16u > SLI_CPC_HDLC_LENGTH_MAX) {
+    WARN("Compression is not enabled, the secondary accepts frames too large for it");
+    return;
+  }
+
+  server_core.compression = true;
+
+  sl_cpc_system_cmd_property_set(property_set_compression_callback,
+                                 5,       /* 5 retries */
+                                 100000,  /* 100ms between retries*/
+                                 PROP_COMPRESSION,
+                                 &enable,
+                                 sizeof(enable),
+                                 true);
+}
+
+static void property_get_bus_speed_confirmation_callback(sl_cpc_system_command_handle_t *handle,
+                                                         sl_cpc_property_id_t property_id,
+                                                         void* property_value,
+                                                         size_t property_length,
+                                                         sl_status_t status)
+{
+  (void) handle;
+
+  server_core.bus_speed_confirmed = (status == SL_STATUS_OK || status == SL_STATUS_IN_PROGRESS)
+                        && property_id == PROP_BUS_SPEED_VALUE
+                        && property_value != NULL
+                        && property_length == sizeof(uint32_t)
+                        && memcmp(property_value, &server_core.bus_speed_candidate, sizeof(uint32_t)) == 0;
+
+  server_core.bus_speed_confirmation_replied = true;
+}
+
+/*
+ * The secondary acknowledges a new bus speed at the current one, switches, and
+ * goes back to config.uart_baudrate unless a frame reaches it at the new speed
+ * in less than 500ms, the time the confirmation below is retried for. Each
+ * step that fails falls back to the next lower baud rate, down to the one the
+ * secondary reset to.
+ */
+static void request_bus_speed_switch(uint32_t baudrate)
+{
+  server_core.bus_speed_candidate = baudrate;
+  server_core.bus_speed_switch_replied = false;
+
+  TRACE_RESET("Requesting a bus speed of %u", server_core.bus_speed_candidate);
+
+  sl_cpc_system_cmd_property_set(property_set_bus_speed_callback,
+                                 5,       /* 5 retries */
+                                 100000,  /* 100ms between retries*/
+                                 PROP_BUS_SPEED_VALUE,
+                                 &server_core.bus_speed_candidate,
+                                 sizeof(server_core.bus_speed_candidate),
+                                 true);
 }
 
 static void property_get_protocol_version_callback(sl_cpc_system_command_handle_t *handle,
@@ -634,7 +1023,7 @@ static void property_get_protocol_version_callback(sl_cpc_system_command_handle_
   server_core_secondary_protocol_version = *version;
   PRINT_INFO("Secondary Protocol v%d", server_core_secondary_protocol_version);
 
-  protocol_version_received = true;
+  server_core.protocol_version_received = true;
 }
 
 static void exit_server_core(void)
@@ -647,16 +1036,16 @@ static void exit_server_core(void)
 
 static void capabilities_checks(void)
 {
-  if ((config.bus == UART) && (config.uart_hardflow != (bool)(capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK))) {
+  if ((config.bus == UART) && (config.uart_hardflow != (bool)(server_core.capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK))) {
     FATAL("UART flow control configuration mismatch between CPCd (%s) and Secondary (%s)",
           config.uart_hardflow ? "enabled" : "disabled",
-          (bool)(capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK) ? "enabled" : "disabled");
+          (bool)(server_core.capabilities & CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK) ? "enabled" : "disabled");
   }
 
-  if (config.use_encryption != (bool)(capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK)) {
+  if (config.use_encryption != (bool)(server_core.capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK)) {
     FATAL("Security configuration mismatch between CPCd (%s) and Secondary (%s)",
           config.use_encryption ? "enabled" : "disabled",
-          (bool)(capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK) ? "enabled" : "disabled");
+          (bool)(server_core.capabilities & CPC_CAPABILITIES_SECURITY_ENDPOINT_MASK) ? "enabled" : "disabled");
   }
 }
 
@@ -679,9 +1068,169 @@ static void application_version_check(void)
   }
 }
 
+/*
+ * The properties below don't depend on one another, they are all requested at
+ * once and the secondary answers them back to back instead of one round trip
+ * at a time. The replies are matched to their command by sequence number.
+ */
+static void request_secondary_info(bool firmware_reset_mode)
+{
+  static const struct {
+    sl_cpc_property_id_t property_id;
+    sl_cpc_system_property_get_set_cmd_callback_t callback;
+  } queries[] = {
+    { PROP_RX_CAPABILITY, property_get_rx_capability_callback },
+    { PROP_PROTOCOL_VERSION, property_get_protocol_version_callback },
+    { PROP_CAPABILITIES, property_get_capabilities_callback },
+    { PROP_SECONDARY_CPC_VERSION, property_get_secondary_cpc_version_callback },
+    { PROP_BUS_SPEED_VALUE, property_get_secondary_bus_speed_callback },
+    { PROP_SECONDARY_APP_VERSION, property_get_secondary_app_version_callback },
+  };
+  size_t i;
+
+  for (i = 0; i < ARRAY_SIZE(queries); i++) {
+    sl_cpc_system_cmd_property_get(queries[i].callback,
+                                   queries[i].property_id,
+                                   5,       /* 5 retries */
+                                   100000,  /* 100ms between retries*/
+                                   true);
+  }
+
+  if (firmware_reset_mode) {
+    // Fetch bootloader information only if in firmware reset mode
+    sl_cpc_system_cmd_property_get(property_get_secondary_bootloader_info,
+                                   PROP_BOOTLOADER_INFO,
+                                   5,       /* 5 retries */
+                                   100000,  /* 100ms between retries*/
+                                   true);
+  } else if (config.tx_window_size > 1) {
+    sl_cpc_system_cmd_property_get(property_get_tx_window_size_callback,
+                                   PROP_TX_WINDOW_SIZE,
+                                   5,       /* 5 retries */
+                                   100000,  /* 100ms between retries*/
+                                   true);
+  }
+
+  TRACE_RESET("Secondary information requested");
+}
+
+static bool secondary_info_received(bool firmware_reset_mode)
+{
+  if (!server_core.rx_capability_received
+      || !server_core.protocol_version_received
+      || !server_core.capabilities_received
+      || !server_core.secondary_cpc_version_received
+      || !(server_core.secondary_bus_speed_received || server_core.failed_to_receive_secondary_bus_speed)
+      || !server_core.secondary_app_version_received_or_not_available) {
+    return false;
+  }
+
+  if (firmware_reset_mode) {
+    return server_core.bootloader_info_received_or_not_available;
+  } else if (config.tx_window_size > 1) {
+    return server_core.tx_window_size_received_or_not_available;
+  }
+
+  return true;
+}
+
+static void on_reboot_wait_timeout(epoll_timer_t *timer)
+{
+  (void)timer;
+
+  server_core.reboot_wait_expired = true;
+}
+
+static void complete_reset_sequence(bool firmware_reset_mode)
+{
+  if (server_core_secondary_app_version) {
+    TRACE_RESET("Obtained Secondary APP version");
+  }
+
+  if (config.print_secondary_versions_and_exit) {
+    config_exit_cpcd(EXIT_SUCCESS);
+  }
+
+  if (!firmware_reset_mode) {
+    application_version_check();
+  }
+
+  server_core.reset_sequence_state = RESET_SEQUENCE_DONE;
+
+  if (firmware_reset_mode) {
+    exit_server_core();
+  } else {
+    if (config.fragmentation && (server_core.capabilities & CPC_CAPABILITIES_FRAGMENTATION_MASK)) {
+      enable_secondary_fragmentation();
+    }
+    if (config.aggregation && (server_core.capabilities & CPC_CAPABILITIES_AGGREGATION_MASK)) {
+      enable_secondary_aggregation();
+    }
+    if (config.compression && (server_core.capabilities & CPC_CAPABILITIES_COMPRESSION_MASK)) {
+      enable_secondary_compression();
+    }
+    core_init_buffer_pools();
+    server_init();
+#if defined(ENABLE_ENCRYPTION)
+    security_init();
+#endif
+    memlock_startup_done();
+    PRINT_INFO("Daemon startup was successful. Waiting for client connections");
+  }
+}
+
+/* What complete_reset_sequence() does, with what the reset sequence of the previous daemon learned */
+static void server_core_resume(void)
+{
+  const handoff_secondary_t *secondary = handoff_get_secondary();
+
+  server_core.rx_capability = secondary->rx_capability;
+  server_core.capabilities = secondary->capabilities;
+  server_core.fragmentation = secondary->fragmentation;
+  server_core.aggregation = secondary->aggregation;
+  server_core.compression = secondary->compression;
+  server_core.tx_window_size = secondary->tx_window_size;
+  server_core.secondary_tx_window_size = secondary->secondary_tx_window_size;
+  server_core.secondary_max_bus_speed = secondary->secondary_max_bus_speed;
+  server_core_secondary_protocol_version = secondary->protocol_version;
+  if (secondary->app_version[0] != '\0') {
+    server_core_secondary_app_version = strdup(secondary->app_version);
+    FATAL_ON(server_core_secondary_app_version == NULL);
+  }
+
+  /* The secondary was not reset, a reset reason from it is news */
+  ignore_reset_reason = false;
+  server_core.reset_sequence_state = RESET_SEQUENCE_DONE;
+
+  core_init_buffer_pools();
+  server_init();
+  handoff_resume();
+#if defined(ENABLE_ENCRYPTION)
+  security_init();
+#endif
+  memlock_startup_done();
+  PRINT_INFO("Daemon took the link over. Waiting for client connections");
+}
+
+void server_core_export_secondary(handoff_secondary_t *secondary)
+{
+  secondary->rx_capability = server_core.rx_capability;
+  secondary->capabilities = server_core.capabilities;
+  secondary->fragmentation = server_core.fragmentation;
+  secondary->aggregation = server_core.aggregation;
+  secondary->compression = server_core.compression;
+  secondary->tx_window_size = server_core.tx_window_size;
+  secondary->secondary_tx_window_size = server_core.secondary_tx_window_size;
+  secondary->secondary_max_bus_speed = server_core.secondary_max_bus_speed;
+  secondary->protocol_version = server_core_secondary_protocol_version;
+  if (server_core_secondary_app_version != NULL) {
+    strncpy(secondary->app_version, server_core_secondary_app_version, sizeof(secondary->app_version) - 1);
+  }
+}
+
 static void process_reset_sequence(bool firmware_reset_mode)
 {
-  switch (reset_sequence_state) {
+  switch (server_core.reset_sequence_state) {
     case RESET_SEQUENCE_DONE:
       return;
 
@@ -692,7 +1241,7 @@ static void process_reset_sequence(bool firmware_reset_mode)
       {
         const sl_cpc_system_reboot_mode_t reboot_mode = REBOOT_APPLICATION;
 
-        pending_mode = reboot_mode;
+        server_core.pending_mode = reboot_mode;
 
         sl_cpc_system_cmd_property_set(property_set_reset_mode_callback,
                                        1,       /* retry once */
@@ -702,7 +1251,7 @@ static void process_reset_sequence(bool firmware_reset_mode)
                                        sizeof(reboot_mode),
                                        true);
 
-        reset_sequence_state = WAIT_NORMAL_REBOOT_MODE_ACK;
+        server_core.reset_sequence_state = WAIT_NORMAL_REBOOT_MODE_ACK;
 
         TRACE_RESET("Reboot mode sent");
       }
@@ -710,16 +1259,16 @@ static void process_reset_sequence(bool firmware_reset_mode)
 
     case WAIT_NORMAL_REBOOT_MODE_ACK:
 
-      if (set_reset_mode_ack == true) {
+      if (server_core.set_reset_mode_ack == true) {
         /* Now, request a reset  */
         sl_cpc_system_cmd_reboot(reset_callback,
                                  5,     /* 5 retries */
                                  100000 /* 100ms between retries*/);
 
-        reset_sequence_state = WAIT_NORMAL_RESET_ACK;
+        server_core.reset_sequence_state = WAIT_NORMAL_RESET_ACK;
 
         /* Set it back to false because it will be used for the bootloader reboot sequence */
-        set_reset_mode_ack = false;
+        server_core.set_reset_mode_ack = false;
 
         TRACE_RESET("Reboot mode reply received, reset request sent");
       }
@@ -727,11 +1276,15 @@ static void process_reset_sequence(bool firmware_reset_mode)
 
     case WAIT_NORMAL_RESET_ACK:
 
-      if (reset_ack == true) {
-        reset_sequence_state = WAIT_RESET_REASON;
+      if (server_core.reset_ack == true) {
+        server_core.reset_sequence_state = WAIT_RESET_REASON;
+
+        /* The reset reason tells when the secondary is back, this is only an upper bound */
+        epoll_timer_init(&server_core.reboot_wait_timer, on_reboot_wait_timeout);
+        epoll_timer_start(&server_core.reboot_wait_timer, (uint64_t)CPCD_REBOOT_TIME_MS * 1000u);
 
         /* Set it back to false because it will be used for the bootloader reboot sequence */
-        reset_ack = false;
+        server_core.reset_ack = false;
 
         TRACE_RESET("Reset request acknowledged");
       }
@@ -739,132 +1292,108 @@ static void process_reset_sequence(bool firmware_reset_mode)
 
     case WAIT_RESET_REASON:
       TRACE_RESET("Waiting for reset reason");
-      if (reset_reason_received) {
-        TRACE_RESET("Reset reason received");
-        reset_sequence_state = WAIT_FOR_RX_CAPABILITY;
-        sl_cpc_system_cmd_property_get(property_get_rx_capability_callback,
-                                       PROP_RX_CAPABILITY,
-                                       5,       /* 5 retries */
-                                       100000,  /* 100ms between retries*/
-                                       true);
+      if (server_core.reset_reason_received || server_core.reboot_wait_expired) {
+        epoll_timer_stop(&server_core.reboot_wait_timer);
+        if (server_core.reset_reason_received) {
+          TRACE_RESET("Reset reason received");
+        } else {
+          WARN("No reset reason from the secondary after %d ms, probing it", CPCD_REBOOT_TIME_MS);
+        }
+        server_core.reset_sequence_state = WAIT_FOR_SECONDARY_INFO;
+        request_secondary_info(firmware_reset_mode);
       }
       break;
 
-    case WAIT_FOR_RX_CAPABILITY:
-      if (rx_capability_received) {
-        TRACE_RESET("Obtained RX capability");
+    case WAIT_FOR_SECONDARY_INFO:
+      if (secondary_info_received(firmware_reset_mode)) {
+        TRACE_RESET("Obtained the secondary information");
         PRINT_INFO("Connected to Secondary");
-        reset_sequence_state = WAIT_FOR_PROTOCOL_VERSION;
-        sl_cpc_system_cmd_property_get(property_get_protocol_version_callback,
-                                       PROP_PROTOCOL_VERSION,
-                                       5,      /* 5 retries */
-                                       100000, /* 100ms between retries*/
-                                       true);
-      }
-      break;
 
-    case WAIT_FOR_PROTOCOL_VERSION:
-      if (protocol_version_received) {
-        TRACE_RESET("Obtained Protocol version");
         if (!firmware_reset_mode) {
           protocol_version_check();
-        }
-        reset_sequence_state = WAIT_FOR_CAPABILITIES;
-        sl_cpc_system_cmd_property_get(property_get_capabilities_callback,
-                                       PROP_CAPABILITIES,
-                                       5,       /* 5 retries */
-                                       100000,  /* 100ms between retries*/
-                                       true);
-      }
-      break;
-
-    case WAIT_FOR_CAPABILITIES:
-      if (capabilities_received) {
-        TRACE_RESET("Obtained Capabilites");
-        if (!firmware_reset_mode) {
           capabilities_checks();
 
-          reset_sequence_state = WAIT_FOR_SECONDARY_CPC_VERSION;
-          sl_cpc_system_cmd_property_get(property_get_secondary_cpc_version_callback,
-                                         PROP_SECONDARY_CPC_VERSION,
+          if (config.tx_window_size > 1) {
+            TRACE_RESET("Negotiated a tx window of %u frames, the secondary transmits with %u",
+                        server_core.tx_window_size, server_core.secondary_tx_window_size);
+          }
+        }
+
+        if (!firmware_reset_mode
+            && server_core.secondary_bus_speed_received
+            && config.bus == UART
+            && config.uart_max_baudrate > config.uart_baudrate) {
+          server_core.reset_sequence_state = WAIT_FOR_SECONDARY_MAX_BUS_SPEED;
+          sl_cpc_system_cmd_property_get(property_get_secondary_max_bus_speed_callback,
+                                         PROP_BUS_SPEED_MAX,
                                          5,       /* 5 retries */
                                          100000,  /* 100ms between retries*/
                                          true);
         } else {
-          // Fetch bootloader information only if in firmware reset mode
-          reset_sequence_state = WAIT_FOR_BOOTLOADER_INFO;
-          sl_cpc_system_cmd_property_get(property_get_secondary_bootloader_info,
-                                         PROP_BOOTLOADER_INFO,
-                                         5,       /* 5 retries */
-                                         100000,  /* 100ms between retries*/
-                                         true);
+          complete_reset_sequence(firmware_reset_mode);
         }
       }
       break;
 
-    case WAIT_FOR_BOOTLOADER_INFO:
-      if (bootloader_info_received_or_not_available) {
-        TRACE_RESET("Obtained secondary bootloader information");
+    case WAIT_FOR_SECONDARY_MAX_BUS_SPEED:
+      if (server_core.secondary_max_bus_speed_received_or_not_available) {
+        uint32_t limit = config.uart_max_baudrate;
 
-        reset_sequence_state = WAIT_FOR_SECONDARY_CPC_VERSION;
-        sl_cpc_system_cmd_property_get(property_get_secondary_cpc_version_callback,
-                                       PROP_SECONDARY_CPC_VERSION,
-                                       5,       /* 5 retries */
-                                       100000,  /* 100ms between retries*/
-                                       true);
-      }
-
-      break;
+        if (server_core.secondary_max_bus_speed < limit) {
+          limit = server_core.secondary_max_bus_speed;
+        }
 
-    case WAIT_FOR_SECONDARY_CPC_VERSION:
-      if (secondary_cpc_version_received) {
-        TRACE_RESET("Obtained Secondary CPC version");
+        uint32_t baudrate = driver_uart_get_highest_baudrate(limit);
 
-        reset_sequence_state = WAIT_FOR_SECONDARY_BUS_SPEED;
-        sl_cpc_system_cmd_property_get(property_get_secondary_bus_speed_callback,
-                                       PROP_BUS_SPEED_VALUE,
-                                       5,       /* 5 retries */
-                                       100000,  /* 100ms between retries*/
-                                       true);
+        if (baudrate > config.uart_baudrate) {
+          server_core.reset_sequence_state = WAIT_FOR_BUS_SPEED_SWITCH;
+          request_bus_speed_switch(baudrate);
+        } else {
+          complete_reset_sequence(firmware_reset_mode);
+        }
       }
       break;
 
-    case WAIT_FOR_SECONDARY_BUS_SPEED:
-      if (secondary_bus_speed_received || failed_to_receive_secondary_bus_speed) {
-        reset_sequence_state = WAIT_FOR_SECONDARY_APP_VERSION;
+    case WAIT_FOR_BUS_SPEED_SWITCH:
+      if (server_core.bus_speed_switch_replied) {
+        if (server_core.bus_speed_switch_acked) {
+          driver_uart_set_baudrate(server_core.bus_speed_candidate);
 
-        sl_cpc_system_cmd_property_get(property_get_secondary_app_version_callback,
-                                       PROP_SECONDARY_APP_VERSION,
-                                       5,       /* 5 retries */
-                                       100000,  /* 100ms between retries*/
-                                       true);
+          server_core.reset_sequence_state = WAIT_FOR_BUS_SPEED_CONFIRMATION;
+          server_core.bus_speed_confirmation_replied = false;
+          sl_cpc_system_cmd_property_get(property_get_bus_speed_confirmation_callback,
+                                         PROP_BUS_SPEED_VALUE,
+                                         5,       /* 5 retries */
+                                         100000,  /* 100ms between retries*/
+                                         true);
+        } else {
+          /* The secondary refused the speed or never got the request, it stays where it is */
+          WARN("Secondary didn't switch to a bus speed of %u, staying at %u",
+               server_core.bus_speed_candidate, config.uart_baudrate);
+          complete_reset_sequence(firmware_reset_mode);
+        }
       }
       break;
 
-    case WAIT_FOR_SECONDARY_APP_VERSION:
-      if (secondary_app_version_received_or_not_available) {
-        if (server_core_secondary_app_version) {
-          TRACE_RESET("Obtained Secondary APP version");
-        }
-
-        if (config.print_secondary_versions_and_exit) {
-          config_exit_cpcd(EXIT_SUCCESS);
-        }
+    case WAIT_FOR_BUS_SPEED_CONFIRMATION:
+      if (server_core.bus_speed_confirmation_replied) {
+        if (server_core.bus_speed_confirmed) {
+          PRINT_INFO("Switched the bus speed to %u", server_core.bus_speed_candidate);
+          complete_reset_sequence(firmware_reset_mode);
+        } else {
+          uint32_t baudrate = driver_uart_get_highest_baudrate(server_core.bus_speed_candidate - 1);
 
-        if (!firmware_reset_mode) {
-          application_version_check();
-        }
+          WARN("The link doesn't work at a bus speed of %u", server_core.bus_speed_candidate);
 
-        reset_sequence_state = RESET_SEQUENCE_DONE;
+          /* The secondary went back to the speed it reset to by now */
+          driver_uart_set_baudrate(config.uart_baudrate);
 
-        if (firmware_reset_mode) {
-          exit_server_core();
-        } else {
-          server_init();
-#if defined(ENABLE_ENCRYPTION)
-          security_init();
-#endif
-          PRINT_INFO("Daemon startup was successful. Waiting for client connections");
+          if (baudrate > config.uart_baudrate) {
+            server_core.reset_sequence_state = WAIT_FOR_BUS_SPEED_SWITCH;
+            request_bus_speed_switch(baudrate);
+          } else {
+            complete_reset_sequence(firmware_reset_mode);
+          }
         }
       }
       break;
@@ -877,13 +1406,13 @@ static void process_reset_sequence(bool firmware_reset_mode)
 
 static void process_reboot_enter_bootloader(void)
 {
-  switch (reboot_into_bootloader_state) {
+  switch (server_core.reboot_into_bootloader_state) {
     case SET_BOOTLOADER_REBOOT_MODE:
       /* Send a request to the secondary to set the reboot mode to 'application' */
     {
       const sl_cpc_system_reboot_mode_t reboot_mode = REBOOT_BOOTLOADER;
 
-      pending_mode = reboot_mode;
+      server_core.pending_mode = reboot_mode;
 
       sl_cpc_system_cmd_property_set(property_set_reset_mode_callback,
                                      1,         /* retry once */
@@ -893,27 +1422,27 @@ static void process_reboot_enter_bootloader(void)
                                      sizeof(reboot_mode),
                                      true);
 
-      reboot_into_bootloader_state = WAIT_BOOTLOADER_REBOOT_MODE_ACK;
+      server_core.reboot_into_bootloader_state = WAIT_BOOTLOADER_REBOOT_MODE_ACK;
 
       TRACE_RESET("Bootloader reboot mode sent");
     }
     break;
 
     case WAIT_BOOTLOADER_REBOOT_MODE_ACK:
-      if (set_reset_mode_ack == true) {
+      if (server_core.set_reset_mode_ack == true) {
         /* Now, request a reset  */
         sl_cpc_system_cmd_reboot(reset_callback,
                                  5,     /* 5 retries */
                                  100000 /* 100ms between retries*/);
 
-        reboot_into_bootloader_state = WAIT_BOOTLOADER_RESET_ACK;
+        server_core.reboot_into_bootloader_state = WAIT_BOOTLOADER_RESET_ACK;
 
         TRACE_RESET("Reboot mode reply received, reset request sent");
       }
       break;
 
     case WAIT_BOOTLOADER_RESET_ACK:
-      if (reset_ack == true) {
+      if (server_core.reset_ack == true) {
         TRACE_RESET("Reset request acknowledged");
         exit_server_core();
       }
@@ -970,7 +1499,7 @@ static void security_fetch_remote_security_state(epoll_private_data_t *private_d
 
   (void)private_data;
 
-  size = read(security_ready_eventfd, &event_value, sizeof(event_value));
+  size = read(server_core.security_ready_eventfd, &event_value, sizeof(event_value));
   FATAL_ON(size != sizeof(event_value));
 
 #if !defined(UNIT_TESTING)
@@ -984,5 +1513,5 @@ static void security_fetch_remote_security_state(epoll_private_data_t *private_d
 
 bool server_core_reset_sequence_in_progress(void)
 {
-  return reset_sequence_state != RESET_SEQUENCE_DONE;
+  return server_core.reset_sequence_state != RESET_SEQUENCE_DONE;
 }
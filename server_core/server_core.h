@@ -24,6 +24,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "server_core/handoff/handoff.h"
+
 typedef enum {
   SERVER_CORE_MODE_NORMAL,
   SERVER_CORE_MODE_FIRMWARE_BOOTLOADER,
@@ -32,6 +34,10 @@ typedef enum {
 
 uint32_t server_core_get_secondary_rx_capability(void);
 
+uint8_t server_core_get_tx_window_size(void);
+
+uint8_t server_core_get_secondary_tx_window_size(void);
+
 pthread_t server_core_init(int fd_socket_driver_core, int fd_socket_driver_core_notify, server_core_mode_t mode);
 
 void server_core_kill_signal(void);
@@ -42,4 +48,15 @@ bool server_core_reset_sequence_in_progress(void);
 
 char* server_core_get_secondary_app_version(void);
 
+bool server_core_secondary_supports_session_resumption(void);
+
+bool server_core_secondary_supports_fragmentation(void);
+
+bool server_core_secondary_supports_aggregation(void);
+
+bool server_core_secondary_supports_compression(void);
+
+/* Hot restart, what the reset sequence learned. The bus and the command sequence are left to the caller */
+void server_core_export_secondary(handoff_secondary_t *secondary);
+
 #endif //SERVER_CORE_H
@@ -17,7 +17,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include "server_core/core/hdlc.h"
@@ -55,12 +54,22 @@
  ******************************************************************************/
 #define ENDPOINT_CLOSE_RETRY_TIMEOUT 100000
 
-static sl_slist_node_t *pending_commands;
-static sl_slist_node_t *commands;
-static sl_slist_node_t *retries;
-static sl_slist_node_t *commands_in_error;
+static struct {
+  sl_slist_node_t *pending_commands;
+  /* Commands in flight, any number of them, each with its own retransmit timer.
+   * A reply is matched to its command by the command sequence number. */
+  sl_slist_node_t *commands;
+  sl_slist_node_t *retries;
+  sl_slist_node_t *commands_in_error;
 
-static bool received_remote_sequence_numbers_reset_ack = true;
+  bool received_remote_sequence_numbers_reset_ack;
+
+  sl_slist_node_t *prop_last_status_callbacks;
+
+  uint8_t next_command_seq;
+} sys = {
+  .received_remote_sequence_numbers_reset_ack = true,
+};
 
 extern bool ignore_reset_reason;
 
@@ -69,12 +78,10 @@ typedef struct {
   sl_cpc_system_unsolicited_status_callback_t callback;
 }prop_last_status_callback_list_item_t;
 
-static sl_slist_node_t *prop_last_status_callbacks;
-
 static void on_iframe_unsolicited(uint8_t endpoint_id, const void* data, size_t data_len);
 static void on_uframe_receive(uint8_t endpoint_id, const void* data, size_t data_len);
 static void on_reply(uint8_t endpoint_id, void *arg, void *answer, uint32_t answer_lenght);
-static void on_timer_expired(epoll_private_data_t *private_data);
+static void on_timer_expired(epoll_timer_t *timer);
 static void write_command(sl_cpc_system_command_handle_t *command_handle);
 
 static void sl_cpc_system_cmd_abort(sl_cpc_system_command_handle_t *command_handle, sl_status_t error);
@@ -102,7 +109,6 @@ static void sl_cpc_system_init_command_handle(sl_cpc_system_command_handle_t *co
                                               uint32_t retry_timeout_us,
                                               bool is_uframe)
 {
-  static uint8_t next_command_seq = 0;
 
   BUG_ON(command_handle == NULL);
   BUG_ON(on_final == NULL);
@@ -112,8 +118,9 @@ static void sl_cpc_system_init_command_handle(sl_cpc_system_command_handle_t *co
   command_handle->on_final = on_final;
   command_handle->retry_count = retry_count;
   command_handle->retry_timeout_us = retry_timeout_us;
-  command_handle->command_seq = next_command_seq++;
+  command_handle->command_seq = sys.next_command_seq++;
   command_handle->is_uframe = is_uframe;
+  epoll_timer_init(&command_handle->re_transmit_timer, on_timer_expired);
 }
 
 const char* sl_cpc_system_bootloader_type_to_str(sl_cpc_bootloader_t bootloader)
@@ -136,11 +143,11 @@ const char* sl_cpc_system_bootloader_type_to_str(sl_cpc_bootloader_t bootloader)
 
 void sl_cpc_system_init(void)
 {
-  sl_slist_init(&commands);
-  sl_slist_init(&retries);
-  sl_slist_init(&pending_commands);
-  sl_slist_init(&commands_in_error);
-  sl_slist_init(&prop_last_status_callbacks);
+  sl_slist_init(&sys.commands);
+  sl_slist_init(&sys.retries);
+  sl_slist_init(&sys.pending_commands);
+  sl_slist_init(&sys.commands_in_error);
+  sl_slist_init(&sys.prop_last_status_callbacks);
 
   sl_cpc_system_open_endpoint();
 }
@@ -152,7 +159,7 @@ void sl_cpc_system_register_unsolicited_prop_last_status_callback(sl_cpc_system_
 
   item->callback = callback;
 
-  sl_slist_push_back(&prop_last_status_callbacks, &item->node);
+  sl_slist_push_back(&sys.prop_last_status_callbacks, &item->node);
 }
 
 /***************************************************************************//**
@@ -161,13 +168,7 @@ void sl_cpc_system_register_unsolicited_prop_last_status_callback(sl_cpc_system_
 static void sl_cpc_system_cmd_abort(sl_cpc_system_command_handle_t *command_handle, sl_status_t error)
 {
   // Stop the re_transmit timer
-  if (command_handle->re_transmit_timer_private_data.file_descriptor != 0) {
-    if (command_handle->is_uframe || command_handle->acked == true) {
-      epoll_unregister(&command_handle->re_transmit_timer_private_data);
-    }
-    close(command_handle->re_transmit_timer_private_data.file_descriptor);
-    command_handle->re_transmit_timer_private_data.file_descriptor = 0;
-  }
+  epoll_timer_stop(&command_handle->re_transmit_timer);
 
   command_handle->error_status = error; //This will be propagated when calling the callbacks
 
@@ -216,7 +217,7 @@ static void sl_cpc_system_cmd_timed_out(const void *frame_data)
   timed_out_command = (sl_cpc_system_cmd_t *)frame_data;
 
   /* Go through the list of pending requests to find the one for which this reply applies */
-  SL_SLIST_FOR_EACH_ENTRY(commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
+  SL_SLIST_FOR_EACH_ENTRY(sys.commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
     if (command_handle->command_seq == timed_out_command->command_seq) {
       break;
     }
@@ -227,7 +228,7 @@ static void sl_cpc_system_cmd_timed_out(const void *frame_data)
   }
 
   // We won't need this command anymore. It needs to be resubmitted.
-  sl_slist_remove(&commands, &command_handle->node_commands);
+  sl_slist_remove(&sys.commands, &command_handle->node_commands);
 
   TRACE_SYSTEM("Command ID #%u SEQ #%u timeout", command_handle->command->command_id, command_handle->command->command_seq);
 
@@ -242,39 +243,18 @@ static void sl_cpc_system_cmd_timed_out(const void *frame_data)
 /***************************************************************************//**
 * Start the process timer once the poll command has been acknowledged
 *******************************************************************************/
-void sl_cpc_system_cmd_poll_acknowledged(const void *frame_data)
+void sl_cpc_system_cmd_poll_acknowledged(uint8_t command_seq)
 {
-  int timer_fd, ret;
   sl_cpc_system_command_handle_t *command_handle;
-  FATAL_ON(frame_data == NULL);
-  sl_cpc_system_cmd_t *acked_command = (sl_cpc_system_cmd_t *)frame_data;
 
   // Go through the command list to figure out which command just got acknowledged
-  SL_SLIST_FOR_EACH_ENTRY(commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
-    if (command_handle->command_seq == acked_command->command_seq) {
+  SL_SLIST_FOR_EACH_ENTRY(sys.commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
+    if (command_handle->command_seq == command_seq) {
       TRACE_SYSTEM("Secondary acknowledged command_id #%d command_seq #%d", command_handle->command->command_id, command_handle->command_seq);
-      const struct itimerspec timeout = { .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
-                                          .it_value    = { .tv_sec = (long int)command_handle->retry_timeout_us / 1000000, .tv_nsec = ((long int)command_handle->retry_timeout_us * 1000) % 1000000000 } };
-
-      /* Setup timeout timer.*/
-      if (command_handle->error_status == SL_STATUS_OK) {
-        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-
-        FATAL_SYSCALL_ON(timer_fd < 0);
-
-        ret = timerfd_settime(timer_fd, 0, &timeout, NULL);
-        FATAL_SYSCALL_ON(ret < 0);
-
-        /* Setup the timer in the server_core epoll set */
-        command_handle->re_transmit_timer_private_data.endpoint_number = SL_CPC_ENDPOINT_SYSTEM; //Irrelevant in this scenario
-        command_handle->re_transmit_timer_private_data.file_descriptor = timer_fd;
-        command_handle->re_transmit_timer_private_data.callback = on_timer_expired;
-
-        epoll_register(&command_handle->re_transmit_timer_private_data);
-      } else if (command_handle->error_status == SL_STATUS_IN_PROGRESS) {
-        // Simply restart the timer
-        ret = timerfd_settime(command_handle->re_transmit_timer_private_data.file_descriptor, 0, &timeout, NULL);
-        FATAL_SYSCALL_ON(ret < 0);
+      /* Setup timeout timer, or simply restart it if a retry already occurred */
+      if (command_handle->error_status == SL_STATUS_OK
+          || command_handle->error_status == SL_STATUS_IN_PROGRESS) {
+        epoll_timer_start(&command_handle->re_transmit_timer, command_handle->retry_timeout_us);
       } else {
         WARN("Received ACK on a command that timed out or is processed.. ignoring");
       }
@@ -363,7 +343,26 @@ void sl_cpc_system_cmd_reboot(sl_cpc_system_reset_cmd_callback_t on_reset_reply,
  ******************************************************************************/
 bool sl_cpc_system_received_unnumbered_acknowledgement(void)
 {
-  return received_remote_sequence_numbers_reset_ack;
+  return sys.received_remote_sequence_numbers_reset_ack;
+}
+
+bool sl_cpc_system_is_idle(void)
+{
+  return sys.pending_commands == NULL
+         && sys.commands == NULL
+         && sys.retries == NULL
+         && sys.commands_in_error == NULL
+         && sys.received_remote_sequence_numbers_reset_ack;
+}
+
+uint8_t sl_cpc_system_get_next_command_seq(void)
+{
+  return sys.next_command_seq;
+}
+
+void sl_cpc_system_set_next_command_seq(uint8_t command_seq)
+{
+  sys.next_command_seq = command_seq;
 }
 
 /***************************************************************************//**
@@ -375,56 +374,40 @@ void sl_cpc_system_on_unnumbered_acknowledgement(void)
   sl_cpc_system_command_handle_t *command_handle;
 
   TRACE_SYSTEM("Received sequence numbers reset acknowledgement");
-  received_remote_sequence_numbers_reset_ack = true;
+  sys.received_remote_sequence_numbers_reset_ack = true;
 
   // Send any pending commands
-  item = sl_slist_pop(&pending_commands);
+  item = sl_slist_pop(&sys.pending_commands);
   while (item != NULL) {
     command_handle = SL_SLIST_ENTRY(item, sl_cpc_system_command_handle_t, node_commands);
     write_command(command_handle);
-    item = sl_slist_pop(&pending_commands);
+    item = sl_slist_pop(&sys.pending_commands);
   }
 }
 
 /***************************************************************************//**
  * Callback for the unnumered acknowledge timeout
  ******************************************************************************/
-static void on_unnumbered_acknowledgement_timeout(epoll_private_data_t *private_data)
+static void on_unnumbered_acknowledgement_timeout(epoll_timer_t *timer)
 {
   sl_slist_node_t *item;
-  int timer_fd = private_data->file_descriptor;
-  sl_cpc_system_command_handle_t *command_handle = container_of(private_data,
+  sl_cpc_system_command_handle_t *command_handle = container_of(timer,
                                                                 sl_cpc_system_command_handle_t,
-                                                                re_transmit_timer_private_data);
+                                                                re_transmit_timer);
 
   if (sl_cpc_system_received_unnumbered_acknowledgement()) {
-    // Unnumbered ack was processed, stop the timeout timer
-    if (command_handle->re_transmit_timer_private_data.file_descriptor != 0) {
-      epoll_unregister(&command_handle->re_transmit_timer_private_data);
-      close(command_handle->re_transmit_timer_private_data.file_descriptor);
-      command_handle->re_transmit_timer_private_data.file_descriptor = 0;
-    }
+    // Unnumbered ack was processed, the timeout timer is not re-armed
+    free(command_handle);
     return;
   }
 
   TRACE_SYSTEM("Remote is unresponsive, retrying...");
 
-  /* Ack the timer */
-  {
-    uint64_t expiration;
-    ssize_t retval;
-
-    retval = read(timer_fd, &expiration, sizeof(expiration));
-
-    FATAL_SYSCALL_ON(retval < 0);
-
-    FATAL_ON(retval != sizeof(expiration));
-
-    WARN_ON(expiration != 1); /* we missed a timeout*/
-  }
+  /* Periodic timer, re-arm it */
+  epoll_timer_start(timer, UNNUMBERED_ACK_TIMEOUT_SECONDS * 1000000u);
 
   /* Drop any pending commands to prevent accumulation*/
-  item = sl_slist_pop(&pending_commands);
+  item = sl_slist_pop(&sys.pending_commands);
   while (item != NULL) {
     command_handle = SL_SLIST_ENTRY(item, sl_cpc_system_command_handle_t, node_commands);
 
@@ -433,7 +416,7 @@ static void on_unnumbered_acknowledgement_timeout(epoll_private_data_t *private_
     }
     free(command_handle->command);
     free(command_handle);
-    item = sl_slist_pop(&pending_commands);
+    item = sl_slist_pop(&sys.pending_commands);
   }
 
   core_write(SL_CPC_ENDPOINT_SYSTEM, NULL, 0, SL_CPC_FLAG_UNNUMBERED_RESET_COMMAND);
@@ -444,7 +427,6 @@ static void on_unnumbered_acknowledgement_timeout(epoll_private_data_t *private_
  ******************************************************************************/
 void sl_cpc_system_request_sequence_reset(void)
 {
-  int timer_fd, ret;
   sl_cpc_system_command_handle_t *command_handle;
 
   sl_cpc_system_reset_system_endpoint();
@@ -456,29 +438,13 @@ void sl_cpc_system_request_sequence_reset(void)
   core_process_transmit_queue();
 
   // Register a timeout timer in case we don't receive an unnumbered acknowledgement
-  const struct itimerspec timeout = { .it_interval = { .tv_sec = UNNUMBERED_ACK_TIMEOUT_SECONDS, .tv_nsec = 0 },
-                                      .it_value    = { .tv_sec = UNNUMBERED_ACK_TIMEOUT_SECONDS, .tv_nsec = 0 } };
-
-  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-
-  FATAL_SYSCALL_ON(timer_fd < 0);
-
-  ret = timerfd_settime(timer_fd, 0, &timeout, NULL);
-  FATAL_SYSCALL_ON(ret < 0);
-
   command_handle = zalloc(sizeof(sl_cpc_system_command_handle_t));
   FATAL_ON(command_handle == NULL);
 
-  /* Setup the timer in the server_core epoll set */
-  command_handle->re_transmit_timer_private_data.file_descriptor = timer_fd;
-  command_handle->re_transmit_timer_private_data.callback = on_unnumbered_acknowledgement_timeout;
-
-  epoll_register(&command_handle->re_transmit_timer_private_data);
+  epoll_timer_init(&command_handle->re_transmit_timer, on_unnumbered_acknowledgement_timeout);
+  epoll_timer_start(&command_handle->re_transmit_timer, UNNUMBERED_ACK_TIMEOUT_SECONDS * 1000000u);
 
-  ret = timerfd_settime(command_handle->re_transmit_timer_private_data.file_descriptor, 0, &timeout, NULL);
-  FATAL_SYSCALL_ON(ret < 0);
-
-  received_remote_sequence_numbers_reset_ack = false;
+  sys.received_remote_sequence_numbers_reset_ack = false;
 }
 
 /***************************************************************************//**
@@ -490,7 +456,7 @@ void sl_cpc_system_reset_system_endpoint(void)
   sl_cpc_system_command_handle_t *command_handle;
 
   // Abort any pending commands
-  item = sl_slist_pop(&commands);
+  item = sl_slist_pop(&sys.commands);
   while (item != NULL) {
     command_handle = SL_SLIST_ENTRY(item, sl_cpc_system_command_handle_t, node_commands);
 
@@ -502,7 +468,7 @@ void sl_cpc_system_reset_system_endpoint(void)
     // Command payload will be freed once we close the endpoint
     free(command_handle->command);
     free(command_handle);
-    item = sl_slist_pop(&commands);
+    item = sl_slist_pop(&sys.commands);
   }
 
   // Close the system endpoint
@@ -705,13 +671,18 @@ static void on_final_property_is(sl_cpc_system_command_handle_t * command_handle
     } else
 #endif // ENABLE_ENCRYPTION
     if (property_cmd->property_id != PROP_RX_CAPABILITY
+        && property_cmd->property_id != PROP_TX_WINDOW_SIZE
         && property_cmd->property_id != PROP_CAPABILITIES
         && property_cmd->property_id != PROP_BUS_SPEED_VALUE
+        && property_cmd->property_id != PROP_BUS_SPEED_MAX
         && property_cmd->property_id != PROP_PROTOCOL_VERSION
         && property_cmd->property_id != PROP_BOOTLOADER_INFO
         && property_cmd->property_id != PROP_SECONDARY_CPC_VERSION
         && property_cmd->property_id != PROP_SECONDARY_APP_VERSION
         && property_cmd->property_id != PROP_BOOTLOADER_REBOOT_MODE
+        && property_cmd->property_id != PROP_FRAGMENTATION
+        && property_cmd->property_id != PROP_AGGREGATION
+        && property_cmd->property_id != PROP_COMPRESSION
         && property_cmd->property_id != PROP_LAST_STATUS) {
       FATAL("Received on_final property_is %x as a u-frame", property_cmd->property_id);
     }
@@ -748,17 +719,15 @@ static void on_reply(uint8_t endpoint_id,
   FATAL_ON(reply->length != answer_lenght - sizeof(sl_cpc_system_cmd_t));
 
   /* Go through the list of pending requests to find the one for which this reply applies */
-  SL_SLIST_FOR_EACH_ENTRY(commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
+  SL_SLIST_FOR_EACH_ENTRY(sys.commands, command_handle, sl_cpc_system_command_handle_t, node_commands) {
     if (command_handle->command_seq == reply->command_seq) {
       TRACE_SYSTEM("Processing command seq#%d of type %d", reply->command_seq, frame_type);
 
       /* Stop and close the retransmit timer */
       if (frame_type == SLI_CPC_HDLC_FRAME_TYPE_UNNUMBERED
           || (frame_type == SLI_CPC_HDLC_FRAME_TYPE_INFORMATION && command_handle->acked == true)) {
-        BUG_ON(command_handle->re_transmit_timer_private_data.file_descriptor <= 0);
-        epoll_unregister(&command_handle->re_transmit_timer_private_data);
-        close(command_handle->re_transmit_timer_private_data.file_descriptor);
-        command_handle->re_transmit_timer_private_data.file_descriptor = 0;
+        BUG_ON(!epoll_timer_is_running(&command_handle->re_transmit_timer));
+        epoll_timer_stop(&command_handle->re_transmit_timer);
       }
 
       /* Call the appropriate callback */
@@ -800,7 +769,7 @@ static void on_reply(uint8_t endpoint_id,
       }
 
       /* Cleanup this command now that it's been serviced */
-      sl_slist_remove(&commands, &command_handle->node_commands);
+      sl_slist_remove(&sys.commands, &command_handle->node_commands);
       free(command_handle->command);
       free(command_handle);
 
@@ -827,7 +796,7 @@ static void on_uframe_receive(uint8_t endpoint_id, const void* data, size_t data
     if (property->property_id == PROP_LAST_STATUS) {
       prop_last_status_callback_list_item_t *item;
 
-      SL_SLIST_FOR_EACH_ENTRY(prop_last_status_callbacks, item, prop_last_status_callback_list_item_t, node) {
+      SL_SLIST_FOR_EACH_ENTRY(sys.prop_last_status_callbacks, item, prop_last_status_callback_list_item_t, node) {
         sl_cpc_system_status_t* status = (sl_cpc_system_status_t*) property->payload;
 
         item->callback(*status);
@@ -893,35 +862,20 @@ static void on_iframe_unsolicited(uint8_t endpoint_id, const void* data, size_t
 /***************************************************************************//**
  * System endpoint timer expire callback
  ******************************************************************************/
-static void on_timer_expired(epoll_private_data_t *private_data)
+static void on_timer_expired(epoll_timer_t *timer)
 {
-  int timer_fd = private_data->file_descriptor;
-  sl_cpc_system_command_handle_t *command_handle = container_of(private_data,
+  sl_cpc_system_command_handle_t *command_handle = container_of(timer,
                                                                 sl_cpc_system_command_handle_t,
-                                                                re_transmit_timer_private_data);
+                                                                re_transmit_timer);
 
   TRACE_SYSTEM("Command ID #%u SEQ #%u timer expired", command_handle->command->command_id, command_handle->command->command_seq);
 
-  /* Ack the timer */
-  {
-    uint64_t expiration;
-    ssize_t retval;
-
-    retval = read(timer_fd, &expiration, sizeof(expiration));
-
-    FATAL_SYSCALL_ON(retval < 0);
-
-    FATAL_ON(retval != sizeof(expiration));
-
-    WARN_ON(expiration != 1); /* we missed a timeout*/
-  }
-
   if (!command_handle->retry_forever) {
     command_handle->retry_count--;
   }
 
   if (command_handle->retry_count > 0 || command_handle->retry_forever) {
-    sl_slist_remove(&commands, &command_handle->node_commands);
+    sl_slist_remove(&sys.commands, &command_handle->node_commands);
 
     command_handle->error_status = SL_STATUS_IN_PROGRESS; //at least one timer retry occurred
 
@@ -942,7 +896,6 @@ static void on_timer_expired(epoll_private_data_t *private_data)
  ******************************************************************************/
 static void write_command(sl_cpc_system_command_handle_t *command_handle)
 {
-  int timer_fd;
   uint8_t flags = SL_CPC_FLAG_INFORMATION_POLL;
 
   if (command_handle->retry_count == 0) {
@@ -959,13 +912,13 @@ static void write_command(sl_cpc_system_command_handle_t *command_handle)
   // Can't send iframe commands on the system endpoint until the sequence numbers are reset
   if (!command_handle->is_uframe) {
     if (!sl_cpc_system_received_unnumbered_acknowledgement()) {
-      sl_slist_push_back(&pending_commands, &command_handle->node_commands);
+      sl_slist_push_back(&sys.pending_commands, &command_handle->node_commands);
       return;
     }
   }
 #endif
 
-  sl_slist_push_back(&commands, &command_handle->node_commands);
+  sl_slist_push_back(&sys.commands, &command_handle->node_commands);
 
   command_handle->acked = false;
 
@@ -978,30 +931,7 @@ static void write_command(sl_cpc_system_command_handle_t *command_handle)
 
   if (command_handle->is_uframe) {
     /* Setup timeout timer.*/
-    {
-      const struct itimerspec timeout = { .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
-                                          .it_value    = { .tv_sec = (long int)command_handle->retry_timeout_us / 1000000, .tv_nsec = ((long int)command_handle->retry_timeout_us * 1000) % 1000000000 } };
-
-      timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-
-      FATAL_SYSCALL_ON(timer_fd < 0);
-
-      int ret = timerfd_settime(timer_fd,
-                                0,
-                                &timeout,
-                                NULL);
-
-      FATAL_SYSCALL_ON(ret < 0);
-    }
-
-    /* Setup the timer in the server_core epoll set */
-    {
-      command_handle->re_transmit_timer_private_data.endpoint_number = SL_CPC_ENDPOINT_SYSTEM;
-      command_handle->re_transmit_timer_private_data.file_descriptor = timer_fd;
-      command_handle->re_transmit_timer_private_data.callback = on_timer_expired;
-
-      epoll_register(&command_handle->re_transmit_timer_private_data);
-    }
+    epoll_timer_start(&command_handle->re_transmit_timer, command_handle->retry_timeout_us);
   }
 }
 
@@ -1012,11 +942,11 @@ void sl_cpc_system_cleanup(void)
 
   TRACE_RESET("Server core cleanup");
 
-  item = sl_slist_pop(&prop_last_status_callbacks);
+  item = sl_slist_pop(&sys.prop_last_status_callbacks);
   while (item != NULL) {
     callback_list_item = SL_SLIST_ENTRY(item, prop_last_status_callback_list_item_t, node);
     free(callback_list_item);
-    item = sl_slist_pop(&pending_commands);
+    item = sl_slist_pop(&sys.pending_commands);
   }
 
   // Close the system endpoint
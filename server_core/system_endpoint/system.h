@@ -19,6 +19,7 @@
 #define EP_SYSTEM_H
 
 #include "server_core/epoll/epoll.h"
+#include "server_core/epoll/timer.h"
 #include "misc/sl_slist.h"
 #include "sl_cpc.h"
 #include "misc/sl_status.h"
@@ -60,8 +61,10 @@ SL_ENUM_GENERIC(sl_cpc_property_id_t, uint32_t)
   PROP_SECONDARY_CPC_VERSION  = 0x03,
   PROP_SECONDARY_APP_VERSION  = 0x04,
   PROP_RX_CAPABILITY          = 0x20,
+  PROP_TX_WINDOW_SIZE         = 0x21,
   PROP_FC_VALIDATION_VALUE    = 0x30,
   PROP_BUS_SPEED_VALUE        = 0x40,
+  PROP_BUS_SPEED_MAX          = 0x41,
   PROP_BOOTLOADER_INFO        = 0x200,
   PROP_BOOTLOADER_REBOOT_MODE = 0x202,
   PROP_SECURITY_STATE         = 0x301,
@@ -69,6 +72,9 @@ SL_ENUM_GENERIC(sl_cpc_property_id_t, uint32_t)
   PROP_UFRAME_PROCESSING      = 0x500,
   PROP_ENTER_IRQ              = 0x600,
   PROP_ENDPOINT_ENCRYPTION    = 0x700,
+  PROP_FRAGMENTATION          = 0x800,
+  PROP_AGGREGATION            = 0x900,
+  PROP_COMPRESSION            = 0xA00,
   PROP_ENDPOINT_STATE_0       = 0x1000,
   PROP_ENDPOINT_STATE_1       = 0x1001,
   PROP_ENDPOINT_STATE_2       = 0x1002,
@@ -459,6 +465,21 @@ typedef struct {
 #define CPC_CAPABILITIES_PACKED_ENDPOINT_MASK   (1 << 1)
 #define CPC_CAPABILITIES_GPIO_ENDPOINT_MASK     (1 << 2)
 #define CPC_CAPABILITIES_UART_FLOW_CONTROL_MASK (1 << 3)
+#define CPC_CAPABILITIES_SESSION_RESUMPTION_MASK (1 << 4)
+#define CPC_CAPABILITIES_FRAGMENTATION_MASK     (1 << 5)
+#define CPC_CAPABILITIES_AGGREGATION_MASK       (1 << 6)
+#define CPC_CAPABILITIES_COMPRESSION_MASK       (1 << 7)
+
+/***************************************************************************//**
+ * Bootloader capabilities mask
+ *
+ * @note
+ *   Used with the capability mask returned by a property-get on
+ *   PROP_BOOTLOADER_INFO
+ *
+ ******************************************************************************/
+#define CPC_BOOTLOADER_CAPABILITIES_XMODEM_1K_MASK        (1 << 0)
+#define CPC_BOOTLOADER_CAPABILITIES_XMODEM_STREAMING_MASK (1 << 1)
 
 /***************************************************************************//**
  * System endpoint command type
@@ -492,7 +513,7 @@ typedef struct  {
   sl_status_t error_status;
   uint8_t command_seq;
   bool acked;
-  epoll_private_data_t re_transmit_timer_private_data; //for epoll for timerfd
+  epoll_timer_t re_transmit_timer;
 } sl_cpc_system_command_handle_t;
 
 void sl_cpc_system_init(void);
@@ -609,7 +630,7 @@ void sl_cpc_system_request_sequence_reset(void);
 /***************************************************************************//**
  * Acknowledge the system command
  ******************************************************************************/
-void sl_cpc_system_cmd_poll_acknowledged(const void *data);
+void sl_cpc_system_cmd_poll_acknowledged(uint8_t command_seq);
 
 /***************************************************************************//**
  * Return true if a previously requested sequence numbers reset was acknowledged
@@ -626,6 +647,18 @@ void sl_cpc_system_on_unnumbered_acknowledgement(void);
  ******************************************************************************/
 void sl_cpc_system_cleanup(void);
 
+/***************************************************************************//**
+ * Return true if no command is queued, in flight, retried nor in error and no
+ * sequence numbers reset is pending. See handoff.h
+ ******************************************************************************/
+bool sl_cpc_system_is_idle(void);
+
+/***************************************************************************//**
+ * Sequence number of the next command, carried over a hot restart
+ ******************************************************************************/
+uint8_t sl_cpc_system_get_next_command_seq(void);
+void sl_cpc_system_set_next_command_seq(uint8_t command_seq);
+
 /***************************************************************************//**
  * Convert bootloader type to string
  ******************************************************************************/
@@ -19,6 +19,7 @@
 #include <sys/socket.h>
 
 #include "misc/config.h"
+#include "misc/endianess.h"
 #include "server_core/system_endpoint/system_callbacks.h"
 #include "server_core/core/core.h"
 #include "server_core/server/server.h"
@@ -26,22 +27,56 @@
 #include "lib/sl_cpc.h"
 #include "server_core/cpcd_exchange.h"
 
-static int fd_ctrl_data_of_pending_open = 0;
+/*
+ * Open handshakes in flight, keyed by endpoint id. Several endpoints can be
+ * opened at the same time, but only one handshake runs per endpoint.
+ */
+typedef struct {
+  int fd_ctrl_data_socket;
+  sl_cpc_system_open_step_t step;
+} pending_open_t;
 
-#if defined(ENABLE_ENCRYPTION)
-static uint8_t ep_id_encryption_queried = 0;
-#endif
-
-sl_cpc_system_open_step_t system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_IDLE;
+static struct {
+  pending_open_t pending_opens[SL_CPC_ENDPOINT_MAX_COUNT];
+  size_t pending_opens_count;
+} system_callbacks;
 
 bool sl_cpc_system_is_waiting_for_status_reply(void)
 {
-  return fd_ctrl_data_of_pending_open != 0;
+  return system_callbacks.pending_opens_count != 0;
+}
+
+void sl_cpc_system_set_pending_connection(uint8_t endpoint_id, int fd)
+{
+  if (system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket == 0 && fd != 0) {
+    system_callbacks.pending_opens_count++;
+  } else if (system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket != 0 && fd == 0) {
+    system_callbacks.pending_opens_count--;
+  }
+
+  system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket = fd;
+}
+
+sl_cpc_system_open_step_t sl_cpc_system_get_open_step(uint8_t endpoint_id)
+{
+  return system_callbacks.pending_opens[endpoint_id].step;
 }
 
-void sl_cpc_system_set_pending_connection(int fd)
+void sl_cpc_system_set_open_step(uint8_t endpoint_id, sl_cpc_system_open_step_t step)
 {
-  fd_ctrl_data_of_pending_open = fd;
+  system_callbacks.pending_opens[endpoint_id].step = step;
+}
+
+/***************************************************************************//**
+ * Endpoint targeted by a property-get issued for a pending open. The reply
+ * doesn't always carry it (eg. a "not implemented" status), but the command
+ * that was sent does.
+ ******************************************************************************/
+static uint8_t system_get_queried_endpoint_id(const sl_cpc_system_command_handle_t *handle)
+{
+  const sl_cpc_system_property_cmd_t *tx_property_command = (const sl_cpc_system_property_cmd_t *)handle->command->payload;
+
+  return PROPERTY_ID_TO_EP_ID(le32_to_cpu(tx_property_command->property_id));
 }
 
 void reply_to_closing_endpoint_on_secondary_async_callback(sl_cpc_system_command_handle_t *handle,
@@ -113,7 +148,14 @@ static void system_send_open_endpoint_ack(uint8_t endpoint_id, bool can_open)
   interface_buffer->endpoint_number = endpoint_id;
   memcpy(interface_buffer->payload, &can_open, sizeof(bool));
 
-  ssize_t ret = send(fd_ctrl_data_of_pending_open, interface_buffer, buffer_len, 0);
+  /* The client closed its control connection meanwhile */
+  if (system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket == -1) {
+    TRACE_SERVER("Client of the open query on ep#%d is gone", endpoint_id);
+    system_callbacks.pending_opens[endpoint_id].step = SL_CPC_SYSTEM_OPEN_STEP_DONE;
+    return;
+  }
+
+  ssize_t ret = send(system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket, interface_buffer, buffer_len, 0);
   TRACE_SERVER("Replied to endpoint open query on ep#%d", endpoint_id);
 
   if (ret == -1) {
@@ -123,7 +165,7 @@ static void system_send_open_endpoint_ack(uint8_t endpoint_id, bool can_open)
         endpoint_id, (int)ret, (int)buffer_len);
   }
 
-  system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_DONE;
+  system_callbacks.pending_opens[endpoint_id].step = SL_CPC_SYSTEM_OPEN_STEP_DONE;
 }
 
 /***************************************************************************//**
@@ -148,10 +190,9 @@ void property_get_single_endpoint_state_and_reply_to_pending_open_callback(sl_cp
                                                                            size_t property_length,
                                                                            sl_status_t status)
 {
-  (void) handle;
   bool can_open = false;
   bool secondary_reachable = false;
-  uint8_t endpoint_id;
+  uint8_t endpoint_id = system_get_queried_endpoint_id(handle);
   cpc_endpoint_state_t remote_endpoint_state;
 
   switch (status) {
@@ -180,7 +221,7 @@ void property_get_single_endpoint_state_and_reply_to_pending_open_callback(sl_cp
   /* Sanity checks */
   {
     /* This callback should be called only when we need to reply to a client pending on an open_endpoint call */
-    BUG_ON(fd_ctrl_data_of_pending_open == 0);
+    BUG_ON(system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket == 0);
 
     /* This function's signature is for all properties get/set. Make sure we
      * are dealing with PROP_ENDPOINT_STATE and with the correct property_length*/
@@ -191,8 +232,6 @@ void property_get_single_endpoint_state_and_reply_to_pending_open_callback(sl_cp
     }
   }
 
-  endpoint_id = PROPERTY_ID_TO_EP_ID(property_id);
-
   if (secondary_reachable && (remote_endpoint_state == SL_CPC_STATE_OPEN)
       && (core_get_endpoint_state(endpoint_id) == SL_CPC_STATE_CLOSED || core_get_endpoint_state(endpoint_id) == SL_CPC_STATE_OPEN)) {
     can_open = true;
@@ -214,12 +253,8 @@ void property_get_single_endpoint_state_and_reply_to_pending_open_callback(sl_cp
   } else {
     if (config.use_encryption) {
 #if defined(ENABLE_ENCRYPTION)
-      // As the secondary might not implement the encryption per-endpoint
-      // and reply with a "not implemented" message (that doesn't contain
-      // the endpoint ID), it must be stored to be accessed later
-      ep_id_encryption_queried = endpoint_id;
-
-      system_open_ep_step = SL_CPC_SYSTEM_OPEN_STEP_STATE_FETCHED;
+      // The server fetches the encryption state next
+      system_callbacks.pending_opens[endpoint_id].step = SL_CPC_SYSTEM_OPEN_STEP_STATE_FETCHED;
 #else
       // Don't bother asking for encryption state, acknowledge
       // endpoint opening to the control socket
@@ -240,9 +275,11 @@ void property_get_single_endpoint_encryption_state_and_reply_to_pending_open_cal
                                                                                       size_t property_length,
                                                                                       sl_status_t status)
 {
-  (void) handle;
   (void) property_length;
-  uint8_t endpoint_id = 0;
+  // As the secondary might not implement the encryption per-endpoint and
+  // reply with a "not implemented" message (that doesn't contain the
+  // endpoint ID), it is taken from the command that was sent
+  uint8_t endpoint_id = system_get_queried_endpoint_id(handle);
   bool encryption;
   bool secondary_reachable = false;
 
@@ -266,12 +303,11 @@ void property_get_single_endpoint_encryption_state_and_reply_to_pending_open_cal
   }
 
   /* This callback should be called only when we need to reply to a client pending on an open_endpoint call */
-  BUG_ON(fd_ctrl_data_of_pending_open == 0);
+  BUG_ON(system_callbacks.pending_opens[endpoint_id].fd_ctrl_data_socket == 0);
 
   if (secondary_reachable) {
     if (property_id >= EP_ID_TO_PROPERTY_ENCRYPTION(0) && property_id <= EP_ID_TO_PROPERTY_ENCRYPTION(255)) {
-      endpoint_id = PROPERTY_ID_TO_EP_ID(property_id);
-      FATAL_ON(ep_id_encryption_queried != endpoint_id);
+      FATAL_ON(PROPERTY_ID_TO_EP_ID(property_id) != endpoint_id);
 
       encryption = *((bool*)property_value);
       TRACE_SERVER("Secondary has per-endpoint encryption: ep#%d: encryption=%d",
@@ -283,17 +319,16 @@ void property_get_single_endpoint_encryption_state_and_reply_to_pending_open_cal
       FATAL_ON(status != STATUS_PROP_NOT_FOUND);
 
       encryption = true;
-      endpoint_id = ep_id_encryption_queried;
       TRACE_SERVER("Secondary doesn't have per-endpoint encryption, forcing encryption of ep#%d", endpoint_id);
     } else {
-      WARN("Unexpected property reply when fetching encryption state of ep#%d", ep_id_encryption_queried);
+      WARN("Unexpected property reply when fetching encryption state of ep#%d", endpoint_id);
       system_finalize_open_endpoint(endpoint_id, false, false);
       return;
     }
 
     system_finalize_open_endpoint(endpoint_id, encryption, true);
   } else {
-    WARN("Could not read endpoint encryption state for ep#%d on the secondary", ep_id_encryption_queried);
+    WARN("Could not read endpoint encryption state for ep#%d on the secondary", endpoint_id);
     system_finalize_open_endpoint(endpoint_id, false, false);
   }
 }
@@ -31,9 +31,10 @@ typedef enum {
   SL_CPC_SYSTEM_OPEN_STEP_DONE,
 } sl_cpc_system_open_step_t;
 
-extern sl_cpc_system_open_step_t system_open_ep_step;
+sl_cpc_system_open_step_t sl_cpc_system_get_open_step(uint8_t endpoint_id);
+void sl_cpc_system_set_open_step(uint8_t endpoint_id, sl_cpc_system_open_step_t step);
 
-void sl_cpc_system_set_pending_connection(int fd);
+void sl_cpc_system_set_pending_connection(uint8_t endpoint_id, int fd);
 bool sl_cpc_system_is_waiting_for_status_reply(void);
 
 void reply_to_closing_endpoint_on_secondary_async_callback(sl_cpc_system_command_handle_t *handle,